@@ -0,0 +1,1067 @@
+/**
+ * vdb_bench.c - Benchmark suite for the VDB vector database
+ *
+ * Scenarios (all by default, or pick with --scenario):
+ * - distance: kernel throughput (GFLOP/s) per ISA and metric
+ * - ingest: append throughput and latency for each durability mode
+ *   and I/O backend
+ * - search: exact and HNSW QPS, latency percentiles and recall@k for a
+ *   sweep of efSearch values
+ * - open: cold-open time (page cache dropped) and first-query latency
+ *
+ * Data is a seeded synthetic clustered set (SIFT-like), or real data
+ * from --base / --query (.fvecs) and optionally --groundtruth (.ivecs).
+ * Runs are reproducible for a given seed. Progress goes to stderr and
+ * the results, as one JSON object, to stdout or --out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "vdb/types.h"
+#include "vdb/storage.h"
+#include "vdb/distance.h"
+#include "vdb/import.h"
+
+#define VDB_VERSION "0.1.0"
+
+#define BENCH_PATH_MAX 1024
+
+/* Clusters in the synthetic data set, and their spread */
+#define BENCH_CLUSTERS 64
+#define BENCH_CLUSTER_SIGMA 0.15
+
+/* Rows per append_batch when loading */
+#define BENCH_LOAD_BATCH 1000
+
+/* Rows scored per kernel call, and how long each kernel runs */
+#define BENCH_KERNEL_ROWS 1024
+#define BENCH_KERNEL_SECONDS 0.2
+
+/* Threads appending at once in the group commit mode */
+#define BENCH_COMMIT_THREADS 4
+
+/* Group commit window */
+#define BENCH_COMMIT_WINDOW_US 200
+
+/* Cold opens measured (the median is reported) */
+#define BENCH_OPEN_RUNS 5
+
+typedef struct {
+    bool distance;
+    bool ingest;
+    bool search;
+    bool open;
+
+    uint32_t dim;
+    uint64_t rows;
+    uint32_t queries;
+    uint32_t k;
+    uint64_t ingest_rows;
+    vdb_metric_t metric;
+    uint64_t seed;
+    uint32_t ef[16];
+    size_t num_ef;
+    uint32_t m;
+    uint32_t ef_construction;
+
+    const char *base_path;
+    const char *query_path;
+    const char *truth_path;
+    const char *data_dir;
+    const char *out_path;
+} bench_config_t;
+
+/**
+ * Queries and their true neighbours (row numbers)
+*/
+typedef struct {
+    float *queries; // num * dim
+    uint32_t num;
+    uint32_t *truth; // num * k, filled by the exact run unless loaded
+    uint32_t truth_k;
+    bool truth_loaded;
+} bench_queries_t;
+
+typedef struct {
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+} latency_t;
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                             */
+/* ------------------------------------------------------------------ */
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double rand_uniform(uint64_t *state) {
+    return (double)(splitmix64(state) >> 11) / 9007199254740992.0;
+}
+
+static double rand_normal(uint64_t *state) {
+    double u1 = rand_uniform(state);
+    double u2 = rand_uniform(state);
+    if (u1 < 1e-300) {
+        u1 = 1e-300;
+    }
+    return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+/**
+ * Cluster centers of the synthetic set, the same for a given seed
+*/
+static float *make_centers(const bench_config_t *cfg) {
+    float *centers = (float*)malloc((size_t)BENCH_CLUSTERS * cfg->dim * sizeof(float));
+    if (centers == NULL) {
+        return NULL;
+    }
+    uint64_t state = cfg->seed;
+    for (size_t i = 0; i < (size_t)BENCH_CLUSTERS * cfg->dim; i++) {
+        centers[i] = (float)(rand_uniform(&state) * 2.0 - 1.0);
+    }
+    return centers;
+}
+
+/**
+ * Synthetic vector number i of a stream (base rows and queries use
+ * different streams)
+*/
+static void make_vector(const bench_config_t *cfg, const float *centers, uint64_t stream, uint64_t i,
+                        float *out) {
+    uint64_t state = cfg->seed ^ (stream << 48) ^ (i * 0x2545f4914f6cdd1dull);
+    const float *center = centers + (splitmix64(&state) % BENCH_CLUSTERS) * cfg->dim;
+    for (uint32_t d = 0; d < cfg->dim; d++) {
+        out[d] = center[d] + (float)(rand_normal(&state) * BENCH_CLUSTER_SIGMA);
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Percentiles (nearest rank) of n samples in seconds, reported in us
+ * Sorts samples.
+*/
+static latency_t percentiles(double *samples, size_t n) {
+    latency_t lat = { 0, 0, 0, 0, 0 };
+    if (n == 0) {
+        return lat;
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    lat.p50 = samples[(size_t)ceil(0.50 * (double)n) - 1] * 1e6;
+    lat.p90 = samples[(size_t)ceil(0.90 * (double)n) - 1] * 1e6;
+    lat.p99 = samples[(size_t)ceil(0.99 * (double)n) - 1] * 1e6;
+    lat.max = samples[n - 1] * 1e6;
+    lat.mean = sum / (double)n * 1e6;
+    return lat;
+}
+
+static void print_latency(FILE *out, const latency_t *lat) {
+    fprintf(out, "{\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f, \"mean\": %.2f}",
+            lat->p50, lat->p90, lat->p99, lat->max, lat->mean);
+}
+
+static void remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        unlink(path);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char child[BENCH_PATH_MAX];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+            remove_tree(child);
+        } else {
+            unlink(child);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/**
+ * Drop a collection's files from the page cache (best effort: only
+ * clean pages go, which after close is all of them)
+*/
+static void drop_cache(const char *data_dir, const char *name) {
+    char path[BENCH_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", data_dir, name);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char file[BENCH_PATH_MAX * 2];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        int fd = open(file, O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * Read a whole .fvecs (or .ivecs: same framing) file
+ * Returns: 0 on success; *out_dim and *out_n describe the rows
+*/
+static int read_vecs(const char *path, void **out_data, uint32_t *out_dim, uint32_t *out_n) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    int32_t dim = 0;
+    if (fread(&dim, sizeof(dim), 1, f) != 1 || dim <= 0 || dim > VDB_COLLECTION_MAX_DIM) {
+        fclose(f);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    size_t row_bytes = sizeof(int32_t) + (size_t)dim * 4;
+    size_t n = (size_t)size / row_bytes;
+
+    uint8_t *data = (uint8_t*)malloc(n * (size_t)dim * 4 + 1);
+    int rc = data != NULL ? 0 : -1;
+    for (size_t i = 0; rc == 0 && i < n; i++) {
+        int32_t row_dim;
+        if (fread(&row_dim, sizeof(row_dim), 1, f) != 1 || row_dim != dim ||
+            fread(data + i * (size_t)dim * 4, 4, (size_t)dim, f) != (size_t)dim) {
+            rc = -1;
+        }
+    }
+    fclose(f);
+    if (rc != 0) {
+        free(data);
+        return -1;
+    }
+    *out_data = data;
+    *out_dim = (uint32_t)dim;
+    *out_n = (uint32_t)n;
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Distance kernels                                                    */
+/* ------------------------------------------------------------------ */
+
+/* Flops per dimension: dot = mul+add, L2 = sub+mul+add, cosine = 3 dots */
+static double flops_per_dim(vdb_metric_t metric) {
+    switch (metric) {
+        case VDB_METRIC_EUCLIDEAN: return 3.0;
+        case VDB_METRIC_COSINE: return 6.0;
+        default: return 2.0;
+    }
+}
+
+static int bench_distance(const bench_config_t *cfg, FILE *out) {
+    float *rows = (float*)malloc((size_t)BENCH_KERNEL_ROWS * cfg->dim * sizeof(float));
+    float *query = (float*)malloc(cfg->dim * sizeof(float));
+    float *dist = (float*)malloc(BENCH_KERNEL_ROWS * sizeof(float));
+    if (rows == NULL || query == NULL || dist == NULL) {
+        free(rows);
+        free(query);
+        free(dist);
+        return -1;
+    }
+    uint64_t state = cfg->seed;
+    for (size_t i = 0; i < (size_t)BENCH_KERNEL_ROWS * cfg->dim; i++) {
+        rows[i] = (float)rand_uniform(&state) - 0.5f;
+    }
+    for (uint32_t d = 0; d < cfg->dim; d++) {
+        query[d] = (float)rand_uniform(&state) - 0.5f;
+    }
+
+    vdb_isa_t original = vdb_distance_get_isa();
+    vdb_metric_t metrics[] = { VDB_METRIC_EUCLIDEAN, VDB_METRIC_COSINE, VDB_METRIC_INNER_PRODUCT };
+    // the generic loop, then the kernels specialized for dim if there are any
+    vdb_dim_kernel_t kernels[] = { VDB_DIM_KERNEL_GENERIC, vdb_distance_kernel_for_dim(cfg->dim) };
+    size_t kernel_count = kernels[1] == VDB_DIM_KERNEL_GENERIC ? 1 : 2;
+    bool first = true;
+    fprintf(out, "  \"distance\": [");
+    for (int isa = VDB_ISA_SCALAR; isa <= VDB_ISA_NEON; isa++) {
+        if (!vdb_distance_isa_supported((vdb_isa_t)isa) || vdb_distance_set_isa((vdb_isa_t)isa) != VDB_OK) {
+            continue;
+        }
+        for (size_t k = 0; k < kernel_count; k++) {
+            for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+                // warm up, then time whole calls until the budget is spent
+                vdb_distance_batch_kernel(kernels[k], metrics[m], VDB_ELEMENT_F32, query, rows,
+                                          BENCH_KERNEL_ROWS, cfg->dim, cfg->dim, dist);
+                uint64_t calls = 0;
+                double start = now_seconds();
+                double elapsed = 0.0;
+                do {
+                    for (int rep = 0; rep < 16; rep++) {
+                        vdb_distance_batch_kernel(kernels[k], metrics[m], VDB_ELEMENT_F32, query, rows,
+                                                  BENCH_KERNEL_ROWS, cfg->dim, cfg->dim, dist);
+                    }
+                    calls += 16;
+                    elapsed = now_seconds() - start;
+                } while (elapsed < BENCH_KERNEL_SECONDS);
+
+                double scored = (double)calls * BENCH_KERNEL_ROWS;
+                double gflops = scored * cfg->dim * flops_per_dim(metrics[m]) / elapsed / 1e9;
+                const char *kind = kernels[k] == VDB_DIM_KERNEL_GENERIC ? "generic" : "fixed";
+                fprintf(out, "%s\n    {\"isa\": \"%s\", \"metric\": \"%s\", \"kernel\": \"%s\", \"dim\": %u, "
+                        "\"rows\": %d, \"gflops\": %.3f, \"ns_per_row\": %.3f}",
+                        first ? "" : ",", vdb_isa_to_string((vdb_isa_t)isa), vdb_metric_to_string(metrics[m]),
+                        kind, cfg->dim, BENCH_KERNEL_ROWS, gflops, elapsed / scored * 1e9);
+                fprintf(stderr, "distance %-7s %-10s %-7s %8.2f GFLOP/s\n", vdb_isa_to_string((vdb_isa_t)isa),
+                        vdb_metric_to_string(metrics[m]), kind, gflops);
+                first = false;
+            }
+        }
+    }
+    fprintf(out, "\n  ]");
+    vdb_distance_set_isa(original);
+    free(rows);
+    free(query);
+    free(dist);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Ingest                                                              */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    const bench_config_t *cfg;
+    const float *centers;
+    vdb_storage_t *storage;
+    uint64_t first;
+    uint64_t count;
+    double *latency; // count samples, one per append
+    vdb_status_t status;
+    bool async; // batches append async, one wait at the end
+} ingest_job_t;
+
+/**
+ * Append rows [first, first + count) one call each
+*/
+static void *ingest_single(void *arg) {
+    ingest_job_t *job = (ingest_job_t*)arg;
+    float *vector = (float*)malloc(job->cfg->dim * sizeof(float));
+    if (vector == NULL) {
+        job->status = VDB_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    for (uint64_t i = 0; i < job->count && job->status == VDB_OK; i++) {
+        vdb_item_t item;
+        memset(&item, 0, sizeof(item));
+        snprintf(item.id, VDB_ID_MAX_LEN, "%lu", (unsigned long)(job->first + i));
+        make_vector(job->cfg, job->centers, 0, job->first + i, vector);
+        item.vector.dim = job->cfg->dim;
+        item.vector.data = vector;
+
+        double start = now_seconds();
+        job->status = vdb_storage_append(job->storage, &item);
+        job->latency[i] = now_seconds() - start;
+    }
+    free(vector);
+    return NULL;
+}
+
+/**
+ * Append rows [first, first + count) in batches; one sample per batch
+*/
+static vdb_status_t ingest_batches(ingest_job_t *job, size_t batch, size_t *out_batches) {
+    vdb_item_t *items = (vdb_item_t*)calloc(batch, sizeof(vdb_item_t));
+    float *vectors = (float*)malloc(batch * job->cfg->dim * sizeof(float));
+    vdb_status_t status = items != NULL && vectors != NULL ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+    size_t batches = 0;
+    vdb_commit_ticket_t ticket = 0;
+    for (uint64_t done = 0; status == VDB_OK && done < job->count; done += batch) {
+        size_t n = job->count - done < batch ? (size_t)(job->count - done) : batch;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t row = job->first + done + i;
+            snprintf(items[i].id, VDB_ID_MAX_LEN, "%lu", (unsigned long)row);
+            make_vector(job->cfg, job->centers, 0, row, vectors + i * job->cfg->dim);
+            items[i].vector.dim = job->cfg->dim;
+            items[i].vector.data = vectors + i * job->cfg->dim;
+            items[i].metadata = NULL;
+        }
+        double start = now_seconds();
+        status = job->async ? vdb_storage_append_batch_async(job->storage, items, n, &ticket)
+                            : vdb_storage_append_batch(job->storage, items, n);
+        if (job->latency != NULL) {
+            job->latency[batches] = now_seconds() - start;
+        }
+        batches++;
+    }
+    if (status == VDB_OK && job->async) {
+        status = vdb_storage_wait_durable(job->storage, ticket);
+    }
+    free(items);
+    free(vectors);
+    *out_batches = batches;
+    return status;
+}
+
+/**
+ * Run one durability mode into a fresh collection and print its result
+*/
+static int ingest_mode(const bench_config_t *cfg, const float *centers, const char *mode, FILE *out,
+                       bool first) {
+    char name[64];
+    snprintf(name, sizeof(name), "ingest-%s", mode);
+    vdb_storage_t *storage = NULL;
+    if (vdb_storage_create(cfg->data_dir, name, cfg->dim, cfg->metric, &storage) != VDB_OK) {
+        return -1;
+    }
+
+    uint64_t rows = cfg->ingest_rows;
+    double *latency = (double*)calloc(rows, sizeof(double));
+    if (latency == NULL) {
+        vdb_storage_close(&storage);
+        return -1;
+    }
+    size_t samples = 0;
+    vdb_status_t status = VDB_OK;
+    double start = now_seconds();
+
+    if (strcmp(mode, "fsync") == 0) {
+        ingest_job_t job = { cfg, centers, storage, 0, rows, latency, VDB_OK, false };
+        ingest_single(&job);
+        status = job.status;
+        samples = rows;
+    } else if (strcmp(mode, "batch") == 0 || strcmp(mode, "async") == 0 || strcmp(mode, "uring") == 0) {
+        // async: batches without their fsync; uring: batches on io_uring
+        ingest_job_t job = { cfg, centers, storage, 0, rows, latency, VDB_OK, strcmp(mode, "async") == 0 };
+        if (strcmp(mode, "uring") == 0 && vdb_storage_set_io_backend(storage, VDB_IO_URING) != VDB_OK) {
+            fprintf(stderr, "ingest   %-7s skipped, no io_uring\n", mode);
+            vdb_storage_close(&storage);
+            free(latency);
+            return 0;
+        }
+        status = ingest_batches(&job, BENCH_LOAD_BATCH, &samples);
+    } else {
+        // group commit: concurrent single appends sharing fsyncs
+        status = vdb_storage_set_group_commit(storage, BENCH_COMMIT_WINDOW_US);
+        ingest_job_t jobs[BENCH_COMMIT_THREADS];
+        pthread_t threads[BENCH_COMMIT_THREADS];
+        uint64_t per = rows / BENCH_COMMIT_THREADS;
+        int started = 0;
+        for (int t = 0; status == VDB_OK && t < BENCH_COMMIT_THREADS; t++) {
+            uint64_t count = t == BENCH_COMMIT_THREADS - 1 ? rows - per * t : per;
+            ingest_job_t job = { cfg, centers, storage, per * t, count, latency + per * t, VDB_OK, false };
+            jobs[t] = job;
+            if (pthread_create(&threads[t], NULL, ingest_single, &jobs[t]) != 0) {
+                status = VDB_ERROR_UNKNOWN;
+                break;
+            }
+            started++;
+        }
+        for (int t = 0; t < started; t++) {
+            pthread_join(threads[t], NULL);
+            if (jobs[t].status != VDB_OK) {
+                status = jobs[t].status;
+            }
+        }
+        samples = rows;
+    }
+    double elapsed = now_seconds() - start;
+    vdb_storage_close(&storage);
+    if (status != VDB_OK) {
+        fprintf(stderr, "Error: ingest %s failed: %s\n", mode, vdb_status_to_string(status));
+        free(latency);
+        return -1;
+    }
+
+    latency_t lat = percentiles(latency, samples);
+    fprintf(out, "%s\n    {\"mode\": \"%s\", \"rows\": %lu, \"seconds\": %.4f, \"rows_per_sec\": %.1f, "
+            "\"calls\": %zu, \"latency_us\": ", first ? "" : ",", mode, (unsigned long)rows, elapsed,
+            (double)rows / elapsed, samples);
+    print_latency(out, &lat);
+    fprintf(out, "}");
+    fprintf(stderr, "ingest   %-7s %10.0f rows/s  p99 %.0f us\n", mode, (double)rows / elapsed, lat.p99);
+    free(latency);
+    return 0;
+}
+
+static int bench_ingest(const bench_config_t *cfg, const float *centers, FILE *out) {
+    const char *modes[] = { "fsync", "batch", "group_commit", "async", "uring" };
+    fprintf(out, "  \"ingest\": [");
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (ingest_mode(cfg, centers, modes[i], out, i == 0) != 0) {
+            return -1;
+        }
+    }
+    fprintf(out, "\n  ]");
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Search                                                              */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Fill the search collection from --base or the synthetic set
+*/
+static int load_base(const bench_config_t *cfg, const float *centers, vdb_storage_t **out_storage,
+                     double *out_seconds) {
+    vdb_storage_t *storage = NULL;
+    if (vdb_storage_create(cfg->data_dir, "search", cfg->dim, cfg->metric, &storage) != VDB_OK) {
+        return -1;
+    }
+    double start = now_seconds();
+    vdb_status_t status;
+    if (cfg->base_path != NULL) {
+        status = vdb_storage_import(storage, cfg->base_path, NULL, NULL);
+    } else {
+        ingest_job_t job = { cfg, centers, storage, 0, cfg->rows, NULL, VDB_OK, false };
+        size_t batches = 0;
+        status = ingest_batches(&job, BENCH_LOAD_BATCH, &batches);
+    }
+    *out_seconds = now_seconds() - start;
+    if (status != VDB_OK) {
+        fprintf(stderr, "Error: loading the base set failed: %s\n", vdb_status_to_string(status));
+        vdb_storage_close(&storage);
+        return -1;
+    }
+    *out_storage = storage;
+    return 0;
+}
+
+static int load_queries(const bench_config_t *cfg, const float *centers, bench_queries_t *q) {
+    memset(q, 0, sizeof(*q));
+    if (cfg->query_path != NULL) {
+        void *data = NULL;
+        uint32_t dim = 0;
+        uint32_t n = 0;
+        if (read_vecs(cfg->query_path, &data, &dim, &n) != 0 || dim != cfg->dim) {
+            fprintf(stderr, "Error: can't read %u-dim queries from '%s'\n", cfg->dim, cfg->query_path);
+            free(data);
+            return -1;
+        }
+        q->queries = (float*)data;
+        q->num = n < cfg->queries ? n : cfg->queries;
+    } else {
+        q->num = cfg->queries;
+        q->queries = (float*)malloc((size_t)q->num * cfg->dim * sizeof(float));
+        if (q->queries == NULL) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < q->num; i++) {
+            make_vector(cfg, centers, 1, i, q->queries + (size_t)i * cfg->dim);
+        }
+    }
+
+    q->truth_k = cfg->k;
+    q->truth = (uint32_t*)calloc((size_t)q->num * cfg->k, sizeof(uint32_t));
+    if (q->truth == NULL) {
+        return -1;
+    }
+    if (cfg->truth_path != NULL) {
+        void *data = NULL;
+        uint32_t k = 0;
+        uint32_t n = 0;
+        if (read_vecs(cfg->truth_path, &data, &k, &n) != 0 || k < cfg->k || n < q->num) {
+            fprintf(stderr, "Error: '%s' needs %u neighbours for %u queries\n", cfg->truth_path, cfg->k, q->num);
+            free(data);
+            return -1;
+        }
+        for (uint32_t i = 0; i < q->num; i++) {
+            memcpy(q->truth + (size_t)i * cfg->k, (uint32_t*)data + (size_t)i * k, cfg->k * sizeof(uint32_t));
+        }
+        free(data);
+        q->truth_loaded = true;
+    }
+    return 0;
+}
+
+/**
+ * Fraction of the true top-k found in the results (IDs are row numbers)
+*/
+static double recall_at_k(const bench_queries_t *q, uint32_t query, const vdb_search_results_t *results) {
+    const uint32_t *truth = q->truth + (size_t)query * q->truth_k;
+    size_t found = 0;
+    for (size_t i = 0; i < results->count; i++) {
+        unsigned long row = strtoul(results->hits[i].id, NULL, 10);
+        for (uint32_t j = 0; j < q->truth_k; j++) {
+            if (truth[j] == row) {
+                found++;
+                break;
+            }
+        }
+    }
+    return (double)found / (double)q->truth_k;
+}
+
+typedef vdb_status_t (*search_fn)(vdb_storage_t *storage, const vdb_vector_t *query, uint32_t k,
+                                  vdb_search_results_t *out_results);
+
+/**
+ * Run every query once; fill truth from the results if asked
+ * Returns: 0 on success, with QPS, latency and mean recall
+*/
+static int run_queries(const bench_config_t *cfg, vdb_storage_t *storage, bench_queries_t *q, search_fn fn,
+                       bool fill_truth, double *out_qps, latency_t *out_lat, double *out_recall) {
+    double *samples = (double*)malloc(q->num * sizeof(double));
+    if (samples == NULL) {
+        return -1;
+    }
+    double recall = 0.0;
+    double start = now_seconds();
+    for (uint32_t i = 0; i < q->num; i++) {
+        vdb_vector_t query = { cfg->dim, q->queries + (size_t)i * cfg->dim };
+        vdb_search_results_t results;
+        double t = now_seconds();
+        vdb_status_t status = fn(storage, &query, cfg->k, &results);
+        samples[i] = now_seconds() - t;
+        if (status != VDB_OK) {
+            fprintf(stderr, "Error: search failed: %s\n", vdb_status_to_string(status));
+            free(samples);
+            return -1;
+        }
+        if (fill_truth) {
+            for (size_t j = 0; j < results.count && j < q->truth_k; j++) {
+                q->truth[(size_t)i * q->truth_k + j] = (uint32_t)strtoul(results.hits[j].id, NULL, 10);
+            }
+        }
+        recall += recall_at_k(q, i, &results);
+        vdb_search_results_free(&results);
+    }
+    double elapsed = now_seconds() - start;
+    *out_qps = (double)q->num / elapsed;
+    *out_lat = percentiles(samples, q->num);
+    *out_recall = q->num > 0 ? recall / q->num : 0.0;
+    free(samples);
+    return 0;
+}
+
+static int bench_search(const bench_config_t *cfg, const float *centers, FILE *out) {
+    vdb_storage_t *storage = NULL;
+    double load_seconds = 0.0;
+    bench_queries_t q;
+    if (load_base(cfg, centers, &storage, &load_seconds) != 0) {
+        return -1;
+    }
+    if (load_queries(cfg, centers, &q) != 0) {
+        vdb_storage_close(&storage);
+        free(q.queries);
+        free(q.truth);
+        return -1;
+    }
+    uint64_t rows = vdb_storage_count(storage);
+
+    int rc = 0;
+    double qps = 0.0;
+    double recall = 0.0;
+    latency_t lat;
+    fprintf(out, "  \"search\": {\"rows\": %lu, \"queries\": %u, \"k\": %u, \"load_seconds\": %.4f,\n",
+            (unsigned long)rows, q.num, cfg->k, load_seconds);
+
+    // exact search doubles as ground truth when none was given
+    rc = run_queries(cfg, storage, &q, vdb_storage_search_exact, !q.truth_loaded, &qps, &lat, &recall);
+    if (rc == 0) {
+        fprintf(out, "    \"exact\": {\"qps\": %.1f, \"recall\": %.4f, \"latency_us\": ", qps, recall);
+        print_latency(out, &lat);
+        fprintf(out, "},\n");
+        fprintf(stderr, "search   exact   %10.1f QPS  recall %.4f  p99 %.0f us\n", qps, recall, lat.p99);
+    }
+
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.m = cfg->m;
+    params.ef_construction = cfg->ef_construction;
+    double start = now_seconds();
+    if (rc == 0 && vdb_storage_enable_hnsw(storage, &params) != VDB_OK) {
+        fprintf(stderr, "Error: building the HNSW index failed\n");
+        rc = -1;
+    }
+    if (rc == 0) {
+        double build = now_seconds() - start;
+        fprintf(stderr, "search   hnsw build %.2f s\n", build);
+        fprintf(out, "    \"hnsw\": {\"m\": %u, \"ef_construction\": %u, \"build_seconds\": %.4f, \"runs\": [",
+                cfg->m, cfg->ef_construction, build);
+        for (size_t i = 0; rc == 0 && i < cfg->num_ef; i++) {
+            vdb_storage_set_ef_search(storage, cfg->ef[i]);
+            rc = run_queries(cfg, storage, &q, vdb_storage_search_hnsw, false, &qps, &lat, &recall);
+            if (rc == 0) {
+                fprintf(out, "%s\n      {\"ef_search\": %u, \"qps\": %.1f, \"recall\": %.4f, \"latency_us\": ",
+                        i == 0 ? "" : ",", cfg->ef[i], qps, recall);
+                print_latency(out, &lat);
+                fprintf(out, "}");
+                fprintf(stderr, "search   ef %-4u %10.1f QPS  recall %.4f  p99 %.0f us\n", cfg->ef[i], qps,
+                        recall, lat.p99);
+            }
+        }
+        fprintf(out, "\n    ]}\n  }");
+    }
+
+    vdb_storage_close(&storage);
+    free(q.queries);
+    free(q.truth);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Cold open                                                           */
+/* ------------------------------------------------------------------ */
+
+static int bench_open(const bench_config_t *cfg, const float *centers, FILE *out) {
+    // reuse the search collection if that scenario built it
+    char path[BENCH_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/search", cfg->data_dir);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        vdb_storage_t *storage = NULL;
+        double seconds = 0.0;
+        if (load_base(cfg, centers, &storage, &seconds) != 0) {
+            return -1;
+        }
+        vdb_storage_close(&storage);
+    }
+
+    float *query = (float*)malloc(cfg->dim * sizeof(float));
+    if (query == NULL) {
+        return -1;
+    }
+    make_vector(cfg, centers, 1, 0, query);
+    vdb_vector_t q = { cfg->dim, query };
+
+    double open_samples[BENCH_OPEN_RUNS];
+    double query_samples[BENCH_OPEN_RUNS];
+    uint64_t rows = 0;
+    bool hnsw = false;
+    int rc = 0;
+    for (int run = 0; rc == 0 && run < BENCH_OPEN_RUNS; run++) {
+        drop_cache(cfg->data_dir, "search");
+        vdb_storage_t *storage = NULL;
+        double start = now_seconds();
+        vdb_status_t status = vdb_storage_open(cfg->data_dir, "search", &storage);
+        open_samples[run] = now_seconds() - start;
+        if (status != VDB_OK) {
+            fprintf(stderr, "Error: open failed: %s\n", vdb_status_to_string(status));
+            rc = -1;
+            break;
+        }
+        rows = vdb_storage_count(storage);
+        hnsw = vdb_storage_has_hnsw(storage);
+
+        vdb_search_results_t results;
+        start = now_seconds();
+        status = hnsw ? vdb_storage_search_hnsw(storage, &q, cfg->k, &results)
+                      : vdb_storage_search_exact(storage, &q, cfg->k, &results);
+        query_samples[run] = now_seconds() - start;
+        if (status == VDB_OK) {
+            vdb_search_results_free(&results);
+        } else {
+            rc = -1;
+        }
+        vdb_storage_close(&storage);
+    }
+    free(query);
+    if (rc != 0) {
+        return -1;
+    }
+
+    latency_t open_lat = percentiles(open_samples, BENCH_OPEN_RUNS);
+    latency_t query_lat = percentiles(query_samples, BENCH_OPEN_RUNS);
+    fprintf(out, "  \"open\": {\"rows\": %lu, \"hnsw\": %s, \"runs\": %d, \"open_us\": ", (unsigned long)rows,
+            hnsw ? "true" : "false", BENCH_OPEN_RUNS);
+    print_latency(out, &open_lat);
+    fprintf(out, ", \"first_query_us\": ");
+    print_latency(out, &query_lat);
+    fprintf(out, "}");
+    fprintf(stderr, "open     %.0f us (median), first query %.0f us\n", open_lat.p50, query_lat.p50);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Main                                                                */
+/* ------------------------------------------------------------------ */
+
+static void print_usage(const char *prog_name) {
+    printf("VDB benchmark suite v%s\n", VDB_VERSION);
+    printf("\n");
+    printf("Usage: %s [options]\n", prog_name);
+    printf("\n");
+    printf("Options:\n");
+    printf("  --scenario LIST    distance,ingest,search,open (default: all)\n");
+    printf("  --dim N            Synthetic vector dimension (default 128)\n");
+    printf("  --rows N           Synthetic base rows (default 20000)\n");
+    printf("  --queries N        Queries per run (default 200)\n");
+    printf("  --k N              Neighbours per query (default 10)\n");
+    printf("  --ingest-rows N    Rows per durability mode (default 2000)\n");
+    printf("  --metric M         cosine, euclidean or dot (default euclidean)\n");
+    printf("  --ef LIST          efSearch sweep (default 16,32,64,128,256)\n");
+    printf("  --m N              HNSW links per node (default 16)\n");
+    printf("  --ef-construction N  HNSW build beam (default 200)\n");
+    printf("  --seed N           Synthetic data seed (default 42)\n");
+    printf("  --base FILE        Base vectors (.fvecs), instead of synthetic\n");
+    printf("  --query FILE       Query vectors (.fvecs)\n");
+    printf("  --groundtruth FILE True neighbours (.ivecs), else exact search\n");
+    printf("  --data-dir DIR     Where collections go (default: a temp dir, removed)\n");
+    printf("  --out FILE         Write the JSON results here (default stdout)\n");
+    printf("  --quick            Small sizes, for smoke runs\n");
+    printf("\n");
+}
+
+static int parse_u64(const char *str, uint64_t min, uint64_t max, uint64_t *out) {
+    char *endptr;
+    if (str == NULL || *str < '0' || *str > '9') {
+        return -1;
+    }
+    unsigned long long value = strtoull(str, &endptr, 10);
+    if (*endptr != '\0' || value < min || value > max) {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static int parse_metric(const char *str, vdb_metric_t *out_metric) {
+    if (strcmp(str, "cosine") == 0) {
+        *out_metric = VDB_METRIC_COSINE;
+    } else if (strcmp(str, "euclidean") == 0) {
+        *out_metric = VDB_METRIC_EUCLIDEAN;
+    } else if (strcmp(str, "dot") == 0) {
+        *out_metric = VDB_METRIC_INNER_PRODUCT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_scenarios(const char *str, bench_config_t *cfg) {
+    cfg->distance = cfg->ingest = cfg->search = cfg->open = false;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", str);
+    for (char *tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (strcmp(tok, "distance") == 0) {
+            cfg->distance = true;
+        } else if (strcmp(tok, "ingest") == 0) {
+            cfg->ingest = true;
+        } else if (strcmp(tok, "search") == 0) {
+            cfg->search = true;
+        } else if (strcmp(tok, "open") == 0) {
+            cfg->open = true;
+        } else if (strcmp(tok, "all") == 0) {
+            cfg->distance = cfg->ingest = cfg->search = cfg->open = true;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int parse_ef_list(const char *str, bench_config_t *cfg) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", str);
+    cfg->num_ef = 0;
+    for (char *tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        uint64_t ef;
+        if (cfg->num_ef == sizeof(cfg->ef) / sizeof(cfg->ef[0]) || parse_u64(tok, 1, 1u << 20, &ef) != 0) {
+            return -1;
+        }
+        cfg->ef[cfg->num_ef++] = (uint32_t)ef;
+    }
+    return cfg->num_ef > 0 ? 0 : -1;
+}
+
+static int parse_args(int argc, char *argv[], bench_config_t *cfg) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--quick") == 0) {
+            cfg->dim = 32;
+            cfg->rows = 2000;
+            cfg->queries = 50;
+            cfg->ingest_rows = 200;
+            cfg->ef_construction = 64;
+            parse_ef_list("16,64", cfg);
+            continue;
+        }
+        if (strcmp(opt, "-h") == 0 || strcmp(opt, "--help") == 0) {
+            print_usage(argv[0]);
+            exit(0);
+        }
+        const char *value = i + 1 < argc ? argv[++i] : NULL;
+        uint64_t n = 0;
+        int rc = value != NULL ? 0 : -1;
+        if (rc != 0) {
+            // missing value
+        } else if (strcmp(opt, "--scenario") == 0) {
+            rc = parse_scenarios(value, cfg);
+        } else if (strcmp(opt, "--dim") == 0) {
+            rc = parse_u64(value, 1, VDB_COLLECTION_MAX_DIM, &n);
+            cfg->dim = (uint32_t)n;
+        } else if (strcmp(opt, "--rows") == 0) {
+            rc = parse_u64(value, 1, UINT32_MAX, &n);
+            cfg->rows = n;
+        } else if (strcmp(opt, "--queries") == 0) {
+            rc = parse_u64(value, 1, UINT32_MAX, &n);
+            cfg->queries = (uint32_t)n;
+        } else if (strcmp(opt, "--k") == 0) {
+            rc = parse_u64(value, 1, 4096, &n);
+            cfg->k = (uint32_t)n;
+        } else if (strcmp(opt, "--ingest-rows") == 0) {
+            rc = parse_u64(value, BENCH_COMMIT_THREADS, UINT32_MAX, &n);
+            cfg->ingest_rows = n;
+        } else if (strcmp(opt, "--metric") == 0) {
+            rc = parse_metric(value, &cfg->metric);
+        } else if (strcmp(opt, "--ef") == 0) {
+            rc = parse_ef_list(value, cfg);
+        } else if (strcmp(opt, "--m") == 0) {
+            rc = parse_u64(value, VDB_HNSW_MIN_M, VDB_HNSW_MAX_M, &n);
+            cfg->m = (uint32_t)n;
+        } else if (strcmp(opt, "--ef-construction") == 0) {
+            rc = parse_u64(value, 1, 1u << 20, &n);
+            cfg->ef_construction = (uint32_t)n;
+        } else if (strcmp(opt, "--seed") == 0) {
+            rc = parse_u64(value, 0, UINT64_MAX, &cfg->seed);
+        } else if (strcmp(opt, "--base") == 0) {
+            cfg->base_path = value;
+        } else if (strcmp(opt, "--query") == 0) {
+            cfg->query_path = value;
+        } else if (strcmp(opt, "--groundtruth") == 0) {
+            cfg->truth_path = value;
+        } else if (strcmp(opt, "--data-dir") == 0) {
+            cfg->data_dir = value;
+        } else if (strcmp(opt, "--out") == 0) {
+            cfg->out_path = value;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", opt);
+            return -1;
+        }
+        if (rc != 0) {
+            fprintf(stderr, "Error: Invalid value for '%s'\n", opt);
+            return -1;
+        }
+    }
+
+    if (cfg->base_path != NULL) {
+        // the collection takes the file's dimension
+        FILE *f = fopen(cfg->base_path, "rb");
+        int32_t first = 0;
+        if (f == NULL || fread(&first, sizeof(first), 1, f) != 1 || first <= 0) {
+            fprintf(stderr, "Error: can't read '%s'\n", cfg->base_path);
+            if (f != NULL) {
+                fclose(f);
+            }
+            return -1;
+        }
+        fclose(f);
+        cfg->dim = (uint32_t)first;
+        if (cfg->query_path == NULL) {
+            fprintf(stderr, "Error: --base needs --query\n");
+            return -1;
+        }
+    }
+    if (cfg->ingest_rows < BENCH_COMMIT_THREADS) {
+        cfg->ingest_rows = BENCH_COMMIT_THREADS;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.distance = cfg.ingest = cfg.search = cfg.open = true;
+    cfg.dim = 128;
+    cfg.rows = 20000;
+    cfg.queries = 200;
+    cfg.k = 10;
+    cfg.ingest_rows = 2000;
+    cfg.metric = VDB_METRIC_EUCLIDEAN;
+    cfg.seed = 42;
+    cfg.m = 16;
+    cfg.ef_construction = 200;
+    parse_ef_list("16,32,64,128,256", &cfg);
+    if (parse_args(argc, argv, &cfg) != 0) {
+        fprintf(stderr, "Run '%s --help' for usage information.\n", argv[0]);
+        return 1;
+    }
+
+    char temp_dir[BENCH_PATH_MAX] = "";
+    if (cfg.data_dir == NULL) {
+        snprintf(temp_dir, sizeof(temp_dir), "/tmp/vdb_bench_XXXXXX");
+        if (mkdtemp(temp_dir) == NULL) {
+            fprintf(stderr, "Error: can't create a temp directory\n");
+            return 1;
+        }
+        cfg.data_dir = temp_dir;
+    }
+
+    FILE *out = stdout;
+    if (cfg.out_path != NULL && (out = fopen(cfg.out_path, "w")) == NULL) {
+        fprintf(stderr, "Error: can't write '%s'\n", cfg.out_path);
+        return 1;
+    }
+    float *centers = make_centers(&cfg);
+    if (centers == NULL) {
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"version\": \"%s\",\n", VDB_VERSION);
+    fprintf(out, "  \"config\": {\"dim\": %u, \"rows\": %lu, \"queries\": %u, \"k\": %u, \"metric\": \"%s\", "
+            "\"seed\": %lu, \"dataset\": \"%s\", \"isa\": \"%s\"}",
+            cfg.dim, (unsigned long)cfg.rows, cfg.queries, cfg.k, vdb_metric_to_string(cfg.metric),
+            (unsigned long)cfg.seed, cfg.base_path != NULL ? "fvecs" : "synthetic",
+            vdb_isa_to_string(vdb_distance_get_isa()));
+
+    int rc = 0;
+    if (rc == 0 && cfg.distance) {
+        fprintf(out, ",\n");
+        rc = bench_distance(&cfg, out);
+    }
+    if (rc == 0 && cfg.ingest) {
+        fprintf(out, ",\n");
+        rc = bench_ingest(&cfg, centers, out);
+    }
+    if (rc == 0 && cfg.search) {
+        fprintf(out, ",\n");
+        rc = bench_search(&cfg, centers, out);
+    }
+    if (rc == 0 && cfg.open) {
+        fprintf(out, ",\n");
+        rc = bench_open(&cfg, centers, out);
+    }
+    fprintf(out, "\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(centers);
+    if (temp_dir[0] != '\0') {
+        remove_tree(temp_dir);
+    }
+    return rc == 0 ? 0 : 1;
+}
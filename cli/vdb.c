@@ -9,11 +9,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "vdb/types.h"
 #include "vdb/collection.h"
+#include "vdb/storage.h"
+#include "vdb/import.h"
+#include "vdb/stats.h"
 
 #define VDB_VERSION "0.1.0"
 
+#define VDB_DEFAULT_DATA_DIR "./data"
+
 /**
  * Print usage information
  */
@@ -28,10 +34,21 @@ static void print_usage(const char *prog_name) {
     printf("  create <name> <dim> <metric>   Create a new collection\n");
     printf("                    - name: Collection name\n");
     printf("                    - dim: Vector dimension (1-%d)\n", VDB_COLLECTION_MAX_DIM);
-    printf("                    - metric: 'cosine' or 'euclidean'\n");
+    printf("                    - metric: 'cosine', 'euclidean' or 'dot'\n");
+    printf("  import <name> <file> [options]  Bulk load .fvecs, .npy or .jsonl\n");
+    printf("                    --data-dir DIR    Collections directory (default %s)\n", VDB_DEFAULT_DATA_DIR);
+    printf("                    --dim N           Create the collection if missing\n");
+    printf("                    --metric M        Metric when creating (default cosine)\n");
+    printf("                    --format F        fvecs, npy or jsonl (default: extension)\n");
+    printf("                    --threads N       Parse threads (default: one per CPU)\n");
+    printf("                    --batch N         Rows per append (default %d)\n", VDB_IMPORT_DEFAULT_BATCH_ROWS);
+    printf("                    --first-id N      ID of the first fvecs/npy row (default 0)\n");
+    printf("                    --hnsw            Build the HNSW index after loading\n");
+    printf("                    --io-uring        Write through io_uring (Linux)\n");
+    printf("                    --stats FILE      Write the collection's stats afterwards, in\n");
+    printf("                                      Prometheus text format ('-' = stdout)\n");
     printf("\n");
     printf("Coming in Step 3:\n");
-    printf("  ingest            Ingest vectors into a collection\n");
     printf("  query             Query for similar vectors\n");
     printf("\n");
 }
@@ -46,6 +63,9 @@ static int parse_metric(const char *metric_str, vdb_metric_t *out_metric) {
     } else if (strcmp(metric_str, "euclidean") == 0) {
         *out_metric = VDB_METRIC_EUCLIDEAN;
         return 0;
+    } else if (strcmp(metric_str, "dot") == 0) {
+        *out_metric = VDB_METRIC_INNER_PRODUCT;
+        return 0;
     }
     return -1;
 }
@@ -71,12 +91,12 @@ static int cmd_create(int argc, char *argv[]) {
         fprintf(stderr, "Error: Invalid dimension '%s' (must be 1-%d)\n", dim_str, VDB_COLLECTION_MAX_DIM);
         return 1;
     }
-    u_int32_t dim = (uint32_t)dim_long;
+    uint32_t dim = (uint32_t)dim_long;
 
     // parse metric
     vdb_metric_t metric;
     if (parse_metric(metric_str, &metric) != 0) {
-        fprintf(stderr, "Error, Invalid metric '%s' (must be 'cosine' or 'euclidean')\n", metric_str);
+        fprintf(stderr, "Error, Invalid metric '%s' (must be 'cosine', 'euclidean' or 'dot')\n", metric_str);
         return 1;
     }
 
@@ -114,6 +134,203 @@ static int cmd_create(int argc, char *argv[]) {
 
 }
 
+/**
+ * Parse an unsigned number option, -1 if it isn't one or exceeds max
+*/
+static int parse_count(const char *str, unsigned long long max, unsigned long long *out) {
+    char *endptr;
+    if (str == NULL || *str < '0' || *str > '9') {
+        return -1;
+    }
+    unsigned long long value = strtoull(str, &endptr, 10);
+    if (*endptr != '\0' || value > max) {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static int parse_format(const char *str, vdb_import_format_t *out_format) {
+    if (strcmp(str, "fvecs") == 0) {
+        *out_format = VDB_IMPORT_FVECS;
+    } else if (strcmp(str, "npy") == 0) {
+        *out_format = VDB_IMPORT_NPY;
+    } else if (strcmp(str, "jsonl") == 0) {
+        *out_format = VDB_IMPORT_JSONL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Write a collection's stats in Prometheus text format to path ('-' = stdout)
+*/
+static int write_stats(vdb_storage_t *storage, const char *name, const char *path) {
+    vdb_stats_t stats;
+    vdb_status_t status = vdb_storage_get_stats(storage, &stats);
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (status == VDB_OK && out == NULL) {
+        status = VDB_ERROR_IO;
+    }
+    if (status == VDB_OK) {
+        status = vdb_stats_write_prometheus(&stats, name, out);
+    }
+    if (out != NULL && out != stdout && fclose(out) != 0 && status == VDB_OK) {
+        status = VDB_ERROR_IO;
+    }
+    if (status != VDB_OK) {
+        fprintf(stderr, "Error: Failed to write stats to %s: %s\n", path, vdb_status_to_string(status));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Handle 'import' command
+*/
+static int cmd_import(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Error: 'import' requires 2 arguments: <name> <file>\n");
+        fprintf(stderr, "Example: %s import my-collection vectors.fvecs --dim 128\n", argv[0]);
+        return 1;
+    }
+
+    const char *name = argv[2];
+    const char *path = argv[3];
+    const char *data_dir = VDB_DEFAULT_DATA_DIR;
+    const char *stats_path = NULL;
+    bool io_uring = false;
+    uint32_t dim = 0;
+    vdb_metric_t metric = VDB_METRIC_COSINE;
+    vdb_import_params_t params = vdb_import_params_default();
+
+    // parse options
+    for (int i = 4; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        unsigned long long n = 0;
+        if (strcmp(opt, "--hnsw") == 0) {
+            params.build_hnsw = true;
+            continue;
+        }
+        if (strcmp(opt, "--io-uring") == 0) {
+            io_uring = true;
+            continue;
+        }
+        if (value == NULL) {
+            fprintf(stderr, "Error: Option '%s' needs a value\n", opt);
+            return 1;
+        }
+        i++;
+        if (strcmp(opt, "--data-dir") == 0) {
+            data_dir = value;
+        } else if (strcmp(opt, "--stats") == 0) {
+            stats_path = value;
+        } else if (strcmp(opt, "--dim") == 0) {
+            if (parse_count(value, VDB_COLLECTION_MAX_DIM, &n) != 0 || n == 0) {
+                fprintf(stderr, "Error: Invalid dimension '%s' (must be 1-%d)\n", value, VDB_COLLECTION_MAX_DIM);
+                return 1;
+            }
+            dim = (uint32_t)n;
+        } else if (strcmp(opt, "--metric") == 0) {
+            if (parse_metric(value, &metric) != 0) {
+                fprintf(stderr, "Error: Invalid metric '%s' (must be 'cosine', 'euclidean' or 'dot')\n", value);
+                return 1;
+            }
+        } else if (strcmp(opt, "--format") == 0) {
+            if (parse_format(value, &params.format) != 0) {
+                fprintf(stderr, "Error: Invalid format '%s' (must be 'fvecs', 'npy' or 'jsonl')\n", value);
+                return 1;
+            }
+        } else if (strcmp(opt, "--threads") == 0) {
+            if (parse_count(value, 1024, &n) != 0) {
+                fprintf(stderr, "Error: Invalid thread count '%s'\n", value);
+                return 1;
+            }
+            params.parse_threads = (uint32_t)n;
+        } else if (strcmp(opt, "--batch") == 0) {
+            if (parse_count(value, UINT32_MAX, &n) != 0 || n == 0) {
+                fprintf(stderr, "Error: Invalid batch size '%s'\n", value);
+                return 1;
+            }
+            params.batch_rows = (uint32_t)n;
+        } else if (strcmp(opt, "--first-id") == 0) {
+            if (parse_count(value, UINT64_MAX, &n) != 0) {
+                fprintf(stderr, "Error: Invalid first ID '%s'\n", value);
+                return 1;
+            }
+            params.first_id = n;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", opt);
+            return 1;
+        }
+    }
+
+    if (params.format == VDB_IMPORT_AUTO && vdb_import_format_from_path(path) == VDB_IMPORT_AUTO) {
+        fprintf(stderr, "Error: Can't tell the format of '%s', use --format\n", path);
+        return 1;
+    }
+
+    // open the collection, creating it if a dimension was given
+    vdb_storage_t *storage = NULL;
+    vdb_status_t status = vdb_storage_open(data_dir, name, &storage);
+    if (status == VDB_ERROR_NOT_FOUND && dim > 0) {
+        status = vdb_storage_create(data_dir, name, dim, metric, &storage);
+    }
+    if (status != VDB_OK) {
+        fprintf(stderr, "Error: Failed to open collection '%s' in %s: %s\n", name, data_dir,
+            vdb_status_to_string(status));
+        if (status == VDB_ERROR_NOT_FOUND) {
+            fprintf(stderr, "Pass --dim (and --metric) to create it\n");
+        }
+        return 1;
+    }
+
+    if (io_uring) {
+        status = vdb_storage_set_io_backend(storage, VDB_IO_URING);
+        if (status != VDB_OK) {
+            fprintf(stderr, "Error: No io_uring: %s\n", vdb_status_to_string(status));
+            vdb_storage_close(&storage);
+            return 1;
+        }
+    }
+
+    double start = now_seconds();
+    vdb_import_stats_t stats;
+    status = vdb_storage_import(storage, path, &params, &stats);
+    double seconds = now_seconds() - start;
+    uint64_t total = vdb_storage_count(storage);
+    int stats_failed = stats_path != NULL ? write_stats(storage, name, stats_path) : 0;
+    vdb_storage_close(&storage);
+
+    if (seconds <= 0.0) {
+        seconds = 1e-9;
+    }
+    printf("  Imported %lu rows (%.1f MB) in %.2f s\n", (unsigned long)stats.rows,
+        (double)stats.bytes / 1e6, seconds);
+    printf("  Throughput: %.0f rows/s, %.1f MB/s\n", (double)stats.rows / seconds,
+        (double)stats.bytes / 1e6 / seconds);
+    printf("  Collection rows: %lu\n", (unsigned long)total);
+
+    if (status != VDB_OK) {
+        if (stats.failed_record > 0) {
+            fprintf(stderr, "Error: Import failed at record %lu: %s\n", (unsigned long)stats.failed_record,
+                vdb_status_to_string(status));
+        } else {
+            fprintf(stderr, "Error: Import failed: %s\n", vdb_status_to_string(status));
+        }
+        return 1;
+    }
+    return stats_failed;
+}
+
 /**
  * Main entry point
  */
@@ -135,6 +352,8 @@ int main(int argc, char *argv[]) {
         return 0;
     } else if (strcmp(command, "create") == 0) {
         return cmd_create(argc, argv);
+    } else if (strcmp(command, "import") == 0) {
+        return cmd_import(argc, argv);
     } else {
         fprintf(stderr, "Unknown command: %s\n", command);
         fprintf(stderr, "Run '%s help' for usage information.\n", argv[0]);
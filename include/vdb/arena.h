@@ -0,0 +1,162 @@
+/**
+ * arena.h - Arena and slab allocators
+ *
+ * Two allocators for memory that doesn't need a malloc/free per object:
+ * - Arena: a bump allocator over chained blocks. Allocations are freed
+ *   all at once, by vdb_arena_reset or by rewinding to a mark taken
+ *   earlier, so nested users can share one arena like a stack.
+ * - Slab: a free list of fixed-size objects carved from big chunks.
+ *
+ * Neither is thread-safe: the idea is one per thread, which is what
+ * keeps them off the malloc locks. The library does the same
+ * internally for per-query scratch (search heaps, WAL buffers).
+ *
+ * A rewound or reset arena keeps one block for reuse and gives the rest
+ * back to malloc, so a one-off huge allocation isn't held forever.
+*/
+
+#ifndef VDB_ARENA_H
+#define VDB_ARENA_H
+
+#include "types.h"
+
+/* Default arena block size */
+#define VDB_ARENA_DEFAULT_BLOCK (64 * 1024)
+
+/* Alignment of vdb_arena_alloc and of slab objects */
+#define VDB_ARENA_ALIGN 16
+
+/**
+ * Arena (opaque)
+*/
+typedef struct vdb_arena vdb_arena_t;
+
+/**
+ * Position in an arena to rewind to
+*/
+typedef struct {
+    void *block; // internal
+    size_t offset; // internal
+    size_t used; // internal
+} vdb_arena_mark_t;
+
+/**
+ * Slab pool of fixed-size objects (opaque)
+*/
+typedef struct vdb_slab vdb_slab_t;
+
+/**
+ * Create an arena
+ *
+ * Parameters:
+ * - block_size: Bytes per block, 0 = VDB_ARENA_DEFAULT_BLOCK. Bigger
+ *   allocations get a block of their own.
+ * - out_arena: Receives the arena; free with vdb_arena_free
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null out_arena
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+*/
+vdb_status_t vdb_arena_create(size_t block_size, vdb_arena_t **out_arena);
+
+/**
+ * Free an arena and everything allocated from it. Safe with NULL.
+ * Sets *arena to NULL after freeing.
+*/
+void vdb_arena_free(vdb_arena_t **arena);
+
+/**
+ * Allocate size bytes, VDB_ARENA_ALIGN aligned
+ * Returns: The memory (uninitialized), or NULL if out of memory
+*/
+void *vdb_arena_alloc(vdb_arena_t *arena, size_t size);
+
+/**
+ * Allocate size bytes aligned to align (a power of two, <= 4096)
+ * Returns: The memory (uninitialized), or NULL if out of memory or
+ * align isn't a power of two
+*/
+void *vdb_arena_alloc_aligned(vdb_arena_t *arena, size_t size, size_t align);
+
+/**
+ * Like vdb_arena_alloc but zeroed, n * size bytes (overflow checked)
+*/
+void *vdb_arena_calloc(vdb_arena_t *arena, size_t n, size_t size);
+
+/**
+ * Remember the current position, for vdb_arena_rewind
+*/
+vdb_arena_mark_t vdb_arena_mark(const vdb_arena_t *arena);
+
+/**
+ * Free everything allocated since mark was taken
+ * Marks taken after it are invalid afterwards.
+*/
+void vdb_arena_rewind(vdb_arena_t *arena, vdb_arena_mark_t mark);
+
+/**
+ * Free everything allocated from the arena
+*/
+void vdb_arena_reset(vdb_arena_t *arena);
+
+/**
+ * Bytes handed out since the last reset, alignment padding included
+*/
+size_t vdb_arena_used(const vdb_arena_t *arena);
+
+/**
+ * Create a zeroed vector in an arena (64-byte aligned, for the SIMD
+ * kernels). Same contract as vdb_vector_create, except the data goes
+ * with the arena: don't pass it to vdb_vector_free.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or dim out of range
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+*/
+vdb_status_t vdb_vector_create_in(vdb_arena_t *arena, uint32_t dim, vdb_vector_t *out_vector);
+
+/**
+ * Deep copy a vector into an arena (see vdb_vector_create_in)
+*/
+vdb_status_t vdb_vector_copy_in(vdb_arena_t *arena, const vdb_vector_t *src, vdb_vector_t *dst);
+
+/**
+ * Create a slab pool
+ *
+ * Parameters:
+ * - object_size: Bytes per object (> 0), rounded up to VDB_ARENA_ALIGN
+ * - objects_per_chunk: Objects malloc'd at a time, 0 = enough for 64 KiB
+ * - out_slab: Receives the pool; free with vdb_slab_free
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null out_slab or object_size == 0
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+*/
+vdb_status_t vdb_slab_create(size_t object_size, size_t objects_per_chunk, vdb_slab_t **out_slab);
+
+/**
+ * Free a pool and every object in it, released or not. Safe with NULL.
+ * Sets *slab to NULL after freeing.
+*/
+void vdb_slab_free(vdb_slab_t **slab);
+
+/**
+ * Take an object from the pool (uninitialized)
+ * Returns: The object, or NULL if out of memory
+*/
+void *vdb_slab_alloc(vdb_slab_t *slab);
+
+/**
+ * Give an object back to the pool it came from. Safe with NULL object.
+*/
+void vdb_slab_release(vdb_slab_t *slab, void *object);
+
+/**
+ * Objects currently taken from the pool
+*/
+size_t vdb_slab_live(const vdb_slab_t *slab);
+
+#endif /* VDB_ARENA_H */
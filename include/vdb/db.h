@@ -0,0 +1,151 @@
+/**
+ * db.h - One handle over every collection in a base directory
+ *
+ * A process serving many collections would otherwise open each with
+ * vdb_storage_open and pay for it separately: its file descriptors and
+ * mappings for as long as it is open, its own search threads, and its
+ * own caches sized with no regard for the others. A vdb_db_t shares
+ * these instead:
+ * - Collections are opened on first use (vdb_db_acquire) and stay open
+ *   while in use. Past max_open, the least recently used idle ones are
+ *   closed, which bounds the descriptors and mappings held.
+ * - All collections run their parallel work - searches, graph builds,
+ *   PQ training - on one thread pool, so CPUs aren't oversubscribed
+ *   however many collections are busy at once.
+ * - With a memory budget, the caches of each collection (query results,
+ *   pinned HNSW layers) are capped at an equal share of it, and when
+ *   the indexes and caches of the open collections together pass it,
+ *   idle collections are closed, least recently used first. A tenant
+ *   with large indexes then pushes out idle collections instead of
+ *   growing the caches of the busy ones without bound.
+ * - With compaction settings, one maintenance thread compacts the open
+ *   collections that are due, one at a time, instead of a compactor
+ *   thread per collection.
+ *
+ * Handles are shared: any number of threads may acquire the same
+ * collection, and get the same vdb_storage_t. Use it through the
+ * storage API until vdb_db_release; never vdb_storage_close it.
+*/
+
+#ifndef VDB_DB_H
+#define VDB_DB_H
+
+#include "storage.h"
+
+typedef struct vdb_db vdb_db_t;
+
+/* Default collections kept open at once */
+#define VDB_DB_DEFAULT_MAX_OPEN 64
+
+/* How often the maintenance thread checks memory without compaction */
+#define VDB_DB_MAINTENANCE_MS 1000
+
+/**
+ * Database options
+*/
+typedef struct {
+    uint32_t max_open; // open collections kept at once, 0 = VDB_DB_DEFAULT_MAX_OPEN
+    uint32_t threads; // shared pool, calling thread included; 0 = one per CPU
+    size_t memory_budget; // bytes for indexes and caches of all open collections, 0 = no limit
+    size_t query_cache_bytes; // result cache per collection (capped at its share), 0 = off
+    bool compaction; // compact due collections from the maintenance thread
+    vdb_compaction_params_t compaction_params; // with compaction; interval_ms paces the maintenance thread
+} vdb_db_params_t;
+
+/**
+ * Default options (64 open, one thread per CPU, no budget, no cache,
+ * no compaction)
+*/
+vdb_db_params_t vdb_db_params_default(void);
+
+/**
+ * Open every collection under base_dir (created if missing) as one
+ * database; no collection is opened yet
+ *
+ * Parameters:
+ * - base_dir: Directory holding the collections
+ * - params: Options, NULL for the defaults
+ * - out_db: Receives the handle
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument or compaction settings out of range
+ * - VDB_ERROR_IO: base_dir could not be created
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_UNKNOWN: The maintenance thread could not be started
+*/
+vdb_status_t vdb_db_open(const char *base_dir, const vdb_db_params_t *params, vdb_db_t **out_db);
+
+/**
+ * Close every open collection and free the database. Safe with NULL.
+ * No collection may still be acquired. Waits for a compaction the
+ * maintenance thread is running.
+*/
+void vdb_db_close(vdb_db_t **db);
+
+/**
+ * Create a collection and acquire it
+ *
+ * Returns:
+ * - Same as vdb_storage_create
+*/
+vdb_status_t vdb_db_create(vdb_db_t *db, const char *name, uint32_t dim, vdb_metric_t metric,
+                           vdb_storage_t **out_storage);
+
+/**
+ * Get a collection, opening it if it isn't open
+ *
+ * The handle stays valid (the collection is not closed) until it is
+ * passed to vdb_db_release; each acquire needs its own release.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument
+ * - VDB_ERROR_NOT_FOUND: No such collection
+ * - Otherwise as vdb_storage_open
+*/
+vdb_status_t vdb_db_acquire(vdb_db_t *db, const char *name, vdb_storage_t **out_storage);
+
+/**
+ * Give back a handle from vdb_db_acquire or vdb_db_create
+ * It may be closed from then on (it is only closed once no one holds it).
+*/
+void vdb_db_release(vdb_db_t *db, vdb_storage_t *storage);
+
+/**
+ * Close an idle collection now instead of waiting for it to age out
+ *
+ * Returns:
+ * - VDB_OK: Closed, or wasn't open
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument, or the collection is acquired
+*/
+vdb_status_t vdb_db_evict(vdb_db_t *db, const char *name);
+
+/**
+ * Callback for vdb_db_list; return non-zero to stop
+*/
+typedef int (*vdb_db_list_fn)(const char *name, void *user_data);
+
+/**
+ * Call fn with the name of every collection in base_dir, open or not
+ * (in directory order)
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument
+ * - VDB_ERROR_IO: base_dir could not be read
+*/
+vdb_status_t vdb_db_list(vdb_db_t *db, vdb_db_list_fn fn, void *user_data);
+
+/**
+ * Collections open now (0 for NULL)
+*/
+size_t vdb_db_open_count(vdb_db_t *db);
+
+/**
+ * Memory the open collections' indexes and caches take now, as counted
+ * against the budget (0 for NULL)
+*/
+size_t vdb_db_memory_usage(vdb_db_t *db);
+
+#endif /* VDB_DB_H */
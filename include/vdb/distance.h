@@ -0,0 +1,241 @@
+/**
+ * distance.h - Vector distance kernels
+ *
+ * This module provides the similarity computation used by search:
+ * - Single pair distance (query vs one vector)
+ * - Batch distance (one query vs N rows laid out with a fixed stride)
+ * - Tile distance (M queries vs N rows, each row read once per 4 queries)
+ *
+ * Convention: every metric is returned as a distance, lower = more similar
+ * - VDB_METRIC_COSINE: 1 - cosine similarity (range [0, 2]).
+ *   A zero vector has similarity 0 with everything (distance 1).
+ * - VDB_METRIC_EUCLIDEAN: L2 distance (range [0, inf))
+ * - VDB_METRIC_INNER_PRODUCT: 1 - a.b, unbounded; equals the cosine
+ *   distance on unit vectors, with one FMA per dimension instead of three
+ *
+ * Rows may also be f16 or bf16 (see vdb_element_type_t); the typed
+ * entry points widen them to float32 as they load, against a float32
+ * query, so a half precision collection never makes a float32 copy.
+ *
+ * Kernels exist for scalar C, SSE2, AVX2+FMA+F16C, AVX-512 and NEON. The best
+ * variant the CPU supports is picked once at startup; all entry points
+ * go through that choice, so callers never branch on the ISA.
+ *
+ * float32 vectors of the common embedding sizes (384, 768, 1024 and
+ * 1536 dimensions) also have kernels built for that exact length:
+ * fully unrolled, with no loop counter and no tail. Callers that know
+ * their dimension up front (a collection) resolve it once with
+ * vdb_distance_kernel_for_dim and use the *_kernel entry points.
+*/
+
+#ifndef VDB_DISTANCE_H
+#define VDB_DISTANCE_H
+
+#include "types.h"
+
+/**
+ * Instruction set variants of the kernels
+*/
+typedef enum {
+    VDB_ISA_SCALAR = 0, /* Portable C fallback */
+    VDB_ISA_SSE2 = 1, /* x86-64 baseline */
+    VDB_ISA_AVX2 = 2, /* AVX2 + FMA + F16C */
+    VDB_ISA_AVX512 = 3, /* AVX-512F */
+    VDB_ISA_NEON = 4, /* ARMv8 Advanced SIMD */
+} vdb_isa_t;
+
+/**
+ * Compute the distance between two vectors
+ *
+ * Parameters:
+ * - metric: Distance metric
+ * - a, b: Vectors of length dim (must not be NULL)
+ * - dim: Number of dimensions
+ *
+ * Returns: Distance (lower = more similar), or NAN for an invalid metric
+*/
+float vdb_distance(vdb_metric_t metric, const float *a, const float *b, uint32_t dim);
+
+/**
+ * Compute distances from one query to n rows
+ *
+ * Rows are read at rows + i * stride (stride in floats, >= dim), which
+ * matches the fixed-stride layout of embeddings.seg. For cosine the
+ * query norm is computed once and each row's norm is fused into the
+ * same pass as the dot product.
+ *
+ * Parameters:
+ * - metric: Distance metric
+ * - query: Query vector of length dim
+ * - rows: First row
+ * - n: Number of rows
+ * - stride: Distance between consecutive rows, in floats
+ * - dim: Number of dimensions
+ * - out: Receives n distances
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null pointers, invalid metric, stride < dim
+*/
+vdb_status_t vdb_distance_batch(
+    vdb_metric_t metric,
+    const float *query,
+    const float *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+);
+
+/**
+ * Compute distances from nq queries to n rows
+ *
+ * The GEMM-shaped version of vdb_distance_batch: queries are taken four
+ * at a time and every load of a row is shared by the four of them, so
+ * scoring a block of rows costs one pass over it per 4 queries instead
+ * of one per query. Keep n * stride small enough to stay in cache.
+ *
+ * Parameters:
+ * - metric: Distance metric
+ * - queries: First query; query j is at queries + j * query_stride
+ * - nq: Number of queries
+ * - query_stride: Distance between consecutive queries, in floats
+ * - rows, n, stride, dim: As for vdb_distance_batch
+ * - out: Receives nq * n distances, query j's row i at out[j * n + i]
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null pointers, invalid metric, a stride < dim
+*/
+vdb_status_t vdb_distance_tile(
+    vdb_metric_t metric,
+    const float *queries,
+    size_t nq,
+    size_t query_stride,
+    const float *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+);
+
+/**
+ * Distance from a float32 query to one row of the given element type
+ * Returns: Distance, or NAN for an invalid metric
+*/
+float vdb_distance_typed(vdb_metric_t metric, vdb_element_type_t type, const float *query,
+                         const void *row, uint32_t dim);
+
+/**
+ * vdb_distance_batch over rows of the given element type
+ * stride is in elements of that type, not bytes.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null pointers, invalid metric or type, stride < dim
+*/
+vdb_status_t vdb_distance_batch_typed(
+    vdb_metric_t metric,
+    vdb_element_type_t type,
+    const float *query,
+    const void *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+);
+
+/**
+ * Distance between two rows of the same element type
+ * Returns: Distance, or NAN for an invalid metric
+*/
+float vdb_distance_rows(vdb_metric_t metric, vdb_element_type_t type, const void *a,
+                        const void *b, uint32_t dim);
+
+/**
+ * Kernels for one dimension: VDB_DIM_KERNEL_GENERIC, or one specialized
+ * for it (see vdb_distance_kernel_for_dim)
+*/
+typedef uint8_t vdb_dim_kernel_t;
+
+#define VDB_DIM_KERNEL_GENERIC 0
+
+/**
+ * Get the kernels specialized for dim, VDB_DIM_KERNEL_GENERIC if there
+ * are none. The result stays valid across vdb_distance_set_isa.
+*/
+vdb_dim_kernel_t vdb_distance_kernel_for_dim(uint32_t dim);
+
+/**
+ * vdb_distance_typed through the kernels of vdb_distance_kernel_for_dim
+ * Falls back to the generic kernels for other element types than
+ * float32, or when dim isn't the one kernel was made for.
+ * Returns: Distance, or NAN for an invalid metric
+*/
+float vdb_distance_kernel(vdb_dim_kernel_t kernel, vdb_metric_t metric, vdb_element_type_t type,
+                          const float *query, const void *row, uint32_t dim);
+
+/**
+ * vdb_distance_batch_typed through the kernels of
+ * vdb_distance_kernel_for_dim, with the same fallback
+ *
+ * Returns:
+ * - Same as vdb_distance_batch_typed
+*/
+vdb_status_t vdb_distance_batch_kernel(
+    vdb_dim_kernel_t kernel,
+    vdb_metric_t metric,
+    vdb_element_type_t type,
+    const float *query,
+    const void *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+);
+
+/**
+ * Convert n values between float32 and an element type
+ * f16 and bf16 round to nearest even; f16 overflows to infinity.
+*/
+void vdb_convert_to_f32(vdb_element_type_t type, const void *src, float *dst, size_t n);
+void vdb_convert_from_f32(vdb_element_type_t type, const float *src, void *dst, size_t n);
+
+/**
+ * Raw kernels (dispatched like the metric functions)
+*/
+float vdb_dot(const float *a, const float *b, uint32_t dim);
+float vdb_l2_squared(const float *a, const float *b, uint32_t dim);
+
+/**
+ * Scale v to unit length in place. A zero vector is left as it is.
+ * Returns: The L2 norm v had
+*/
+float vdb_normalize(float *v, uint32_t dim);
+
+/**
+ * Get the kernel variant currently in use
+*/
+vdb_isa_t vdb_distance_get_isa(void);
+
+/**
+ * Check whether this CPU (and build) supports a kernel variant
+*/
+bool vdb_distance_isa_supported(vdb_isa_t isa);
+
+/**
+ * Force a kernel variant (for tests and benchmarks)
+ * Not thread-safe with concurrent distance calls; call it up front.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Unsupported on this CPU or invalid isa
+*/
+vdb_status_t vdb_distance_set_isa(vdb_isa_t isa);
+
+/**
+ * Get human-readable name of a kernel variant (e.g. "avx2")
+*/
+const char* vdb_isa_to_string(vdb_isa_t isa);
+
+#endif /* VDB_DISTANCE_H */
@@ -0,0 +1,60 @@
+/**
+ * filter.h - Metadata filter expressions
+ *
+ * Filters select rows by the JSON metadata given at append time. The
+ * top-level fields of each row's metadata object are indexed when the
+ * row is appended:
+ * - strings and booleans as exact terms (inverted postings)
+ * - numbers in a per-field range index
+ * - arrays of those as one term / value per element
+ * Nested objects and null are skipped; metadata that isn't a valid
+ * JSON object is stored as before but matches no field.
+ *
+ * Expressions:
+ *   expr   := term (OR term)*
+ *   term   := factor (AND factor)*
+ *   factor := NOT factor | '(' expr ')' | field op value
+ *   op     := = | == | != | < | <= | > | >=
+ *   value  := "string" | number | true | false
+ *
+ * Keywords are case-insensitive. A field is a bare word
+ * ([A-Za-z_][A-Za-z0-9_.-]*) or a double-quoted string. Ordering
+ * operators need a number; = and != compare strings, booleans and
+ * numbers exactly, and a value only ever matches fields of its own
+ * type ("5" != 5). NOT and != match rows without the field too.
+ *
+ * Example: category = "shoes" AND (price < 50 OR on_sale = true)
+*/
+
+#ifndef VDB_FILTER_H
+#define VDB_FILTER_H
+
+#include "types.h"
+
+/**
+ * Parsed filter expression (opaque)
+ * Independent of any collection: parse once, use in many searches.
+*/
+typedef struct vdb_filter vdb_filter_t;
+
+/**
+ * Parse a filter expression
+ *
+ * Parameters:
+ * - expr: Null-terminated expression (see grammar above)
+ * - out_filter: Receives the filter on success; free with vdb_filter_free
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or syntax error
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+*/
+vdb_status_t vdb_filter_parse(const char *expr, vdb_filter_t **out_filter);
+
+/**
+ * Free a filter. Safe with NULL.
+ * Sets *filter to NULL after freeing.
+*/
+void vdb_filter_free(vdb_filter_t **filter);
+
+#endif /* VDB_FILTER_H */
@@ -0,0 +1,106 @@
+/**
+ * import.h - Bulk import of vectors from files
+ *
+ * Input formats:
+ * - .fvecs: per vector an int32 dimension, then that many float32s
+ *   (little-endian, the TEXMEX / ann-benchmarks layout)
+ * - .npy: a 2-D C-order <f4 or <f8 array, one row per vector
+ * - .jsonl: one object per line, {"id": ..., "vector": [...],
+ *   "metadata": {...}}. id (a string or an integer) and vector are
+ *   required, metadata is optional and stored as written. Other fields
+ *   and blank lines are skipped.
+ * fvecs and npy rows have no IDs: row i of the file gets the decimal
+ * ID first_id + i.
+ *
+ * The import is a pipeline over a bounded ring of large chunks: one
+ * thread reads the file ahead, several parse chunks at once, and the
+ * calling thread appends each parsed chunk in file order with
+ * vdb_storage_append_batch_async, syncing the WAL once at the end.
+ * Reading, parsing and appending all overlap, and memory stays at a
+ * few chunks per parse thread however big the file is.
+ *
+ * An import is not atomic: batches appended before a failure stay
+ * stored, and durable (vdb_import_stats_t says how far it got).
+*/
+
+#ifndef VDB_IMPORT_H
+#define VDB_IMPORT_H
+
+#include "storage.h"
+
+/**
+ * Input format
+*/
+typedef enum {
+    VDB_IMPORT_AUTO = 0, // from the file extension
+    VDB_IMPORT_FVECS = 1,
+    VDB_IMPORT_NPY = 2,
+    VDB_IMPORT_JSONL = 3
+} vdb_import_format_t;
+
+/* Default rows per vdb_storage_append_batch call */
+#define VDB_IMPORT_DEFAULT_BATCH_ROWS 8192
+
+/* Default bytes read per chunk */
+#define VDB_IMPORT_DEFAULT_CHUNK_BYTES (4u << 20)
+
+/**
+ * Import options
+*/
+typedef struct {
+    vdb_import_format_t format;
+    uint32_t parse_threads; // 0 = one per CPU
+    uint32_t batch_rows; // rows per append, 0 = VDB_IMPORT_DEFAULT_BATCH_ROWS
+    uint32_t chunk_bytes; // 0 = VDB_IMPORT_DEFAULT_CHUNK_BYTES
+    uint64_t first_id; // ID of the first fvecs / npy row
+    bool build_hnsw; // build the HNSW index at the end (seal it if there is one)
+} vdb_import_params_t;
+
+/**
+ * How far an import got
+*/
+typedef struct {
+    uint64_t rows; // rows appended
+    uint64_t bytes; // input bytes read
+    uint64_t failed_record; // 1-based vector (line for JSONL) that didn't parse, 0 = none
+} vdb_import_stats_t;
+
+/**
+ * Default import options (auto format, one parse thread per CPU)
+*/
+vdb_import_params_t vdb_import_params_default(void);
+
+/**
+ * Guess the format from a path's extension (.fvecs, .npy, .jsonl / .ndjson)
+ * Returns: The format, or VDB_IMPORT_AUTO if the extension is unknown
+*/
+vdb_import_format_t vdb_import_format_from_path(const char *path);
+
+/**
+ * Append every vector of a file to a collection
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - path: Input file
+ * - params: Options (NULL = vdb_import_params_default())
+ * - out_stats: Receives progress, also on failure (nullable)
+ *
+ * Returns:
+ * - VDB_OK: Success, every row is durable
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params, unknown format, or a
+ *   record that doesn't parse (see failed_record)
+ * - VDB_ERROR_DIMENSION_MISMATCH: A vector of the wrong dimension
+ * - VDB_ERROR_ALREADY_EXISTS: An ID is stored already or repeats in a batch
+ * - VDB_ERROR_NOT_FOUND: The file doesn't exist
+ * - VDB_ERROR_CORRUPTED: Truncated fvecs record or npy data, bad npy header
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: Read or write failed
+*/
+vdb_status_t vdb_storage_import(
+    vdb_storage_t *storage,
+    const char *path,
+    const vdb_import_params_t *params,
+    vdb_import_stats_t *out_stats
+);
+
+#endif /* VDB_IMPORT_H */
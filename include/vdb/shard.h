@@ -0,0 +1,226 @@
+/**
+ * shard.h - One collection split across several storages
+ *
+ * A vdb_storage_t lives in one directory and takes its writes one at a
+ * time. A sharded collection spreads its IDs over N storages (shards),
+ * each of which may sit on a different disk, so appends to different
+ * shards run side by side on different writer locks and devices.
+ *
+ * Partitioning:
+ * - VDB_SHARD_HASH: an ID lives in shard crc32c(id) % N. Appends, gets
+ *   and deletes touch only that shard; every search asks every shard.
+ * - VDB_SHARD_IVF: N centroids are learned with k-means from sample
+ *   vectors at create time, and a row goes to the shard of its nearest
+ *   centroid. Similar vectors share a shard, so a search may probe only
+ *   the shards of the few centroids nearest the query (nprobe) and skip
+ *   the rest, at some cost in recall. The ID doesn't say where a row
+ *   is, so gets and deletes look in every shard.
+ *
+ * A search runs on every probed shard at once, each shard keeping its
+ * own top-k, and the shard results are merged into one top-k. All
+ * shards share one thread pool for this and for their own parallel
+ * work.
+ *
+ * Layout: <base_dir>/<name>/shards.meta records the partitioning (and
+ * the IVF centroids); shard i is the collection "shard-<i>" under
+ * <dir_i>/<name>, where dir_i is base_dir unless given. Each shard is
+ * an ordinary collection with its own WAL, indexes and settings
+ * (vdb_sharded_shard hands it out to enable HNSW, quantization, ...).
+ *
+ * Writes are atomic per shard only: a batch spanning shards can be
+ * half applied, and an IVF upsert that moves a row to another shard
+ * appends the new row before deleting the old one, so a crash in
+ * between leaves both (the next upsert or delete of the ID removes the
+ * stale one).
+*/
+
+#ifndef VDB_SHARD_H
+#define VDB_SHARD_H
+
+#include "storage.h"
+
+typedef struct vdb_sharded vdb_sharded_t;
+
+/* Most shards a collection can have */
+#define VDB_SHARD_MAX 256
+
+/**
+ * How IDs are spread over the shards
+*/
+typedef enum {
+    VDB_SHARD_HASH = 0, /* By ID hash */
+    VDB_SHARD_IVF = 1, /* By nearest k-means centroid of the vector */
+} vdb_shard_mode_t;
+
+/**
+ * Sharded collection options
+*/
+typedef struct {
+    vdb_shard_mode_t mode;
+    uint32_t num_shards; // 1..VDB_SHARD_MAX
+    const char *const *shard_dirs; // num_shards base directories (one per disk), NULL = all in base_dir
+    const float *train; // IVF: num_train vectors of dim floats to learn the centroids from
+    size_t num_train; // IVF: at least num_shards
+    uint32_t threads; // shared pool, calling thread included; 0 = one per CPU
+} vdb_shard_params_t;
+
+/**
+ * Default options (hash partitioning over 4 shards in base_dir, one
+ * thread per CPU)
+*/
+vdb_shard_params_t vdb_shard_params_default(void);
+
+/**
+ * Create a sharded collection and its shards
+ *
+ * Parameters:
+ * - base_dir: Directory holding the collection (and its shards, unless shard_dirs says otherwise)
+ * - name: Collection name
+ * - dim, metric: As vdb_storage_create, for every shard
+ * - params: Options
+ * - out_sharded: Receives the handle
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument, bad name/dim/metric, num_shards
+ *   out of range, or IVF without enough training vectors
+ * - VDB_ERROR_ALREADY_EXISTS: The collection or one of its shards exists
+ * - VDB_ERROR_IO: A directory or shards.meta could not be written
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ *
+ * A create that fails part-way leaves the shards it made behind; they
+ * have to be removed before the name can be created again.
+*/
+vdb_status_t vdb_sharded_create(const char *base_dir, const char *name, uint32_t dim, vdb_metric_t metric,
+                                const vdb_shard_params_t *params, vdb_sharded_t **out_sharded);
+
+/**
+ * Open a sharded collection and all of its shards
+ *
+ * Parameters:
+ * - threads: Shared pool size, calling thread included; 0 = one per CPU
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument
+ * - VDB_ERROR_NOT_FOUND: No shards.meta, or a shard is missing
+ * - VDB_ERROR_CORRUPTED: Bad shards.meta, or a shard's dimension or metric differs
+ * - Otherwise as vdb_storage_open
+*/
+vdb_status_t vdb_sharded_open(const char *base_dir, const char *name, uint32_t threads,
+                              vdb_sharded_t **out_sharded);
+
+/**
+ * Close every shard and free the handle. Safe with NULL.
+*/
+void vdb_sharded_close(vdb_sharded_t **sharded);
+
+/* Number of shards (0 for NULL) */
+uint32_t vdb_sharded_num_shards(const vdb_sharded_t *sharded);
+
+/**
+ * Shard i, for per-shard settings, indexes and stats (NULL if out of
+ * range). Owned by the sharded collection: never vdb_storage_close it,
+ * and write rows through vdb_sharded_* so they land in the right shard.
+*/
+vdb_storage_t *vdb_sharded_shard(vdb_sharded_t *sharded, uint32_t i);
+
+/**
+ * Append an item to the shard that owns it
+ *
+ * Returns:
+ * - Same as vdb_storage_append (VDB_ERROR_ALREADY_EXISTS if any shard
+ *   holds the ID)
+*/
+vdb_status_t vdb_sharded_append(vdb_sharded_t *sharded, const vdb_item_t *item);
+
+/**
+ * Append items, split by shard; the shards' batches run in parallel
+ * Each shard's part is all or nothing, but the batch as a whole isn't:
+ * on error, the parts of other shards may have been appended.
+ *
+ * Returns:
+ * - Same as vdb_storage_append_batch
+*/
+vdb_status_t vdb_sharded_append_batch(vdb_sharded_t *sharded, const vdb_item_t *items, size_t n);
+
+/**
+ * Insert or replace an item; under IVF a row whose vector moved to
+ * another partition moves to that shard
+ *
+ * Returns:
+ * - Same as vdb_storage_upsert
+*/
+vdb_status_t vdb_sharded_upsert(vdb_sharded_t *sharded, const vdb_item_t *item);
+
+/**
+ * Delete an ID
+ *
+ * Returns:
+ * - Same as vdb_storage_delete
+*/
+vdb_status_t vdb_sharded_delete(vdb_sharded_t *sharded, const char *id);
+
+/**
+ * Get an item by ID
+ *
+ * Returns:
+ * - Same as vdb_storage_get
+*/
+vdb_status_t vdb_sharded_get(vdb_sharded_t *sharded, const char *id, vdb_item_t *out_item);
+
+/**
+ * Index each shard searches with
+*/
+typedef enum {
+    VDB_SHARD_SEARCH_EXACT = 0, /* vdb_storage_search_exact(_filtered) */
+    VDB_SHARD_SEARCH_HNSW = 1, /* vdb_storage_search_hnsw(_filtered) */
+    VDB_SHARD_SEARCH_DISKANN = 2, /* vdb_storage_search_diskann (no filter) */
+} vdb_shard_search_t;
+
+/**
+ * Search options
+*/
+typedef struct {
+    vdb_shard_search_t kind;
+    const vdb_filter_t *filter; // exact and HNSW; NULL = every row
+    uint32_t nprobe; // IVF: shards of the nprobe centroids nearest the query; 0 = all shards
+} vdb_shard_query_t;
+
+/**
+ * Top-k search across the shards
+ *
+ * Every probed shard is searched in parallel for its own top k, and
+ * those are merged into the best k overall, best first (ties go to the
+ * lower shard, then the lower row). A hit's row is its row within its
+ * shard.
+ *
+ * Parameters:
+ * - query: Query vector (dimension must match)
+ * - k: Number of hits wanted (> 0)
+ * - options: NULL = exact search of every shard
+ * - out_results: Receives the hits; release with vdb_search_results_free
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params, k == 0, or a filter with DiskANN
+ * - Otherwise the first error of a shard search
+*/
+vdb_status_t vdb_sharded_search(vdb_sharded_t *sharded, const vdb_vector_t *query, uint32_t k,
+                                const vdb_shard_query_t *options, vdb_search_results_t *out_results);
+
+/**
+ * Rows in all shards (as vdb_storage_count, summed; 0 for NULL)
+*/
+uint64_t vdb_sharded_count(vdb_sharded_t *sharded);
+
+/**
+ * Checkpoint every shard
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - Otherwise the first error of a shard (the others are still checkpointed)
+*/
+vdb_status_t vdb_sharded_checkpoint(vdb_sharded_t *sharded);
+
+#endif /* VDB_SHARD_H */
@@ -0,0 +1,140 @@
+/**
+ * stats.h - Counters and latency histograms of a storage
+ *
+ * Every storage counts what its hot paths do: appends, WAL fsyncs and
+ * their latency, bytes written per file, searches and their latency,
+ * distances computed and HNSW hops. Counting is always on. Each thread
+ * bumps a shard of its own with relaxed atomic adds (no locks, no
+ * shared cache lines in the common case), and vdb_storage_get_stats
+ * sums the shards into a snapshot.
+ *
+ * Counts start at zero on open; they are not persisted.
+ *
+ * Histograms are log-linear like HDR histograms: values below 8 ns get
+ * a bucket each, and every power of two above is split into 8 buckets,
+ * so a recorded value is within 12.5% of its bucket's bounds.
+*/
+
+#ifndef VDB_STATS_H
+#define VDB_STATS_H
+
+#include "storage.h"
+#include <stdio.h>
+
+/* Sub-buckets per power of two, as a shift */
+#define VDB_HISTOGRAM_SUB_BITS 3
+
+/* Largest power of two tracked; longer latencies land in the last bucket */
+#define VDB_HISTOGRAM_MAX_BITS 36 // ~69 s
+
+/* Buckets per histogram */
+#define VDB_HISTOGRAM_BUCKETS \
+    ((1u << VDB_HISTOGRAM_SUB_BITS) * (VDB_HISTOGRAM_MAX_BITS - VDB_HISTOGRAM_SUB_BITS + 1))
+
+/**
+ * Latency histogram, in nanoseconds
+*/
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[VDB_HISTOGRAM_BUCKETS];
+} vdb_histogram_t;
+
+/**
+ * Bytes written, per file kind
+*/
+typedef struct {
+    uint64_t wal;
+    uint64_t embeddings;
+    uint64_t ids;
+    uint64_t metadata;
+    uint64_t norms;
+    uint64_t codes; // embeddings.sq8 / embeddings.pq
+    uint64_t index; // hnsw-<n>.idx graphs and diskann.idx
+} vdb_bytes_written_t;
+
+/**
+ * Snapshot of a storage's counters
+*/
+typedef struct {
+    /* Writes */
+    uint64_t appended_rows; // appends and upserts
+    uint64_t append_calls; // append / upsert calls (a batch is one)
+    uint64_t deletes;
+    uint64_t wal_fsyncs;
+    uint64_t checkpoints;
+    vdb_bytes_written_t bytes_written;
+
+    /* Searches; a filtered HNSW search that scans instead still counts as HNSW */
+    uint64_t exact_searches;
+    uint64_t hnsw_searches;
+    uint64_t diskann_searches;
+    uint64_t batch_searches; // vdb_storage_search_batch calls
+    uint64_t batch_queries; // queries they ran
+    uint64_t distances; // vectors or codes scored, reranks included
+    uint64_t hnsw_hops; // graph nodes whose links were followed
+    uint64_t diskann_reads; // node records read from diskann.idx
+    uint64_t query_cache_hits; // searches answered from the query cache (counted as searches too)
+    uint64_t query_cache_misses; // searches run with the cache on
+
+    vdb_histogram_t append_latency; // whole call, WAL fsync included
+    vdb_histogram_t wal_fsync_latency;
+    vdb_histogram_t exact_search_latency;
+    vdb_histogram_t hnsw_search_latency;
+    vdb_histogram_t diskann_search_latency;
+    vdb_histogram_t batch_search_latency; // per call, not per query
+} vdb_stats_t;
+
+/**
+ * Sum the counters so far
+ * Counters other threads bump meanwhile may or may not be included, so
+ * two fields of one snapshot can be a few events apart.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or out_stats
+*/
+vdb_status_t vdb_storage_get_stats(vdb_storage_t *storage, vdb_stats_t *out_stats);
+
+/**
+ * Zero every counter
+ * Events recorded while it runs may survive it.
+*/
+vdb_status_t vdb_storage_reset_stats(vdb_storage_t *storage);
+
+/**
+ * Value below which a fraction of the recorded values fall
+ *
+ * Parameters:
+ * - histogram: Histogram
+ * - quantile: 0.0 - 1.0 (0.99 = p99)
+ *
+ * Returns: The upper bound of the bucket holding that value (capped at
+ * max_ns), 0 for an empty histogram
+*/
+uint64_t vdb_histogram_quantile(const vdb_histogram_t *histogram, double quantile);
+
+/**
+ * Mean of the recorded values in nanoseconds, 0 if there are none
+*/
+double vdb_histogram_mean(const vdb_histogram_t *histogram);
+
+/**
+ * Write a snapshot in the Prometheus text exposition format
+ * Counters become vdb_*_total, histograms summaries (in seconds, with
+ * p50 / p90 / p99 / p999 quantiles), all labelled with the collection.
+ *
+ * Parameters:
+ * - stats: Snapshot
+ * - collection: Value of the collection label
+ * - out: Stream to write to
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument
+ * - VDB_ERROR_IO: Writing failed
+*/
+vdb_status_t vdb_stats_write_prometheus(const vdb_stats_t *stats, const char *collection, FILE *out);
+
+#endif /* VDB_STATS_H */
@@ -3,21 +3,60 @@
  * 
  * This module handles:
  * - Writing vectors to disk (append-only segment)
- * - Write-ahead logging (WAL) for crash recovery
+ * - Write-ahead logging (WAL) with CRC32C-framed records for crash recovery
  * - Memory-mapped reads for performance
  * - Atomic operations via fsync
  * 
  * File layout per collection:
- *    data/<name>/collection.meta   - Metadata (dim, metric, count)
- *    data/<name>/embeddings.seq    - Float32 embeddings (dim * 4 bytes per vector)
- *    data/<name>/ids.seq           - Fixed 64-byte IDs
- *    data/<name>/metadata.seq      - Length-prefixed JSON strings
+ *    data/<name>/collection.meta   - Binary superblock (version, features, dim, metric, count,
+ *                                    metadata.seg length)
+ *    data/<name>/embeddings.seg    - Embeddings (dim * 4 bytes per vector, 2 for f16/bf16,
+ *                                    or padded to VDB_ROW_ALIGN)
+ *    data/<name>/norms.seg         - float32 norm per row (only with VDB_NORMALIZE_KEEP_NORMS)
+ *    data/<name>/ids.seg           - Fixed 64-byte IDs
+ *    data/<name>/ids.idx           - ID -> row hash index, with deletes
+ *    data/<name>/index.snap        - ID and metadata indexes as of the last checkpoint
+ *    data/<name>/metadata.seg      - Length-prefixed JSON strings
  *    data/<name>/wal.log           - Write-ahead log
+ *    data/<name>/hnsw.idx          - HNSW params + sealed segment list (only if enabled)
+ *    data/<name>/hnsw-<n>.idx      - HNSW graph of one sealed segment
+ *    data/<name>/diskann.idx       - Vamana graph + full vectors in 4 KB sectors (only if built)
+ *    data/<name>/embeddings.sq8    - 8-bit codes (only with SQ8 quantization)
+ *    data/<name>/sq8.params        - SQ8 per-dimension offset/scale
+ *    data/<name>/embeddings.pq     - 4-bit PQ codes in 32-row blocks (only with PQ)
+ *    data/<name>/pq.params         - PQ codebooks
+ *    data/<name>/.compact/         - New files while a compaction swaps them in
  * 
  * Design:
- * - Append-only: Never modify existing data (simplifies concurrency)
- * - WAL-first: Write to WAL + fsync before touching segments
- * -mmap reads: OS manages caching, fast sequential/random access
+ * - Append-only: Never modify existing data (simplifies concurrency).
+ *   An upsert appends a new row and moves its ID to it; a delete only
+ *   flags the ID in ids.idx. Searches skip the dead rows this leaves
+ *   behind, and compaction rewrites the segments without them.
+ * - WAL-first: An append is durable once its WAL frame is fsync'd; the
+ *   segments are fsync'd only at checkpoints, which record the count in
+ *   collection.meta and empty the WAL. Open replays frames past it.
+ * - Fast restarts: a checkpoint also writes the in-memory ID and
+ *   metadata indexes to index.snap, in a layout open maps as is, so
+ *   open only indexes the rows past the snapshot rather than all of them.
+ * - mmap reads: OS manages caching, fast sequential/random access
+ * - Metadata filtering: top-level JSON fields are indexed in memory as
+ *   rows are appended (restored from index.snap on open), see filter.h
+ * - Sealed segments: with HNSW on, fresh rows form a memtable that is
+ *   searched exactly. Every VDB_DEFAULT_SEGMENT_ROWS of them are sealed
+ *   in the background into an immutable range with its own graph, so
+ *   appends never wait on index builds.
+ *
+ * Concurrency:
+ * - One handle may be shared by any number of threads. Writes (appends,
+ *   upserts, deletes, settings) run one at a time.
+ * - Reads (searches, get, iterate, count) take no lock the writer holds
+ *   while it syncs: each write publishes a snapshot of the committed
+ *   rows once they are in the segments, and readers work on the latest
+ *   one. A read never sees part of a batch.
+ * - Mappings, codecs and search threads a write replaces are freed once
+ *   the last read that could still see them returns.
+ * - Compaction renumbers rows, so reads pause for its final swap (not
+ *   for the copy before it).
 */
 
 #ifndef VDB_STORAGE_H
@@ -25,6 +64,7 @@
 
 #include "types.h"
 #include "collection.h"
+#include "filter.h"
 #include <stdint.h>
 
 /** 
@@ -70,7 +110,7 @@ typedef int (*vdb_storage_iter_fn)(const vdb_item_t *item, void *user_data);
  * Returns:
  * - VDB_OK: Success
  * - VDB_ERROR_ALREADY_EXISTS: Collection already exists
- * - VDB_ERROR_INVALID_ARGUMENT: Invalid parameters
+ * - VDB_ERROR_INVALID_ARGUMENT: Invalid parameters, or a path too long
  * - VDB_ERROR_IO: Failed to create files
 */
 vdb_status_t vdb_storage_create(
@@ -84,7 +124,9 @@ vdb_status_t vdb_storage_create(
 /**
  * Open an existing collection from disk
  * 
- * Loads metadata and recovers from WAL if needed
+ * Loads metadata and recovers from WAL if needed. A text
+ * collection.meta from older versions is still read and is replaced
+ * by the binary superblock at the next checkpoint.
  * 
  * Parameters:
  * - base_dir: Base directory for data
@@ -93,9 +135,11 @@ vdb_status_t vdb_storage_create(
  * 
  * Returns:
  * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null argument, or a path too long
  * - VDB_ERROR_NOT_FOUND: Collection doesn't exist
  * - VDB_ERROR_IO: I/O error
- * - VDB_ERROR_CORRUPTED: Metadata corrupted
+ * - VDB_ERROR_CORRUPTED: Superblock checksum, version or fields invalid,
+ *   or unknown feature flags
 */
 vdb_status_t vdb_storage_open(
     const char *base_dir,
@@ -113,18 +157,18 @@ void vdb_storage_close(vdb_storage_t **storage);
 /**
  * Append an item to storage
  * 1. Validate item (dimension matches collection)
- * 2. Write to WAL + fsync
- * 3. Append to segment files
- * 4. Update metadata (increment count)
- * 5. Truncate WAL
+ * 2. Write a CRC32C-framed WAL record + fsync (this makes it durable)
+ * 3. Append to segment files (no fsync)
+ * 4. Increment count; checkpoint if the WAL is past checkpoint_bytes
  * 
  * Parameters:
  * - storage: Storage handle
- * - item: Item to append (ID must be unique - not checking for now)
+ * - item: Item to append (ID must not be stored already, see upsert)
  * 
  * Returns:
  * - VDB_OK: Success
  * - VDB_ERROR_INVALID_ARGUMENT: Null params or dimension mismatch
+ * - VDB_ERROR_ALREADY_EXISTS: An item with this ID is stored
  * - VDB_ERROR_IO: Write failed
 */
 vdb_status_t vdb_storage_append(
@@ -132,11 +176,374 @@ vdb_status_t vdb_storage_append(
     const vdb_item_t *item
 );
 
+/**
+ * Append a batch of items to storage
+ * Same semantics as vdb_storage_append, but amortizes the I/O:
+ * 1. Validate every item up front (nothing is written if one is bad)
+ * 2. Write ONE WAL frame holding all records + fsync
+ * 3. Write each segment file once (staged in memory)
+ * 4. Increment count by n; checkpoint if the WAL is past checkpoint_bytes
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - items: Array of n items
+ * - n: Number of items (0 is a no-op)
+ *
+ * Returns:
+ * - VDB_OK: Success, all n items are durable
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or invalid ID
+ * - VDB_ERROR_DIMENSION_MISMATCH: An item has the wrong dimension
+ * - VDB_ERROR_ALREADY_EXISTS: An ID is stored already or repeats in the batch
+ * - VDB_ERROR_OUT_OF_MEMORY: Staging buffers could not be allocated
+ * - VDB_ERROR_IO: Write failed
+*/
+vdb_status_t vdb_storage_append_batch(
+    vdb_storage_t *storage,
+    const vdb_item_t *items,
+    size_t n
+);
+
+/* Handle of an append that may not be durable yet; 0 = nothing to wait for */
+typedef uint64_t vdb_commit_ticket_t;
+
+/**
+ * Append a batch without waiting for it to be durable
+ * Like vdb_storage_append_batch, except that the WAL frame isn't
+ * fsync'd here: the rows are written and searchable on return, and
+ * *out_ticket says what to hand vdb_storage_wait_durable. Until that
+ * returns VDB_OK (or something else syncs the WAL - a later plain
+ * append, the group committer, a checkpoint or close) a crash may lose
+ * them. Lets one thread keep the device busy: with group commit on,
+ * the committer fsyncs while the caller writes the next batch; without
+ * it, many batches share the fsync of one final wait.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - items: Array of n items
+ * - n: Number of items (0 is a no-op with ticket 0)
+ * - out_ticket: Ticket of this append
+ *
+ * Returns:
+ * - Same as vdb_storage_append_batch, VDB_OK meaning written (not durable)
+*/
+vdb_status_t vdb_storage_append_batch_async(
+    vdb_storage_t *storage,
+    const vdb_item_t *items,
+    size_t n,
+    vdb_commit_ticket_t *out_ticket
+);
+
+/**
+ * Wait until the append behind a ticket - and every append before
+ * it - is durable
+ * Syncs the WAL itself unless the group committer is running, in which
+ * case it waits for the committer's next sync.
+ *
+ * Returns:
+ * - VDB_OK: Durable
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or a ticket not handed out
+ * - VDB_ERROR_IO: The sync failed
+*/
+vdb_status_t vdb_storage_wait_durable(vdb_storage_t *storage, vdb_commit_ticket_t ticket);
+
+/**
+ * Insert an item, or replace the one stored under its ID
+ *
+ * Written exactly like an append; the new row takes over the ID and
+ * the old row is superseded (vdb_storage_get returns the new one).
+ * Within a batch the last item with an ID wins. Searches and iterate
+ * skip superseded and deleted rows; compaction reclaims their space.
+ *
+ * Returns:
+ * - Same as vdb_storage_append / vdb_storage_append_batch, without
+ *   VDB_ERROR_ALREADY_EXISTS
+*/
+vdb_status_t vdb_storage_upsert(vdb_storage_t *storage, const vdb_item_t *item);
+vdb_status_t vdb_storage_upsert_batch(vdb_storage_t *storage, const vdb_item_t *items, size_t n);
+
+/**
+ * Delete the item stored under an ID
+ *
+ * Logs the deleted row to the WAL and flags the ID in the ID index;
+ * the row itself stays in the segments. The ID can be appended again
+ * afterwards. Durable when this returns, like an append.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or invalid ID
+ * - VDB_ERROR_NOT_FOUND: No item with this ID
+ * - VDB_ERROR_IO: Write failed
+*/
+vdb_status_t vdb_storage_delete(vdb_storage_t *storage, const char *id);
+
+/**
+ * Look up an item by ID (one hash probe, no scan)
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - id: ID to look up
+ * - out_item: Receives copies of the vector and metadata (metadata is
+ *   NULL if the item has none); release with vdb_storage_item_free()
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or invalid ID
+ * - VDB_ERROR_NOT_FOUND: No item with this ID (or it was deleted)
+ * - VDB_ERROR_OUT_OF_MEMORY: Copies could not be allocated
+*/
+vdb_status_t vdb_storage_get(vdb_storage_t *storage, const char *id, vdb_item_t *out_item);
+
+/**
+ * Free what vdb_storage_get copied into an item. Safe with NULL.
+*/
+void vdb_storage_item_free(vdb_item_t *item);
+
+/**
+ * Background compaction settings
+*/
+typedef struct {
+    double min_dead_fraction; // compact once this share of the rows is dead, (0, 1]
+    uint64_t io_bytes_per_sec; // copy budget, 0 = unthrottled
+    uint32_t interval_ms; // how often the dead share is checked
+} vdb_compaction_params_t;
+
+/**
+ * Default compaction settings (20% dead, 32 MiB/s, checked every second)
+*/
+vdb_compaction_params_t vdb_compaction_params_default(void);
+
+/**
+ * Rewrite the segments without superseded and deleted rows
+ *
+ * The live rows are copied into new files while appends and searches
+ * carry on, at most io_bytes_per_sec bytes per second (0 = as fast as
+ * possible). Rows appended meanwhile are then copied and the new files
+ * swapped in, which briefly blocks both. Rows are renumbered (hit rows
+ * change, IDs don't); the ID, filter and HNSW indexes are remapped and
+ * quantized codes are encoded again. A crash leaves either the old
+ * files or the new ones - open finishes a swap that was under way.
+ *
+ * Returns:
+ * - VDB_OK: Success, also when no row was dead
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: New files could not be written (the old ones are kept)
+*/
+vdb_status_t vdb_storage_compact(vdb_storage_t *storage, uint64_t io_bytes_per_sec);
+
+/**
+ * Start or reconfigure the background compactor (NULL stops it)
+ * It runs vdb_storage_compact whenever the dead share reaches
+ * min_dead_fraction. Stopped on close, abandoning a copy in progress.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or settings out of range
+ * - VDB_ERROR_UNKNOWN: Thread could not be started
+*/
+vdb_status_t vdb_storage_set_compaction(vdb_storage_t *storage, const vdb_compaction_params_t *params);
+
+/**
+ * Rows that are neither superseded nor deleted, among the rows readers
+ * see (vdb_storage_count); never waits on a writer
+*/
+uint64_t vdb_storage_live_count(vdb_storage_t *storage);
+
+/**
+ * Configure group commit
+ *
+ * With group commit enabled, appends (single or batch) write their data
+ * without syncing and then block until a background committer thread
+ * has fsync'd the WAL. The committer waits up to window_us after the
+ * first pending append, so appends from concurrent callers that land
+ * inside the same window share a single fsync.
+ *
+ * An append still only returns VDB_OK once its data is durable. If the
+ * committer's fsync fails, the appends it covered return VDB_ERROR_IO
+ * and are never made visible; whether they survived is only known once
+ * the collection is reopened (replay brings back what reached the WAL).
+ * The handle stays readable but fails every write and checkpoint with
+ * that error from then on, so it has to be closed and reopened.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - window_us: Commit window in microseconds (0 disables group commit,
+ *   flushing anything pending and stopping the committer thread)
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+ * - VDB_ERROR_UNKNOWN: Committer thread could not be started
+ * - VDB_ERROR_IO: Final flush failed while disabling
+*/
+vdb_status_t vdb_storage_set_group_commit(
+    vdb_storage_t *storage,
+    uint32_t window_us
+);
+
+/**
+ * How the write path does its I/O
+ * - VDB_IO_BLOCKING: write() / fsync() one file at a time (default)
+ * - VDB_IO_URING: io_uring (Linux). An append is one submission: the
+ *   WAL write and its fsync linked, the segment writes running
+ *   alongside; checkpoints fsync every segment at once.
+*/
+typedef enum {
+    VDB_IO_BLOCKING = 0,
+    VDB_IO_URING = 1
+} vdb_io_backend_t;
+
+/**
+ * Pick the I/O backend of an open collection; not persisted
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or unknown backend
+ * - VDB_ERROR_NOT_FOUND: No io_uring in this build or kernel (the
+ *   backend stays what it was)
+ * - VDB_ERROR_OUT_OF_MEMORY: Ring setup failed
+*/
+vdb_status_t vdb_storage_set_io_backend(vdb_storage_t *storage, vdb_io_backend_t backend);
+vdb_io_backend_t vdb_storage_get_io_backend(vdb_storage_t *storage);
+
+/* WAL size that triggers a checkpoint by default */
+#define VDB_DEFAULT_CHECKPOINT_BYTES (64ull << 20)
+
+/**
+ * Checkpoint now
+ *
+ * fsyncs the segment files, records the row count in collection.meta
+ * and empties wal.log, then snapshots the ID and metadata indexes to
+ * index.snap if they changed. Happens on its own when the WAL reaches
+ * the checkpoint size and on close; after a crash, open replays
+ * whatever the WAL holds past the last checkpoint, and indexes only the
+ * rows past the snapshot.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+ * - VDB_ERROR_IO: A sync or the meta write failed (the WAL is kept)
+*/
+vdb_status_t vdb_storage_checkpoint(vdb_storage_t *storage);
+
+/**
+ * Set the WAL size at which a commit also checkpoints
+ * Smaller = faster recovery, more fsyncs and index snapshots (each
+ * writes the whole ID and metadata indexes). 0 checkpoints on every
+ * commit. Default VDB_DEFAULT_CHECKPOINT_BYTES.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+*/
+vdb_status_t vdb_storage_set_checkpoint_bytes(vdb_storage_t *storage, uint64_t bytes);
+
+/* Row size multiple of the padded layout (a cache line) */
+#define VDB_ROW_ALIGN 64
+
+/**
+ * Layout of the rows in embeddings.seg
+*/
+typedef enum {
+    VDB_ROW_LAYOUT_PACKED = 0, /* dim * 4 bytes per row */
+    VDB_ROW_LAYOUT_PADDED = 1, /* rounded up to VDB_ROW_ALIGN bytes, zero filled */
+} vdb_row_layout_t;
+
+/**
+ * Set the row layout of an empty collection
+ *
+ * Padded rows start on a cache line (the mapping is page aligned), so
+ * an odd dim like 100 or 300 doesn't split rows across lines, and the
+ * scan kernels run over the whole padded row with no tail to handle.
+ * Costs up to 60 bytes per row on disk. The layout is recorded in
+ * collection.meta and kept by compaction; vectors read back still
+ * have dim floats.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, unknown layout, or the
+ *   collection already has rows or an HNSW index
+ * - VDB_ERROR_IO: collection.meta could not be written
+*/
+vdb_status_t vdb_storage_set_row_layout(vdb_storage_t *storage, vdb_row_layout_t layout);
+
+/**
+ * Get the row layout (VDB_ROW_LAYOUT_PACKED for NULL)
+*/
+vdb_row_layout_t vdb_storage_get_row_layout(const vdb_storage_t *storage);
+
+/**
+ * Set the element type of an empty collection
+ *
+ * With VDB_ELEMENT_F16 or VDB_ELEMENT_BF16 rows take 2 bytes per
+ * dimension, half the disk, page cache and scan bandwidth of float32.
+ * Vectors are still passed in and returned as float32: appends round
+ * them (to nearest even) and reads widen them back. The scan and HNSW
+ * kernels widen the rows as they load them (F16C, AVX-512F or NEON),
+ * against a float32 query.
+ *
+ * f16 keeps more precision but tops out at +-65504; bf16 keeps the
+ * float32 range. Either is fine for normalized embeddings. Recorded in
+ * collection.meta and kept by compaction.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, unknown type, or the
+ *   collection already has rows, an HNSW index or quantization
+ * - VDB_ERROR_IO: collection.meta could not be written
+*/
+vdb_status_t vdb_storage_set_element_type(vdb_storage_t *storage, vdb_element_type_t type);
+
+/**
+ * Get the element type (VDB_ELEMENT_F32 for NULL)
+*/
+vdb_element_type_t vdb_storage_get_element_type(const vdb_storage_t *storage);
+
+/**
+ * Normalization of cosine collections
+*/
+typedef enum {
+    VDB_NORMALIZE_NONE = 0, /* Store vectors as given */
+    VDB_NORMALIZE_UNIT = 1, /* Store unit vectors; get returns those */
+    VDB_NORMALIZE_KEEP_NORMS = 2, /* Unit vectors plus norms.seg; get scales them back */
+} vdb_normalize_t;
+
+/**
+ * Store the vectors of an empty cosine collection normalized
+ *
+ * Appends scale each vector to unit length once, and the query once per
+ * search, so every comparison after that is a plain dot product
+ * (VDB_METRIC_INNER_PRODUCT) instead of a dot product and two norms.
+ * Distances stay cosine distances. With VDB_NORMALIZE_KEEP_NORMS the
+ * original norms go to norms.seg (4 bytes a row) and get / iterate
+ * return the vectors at their old length, up to float rounding.
+ *
+ * Recorded in collection.meta and kept by compaction.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, unknown mode, a metric
+ *   other than cosine, or the collection already has rows or an HNSW index
+ * - VDB_ERROR_IO: collection.meta or norms.seg could not be written
+*/
+vdb_status_t vdb_storage_set_normalize(vdb_storage_t *storage, vdb_normalize_t mode);
+
+/**
+ * Get the normalization (VDB_NORMALIZE_NONE for NULL)
+*/
+vdb_normalize_t vdb_storage_get_normalize(const vdb_storage_t *storage);
+
 /**
  * Iterate over all stored items
  * 
  * Reads from segment files (not WAL)
- * Items are return in insertion order
+ * Items are return in insertion order, skipping superseded and
+ * deleted rows
+ * 
+ * item->vector.data is a read-only view into the mmap'd embeddings
+ * segment (no copy). It and item->metadata are only valid during the
+ * callback - copy them (e.g. vdb_vector_copy) to keep them. Do not
+ * append to or compact the same storage from inside the callback.
  * 
  * Parameters:
  * - storage: Storage handle
@@ -147,6 +554,7 @@ vdb_status_t vdb_storage_append(
  * - VDB_OK: Success (all items processed or callb stopped iter)
  * - VDB_ERROR_INVALID_ARGUMENT: Null params
  * - VDB_ERROR_IO: Read error
+ * - VDB_ERROR_CORRUPTED: metadata.seg is truncated
 */
 vdb_status_t vdb_storage_iterate(
     vdb_storage_t *storage,
@@ -154,6 +562,546 @@ vdb_status_t vdb_storage_iterate(
     void *user_data
 );
 
+/**
+ * Access pattern hints for the segment mappings
+*/
+typedef enum {
+    VDB_ACCESS_NORMAL = 0, /* No special treatment */
+    VDB_ACCESS_SEQUENTIAL = 1, /* Full scans: aggressive read-ahead */
+    VDB_ACCESS_RANDOM = 2, /* Point lookups / graph walks: no read-ahead */
+    VDB_ACCESS_WILLNEED = 3, /* Warmup: start paging everything in now */
+} vdb_access_hint_t;
+
+/**
+ * Advise the kernel how the segments will be read (posix_madvise)
+ * vdb_storage_iterate applies VDB_ACCESS_SEQUENTIAL itself; use
+ * VDB_ACCESS_WILLNEED right after open to warm a cold collection.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or invalid hint
+ * - VDB_ERROR_IO: Segments could not be mapped
+*/
+vdb_status_t vdb_storage_advise(vdb_storage_t *storage, vdb_access_hint_t hint);
+
+/**
+ * One search hit
+*/
+typedef struct {
+    vdb_id_t id; // stored ID
+    uint64_t row; // row number in storage (insertion) order
+    float distance; // lower = more similar (see distance.h)
+} vdb_search_hit_t;
+
+/**
+ * Search results, best hit first
+ * Owned by the caller; release with vdb_search_results_free()
+*/
+typedef struct {
+    vdb_search_hit_t *hits;
+    size_t count; // min(k, number of stored items)
+} vdb_search_results_t;
+
+/**
+ * Free search results
+ * Safe to call with NULL or already-freed results.
+*/
+void vdb_search_results_free(vdb_search_results_t *results);
+
+/**
+ * Exact (brute-force) top-k search
+ *
+ * Scores the query against every stored row with the SIMD distance
+ * kernels. Large collections are split into chunks scanned in parallel
+ * by the storage's worker pool, each keeping a bounded top-k heap; the
+ * heaps are merged at the end. The result is exact, so it doubles as
+ * ground truth for measuring approximate indexes.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - query: Query vector (dimension must match the collection)
+ * - k: Number of hits wanted (> 0)
+ * - out_results: Receives the hits (count may be < k for small collections)
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or k == 0
+ * - VDB_ERROR_DIMENSION_MISMATCH: Query dimension doesn't match
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: Segments could not be mapped
+*/
+vdb_status_t vdb_storage_search_exact(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    vdb_search_results_t *out_results
+);
+
+/**
+ * Exact top-k search for many queries in one pass over the rows
+ *
+ * Same results as calling vdb_storage_search_exact for each query, but
+ * every block of rows is scored against all the queries while it is in
+ * cache (four queries per load of a row), so a burst of queries costs
+ * about one scan of the collection instead of one scan each. Very large
+ * batches are split into passes of a few hundred queries.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - queries: nq query vectors (dimensions must match the collection)
+ * - nq: Number of queries
+ * - k: Number of hits wanted per query (> 0)
+ * - out_results: Array of nq results, results[i] for queries[i]; free
+ *   each with vdb_search_results_free
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or k == 0
+ * - VDB_ERROR_DIMENSION_MISMATCH: A query dimension doesn't match
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed (no results are returned)
+ * - VDB_ERROR_IO: Segments could not be mapped
+*/
+vdb_status_t vdb_storage_search_batch(
+    vdb_storage_t *storage,
+    const vdb_vector_t *queries,
+    size_t nq,
+    uint32_t k,
+    vdb_search_results_t *out_results
+);
+
+/**
+ * Set how many threads one search may use (including the caller)
+ * 0 = one per online CPU (the default). Searches in progress finish
+ * on the old threads, which are stopped once the last one is done.
+ *
+ * The same threads build the HNSW index when many rows are indexed at
+ * once (vdb_storage_enable_hnsw over existing rows, large batches,
+ * catch-up on open).
+ *
+ * A collection acquired from a vdb_db_t runs on the database's shared
+ * threads; calling this gives it threads of its own.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+ * - VDB_ERROR_OUT_OF_MEMORY: The old threads couldn't be retired (they stay)
+*/
+vdb_status_t vdb_storage_set_search_threads(vdb_storage_t *storage, uint32_t num_threads);
+
+/**
+ * Quantization modes
+ * The float32 rows are always kept; quantized codes are an extra,
+ * smaller copy used to pick candidates, which are then re-ranked
+ * against the float32 rows.
+*/
+typedef enum {
+    VDB_QUANTIZATION_NONE = 0, /* Scan float32 rows directly */
+    VDB_QUANTIZATION_SQ8 = 1, /* 8 bits per dimension, per-dimension offset/scale */
+    VDB_QUANTIZATION_PQ = 2, /* 4 bits per subspace, 16 k-means centroids each */
+} vdb_quantization_t;
+
+/* Default candidates kept per requested hit before re-ranking */
+#define VDB_DEFAULT_RERANK_FACTOR 4
+
+/* PQ subspace limits; the default is one subspace per 4 dimensions */
+#define VDB_PQ_MAX_SUBSPACES 256
+#define VDB_PQ_DEFAULT_SUBSPACE_DIM 4
+
+/**
+ * Set the quantization mode of the collection
+ *
+ * Enabling SQ8 learns each dimension's range from the stored rows (or
+ * from the first append, for an empty collection) and writes 8-bit
+ * codes for every row to embeddings.sq8; later appends are encoded with
+ * the same ranges. Values outside the learned range are clamped, so
+ * enable it once representative data is loaded. The mode is recorded
+ * in collection.meta.
+ *
+ * Enabling PQ instead trains 16 centroids per subspace (k-means over a
+ * sample of the rows) and stores m 4-bit codes per row plus its norm
+ * in embeddings.pq - m / 2 + 4 bytes per row. Scoring uses per-query
+ * lookup tables, scanned 32 rows at a time with SIMD byte shuffles.
+ * Coarser than SQ8, so it usually wants a higher rerank factor.
+ *
+ * From then on vdb_storage_search_exact and vdb_storage_search_hnsw
+ * score the codes against the full precision query, keep
+ * k * rerank_factor candidates and re-rank those with the float32 rows.
+ * Setting VDB_QUANTIZATION_NONE removes the codes again.
+ *
+ * Must not race with searches in progress.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, unknown mode, or rows
+ *   that aren't float32 (see vdb_storage_set_element_type)
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: Codes or params could not be written
+*/
+vdb_status_t vdb_storage_set_quantization(vdb_storage_t *storage, vdb_quantization_t mode);
+
+/**
+ * Get the quantization mode (VDB_QUANTIZATION_NONE for NULL)
+*/
+vdb_quantization_t vdb_storage_get_quantization(const vdb_storage_t *storage);
+
+/**
+ * Set how many quantized candidates are re-ranked per requested hit
+ * Higher = better recall, more float32 rows touched. Default
+ * VDB_DEFAULT_RERANK_FACTOR.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or factor == 0
+*/
+vdb_status_t vdb_storage_set_rerank_factor(vdb_storage_t *storage, uint32_t factor);
+
+/**
+ * Set the number of PQ subspaces (m)
+ * 0 restores the default, ceil(dim / VDB_PQ_DEFAULT_SUBSPACE_DIM)
+ * capped at VDB_PQ_MAX_SUBSPACES. If PQ is on, the codebooks are
+ * retrained and every row re-encoded; otherwise it applies the next
+ * time PQ is enabled. Recorded in collection.meta. Must not race with
+ * searches in progress.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, m > dim or m > VDB_PQ_MAX_SUBSPACES
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: Codes, params or collection.meta could not be written
+*/
+vdb_status_t vdb_storage_set_pq_subspaces(vdb_storage_t *storage, uint32_t m);
+
+/**
+ * HNSW index parameters
+*/
+typedef struct {
+    uint32_t m; // links per node per layer (layer 0 gets 2 * m)
+    uint32_t ef_construction; // beam width while inserting
+    uint32_t ef_search; // default beam width while searching (raised to k if lower)
+} vdb_hnsw_params_t;
+
+/* Limits checked by vdb_storage_enable_hnsw */
+#define VDB_HNSW_MIN_M 2
+#define VDB_HNSW_MAX_M 128
+
+/**
+ * Default HNSW parameters (M = 16, efConstruction = 200, efSearch = 64)
+*/
+vdb_hnsw_params_t vdb_hnsw_params_default(void);
+
+/* Default memtable rows that are sealed into one segment */
+#define VDB_DEFAULT_SEGMENT_ROWS 65536
+
+/**
+ * Build an HNSW index over the collection and keep it up to date
+ *
+ * Seals every stored row into segments, building their graphs over the
+ * search threads (vdb_storage_set_search_threads). Later appends land
+ * in the memtable, which HNSW searches scan exactly; once it holds a
+ * full segment a background thread builds that segment's graph. Each
+ * graph is saved once, to hnsw-<n>.idx, and hnsw.idx lists them, so
+ * rows are only indexed once; rows no listed segment covers are
+ * sealed again after open.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - params: Index parameters (NULL = vdb_hnsw_params_default())
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or params out of range
+ * - VDB_ERROR_ALREADY_EXISTS: The collection already has an index
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: Segments could not be mapped or hnsw.idx not written
+*/
+vdb_status_t vdb_storage_enable_hnsw(
+    vdb_storage_t *storage,
+    const vdb_hnsw_params_t *params
+);
+
+/**
+ * Check whether the collection has an HNSW index
+*/
+bool vdb_storage_has_hnsw(const vdb_storage_t *storage);
+
+/**
+ * Seal the whole memtable now, full segment or not
+ * Useful after a bulk load, so searches don't scan the tail. Runs on
+ * the caller's thread (and the search threads).
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+ * - VDB_ERROR_NOT_FOUND: No index
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: A segment or hnsw.idx could not be written
+*/
+vdb_status_t vdb_storage_seal(vdb_storage_t *storage);
+
+/**
+ * Set how many memtable rows are sealed into one segment
+ * (VDB_DEFAULT_SEGMENT_ROWS by default, not persisted). Bigger
+ * segments mean fewer graphs per search but a longer exact scan of the
+ * memtable; segments already sealed keep their size.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or rows == 0
+*/
+vdb_status_t vdb_storage_set_segment_rows(vdb_storage_t *storage, uint32_t rows);
+
+/**
+ * Change the default efSearch of the index
+ * Higher = better recall, slower queries.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage or ef_search == 0
+ * - VDB_ERROR_NOT_FOUND: No index
+*/
+vdb_status_t vdb_storage_set_ef_search(vdb_storage_t *storage, uint32_t ef_search);
+
+/* Default memory for the pinned top layers of each HNSW segment */
+#define VDB_DEFAULT_HNSW_PINNED_BYTES ((size_t)4 << 20)
+
+/**
+ * Set how much of each segment graph's top layers is pinned in memory
+ *
+ * Every search starts at a graph's entry point and descends greedily
+ * through its upper layers, always through the same few nodes. The
+ * first search to walk a graph copies the vectors of its top layers
+ * (float32, about 1 / M of the nodes per layer down) into memory, as
+ * many layers as fit in bytes, and later descents score those copies
+ * without touching the rows - so a cold or evicted page never stalls
+ * the descent. With quantization the pinned layers are scored exactly.
+ *
+ * Default VDB_DEFAULT_HNSW_PINNED_BYTES, 0 pins nothing. Not persisted;
+ * graphs already pinned are released and pinned again at the new size.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+*/
+vdb_status_t vdb_storage_set_hnsw_pinned_bytes(vdb_storage_t *storage, size_t bytes);
+
+/**
+ * Memory the pinned top layers of every segment take now (0 for NULL)
+*/
+size_t vdb_storage_hnsw_pinned_memory(vdb_storage_t *storage);
+
+/**
+ * Approximate top-k search through the HNSW index
+ *
+ * Same inputs and outputs as vdb_storage_search_exact. Hits are sorted
+ * best-first but may miss some of the true nearest neighbours; raise
+ * efSearch to trade speed for recall.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or k == 0
+ * - VDB_ERROR_DIMENSION_MISMATCH: Query dimension doesn't match
+ * - VDB_ERROR_NOT_FOUND: No index (see vdb_storage_enable_hnsw)
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: Segments could not be mapped
+*/
+vdb_status_t vdb_storage_search_hnsw(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    vdb_search_results_t *out_results
+);
+
+/**
+ * Exact top-k search over the rows whose metadata matches a filter
+ *
+ * The filter is evaluated against the metadata index to a row bitmap,
+ * and only those rows are scored - so a selective filter makes the scan
+ * cheaper rather than shrinking the result. A NULL filter is the same
+ * as vdb_storage_search_exact.
+ *
+ * Returns:
+ * - Same as vdb_storage_search_exact
+*/
+vdb_status_t vdb_storage_search_exact_filtered(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    const vdb_filter_t *filter,
+    vdb_search_results_t *out_results
+);
+
+/**
+ * Approximate top-k search over the rows whose metadata matches a filter
+ *
+ * The matching rows are passed to the graph walk as an allow-list:
+ * every node can be walked through, but only matching ones are
+ * returned. When few rows match (under a couple of thousand, or a few
+ * percent of the collection) they are scanned exactly instead, which
+ * is both faster and exact. A NULL filter is the same as
+ * vdb_storage_search_hnsw.
+ *
+ * Returns:
+ * - Same as vdb_storage_search_hnsw
+*/
+vdb_status_t vdb_storage_search_hnsw_filtered(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    const vdb_filter_t *filter,
+    vdb_search_results_t *out_results
+);
+
+/**
+ * DiskANN index parameters
+*/
+typedef struct {
+    uint32_t max_degree; // R: links per node
+    uint32_t build_list; // L: candidate list while building
+    float alpha; // >= 1; higher keeps more long links (fewer hops, bigger lists)
+    uint32_t search_list; // default candidate list while searching (raised to k if lower)
+    uint32_t beam_width; // default node records read per search round
+} vdb_diskann_params_t;
+
+/* Limits checked by vdb_storage_build_diskann */
+#define VDB_DISKANN_MIN_DEGREE 2
+#define VDB_DISKANN_MAX_DEGREE 256
+#define VDB_DISKANN_MAX_BEAM 16
+
+/**
+ * Default DiskANN parameters (R = 64, L = 100, alpha = 1.2, search
+ * list 64, beam width 4)
+*/
+vdb_diskann_params_t vdb_diskann_params_default(void);
+
+/**
+ * Build a DiskANN (Vamana) index, for collections bigger than memory
+ *
+ * Builds a Vamana graph over every stored row on the search threads
+ * and writes it to diskann.idx: each row's full-precision vector next
+ * to its neighbour list, packed into 4 KB sectors. Only the file's
+ * header stays in memory. Searches steer by the quantized codes, so
+ * enable PQ (vdb_storage_set_quantization) first and embeddings.seg is
+ * left alone: rows are read from diskann.idx, a beam of sectors at a
+ * time, only for the nodes a search expands.
+ *
+ * The index is a snapshot. Rows appended later are scanned exactly by
+ * vdb_storage_search_diskann until the next build, which replaces it;
+ * dead rows are skipped. Compaction renumbers the rows, so it drops
+ * the index - build again after one. The build itself holds the graph
+ * in memory, 4 * (max_degree + 1) bytes per row.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - params: Index parameters (NULL = vdb_diskann_params_default())
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, params out of range, or no rows
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: diskann.idx could not be written or read back
+*/
+vdb_status_t vdb_storage_build_diskann(
+    vdb_storage_t *storage,
+    const vdb_diskann_params_t *params
+);
+
+/**
+ * Check whether the collection has a DiskANN index
+*/
+bool vdb_storage_has_diskann(vdb_storage_t *storage);
+
+/**
+ * Drop the DiskANN index and delete diskann.idx
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+ * - VDB_ERROR_NOT_FOUND: No index
+*/
+vdb_status_t vdb_storage_drop_diskann(vdb_storage_t *storage);
+
+/**
+ * Change how DiskANN searches walk the graph (not persisted)
+ * A longer list = better recall, more reads; a wider beam = more reads
+ * per round but fewer rounds, which suits devices with deep queues.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage, search_list == 0, or
+ *   beam_width not in 1..VDB_DISKANN_MAX_BEAM
+ * - VDB_ERROR_NOT_FOUND: No index
+*/
+vdb_status_t vdb_storage_set_diskann_search(vdb_storage_t *storage, uint32_t search_list,
+                                            uint32_t beam_width);
+
+/**
+ * Approximate top-k search through the DiskANN index
+ *
+ * Same inputs and outputs as vdb_storage_search_exact. The walk is
+ * scored with the PQ or SQ8 codes (or the rows, without quantization)
+ * and every node it expands is re-scored with the full vector read from
+ * diskann.idx, so the hits carry exact distances. Reads go through
+ * io_uring when that backend is on (vdb_storage_set_io_backend).
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null params or k == 0
+ * - VDB_ERROR_DIMENSION_MISMATCH: Query dimension doesn't match
+ * - VDB_ERROR_NOT_FOUND: No index (see vdb_storage_build_diskann)
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+ * - VDB_ERROR_IO: diskann.idx could not be read
+ * - VDB_ERROR_CORRUPTED: diskann.idx holds a bad neighbour list
+*/
+vdb_status_t vdb_storage_search_diskann(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    vdb_search_results_t *out_results
+);
+
+/**
+ * Cache search results by query
+ *
+ * Exact, HNSW and DiskANN searches (filtered or not, but not
+ * vdb_storage_search_batch) first look for an earlier search of the
+ * same kind with the same query, k and filter, and if there is one
+ * return a copy of its hits without searching. Queries are compared
+ * after rounding every value to bfloat16, so retries and queries that
+ * differ only past the third significant digit share an entry.
+ *
+ * Any change a search could see - an append, upsert, delete or
+ * compaction, a seal, an index built or dropped, a search setting -
+ * invalidates every entry at once. Stale entries are evicted first;
+ * otherwise eviction is CLOCK (second chance) order once the hits and
+ * keys pass max_bytes.
+ *
+ * Off by default. Not persisted.
+ *
+ * Parameters:
+ * - storage: Storage handle
+ * - max_bytes: Cache size; 0 turns the cache off and frees its entries
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_INVALID_ARGUMENT: Null storage
+*/
+vdb_status_t vdb_storage_set_query_cache(vdb_storage_t *storage, size_t max_bytes);
+
+/**
+ * Memory the cached results take now (0 for NULL)
+*/
+size_t vdb_storage_query_cache_bytes(vdb_storage_t *storage);
+
+/**
+ * Memory the in-memory indexes and caches take now (0 for NULL): the
+ * HNSW graphs and their pinned layers, the ID index with its dead row
+ * bitmap, the metadata filter postings, the SQ8/PQ codec and codes
+ * (which quantized and DiskANN searches steer by), and the cached
+ * results. The rows and the DiskANN graph are read from their files
+ * as needed and left to the page cache, so they aren't counted.
+*/
+size_t vdb_storage_memory_usage(vdb_storage_t *storage);
+
 /**
  * Get collection info from storage
  * 
@@ -167,7 +1115,8 @@ vdb_status_t vdb_storage_get_info(
 );
 
 /**
- * Get num of items in storage
+ * Get num of rows in storage, as readers currently see them
+ * Superseded and deleted rows count until compaction drops them.
 */
 uint64_t vdb_storage_count(const vdb_storage_t *storage);
 
@@ -24,8 +24,20 @@
 typedef enum {
     VDB_METRIC_COSINE = 0, /* Cosine similarity (range: [-1,1], higher = more similar) */
     VDB_METRIC_EUCLIDEAN = 1, /* Euclidean (L2) distance (range: [0, inf), lower = more similar)  */
+    VDB_METRIC_INNER_PRODUCT = 2, /* Inner product (higher = more similar; cosine on unit vectors) */
 } vdb_metric_t;
 
+/**
+ * Element type of stored embeddings
+ * Vectors passed in and out are always float32; a collection of a
+ * narrower type converts on write and widens on read.
+*/
+typedef enum {
+    VDB_ELEMENT_F32 = 0, /* float32, 4 bytes per dimension */
+    VDB_ELEMENT_F16 = 1, /* IEEE half, 2 bytes (range +-65504, ~3 decimal digits) */
+    VDB_ELEMENT_BF16 = 2, /* bfloat16, 2 bytes (float32 range, ~2 decimal digits) */
+} vdb_element_type_t;
+
 /**
  * Status codes for err handling
  * Convention: 0 = success, negative, error
@@ -83,9 +95,25 @@ const char* vdb_status_to_string(vdb_status_t status);
 */
 bool vdb_metric_is_valid(vdb_metric_t metric);
 
+/**
+ * Bytes per dimension of an element type, 0 if it isn't valid
+*/
+size_t vdb_element_size(vdb_element_type_t type);
+
+/**
+ * Get human-readable string for an element type ("f32", "f16",
+ * "bf16") or "unknown"
+*/
+const char* vdb_element_type_to_string(vdb_element_type_t type);
+
+/* Alignment of vector data from vdb_vector_create (a cache line, and
+ * an AVX-512 register) */
+#define VDB_VECTOR_ALIGN 64
+
 /**
  * Create a vector with the given dimension
- * Allocates memory for the float array (initialized to zero).
+ * Allocates memory for the float array (initialized to zero), aligned
+ * to VDB_VECTOR_ALIGN.
  *
  * Returns: VDB_OK on success, error code otherwise
  * On success, *out_vector is populated with allocated vector
@@ -0,0 +1,306 @@
+/**
+ * aio.c - Internal batched file I/O: writes, reads and fsyncs, blocking or io_uring
+ *
+ * The io_uring side talks to the kernel directly (io_uring_setup /
+ * io_uring_enter and the mmap'd rings), so there is no liburing
+ * dependency. The ring only ever holds one batch: aio_run fills the
+ * submission queue, enters once to submit and wait for every
+ * completion, then reaps them all.
+*/
+
+#define _DEFAULT_SOURCE // syscall(), MAP_POPULATE
+
+#include "aio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef VDB_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/* Blocking write of a whole buffer */
+static vdb_status_t write_fully(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return VDB_ERROR_IO;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return VDB_OK;
+}
+
+/* Blocking read of a whole range; hitting the end of file is an error */
+static vdb_status_t read_fully(int fd, uint8_t *p, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return VDB_ERROR_IO;
+        }
+        if (n == 0) {
+            return VDB_ERROR_IO;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return VDB_OK;
+}
+
+static vdb_status_t run_blocking(const aio_op_t *op) {
+    if (op->kind == AIO_FSYNC) {
+        return fsync(op->fd) == 0 ? VDB_OK : VDB_ERROR_IO;
+    }
+    if (op->kind == AIO_READ) {
+        return read_fully(op->fd, (uint8_t*)op->buf, op->len, op->offset);
+    }
+    return write_fully(op->fd, (const uint8_t*)op->data, op->len);
+}
+
+static vdb_status_t run_in_order(const aio_op_t *ops, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        vdb_status_t status = run_blocking(&ops[i]);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    return VDB_OK;
+}
+
+#ifdef VDB_HAVE_IO_URING
+
+/* Ring size: a batch never needs more */
+#define AIO_RING_ENTRIES AIO_MAX_OPS
+
+struct aio_ring {
+    int fd;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr; // == sq_ptr with IORING_FEAT_SINGLE_MMAP
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+vdb_status_t aio_ring_create(aio_ring_t **out_ring) {
+    if (out_ring == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    aio_ring_t *ring = (aio_ring_t*)calloc(1, sizeof(aio_ring_t));
+    if (ring == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, AIO_RING_ENTRIES, &p);
+    if (ring->fd < 0) {
+        free(ring);
+        return errno == ENOMEM ? VDB_ERROR_OUT_OF_MEMORY : VDB_ERROR_NOT_FOUND;
+    }
+    if ((p.features & IORING_FEAT_RW_CUR_POS) == 0) {
+        // pre-5.6: no positionless writes (nor IORING_OP_WRITE / READ)
+        close(ring->fd);
+        free(ring);
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_len > ring->sq_len) {
+        ring->sq_len = ring->cq_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ptr = ring->sq_ptr;
+    if (ring->sq_ptr != MAP_FAILED && !single) {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = MAP_FAILED;
+    if (ring->sq_ptr != MAP_FAILED && ring->cq_ptr != MAP_FAILED) {
+        ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    }
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ptr != MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_len);
+        }
+        if (!single && ring->cq_ptr != MAP_FAILED) {
+            munmap(ring->cq_ptr, ring->cq_len);
+        }
+        close(ring->fd);
+        free(ring);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint8_t *sq = (uint8_t*)ring->sq_ptr;
+    uint8_t *cq = (uint8_t*)ring->cq_ptr;
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    *out_ring = ring;
+    return VDB_OK;
+}
+
+void aio_ring_free(aio_ring_t **ring) {
+    if (ring == NULL || *ring == NULL) {
+        return;
+    }
+    aio_ring_t *r = *ring;
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_len);
+    }
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+    free(r);
+    *ring = NULL;
+}
+
+/**
+ * Submit the batch and wait for it; res[i] gets op i's result
+*/
+static vdb_status_t submit_and_wait(aio_ring_t *ring, const aio_op_t *ops, size_t n, int32_t *res) {
+    unsigned tail = *ring->sq_tail; // only we write it
+    unsigned mask = *ring->sq_mask;
+    for (size_t i = 0; i < n; i++) {
+        unsigned idx = tail & mask;
+        struct io_uring_sqe *sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = ops[i].fd;
+        sqe->user_data = i;
+        if (ops[i].kind == AIO_FSYNC) {
+            sqe->opcode = IORING_OP_FSYNC;
+        } else if (ops[i].kind == AIO_READ) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)ops[i].buf;
+            sqe->len = (uint32_t)ops[i].len;
+            sqe->off = ops[i].offset;
+        } else {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(uintptr_t)ops[i].data;
+            sqe->len = (uint32_t)ops[i].len;
+            sqe->off = (uint64_t)-1; // the file position (end, for O_APPEND)
+        }
+        if (ops[i].link && i + 1 < n) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        ring->sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    size_t submitted = 0;
+    size_t reaped = 0;
+    bool failed = false;
+    while (reaped < submitted || (!failed && submitted < n)) {
+        unsigned to_submit = failed ? 0 : (unsigned)(n - submitted);
+        unsigned wait_for = (unsigned)((failed ? submitted : n) - reaped);
+        long ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_for,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret > 0) {
+            submitted += (size_t)ret;
+        } else if (ret < 0 && errno != EINTR && !failed) {
+            // take back what the kernel didn't consume, wait out the rest
+            failed = true;
+            __atomic_store_n(ring->sq_tail, tail - (unsigned)(n - submitted), __ATOMIC_RELEASE);
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->user_data < n) {
+                res[cqe->user_data] = cqe->res;
+            }
+            reaped++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return failed ? VDB_ERROR_IO : VDB_OK;
+}
+
+vdb_status_t aio_run(aio_ring_t *ring, const aio_op_t *ops, size_t n) {
+    if (n > AIO_MAX_OPS || (n > 0 && ops == NULL)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (ring == NULL) {
+        return run_in_order(ops, n);
+    }
+
+    int32_t res[AIO_MAX_OPS];
+    vdb_status_t status = submit_and_wait(ring, ops, n, res);
+
+    /* finish what a short write cut off: the rest of the write, then the
+     * ops linked behind it - cancelled by the kernel, or if they did run,
+     * run before the rest was written */
+    bool redo = false;
+    for (size_t i = 0; i < n && status == VDB_OK; i++) {
+        const aio_op_t *op = &ops[i];
+        if (res[i] == -ECANCELED || (redo && res[i] >= 0)) {
+            status = run_blocking(op);
+        } else if (res[i] < 0) {
+            status = VDB_ERROR_IO;
+        } else if (op->kind == AIO_WRITE && (size_t)res[i] < op->len) {
+            status = write_fully(op->fd, (const uint8_t*)op->data + res[i], op->len - (size_t)res[i]);
+            redo = op->link;
+            continue;
+        } else if (op->kind == AIO_READ && (size_t)res[i] < op->len) {
+            status = read_fully(op->fd, (uint8_t*)op->buf + res[i], op->len - (size_t)res[i],
+                                op->offset + (uint64_t)res[i]);
+            redo = op->link;
+            continue;
+        }
+        redo = redo && op->link;
+    }
+    return status;
+}
+
+#else /* !VDB_HAVE_IO_URING */
+
+vdb_status_t aio_ring_create(aio_ring_t **out_ring) {
+    if (out_ring == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    return VDB_ERROR_NOT_FOUND;
+}
+
+void aio_ring_free(aio_ring_t **ring) {
+    (void)ring;
+}
+
+vdb_status_t aio_run(aio_ring_t *ring, const aio_op_t *ops, size_t n) {
+    (void)ring;
+    if (n > AIO_MAX_OPS || (n > 0 && ops == NULL)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    return run_in_order(ops, n);
+}
+
+#endif /* VDB_HAVE_IO_URING */
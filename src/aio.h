@@ -0,0 +1,73 @@
+/**
+ * aio.h - Internal batched file I/O: writes, reads and fsyncs, blocking or io_uring
+ *
+ * A batch is a short list of ops. Without a ring they run one after the
+ * other with write() / pread() / fsync(). With an io_uring ring (Linux, built with
+ * VDB_HAVE_IO_URING) the whole batch is one submission: ops run in
+ * parallel, except that an op marked link holds the next one back until
+ * it is done, and one io_uring_enter both submits and waits.
+ *
+ * Writes go where the fd's file position (or O_APPEND) puts them, so two
+ * writes to one fd in a batch must be linked. Short writes and links
+ * broken by them are finished with blocking calls; aio_run only returns
+ * VDB_OK once every op completed in full.
+ *
+ * Reads take an explicit offset and never move the file position. A read
+ * that runs into the end of the file is an error.
+*/
+
+#ifndef VDB_AIO_H
+#define VDB_AIO_H
+
+#include "vdb/types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Most ops in one batch */
+#define AIO_MAX_OPS 16
+
+typedef enum {
+    AIO_WRITE,
+    AIO_READ,
+    AIO_FSYNC
+} aio_kind_t;
+
+typedef struct {
+    aio_kind_t kind;
+    int fd;
+    const void *data; // writes only
+    size_t len;
+    bool link; // the next op waits for this one
+    void *buf; // reads only: len bytes from offset land here
+    uint64_t offset;
+} aio_op_t;
+
+typedef struct aio_ring aio_ring_t;
+
+/**
+ * Set up an io_uring ring
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_NOT_FOUND: No io_uring in this build or kernel (or it is blocked)
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed
+*/
+vdb_status_t aio_ring_create(aio_ring_t **out_ring);
+
+/**
+ * Tear a ring down. Safe with NULL. No batch may be running.
+*/
+void aio_ring_free(aio_ring_t **ring);
+
+/**
+ * Run a batch of at most AIO_MAX_OPS ops and wait for all of them
+ * ring NULL runs them blocking, in order. A ring is not thread-safe;
+ * callers serialize batches on it.
+ *
+ * Returns:
+ * - VDB_OK: Every op done
+ * - VDB_ERROR_INVALID_ARGUMENT: Too many ops
+ * - VDB_ERROR_IO: An op failed (the others may or may not have run)
+*/
+vdb_status_t aio_run(aio_ring_t *ring, const aio_op_t *ops, size_t n);
+
+#endif /* VDB_AIO_H */
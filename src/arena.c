@@ -0,0 +1,328 @@
+/**
+ * arena.c - Arena and slab allocators, and the per-thread scratch arena
+ *
+ * An arena is a stack of blocks, newest first. Allocating bumps the
+ * offset in the newest block, or pushes a new one; rewinding pops the
+ * blocks pushed since the mark. One popped block of the standard size
+ * is kept as a spare, so an arena rewound after every query mallocs
+ * nothing in steady state.
+ *
+ * A slab threads its free objects through their first word.
+*/
+
+#include "vdb/arena.h"
+#include "vdb/collection.h"
+#include "scratch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Largest alignment vdb_arena_alloc_aligned takes */
+#define ARENA_MAX_ALIGN 4096
+
+/* Slab chunk size when the caller doesn't pick one */
+#define SLAB_DEFAULT_CHUNK_BYTES (64 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *prev;
+    size_t size; // bytes after the header
+    size_t used;
+    uint64_t pad; // keeps the data VDB_ARENA_ALIGN aligned
+} arena_block_t;
+
+struct vdb_arena {
+    arena_block_t *head;
+    arena_block_t *spare;
+    size_t block_size;
+    size_t used;
+};
+
+typedef struct slab_chunk {
+    struct slab_chunk *next;
+    uint64_t pad;
+} slab_chunk_t;
+
+struct vdb_slab {
+    size_t object_size;
+    size_t per_chunk;
+    void *free_list;
+    slab_chunk_t *chunks;
+    size_t live;
+};
+
+/* ------------------------------------------------------------------ */
+/* Arena                                                               */
+/* ------------------------------------------------------------------ */
+
+static uint8_t *block_data(arena_block_t *block) {
+    return (uint8_t*)(block + 1);
+}
+
+static void release_block(vdb_arena_t *arena, arena_block_t *block) {
+    if (block->size == arena->block_size && arena->spare == NULL) {
+        arena->spare = block;
+    } else {
+        free(block);
+    }
+}
+
+vdb_status_t vdb_arena_create(size_t block_size, vdb_arena_t **out_arena) {
+    if (out_arena == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_arena_t *arena = (vdb_arena_t*)calloc(1, sizeof(vdb_arena_t));
+    if (arena == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    arena->block_size = block_size > 0 ? block_size : VDB_ARENA_DEFAULT_BLOCK;
+    *out_arena = arena;
+    return VDB_OK;
+}
+
+void vdb_arena_free(vdb_arena_t **arena) {
+    if (arena == NULL || *arena == NULL) {
+        return;
+    }
+    vdb_arena_reset(*arena);
+    free((*arena)->spare);
+    free(*arena);
+    *arena = NULL;
+}
+
+void *vdb_arena_alloc_aligned(vdb_arena_t *arena, size_t size, size_t align) {
+    if (arena == NULL || align == 0 || (align & (align - 1)) != 0 || align > ARENA_MAX_ALIGN) {
+        return NULL;
+    }
+    if (size == 0) {
+        size = 1;
+    }
+
+    arena_block_t *head = arena->head;
+    if (head != NULL) {
+        uintptr_t base = (uintptr_t)block_data(head);
+        uintptr_t start = (base + head->used + align - 1) & ~(uintptr_t)(align - 1);
+        size_t offset = (size_t)(start - base);
+        if (offset <= head->size && size <= head->size - offset) {
+            arena->used += offset + size - head->used;
+            head->used = offset + size;
+            return (void*)start;
+        }
+    }
+
+    // a new block; anything bigger than a block gets one of its own
+    if (size > SIZE_MAX - sizeof(arena_block_t) - align) {
+        return NULL;
+    }
+    size_t need = size + align - 1;
+    size_t block_size = need > arena->block_size ? need : arena->block_size;
+    arena_block_t *block = NULL;
+    if (block_size == arena->block_size && arena->spare != NULL) {
+        block = arena->spare;
+        arena->spare = NULL;
+    } else {
+        block = (arena_block_t*)malloc(sizeof(arena_block_t) + block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->size = block_size;
+    }
+    block->prev = head;
+    block->used = 0;
+    arena->head = block;
+
+    uintptr_t base = (uintptr_t)block_data(block);
+    uintptr_t start = (base + align - 1) & ~(uintptr_t)(align - 1);
+    block->used = (size_t)(start - base) + size;
+    arena->used += block->used;
+    return (void*)start;
+}
+
+void *vdb_arena_alloc(vdb_arena_t *arena, size_t size) {
+    return vdb_arena_alloc_aligned(arena, size, VDB_ARENA_ALIGN);
+}
+
+void *vdb_arena_calloc(vdb_arena_t *arena, size_t n, size_t size) {
+    if (size > 0 && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *p = vdb_arena_alloc(arena, n * size);
+    if (p != NULL) {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+vdb_arena_mark_t vdb_arena_mark(const vdb_arena_t *arena) {
+    vdb_arena_mark_t mark = { NULL, 0, 0 };
+    if (arena != NULL && arena->head != NULL) {
+        mark.block = arena->head;
+        mark.offset = arena->head->used;
+        mark.used = arena->used;
+    }
+    return mark;
+}
+
+void vdb_arena_rewind(vdb_arena_t *arena, vdb_arena_mark_t mark) {
+    if (arena == NULL) {
+        return;
+    }
+    while (arena->head != NULL && arena->head != mark.block) {
+        arena_block_t *block = arena->head;
+        arena->head = block->prev;
+        release_block(arena, block);
+    }
+    if (arena->head != NULL) {
+        arena->head->used = mark.offset;
+    }
+    arena->used = mark.used;
+}
+
+void vdb_arena_reset(vdb_arena_t *arena) {
+    vdb_arena_mark_t start = { NULL, 0, 0 };
+    vdb_arena_rewind(arena, start);
+}
+
+size_t vdb_arena_used(const vdb_arena_t *arena) {
+    return arena != NULL ? arena->used : 0;
+}
+
+vdb_status_t vdb_vector_create_in(vdb_arena_t *arena, uint32_t dim, vdb_vector_t *out_vector) {
+    if (out_vector == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    out_vector->dim = 0;
+    out_vector->data = NULL;
+    if (arena == NULL || dim == 0 || dim > VDB_COLLECTION_MAX_DIM) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    float *data = (float*)vdb_arena_alloc_aligned(arena, dim * sizeof(float), VDB_VECTOR_ALIGN);
+    if (data == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    memset(data, 0, dim * sizeof(float));
+    out_vector->dim = dim;
+    out_vector->data = data;
+    return VDB_OK;
+}
+
+vdb_status_t vdb_vector_copy_in(vdb_arena_t *arena, const vdb_vector_t *src, vdb_vector_t *dst) {
+    if (src == NULL || dst == NULL || src->data == NULL || src->dim == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_status_t status = vdb_vector_create_in(arena, src->dim, dst);
+    if (status != VDB_OK) {
+        return status;
+    }
+    memcpy(dst->data, src->data, src->dim * sizeof(float));
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Per-thread scratch                                                  */
+/* ------------------------------------------------------------------ */
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_free(void *ptr) {
+    vdb_arena_t *arena = (vdb_arena_t*)ptr;
+    vdb_arena_free(&arena);
+}
+
+static void scratch_key_init(void) {
+    pthread_key_create(&scratch_key, scratch_free);
+}
+
+vdb_arena_t *scratch_arena(void) {
+    pthread_once(&scratch_once, scratch_key_init);
+    vdb_arena_t *arena = (vdb_arena_t*)pthread_getspecific(scratch_key);
+    if (arena == NULL && vdb_arena_create(0, &arena) == VDB_OK) {
+        pthread_setspecific(scratch_key, arena);
+    }
+    return arena;
+}
+
+/* ------------------------------------------------------------------ */
+/* Slab                                                                */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t vdb_slab_create(size_t object_size, size_t objects_per_chunk, vdb_slab_t **out_slab) {
+    if (out_slab == NULL || object_size == 0 || object_size > SIZE_MAX / 2) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_slab_t *slab = (vdb_slab_t*)calloc(1, sizeof(vdb_slab_t));
+    if (slab == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    slab->object_size = (object_size + VDB_ARENA_ALIGN - 1) & ~(size_t)(VDB_ARENA_ALIGN - 1);
+    slab->per_chunk = objects_per_chunk;
+    if (slab->per_chunk == 0) {
+        slab->per_chunk = SLAB_DEFAULT_CHUNK_BYTES / slab->object_size;
+    }
+    if (slab->per_chunk == 0) {
+        slab->per_chunk = 1;
+    }
+    if (slab->per_chunk > (SIZE_MAX - sizeof(slab_chunk_t)) / slab->object_size) {
+        free(slab);
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    *out_slab = slab;
+    return VDB_OK;
+}
+
+void vdb_slab_free(vdb_slab_t **slab) {
+    if (slab == NULL || *slab == NULL) {
+        return;
+    }
+    slab_chunk_t *chunk = (*slab)->chunks;
+    while (chunk != NULL) {
+        slab_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(*slab);
+    *slab = NULL;
+}
+
+void *vdb_slab_alloc(vdb_slab_t *slab) {
+    if (slab == NULL) {
+        return NULL;
+    }
+    if (slab->free_list == NULL) {
+        slab_chunk_t *chunk = (slab_chunk_t*)malloc(sizeof(slab_chunk_t) + slab->per_chunk * slab->object_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+
+        // thread the new objects onto the free list, first one on top
+        uint8_t *objects = (uint8_t*)(chunk + 1);
+        for (size_t i = slab->per_chunk; i-- > 0; ) {
+            void *object = objects + i * slab->object_size;
+            memcpy(object, &slab->free_list, sizeof(void*));
+            slab->free_list = object;
+        }
+    }
+
+    void *object = slab->free_list;
+    memcpy(&slab->free_list, object, sizeof(void*));
+    slab->live++;
+    return object;
+}
+
+void vdb_slab_release(vdb_slab_t *slab, void *object) {
+    if (slab == NULL || object == NULL) {
+        return;
+    }
+    memcpy(object, &slab->free_list, sizeof(void*));
+    slab->free_list = object;
+    slab->live--;
+}
+
+size_t vdb_slab_live(const vdb_slab_t *slab) {
+    return slab != NULL ? slab->live : 0;
+}
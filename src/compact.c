@@ -0,0 +1,927 @@
+/**
+ * compact.c - Rewriting the segments without dead rows
+ *
+ * Superseded and deleted rows stay in the append-only segments until a
+ * compaction copies the live rows into new files in <name>/.compact/
+ * and swaps them in:
+ *
+ * 1. Copy: the rows of a snapshot never change, so they are copied
+ *    without any lock, throttled to the I/O budget. The filter and ID
+ *    indexes over the new rows are built along the way.
+ * 2. Swap, under layout_lock and write_lock: copy the rows appended
+ *    since, apply the deletes made since, remap each HNSW segment and
+ *    write the new collection.meta into .compact/ last - that is the
+ *    commit point. The new files are then renamed over the old ones.
+ *
+ * On open, a .compact/ holding collection.meta is a committed swap and
+ * is rolled forward; anything else in it is an abandoned copy.
+ *
+ * Old row numbers mean nothing after the swap, so the new WAL starts
+ * empty (every row was copied and synced) and hnsw.idx / ids.idx are
+ * small stand-ins: a manifest with the index params and no sealed
+ * segments, and an empty ID index unless it holds deletes. Both rebuild
+ * from the segments if the process dies before the real ones are written.
+ * A DiskANN index, index.snap and the codes number the old rows, so
+ * they are dropped right after the commit, and roll_forward drops their
+ * files before the renames. The DiskANN index only comes back from
+ * another vdb_storage_build_diskann, the next checkpoint writes
+ * index.snap again and the codes are re-encoded on catch-up.
+*/
+
+#include "vdb/storage.h"
+#include "storage_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define COMPACT_DIR ".compact"
+
+/* Rows per copy chunk; also how often the budget and stop flag are checked */
+#define COMPACT_CHUNK_ROWS 1024
+
+/* new_rows entry of a dropped row */
+#define COMPACT_DROPPED UINT64_MAX
+
+/* Files a swap replaces, collection.meta last */
+static const char *const swap_files[] = {
+    "embeddings.seg", "norms.seg", "ids.seg", "metadata.seg", "wal.log", "ids.idx", "hnsw.idx",
+    "collection.meta",
+};
+
+/* Files derived from the old rows; a swap deletes them and empties the codes */
+static const char *const derived_files[] = { "diskann.idx", "index.snap" };
+static const char *const codes_files[] = { "embeddings.sq8", "embeddings.pq" };
+
+vdb_compaction_params_t vdb_compaction_params_default(void) {
+    vdb_compaction_params_t params = { 0.2, 32ull << 20, 1000 };
+    return params;
+}
+
+bool storage_compaction_params_valid(const vdb_compaction_params_t *params) {
+    return params->min_dead_fraction > 0.0 && params->min_dead_fraction <= 1.0 &&
+        params->interval_ms > 0;
+}
+
+/* VDB_ERROR_INVALID_ARGUMENT if the path doesn't fit in MAX_PATH */
+static vdb_status_t coll_path(const char *base_dir, const char *name, const char *file, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/%s", base_dir, name, file);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+static vdb_status_t compact_path(const char *base_dir, const char *name, const char *file, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/" COMPACT_DIR "/%s", base_dir, name, file);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+static vdb_status_t sync_dir(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return VDB_ERROR_IO;
+    }
+    vdb_status_t status = fsync(fd) == 0 ? VDB_OK : VDB_ERROR_IO;
+    close(fd);
+    return status;
+}
+
+/**
+ * Delete .compact/ and whatever is in it
+ * A name whose path doesn't fit is left alone rather than unlinking
+ * whatever the truncated path names.
+*/
+static void remove_compact_dir(const char *base_dir, const char *name) {
+    char dir_path[MAX_PATH];
+    if (coll_path(base_dir, name, COMPACT_DIR, dir_path) != VDB_OK) {
+        return;
+    }
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            char path[MAX_PATH];
+            if (compact_path(base_dir, name, entry->d_name, path) == VDB_OK) {
+                unlink(path);
+            }
+        }
+    }
+    closedir(dir);
+    rmdir(dir_path);
+}
+
+/**
+ * Drop the files derived from the old rows
+ * The codes files are emptied rather than deleted so an open codes_fd
+ * stays valid; the rows are re-encoded on catch-up.
+*/
+static vdb_status_t drop_derived_files(const char *base_dir, const char *name) {
+    char path[MAX_PATH];
+    for (size_t i = 0; i < sizeof(derived_files) / sizeof(derived_files[0]); i++) {
+        vdb_status_t status = coll_path(base_dir, name, derived_files[i], path);
+        if (status != VDB_OK) {
+            return status;
+        }
+        if (unlink(path) != 0 && errno != ENOENT) {
+            return VDB_ERROR_IO;
+        }
+    }
+    for (size_t i = 0; i < sizeof(codes_files) / sizeof(codes_files[0]); i++) {
+        vdb_status_t status = coll_path(base_dir, name, codes_files[i], path);
+        if (status != VDB_OK) {
+            return status;
+        }
+        if (truncate(path, 0) != 0 && errno != ENOENT) {
+            return VDB_ERROR_IO;
+        }
+    }
+    return VDB_OK;
+}
+
+/**
+ * Move a committed swap's files into place
+ * The derived files go first, while .compact/collection.meta still
+ * marks the swap, and files already moved are skipped, so this can be
+ * redone after a crash. Nothing is touched if a path doesn't fit.
+*/
+static vdb_status_t roll_forward(const char *base_dir, const char *name) {
+    char from[sizeof(swap_files) / sizeof(swap_files[0])][MAX_PATH];
+    char to[sizeof(swap_files) / sizeof(swap_files[0])][MAX_PATH];
+    char dir_path[MAX_PATH];
+    int len = snprintf(dir_path, MAX_PATH, "%s/%s", base_dir, name);
+    vdb_status_t status = len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+    for (size_t i = 0; i < sizeof(swap_files) / sizeof(swap_files[0]) && status == VDB_OK; i++) {
+        status = compact_path(base_dir, name, swap_files[i], from[i]);
+        if (status == VDB_OK) {
+            status = coll_path(base_dir, name, swap_files[i], to[i]);
+        }
+    }
+    if (status == VDB_OK) {
+        status = drop_derived_files(base_dir, name);
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    for (size_t i = 0; i < sizeof(swap_files) / sizeof(swap_files[0]); i++) {
+        if (rename(from[i], to[i]) != 0 && errno != ENOENT) {
+            return VDB_ERROR_IO;
+        }
+    }
+
+    status = sync_dir(dir_path);
+    if (status == VDB_OK) {
+        remove_compact_dir(base_dir, name);
+    }
+    return status;
+}
+
+vdb_status_t storage_compact_recover(const char *base_dir, const char *name) {
+    char path[MAX_PATH];
+    vdb_status_t status = compact_path(base_dir, name, "collection.meta", path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        return roll_forward(base_dir, name);
+    }
+    remove_compact_dir(base_dir, name);
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Copying                                                             */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint64_t bytes_per_sec; // 0 = unthrottled
+    uint64_t bytes;
+    struct timespec start;
+} throttle_t;
+
+/**
+ * Account for bytes copied, sleeping until the budget allows them
+*/
+static void throttle(throttle_t *t, uint64_t bytes) {
+    t->bytes += bytes;
+    if (t->bytes_per_sec == 0) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (double)(now.tv_sec - t->start.tv_sec) + (double)(now.tv_nsec - t->start.tv_nsec) / 1e9;
+    double due = (double)t->bytes / (double)t->bytes_per_sec;
+    if (due > elapsed) {
+        double wait = due - elapsed;
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * One compaction run
+*/
+typedef struct {
+    vdb_storage_t *storage;
+    bool background; // abandon the copy if the compactor is stopped
+
+    /* new files, written in .compact/ */
+    int embeddings_fd;
+    int ids_fd;
+    int metadata_fd;
+    int norms_fd; // -1 unless norms are kept
+    uint64_t count; // rows written
+    uint64_t metadata_bytes;
+    segment_map_t embeddings_map; // private read-only maps of them
+    segment_map_t ids_map;
+    segment_map_t metadata_map;
+    segment_map_t norms_map;
+
+    uint64_t *new_rows; // old row -> new row, COMPACT_DROPPED
+    uint64_t old_meta_offset; // metadata.seg offset of the next old row to copy
+    filter_index_t *filters; // over the new rows
+    id_index_t *ids;
+
+    /* one chunk of rows */
+    uint8_t *embeddings_buf;
+    uint8_t *ids_buf;
+    float *norms_buf;
+    uint8_t *metadata_buf;
+    size_t metadata_cap;
+} compaction_t;
+
+static bool stopping(vdb_storage_t *storage) {
+    pthread_mutex_lock(&storage->compact_wait_lock);
+    bool stop = storage->compact_stop;
+    pthread_mutex_unlock(&storage->compact_wait_lock);
+    return stop;
+}
+
+static vdb_status_t write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return VDB_ERROR_IO;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return VDB_OK;
+}
+
+static void unmap_private(segment_map_t *map) {
+    if (map->addr != NULL) {
+        munmap((void*)map->addr, map->len);
+        map->addr = NULL;
+        map->len = 0;
+    }
+}
+
+/**
+ * Map the first `needed` bytes of a new file read-only (no headroom:
+ * only this run reads it until the swap)
+*/
+static vdb_status_t map_private(compaction_t *c, const char *file, segment_map_t *map, size_t needed) {
+    if (needed <= map->len) {
+        return VDB_OK;
+    }
+    char path[MAX_PATH];
+    vdb_status_t status = compact_path(c->storage->base_dir, c->storage->name, file, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return VDB_ERROR_IO;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (needed + page - 1) / page * page;
+    void *addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return VDB_ERROR_IO;
+    }
+    unmap_private(map);
+    map->addr = (const uint8_t*)addr;
+    map->len = len;
+    return VDB_OK;
+}
+
+static vdb_status_t open_new_files(compaction_t *c) {
+    const vdb_storage_t *storage = c->storage;
+    char path[MAX_PATH];
+    vdb_status_t status = coll_path(storage->base_dir, storage->name, COMPACT_DIR, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (mkdir(path, 0755) != 0) {
+        return VDB_ERROR_IO;
+    }
+
+    int *fds[] = { &c->embeddings_fd, &c->ids_fd, &c->metadata_fd };
+    const char *files[] = { "embeddings.seg", "ids.seg", "metadata.seg" };
+    for (size_t i = 0; i < 3; i++) {
+        status = compact_path(storage->base_dir, storage->name, files[i], path);
+        if (status != VDB_OK) {
+            return status;
+        }
+        *fds[i] = open(path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+        if (*fds[i] < 0) {
+            return VDB_ERROR_IO;
+        }
+    }
+    if (storage->normalize == VDB_NORMALIZE_KEEP_NORMS) {
+        status = compact_path(storage->base_dir, storage->name, "norms.seg", path);
+        if (status != VDB_OK) {
+            return status;
+        }
+        c->norms_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+        if (c->norms_fd < 0) {
+            return VDB_ERROR_IO;
+        }
+    }
+    return VDB_OK;
+}
+
+static vdb_status_t sync_new_files(const compaction_t *c) {
+    if (fsync(c->embeddings_fd) != 0 || fsync(c->ids_fd) != 0 || fsync(c->metadata_fd) != 0 ||
+        (c->norms_fd >= 0 && fsync(c->norms_fd) != 0)) {
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+static void compaction_free(compaction_t *c) {
+    int fds[] = { c->embeddings_fd, c->ids_fd, c->metadata_fd, c->norms_fd };
+    for (size_t i = 0; i < 4; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    unmap_private(&c->embeddings_map);
+    unmap_private(&c->ids_map);
+    unmap_private(&c->metadata_map);
+    unmap_private(&c->norms_map);
+    free(c->new_rows);
+    filter_index_free(&c->filters);
+    id_index_free(&c->ids);
+    free(c->embeddings_buf);
+    free(c->ids_buf);
+    free(c->norms_buf);
+    free(c->metadata_buf);
+}
+
+/**
+ * Copy the live rows of [first, end) of a view to the new files
+ * Rows are buffered a chunk at a time, one write per file per chunk.
+*/
+static vdb_status_t copy_rows(compaction_t *c, const storage_view_t *view, uint64_t first,
+                              uint64_t end, const roaring_t *dead, throttle_t *budget) {
+    const vdb_storage_t *storage = c->storage;
+    size_t pending = 0;
+    size_t metadata_len = 0;
+    vdb_status_t status = VDB_OK;
+
+    for (uint64_t row = first; row < end && status == VDB_OK; row++) {
+        uint64_t offset = c->old_meta_offset;
+        uint32_t len;
+        if (offset + sizeof(len) > view->metadata_bytes) {
+            return VDB_ERROR_CORRUPTED;
+        }
+        memcpy(&len, view->metadata + offset, sizeof(len));
+        if (offset + sizeof(len) + len > view->metadata_bytes) {
+            return VDB_ERROR_CORRUPTED;
+        }
+        c->old_meta_offset += sizeof(len) + len;
+
+        if (roaring_contains(dead, row)) {
+            c->new_rows[row] = COMPACT_DROPPED;
+        } else {
+            if (metadata_len + sizeof(len) + len > c->metadata_cap) {
+                size_t cap = (metadata_len + sizeof(len) + len) * 2;
+                uint8_t *grown = (uint8_t*)realloc(c->metadata_buf, cap);
+                if (grown == NULL) {
+                    return VDB_ERROR_OUT_OF_MEMORY;
+                }
+                c->metadata_buf = grown;
+                c->metadata_cap = cap;
+            }
+            memcpy(c->embeddings_buf + pending * storage->row_bytes,
+                   storage_view_row(storage, view, row), storage->row_bytes);
+            memcpy(c->ids_buf + pending * VDB_ID_MAX_LEN, storage_view_id(view, row), VDB_ID_MAX_LEN);
+            if (c->norms_buf != NULL) {
+                c->norms_buf[pending] = view->norms[row];
+            }
+            memcpy(c->metadata_buf + metadata_len, view->metadata + offset, sizeof(len) + len);
+            metadata_len += sizeof(len) + len;
+
+            status = filter_index_add(c->filters, (const char*)view->metadata + offset + sizeof(len), len);
+            c->new_rows[row] = c->count + pending++;
+        }
+
+        if (status == VDB_OK && pending > 0 && (pending == COMPACT_CHUNK_ROWS || row + 1 == end)) {
+            status = write_all(c->embeddings_fd, c->embeddings_buf, pending * storage->row_bytes);
+            if (status == VDB_OK) {
+                status = write_all(c->ids_fd, c->ids_buf, pending * VDB_ID_MAX_LEN);
+            }
+            if (status == VDB_OK) {
+                status = write_all(c->metadata_fd, c->metadata_buf, metadata_len);
+            }
+            if (status == VDB_OK && c->norms_fd >= 0) {
+                status = write_all(c->norms_fd, c->norms_buf, pending * sizeof(float));
+            }
+            if (status == VDB_OK) {
+                c->count += pending;
+                c->metadata_bytes += metadata_len;
+                if (budget != NULL) {
+                    throttle(budget, pending * (storage->row_bytes + VDB_ID_MAX_LEN) + metadata_len);
+                }
+                pending = 0;
+                metadata_len = 0;
+                if (c->background && budget != NULL && stopping(c->storage)) {
+                    status = VDB_ERROR_UNKNOWN; // abandoned, nothing was swapped
+                }
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * Index the IDs of the new rows not indexed yet
+*/
+static vdb_status_t index_new_ids(compaction_t *c) {
+    vdb_status_t status = map_private(c, "ids.seg", &c->ids_map, (size_t)c->count * VDB_ID_MAX_LEN);
+    if (status == VDB_OK) {
+        status = map_private(c, "metadata.seg", &c->metadata_map, (size_t)c->metadata_bytes);
+    }
+    if (status == VDB_OK) {
+        status = id_index_reserve(c->ids, c->count - id_index_rows(c->ids));
+    }
+    while (status == VDB_OK && id_index_rows(c->ids) < c->count) {
+        uint32_t len;
+        memcpy(&len, c->metadata_map.addr + id_index_meta_end(c->ids), sizeof(len));
+        status = id_index_add(c->ids, c->ids_map.addr, sizeof(len) + len);
+    }
+    return status;
+}
+
+/**
+ * Write the small files of the swap: an empty WAL, the stand-in
+ * hnsw.idx / ids.idx, and collection.meta last
+*/
+static vdb_status_t write_swap_files(compaction_t *c) {
+    vdb_storage_t *storage = c->storage;
+    char path[MAX_PATH];
+
+    vdb_status_t status = compact_path(storage->base_dir, storage->name, "wal.log", path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return VDB_ERROR_IO;
+    }
+    status = fsync(fd) == 0 ? VDB_OK : VDB_ERROR_IO;
+    close(fd);
+
+    if (status == VDB_OK && storage->hnsw_enabled) {
+        status = compact_path(storage->base_dir, storage->name, "hnsw.idx", path);
+        if (status == VDB_OK) {
+            status = storage_index_stand_in(storage, path);
+        }
+    }
+
+    // deletes made during the copy exist nowhere else
+    if (status == VDB_OK) {
+        id_index_t *empty = NULL;
+        bool keep = id_index_deletes(c->ids) > 0;
+        status = keep ? VDB_OK : id_index_create(&empty);
+        if (status == VDB_OK) {
+            status = compact_path(storage->base_dir, storage->name, "ids.idx", path);
+        }
+        if (status == VDB_OK) {
+            status = id_index_save(keep ? c->ids : empty, path);
+        }
+        id_index_free(&empty);
+    }
+
+    if (status == VDB_OK) {
+        status = compact_path(storage->base_dir, storage->name, "collection.meta", path);
+    }
+    if (status == VDB_OK) {
+        status = storage_write_superblock(storage, path, c->count, c->metadata_bytes, storage->next_lsn,
+                                          id_index_deletes(c->ids));
+    }
+    if (status == VDB_OK) {
+        status = coll_path(storage->base_dir, storage->name, COMPACT_DIR, path);
+    }
+    if (status == VDB_OK) {
+        status = sync_dir(path);
+    }
+    return status;
+}
+
+/**
+ * Drop what numbers the old rows once the swap is committed: the
+ * snapshot, a DiskANN graph (rebuilt on request) and the codes
+ * (re-encoded on catch-up). roll_forward drops their files as well, so
+ * an open after a crash can't pair them with the new rows either.
+*/
+static vdb_status_t drop_derived(vdb_storage_t *storage) {
+    vdb_status_t status = storage_index_snap_drop(storage);
+    if (storage->diskann != NULL) {
+        vdb_status_t dropped = storage_diskann_drop(storage);
+        status = status == VDB_OK ? dropped : status;
+    }
+    if (storage->quantization != VDB_QUANTIZATION_NONE) {
+        vdb_status_t reset = storage_quant_reset(storage);
+        status = status == VDB_OK ? reset : status;
+    }
+    return status;
+}
+
+/**
+ * Point the storage at the new files (the swap is committed)
+*/
+static vdb_status_t adopt_new_files(compaction_t *c, index_segment_t *segments, size_t num_segments) {
+    vdb_storage_t *storage = c->storage;
+    vdb_status_t status = storage_reopen_segments(storage);
+
+    storage->count = c->count;
+    storage->metadata_bytes = c->metadata_bytes;
+    storage->checkpoint_count = c->count;
+    storage->checkpoint_metadata_bytes = c->metadata_bytes;
+    storage->checkpoint_lsn = storage->next_lsn;
+    storage->wal_bytes = 0;
+    storage->unsynced_row = UINT64_MAX; // the swap synced every row
+    // the private maps are maps of the very files that now have these names
+    storage->embeddings_map = c->embeddings_map;
+    storage->ids_map = c->ids_map;
+    storage->metadata_map = c->metadata_map;
+    storage->norms_map = c->norms_map;
+    memset(&c->embeddings_map, 0, sizeof(segment_map_t));
+    memset(&c->ids_map, 0, sizeof(segment_map_t));
+    memset(&c->metadata_map, 0, sizeof(segment_map_t));
+    memset(&c->norms_map, 0, sizeof(segment_map_t));
+
+    pthread_rwlock_wrlock(&storage->id_lock);
+    id_index_free(&storage->ids);
+    storage->ids = c->ids;
+    c->ids = NULL;
+    storage->id_keys = storage->ids_map.addr;
+    storage->ids_saved_rows = id_index_deletes(storage->ids) > 0 ? id_index_rows(storage->ids) : 0;
+    storage->ids_saved_deletes = id_index_deletes(storage->ids);
+    pthread_rwlock_unlock(&storage->id_lock);
+
+    pthread_rwlock_wrlock(&storage->filter_lock);
+    filter_index_free(&storage->filters);
+    storage->filters = c->filters;
+    c->filters = NULL;
+    storage->filter_meta_offset = c->metadata_bytes;
+    pthread_rwlock_unlock(&storage->filter_lock);
+
+    if (storage->hnsw_enabled) {
+        storage_index_adopt(storage, segments, num_segments);
+    }
+    return status;
+}
+
+/**
+ * Copy the rows appended during the copy, then swap - caller holds
+ * layout_lock for writing and write_lock
+*/
+static vdb_status_t swap_locked(compaction_t *c, uint64_t snapshot_count, const roaring_t *snapshot_dead,
+                                bool *committed) {
+    vdb_storage_t *storage = c->storage;
+    storage_view_t view;
+    roaring_t dead, died;
+    roaring_init(&dead);
+    roaring_init(&died);
+
+    // after a failed commit the swap would record rows that may be lost
+    vdb_status_t status = storage->commit_error;
+    if (status == VDB_OK) {
+        status = storage_ids_catch_up(storage);
+    }
+    if (status == VDB_OK) {
+        status = storage_view_locked(storage, &view);
+    }
+    if (status == VDB_OK) {
+        status = storage_ids_dead(storage, &dead);
+    }
+    if (status == VDB_OK) {
+        uint64_t *grown = (uint64_t*)realloc(c->new_rows, (view.count > 0 ? view.count : 1) * sizeof(uint64_t));
+        status = grown != NULL ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+        if (grown != NULL) {
+            c->new_rows = grown;
+        }
+    }
+    if (status == VDB_OK) {
+        status = copy_rows(c, &view, snapshot_count, view.count, &dead, NULL);
+    }
+    if (status == VDB_OK) {
+        status = sync_new_files(c);
+    }
+    if (status == VDB_OK) {
+        status = index_new_ids(c);
+    }
+
+    // rows deleted while the copy ran were copied as live
+    if (status == VDB_OK) {
+        status = roaring_andnot(&dead, snapshot_dead, &died);
+    }
+    uint64_t rows[256];
+    size_t got;
+    uint64_t from = 0;
+    while (status == VDB_OK && (got = roaring_next_rows(&died, from, snapshot_count, rows, 256)) > 0) {
+        for (size_t i = 0; i < got && status == VDB_OK; i++) {
+            status = id_index_delete(c->ids, c->ids_map.addr, c->new_rows[rows[i]]);
+            if (status == VDB_ERROR_NOT_FOUND) {
+                status = VDB_OK; // superseded by a row copied just now
+            }
+        }
+        from = rows[got - 1] + 1;
+    }
+    roaring_free(&dead);
+    roaring_free(&died);
+
+    index_segment_t *segments = NULL;
+    size_t num_segments = 0;
+    if (status == VDB_OK && storage->hnsw_enabled) {
+        status = storage_index_remap(storage, c->new_rows, &segments, &num_segments);
+    }
+    if (status == VDB_OK) {
+        status = map_private(c, "embeddings.seg", &c->embeddings_map, (size_t)c->count * storage->row_bytes);
+    }
+    // after this the old mappings are only used by views taken earlier
+    if (status == VDB_OK) {
+        status = storage_retire_map(storage, &storage->embeddings_map);
+    }
+    if (status == VDB_OK) {
+        status = storage_retire_map(storage, &storage->ids_map);
+    }
+    if (status == VDB_OK && c->norms_fd >= 0 && c->count > 0) {
+        status = map_private(c, "norms.seg", &c->norms_map, (size_t)c->count * sizeof(float));
+    }
+    if (status == VDB_OK) {
+        status = storage_retire_map(storage, &storage->metadata_map);
+    }
+    if (status == VDB_OK) {
+        status = storage_retire_map(storage, &storage->norms_map);
+    }
+    if (status == VDB_OK) {
+        status = write_swap_files(c);
+    }
+    if (status != VDB_OK) {
+        storage_index_segments_free(segments, num_segments);
+        return status;
+    }
+
+    // committed: from here the new files are the collection, and an
+    // open after a failure below finishes the renames
+    *committed = true;
+    vdb_status_t dropped = drop_derived(storage);
+    status = roll_forward(storage->base_dir, storage->name);
+    if (status == VDB_OK) {
+        status = adopt_new_files(c, segments, num_segments);
+    } else {
+        storage_index_segments_free(segments, num_segments);
+    }
+    return status == VDB_OK ? dropped : status;
+}
+
+/**
+ * Compact if any row is dead - caller holds compact_lock
+*/
+static vdb_status_t compact_locked(vdb_storage_t *storage, uint64_t io_bytes_per_sec, bool background) {
+    compaction_t c;
+    memset(&c, 0, sizeof(c));
+    c.storage = storage;
+    c.background = background;
+    c.embeddings_fd = -1;
+    c.ids_fd = -1;
+    c.metadata_fd = -1;
+    c.norms_fd = -1;
+
+    /* snapshot: rows below its count never change. It is a reader's
+     * view, so appends during the copy can't unmap it under us */
+    storage_view_t view;
+    roaring_t dead;
+    roaring_init(&dead);
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = storage_ids_catch_up(storage);
+    if (status == VDB_OK) {
+        status = storage_acquire_view(storage, &view);
+    }
+    if (status == VDB_OK) {
+        status = storage_ids_dead(storage, &dead);
+        if (status != VDB_OK) {
+            storage_release_view(storage, &view);
+        }
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    if (status == VDB_OK && roaring_cardinality(&dead) == 0) {
+        storage_release_view(storage, &view);
+    }
+    if (status != VDB_OK || roaring_cardinality(&dead) == 0) {
+        roaring_free(&dead);
+        return status;
+    }
+
+    remove_compact_dir(storage->base_dir, storage->name);
+    c.new_rows = (uint64_t*)malloc((view.count > 0 ? view.count : 1) * sizeof(uint64_t));
+    c.embeddings_buf = (uint8_t*)malloc(COMPACT_CHUNK_ROWS * storage->row_bytes);
+    c.ids_buf = (uint8_t*)malloc(COMPACT_CHUNK_ROWS * VDB_ID_MAX_LEN);
+    if (view.norms != NULL) {
+        c.norms_buf = (float*)malloc(COMPACT_CHUNK_ROWS * sizeof(float));
+    }
+    status = c.new_rows != NULL && c.embeddings_buf != NULL && c.ids_buf != NULL &&
+        (view.norms == NULL || c.norms_buf != NULL) ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+    if (status == VDB_OK) {
+        status = filter_index_create(&c.filters);
+    }
+    if (status == VDB_OK) {
+        status = id_index_create(&c.ids);
+    }
+    if (status == VDB_OK) {
+        status = open_new_files(&c);
+    }
+
+    /* copy without locks, within the budget */
+    throttle_t budget = { io_bytes_per_sec, 0, { 0, 0 } };
+    clock_gettime(CLOCK_MONOTONIC, &budget.start);
+    if (status == VDB_OK) {
+        status = copy_rows(&c, &view, 0, view.count, &dead, &budget);
+    }
+    if (status == VDB_OK) {
+        status = sync_new_files(&c);
+    }
+    if (status == VDB_OK) {
+        status = index_new_ids(&c);
+    }
+
+    /* swap; readers come back to the new files' snapshot, and the old
+     * mappings go once the last view of them is released */
+    bool committed = false;
+    uint64_t snapshot_count = view.count;
+    storage_release_view(storage, &view);
+    if (status == VDB_OK) {
+        pthread_rwlock_wrlock(&storage->layout_lock);
+        pthread_mutex_lock(&storage->write_lock);
+        status = swap_locked(&c, snapshot_count, &dead, &committed);
+        storage_publish_locked(storage);
+        pthread_mutex_unlock(&storage->write_lock);
+        pthread_rwlock_unlock(&storage->layout_lock);
+    }
+    roaring_free(&dead);
+    compaction_free(&c);
+    if (status != VDB_OK) {
+        if (!committed) {
+            remove_compact_dir(storage->base_dir, storage->name);
+        }
+        return status;
+    }
+
+    /* re-encode the codes, wake the sealer if the memtable fills a
+     * segment, and save the remapped segments the stand-in hnsw.idx
+     * replaced; all derived, so failures are picked up again like after
+     * an append */
+    pthread_mutex_lock(&storage->write_lock);
+    if (storage->quantization != VDB_QUANTIZATION_NONE) {
+        storage_quant_catch_up(storage);
+    }
+    if (storage->hnsw_enabled) {
+        storage_index_catch_up(storage);
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    storage_index_save(storage);
+    return VDB_OK;
+}
+
+vdb_status_t vdb_storage_compact(vdb_storage_t *storage, uint64_t io_bytes_per_sec) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->compact_lock);
+    vdb_status_t status = compact_locked(storage, io_bytes_per_sec, false);
+    pthread_mutex_unlock(&storage->compact_lock);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Background compactor                                                */
+/* ------------------------------------------------------------------ */
+
+static bool compaction_due(vdb_storage_t *storage, double min_dead_fraction) {
+    pthread_mutex_lock(&storage->write_lock);
+    uint64_t count = storage->count;
+    pthread_mutex_unlock(&storage->write_lock);
+    uint64_t dead = storage_ids_dead_count(storage);
+    return dead > 0 && (double)dead >= min_dead_fraction * (double)count;
+}
+
+/**
+ * Wake up every interval_ms and compact once enough rows are dead
+*/
+static void *compact_main(void *arg) {
+    vdb_storage_t *storage = (vdb_storage_t*)arg;
+
+    pthread_mutex_lock(&storage->compact_wait_lock);
+    while (!storage->compact_stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint32_t ms = storage->compact_params.interval_ms;
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&storage->compact_cond, &storage->compact_wait_lock, &ts);
+        if (storage->compact_stop) {
+            break;
+        }
+
+        vdb_compaction_params_t params = storage->compact_params;
+        pthread_mutex_unlock(&storage->compact_wait_lock);
+        if (compaction_due(storage, params.min_dead_fraction)) {
+            // a failed run is simply tried again next time
+            pthread_mutex_lock(&storage->compact_lock);
+            compact_locked(storage, params.io_bytes_per_sec, true);
+            pthread_mutex_unlock(&storage->compact_lock);
+        }
+        pthread_mutex_lock(&storage->compact_wait_lock);
+    }
+    pthread_mutex_unlock(&storage->compact_wait_lock);
+    return NULL;
+}
+
+vdb_status_t storage_compact_if_due(vdb_storage_t *storage, const vdb_compaction_params_t *params) {
+    if (!compaction_due(storage, params->min_dead_fraction)) {
+        return VDB_OK;
+    }
+    pthread_mutex_lock(&storage->compact_lock);
+    vdb_status_t status = compact_locked(storage, params->io_bytes_per_sec, true);
+    pthread_mutex_unlock(&storage->compact_lock);
+    return status;
+}
+
+void storage_compact_stop(vdb_storage_t *storage) {
+    pthread_mutex_lock(&storage->compact_wait_lock);
+    if (!storage->compact_thread_running) {
+        pthread_mutex_unlock(&storage->compact_wait_lock);
+        return;
+    }
+    storage->compact_stop = true;
+    pthread_cond_signal(&storage->compact_cond);
+    pthread_mutex_unlock(&storage->compact_wait_lock);
+
+    pthread_join(storage->compact_thread, NULL);
+
+    pthread_mutex_lock(&storage->compact_wait_lock);
+    storage->compact_thread_running = false;
+    storage->compact_stop = false;
+    pthread_mutex_unlock(&storage->compact_wait_lock);
+}
+
+vdb_status_t vdb_storage_set_compaction(vdb_storage_t *storage, const vdb_compaction_params_t *params) {
+    if (storage == NULL || (params != NULL && !storage_compaction_params_valid(params))) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (params == NULL) {
+        storage_compact_stop(storage);
+        return VDB_OK;
+    }
+
+    pthread_mutex_lock(&storage->compact_wait_lock);
+    storage->compact_params = *params;
+    vdb_status_t status = VDB_OK;
+    if (!storage->compact_thread_running) {
+        if (pthread_create(&storage->compact_thread, NULL, compact_main, storage) != 0) {
+            status = VDB_ERROR_UNKNOWN;
+        } else {
+            storage->compact_thread_running = true;
+        }
+    } else {
+        pthread_cond_signal(&storage->compact_cond); // pick up the new interval now
+    }
+    pthread_mutex_unlock(&storage->compact_wait_lock);
+    return status;
+}
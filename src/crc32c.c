@@ -0,0 +1,69 @@
+/**
+ * crc32c.c - CRC32C with the SSE4.2 crc32 instruction when available
+ *
+ * The fallback is a byte-at-a-time table; the WAL is read in full only
+ * on recovery, and written once per append, so it doesn't need more.
+*/
+
+#include "crc32c.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#define VDB_CRC_X86 1
+#include <immintrin.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void build_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc_scalar(uint32_t crc, const uint8_t *p, size_t len) {
+    pthread_once(&crc_table_once, build_table);
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef VDB_CRC_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+    for (; len > 0; p++, len--) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+    return crc;
+}
+
+#endif /* VDB_CRC_X86 */
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    crc = ~crc;
+#ifdef VDB_CRC_X86
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc_sse42(crc, p, len);
+    }
+#endif
+    return ~crc_scalar(crc, p, len);
+}
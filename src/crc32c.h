@@ -0,0 +1,17 @@
+/**
+ * crc32c.h - Internal CRC32C (Castagnoli) checksums
+ *
+ * Used to frame WAL records. Values chain like zlib's crc32():
+ * crc32c(crc32c(0, a, n), b, m) == crc32c(0, a || b, n + m).
+*/
+
+#ifndef VDB_CRC32C_H
+#define VDB_CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Extend crc (0 to start) over len bytes of data */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif /* VDB_CRC32C_H */
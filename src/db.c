@@ -0,0 +1,544 @@
+/**
+ * db.c - Multi-collection handle
+ *
+ * Every collection acquired once gets an entry in a chained hash table
+ * keyed by name; entries are small and kept (closed) until the
+ * database is, so a pointer to one stays valid. Open entries are also
+ * on an LRU list, most recently acquired first.
+ *
+ * Opening and closing a collection does I/O, so it runs outside
+ * db->lock: the entry is marked busy meanwhile, and anyone acquiring
+ * or evicting it waits on busy_cond. An entry is only closed while no
+ * one holds it (refs == 0) - the maintenance thread holds a reference
+ * too while it compacts one.
+*/
+
+#include "vdb/db.h"
+#include "storage_internal.h"
+#include "crc32c.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* Initial hash buckets; doubled when entries outnumber them */
+#define DB_INITIAL_BUCKETS 64
+
+typedef struct db_entry {
+    char name[VDB_COLLECTION_NAME_MAX_LEN];
+    vdb_storage_t *storage; // NULL while closed
+    uint32_t refs; // acquires not yet released
+    bool busy; // being opened or closed outside the lock
+    struct db_entry *chain; // next in its bucket
+    struct db_entry *newer; // LRU neighbours, while open
+    struct db_entry *older;
+} db_entry_t;
+
+struct vdb_db {
+    char base_dir[MAX_PATH];
+    vdb_db_params_t params;
+    size_t cache_share; // cap on each cache of a collection, 0 = none
+    vdb_thread_pool_t *pool;
+
+    pthread_mutex_t lock;
+    pthread_cond_t busy_cond; // an entry stopped being busy
+    db_entry_t **buckets;
+    size_t num_buckets;
+    size_t num_entries;
+    db_entry_t *newest; // LRU list of open entries
+    db_entry_t *oldest;
+    size_t num_open;
+
+    /* Maintenance thread (memory budget, compaction); sleeps on
+     * maintenance_cond under lock */
+    pthread_cond_t maintenance_cond;
+    pthread_t maintenance_thread;
+    bool maintenance_running;
+    bool maintenance_stop;
+};
+
+vdb_db_params_t vdb_db_params_default(void) {
+    vdb_db_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.max_open = VDB_DB_DEFAULT_MAX_OPEN;
+    params.compaction_params = vdb_compaction_params_default();
+    return params;
+}
+
+/* ------------------------------------------------------------------ */
+/* Entries                                                             */
+/* ------------------------------------------------------------------ */
+
+static size_t bucket_of(const vdb_db_t *db, const char *name) {
+    return crc32c(0, name, strlen(name)) & (db->num_buckets - 1);
+}
+
+static db_entry_t *find_locked(vdb_db_t *db, const char *name) {
+    for (db_entry_t *e = db->buckets[bucket_of(db, name)]; e != NULL; e = e->chain) {
+        if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Double the buckets; a failed allocation just leaves chains longer
+*/
+static void grow_locked(vdb_db_t *db) {
+    size_t num = db->num_buckets * 2;
+    db_entry_t **buckets = (db_entry_t**)calloc(num, sizeof(db_entry_t*));
+    if (buckets == NULL) {
+        return;
+    }
+    db_entry_t **old = db->buckets;
+    size_t old_num = db->num_buckets;
+    db->buckets = buckets;
+    db->num_buckets = num;
+    for (size_t i = 0; i < old_num; i++) {
+        while (old[i] != NULL) {
+            db_entry_t *e = old[i];
+            old[i] = e->chain;
+            size_t b = bucket_of(db, e->name);
+            e->chain = buckets[b];
+            buckets[b] = e;
+        }
+    }
+    free(old);
+}
+
+/**
+ * Find the entry of name, adding a closed one if there is none
+ * Returns: NULL if it can't be allocated
+*/
+static db_entry_t *get_locked(vdb_db_t *db, const char *name) {
+    db_entry_t *e = find_locked(db, name);
+    if (e != NULL) {
+        return e;
+    }
+    e = (db_entry_t*)calloc(1, sizeof(db_entry_t));
+    if (e == NULL) {
+        return NULL;
+    }
+    strcpy(e->name, name); // length checked by the caller
+    if (db->num_entries >= db->num_buckets) {
+        grow_locked(db);
+    }
+    size_t b = bucket_of(db, name);
+    e->chain = db->buckets[b];
+    db->buckets[b] = e;
+    db->num_entries++;
+    return e;
+}
+
+static void lru_unlink(vdb_db_t *db, db_entry_t *e) {
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        db->newest = e->older;
+    }
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        db->oldest = e->newer;
+    }
+    e->newer = NULL;
+    e->older = NULL;
+}
+
+static void lru_push(vdb_db_t *db, db_entry_t *e) {
+    e->newer = NULL;
+    e->older = db->newest;
+    if (db->newest != NULL) {
+        db->newest->newer = e;
+    } else {
+        db->oldest = e;
+    }
+    db->newest = e;
+}
+
+/* ------------------------------------------------------------------ */
+/* Open / close                                                        */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Move a freshly opened collection onto the shared pool and cap its
+ * caches at its share of the budget
+*/
+static vdb_status_t adopt(vdb_db_t *db, vdb_storage_t *storage) {
+    vdb_status_t status = storage_share_pool(storage, db->pool);
+    size_t cache = db->params.query_cache_bytes;
+    size_t pinned = VDB_DEFAULT_HNSW_PINNED_BYTES;
+    if (db->cache_share > 0) {
+        cache = cache < db->cache_share ? cache : db->cache_share;
+        pinned = pinned < db->cache_share ? pinned : db->cache_share;
+    }
+    if (status == VDB_OK) {
+        status = vdb_storage_set_query_cache(storage, cache);
+    }
+    if (status == VDB_OK) {
+        status = vdb_storage_set_hnsw_pinned_bytes(storage, pinned);
+    }
+    return status;
+}
+
+/**
+ * Close an open, unheld entry; drops db->lock while the collection is
+ * closed
+*/
+static void close_locked(vdb_db_t *db, db_entry_t *e) {
+    lru_unlink(db, e);
+    db->num_open--;
+    vdb_storage_t *storage = e->storage;
+    e->storage = NULL;
+    e->busy = true;
+
+    pthread_mutex_unlock(&db->lock);
+    vdb_storage_close(&storage);
+    pthread_mutex_lock(&db->lock);
+
+    e->busy = false;
+    pthread_cond_broadcast(&db->busy_cond);
+}
+
+static size_t memory_locked(vdb_db_t *db) {
+    size_t bytes = 0;
+    for (db_entry_t *e = db->newest; e != NULL; e = e->older) {
+        bytes += vdb_storage_memory_usage(e->storage);
+    }
+    return bytes;
+}
+
+/**
+ * Close idle collections, least recently used first, until at most
+ * max_open are open and they fit the memory budget (or none is idle)
+*/
+static void trim_locked(vdb_db_t *db) {
+    size_t budget = db->params.memory_budget;
+    size_t used = budget > 0 ? memory_locked(db) : 0;
+    db_entry_t *e = db->oldest;
+    while (e != NULL && (db->num_open > db->params.max_open || used > budget)) {
+        if (e->refs > 0 || e->busy) {
+            e = e->newer;
+            continue;
+        }
+        size_t bytes = budget > 0 ? vdb_storage_memory_usage(e->storage) : 0;
+        close_locked(db, e);
+        used -= bytes < used ? bytes : used;
+        e = db->oldest; // the list may have changed while unlocked
+    }
+}
+
+/**
+ * Acquire name, opening (or with create, creating) it if need be
+*/
+static vdb_status_t acquire(vdb_db_t *db, const char *name, bool create, uint32_t dim,
+                            vdb_metric_t metric, vdb_storage_t **out_storage) {
+    if (db == NULL || name == NULL || out_storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (name[0] == '\0' || strlen(name) >= VDB_COLLECTION_NAME_MAX_LEN) {
+        return create ? VDB_ERROR_INVALID_ARGUMENT : VDB_ERROR_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&db->lock);
+    db_entry_t *e = get_locked(db, name);
+    if (e == NULL) {
+        pthread_mutex_unlock(&db->lock);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    while (e->busy) {
+        pthread_cond_wait(&db->busy_cond, &db->lock);
+    }
+    if (e->storage != NULL) {
+        vdb_status_t status = VDB_OK;
+        if (create) {
+            status = VDB_ERROR_ALREADY_EXISTS;
+        } else {
+            e->refs++;
+            lru_unlink(db, e);
+            lru_push(db, e);
+            *out_storage = e->storage;
+        }
+        pthread_mutex_unlock(&db->lock);
+        return status;
+    }
+    e->busy = true;
+    pthread_mutex_unlock(&db->lock);
+
+    vdb_storage_t *storage = NULL;
+    vdb_status_t status = create ? vdb_storage_create(db->base_dir, name, dim, metric, &storage)
+                                 : vdb_storage_open(db->base_dir, name, &storage);
+    if (status == VDB_OK) {
+        status = adopt(db, storage);
+        if (status != VDB_OK) {
+            vdb_storage_close(&storage);
+        }
+    }
+
+    pthread_mutex_lock(&db->lock);
+    e->busy = false;
+    pthread_cond_broadcast(&db->busy_cond);
+    if (status == VDB_OK) {
+        e->storage = storage;
+        e->refs = 1;
+        lru_push(db, e);
+        db->num_open++;
+        trim_locked(db);
+        *out_storage = storage;
+    }
+    pthread_mutex_unlock(&db->lock);
+    return status;
+}
+
+vdb_status_t vdb_db_acquire(vdb_db_t *db, const char *name, vdb_storage_t **out_storage) {
+    return acquire(db, name, false, 0, VDB_METRIC_EUCLIDEAN, out_storage);
+}
+
+vdb_status_t vdb_db_create(vdb_db_t *db, const char *name, uint32_t dim, vdb_metric_t metric,
+                           vdb_storage_t **out_storage) {
+    return acquire(db, name, true, dim, metric, out_storage);
+}
+
+void vdb_db_release(vdb_db_t *db, vdb_storage_t *storage) {
+    if (db == NULL || storage == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&db->lock);
+    db_entry_t *e = find_locked(db, storage->name);
+    if (e != NULL && e->storage == storage && e->refs > 0) {
+        e->refs--;
+        // over max_open because everything was held: catch up now
+        if (e->refs == 0 && db->num_open > db->params.max_open) {
+            trim_locked(db);
+        }
+    }
+    pthread_mutex_unlock(&db->lock);
+}
+
+vdb_status_t vdb_db_evict(vdb_db_t *db, const char *name) {
+    if (db == NULL || name == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_status_t status = VDB_OK;
+    pthread_mutex_lock(&db->lock);
+    db_entry_t *e = find_locked(db, name);
+    while (e != NULL && e->busy) {
+        pthread_cond_wait(&db->busy_cond, &db->lock);
+    }
+    if (e != NULL && e->storage != NULL) {
+        if (e->refs > 0) {
+            status = VDB_ERROR_INVALID_ARGUMENT;
+        } else {
+            close_locked(db, e);
+        }
+    }
+    pthread_mutex_unlock(&db->lock);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Maintenance                                                         */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Compact the open collections that are due, one at a time, each held
+ * while it runs. Entries are collected first: the LRU order changes
+ * while the lock is dropped.
+*/
+static void compact_locked(vdb_db_t *db) {
+    size_t num = db->num_open;
+    db_entry_t **entries = (db_entry_t**)malloc((num > 0 ? num : 1) * sizeof(db_entry_t*));
+    if (entries == NULL) {
+        return;
+    }
+    size_t n = 0;
+    for (db_entry_t *e = db->newest; e != NULL && n < num; e = e->older) {
+        entries[n++] = e;
+    }
+
+    for (size_t i = 0; i < n && !db->maintenance_stop; i++) {
+        db_entry_t *e = entries[i];
+        if (e->storage == NULL || e->busy) {
+            continue; // closed meanwhile
+        }
+        e->refs++;
+        vdb_compaction_params_t params = db->params.compaction_params;
+        pthread_mutex_unlock(&db->lock);
+        // a failed run is simply tried again next time
+        storage_compact_if_due(e->storage, &params);
+        pthread_mutex_lock(&db->lock);
+        e->refs--;
+    }
+    free(entries);
+}
+
+static void *maintenance_main(void *arg) {
+    vdb_db_t *db = (vdb_db_t*)arg;
+    uint32_t ms = db->params.compaction ? db->params.compaction_params.interval_ms
+                                        : VDB_DB_MAINTENANCE_MS;
+
+    pthread_mutex_lock(&db->lock);
+    while (!db->maintenance_stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&db->maintenance_cond, &db->lock, &ts);
+        if (db->maintenance_stop) {
+            break;
+        }
+
+        // caches fill and segments seal between acquires
+        if (db->params.memory_budget > 0) {
+            trim_locked(db);
+        }
+        if (db->params.compaction) {
+            compact_locked(db);
+        }
+    }
+    pthread_mutex_unlock(&db->lock);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Database                                                            */
+/* ------------------------------------------------------------------ */
+
+static void free_db(vdb_db_t *db) {
+    for (size_t i = 0; i < db->num_buckets; i++) {
+        while (db->buckets[i] != NULL) {
+            db_entry_t *e = db->buckets[i];
+            db->buckets[i] = e->chain;
+            vdb_storage_close(&e->storage);
+            free(e);
+        }
+    }
+    // after the collections: they run on it
+    vdb_thread_pool_destroy(&db->pool);
+    pthread_cond_destroy(&db->maintenance_cond);
+    pthread_cond_destroy(&db->busy_cond);
+    pthread_mutex_destroy(&db->lock);
+    free(db->buckets);
+    free(db);
+}
+
+vdb_status_t vdb_db_open(const char *base_dir, const vdb_db_params_t *params, vdb_db_t **out_db) {
+    vdb_db_params_t p = params != NULL ? *params : vdb_db_params_default();
+    if (base_dir == NULL || out_db == NULL || strlen(base_dir) >= MAX_PATH ||
+        (p.compaction && !storage_compaction_params_valid(&p.compaction_params))) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (p.max_open == 0) {
+        p.max_open = VDB_DB_DEFAULT_MAX_OPEN;
+    }
+
+    struct stat st;
+    if (mkdir(base_dir, 0755) != 0 && (errno != EEXIST || stat(base_dir, &st) != 0 ||
+                                       !S_ISDIR(st.st_mode))) {
+        return VDB_ERROR_IO;
+    }
+
+    vdb_db_t *db = (vdb_db_t*)calloc(1, sizeof(vdb_db_t));
+    if (db == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    strcpy(db->base_dir, base_dir);
+    db->params = p;
+    // half of a collection's share for each of its two caches
+    db->cache_share = p.memory_budget > 0 ? p.memory_budget / p.max_open / 2 : 0;
+    pthread_mutex_init(&db->lock, NULL);
+    pthread_cond_init(&db->busy_cond, NULL);
+    pthread_cond_init(&db->maintenance_cond, NULL);
+
+    db->num_buckets = DB_INITIAL_BUCKETS;
+    db->buckets = (db_entry_t**)calloc(db->num_buckets, sizeof(db_entry_t*));
+    size_t workers = p.threads > 0 ? p.threads - 1 : vdb_thread_pool_default_workers();
+    if (db->buckets == NULL || vdb_thread_pool_create(workers, &db->pool) != VDB_OK) {
+        free_db(db);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (p.memory_budget > 0 || p.compaction) {
+        if (pthread_create(&db->maintenance_thread, NULL, maintenance_main, db) != 0) {
+            free_db(db);
+            return VDB_ERROR_UNKNOWN;
+        }
+        db->maintenance_running = true;
+    }
+
+    *out_db = db;
+    return VDB_OK;
+}
+
+void vdb_db_close(vdb_db_t **db) {
+    if (db == NULL || *db == NULL) {
+        return;
+    }
+
+    vdb_db_t *d = *db;
+    if (d->maintenance_running) {
+        pthread_mutex_lock(&d->lock);
+        d->maintenance_stop = true;
+        pthread_cond_signal(&d->maintenance_cond);
+        pthread_mutex_unlock(&d->lock);
+        pthread_join(d->maintenance_thread, NULL);
+    }
+    free_db(d);
+    *db = NULL;
+}
+
+vdb_status_t vdb_db_list(vdb_db_t *db, vdb_db_list_fn fn, void *user_data) {
+    if (db == NULL || fn == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    DIR *dir = opendir(db->base_dir);
+    if (dir == NULL) {
+        return VDB_ERROR_IO;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) >= VDB_COLLECTION_NAME_MAX_LEN) {
+            continue;
+        }
+        // a collection is a directory with a superblock
+        char path[MAX_PATH];
+        struct stat st;
+        int len = snprintf(path, sizeof(path), "%s/%s/collection.meta", db->base_dir, entry->d_name);
+        if (len < 0 || (size_t)len >= sizeof(path) || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (fn(entry->d_name, user_data) != 0) {
+            break;
+        }
+    }
+    closedir(dir);
+    return VDB_OK;
+}
+
+size_t vdb_db_open_count(vdb_db_t *db) {
+    if (db == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&db->lock);
+    size_t n = db->num_open;
+    pthread_mutex_unlock(&db->lock);
+    return n;
+}
+
+size_t vdb_db_memory_usage(vdb_db_t *db) {
+    if (db == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&db->lock);
+    size_t bytes = memory_locked(db);
+    pthread_mutex_unlock(&db->lock);
+    return bytes;
+}
@@ -0,0 +1,190 @@
+/**
+ * diskann.c - Attaching a DiskANN index to a storage
+ *
+ * The graph and its sector file are vamana.c; this builds it over the
+ * stored rows and keeps diskann.idx matched to them. Unlike the HNSW
+ * segments the index is one snapshot: rows past it are scanned exactly
+ * by searches, and anything that renumbers rows (compaction) drops it.
+ * A file that no longer fits the rows on open (rows lost in a crash,
+ * another row format) is deleted instead of attached.
+*/
+
+#include "vdb/storage.h"
+#include "storage_internal.h"
+#include "vamana.h"
+#include <stdio.h>
+#include <unistd.h>
+
+/* VDB_ERROR_INVALID_ARGUMENT if the path doesn't fit in MAX_PATH */
+static vdb_status_t diskann_path(const char *base_dir, const char *name, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/diskann.idx", base_dir, name);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+vdb_diskann_params_t vdb_diskann_params_default(void) {
+    vdb_diskann_params_t params = { 64, 100, 1.2f, 64, 4 };
+    return params;
+}
+
+static bool params_valid(const vdb_diskann_params_t *params) {
+    return params->max_degree >= VDB_DISKANN_MIN_DEGREE && params->max_degree <= VDB_DISKANN_MAX_DEGREE &&
+        params->build_list >= params->max_degree && params->alpha >= 1.0f &&
+        params->search_list > 0 && params->beam_width > 0 && params->beam_width <= VDB_DISKANN_MAX_BEAM;
+}
+
+/* The row format the graph's records copy */
+static hnsw_space_t diskann_space(const vdb_storage_t *storage, const uint8_t *base) {
+    hnsw_space_t space = { storage_scan_metric(storage), storage->scan_dim, base, storage->row_bytes,
+                           storage->element, storage->dim_kernel };
+    return space;
+}
+
+/**
+ * Swap in a new index (NULL to detach); caller holds layout_lock for
+ * writing and write_lock. Returns the old one.
+*/
+static vamana_index_t *swap_locked(vdb_storage_t *storage, vamana_index_t *index) {
+    vamana_index_t *old = storage->diskann;
+    if (index != NULL) {
+        vamana_set_uring(index, storage->ring != NULL);
+    }
+    storage->diskann = index;
+    query_cache_invalidate(storage->query_cache);
+    return old;
+}
+
+vdb_status_t vdb_storage_build_diskann(vdb_storage_t *storage, const vdb_diskann_params_t *params) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_diskann_params_t p = params != NULL ? *params : vdb_diskann_params_default();
+    if (!params_valid(&p)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    // no compaction may renumber the rows under the build
+    pthread_mutex_lock(&storage->compact_lock);
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    if (status != VDB_OK) {
+        pthread_mutex_unlock(&storage->compact_lock);
+        return status;
+    }
+    vdb_thread_pool_t *pool = storage_get_pool(storage); // under the view's guard
+    uint64_t count = view.count;
+    char path[MAX_PATH];
+    status = diskann_path(storage->base_dir, storage->name, path);
+
+    if (status == VDB_OK && (count == 0 || count >= UINT32_MAX)) {
+        status = VDB_ERROR_INVALID_ARGUMENT;
+    } else if (status == VDB_OK) {
+        hnsw_space_t space = diskann_space(storage, view.embeddings);
+        status = vamana_build(&p, &space, (uint32_t)count, pool, path);
+    }
+    storage_release_view(storage, &view);
+
+    vamana_index_t *index = NULL;
+    if (status == VDB_OK) {
+        status = vamana_open(path, &index);
+        status = status == VDB_OK || status == VDB_ERROR_OUT_OF_MEMORY ? status : VDB_ERROR_IO;
+    }
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_BYTES_INDEX, vamana_file_bytes(index));
+        pthread_rwlock_wrlock(&storage->layout_lock);
+        pthread_mutex_lock(&storage->write_lock);
+        vamana_index_t *old = swap_locked(storage, index);
+        pthread_mutex_unlock(&storage->write_lock);
+        pthread_rwlock_unlock(&storage->layout_lock);
+        vamana_close(&old); // its file was renamed over; the fd kept it readable
+    }
+    pthread_mutex_unlock(&storage->compact_lock);
+    return status;
+}
+
+bool vdb_storage_has_diskann(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return false;
+    }
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    bool has = storage->diskann != NULL;
+    pthread_rwlock_unlock(&storage->layout_lock);
+    return has;
+}
+
+vdb_status_t vdb_storage_drop_diskann(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    pthread_mutex_lock(&storage->compact_lock);
+    pthread_rwlock_wrlock(&storage->layout_lock);
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = storage->diskann != NULL ? storage_diskann_drop(storage) : VDB_ERROR_NOT_FOUND;
+    pthread_mutex_unlock(&storage->write_lock);
+    pthread_rwlock_unlock(&storage->layout_lock);
+    pthread_mutex_unlock(&storage->compact_lock);
+    return status;
+}
+
+vdb_status_t vdb_storage_set_diskann_search(vdb_storage_t *storage, uint32_t search_list,
+                                            uint32_t beam_width) {
+    if (storage == NULL || search_list == 0 || beam_width == 0 || beam_width > VDB_DISKANN_MAX_BEAM) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    pthread_rwlock_wrlock(&storage->layout_lock);
+    vdb_status_t status = VDB_ERROR_NOT_FOUND;
+    if (storage->diskann != NULL) {
+        vamana_set_search(storage->diskann, search_list, beam_width);
+        status = VDB_OK;
+    }
+    pthread_rwlock_unlock(&storage->layout_lock);
+    query_cache_invalidate(storage->query_cache);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Storage hooks                                                       */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t storage_diskann_load(vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    vdb_status_t status = diskann_path(storage->base_dir, storage->name, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    vamana_index_t *index = NULL;
+    status = vamana_open(path, &index);
+    if (status == VDB_ERROR_NOT_FOUND) {
+        return VDB_OK;
+    }
+    if (status == VDB_ERROR_OUT_OF_MEMORY) {
+        return status;
+    }
+
+    hnsw_space_t space = diskann_space(storage, NULL);
+    if (status != VDB_OK || !vamana_matches(index, &space) || vamana_count(index) > storage->count) {
+        // derived data: stale or unreadable, rebuilt on request
+        vamana_close(&index);
+        unlink(path);
+        return VDB_OK;
+    }
+    pthread_rwlock_wrlock(&storage->layout_lock);
+    pthread_mutex_lock(&storage->write_lock);
+    swap_locked(storage, index);
+    pthread_mutex_unlock(&storage->write_lock);
+    pthread_rwlock_unlock(&storage->layout_lock);
+    return VDB_OK;
+}
+
+vdb_status_t storage_diskann_drop(vdb_storage_t *storage) {
+    vamana_index_t *old = swap_locked(storage, NULL);
+    if (old == NULL) {
+        return VDB_OK;
+    }
+    vamana_close(&old);
+    char path[MAX_PATH];
+    vdb_status_t status = diskann_path(storage->base_dir, storage->name, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    return unlink(path) == 0 ? VDB_OK : VDB_ERROR_IO;
+}
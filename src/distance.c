@@ -0,0 +1,1777 @@
+/**
+ * distance.c - Distance kernels with runtime CPU dispatch
+ *
+ * Each ISA provides the same primitives:
+ * - dot(a, b)
+ * - l2sq(a, b)  (squared L2)
+ * - dot_norm(q, x) -> q.x and x.x in one pass (cosine without a second read)
+ * - l2sq_x4 / dot_norm_x4: one row against four queries, so each load
+ *   of the row feeds four accumulators (the micro-kernel of the tile)
+ * - f16 / bf16: l2sq, dot and dot_norm of a float32 query against a half
+ *   precision row, converting as it loads (F16C, AVX-512F, NEON), and
+ *   widen for whole rows
+ * - fixed: dot, l2sq and dot_norm again for each of the common embedding
+ *   sizes (DISTANCE_FIXED_DIMS), generated from one template with the
+ *   dimension as a constant (see "Fixed-dimension kernels")
+ *
+ * x86 variants are compiled with per-function target attributes, so the
+ * library builds without -mavx2 and still runs on older CPUs. The table
+ * is chosen by a constructor at load time.
+*/
+
+#include "vdb/distance.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VDB_DISTANCE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define VDB_DISTANCE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Kernels over half precision rows, one set per element type */
+typedef struct {
+    float (*l2sq)(const float *q, const uint16_t *x, uint32_t dim);
+    float (*dot)(const float *q, const uint16_t *x, uint32_t dim);
+    void (*dot_norm)(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx);
+    void (*widen)(const uint16_t *x, float *out, size_t n);
+} half_kernels_t;
+
+/* float32 kernels for one dimension */
+typedef struct {
+    float (*dot)(const float *a, const float *b, uint32_t dim);
+    float (*l2sq)(const float *a, const float *b, uint32_t dim);
+    void (*dot_norm)(const float *q, const float *x, uint32_t dim, float *out_dot, float *out_xx);
+} fixed_kernels_t;
+
+/* ------------------------------------------------------------------ */
+/* Fixed-dimension kernels                                             */
+/* ------------------------------------------------------------------ */
+
+/*
+ * X-macro of the specialized sizes: X(isa, dim) for each. All are
+ * multiples of 64 floats - four AVX-512 vectors, the widest step - so
+ * the template's loop has no tail, and with a constant trip count it is
+ * unrolled completely: straight-line loads and FMAs, no counter, no
+ * branch. The dimension argument is only there to share the generic
+ * kernels' signature.
+ *
+ * An ISA instantiates the template after defining FX_<isa>_{TARGET,
+ * VEC, LANES, ZERO, LOAD, FMA, SUB, ADD, HSUM}; FMA(a, b, acc) is
+ * a * b + acc. The scalar table keeps the generic loops for every size.
+*/
+#define DISTANCE_FIXED_DIMS 4
+#define FIXED_DIMS(X, isa) X(isa, 384) X(isa, 768) X(isa, 1024) X(isa, 1536)
+
+#define FX_OP(isa, op) FX_##isa##_##op
+#define FX_DIM(isa, D) D,
+
+static const uint32_t fixed_dims[] = { FIXED_DIMS(FX_DIM, _) };
+_Static_assert(sizeof(fixed_dims) / sizeof(fixed_dims[0]) == DISTANCE_FIXED_DIMS,
+               "DISTANCE_FIXED_DIMS out of date");
+
+#define FIXED_KERNELS(isa, D) \
+FX_OP(isa, TARGET) \
+static float dot_##isa##_##D(const float *a, const float *b, uint32_t dim) { \
+    (void)dim; \
+    FX_OP(isa, VEC) acc0 = FX_OP(isa, ZERO)(), acc1 = FX_OP(isa, ZERO)(); \
+    FX_OP(isa, VEC) acc2 = FX_OP(isa, ZERO)(), acc3 = FX_OP(isa, ZERO)(); \
+    _Pragma("GCC unroll 128") \
+    for (uint32_t i = 0; i < (D); i += 4 * FX_OP(isa, LANES)) { \
+        acc0 = FX_OP(isa, FMA)(FX_OP(isa, LOAD)(a + i), FX_OP(isa, LOAD)(b + i), acc0); \
+        acc1 = FX_OP(isa, FMA)(FX_OP(isa, LOAD)(a + i + FX_OP(isa, LANES)), \
+                               FX_OP(isa, LOAD)(b + i + FX_OP(isa, LANES)), acc1); \
+        acc2 = FX_OP(isa, FMA)(FX_OP(isa, LOAD)(a + i + 2 * FX_OP(isa, LANES)), \
+                               FX_OP(isa, LOAD)(b + i + 2 * FX_OP(isa, LANES)), acc2); \
+        acc3 = FX_OP(isa, FMA)(FX_OP(isa, LOAD)(a + i + 3 * FX_OP(isa, LANES)), \
+                               FX_OP(isa, LOAD)(b + i + 3 * FX_OP(isa, LANES)), acc3); \
+    } \
+    return FX_OP(isa, HSUM)(FX_OP(isa, ADD)(FX_OP(isa, ADD)(acc0, acc1), FX_OP(isa, ADD)(acc2, acc3))); \
+} \
+FX_OP(isa, TARGET) \
+static float l2sq_##isa##_##D(const float *a, const float *b, uint32_t dim) { \
+    (void)dim; \
+    FX_OP(isa, VEC) acc0 = FX_OP(isa, ZERO)(), acc1 = FX_OP(isa, ZERO)(); \
+    FX_OP(isa, VEC) acc2 = FX_OP(isa, ZERO)(), acc3 = FX_OP(isa, ZERO)(); \
+    _Pragma("GCC unroll 128") \
+    for (uint32_t i = 0; i < (D); i += 4 * FX_OP(isa, LANES)) { \
+        FX_OP(isa, VEC) d0 = FX_OP(isa, SUB)(FX_OP(isa, LOAD)(a + i), FX_OP(isa, LOAD)(b + i)); \
+        FX_OP(isa, VEC) d1 = FX_OP(isa, SUB)(FX_OP(isa, LOAD)(a + i + FX_OP(isa, LANES)), \
+                                             FX_OP(isa, LOAD)(b + i + FX_OP(isa, LANES))); \
+        FX_OP(isa, VEC) d2 = FX_OP(isa, SUB)(FX_OP(isa, LOAD)(a + i + 2 * FX_OP(isa, LANES)), \
+                                             FX_OP(isa, LOAD)(b + i + 2 * FX_OP(isa, LANES))); \
+        FX_OP(isa, VEC) d3 = FX_OP(isa, SUB)(FX_OP(isa, LOAD)(a + i + 3 * FX_OP(isa, LANES)), \
+                                             FX_OP(isa, LOAD)(b + i + 3 * FX_OP(isa, LANES))); \
+        acc0 = FX_OP(isa, FMA)(d0, d0, acc0); \
+        acc1 = FX_OP(isa, FMA)(d1, d1, acc1); \
+        acc2 = FX_OP(isa, FMA)(d2, d2, acc2); \
+        acc3 = FX_OP(isa, FMA)(d3, d3, acc3); \
+    } \
+    return FX_OP(isa, HSUM)(FX_OP(isa, ADD)(FX_OP(isa, ADD)(acc0, acc1), FX_OP(isa, ADD)(acc2, acc3))); \
+} \
+FX_OP(isa, TARGET) \
+static void dot_norm_##isa##_##D(const float *q, const float *x, uint32_t dim, \
+                                 float *out_dot, float *out_xx) { \
+    (void)dim; \
+    FX_OP(isa, VEC) dacc0 = FX_OP(isa, ZERO)(), dacc1 = FX_OP(isa, ZERO)(); \
+    FX_OP(isa, VEC) nacc0 = FX_OP(isa, ZERO)(), nacc1 = FX_OP(isa, ZERO)(); \
+    _Pragma("GCC unroll 128") \
+    for (uint32_t i = 0; i < (D); i += 2 * FX_OP(isa, LANES)) { \
+        FX_OP(isa, VEC) x0 = FX_OP(isa, LOAD)(x + i); \
+        FX_OP(isa, VEC) x1 = FX_OP(isa, LOAD)(x + i + FX_OP(isa, LANES)); \
+        dacc0 = FX_OP(isa, FMA)(FX_OP(isa, LOAD)(q + i), x0, dacc0); \
+        dacc1 = FX_OP(isa, FMA)(FX_OP(isa, LOAD)(q + i + FX_OP(isa, LANES)), x1, dacc1); \
+        nacc0 = FX_OP(isa, FMA)(x0, x0, nacc0); \
+        nacc1 = FX_OP(isa, FMA)(x1, x1, nacc1); \
+    } \
+    *out_dot = FX_OP(isa, HSUM)(FX_OP(isa, ADD)(dacc0, dacc1)); \
+    *out_xx = FX_OP(isa, HSUM)(FX_OP(isa, ADD)(nacc0, nacc1)); \
+}
+
+#define FX_ENTRY(isa, D) { dot_##isa##_##D, l2sq_##isa##_##D, dot_norm_##isa##_##D },
+#define FIXED_TABLE(isa) { FIXED_DIMS(FX_ENTRY, isa) }
+
+/* Kernel table for one ISA */
+typedef struct {
+    vdb_isa_t isa;
+    float (*dot)(const float *a, const float *b, uint32_t dim);
+    float (*l2sq)(const float *a, const float *b, uint32_t dim);
+    void (*dot_norm)(const float *q, const float *x, uint32_t dim, float *out_dot, float *out_xx);
+    void (*l2sq_x4)(const float *const *q, const float *x, uint32_t dim, float *out);
+    void (*dot_norm_x4)(const float *const *q, const float *x, uint32_t dim, float *out_dot, float *out_xx);
+    half_kernels_t f16;
+    half_kernels_t bf16;
+    fixed_kernels_t fixed[DISTANCE_FIXED_DIMS]; // by position in fixed_dims
+} kernel_table_t;
+
+/* ------------------------------------------------------------------ */
+/* Scalar                                                              */
+/* ------------------------------------------------------------------ */
+
+static float dot_scalar(const float *a, const float *b, uint32_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; i++) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float l2sq_scalar(const float *a, const float *b, uint32_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float d0 = a[i] - b[i];
+        float d1 = a[i + 1] - b[i + 1];
+        float d2 = a[i + 2] - b[i + 2];
+        float d3 = a[i + 3] - b[i + 3];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+    }
+    for (; i < dim; i++) {
+        float d = a[i] - b[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static void dot_norm_scalar(const float *q, const float *x, uint32_t dim,
+                            float *out_dot, float *out_xx) {
+    float d0 = 0.0f, d1 = 0.0f, n0 = 0.0f, n1 = 0.0f;
+    uint32_t i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        d0 += q[i] * x[i];
+        d1 += q[i + 1] * x[i + 1];
+        n0 += x[i] * x[i];
+        n1 += x[i + 1] * x[i + 1];
+    }
+    for (; i < dim; i++) {
+        d0 += q[i] * x[i];
+        n0 += x[i] * x[i];
+    }
+    *out_dot = d0 + d1;
+    *out_xx = n0 + n1;
+}
+
+static void l2sq_x4_scalar(const float *const *q, const float *x, uint32_t dim, float *out) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (uint32_t i = 0; i < dim; i++) {
+        float d0 = q[0][i] - x[i];
+        float d1 = q[1][i] - x[i];
+        float d2 = q[2][i] - x[i];
+        float d3 = q[3][i] - x[i];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+
+static void dot_norm_x4_scalar(const float *const *q, const float *x, uint32_t dim,
+                               float *out_dot, float *out_xx) {
+    float d0 = 0.0f, d1 = 0.0f, d2 = 0.0f, d3 = 0.0f, n = 0.0f;
+    for (uint32_t i = 0; i < dim; i++) {
+        d0 += q[0][i] * x[i];
+        d1 += q[1][i] * x[i];
+        d2 += q[2][i] * x[i];
+        d3 += q[3][i] * x[i];
+        n += x[i] * x[i];
+    }
+    out_dot[0] = d0;
+    out_dot[1] = d1;
+    out_dot[2] = d2;
+    out_dot[3] = d3;
+    *out_xx = n;
+}
+
+/* IEEE half -> float, subnormals and NaN included */
+static inline float f16_to_f32(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+    uint32_t exp = (h >> 10) & 0x1fu;
+    uint32_t mant = h & 0x3ffu;
+    uint32_t bits;
+    if (exp == 0x1fu) {
+        bits = sign | 0x7f800000u | (mant << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112u) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        // subnormal: shift the mantissa up until it is normal
+        exp = 113;
+        while ((mant & 0x400u) == 0) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ffu) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/* float -> IEEE half, round to nearest even, overflow to inf */
+static inline uint16_t f32_to_f16(float f) {
+    const uint32_t f16_max = (127u + 16u) << 23; // 65536, first value that is inf
+    const uint32_t denorm_magic_bits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint16_t out;
+    if (x >= f16_max) {
+        out = x > 0x7f800000u ? 0x7e00u : 0x7c00u; // NaN stays NaN
+    } else if (x < (113u << 23)) {
+        // subnormal or zero: let the FPU round the mantissa into place
+        float fx, magic;
+        memcpy(&fx, &x, sizeof(fx));
+        memcpy(&magic, &denorm_magic_bits, sizeof(magic));
+        fx += magic;
+        uint32_t r;
+        memcpy(&r, &fx, sizeof(r));
+        out = (uint16_t)(r - denorm_magic_bits);
+    } else {
+        uint32_t mant_odd = (x >> 13) & 1u;
+        x += ((15u - 127u) << 23) + 0xfffu + mant_odd;
+        out = (uint16_t)(x >> 13);
+    }
+    return (uint16_t)(out | (sign >> 16));
+}
+
+static inline float bf16_to_f32(uint16_t h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/* float -> bfloat16, round to nearest even */
+static inline uint16_t f32_to_bf16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffffu) > 0x7f800000u) {
+        return (uint16_t)((x >> 16) | 0x40u); // keep NaN quiet
+    }
+    x += 0x7fffu + ((x >> 16) & 1u);
+    return (uint16_t)(x >> 16);
+}
+
+static inline float half_to_f32(uint16_t h, bool bf16) {
+    return bf16 ? bf16_to_f32(h) : f16_to_f32(h);
+}
+
+static inline float l2sq_half_scalar(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    float s0 = 0.0f, s1 = 0.0f;
+    uint32_t i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        float d0 = q[i] - half_to_f32(x[i], bf16);
+        float d1 = q[i + 1] - half_to_f32(x[i + 1], bf16);
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+    }
+    for (; i < dim; i++) {
+        float d = q[i] - half_to_f32(x[i], bf16);
+        s0 += d * d;
+    }
+    return s0 + s1;
+}
+
+static inline float dot_half_scalar(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    float s0 = 0.0f, s1 = 0.0f;
+    uint32_t i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        s0 += q[i] * half_to_f32(x[i], bf16);
+        s1 += q[i + 1] * half_to_f32(x[i + 1], bf16);
+    }
+    for (; i < dim; i++) {
+        s0 += q[i] * half_to_f32(x[i], bf16);
+    }
+    return s0 + s1;
+}
+
+static inline void dot_norm_half_scalar(const float *q, const uint16_t *x, uint32_t dim,
+                                        float *out_dot, float *out_xx, bool bf16) {
+    float d = 0.0f, n = 0.0f;
+    for (uint32_t i = 0; i < dim; i++) {
+        float xv = half_to_f32(x[i], bf16);
+        d += q[i] * xv;
+        n += xv * xv;
+    }
+    *out_dot = d;
+    *out_xx = n;
+}
+
+static float l2sq_f16_scalar(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_scalar(q, x, dim, false);
+}
+
+static float l2sq_bf16_scalar(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_scalar(q, x, dim, true);
+}
+
+static float dot_f16_scalar(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_scalar(q, x, dim, false);
+}
+
+static float dot_bf16_scalar(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_scalar(q, x, dim, true);
+}
+
+static void dot_norm_f16_scalar(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_scalar(q, x, dim, out_dot, out_xx, false);
+}
+
+static void dot_norm_bf16_scalar(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_scalar(q, x, dim, out_dot, out_xx, true);
+}
+
+static void widen_f16_scalar(const uint16_t *x, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = f16_to_f32(x[i]);
+    }
+}
+
+static void widen_bf16_scalar(const uint16_t *x, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = bf16_to_f32(x[i]);
+    }
+}
+
+#define HALF_SCALAR \
+    { l2sq_f16_scalar, dot_f16_scalar, dot_norm_f16_scalar, widen_f16_scalar }, \
+    { l2sq_bf16_scalar, dot_bf16_scalar, dot_norm_bf16_scalar, widen_bf16_scalar }
+
+#define FX_GENERIC(isa, D) { dot_scalar, l2sq_scalar, dot_norm_scalar },
+
+static const kernel_table_t scalar_table = {
+    VDB_ISA_SCALAR, dot_scalar, l2sq_scalar, dot_norm_scalar, l2sq_x4_scalar, dot_norm_x4_scalar,
+    HALF_SCALAR,
+    { FIXED_DIMS(FX_GENERIC, scalar) }
+};
+
+#ifdef VDB_DISTANCE_X86
+
+/* ------------------------------------------------------------------ */
+/* SSE2                                                                */
+/* ------------------------------------------------------------------ */
+
+__attribute__((target("sse2")))
+static inline float hsum_sse2(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("sse2")))
+static float dot_sse2(const float *a, const float *b, uint32_t dim) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float sum = hsum_sse2(_mm_add_ps(acc0, acc1));
+    for (; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static float l2sq_sse2(const float *a, const float *b, uint32_t dim) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+    }
+    float sum = hsum_sse2(_mm_add_ps(acc0, acc1));
+    for (; i < dim; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static void dot_norm_sse2(const float *q, const float *x, uint32_t dim,
+                          float *out_dot, float *out_xx) {
+    __m128 dacc = _mm_setzero_ps();
+    __m128 nacc = _mm_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 xv = _mm_loadu_ps(x + i);
+        dacc = _mm_add_ps(dacc, _mm_mul_ps(_mm_loadu_ps(q + i), xv));
+        nacc = _mm_add_ps(nacc, _mm_mul_ps(xv, xv));
+    }
+    float d = hsum_sse2(dacc);
+    float n = hsum_sse2(nacc);
+    for (; i < dim; i++) {
+        d += q[i] * x[i];
+        n += x[i] * x[i];
+    }
+    *out_dot = d;
+    *out_xx = n;
+}
+
+__attribute__((target("sse2")))
+static void l2sq_x4_sse2(const float *const *q, const float *x, uint32_t dim, float *out) {
+    __m128 acc[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 xv = _mm_loadu_ps(x + i);
+        for (int j = 0; j < 4; j++) {
+            __m128 d = _mm_sub_ps(_mm_loadu_ps(q[j] + i), xv);
+            acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(d, d));
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        float sum = hsum_sse2(acc[j]);
+        for (uint32_t t = i; t < dim; t++) {
+            float d = q[j][t] - x[t];
+            sum += d * d;
+        }
+        out[j] = sum;
+    }
+}
+
+__attribute__((target("sse2")))
+static void dot_norm_x4_sse2(const float *const *q, const float *x, uint32_t dim,
+                             float *out_dot, float *out_xx) {
+    __m128 acc[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+    __m128 nacc = _mm_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 xv = _mm_loadu_ps(x + i);
+        for (int j = 0; j < 4; j++) {
+            acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(_mm_loadu_ps(q[j] + i), xv));
+        }
+        nacc = _mm_add_ps(nacc, _mm_mul_ps(xv, xv));
+    }
+    float n = hsum_sse2(nacc);
+    for (uint32_t t = i; t < dim; t++) {
+        n += x[t] * x[t];
+    }
+    for (int j = 0; j < 4; j++) {
+        float d = hsum_sse2(acc[j]);
+        for (uint32_t t = i; t < dim; t++) {
+            d += q[j][t] * x[t];
+        }
+        out_dot[j] = d;
+    }
+    *out_xx = n;
+}
+
+#define FX_sse2_TARGET __attribute__((target("sse2")))
+#define FX_sse2_VEC __m128
+#define FX_sse2_LANES 4
+#define FX_sse2_ZERO _mm_setzero_ps
+#define FX_sse2_LOAD _mm_loadu_ps
+#define FX_sse2_FMA(a, b, acc) _mm_add_ps(_mm_mul_ps(a, b), acc)
+#define FX_sse2_SUB _mm_sub_ps
+#define FX_sse2_ADD _mm_add_ps
+#define FX_sse2_HSUM hsum_sse2
+
+FIXED_DIMS(FIXED_KERNELS, sse2)
+
+/* no half conversion below F16C; SSE2 uses the scalar loops for those */
+static const kernel_table_t sse2_table = {
+    VDB_ISA_SSE2, dot_sse2, l2sq_sse2, dot_norm_sse2, l2sq_x4_sse2, dot_norm_x4_sse2,
+    HALF_SCALAR,
+    FIXED_TABLE(sse2)
+};
+
+/* ------------------------------------------------------------------ */
+/* AVX2 + FMA                                                          */
+/* ------------------------------------------------------------------ */
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, uint32_t dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float l2sq_avx2(const float *a, const float *b, uint32_t dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    }
+    float sum = hsum_avx2(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < dim; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_norm_avx2(const float *q, const float *x, uint32_t dim,
+                          float *out_dot, float *out_xx) {
+    __m256 dacc0 = _mm256_setzero_ps();
+    __m256 dacc1 = _mm256_setzero_ps();
+    __m256 nacc0 = _mm256_setzero_ps();
+    __m256 nacc1 = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 x0 = _mm256_loadu_ps(x + i);
+        __m256 x1 = _mm256_loadu_ps(x + i + 8);
+        dacc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), x0, dacc0);
+        dacc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), x1, dacc1);
+        nacc0 = _mm256_fmadd_ps(x0, x0, nacc0);
+        nacc1 = _mm256_fmadd_ps(x1, x1, nacc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 x0 = _mm256_loadu_ps(x + i);
+        dacc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), x0, dacc0);
+        nacc0 = _mm256_fmadd_ps(x0, x0, nacc0);
+    }
+    float d = hsum_avx2(_mm256_add_ps(dacc0, dacc1));
+    float n = hsum_avx2(_mm256_add_ps(nacc0, nacc1));
+    for (; i < dim; i++) {
+        d += q[i] * x[i];
+        n += x[i] * x[i];
+    }
+    *out_dot = d;
+    *out_xx = n;
+}
+
+__attribute__((target("avx2,fma")))
+static void l2sq_x4_avx2(const float *const *q, const float *x, uint32_t dim, float *out) {
+    __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 xv = _mm256_loadu_ps(x + i);
+        for (int j = 0; j < 4; j++) {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(q[j] + i), xv);
+            acc[j] = _mm256_fmadd_ps(d, d, acc[j]);
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        float sum = hsum_avx2(acc[j]);
+        for (uint32_t t = i; t < dim; t++) {
+            float d = q[j][t] - x[t];
+            sum += d * d;
+        }
+        out[j] = sum;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_norm_x4_avx2(const float *const *q, const float *x, uint32_t dim,
+                             float *out_dot, float *out_xx) {
+    __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+    __m256 nacc = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 xv = _mm256_loadu_ps(x + i);
+        for (int j = 0; j < 4; j++) {
+            acc[j] = _mm256_fmadd_ps(_mm256_loadu_ps(q[j] + i), xv, acc[j]);
+        }
+        nacc = _mm256_fmadd_ps(xv, xv, nacc);
+    }
+    float n = hsum_avx2(nacc);
+    for (uint32_t t = i; t < dim; t++) {
+        n += x[t] * x[t];
+    }
+    for (int j = 0; j < 4; j++) {
+        float d = hsum_avx2(acc[j]);
+        for (uint32_t t = i; t < dim; t++) {
+            d += q[j][t] * x[t];
+        }
+        out_dot[j] = d;
+    }
+    *out_xx = n;
+}
+
+/* 8 halves -> 8 floats: F16C for f16, a shift for bf16 */
+__attribute__((target("avx2,fma,f16c")))
+static inline __m256 load_half_avx2(const uint16_t *x, bool bf16) {
+    __m128i h = _mm_loadu_si128((const __m128i*)x);
+    if (bf16) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+    }
+    return _mm256_cvtph_ps(h);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline float l2sq_half_avx2(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(q + i), load_half_avx2(x + i, bf16));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(q + i + 8), load_half_avx2(x + i + 8, bf16));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(q + i), load_half_avx2(x + i, bf16));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    }
+    return hsum_avx2(_mm256_add_ps(acc0, acc1)) + l2sq_half_scalar(q + i, x + i, dim - i, bf16);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline float dot_half_avx2(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), load_half_avx2(x + i, bf16), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), load_half_avx2(x + i + 8, bf16), acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), load_half_avx2(x + i, bf16), acc0);
+    }
+    return hsum_avx2(_mm256_add_ps(acc0, acc1)) + dot_half_scalar(q + i, x + i, dim - i, bf16);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline void dot_norm_half_avx2(const float *q, const uint16_t *x, uint32_t dim,
+                                      float *out_dot, float *out_xx, bool bf16) {
+    __m256 dacc = _mm256_setzero_ps();
+    __m256 nacc = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 xv = load_half_avx2(x + i, bf16);
+        dacc = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), xv, dacc);
+        nacc = _mm256_fmadd_ps(xv, xv, nacc);
+    }
+    float d, n;
+    dot_norm_half_scalar(q + i, x + i, dim - i, &d, &n, bf16);
+    *out_dot = hsum_avx2(dacc) + d;
+    *out_xx = hsum_avx2(nacc) + n;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static inline void widen_half_avx2(const uint16_t *x, float *out, size_t n, bool bf16) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, load_half_avx2(x + i, bf16));
+    }
+    for (; i < n; i++) {
+        out[i] = half_to_f32(x[i], bf16);
+    }
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float l2sq_f16_avx2(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_avx2(q, x, dim, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float l2sq_bf16_avx2(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_avx2(q, x, dim, true);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float dot_f16_avx2(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_avx2(q, x, dim, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float dot_bf16_avx2(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_avx2(q, x, dim, true);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void dot_norm_f16_avx2(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_avx2(q, x, dim, out_dot, out_xx, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void dot_norm_bf16_avx2(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_avx2(q, x, dim, out_dot, out_xx, true);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void widen_f16_avx2(const uint16_t *x, float *out, size_t n) {
+    widen_half_avx2(x, out, n, false);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void widen_bf16_avx2(const uint16_t *x, float *out, size_t n) {
+    widen_half_avx2(x, out, n, true);
+}
+
+#define FX_avx2_TARGET __attribute__((target("avx2,fma")))
+#define FX_avx2_VEC __m256
+#define FX_avx2_LANES 8
+#define FX_avx2_ZERO _mm256_setzero_ps
+#define FX_avx2_LOAD _mm256_loadu_ps
+#define FX_avx2_FMA _mm256_fmadd_ps
+#define FX_avx2_SUB _mm256_sub_ps
+#define FX_avx2_ADD _mm256_add_ps
+#define FX_avx2_HSUM hsum_avx2
+
+FIXED_DIMS(FIXED_KERNELS, avx2)
+
+static const kernel_table_t avx2_table = {
+    VDB_ISA_AVX2, dot_avx2, l2sq_avx2, dot_norm_avx2, l2sq_x4_avx2, dot_norm_x4_avx2,
+    { l2sq_f16_avx2, dot_f16_avx2, dot_norm_f16_avx2, widen_f16_avx2 },
+    { l2sq_bf16_avx2, dot_bf16_avx2, dot_norm_bf16_avx2, widen_bf16_avx2 },
+    FIXED_TABLE(avx2)
+};
+
+/* ------------------------------------------------------------------ */
+/* AVX-512F                                                            */
+/* Tails use masked loads, so there is no scalar remainder loop.       */
+/* ------------------------------------------------------------------ */
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float *a, const float *b, uint32_t dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < dim) {
+        __mmask16 mask = (__mmask16)((1u << (dim - i)) - 1u);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                               _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static float l2sq_avx512(const float *a, const float *b, uint32_t dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    }
+    if (i < dim) {
+        __mmask16 mask = (__mmask16)((1u << (dim - i)) - 1u);
+        __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                                  _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(d0, d0, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+static void dot_norm_avx512(const float *q, const float *x, uint32_t dim,
+                            float *out_dot, float *out_xx) {
+    __m512 dacc = _mm512_setzero_ps();
+    __m512 nacc = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 xv = _mm512_loadu_ps(x + i);
+        dacc = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), xv, dacc);
+        nacc = _mm512_fmadd_ps(xv, xv, nacc);
+    }
+    if (i < dim) {
+        __mmask16 mask = (__mmask16)((1u << (dim - i)) - 1u);
+        __m512 xv = _mm512_maskz_loadu_ps(mask, x + i);
+        dacc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, q + i), xv, dacc);
+        nacc = _mm512_fmadd_ps(xv, xv, nacc);
+    }
+    *out_dot = _mm512_reduce_add_ps(dacc);
+    *out_xx = _mm512_reduce_add_ps(nacc);
+}
+
+__attribute__((target("avx512f")))
+static void l2sq_x4_avx512(const float *const *q, const float *x, uint32_t dim, float *out) {
+    __m512 acc[4] = { _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 xv = _mm512_loadu_ps(x + i);
+        for (int j = 0; j < 4; j++) {
+            __m512 d = _mm512_sub_ps(_mm512_loadu_ps(q[j] + i), xv);
+            acc[j] = _mm512_fmadd_ps(d, d, acc[j]);
+        }
+    }
+    if (i < dim) {
+        __mmask16 mask = (__mmask16)((1u << (dim - i)) - 1u);
+        __m512 xv = _mm512_maskz_loadu_ps(mask, x + i);
+        for (int j = 0; j < 4; j++) {
+            __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, q[j] + i), xv);
+            acc[j] = _mm512_fmadd_ps(d, d, acc[j]);
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        out[j] = _mm512_reduce_add_ps(acc[j]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void dot_norm_x4_avx512(const float *const *q, const float *x, uint32_t dim,
+                               float *out_dot, float *out_xx) {
+    __m512 acc[4] = { _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+    __m512 nacc = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 xv = _mm512_loadu_ps(x + i);
+        for (int j = 0; j < 4; j++) {
+            acc[j] = _mm512_fmadd_ps(_mm512_loadu_ps(q[j] + i), xv, acc[j]);
+        }
+        nacc = _mm512_fmadd_ps(xv, xv, nacc);
+    }
+    if (i < dim) {
+        __mmask16 mask = (__mmask16)((1u << (dim - i)) - 1u);
+        __m512 xv = _mm512_maskz_loadu_ps(mask, x + i);
+        for (int j = 0; j < 4; j++) {
+            acc[j] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, q[j] + i), xv, acc[j]);
+        }
+        nacc = _mm512_fmadd_ps(xv, xv, nacc);
+    }
+    for (int j = 0; j < 4; j++) {
+        out_dot[j] = _mm512_reduce_add_ps(acc[j]);
+    }
+    *out_xx = _mm512_reduce_add_ps(nacc);
+}
+
+/* 16 halves -> 16 floats (vcvtph2ps is part of AVX-512F) */
+__attribute__((target("avx512f")))
+static inline __m512 load_half_avx512(const uint16_t *x, bool bf16) {
+    __m256i h = _mm256_loadu_si256((const __m256i*)x);
+    if (bf16) {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+    }
+    return _mm512_cvtph_ps(h);
+}
+
+/* half tails stay scalar: a masked 16-bit load would need AVX-512BW */
+__attribute__((target("avx512f")))
+static inline float l2sq_half_avx512(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(q + i), load_half_avx512(x + i, bf16));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(q + i + 16), load_half_avx512(x + i + 16, bf16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(q + i), load_half_avx512(x + i, bf16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + l2sq_half_scalar(q + i, x + i, dim - i, bf16);
+}
+
+__attribute__((target("avx512f")))
+static inline float dot_half_avx512(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), load_half_avx512(x + i, bf16), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), load_half_avx512(x + i + 16, bf16), acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), load_half_avx512(x + i, bf16), acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + dot_half_scalar(q + i, x + i, dim - i, bf16);
+}
+
+__attribute__((target("avx512f")))
+static inline void dot_norm_half_avx512(const float *q, const uint16_t *x, uint32_t dim,
+                                        float *out_dot, float *out_xx, bool bf16) {
+    __m512 dacc = _mm512_setzero_ps();
+    __m512 nacc = _mm512_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 xv = load_half_avx512(x + i, bf16);
+        dacc = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), xv, dacc);
+        nacc = _mm512_fmadd_ps(xv, xv, nacc);
+    }
+    float d, n;
+    dot_norm_half_scalar(q + i, x + i, dim - i, &d, &n, bf16);
+    *out_dot = _mm512_reduce_add_ps(dacc) + d;
+    *out_xx = _mm512_reduce_add_ps(nacc) + n;
+}
+
+__attribute__((target("avx512f")))
+static inline void widen_half_avx512(const uint16_t *x, float *out, size_t n, bool bf16) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, load_half_avx512(x + i, bf16));
+    }
+    for (; i < n; i++) {
+        out[i] = half_to_f32(x[i], bf16);
+    }
+}
+
+__attribute__((target("avx512f")))
+static float l2sq_f16_avx512(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_avx512(q, x, dim, false);
+}
+
+__attribute__((target("avx512f")))
+static float l2sq_bf16_avx512(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_avx512(q, x, dim, true);
+}
+
+__attribute__((target("avx512f")))
+static float dot_f16_avx512(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_avx512(q, x, dim, false);
+}
+
+__attribute__((target("avx512f")))
+static float dot_bf16_avx512(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_avx512(q, x, dim, true);
+}
+
+__attribute__((target("avx512f")))
+static void dot_norm_f16_avx512(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_avx512(q, x, dim, out_dot, out_xx, false);
+}
+
+__attribute__((target("avx512f")))
+static void dot_norm_bf16_avx512(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_avx512(q, x, dim, out_dot, out_xx, true);
+}
+
+__attribute__((target("avx512f")))
+static void widen_f16_avx512(const uint16_t *x, float *out, size_t n) {
+    widen_half_avx512(x, out, n, false);
+}
+
+__attribute__((target("avx512f")))
+static void widen_bf16_avx512(const uint16_t *x, float *out, size_t n) {
+    widen_half_avx512(x, out, n, true);
+}
+
+#define FX_avx512_TARGET __attribute__((target("avx512f")))
+#define FX_avx512_VEC __m512
+#define FX_avx512_LANES 16
+#define FX_avx512_ZERO _mm512_setzero_ps
+#define FX_avx512_LOAD _mm512_loadu_ps
+#define FX_avx512_FMA _mm512_fmadd_ps
+#define FX_avx512_SUB _mm512_sub_ps
+#define FX_avx512_ADD _mm512_add_ps
+#define FX_avx512_HSUM _mm512_reduce_add_ps
+
+FIXED_DIMS(FIXED_KERNELS, avx512)
+
+static const kernel_table_t avx512_table = {
+    VDB_ISA_AVX512, dot_avx512, l2sq_avx512, dot_norm_avx512, l2sq_x4_avx512, dot_norm_x4_avx512,
+    { l2sq_f16_avx512, dot_f16_avx512, dot_norm_f16_avx512, widen_f16_avx512 },
+    { l2sq_bf16_avx512, dot_bf16_avx512, dot_norm_bf16_avx512, widen_bf16_avx512 },
+    FIXED_TABLE(avx512)
+};
+
+#endif /* VDB_DISTANCE_X86 */
+
+#ifdef VDB_DISTANCE_NEON
+
+/* ------------------------------------------------------------------ */
+/* NEON                                                                */
+/* ------------------------------------------------------------------ */
+
+static float dot_neon(const float *a, const float *b, uint32_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static float l2sq_neon(const float *a, const float *b, uint32_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+    }
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static void dot_norm_neon(const float *q, const float *x, uint32_t dim,
+                          float *out_dot, float *out_xx) {
+    float32x4_t dacc = vdupq_n_f32(0.0f);
+    float32x4_t nacc = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t xv = vld1q_f32(x + i);
+        dacc = vfmaq_f32(dacc, vld1q_f32(q + i), xv);
+        nacc = vfmaq_f32(nacc, xv, xv);
+    }
+    float d = vaddvq_f32(dacc);
+    float n = vaddvq_f32(nacc);
+    for (; i < dim; i++) {
+        d += q[i] * x[i];
+        n += x[i] * x[i];
+    }
+    *out_dot = d;
+    *out_xx = n;
+}
+
+static void l2sq_x4_neon(const float *const *q, const float *x, uint32_t dim, float *out) {
+    float32x4_t acc[4] = { vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f) };
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t xv = vld1q_f32(x + i);
+        for (int j = 0; j < 4; j++) {
+            float32x4_t d = vsubq_f32(vld1q_f32(q[j] + i), xv);
+            acc[j] = vfmaq_f32(acc[j], d, d);
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        float sum = vaddvq_f32(acc[j]);
+        for (uint32_t t = i; t < dim; t++) {
+            float d = q[j][t] - x[t];
+            sum += d * d;
+        }
+        out[j] = sum;
+    }
+}
+
+static void dot_norm_x4_neon(const float *const *q, const float *x, uint32_t dim,
+                             float *out_dot, float *out_xx) {
+    float32x4_t acc[4] = { vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f) };
+    float32x4_t nacc = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t xv = vld1q_f32(x + i);
+        for (int j = 0; j < 4; j++) {
+            acc[j] = vfmaq_f32(acc[j], vld1q_f32(q[j] + i), xv);
+        }
+        nacc = vfmaq_f32(nacc, xv, xv);
+    }
+    float n = vaddvq_f32(nacc);
+    for (uint32_t t = i; t < dim; t++) {
+        n += x[t] * x[t];
+    }
+    for (int j = 0; j < 4; j++) {
+        float d = vaddvq_f32(acc[j]);
+        for (uint32_t t = i; t < dim; t++) {
+            d += q[j][t] * x[t];
+        }
+        out_dot[j] = d;
+    }
+    *out_xx = n;
+}
+
+/* 4 halves -> 4 floats: fcvtl for f16, a widening shift for bf16 */
+static inline float32x4_t load_half_neon(const uint16_t *x, bool bf16) {
+    uint16x4_t h = vld1_u16(x);
+    if (bf16) {
+        return vreinterpretq_f32_u32(vshll_n_u16(h, 16));
+    }
+    return vcvt_f32_f16(vreinterpret_f16_u16(h));
+}
+
+static inline float l2sq_half_neon(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(q + i), load_half_neon(x + i, bf16));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(q + i + 4), load_half_neon(x + i + 4, bf16));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+    }
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(q + i), load_half_neon(x + i, bf16));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + l2sq_half_scalar(q + i, x + i, dim - i, bf16);
+}
+
+static inline float dot_half_neon(const float *q, const uint16_t *x, uint32_t dim, bool bf16) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q + i), load_half_neon(x + i, bf16));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(q + i + 4), load_half_neon(x + i + 4, bf16));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q + i), load_half_neon(x + i, bf16));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + dot_half_scalar(q + i, x + i, dim - i, bf16);
+}
+
+static inline void dot_norm_half_neon(const float *q, const uint16_t *x, uint32_t dim,
+                                      float *out_dot, float *out_xx, bool bf16) {
+    float32x4_t dacc = vdupq_n_f32(0.0f);
+    float32x4_t nacc = vdupq_n_f32(0.0f);
+    uint32_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        float32x4_t xv = load_half_neon(x + i, bf16);
+        dacc = vfmaq_f32(dacc, vld1q_f32(q + i), xv);
+        nacc = vfmaq_f32(nacc, xv, xv);
+    }
+    float d, n;
+    dot_norm_half_scalar(q + i, x + i, dim - i, &d, &n, bf16);
+    *out_dot = vaddvq_f32(dacc) + d;
+    *out_xx = vaddvq_f32(nacc) + n;
+}
+
+static inline void widen_half_neon(const uint16_t *x, float *out, size_t n, bool bf16) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(out + i, load_half_neon(x + i, bf16));
+    }
+    for (; i < n; i++) {
+        out[i] = half_to_f32(x[i], bf16);
+    }
+}
+
+static float l2sq_f16_neon(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_neon(q, x, dim, false);
+}
+
+static float l2sq_bf16_neon(const float *q, const uint16_t *x, uint32_t dim) {
+    return l2sq_half_neon(q, x, dim, true);
+}
+
+static float dot_f16_neon(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_neon(q, x, dim, false);
+}
+
+static float dot_bf16_neon(const float *q, const uint16_t *x, uint32_t dim) {
+    return dot_half_neon(q, x, dim, true);
+}
+
+static void dot_norm_f16_neon(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_neon(q, x, dim, out_dot, out_xx, false);
+}
+
+static void dot_norm_bf16_neon(const float *q, const uint16_t *x, uint32_t dim, float *out_dot, float *out_xx) {
+    dot_norm_half_neon(q, x, dim, out_dot, out_xx, true);
+}
+
+static void widen_f16_neon(const uint16_t *x, float *out, size_t n) {
+    widen_half_neon(x, out, n, false);
+}
+
+static void widen_bf16_neon(const uint16_t *x, float *out, size_t n) {
+    widen_half_neon(x, out, n, true);
+}
+
+static inline float32x4_t fx_zero_neon(void) {
+    return vdupq_n_f32(0.0f);
+}
+
+#define FX_neon_TARGET
+#define FX_neon_VEC float32x4_t
+#define FX_neon_LANES 4
+#define FX_neon_ZERO fx_zero_neon
+#define FX_neon_LOAD vld1q_f32
+#define FX_neon_FMA(a, b, acc) vfmaq_f32(acc, a, b)
+#define FX_neon_SUB vsubq_f32
+#define FX_neon_ADD vaddq_f32
+#define FX_neon_HSUM vaddvq_f32
+
+FIXED_DIMS(FIXED_KERNELS, neon)
+
+static const kernel_table_t neon_table = {
+    VDB_ISA_NEON, dot_neon, l2sq_neon, dot_norm_neon, l2sq_x4_neon, dot_norm_x4_neon,
+    { l2sq_f16_neon, dot_f16_neon, dot_norm_f16_neon, widen_f16_neon },
+    { l2sq_bf16_neon, dot_bf16_neon, dot_norm_bf16_neon, widen_bf16_neon },
+    FIXED_TABLE(neon)
+};
+
+#endif /* VDB_DISTANCE_NEON */
+
+/* ------------------------------------------------------------------ */
+/* Dispatch                                                            */
+/* ------------------------------------------------------------------ */
+
+/* Active table; scalar until the constructor has run */
+static const kernel_table_t *active_kernels = &scalar_table;
+
+/**
+ * Get the table for an ISA, NULL if unsupported here
+*/
+static const kernel_table_t *table_for_isa(vdb_isa_t isa) {
+    switch (isa) {
+        case VDB_ISA_SCALAR:
+            return &scalar_table;
+#ifdef VDB_DISTANCE_X86
+        case VDB_ISA_SSE2:
+            return __builtin_cpu_supports("sse2") ? &sse2_table : NULL;
+        case VDB_ISA_AVX2:
+            return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                    __builtin_cpu_supports("f16c"))
+                ? &avx2_table : NULL;
+        case VDB_ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") ? &avx512_table : NULL;
+#endif
+#ifdef VDB_DISTANCE_NEON
+        case VDB_ISA_NEON:
+            return &neon_table;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Pick the best kernels once, at load time
+*/
+__attribute__((constructor))
+static void distance_init(void) {
+#ifdef VDB_DISTANCE_X86
+    __builtin_cpu_init();
+#endif
+    static const vdb_isa_t preference[] = {
+        VDB_ISA_AVX512, VDB_ISA_AVX2, VDB_ISA_NEON, VDB_ISA_SSE2
+    };
+    for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        const kernel_table_t *table = table_for_isa(preference[i]);
+        if (table != NULL) {
+            active_kernels = table;
+            return;
+        }
+    }
+}
+
+vdb_isa_t vdb_distance_get_isa(void) {
+    return active_kernels->isa;
+}
+
+bool vdb_distance_isa_supported(vdb_isa_t isa) {
+    return table_for_isa(isa) != NULL;
+}
+
+vdb_status_t vdb_distance_set_isa(vdb_isa_t isa) {
+    const kernel_table_t *table = table_for_isa(isa);
+    if (table == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    active_kernels = table;
+    return VDB_OK;
+}
+
+const char* vdb_isa_to_string(vdb_isa_t isa) {
+    switch (isa) {
+        case VDB_ISA_SCALAR:
+            return "scalar";
+        case VDB_ISA_SSE2:
+            return "sse2";
+        case VDB_ISA_AVX2:
+            return "avx2";
+        case VDB_ISA_AVX512:
+            return "avx512";
+        case VDB_ISA_NEON:
+            return "neon";
+        default:
+            return "unknown";
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Metric functions                                                    */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Turn a dot product and squared norms into a cosine distance
+*/
+static inline float cosine_from_parts(float dot, float qq, float xx) {
+    float denom = qq * xx;
+    if (denom <= 0.0f) {
+        return 1.0f; // zero vector: similarity 0
+    }
+    return 1.0f - dot / sqrtf(denom);
+}
+
+float vdb_dot(const float *a, const float *b, uint32_t dim) {
+    return active_kernels->dot(a, b, dim);
+}
+
+float vdb_l2_squared(const float *a, const float *b, uint32_t dim) {
+    return active_kernels->l2sq(a, b, dim);
+}
+
+float vdb_normalize(float *v, uint32_t dim) {
+    float norm = sqrtf(active_kernels->dot(v, v, dim));
+    if (norm > 0.0f) {
+        float inv = 1.0f / norm;
+        for (uint32_t i = 0; i < dim; i++) {
+            v[i] *= inv;
+        }
+    }
+    return norm;
+}
+
+/* The active ISA's generic float32 kernels, in the fixed kernels' shape */
+static inline fixed_kernels_t generic_kernels(void) {
+    const kernel_table_t *k = active_kernels;
+    fixed_kernels_t f = { k->dot, k->l2sq, k->dot_norm };
+    return f;
+}
+
+static float distance_f32(const fixed_kernels_t *f, vdb_metric_t metric, const float *a,
+                          const float *b, uint32_t dim) {
+    switch (metric) {
+        case VDB_METRIC_COSINE: {
+            float dot, bb;
+            f->dot_norm(a, b, dim, &dot, &bb);
+            return cosine_from_parts(dot, f->dot(a, a, dim), bb);
+        }
+        case VDB_METRIC_EUCLIDEAN:
+            return sqrtf(f->l2sq(a, b, dim));
+        case VDB_METRIC_INNER_PRODUCT:
+            return 1.0f - f->dot(a, b, dim);
+        default:
+            return NAN;
+    }
+}
+
+static vdb_status_t batch_f32(const fixed_kernels_t *f, vdb_metric_t metric, const float *query,
+                              const float *rows, size_t n, size_t stride, uint32_t dim, float *out) {
+    if (query == NULL || (n > 0 && (rows == NULL || out == NULL)) || stride < dim) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    switch (metric) {
+        case VDB_METRIC_COSINE: {
+            float qq = f->dot(query, query, dim);
+            for (size_t i = 0; i < n; i++) {
+                float dot, xx;
+                f->dot_norm(query, rows + i * stride, dim, &dot, &xx);
+                out[i] = cosine_from_parts(dot, qq, xx);
+            }
+            return VDB_OK;
+        }
+        case VDB_METRIC_EUCLIDEAN:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = sqrtf(f->l2sq(query, rows + i * stride, dim));
+            }
+            return VDB_OK;
+        case VDB_METRIC_INNER_PRODUCT:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = 1.0f - f->dot(query, rows + i * stride, dim);
+            }
+            return VDB_OK;
+        default:
+            return VDB_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+float vdb_distance(vdb_metric_t metric, const float *a, const float *b, uint32_t dim) {
+    fixed_kernels_t f = generic_kernels();
+    return distance_f32(&f, metric, a, b, dim);
+}
+
+vdb_status_t vdb_distance_batch(
+    vdb_metric_t metric,
+    const float *query,
+    const float *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+) {
+    fixed_kernels_t f = generic_kernels();
+    return batch_f32(&f, metric, query, rows, n, stride, dim, out);
+}
+
+vdb_status_t vdb_distance_tile(
+    vdb_metric_t metric,
+    const float *queries,
+    size_t nq,
+    size_t query_stride,
+    const float *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+) {
+    if ((nq > 0 && n > 0 && (queries == NULL || rows == NULL || out == NULL)) ||
+        query_stride < dim || stride < dim) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (!vdb_metric_is_valid(metric)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    const kernel_table_t *k = active_kernels;
+    for (size_t q0 = 0; q0 < nq; q0 += 4) {
+        /* a short last group repeats its last query; the extra lanes are dropped */
+        size_t group = nq - q0 < 4 ? nq - q0 : 4;
+        const float *q[4];
+        float qq[4];
+        for (size_t j = 0; j < 4; j++) {
+            q[j] = queries + (q0 + (j < group ? j : group - 1)) * query_stride;
+            qq[j] = metric == VDB_METRIC_COSINE ? k->dot(q[j], q[j], dim) : 0.0f;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const float *x = rows + i * stride;
+            float d[4];
+            if (metric == VDB_METRIC_COSINE) {
+                float xx;
+                k->dot_norm_x4(q, x, dim, d, &xx);
+                for (size_t j = 0; j < group; j++) {
+                    out[(q0 + j) * n + i] = cosine_from_parts(d[j], qq[j], xx);
+                }
+            } else if (metric == VDB_METRIC_INNER_PRODUCT) {
+                float xx; // the x4 kernels only come with the norm
+                k->dot_norm_x4(q, x, dim, d, &xx);
+                for (size_t j = 0; j < group; j++) {
+                    out[(q0 + j) * n + i] = 1.0f - d[j];
+                }
+            } else {
+                k->l2sq_x4(q, x, dim, d);
+                for (size_t j = 0; j < group; j++) {
+                    out[(q0 + j) * n + i] = sqrtf(d[j]);
+                }
+            }
+        }
+    }
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Half precision rows                                                 */
+/* ------------------------------------------------------------------ */
+
+/* Row-vs-row distances widen the first row this many floats at a time */
+#define ROWS_CHUNK 256
+
+static const half_kernels_t *half_kernels(const kernel_table_t *k, vdb_element_type_t type) {
+    return type == VDB_ELEMENT_BF16 ? &k->bf16 : &k->f16;
+}
+
+static bool element_type_valid(vdb_element_type_t type) {
+    return type == VDB_ELEMENT_F32 || type == VDB_ELEMENT_F16 || type == VDB_ELEMENT_BF16;
+}
+
+void vdb_convert_to_f32(vdb_element_type_t type, const void *src, float *dst, size_t n) {
+    if (type == VDB_ELEMENT_F32) {
+        memcpy(dst, src, n * sizeof(float));
+    } else {
+        half_kernels(active_kernels, type)->widen((const uint16_t*)src, dst, n);
+    }
+}
+
+void vdb_convert_from_f32(vdb_element_type_t type, const float *src, void *dst, size_t n) {
+    uint16_t *out = (uint16_t*)dst;
+    switch (type) {
+        case VDB_ELEMENT_F16:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = f32_to_f16(src[i]);
+            }
+            break;
+        case VDB_ELEMENT_BF16:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = f32_to_bf16(src[i]);
+            }
+            break;
+        default:
+            memcpy(dst, src, n * sizeof(float));
+            break;
+    }
+}
+
+float vdb_distance_typed(vdb_metric_t metric, vdb_element_type_t type, const float *query,
+                         const void *row, uint32_t dim) {
+    if (type == VDB_ELEMENT_F32) {
+        return vdb_distance(metric, query, (const float*)row, dim);
+    }
+    const kernel_table_t *k = active_kernels;
+    const half_kernels_t *h = half_kernels(k, type);
+    switch (metric) {
+        case VDB_METRIC_COSINE: {
+            float dot, xx;
+            h->dot_norm(query, (const uint16_t*)row, dim, &dot, &xx);
+            return cosine_from_parts(dot, k->dot(query, query, dim), xx);
+        }
+        case VDB_METRIC_EUCLIDEAN:
+            return sqrtf(h->l2sq(query, (const uint16_t*)row, dim));
+        case VDB_METRIC_INNER_PRODUCT:
+            return 1.0f - h->dot(query, (const uint16_t*)row, dim);
+        default:
+            return NAN;
+    }
+}
+
+vdb_status_t vdb_distance_batch_typed(
+    vdb_metric_t metric,
+    vdb_element_type_t type,
+    const float *query,
+    const void *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+) {
+    if (!element_type_valid(type)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (type == VDB_ELEMENT_F32) {
+        return vdb_distance_batch(metric, query, (const float*)rows, n, stride, dim, out);
+    }
+    if (query == NULL || (n > 0 && (rows == NULL || out == NULL)) || stride < dim) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    const kernel_table_t *k = active_kernels;
+    const half_kernels_t *h = half_kernels(k, type);
+    const uint16_t *base = (const uint16_t*)rows;
+    switch (metric) {
+        case VDB_METRIC_COSINE: {
+            float qq = k->dot(query, query, dim);
+            for (size_t i = 0; i < n; i++) {
+                float dot, xx;
+                h->dot_norm(query, base + i * stride, dim, &dot, &xx);
+                out[i] = cosine_from_parts(dot, qq, xx);
+            }
+            return VDB_OK;
+        }
+        case VDB_METRIC_EUCLIDEAN:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = sqrtf(h->l2sq(query, base + i * stride, dim));
+            }
+            return VDB_OK;
+        case VDB_METRIC_INNER_PRODUCT:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = 1.0f - h->dot(query, base + i * stride, dim);
+            }
+            return VDB_OK;
+        default:
+            return VDB_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+float vdb_distance_rows(vdb_metric_t metric, vdb_element_type_t type, const void *a,
+                        const void *b, uint32_t dim) {
+    if (type == VDB_ELEMENT_F32) {
+        return vdb_distance(metric, (const float*)a, (const float*)b, dim);
+    }
+    if (!vdb_metric_is_valid(metric)) {
+        return NAN;
+    }
+
+    const kernel_table_t *k = active_kernels;
+    const half_kernels_t *h = half_kernels(k, type);
+    const uint16_t *ha = (const uint16_t*)a;
+    const uint16_t *hb = (const uint16_t*)b;
+    float buf[ROWS_CHUNK];
+    float sum = 0.0f, dot = 0.0f, aa = 0.0f, bb = 0.0f;
+    for (uint32_t i = 0; i < dim; i += ROWS_CHUNK) {
+        uint32_t len = dim - i < ROWS_CHUNK ? dim - i : ROWS_CHUNK;
+        h->widen(ha + i, buf, len);
+        if (metric == VDB_METRIC_COSINE) {
+            float d, x;
+            h->dot_norm(buf, hb + i, len, &d, &x);
+            dot += d;
+            bb += x;
+            aa += k->dot(buf, buf, len);
+        } else if (metric == VDB_METRIC_INNER_PRODUCT) {
+            dot += h->dot(buf, hb + i, len);
+        } else {
+            sum += h->l2sq(buf, hb + i, len);
+        }
+    }
+    switch (metric) {
+        case VDB_METRIC_COSINE:
+            return cosine_from_parts(dot, aa, bb);
+        case VDB_METRIC_INNER_PRODUCT:
+            return 1.0f - dot;
+        default:
+            return sqrtf(sum);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Per-dimension kernels                                               */
+/* ------------------------------------------------------------------ */
+
+vdb_dim_kernel_t vdb_distance_kernel_for_dim(uint32_t dim) {
+    for (size_t i = 0; i < DISTANCE_FIXED_DIMS; i++) {
+        if (fixed_dims[i] == dim) {
+            return (vdb_dim_kernel_t)(i + 1);
+        }
+    }
+    return VDB_DIM_KERNEL_GENERIC;
+}
+
+/**
+ * The active ISA's kernels for kernel, NULL when the generic entry
+ * points apply (generic kernel, or another dimension or element type)
+*/
+static const fixed_kernels_t *fixed_kernels(vdb_dim_kernel_t kernel, vdb_element_type_t type,
+                                            uint32_t dim) {
+    if (kernel == VDB_DIM_KERNEL_GENERIC || kernel > DISTANCE_FIXED_DIMS ||
+        type != VDB_ELEMENT_F32 || fixed_dims[kernel - 1] != dim) {
+        return NULL;
+    }
+    return &active_kernels->fixed[kernel - 1];
+}
+
+float vdb_distance_kernel(vdb_dim_kernel_t kernel, vdb_metric_t metric, vdb_element_type_t type,
+                          const float *query, const void *row, uint32_t dim) {
+    const fixed_kernels_t *f = fixed_kernels(kernel, type, dim);
+    if (f == NULL) {
+        return vdb_distance_typed(metric, type, query, row, dim);
+    }
+    return distance_f32(f, metric, query, (const float*)row, dim);
+}
+
+vdb_status_t vdb_distance_batch_kernel(
+    vdb_dim_kernel_t kernel,
+    vdb_metric_t metric,
+    vdb_element_type_t type,
+    const float *query,
+    const void *rows,
+    size_t n,
+    size_t stride,
+    uint32_t dim,
+    float *out
+) {
+    const fixed_kernels_t *f = fixed_kernels(kernel, type, dim);
+    if (f == NULL) {
+        return vdb_distance_batch_typed(metric, type, query, rows, n, stride, dim, out);
+    }
+    return batch_f32(f, metric, query, (const float*)rows, n, stride, dim, out);
+}
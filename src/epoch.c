@@ -0,0 +1,155 @@
+/**
+ * epoch.c - Internal epoch-based reclamation
+ *
+ * The domain has a global epoch and a slot per reader. A reader
+ * publishes the epoch it saw in a free slot (0 = free), then checks the
+ * global epoch hasn't moved meanwhile; if it has, it republishes, so a
+ * writer that missed the slot is sure to be older than it.
+ *
+ * Retiring tags the object with the current epoch and bumps it. An
+ * object tagged t is freed once every busy slot holds an epoch > t:
+ * those readers entered after the bump, when it was unreachable.
+ *
+ * All slot and epoch accesses are seq_cst; that's what orders a
+ * reader's slot store before its loads of what the writer unpublished.
+*/
+
+#include "epoch.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* One reader slot, a cache line each so readers don't share lines */
+typedef struct {
+    atomic_uint_fast64_t epoch; // 0 = free
+    uint8_t pad[64 - sizeof(atomic_uint_fast64_t)];
+} epoch_slot_t;
+
+typedef struct {
+    epoch_free_fn fn;
+    void *ptr;
+    size_t len;
+    uint64_t epoch; // global epoch when it was retired
+} retired_t;
+
+struct epoch_domain {
+    atomic_uint_fast64_t global; // starts at 1
+    epoch_slot_t slots[EPOCH_MAX_READERS];
+
+    pthread_mutex_t lock; // retired list
+    retired_t *retired;
+    size_t num_retired;
+    size_t cap_retired;
+};
+
+/* Where this thread starts looking for a free slot */
+static _Thread_local uint32_t slot_hint = EPOCH_NONE;
+static atomic_uint next_hint;
+
+vdb_status_t epoch_domain_create(epoch_domain_t **out_domain) {
+    if (out_domain == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    epoch_domain_t *domain = (epoch_domain_t*)calloc(1, sizeof(epoch_domain_t));
+    if (domain == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    atomic_init(&domain->global, 1);
+    for (size_t i = 0; i < EPOCH_MAX_READERS; i++) {
+        atomic_init(&domain->slots[i].epoch, 0);
+    }
+    pthread_mutex_init(&domain->lock, NULL);
+    *out_domain = domain;
+    return VDB_OK;
+}
+
+void epoch_domain_free(epoch_domain_t **domain) {
+    if (domain == NULL || *domain == NULL) {
+        return;
+    }
+    epoch_domain_t *d = *domain;
+    for (size_t i = 0; i < d->num_retired; i++) {
+        d->retired[i].fn(d->retired[i].ptr, d->retired[i].len);
+    }
+    free(d->retired);
+    pthread_mutex_destroy(&d->lock);
+    free(d);
+    *domain = NULL;
+}
+
+uint32_t epoch_enter(epoch_domain_t *domain) {
+    if (slot_hint == EPOCH_NONE) {
+        slot_hint = atomic_fetch_add_explicit(&next_hint, 1, memory_order_relaxed) % EPOCH_MAX_READERS;
+    }
+
+    for (;;) {
+        for (uint32_t i = 0; i < EPOCH_MAX_READERS; i++) {
+            uint32_t slot = (slot_hint + i) % EPOCH_MAX_READERS;
+            uint_fast64_t seen = atomic_load(&domain->global);
+            uint_fast64_t free_slot = 0;
+            if (!atomic_compare_exchange_strong(&domain->slots[slot].epoch, &free_slot, seen)) {
+                continue;
+            }
+            uint_fast64_t now;
+            while ((now = atomic_load(&domain->global)) != seen) {
+                atomic_store(&domain->slots[slot].epoch, now);
+                seen = now;
+            }
+            return slot;
+        }
+        sched_yield(); // every slot is busy
+    }
+}
+
+void epoch_exit(epoch_domain_t *domain, uint32_t guard) {
+    if (domain != NULL && guard < EPOCH_MAX_READERS) {
+        atomic_store(&domain->slots[guard].epoch, 0);
+    }
+}
+
+vdb_status_t epoch_retire(epoch_domain_t *domain, epoch_free_fn fn, void *ptr, size_t len) {
+    pthread_mutex_lock(&domain->lock);
+    if (domain->num_retired == domain->cap_retired) {
+        size_t cap = domain->cap_retired > 0 ? domain->cap_retired * 2 : 16;
+        retired_t *grown = (retired_t*)realloc(domain->retired, cap * sizeof(retired_t));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&domain->lock);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        domain->retired = grown;
+        domain->cap_retired = cap;
+    }
+    retired_t *r = &domain->retired[domain->num_retired++];
+    r->fn = fn;
+    r->ptr = ptr;
+    r->len = len;
+    r->epoch = atomic_fetch_add(&domain->global, 1);
+    pthread_mutex_unlock(&domain->lock);
+    return VDB_OK;
+}
+
+size_t epoch_reclaim(epoch_domain_t *domain) {
+    pthread_mutex_lock(&domain->lock);
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < EPOCH_MAX_READERS; i++) {
+        uint64_t e = atomic_load(&domain->slots[i].epoch);
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < domain->num_retired; i++) {
+        retired_t r = domain->retired[i];
+        if (r.epoch < oldest) {
+            r.fn(r.ptr, r.len);
+        } else {
+            domain->retired[kept++] = r;
+        }
+    }
+    domain->num_retired = kept;
+    pthread_mutex_unlock(&domain->lock);
+    return kept;
+}
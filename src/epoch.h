@@ -0,0 +1,73 @@
+/**
+ * epoch.h - Internal epoch-based reclamation
+ *
+ * Readers bracket their use of shared memory with epoch_enter and
+ * epoch_exit. That is one store to a slot of their own each way: they
+ * never take a lock and never wait for a writer.
+ *
+ * A writer that unpublishes something readers may still be using (a
+ * replaced snapshot, a mapping that was grown or swapped out) hands it
+ * to epoch_retire instead of freeing it. epoch_reclaim later frees
+ * whatever was retired before the oldest reader still inside entered.
+ *
+ * Past EPOCH_MAX_READERS readers at once, epoch_enter spins until a
+ * slot frees up.
+*/
+
+#ifndef VDB_EPOCH_H
+#define VDB_EPOCH_H
+
+#include "vdb/types.h"
+#include <stddef.h>
+
+/* Reader slots per domain */
+#define EPOCH_MAX_READERS 128
+
+/* Guard value meaning "not inside" */
+#define EPOCH_NONE UINT32_MAX
+
+typedef struct epoch_domain epoch_domain_t;
+
+/* Frees one retired object; gets back what epoch_retire was given */
+typedef void (*epoch_free_fn)(void *ptr, size_t len);
+
+/**
+ * Create a domain with no readers and nothing retired
+*/
+vdb_status_t epoch_domain_create(epoch_domain_t **out_domain);
+
+/**
+ * Free everything still retired, then the domain. Safe with NULL.
+ * No reader may be inside.
+*/
+void epoch_domain_free(epoch_domain_t **domain);
+
+/**
+ * Enter: memory retired from now on stays valid until epoch_exit
+ * Returns: The guard to pass to epoch_exit. Guards nest (each enter
+ * takes a slot of its own).
+*/
+uint32_t epoch_enter(epoch_domain_t *domain);
+
+/**
+ * Leave, releasing the slot epoch_enter returned. Safe with EPOCH_NONE.
+*/
+void epoch_exit(epoch_domain_t *domain, uint32_t guard);
+
+/**
+ * Free (ptr, len) with fn once no reader that entered before now is
+ * still inside. It must already be unreachable for new readers.
+ *
+ * Returns:
+ * - VDB_OK: Success
+ * - VDB_ERROR_OUT_OF_MEMORY: Allocation failed; nothing was retired
+*/
+vdb_status_t epoch_retire(epoch_domain_t *domain, epoch_free_fn fn, void *ptr, size_t len);
+
+/**
+ * Free what no reader can see anymore
+ * Returns: How many retired objects are still waiting
+*/
+size_t epoch_reclaim(epoch_domain_t *domain);
+
+#endif /* VDB_EPOCH_H */
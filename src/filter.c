@@ -0,0 +1,447 @@
+/**
+ * filter.c - Filter expression parser and bitmap evaluation
+ *
+ * Expressions parse into a small tree (recursive descent, one token of
+ * lookahead). Evaluation runs bottom-up over the filter index: leaves
+ * are postings or range lookups, inner nodes are bitmap AND / OR /
+ * AND-NOT, so no metadata is parsed at search time.
+*/
+
+#include "vdb/filter.h"
+#include "filter_index.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+/* Deepest nesting of NOT / parentheses accepted */
+#define FILTER_MAX_NESTING 64
+
+typedef enum {
+    FILTER_NODE_TERM, // field == string / bool
+    FILTER_NODE_RANGE, // numeric field in [lo, hi]
+    FILTER_NODE_AND,
+    FILTER_NODE_OR,
+    FILTER_NODE_NOT,
+} filter_node_type_t;
+
+struct vdb_filter {
+    filter_node_type_t type;
+    char *field; // leaves
+    char value_type; // term: FILTER_TYPE_STRING / FILTER_TYPE_BOOL
+    char *value;
+    size_t value_len;
+    double lo, hi; // range
+    bool lo_inclusive, hi_inclusive;
+    vdb_filter_t *left; // AND / OR, NOT's operand
+    vdb_filter_t *right;
+};
+
+/* ------------------------------------------------------------------ */
+/* Lexer                                                               */
+/* ------------------------------------------------------------------ */
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_ERROR,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_NOT,
+    TOKEN_TRUE,
+    TOKEN_FALSE,
+    TOKEN_WORD, // bare field name
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_EQ,
+    TOKEN_NE,
+    TOKEN_LT,
+    TOKEN_LE,
+    TOKEN_GT,
+    TOKEN_GE,
+} token_type_t;
+
+typedef struct {
+    token_type_t type;
+    const char *start; // word / string (raw, quotes stripped)
+    size_t len;
+    double number;
+} token_t;
+
+typedef struct {
+    const char *p;
+    token_t token; // lookahead
+    int depth;
+    vdb_status_t status; // set on allocation failure
+} parser_t;
+
+static bool word_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '-';
+}
+
+static bool keyword(const token_t *t, const char *word) {
+    size_t len = strlen(word);
+    if (t->len != len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (toupper((unsigned char)t->start[i]) != word[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void next_token(parser_t *ps) {
+    const char *p = ps->p;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    token_t *t = &ps->token;
+    t->start = p;
+    t->len = 0;
+
+    char c = *p;
+    if (c == '\0') {
+        t->type = TOKEN_END;
+    } else if (c == '(' || c == ')') {
+        t->type = c == '(' ? TOKEN_LPAREN : TOKEN_RPAREN;
+        p++;
+    } else if (c == '=') {
+        t->type = TOKEN_EQ;
+        p += p[1] == '=' ? 2 : 1;
+    } else if (c == '!' && p[1] == '=') {
+        t->type = TOKEN_NE;
+        p += 2;
+    } else if (c == '<' || c == '>') {
+        bool eq = p[1] == '=';
+        t->type = c == '<' ? (eq ? TOKEN_LE : TOKEN_LT) : (eq ? TOKEN_GE : TOKEN_GT);
+        p += eq ? 2 : 1;
+    } else if (c == '"') {
+        // raw contents; escapes are resolved when the value is copied
+        t->type = TOKEN_STRING;
+        t->start = ++p;
+        while (*p != '\0' && *p != '"') {
+            p += (*p == '\\' && p[1] != '\0') ? 2 : 1;
+        }
+        if (*p != '"') {
+            t->type = TOKEN_ERROR;
+        } else {
+            t->len = (size_t)(p - t->start);
+            p++;
+        }
+    } else if (isdigit((unsigned char)c) || ((c == '-' || c == '+' || c == '.') && (isdigit((unsigned char)p[1]) || p[1] == '.'))) {
+        char *end;
+        t->number = strtod(p, &end);
+        t->type = end != p && isfinite(t->number) ? TOKEN_NUMBER : TOKEN_ERROR;
+        p = end != p ? end : p + 1;
+    } else if (word_start(c)) {
+        while (word_char(*p)) {
+            p++;
+        }
+        t->len = (size_t)(p - t->start);
+        t->type = keyword(t, "AND") ? TOKEN_AND
+                : keyword(t, "OR") ? TOKEN_OR
+                : keyword(t, "NOT") ? TOKEN_NOT
+                : keyword(t, "TRUE") ? TOKEN_TRUE
+                : keyword(t, "FALSE") ? TOKEN_FALSE
+                : TOKEN_WORD;
+    } else {
+        t->type = TOKEN_ERROR;
+        p++;
+    }
+    ps->p = p;
+}
+
+/* ------------------------------------------------------------------ */
+/* Parser                                                              */
+/* ------------------------------------------------------------------ */
+
+static vdb_filter_t *new_node(parser_t *ps, filter_node_type_t type) {
+    vdb_filter_t *node = (vdb_filter_t*)calloc(1, sizeof(vdb_filter_t));
+    if (node == NULL) {
+        ps->status = VDB_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    node->type = type;
+    return node;
+}
+
+/* Copy a string token, resolving \" \\ and the other one-letter escapes */
+static char *copy_token_text(parser_t *ps, const token_t *t, bool escapes, size_t *out_len) {
+    char *text = (char*)malloc(t->len + 1);
+    if (text == NULL) {
+        ps->status = VDB_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < t->len; i++) {
+        char c = t->start[i];
+        if (escapes && c == '\\' && i + 1 < t->len) {
+            c = t->start[++i];
+            c = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c;
+        }
+        text[n++] = c;
+    }
+    text[n] = '\0';
+    *out_len = n;
+    return text;
+}
+
+static vdb_filter_t *parse_or(parser_t *ps);
+
+static vdb_filter_t *combine(parser_t *ps, filter_node_type_t type, vdb_filter_t *left,
+                             vdb_filter_t *right) {
+    vdb_filter_t *node = left != NULL && right != NULL ? new_node(ps, type) : NULL;
+    if (node == NULL) {
+        vdb_filter_free(&left);
+        vdb_filter_free(&right);
+        return NULL;
+    }
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+/* field op value */
+static vdb_filter_t *parse_comparison(parser_t *ps) {
+    if (ps->token.type != TOKEN_WORD && ps->token.type != TOKEN_STRING) {
+        return NULL;
+    }
+    size_t field_len;
+    char *field = copy_token_text(ps, &ps->token, ps->token.type == TOKEN_STRING, &field_len);
+    if (field == NULL || field_len == 0) {
+        free(field);
+        return NULL;
+    }
+    next_token(ps);
+    token_type_t op = ps->token.type;
+    if (op < TOKEN_EQ) {
+        free(field);
+        return NULL;
+    }
+    next_token(ps);
+    token_t value = ps->token;
+    next_token(ps);
+
+    bool ordering = op != TOKEN_EQ && op != TOKEN_NE;
+    vdb_filter_t *leaf = NULL;
+    if (value.type == TOKEN_NUMBER) {
+        leaf = new_node(ps, FILTER_NODE_RANGE);
+        if (leaf != NULL) {
+            leaf->lo = (op == TOKEN_LT || op == TOKEN_LE) ? -INFINITY : value.number;
+            leaf->hi = (op == TOKEN_GT || op == TOKEN_GE) ? INFINITY : value.number;
+            leaf->lo_inclusive = op != TOKEN_GT;
+            leaf->hi_inclusive = op != TOKEN_LT;
+        }
+    } else if (!ordering && (value.type == TOKEN_STRING || value.type == TOKEN_TRUE ||
+                             value.type == TOKEN_FALSE)) {
+        leaf = new_node(ps, FILTER_NODE_TERM);
+        if (leaf != NULL && value.type == TOKEN_STRING) {
+            leaf->value_type = FILTER_TYPE_STRING;
+            leaf->value = copy_token_text(ps, &value, true, &leaf->value_len);
+        } else if (leaf != NULL) {
+            leaf->value_type = FILTER_TYPE_BOOL;
+            token_t literal = { TOKEN_WORD, value.type == TOKEN_TRUE ? "true" : "false",
+                                value.type == TOKEN_TRUE ? 4u : 5u, 0.0 };
+            leaf->value = copy_token_text(ps, &literal, false, &leaf->value_len);
+        }
+        if (leaf != NULL && leaf->value == NULL) {
+            vdb_filter_free(&leaf);
+        }
+    }
+    if (leaf == NULL) {
+        free(field);
+        return NULL;
+    }
+    leaf->field = field;
+
+    if (op == TOKEN_NE) {
+        vdb_filter_t *not_node = new_node(ps, FILTER_NODE_NOT);
+        if (not_node == NULL) {
+            vdb_filter_free(&leaf);
+            return NULL;
+        }
+        not_node->left = leaf;
+        return not_node;
+    }
+    return leaf;
+}
+
+/* NOT factor | ( expr ) | comparison */
+static vdb_filter_t *parse_factor(parser_t *ps) {
+    if (++ps->depth > FILTER_MAX_NESTING) {
+        return NULL;
+    }
+    vdb_filter_t *node = NULL;
+    if (ps->token.type == TOKEN_NOT) {
+        next_token(ps);
+        vdb_filter_t *operand = parse_factor(ps);
+        node = operand != NULL ? new_node(ps, FILTER_NODE_NOT) : NULL;
+        if (node == NULL) {
+            vdb_filter_free(&operand);
+        } else {
+            node->left = operand;
+        }
+    } else if (ps->token.type == TOKEN_LPAREN) {
+        next_token(ps);
+        node = parse_or(ps);
+        if (node != NULL && ps->token.type != TOKEN_RPAREN) {
+            vdb_filter_free(&node);
+        }
+        next_token(ps);
+    } else {
+        node = parse_comparison(ps);
+    }
+    ps->depth--;
+    return node;
+}
+
+static vdb_filter_t *parse_and(parser_t *ps) {
+    vdb_filter_t *node = parse_factor(ps);
+    while (node != NULL && ps->token.type == TOKEN_AND) {
+        next_token(ps);
+        node = combine(ps, FILTER_NODE_AND, node, parse_factor(ps));
+    }
+    return node;
+}
+
+static vdb_filter_t *parse_or(parser_t *ps) {
+    vdb_filter_t *node = parse_and(ps);
+    while (node != NULL && ps->token.type == TOKEN_OR) {
+        next_token(ps);
+        node = combine(ps, FILTER_NODE_OR, node, parse_and(ps));
+    }
+    return node;
+}
+
+/**
+ * Parse a filter expression
+*/
+vdb_status_t vdb_filter_parse(const char *expr, vdb_filter_t **out_filter) {
+    if (expr == NULL || out_filter == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    *out_filter = NULL;
+
+    parser_t ps = { expr, { TOKEN_END, NULL, 0, 0.0 }, 0, VDB_OK };
+    next_token(&ps);
+    vdb_filter_t *filter = parse_or(&ps);
+    if (filter != NULL && ps.token.type != TOKEN_END) {
+        vdb_filter_free(&filter); // trailing tokens
+    }
+    if (filter == NULL) {
+        return ps.status != VDB_OK ? ps.status : VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    *out_filter = filter;
+    return VDB_OK;
+}
+
+/**
+ * Free a filter tree
+*/
+void vdb_filter_free(vdb_filter_t **filter) {
+    if (filter == NULL || *filter == NULL) {
+        return;
+    }
+    vdb_filter_t *node = *filter;
+    vdb_filter_free(&node->left);
+    vdb_filter_free(&node->right);
+    free(node->field);
+    free(node->value);
+    free(node);
+    *filter = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Evaluation                                                          */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t filter_eval(const vdb_filter_t *filter, const filter_index_t *index, roaring_t *out) {
+    roaring_free(out);
+
+    switch (filter->type) {
+        case FILTER_NODE_TERM:
+            return filter_index_term(index, filter->field, filter->value_type, filter->value,
+                                     filter->value_len, out);
+        case FILTER_NODE_RANGE:
+            return filter_index_range(index, filter->field, filter->lo, filter->lo_inclusive,
+                                      filter->hi, filter->hi_inclusive, out);
+        default:
+            break;
+    }
+
+    roaring_t left, right;
+    roaring_init(&left);
+    roaring_init(&right);
+    vdb_status_t status = filter_eval(filter->left, index, &left);
+    if (status == VDB_OK) {
+        if (filter->type == FILTER_NODE_NOT) {
+            status = roaring_add_range(&right, 0, filter_index_count(index));
+            if (status == VDB_OK) {
+                status = roaring_andnot(&right, &left, out);
+            }
+        } else if (filter->type == FILTER_NODE_AND && left.size == 0) {
+            // nothing left to intersect
+        } else {
+            status = filter_eval(filter->right, index, &right);
+            if (status == VDB_OK) {
+                status = filter->type == FILTER_NODE_AND ? roaring_and(&left, &right, out)
+                                                         : roaring_or(&left, &right, out);
+            }
+        }
+    }
+    roaring_free(&left);
+    roaring_free(&right);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Cache keys                                                          */
+/* ------------------------------------------------------------------ */
+
+/* Append n bytes at *pos, as far as they fit in cap */
+static void key_put(uint8_t *out, size_t cap, size_t *pos, const void *data, size_t n) {
+    if (*pos < cap) {
+        memcpy(out + *pos, data, cap - *pos < n ? cap - *pos : n);
+    }
+    *pos += n;
+}
+
+static void key_node(const vdb_filter_t *filter, uint8_t *out, size_t cap, size_t *pos) {
+    uint8_t type = (uint8_t)filter->type;
+    key_put(out, cap, pos, &type, 1);
+    if (filter->type == FILTER_NODE_TERM || filter->type == FILTER_NODE_RANGE) {
+        uint64_t len = strlen(filter->field);
+        key_put(out, cap, pos, &len, sizeof(len));
+        key_put(out, cap, pos, filter->field, (size_t)len);
+    }
+    if (filter->type == FILTER_NODE_TERM) {
+        uint64_t len = filter->value_len;
+        key_put(out, cap, pos, &filter->value_type, 1);
+        key_put(out, cap, pos, &len, sizeof(len));
+        key_put(out, cap, pos, filter->value, filter->value_len);
+    } else if (filter->type == FILTER_NODE_RANGE) {
+        uint8_t inclusive = (uint8_t)(filter->lo_inclusive | filter->hi_inclusive << 1);
+        key_put(out, cap, pos, &filter->lo, sizeof(double));
+        key_put(out, cap, pos, &filter->hi, sizeof(double));
+        key_put(out, cap, pos, &inclusive, 1);
+    } else {
+        key_node(filter->left, out, cap, pos);
+        if (filter->type != FILTER_NODE_NOT) {
+            key_node(filter->right, out, cap, pos);
+        }
+    }
+}
+
+size_t filter_key(const vdb_filter_t *filter, uint8_t *out, size_t cap) {
+    size_t pos = 0;
+    key_node(filter, out, cap, &pos);
+    return pos;
+}
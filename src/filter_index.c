@@ -0,0 +1,1009 @@
+/**
+ * filter_index.c - Metadata extraction and the postings / range index
+ *
+ * Metadata is parsed with a small strict JSON reader (RFC 8259 syntax,
+ * no extensions). A row is parsed twice: once to check the whole blob
+ * is a valid object, then again to index it, so a malformed blob never
+ * leaves half its fields indexed.
+ *
+ * Terms and numeric fields share one open-addressing hash table keyed
+ * by "field \0 type [value]".
+*/
+
+#include "filter_index.h"
+#include "storage_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Deepest nesting the reader follows (skipped values included) */
+#define FILTER_MAX_DEPTH 64
+
+/* Longest number literal accepted */
+#define FILTER_MAX_NUMBER_LEN 64
+
+/* The unsorted tail of a range index is merged once it reaches
+ * max(this, sorted / FILTER_TAIL_RATIO) entries */
+#define FILTER_TAIL_MIN 1024
+#define FILTER_TAIL_RATIO 8
+
+#define FILTER_TYPE_NUMBER 'n'
+
+typedef struct {
+    double value;
+    uint64_t row;
+} number_entry_t;
+
+typedef struct {
+    char *key; // NULL = empty slot
+    size_t key_len;
+    uint64_t hash;
+    roaring_t rows; // string / bool terms
+    number_entry_t *sorted; // numeric fields: by value, then row
+    size_t sorted_len;
+    number_entry_t *tail; // appended since the last merge
+    size_t tail_len;
+    size_t tail_cap;
+} filter_entry_t;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} text_buffer_t;
+
+/* index.snap section: this header, then per term a filter_snap_term_t
+ * followed by its key (padded to 8 bytes), the image of its rows, and
+ * its sorted and tail number entries */
+typedef struct {
+    uint64_t count;
+    uint64_t meta_offset;
+    uint64_t terms;
+} filter_snap_header_t;
+
+typedef struct {
+    uint64_t key_len;
+    uint64_t rows_bytes;
+    uint64_t sorted_len;
+    uint64_t tail_len;
+} filter_snap_term_t;
+
+struct filter_index {
+    filter_entry_t *slots;
+    size_t capacity; // power of two
+    size_t used;
+    uint64_t count;
+    text_buffer_t field; // decoded field name of the current pair
+    text_buffer_t value; // decoded string value
+    text_buffer_t key; // lookup key
+};
+
+/* ------------------------------------------------------------------ */
+/* Hash table                                                          */
+/* ------------------------------------------------------------------ */
+
+static uint64_t hash_bytes(const char *data, size_t len) {
+    uint64_t h = 1469598103934665603ull; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static vdb_status_t text_reserve(text_buffer_t *buf, size_t len) {
+    if (len <= buf->cap) {
+        return VDB_OK;
+    }
+    size_t cap = buf->cap < 64 ? 64 : buf->cap;
+    while (cap < len) {
+        cap *= 2;
+    }
+    char *data = (char*)realloc(buf->data, cap);
+    if (data == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return VDB_OK;
+}
+
+static vdb_status_t text_append(text_buffer_t *buf, const char *data, size_t len) {
+    if (len == 0) {
+        return VDB_OK; // data may be NULL
+    }
+    vdb_status_t status = text_reserve(buf, buf->len + len);
+    if (status == VDB_OK) {
+        memcpy(buf->data + buf->len, data, len);
+        buf->len += len;
+    }
+    return status;
+}
+
+/* key = field \0 type value into index->key */
+static vdb_status_t build_key(text_buffer_t *key, const char *field, size_t field_len, char type,
+                              const char *value, size_t value_len) {
+    key->len = 0;
+    char sep[2] = { '\0', type };
+    vdb_status_t status = text_append(key, field, field_len);
+    if (status == VDB_OK) {
+        status = text_append(key, sep, sizeof(sep));
+    }
+    if (status == VDB_OK) {
+        status = text_append(key, value, value_len);
+    }
+    return status;
+}
+
+static filter_entry_t *find_slot(filter_entry_t *slots, size_t capacity, const char *key,
+                                 size_t len, uint64_t hash) {
+    size_t mask = capacity - 1;
+    for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        filter_entry_t *e = &slots[i];
+        if (e->key == NULL ||
+            (e->hash == hash && e->key_len == len && memcmp(e->key, key, len) == 0)) {
+            return e;
+        }
+    }
+}
+
+static const filter_entry_t *lookup(const filter_index_t *index, const text_buffer_t *key) {
+    const filter_entry_t *e = find_slot(index->slots, index->capacity, key->data, key->len,
+                                        hash_bytes(key->data, key->len));
+    return e->key != NULL ? e : NULL;
+}
+
+static vdb_status_t grow_table(filter_index_t *index) {
+    size_t capacity = index->capacity * 2;
+    filter_entry_t *slots = (filter_entry_t*)calloc(capacity, sizeof(filter_entry_t));
+    if (slots == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < index->capacity; i++) {
+        filter_entry_t *e = &index->slots[i];
+        if (e->key != NULL) {
+            *find_slot(slots, capacity, e->key, e->key_len, e->hash) = *e;
+        }
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return VDB_OK;
+}
+
+/* Entry for the key in index->key, inserted if missing */
+static filter_entry_t *get_entry(filter_index_t *index) {
+    const text_buffer_t *key = &index->key;
+    uint64_t hash = hash_bytes(key->data, key->len);
+    filter_entry_t *e = find_slot(index->slots, index->capacity, key->data, key->len, hash);
+    if (e->key != NULL) {
+        return e;
+    }
+
+    // keep the load under 3/4
+    if ((index->used + 1) * 4 > index->capacity * 3) {
+        if (grow_table(index) != VDB_OK) {
+            return NULL;
+        }
+        e = find_slot(index->slots, index->capacity, key->data, key->len, hash);
+    }
+    char *copy = (char*)malloc(key->len);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, key->data, key->len);
+    memset(e, 0, sizeof(*e));
+    e->key = copy;
+    e->key_len = key->len;
+    e->hash = hash;
+    roaring_init(&e->rows);
+    index->used++;
+    return e;
+}
+
+/* ------------------------------------------------------------------ */
+/* Range index                                                         */
+/* ------------------------------------------------------------------ */
+
+static int compare_numbers(const void *a, const void *b) {
+    const number_entry_t *x = (const number_entry_t*)a;
+    const number_entry_t *y = (const number_entry_t*)b;
+    if (x->value != y->value) {
+        return x->value < y->value ? -1 : 1;
+    }
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+/* Sort the tail into the sorted run */
+static vdb_status_t merge_tail(filter_entry_t *e) {
+    number_entry_t *merged = (number_entry_t*)malloc((e->sorted_len + e->tail_len) * sizeof(number_entry_t));
+    if (merged == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    qsort(e->tail, e->tail_len, sizeof(number_entry_t), compare_numbers);
+
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+    while (i < e->sorted_len || j < e->tail_len) {
+        if (j == e->tail_len || (i < e->sorted_len && compare_numbers(&e->sorted[i], &e->tail[j]) <= 0)) {
+            merged[n++] = e->sorted[i++];
+        } else {
+            merged[n++] = e->tail[j++];
+        }
+    }
+    free(e->sorted);
+    e->sorted = merged;
+    e->sorted_len = n;
+    e->tail_len = 0;
+    return VDB_OK;
+}
+
+static vdb_status_t add_number(filter_entry_t *e, double value, uint64_t row) {
+    if (e->tail_len == e->tail_cap) {
+        size_t cap = e->tail_cap < 16 ? 16 : e->tail_cap * 2;
+        number_entry_t *tail = (number_entry_t*)realloc(e->tail, cap * sizeof(number_entry_t));
+        if (tail == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        e->tail = tail;
+        e->tail_cap = cap;
+    }
+    e->tail[e->tail_len].value = value;
+    e->tail[e->tail_len].row = row;
+    e->tail_len++;
+
+    size_t limit = e->sorted_len / FILTER_TAIL_RATIO;
+    if (e->tail_len >= (limit > FILTER_TAIL_MIN ? limit : FILTER_TAIL_MIN)) {
+        return merge_tail(e); // a failed merge leaves the tail as is
+    }
+    return VDB_OK;
+}
+
+static bool in_range(double v, double lo, bool lo_inclusive, double hi, bool hi_inclusive) {
+    return (lo_inclusive ? v >= lo : v > lo) && (hi_inclusive ? v <= hi : v < hi);
+}
+
+static int compare_rows(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* ------------------------------------------------------------------ */
+/* JSON reader                                                         */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    const char *p;
+    const char *end;
+    filter_index_t *index;
+    bool apply; // false = only check the syntax
+    vdb_status_t status; // first indexing failure
+} json_reader_t;
+
+static void skip_ws(json_reader_t *r) {
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r')) {
+        r->p++;
+    }
+}
+
+static bool consume(json_reader_t *r, char c) {
+    skip_ws(r);
+    if (r->p < r->end && *r->p == c) {
+        r->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool consume_literal(json_reader_t *r, const char *literal) {
+    size_t len = strlen(literal);
+    if ((size_t)(r->end - r->p) < len || memcmp(r->p, literal, len) != 0) {
+        return false;
+    }
+    r->p += len;
+    return true;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool read_hex4(json_reader_t *r, uint32_t *out) {
+    if (r->end - r->p < 4) {
+        return false;
+    }
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = hex_digit(r->p[i]);
+        if (d < 0) {
+            return false;
+        }
+        v = (v << 4) | (uint32_t)d;
+    }
+    r->p += 4;
+    *out = v;
+    return true;
+}
+
+static vdb_status_t append_utf8(text_buffer_t *buf, uint32_t cp) {
+    char out[4];
+    size_t n;
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        out[0] = (char)(0xc0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3f));
+        n = 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char)(0xe0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (cp & 0x3f));
+        n = 3;
+    } else {
+        out[0] = (char)(0xf0 | (cp >> 18));
+        out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+        out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[3] = (char)(0x80 | (cp & 0x3f));
+        n = 4;
+    }
+    return text_append(buf, out, n);
+}
+
+/**
+ * Read a string (opening quote next) and decode it into out
+ * \u0000 is refused: field names end at a NUL in the keys.
+*/
+static bool read_string(json_reader_t *r, text_buffer_t *out) {
+    out->len = 0;
+    if (!consume(r, '"')) {
+        return false;
+    }
+    while (r->p < r->end) {
+        const char *run = r->p;
+        while (r->p < r->end && *r->p != '"' && *r->p != '\\' && (uint8_t)*r->p >= 0x20) {
+            r->p++;
+        }
+        if (text_append(out, run, (size_t)(r->p - run)) != VDB_OK) {
+            r->status = VDB_ERROR_OUT_OF_MEMORY;
+            return false;
+        }
+        if (r->p == r->end || (uint8_t)*r->p < 0x20) {
+            return false;
+        }
+        if (*r->p++ == '"') {
+            return true;
+        }
+
+        // escape
+        if (r->p == r->end) {
+            return false;
+        }
+        char c = *r->p++;
+        uint32_t cp;
+        switch (c) {
+            case '"': case '\\': case '/': cp = (uint32_t)c; break;
+            case 'b': cp = '\b'; break;
+            case 'f': cp = '\f'; break;
+            case 'n': cp = '\n'; break;
+            case 'r': cp = '\r'; break;
+            case 't': cp = '\t'; break;
+            case 'u':
+                if (!read_hex4(r, &cp) || cp == 0) {
+                    return false;
+                }
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    uint32_t low;
+                    if (!consume_literal(r, "\\u") || !read_hex4(r, &low) || low < 0xdc00 || low >= 0xe000) {
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                } else if (cp >= 0xdc00 && cp < 0xe000) {
+                    return false; // lone low surrogate
+                }
+                break;
+            default:
+                return false;
+        }
+        if (append_utf8(out, cp) != VDB_OK) {
+            r->status = VDB_ERROR_OUT_OF_MEMORY;
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool read_number(json_reader_t *r, double *out) {
+    skip_ws(r);
+    const char *start = r->p;
+    const char *p = r->p;
+    if (p < r->end && *p == '-') {
+        p++;
+    }
+    if (p == r->end || !is_digit(*p)) {
+        return false;
+    }
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < r->end && is_digit(*p)) {
+            p++;
+        }
+    }
+    if (p < r->end && *p == '.') {
+        p++;
+        if (p == r->end || !is_digit(*p)) {
+            return false;
+        }
+        while (p < r->end && is_digit(*p)) {
+            p++;
+        }
+    }
+    if (p < r->end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < r->end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p == r->end || !is_digit(*p)) {
+            return false;
+        }
+        while (p < r->end && is_digit(*p)) {
+            p++;
+        }
+    }
+
+    // the blob is not NUL-terminated, strtod needs a copy
+    char buf[FILTER_MAX_NUMBER_LEN + 1];
+    size_t len = (size_t)(p - start);
+    if (len > FILTER_MAX_NUMBER_LEN) {
+        return false;
+    }
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    *out = strtod(buf, NULL);
+    r->p = p;
+    return true;
+}
+
+static bool skip_value(json_reader_t *r, int depth);
+
+static bool skip_container(json_reader_t *r, char close, int depth) {
+    if (consume(r, close)) {
+        return true;
+    }
+    text_buffer_t *scratch = &r->index->value;
+    do {
+        if (close == '}' && (!read_string(r, scratch) || !consume(r, ':'))) {
+            return false;
+        }
+        if (!skip_value(r, depth + 1)) {
+            return false;
+        }
+    } while (consume(r, ','));
+    return consume(r, close);
+}
+
+static bool skip_value(json_reader_t *r, int depth) {
+    if (depth > FILTER_MAX_DEPTH) {
+        return false;
+    }
+    skip_ws(r);
+    if (r->p == r->end) {
+        return false;
+    }
+    double number;
+    switch (*r->p) {
+        case '{': r->p++; return skip_container(r, '}', depth);
+        case '[': r->p++; return skip_container(r, ']', depth);
+        case '"': return read_string(r, &r->index->value);
+        case 't': return consume_literal(r, "true");
+        case 'f': return consume_literal(r, "false");
+        case 'n': return consume_literal(r, "null");
+        default: return read_number(r, &number);
+    }
+}
+
+/* Record one scalar of the current field */
+static void index_term(json_reader_t *r, char type, const char *value, size_t value_len) {
+    filter_index_t *index = r->index;
+    if (!r->apply || r->status != VDB_OK) {
+        return;
+    }
+    vdb_status_t status = build_key(&index->key, index->field.data, index->field.len, type, value, value_len);
+    filter_entry_t *e = status == VDB_OK ? get_entry(index) : NULL;
+    r->status = e != NULL ? roaring_add(&e->rows, index->count) : VDB_ERROR_OUT_OF_MEMORY;
+}
+
+static void index_number(json_reader_t *r, double value) {
+    filter_index_t *index = r->index;
+    if (!r->apply || r->status != VDB_OK) {
+        return;
+    }
+    vdb_status_t status = build_key(&index->key, index->field.data, index->field.len,
+                                    FILTER_TYPE_NUMBER, NULL, 0);
+    filter_entry_t *e = status == VDB_OK ? get_entry(index) : NULL;
+    r->status = e != NULL ? add_number(e, value, index->count) : VDB_ERROR_OUT_OF_MEMORY;
+}
+
+/**
+ * Read the value of a top-level field and index it
+ * Scalars (or arrays of them) are indexed; anything else is skipped.
+*/
+static bool read_field_value(json_reader_t *r, bool in_array) {
+    skip_ws(r);
+    if (r->p == r->end) {
+        return false;
+    }
+    double number;
+    switch (*r->p) {
+        case '"':
+            if (!read_string(r, &r->index->value)) {
+                return false;
+            }
+            index_term(r, FILTER_TYPE_STRING, r->index->value.data, r->index->value.len);
+            return true;
+        case 't':
+            if (!consume_literal(r, "true")) {
+                return false;
+            }
+            index_term(r, FILTER_TYPE_BOOL, "true", 4);
+            return true;
+        case 'f':
+            if (!consume_literal(r, "false")) {
+                return false;
+            }
+            index_term(r, FILTER_TYPE_BOOL, "false", 5);
+            return true;
+        case 'n':
+            return consume_literal(r, "null");
+        case '{':
+            return skip_value(r, 1);
+        case '[':
+            if (in_array) {
+                return skip_value(r, 1); // only one level of arrays is indexed
+            }
+            r->p++;
+            if (consume(r, ']')) {
+                return true;
+            }
+            do {
+                if (!read_field_value(r, true)) {
+                    return false;
+                }
+            } while (consume(r, ','));
+            return consume(r, ']');
+        default:
+            if (!read_number(r, &number)) {
+                return false;
+            }
+            index_number(r, number);
+            return true;
+    }
+}
+
+/* Whole blob: one object and nothing after it */
+static bool read_object(json_reader_t *r) {
+    if (!consume(r, '{')) {
+        return false;
+    }
+    if (!consume(r, '}')) {
+        do {
+            if (!read_string(r, &r->index->field) || !consume(r, ':') || !read_field_value(r, false)) {
+                return false;
+            }
+        } while (consume(r, ','));
+        if (!consume(r, '}')) {
+            return false;
+        }
+    }
+    skip_ws(r);
+    return r->p == r->end;
+}
+
+/* ------------------------------------------------------------------ */
+/* Index API                                                           */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t filter_index_create(filter_index_t **out_index) {
+    filter_index_t *index = (filter_index_t*)calloc(1, sizeof(filter_index_t));
+    if (index == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    index->capacity = 64;
+    index->slots = (filter_entry_t*)calloc(index->capacity, sizeof(filter_entry_t));
+    if (index->slots == NULL) {
+        free(index);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    *out_index = index;
+    return VDB_OK;
+}
+
+void filter_index_free(filter_index_t **index) {
+    if (index == NULL || *index == NULL) {
+        return;
+    }
+    filter_index_t *idx = *index;
+    for (size_t i = 0; i < idx->capacity; i++) {
+        filter_entry_t *e = &idx->slots[i];
+        if (e->key != NULL) {
+            free(e->key);
+            roaring_free(&e->rows);
+            free(e->sorted);
+            free(e->tail);
+        }
+    }
+    free(idx->slots);
+    free(idx->field.data);
+    free(idx->value.data);
+    free(idx->key.data);
+    free(idx);
+    *index = NULL;
+}
+
+uint64_t filter_index_count(const filter_index_t *index) {
+    return index->count;
+}
+
+size_t filter_index_memory_bytes(const filter_index_t *index) {
+    size_t bytes = sizeof(*index) + index->capacity * sizeof(filter_entry_t) +
+                   index->field.cap + index->value.cap + index->key.cap;
+    for (size_t i = 0; i < index->capacity; i++) {
+        const filter_entry_t *e = &index->slots[i];
+        if (e->key != NULL) {
+            bytes += e->key_len + roaring_memory_bytes(&e->rows) +
+                     (e->sorted_len + e->tail_cap) * sizeof(number_entry_t);
+        }
+    }
+    return bytes;
+}
+
+vdb_status_t filter_index_add(filter_index_t *index, const char *json, size_t len) {
+    if (len > 0) {
+        json_reader_t r = { json, json + len, index, false, VDB_OK };
+        bool valid = read_object(&r);
+        if (r.status != VDB_OK) {
+            return r.status;
+        }
+        if (valid) {
+            r.p = json;
+            r.apply = true;
+            read_object(&r);
+            if (r.status != VDB_OK) {
+                return r.status;
+            }
+        }
+    }
+    index->count++;
+    return VDB_OK;
+}
+
+vdb_status_t filter_index_term(const filter_index_t *index, const char *field, char type,
+                               const char *value, size_t value_len, roaring_t *out) {
+    text_buffer_t key = {0};
+    vdb_status_t status = build_key(&key, field, strlen(field), type, value, value_len);
+    const filter_entry_t *e = status == VDB_OK ? lookup(index, &key) : NULL;
+    free(key.data);
+    if (status != VDB_OK || e == NULL) {
+        return status;
+    }
+
+    roaring_t merged;
+    roaring_init(&merged);
+    status = roaring_or(out, &e->rows, &merged);
+    if (status == VDB_OK) {
+        roaring_free(out);
+        *out = merged;
+    }
+    return status;
+}
+
+vdb_status_t filter_index_range(const filter_index_t *index, const char *field,
+                                double lo, bool lo_inclusive, double hi, bool hi_inclusive,
+                                roaring_t *out) {
+    text_buffer_t key = {0};
+    vdb_status_t status = build_key(&key, field, strlen(field), FILTER_TYPE_NUMBER, NULL, 0);
+    const filter_entry_t *e = status == VDB_OK ? lookup(index, &key) : NULL;
+    free(key.data);
+    if (status != VDB_OK || e == NULL) {
+        return status;
+    }
+
+    // first sorted entry past the lower bound
+    size_t first = 0;
+    size_t last = e->sorted_len;
+    while (first < last) {
+        size_t mid = first + (last - first) / 2;
+        double v = e->sorted[mid].value;
+        if (lo_inclusive ? v < lo : v <= lo) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    size_t end = first;
+    while (end < e->sorted_len && in_range(e->sorted[end].value, lo, lo_inclusive, hi, hi_inclusive)) {
+        end++;
+    }
+
+    // collect, then add in row order so the bitmap appends
+    size_t capacity = (end - first) + e->tail_len;
+    uint64_t *rows = (uint64_t*)malloc((capacity > 0 ? capacity : 1) * sizeof(uint64_t));
+    if (rows == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    size_t n = 0;
+    for (size_t i = first; i < end; i++) {
+        rows[n++] = e->sorted[i].row;
+    }
+    for (size_t i = 0; i < e->tail_len; i++) {
+        if (in_range(e->tail[i].value, lo, lo_inclusive, hi, hi_inclusive)) {
+            rows[n++] = e->tail[i].row;
+        }
+    }
+    qsort(rows, n, sizeof(uint64_t), compare_rows);
+    for (size_t i = 0; i < n && status == VDB_OK; i++) {
+        status = roaring_add(out, rows[i]);
+    }
+    free(rows);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Snapshots                                                           */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t filter_index_write_snap(const filter_index_t *index, uint64_t meta_offset,
+                                     index_snap_writer_t *w) {
+    filter_snap_header_t header = { index->count, meta_offset, index->used };
+    index_snap_begin(w, INDEX_SNAP_FILTERS);
+    index_snap_write(w, &header, sizeof(header));
+
+    static const uint8_t zeros[8];
+    text_buffer_t image = {0};
+    vdb_status_t status = VDB_OK;
+    for (size_t i = 0; i < index->capacity && status == VDB_OK; i++) {
+        const filter_entry_t *e = &index->slots[i];
+        if (e->key == NULL) {
+            continue;
+        }
+        filter_snap_term_t term = { e->key_len, roaring_image_bytes(&e->rows), e->sorted_len, e->tail_len };
+        status = text_reserve(&image, (size_t)term.rows_bytes);
+        if (status != VDB_OK) {
+            break;
+        }
+        roaring_write_image(&e->rows, (uint8_t*)image.data);
+
+        index_snap_write(w, &term, sizeof(term));
+        index_snap_write(w, e->key, e->key_len);
+        index_snap_write(w, zeros, (8 - e->key_len % 8) % 8);
+        index_snap_write(w, image.data, (size_t)term.rows_bytes);
+        index_snap_write(w, e->sorted, e->sorted_len * sizeof(number_entry_t));
+        index_snap_write(w, e->tail, e->tail_len * sizeof(number_entry_t));
+    }
+    index_snap_end(w);
+    free(image.data);
+    return status;
+}
+
+/* Copy n number entries out of the section */
+static vdb_status_t read_numbers(index_snap_reader_t *r, uint64_t n, number_entry_t **out) {
+    if (n == 0) {
+        return VDB_OK;
+    }
+    const void *data = n <= SIZE_MAX / sizeof(number_entry_t)
+        ? index_snap_read(r, (size_t)n * sizeof(number_entry_t)) : NULL;
+    if (data == NULL) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    *out = (number_entry_t*)malloc((size_t)n * sizeof(number_entry_t));
+    if (*out == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(*out, data, (size_t)n * sizeof(number_entry_t));
+    return VDB_OK;
+}
+
+/* Read one term into its slot */
+static vdb_status_t read_term(filter_index_t *index, index_snap_reader_t *r) {
+    filter_snap_term_t term;
+    const void *data = index_snap_read(r, sizeof(term));
+    if (data == NULL) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    memcpy(&term, data, sizeof(term));
+    const char *key = term.key_len > 0 && term.key_len < SIZE_MAX - 8
+        ? (const char*)index_snap_read(r, (size_t)(term.key_len + 7) / 8 * 8) : NULL;
+    if (key == NULL) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    uint64_t hash = hash_bytes(key, (size_t)term.key_len);
+    filter_entry_t *e = find_slot(index->slots, index->capacity, key, (size_t)term.key_len, hash);
+    if (e->key != NULL) {
+        return VDB_ERROR_CORRUPTED; // written twice
+    }
+
+    filter_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    roaring_init(&entry.rows);
+    entry.key = (char*)malloc((size_t)term.key_len);
+    if (entry.key == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(entry.key, key, (size_t)term.key_len);
+    entry.key_len = (size_t)term.key_len;
+    entry.hash = hash;
+
+    size_t used = 0;
+    data = index_snap_read(r, (size_t)term.rows_bytes);
+    vdb_status_t status = data != NULL
+        ? roaring_read_image((const uint8_t*)data, (size_t)term.rows_bytes, &entry.rows, &used)
+        : VDB_ERROR_CORRUPTED;
+    if (status == VDB_OK && used != term.rows_bytes) {
+        status = VDB_ERROR_CORRUPTED;
+    }
+    if (status == VDB_OK) {
+        status = read_numbers(r, term.sorted_len, &entry.sorted);
+        entry.sorted_len = entry.sorted != NULL ? (size_t)term.sorted_len : 0;
+    }
+    if (status == VDB_OK) {
+        status = read_numbers(r, term.tail_len, &entry.tail);
+        entry.tail_len = entry.tail != NULL ? (size_t)term.tail_len : 0;
+        entry.tail_cap = entry.tail_len;
+    }
+    if (status != VDB_OK) {
+        free(entry.key);
+        roaring_free(&entry.rows);
+        free(entry.sorted);
+        free(entry.tail);
+        return status;
+    }
+    *e = entry;
+    index->used++;
+    return VDB_OK;
+}
+
+vdb_status_t filter_index_read_snap(index_snap_t *snap, filter_index_t **out_index,
+                                    uint64_t *out_meta_offset) {
+    index_snap_reader_t r;
+    if (!index_snap_section(snap, INDEX_SNAP_FILTERS, &r)) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+    filter_snap_header_t header;
+    const void *data = index_snap_read(&r, sizeof(header));
+    if (data == NULL) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    memcpy(&header, data, sizeof(header));
+    // every term takes at least its record
+    if (header.terms > (r.end - r.pos) / sizeof(filter_snap_term_t)) {
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    filter_index_t *index = (filter_index_t*)calloc(1, sizeof(filter_index_t));
+    if (index == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    // sized so the load stays under 3/4 without growing
+    index->capacity = 64;
+    while (index->capacity * 3 < header.terms * 4) {
+        index->capacity *= 2;
+    }
+    index->slots = (filter_entry_t*)calloc(index->capacity, sizeof(filter_entry_t));
+    index->count = header.count;
+    vdb_status_t status = index->slots != NULL ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+    for (uint64_t i = 0; i < header.terms && status == VDB_OK; i++) {
+        status = read_term(index, &r);
+    }
+    if (status != VDB_OK) {
+        filter_index_free(&index);
+        return status;
+    }
+
+    *out_index = index;
+    *out_meta_offset = header.meta_offset;
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Storage hooks                                                       */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Index rows [filter_index_count, count) - caller holds write_lock
+*/
+vdb_status_t storage_filter_catch_up(vdb_storage_t *storage) {
+    storage_view_t view;
+    vdb_status_t status = storage_view_locked(storage, &view);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    pthread_rwlock_wrlock(&storage->filter_lock);
+    uint64_t offset = storage->filter_meta_offset;
+    while (status == VDB_OK && filter_index_count(storage->filters) < view.count) {
+        uint32_t len;
+        if (offset + sizeof(len) > view.metadata_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        memcpy(&len, view.metadata + offset, sizeof(len));
+        if (offset + sizeof(len) + len > view.metadata_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        status = filter_index_add(storage->filters, (const char*)view.metadata + offset + sizeof(len), len);
+        if (status == VDB_OK) {
+            offset += sizeof(len) + len;
+        }
+    }
+    storage->filter_meta_offset = offset;
+    pthread_rwlock_unlock(&storage->filter_lock);
+    return status;
+}
+
+/**
+ * Take the index from index.snap if it fits the rows stored now
+*/
+static bool filters_from_snap(vdb_storage_t *storage) {
+    filter_index_t *filters = NULL;
+    uint64_t meta_offset = 0;
+    if (storage->index_snap == NULL ||
+        filter_index_read_snap(storage->index_snap, &filters, &meta_offset) != VDB_OK) {
+        return false;
+    }
+    if (filter_index_count(filters) > storage->count || meta_offset > storage->metadata_bytes) {
+        filter_index_free(&filters);
+        return false;
+    }
+    storage->filters = filters;
+    storage->filter_meta_offset = meta_offset;
+    storage->snap_filters_used = true;
+    return true;
+}
+
+/**
+ * Attach the index over the rows already stored: from index.snap and
+ * the rows past it, or built from every row
+*/
+vdb_status_t storage_filter_load(vdb_storage_t *storage) {
+    if (!filters_from_snap(storage)) {
+        vdb_status_t status = filter_index_create(&storage->filters);
+        if (status != VDB_OK) {
+            return status;
+        }
+        storage->filter_meta_offset = 0;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = storage_filter_catch_up(storage);
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Evaluate a filter against the rows indexed so far
+*/
+vdb_status_t storage_filter_eval(vdb_storage_t *storage, const vdb_filter_t *filter, roaring_t *out) {
+    pthread_rwlock_rdlock(&storage->filter_lock);
+    vdb_status_t status = filter != NULL
+        ? filter_eval(filter, storage->filters, out)
+        : roaring_add_range(out, 0, filter_index_count(storage->filters));
+    pthread_rwlock_unlock(&storage->filter_lock);
+    return status;
+}
@@ -0,0 +1,93 @@
+/**
+ * filter_index.h - Internal metadata filter index
+ *
+ * Built from the JSON metadata as rows are appended (derived data, like
+ * the HNSW index: rebuilt from metadata.seg on open). Top-level fields
+ * of each row's object are indexed as:
+ * - strings and booleans: an inverted posting (roaring bitmap of rows)
+ *   per (field, value) term
+ * - numbers: a per-field range index of (value, row) pairs, a sorted
+ *   run plus a small unsorted tail that is merged in as it grows
+ * Array values index each scalar element.
+ * index.snap keeps a copy, so open only parses the rows past it.
+*/
+
+#ifndef VDB_FILTER_INDEX_H
+#define VDB_FILTER_INDEX_H
+
+#include "vdb/filter.h"
+#include "roaring.h"
+#include "index_snap.h"
+
+typedef struct filter_index filter_index_t;
+
+/* Value types of a term */
+#define FILTER_TYPE_STRING 's'
+#define FILTER_TYPE_BOOL 'b'
+
+vdb_status_t filter_index_create(filter_index_t **out_index);
+
+/**
+ * Free an index. Safe with NULL.
+*/
+void filter_index_free(filter_index_t **index);
+
+/* Rows indexed so far; the next add is this row */
+uint64_t filter_index_count(const filter_index_t *index);
+
+/* Heap bytes held: the term table, keys, postings and number entries */
+size_t filter_index_memory_bytes(const filter_index_t *index);
+
+/**
+ * Index the metadata of the next row (len 0 = no metadata)
+ * Metadata that isn't a JSON object indexes nothing. On failure the
+ * row can be added again; postings already written are idempotent.
+*/
+vdb_status_t filter_index_add(filter_index_t *index, const char *json, size_t len);
+
+/**
+ * OR the rows of a term into out
+ * For FILTER_TYPE_BOOL the value is "true" or "false".
+*/
+vdb_status_t filter_index_term(const filter_index_t *index, const char *field, char type,
+                               const char *value, size_t value_len, roaring_t *out);
+
+/**
+ * OR the rows whose numeric field lies in the range into out
+ * Bounds: lo < v (lo <= v if lo_inclusive), v < hi likewise.
+*/
+vdb_status_t filter_index_range(const filter_index_t *index, const char *field,
+                                double lo, bool lo_inclusive, double hi, bool hi_inclusive,
+                                roaring_t *out);
+
+/**
+ * Write the index as an INDEX_SNAP_FILTERS section, with the
+ * metadata.seg offset of the next row to index
+*/
+vdb_status_t filter_index_write_snap(const filter_index_t *index, uint64_t meta_offset,
+                                     index_snap_writer_t *w);
+
+/**
+ * Read the index back from the INDEX_SNAP_FILTERS section of a snapshot
+ *
+ * Returns:
+ * - VDB_ERROR_NOT_FOUND: No such section
+ * - VDB_ERROR_CORRUPTED: Truncated section, duplicate term or bad bitmap
+*/
+vdb_status_t filter_index_read_snap(index_snap_t *snap, filter_index_t **out_index,
+                                    uint64_t *out_meta_offset);
+
+/**
+ * Rows [0, filter_index_count) matching a parsed expression (filter.c)
+ * out must be initialized and is replaced.
+*/
+vdb_status_t filter_eval(const vdb_filter_t *filter, const filter_index_t *index, roaring_t *out);
+
+/**
+ * Serialize a parsed expression (filter.c): equal trees give equal
+ * bytes, so it can key a cache. Writes at most cap bytes to out.
+ * Returns: The full length, like snprintf
+*/
+size_t filter_key(const vdb_filter_t *filter, uint8_t *out, size_t cap);
+
+#endif /* VDB_FILTER_INDEX_H */
@@ -0,0 +1,1228 @@
+/**
+ * hnsw.c - HNSW graph construction, search and persistence
+ *
+ * Follows Malkov & Yashunin: exponentially distributed node levels,
+ * greedy descent through the upper layers, beam search (ef) on the
+ * target layer, and the neighbour-diversity heuristic when choosing and
+ * trimming links.
+*/
+
+#include "hnsw.h"
+#include "vdb/distance.h"
+#include "scratch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* On-disk format */
+#define HNSW_MAGIC 0x57534E48u /* "HNSW" */
+#define HNSW_VERSION 1u
+
+/* Safety cap on levels (probability of reaching it is negligible) */
+#define HNSW_MAX_LEVEL 31
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t m;
+    uint32_t m0;
+    uint32_t ef_construction;
+    uint32_t ef_search;
+    uint32_t num_nodes;
+    uint32_t entry_point;
+    int32_t max_level;
+    uint32_t reserved;
+    uint64_t upper_len; // uint32 entries in the upper links array
+    uint64_t rng_state;
+} __attribute__((packed)) hnsw_file_header_t;
+
+/**
+ * Pinned vectors of layers >= min_level
+ * Open addressing over node + 1 (0 = empty slot); the vector of
+ * nodes[i] is at vectors + slots[i] * dim.
+*/
+typedef struct {
+    int32_t min_level; // past max_level = nothing fit
+    uint32_t dim;
+    vdb_metric_t metric;
+    vdb_dim_kernel_t kernel;
+    uint32_t mask; // table size - 1
+    uint32_t *nodes;
+    uint32_t *slots;
+    float *vectors;
+    size_t bytes;
+} hnsw_pin_t;
+
+struct hnsw_index {
+    uint32_t m; // max links per node on layers >= 1
+    uint32_t m0; // max links per node on layer 0
+    uint32_t ef_construction;
+    uint32_t ef_search;
+    double level_mult; // 1 / ln(m)
+
+    uint32_t num_nodes;
+    uint32_t capacity;
+    uint32_t entry_point;
+    int32_t max_level; // -1 while empty
+
+    uint8_t *levels;
+    uint32_t *upper_offsets;
+    uint32_t *links0;
+    uint32_t *upper;
+    size_t upper_len;
+    size_t upper_cap;
+
+    uint64_t rng_state;
+
+    /* Concurrent build only: per-node neighbour-list locks, and the
+     * entry point / max level */
+    atomic_uchar *locks;
+    pthread_mutex_t entry_lock;
+
+    /* Pinned top layers, set once by the first hnsw_pin_upper */
+    _Atomic(hnsw_pin_t*) pin;
+};
+
+/* ------------------------------------------------------------------ */
+/* Visited set: per-thread, generation-tagged so it never needs a clear */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint32_t *tags;
+    size_t capacity;
+    uint32_t generation;
+    vdb_topk_entry_t *heap; // candidate heap storage, kept between searches
+    size_t heap_cap;
+} visited_set_t;
+
+static pthread_key_t visited_key;
+static pthread_once_t visited_once = PTHREAD_ONCE_INIT;
+
+static void visited_free(void *ptr) {
+    visited_set_t *set = (visited_set_t*)ptr;
+    if (set != NULL) {
+        free(set->tags);
+        free(set->heap);
+        free(set);
+    }
+}
+
+static void visited_key_init(void) {
+    pthread_key_create(&visited_key, visited_free);
+}
+
+/* Forget every mark in O(1) */
+static void visited_reset(visited_set_t *set) {
+    if (++set->generation == 0) {
+        // wrapped: tags from 2^32 searches ago would look fresh
+        memset(set->tags, 0, set->capacity * sizeof(uint32_t));
+        set->generation = 1;
+    }
+}
+
+/**
+ * Get this thread's visited set, cleared, sized for n nodes
+*/
+static visited_set_t *visited_acquire(size_t n) {
+    pthread_once(&visited_once, visited_key_init);
+    visited_set_t *set = (visited_set_t*)pthread_getspecific(visited_key);
+    if (set == NULL) {
+        set = (visited_set_t*)calloc(1, sizeof(visited_set_t));
+        if (set == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(visited_key, set);
+    }
+
+    if (set->capacity < n) {
+        size_t cap = set->capacity ? set->capacity : 1024;
+        while (cap < n) {
+            cap *= 2;
+        }
+        uint32_t *tags = (uint32_t*)calloc(cap, sizeof(uint32_t));
+        if (tags == NULL) {
+            return NULL;
+        }
+        free(set->tags);
+        set->tags = tags;
+        set->capacity = cap;
+        set->generation = 0;
+    }
+
+    visited_reset(set);
+    return set;
+}
+
+/* Returns true if node was already visited; marks it otherwise */
+static inline bool visited_test_and_set(visited_set_t *set, uint32_t node) {
+    if (set->tags[node] == set->generation) {
+        return true;
+    }
+    set->tags[node] = set->generation;
+    return false;
+}
+
+/* ------------------------------------------------------------------ */
+/* Candidate min-heap (closest first), growable                        */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    vdb_topk_entry_t *e;
+    size_t size;
+    size_t cap;
+} min_heap_t;
+
+static bool min_heap_push(min_heap_t *h, float distance, uint32_t node) {
+    if (h->size == h->cap) {
+        size_t cap = h->cap ? h->cap * 2 : 64;
+        vdb_topk_entry_t *e = (vdb_topk_entry_t*)realloc(h->e, cap * sizeof(vdb_topk_entry_t));
+        if (e == NULL) {
+            return false;
+        }
+        h->e = e;
+        h->cap = cap;
+    }
+
+    size_t i = h->size++;
+    h->e[i].distance = distance;
+    h->e[i].row = node;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!topk_worse(&h->e[parent], &h->e[i])) {
+            break;
+        }
+        vdb_topk_entry_t tmp = h->e[i];
+        h->e[i] = h->e[parent];
+        h->e[parent] = tmp;
+        i = parent;
+    }
+    return true;
+}
+
+static vdb_topk_entry_t min_heap_pop(min_heap_t *h) {
+    vdb_topk_entry_t top = h->e[0];
+    h->e[0] = h->e[--h->size];
+    size_t i = 0;
+    for (;;) {
+        size_t left = 2 * i + 1;
+        size_t best = i;
+        if (left < h->size && topk_worse(&h->e[best], &h->e[left])) {
+            best = left;
+        }
+        if (left + 1 < h->size && topk_worse(&h->e[best], &h->e[left + 1])) {
+            best = left + 1;
+        }
+        if (best == i) {
+            break;
+        }
+        vdb_topk_entry_t tmp = h->e[i];
+        h->e[i] = h->e[best];
+        h->e[best] = tmp;
+        i = best;
+    }
+    return top;
+}
+
+/* ------------------------------------------------------------------ */
+/* Graph helpers                                                       */
+/* ------------------------------------------------------------------ */
+
+static inline uint32_t *node_links(const hnsw_index_t *index, uint32_t node, int level) {
+    if (level == 0) {
+        return index->links0 + (size_t)node * (1 + index->m0);
+    }
+    return index->upper + index->upper_offsets[node] + (size_t)(level - 1) * (1 + index->m);
+}
+
+static inline uint32_t max_links(const hnsw_index_t *index, int level) {
+    return level == 0 ? index->m0 : index->m;
+}
+
+/* Per-node spinlock; only concurrent inserts take it */
+static inline void node_lock(const hnsw_index_t *index, uint32_t node) {
+    unsigned spins = 0;
+    while (atomic_exchange_explicit(&index->locks[node], 1, memory_order_acquire)) {
+        if (++spins % 64 == 0) {
+            sched_yield(); // holder may be descheduled; don't burn its slice
+        }
+    }
+}
+
+static inline void node_unlock(const hnsw_index_t *index, uint32_t node) {
+    atomic_store_explicit(&index->locks[node], 0, memory_order_release);
+}
+
+/**
+ * Neighbour list of a node: the list itself, or a copy taken under the
+ * node's lock when other threads may be rewriting it
+*/
+static inline const uint32_t *read_links(const hnsw_index_t *index, uint32_t node, int level,
+                                         bool concurrent, uint32_t *buf) {
+    const uint32_t *links = node_links(index, node, level);
+    if (!concurrent) {
+        return links;
+    }
+    node_lock(index, node);
+    memcpy(buf, links, (1 + (size_t)links[0]) * sizeof(uint32_t));
+    node_unlock(index, node);
+    return buf;
+}
+
+static float space_distance(const hnsw_space_t *space, uint32_t a, uint32_t b) {
+    const uint8_t *row_a = space->base + (size_t)a * space->stride;
+    const uint8_t *row_b = space->base + (size_t)b * space->stride;
+    if (space->element == VDB_ELEMENT_F32) {
+        // a float32 row is a query as it is
+        return vdb_distance_kernel(space->kernel, space->metric, VDB_ELEMENT_F32,
+                                   (const float*)row_a, row_b, space->dim);
+    }
+    return vdb_distance_rows(space->metric, space->element, row_a, row_b, space->dim);
+}
+
+static float float_query_distance(const hnsw_query_t *query, uint32_t node) {
+    const hnsw_float_query_t *q = (const hnsw_float_query_t*)query->ctx;
+    return vdb_distance_kernel(q->space->kernel, q->space->metric, q->space->element, q->vector,
+                               q->space->base + (size_t)node * q->space->stride,
+                               q->space->dim);
+}
+
+void hnsw_float_query_init(hnsw_query_t *query, hnsw_float_query_t *ctx,
+                           const hnsw_space_t *space, const float *vector) {
+    ctx->space = space;
+    ctx->vector = vector;
+    query->distance = float_query_distance;
+    query->ctx = ctx;
+    query->vector = vector;
+}
+
+/* ------------------------------------------------------------------ */
+/* Pinned top layers                                                   */
+/* ------------------------------------------------------------------ */
+
+static inline uint32_t pin_hash(uint32_t node) {
+    return node * 0x9E3779B1u;
+}
+
+/* Pinned vector of a node on a pinned layer */
+static const float *pin_vector(const hnsw_pin_t *pin, uint32_t node) {
+    for (uint32_t i = pin_hash(node) & pin->mask; ; i = (i + 1) & pin->mask) {
+        if (pin->nodes[i] == node + 1) {
+            return pin->vectors + (size_t)pin->slots[i] * pin->dim;
+        }
+    }
+}
+
+typedef struct {
+    const hnsw_pin_t *pin;
+    const float *vector;
+} pinned_query_t;
+
+static float pinned_distance(const hnsw_query_t *query, uint32_t node) {
+    const pinned_query_t *q = (const pinned_query_t*)query->ctx;
+    return vdb_distance_kernel(q->pin->kernel, q->pin->metric, VDB_ELEMENT_F32, q->vector,
+                               pin_vector(q->pin, node), q->pin->dim);
+}
+
+static void pin_free(hnsw_pin_t *pin) {
+    if (pin != NULL) {
+        free(pin->nodes);
+        free(pin->slots);
+        free(pin->vectors);
+        free(pin);
+    }
+}
+
+/**
+ * Copy the vectors of layers >= min_level (count nodes) out of space
+*/
+static hnsw_pin_t *pin_build(const hnsw_index_t *index, const hnsw_space_t *space,
+                             int32_t min_level, uint32_t count) {
+    hnsw_pin_t *pin = (hnsw_pin_t*)calloc(1, sizeof(hnsw_pin_t));
+    if (pin == NULL) {
+        return NULL;
+    }
+    pin->min_level = min_level;
+    pin->dim = space->dim;
+    pin->metric = space->metric;
+    pin->kernel = space->kernel;
+    if (count == 0) {
+        return pin;
+    }
+
+    uint32_t table = 2;
+    while (table < 2 * count) {
+        table <<= 1;
+    }
+    pin->mask = table - 1;
+    pin->nodes = (uint32_t*)calloc(table, sizeof(uint32_t));
+    pin->slots = (uint32_t*)malloc(table * sizeof(uint32_t));
+    pin->vectors = (float*)malloc((size_t)count * space->dim * sizeof(float));
+    if (pin->nodes == NULL || pin->slots == NULL || pin->vectors == NULL) {
+        pin_free(pin);
+        return NULL;
+    }
+    pin->bytes = (size_t)table * 2 * sizeof(uint32_t) + (size_t)count * space->dim * sizeof(float);
+
+    uint32_t slot = 0;
+    for (uint32_t node = 0; node < index->num_nodes; node++) {
+        if (index->levels[node] < min_level) {
+            continue;
+        }
+        uint32_t i = pin_hash(node) & pin->mask;
+        while (pin->nodes[i] != 0) {
+            i = (i + 1) & pin->mask;
+        }
+        pin->nodes[i] = node + 1;
+        pin->slots[i] = slot;
+        vdb_convert_to_f32(space->element, space->base + (size_t)node * space->stride,
+                           pin->vectors + (size_t)slot * space->dim, space->dim);
+        slot++;
+    }
+    return pin;
+}
+
+/**
+ * Draw a level from the exponential distribution (xorshift64*)
+*/
+static int random_level(hnsw_index_t *index) {
+    uint64_t x = index->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    index->rng_state = x;
+    uint64_t r = x * 0x2545F4914F6CDD1DULL;
+
+    double u = ((double)(r >> 11) + 1.0) / 9007199254740993.0; // (0, 1]
+    int level = (int)(-log(u) * index->level_mult);
+    return level > HNSW_MAX_LEVEL ? HNSW_MAX_LEVEL : level;
+}
+
+/**
+ * Greedy walk on one layer: move to the closest neighbour until stuck
+*/
+static void greedy_descend(const hnsw_index_t *index, const hnsw_query_t *query, int level,
+                           bool concurrent, uint32_t *buf, uint32_t *node, float *distance,
+                           hnsw_search_counts_t *counts) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        const uint32_t *links = read_links(index, *node, level, concurrent, buf);
+        counts->hops++;
+        counts->distances += links[0];
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            float d = query->distance(query, links[i]);
+            if (d < *distance) {
+                *distance = d;
+                *node = links[i];
+                changed = true;
+            }
+        }
+    }
+}
+
+/**
+ * Beam search on one layer starting at entry
+ * results must be initialized with capacity ef. Nodes rows doesn't
+ * admit (as row node + row_base; NULL admits all) are expanded but
+ * never become results.
+*/
+static vdb_status_t search_layer(const hnsw_index_t *index, const hnsw_query_t *query,
+                                 uint32_t entry, float entry_distance, int level,
+                                 bool concurrent, uint32_t *buf, const row_set_t *rows,
+                                 uint64_t row_base, vdb_topk_t *results, visited_set_t *visited,
+                                 hnsw_search_counts_t *counts) {
+    // the thread's heap storage, handed back (maybe grown) at the end
+    min_heap_t candidates = { visited->heap, 0, visited->heap_cap };
+    vdb_status_t status = VDB_OK;
+    visited_test_and_set(visited, entry);
+    if (row_set_admits(rows, row_base + entry)) {
+        topk_push(results, entry_distance, entry);
+    }
+    if (!min_heap_push(&candidates, entry_distance, entry)) {
+        status = VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    while (status == VDB_OK && candidates.size > 0) {
+        vdb_topk_entry_t current = min_heap_pop(&candidates);
+        if (current.distance > topk_threshold(results)) {
+            break; // every remaining candidate is worse than our worst result
+        }
+
+        const uint32_t *links = read_links(index, (uint32_t)current.row, level, concurrent, buf);
+        counts->hops++;
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            uint32_t neighbour = links[i];
+            if (visited_test_and_set(visited, neighbour)) {
+                continue;
+            }
+            counts->distances++;
+            float d = query->distance(query, neighbour);
+            if (d < topk_threshold(results)) {
+                if (row_set_admits(rows, row_base + neighbour)) {
+                    topk_push(results, d, neighbour);
+                }
+                if (!min_heap_push(&candidates, d, neighbour)) {
+                    status = VDB_ERROR_OUT_OF_MEMORY;
+                    break;
+                }
+            }
+        }
+    }
+
+    visited->heap = candidates.e;
+    visited->heap_cap = candidates.cap;
+    return status;
+}
+
+/**
+ * Neighbour-diversity heuristic
+ * cands is sorted best-first by distance to the base node; keeps a
+ * candidate only if it is closer to the base than to anything kept so
+ * far. Writes up to max_out node ids into out, returns how many.
+*/
+static uint32_t select_neighbours(const hnsw_space_t *space, const vdb_topk_entry_t *cands,
+                                  size_t num_cands, uint32_t max_out, uint32_t *out) {
+    uint32_t selected = 0;
+    for (size_t i = 0; i < num_cands && selected < max_out; i++) {
+        uint32_t c = (uint32_t)cands[i].row;
+        bool keep = true;
+        for (uint32_t j = 0; j < selected; j++) {
+            if (space_distance(space, c, out[j]) < cands[i].distance) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            out[selected++] = c;
+        }
+    }
+    return selected;
+}
+
+/**
+ * Per-inserter scratch space, sized once per insert or once per build task
+*/
+typedef struct {
+    vdb_topk_entry_t *entries; // ef_construction beam
+    vdb_topk_entry_t *cands; // m0 + 1 when re-pruning a full list
+    uint32_t *selected; // m
+    uint32_t *links; // 1 + m0, copy of a neighbour list
+    float *vector; // dim, the new node widened (half precision spaces only)
+} insert_scratch_t;
+
+static void scratch_free(insert_scratch_t *scratch) {
+    free(scratch->entries);
+    free(scratch->cands);
+    free(scratch->selected);
+    free(scratch->links);
+    free(scratch->vector);
+}
+
+static vdb_status_t scratch_init(const hnsw_index_t *index, const hnsw_space_t *space,
+                                 insert_scratch_t *scratch) {
+    scratch->entries = (vdb_topk_entry_t*)malloc(index->ef_construction * sizeof(vdb_topk_entry_t));
+    scratch->cands = (vdb_topk_entry_t*)malloc((index->m0 + 1) * sizeof(vdb_topk_entry_t));
+    scratch->selected = (uint32_t*)malloc(index->m * sizeof(uint32_t));
+    scratch->links = (uint32_t*)malloc((1 + index->m0) * sizeof(uint32_t));
+    scratch->vector = space->element != VDB_ELEMENT_F32 ? (float*)malloc(space->dim * sizeof(float)) : NULL;
+    if (scratch->entries == NULL || scratch->cands == NULL ||
+        scratch->selected == NULL || scratch->links == NULL ||
+        (space->element != VDB_ELEMENT_F32 && scratch->vector == NULL)) {
+        scratch_free(scratch);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Add a back-link from neighbour to node, re-pruning a full list
+*/
+static void add_back_link(hnsw_index_t *index, const hnsw_space_t *space, uint32_t neighbour,
+                          uint32_t node, int level, bool concurrent, insert_scratch_t *scratch) {
+    if (concurrent) {
+        node_lock(index, neighbour);
+    }
+
+    uint32_t *links = node_links(index, neighbour, level);
+    uint32_t cap = max_links(index, level);
+    if (links[0] < cap) {
+        links[++links[0]] = node;
+    } else {
+        vdb_topk_t heap;
+        topk_init(&heap, scratch->cands, cap + 1);
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            topk_push(&heap, space_distance(space, neighbour, links[i]), links[i]);
+        }
+        topk_push(&heap, space_distance(space, neighbour, node), node);
+        topk_sort(&heap);
+        links[0] = select_neighbours(space, heap.entries, heap.size, cap, links + 1);
+    }
+
+    if (concurrent) {
+        node_unlock(index, neighbour);
+    }
+}
+
+/**
+ * Make room for count more nodes whose levels sum to upper_layers
+*/
+static vdb_status_t ensure_capacity(hnsw_index_t *index, uint32_t count, size_t upper_layers) {
+    if ((uint64_t)index->num_nodes + count > index->capacity) {
+        uint64_t cap = index->capacity ? index->capacity : 1024;
+        while (cap < (uint64_t)index->num_nodes + count) {
+            cap *= 2;
+        }
+        if (cap > UINT32_MAX) {
+            cap = UINT32_MAX;
+        }
+
+        uint8_t *levels = (uint8_t*)realloc(index->levels, cap);
+        if (levels == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        index->levels = levels;
+
+        uint32_t *offsets = (uint32_t*)realloc(index->upper_offsets, cap * sizeof(uint32_t));
+        if (offsets == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        index->upper_offsets = offsets;
+
+        uint32_t *links0 = (uint32_t*)realloc(index->links0,
+                                              cap * (1 + index->m0) * sizeof(uint32_t));
+        if (links0 == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        index->links0 = links0;
+
+        atomic_uchar *locks = (atomic_uchar*)realloc(index->locks, cap * sizeof(atomic_uchar));
+        if (locks == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        for (uint64_t i = index->capacity; i < cap; i++) {
+            atomic_init(&locks[i], 0);
+        }
+        index->locks = locks;
+        index->capacity = (uint32_t)cap;
+    }
+
+    size_t need = index->upper_len + upper_layers * (1 + index->m);
+    if (need > index->upper_cap) {
+        size_t cap = index->upper_cap ? index->upper_cap : 4096;
+        while (cap < need) {
+            cap *= 2;
+        }
+        uint32_t *upper = (uint32_t*)realloc(index->upper, cap * sizeof(uint32_t));
+        if (upper == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        index->upper = upper;
+        index->upper_cap = cap;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Append an unlinked node of the given level (capacity already reserved)
+*/
+static uint32_t reserve_node(hnsw_index_t *index, int level) {
+    uint32_t node = index->num_nodes++;
+    index->levels[node] = (uint8_t)level;
+    index->upper_offsets[node] = (uint32_t)index->upper_len;
+    index->upper_len += (size_t)level * (1 + index->m);
+    for (int l = 0; l <= level; l++) {
+        node_links(index, node, l)[0] = 0;
+    }
+    return node;
+}
+
+/**
+ * Link a reserved node into the graph
+ *
+ * With concurrent set, other threads are linking other nodes at the same
+ * time: neighbour lists are only touched under their node's lock, and
+ * entry_lock guards the entry point. A node that will become the new top
+ * of the graph keeps entry_lock for its whole insertion (rare - about one
+ * node in m per level) so nobody descends from a half-linked entry.
+*/
+static vdb_status_t link_node(hnsw_index_t *index, const hnsw_space_t *space, uint32_t node,
+                              bool concurrent, insert_scratch_t *scratch) {
+    int level = index->levels[node];
+
+    if (concurrent) {
+        pthread_mutex_lock(&index->entry_lock);
+    }
+    int max_level = index->max_level;
+    uint32_t entry = index->entry_point;
+    bool new_top = level > max_level;
+    if (concurrent && !new_top) {
+        pthread_mutex_unlock(&index->entry_lock);
+    }
+
+    vdb_status_t status = VDB_OK;
+    if (max_level >= 0) {
+        visited_set_t *visited = visited_acquire(index->num_nodes);
+        if (visited == NULL) {
+            status = VDB_ERROR_OUT_OF_MEMORY;
+        }
+
+        const void *row = space->base + (size_t)node * space->stride;
+        if (scratch->vector != NULL) {
+            vdb_convert_to_f32(space->element, row, scratch->vector, space->dim);
+            row = scratch->vector;
+        }
+        hnsw_float_query_t qctx;
+        hnsw_query_t query;
+        hnsw_float_query_init(&query, &qctx, space, (const float*)row);
+
+        /* descend greedily through the layers above the new node */
+        hnsw_search_counts_t counts = { 0, 0 }; // builds aren't counted
+        float entry_distance = query.distance(&query, entry);
+        for (int l = max_level; l > level && status == VDB_OK; l--) {
+            greedy_descend(index, &query, l, concurrent, scratch->links, &entry, &entry_distance, &counts);
+        }
+
+        /* link on every layer the node lives on */
+        int top = level < max_level ? level : max_level;
+        for (int l = top; l >= 0 && status == VDB_OK; l--) {
+            vdb_topk_t results;
+            topk_init(&results, scratch->entries, index->ef_construction);
+            visited_reset(visited);
+            status = search_layer(index, &query, entry, entry_distance, l,
+                                  concurrent, scratch->links, NULL, 0, &results, visited, &counts);
+            if (status != VDB_OK) {
+                break;
+            }
+            topk_sort(&results);
+
+            uint32_t count = select_neighbours(space, results.entries, results.size,
+                                               index->m, scratch->selected);
+            uint32_t *links = node_links(index, node, l);
+            if (concurrent) {
+                node_lock(index, node);
+            }
+            memcpy(links + 1, scratch->selected, count * sizeof(uint32_t));
+            links[0] = count;
+            if (concurrent) {
+                node_unlock(index, node);
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                add_back_link(index, space, scratch->selected[i], node, l, concurrent, scratch);
+            }
+
+            // closest node found seeds the next layer down
+            entry = (uint32_t)results.entries[0].row;
+            entry_distance = results.entries[0].distance;
+        }
+    }
+
+    if (new_top) {
+        index->entry_point = node;
+        index->max_level = level;
+        if (concurrent) {
+            pthread_mutex_unlock(&index->entry_lock);
+        }
+    }
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Public (internal) API                                               */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t hnsw_create(const vdb_hnsw_params_t *params, hnsw_index_t **out_index) {
+    hnsw_index_t *index = (hnsw_index_t*)calloc(1, sizeof(hnsw_index_t));
+    if (index == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    index->m = params->m;
+    index->m0 = params->m * 2;
+    index->ef_construction = params->ef_construction;
+    index->ef_search = params->ef_search;
+    index->level_mult = 1.0 / log((double)params->m);
+    index->max_level = -1;
+    index->rng_state = 0x9E3779B97F4A7C15ULL;
+    pthread_mutex_init(&index->entry_lock, NULL);
+    atomic_init(&index->pin, NULL);
+
+    *out_index = index;
+    return VDB_OK;
+}
+
+void hnsw_destroy(hnsw_index_t **index) {
+    if (index == NULL || *index == NULL) {
+        return;
+    }
+    hnsw_index_t *idx = *index;
+    pthread_mutex_destroy(&idx->entry_lock);
+    pin_free(atomic_load(&idx->pin));
+    free(idx->levels);
+    free(idx->upper_offsets);
+    free(idx->links0);
+    free(idx->upper);
+    free(idx->locks);
+    free(idx);
+    *index = NULL;
+}
+
+vdb_status_t hnsw_insert(hnsw_index_t *index, const hnsw_space_t *space) {
+    if (index->num_nodes == UINT32_MAX) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    int level = random_level(index);
+    insert_scratch_t scratch;
+    vdb_status_t status = ensure_capacity(index, 1, (size_t)level);
+    if (status == VDB_OK) {
+        status = scratch_init(index, space, &scratch);
+    }
+    if (status != VDB_OK) {
+        return status; // nothing changed
+    }
+
+    status = link_node(index, space, reserve_node(index, level), false, &scratch);
+    scratch_free(&scratch);
+    return status;
+}
+
+typedef struct {
+    hnsw_index_t *index;
+    const hnsw_space_t *space;
+    insert_scratch_t *scratch; // one per task
+    atomic_uint next_node;
+    uint32_t end_node;
+    atomic_int status;
+} parallel_build_t;
+
+/**
+ * Build task: keep claiming the next unlinked node until none are left
+*/
+static void parallel_build_task(void *ctx, size_t task) {
+    parallel_build_t *build = (parallel_build_t*)ctx;
+    for (;;) {
+        uint32_t node = atomic_fetch_add_explicit(&build->next_node, 1, memory_order_relaxed);
+        if (node >= build->end_node) {
+            return;
+        }
+        vdb_status_t status = link_node(build->index, build->space, node, true, &build->scratch[task]);
+        if (status != VDB_OK) {
+            atomic_store(&build->status, (int)status);
+            return;
+        }
+    }
+}
+
+vdb_status_t hnsw_insert_parallel(hnsw_index_t *index, const hnsw_space_t *space,
+                                  uint32_t count, vdb_thread_pool_t *pool) {
+    if (count <= index->num_nodes) {
+        return VDB_OK;
+    }
+
+    /* draw every level up front (same sequence as one-by-one inserts),
+     * then size the arrays once - nothing may move while tasks run */
+    uint32_t first = index->num_nodes;
+    uint32_t n = count - first;
+    uint8_t *levels = (uint8_t*)malloc(n);
+    if (levels == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    uint64_t saved_rng = index->rng_state;
+    size_t upper_layers = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        levels[i] = (uint8_t)random_level(index);
+        upper_layers += levels[i];
+    }
+
+    size_t num_tasks = vdb_thread_pool_concurrency(pool);
+    if (num_tasks > n) {
+        num_tasks = n;
+    }
+    insert_scratch_t *scratch = (insert_scratch_t*)calloc(num_tasks, sizeof(insert_scratch_t));
+    vdb_status_t status = scratch != NULL ? ensure_capacity(index, n, upper_layers)
+                                          : VDB_ERROR_OUT_OF_MEMORY;
+    size_t ready = 0;
+    while (status == VDB_OK && ready < num_tasks) {
+        status = scratch_init(index, space, &scratch[ready]);
+        ready += status == VDB_OK;
+    }
+    if (status != VDB_OK) {
+        for (size_t t = 0; t < ready; t++) {
+            scratch_free(&scratch[t]);
+        }
+        free(scratch);
+        free(levels);
+        index->rng_state = saved_rng; // nothing changed
+        return status;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        reserve_node(index, levels[i]);
+    }
+    free(levels);
+
+    /* an empty graph needs its first node before anyone can descend */
+    uint32_t start = first;
+    if (index->max_level < 0) {
+        status = link_node(index, space, start++, false, &scratch[0]);
+    }
+
+    parallel_build_t build = { index, space, scratch, start, count, VDB_OK };
+    if (status == VDB_OK) {
+        vdb_thread_pool_run(pool, num_tasks, parallel_build_task, &build);
+        status = (vdb_status_t)atomic_load(&build.status);
+    }
+
+    for (size_t t = 0; t < num_tasks; t++) {
+        scratch_free(&scratch[t]);
+    }
+    free(scratch);
+    return status;
+}
+
+vdb_status_t hnsw_search(const hnsw_index_t *index, const hnsw_query_t *query, uint32_t ef,
+                         const row_set_t *rows, uint64_t row_base, vdb_topk_t *out,
+                         hnsw_search_counts_t *counts) {
+    if (index->max_level < 0 || out->k == 0) {
+        return VDB_OK;
+    }
+    if (ef < out->k) {
+        ef = (uint32_t)out->k;
+    }
+
+    hnsw_search_counts_t local = { 0, 1 };
+    uint32_t entry = index->entry_point;
+    int level = index->max_level;
+
+    // through the pinned layers on the copies, then on with the query's own distances
+    const hnsw_pin_t *pin = query->vector != NULL ? atomic_load_explicit(&index->pin, memory_order_acquire) : NULL;
+    if (pin != NULL && level >= pin->min_level && level > 0) {
+        pinned_query_t pctx = { pin, query->vector };
+        hnsw_query_t pinned = { pinned_distance, &pctx, query->vector };
+        float d = pinned_distance(&pinned, entry);
+        for (; level >= pin->min_level && level > 0; level--) {
+            greedy_descend(index, &pinned, level, false, NULL, &entry, &d, &local);
+        }
+        local.distances++;
+    }
+    float entry_distance = query->distance(query, entry);
+    for (; level > 0; level--) {
+        greedy_descend(index, query, level, false, NULL, &entry, &entry_distance, &local);
+    }
+
+    visited_set_t *visited = visited_acquire(index->num_nodes);
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    vdb_topk_entry_t *entries = (vdb_topk_entry_t*)vdb_arena_alloc(arena, ef * sizeof(vdb_topk_entry_t));
+    if (visited == NULL || entries == NULL) {
+        vdb_arena_rewind(arena, mark);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    vdb_topk_t beam;
+    topk_init(&beam, entries, ef);
+    vdb_status_t status = search_layer(index, query, entry, entry_distance, 0,
+                                       false, NULL, rows, row_base, &beam, visited, &local);
+    for (size_t i = 0; i < beam.size && status == VDB_OK; i++) {
+        topk_push(out, beam.entries[i].distance, row_base + beam.entries[i].row);
+    }
+    if (counts != NULL) {
+        counts->hops += local.hops;
+        counts->distances += local.distances;
+    }
+
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+uint32_t hnsw_count(const hnsw_index_t *index) {
+    return index->num_nodes;
+}
+
+uint64_t hnsw_file_bytes(const hnsw_index_t *index) {
+    uint64_t n = index->num_nodes;
+    return sizeof(hnsw_file_header_t) + n + n * sizeof(uint32_t) +
+        n * sizeof(uint32_t) * (1 + index->m0) + index->upper_len * sizeof(uint32_t);
+}
+
+void hnsw_get_params(const hnsw_index_t *index, vdb_hnsw_params_t *out_params) {
+    out_params->m = index->m;
+    out_params->ef_construction = index->ef_construction;
+    out_params->ef_search = index->ef_search;
+}
+
+void hnsw_set_ef_search(hnsw_index_t *index, uint32_t ef_search) {
+    index->ef_search = ef_search;
+}
+
+vdb_status_t hnsw_pin_upper(hnsw_index_t *index, const hnsw_space_t *space, size_t max_bytes) {
+    if (max_bytes == 0 || index->max_level < 1 ||
+        atomic_load_explicit(&index->pin, memory_order_acquire) != NULL) {
+        return VDB_OK;
+    }
+
+    // nodes per top layer, then the lowest layer whose nodes (and the
+    // ones above) fit; the table takes up to four slots of two uint32 a node
+    uint32_t at_level[HNSW_MAX_LEVEL + 1] = { 0 };
+    for (uint32_t node = 0; node < index->num_nodes; node++) {
+        at_level[index->levels[node]]++;
+    }
+    size_t per_node = (size_t)space->dim * sizeof(float) + 8 * sizeof(uint32_t);
+    int32_t min_level = index->max_level + 1;
+    uint32_t count = 0, above = 0;
+    for (int32_t l = index->max_level; l >= 1; l--) {
+        above += at_level[l];
+        if ((size_t)above * per_node > max_bytes) {
+            break;
+        }
+        min_level = l;
+        count = above;
+    }
+
+    hnsw_pin_t *pin = pin_build(index, space, min_level, count);
+    if (pin == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    hnsw_pin_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&index->pin, &expected, pin,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        pin_free(pin); // another search pinned it first
+    }
+    return VDB_OK;
+}
+
+void hnsw_unpin(hnsw_index_t *index) {
+    pin_free(atomic_exchange(&index->pin, NULL));
+}
+
+size_t hnsw_pinned_bytes(const hnsw_index_t *index) {
+    const hnsw_pin_t *pin = atomic_load_explicit(&index->pin, memory_order_acquire);
+    return pin != NULL ? pin->bytes : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Remapping (compaction)                                              */
+/* ------------------------------------------------------------------ */
+
+static bool links_contain(const uint32_t *links, uint32_t n, uint32_t node) {
+    for (uint32_t i = 0; i < n; i++) {
+        if (links[i] == node) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A node's links on one layer, renumbered through new_ids
+ * Dropped neighbours are left out, and the room they leave is refilled
+ * from their own links (two hops away), so the neighbourhood around a
+ * dropped node stays connected. Returns how many were written to out.
+*/
+static uint32_t remap_links(const hnsw_index_t *index, const uint32_t *new_ids, uint32_t node,
+                            int level, uint32_t *out) {
+    const uint32_t *links = node_links(index, node, level);
+    uint32_t max = max_links(index, level);
+    uint32_t n = 0;
+    for (uint32_t i = 1; i <= links[0]; i++) {
+        if (new_ids[links[i]] != HNSW_REMAP_DROPPED) {
+            out[n++] = new_ids[links[i]];
+        }
+    }
+
+    for (uint32_t i = 1; i <= links[0] && n < max; i++) {
+        if (new_ids[links[i]] != HNSW_REMAP_DROPPED) {
+            continue;
+        }
+        const uint32_t *hop = node_links(index, links[i], level);
+        for (uint32_t j = 1; j <= hop[0] && n < max; j++) {
+            uint32_t id = new_ids[hop[j]];
+            if (hop[j] != node && id != HNSW_REMAP_DROPPED && !links_contain(out, n, id)) {
+                out[n++] = id;
+            }
+        }
+    }
+    return n;
+}
+
+vdb_status_t hnsw_remap(const hnsw_index_t *index, const uint32_t *new_ids, hnsw_index_t **out_index) {
+    vdb_hnsw_params_t params;
+    hnsw_get_params(index, &params);
+    hnsw_index_t *out = NULL;
+    vdb_status_t status = hnsw_create(&params, &out);
+    if (status != VDB_OK) {
+        return status;
+    }
+    out->rng_state = index->rng_state;
+
+    uint32_t kept = 0;
+    size_t upper_layers = 0;
+    for (uint32_t node = 0; node < index->num_nodes; node++) {
+        if (new_ids[node] != HNSW_REMAP_DROPPED) {
+            kept++;
+            upper_layers += index->levels[node];
+        }
+    }
+    status = ensure_capacity(out, kept, upper_layers);
+    if (status != VDB_OK) {
+        hnsw_destroy(&out);
+        return status;
+    }
+
+    for (uint32_t node = 0; node < index->num_nodes; node++) {
+        if (new_ids[node] == HNSW_REMAP_DROPPED) {
+            continue;
+        }
+        int level = index->levels[node];
+        uint32_t id = reserve_node(out, level); // == new_ids[node]
+        for (int l = 0; l <= level; l++) {
+            uint32_t *links = node_links(out, id, l);
+            links[0] = remap_links(index, new_ids, node, l, links + 1);
+        }
+        // the first node on the top layer, unless the old entry survives
+        if (level > out->max_level) {
+            out->max_level = level;
+            out->entry_point = id;
+        }
+    }
+    if (index->num_nodes > 0 && new_ids[index->entry_point] != HNSW_REMAP_DROPPED) {
+        out->entry_point = new_ids[index->entry_point];
+    }
+
+    *out_index = out;
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Persistence                                                         */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t hnsw_save(const hnsw_index_t *index, const char *path) {
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return VDB_ERROR_IO;
+    }
+
+    hnsw_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = HNSW_MAGIC;
+    header.version = HNSW_VERSION;
+    header.m = index->m;
+    header.m0 = index->m0;
+    header.ef_construction = index->ef_construction;
+    header.ef_search = index->ef_search;
+    header.num_nodes = index->num_nodes;
+    header.entry_point = index->entry_point;
+    header.max_level = index->max_level;
+    header.upper_len = index->upper_len;
+    header.rng_state = index->rng_state;
+
+    size_t n = index->num_nodes;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(index->levels, 1, n, fp) == n &&
+        fwrite(index->upper_offsets, sizeof(uint32_t), n, fp) == n &&
+        fwrite(index->links0, sizeof(uint32_t) * (1 + index->m0), n, fp) == n &&
+        fwrite(index->upper, sizeof(uint32_t), index->upper_len, fp) == index->upper_len;
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Check every link points at an existing node
+*/
+static bool links_valid(const hnsw_index_t *index) {
+    for (uint32_t node = 0; node < index->num_nodes; node++) {
+        uint32_t level = index->levels[node];
+        if ((size_t)index->upper_offsets[node] + (size_t)level * (1 + index->m) > index->upper_len) {
+            return false;
+        }
+        for (uint32_t l = 0; l <= level; l++) {
+            const uint32_t *links = node_links(index, node, (int)l);
+            if (links[0] > max_links(index, (int)l)) {
+                return false;
+            }
+            for (uint32_t i = 1; i <= links[0]; i++) {
+                if (links[i] >= index->num_nodes) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+vdb_status_t hnsw_load(const char *path, hnsw_index_t **out_index) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    hnsw_file_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != HNSW_MAGIC || header.version != HNSW_VERSION ||
+        header.m < 2 || header.m0 != header.m * 2 ||
+        (header.num_nodes > 0 && (header.entry_point >= header.num_nodes ||
+                                  header.max_level < 0 || header.max_level > HNSW_MAX_LEVEL))) {
+        fclose(fp);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    vdb_hnsw_params_t params = { header.m, header.ef_construction, header.ef_search };
+    hnsw_index_t *index = NULL;
+    vdb_status_t status = hnsw_create(&params, &index);
+    if (status != VDB_OK) {
+        fclose(fp);
+        return status;
+    }
+
+    index->entry_point = header.entry_point;
+    index->max_level = header.num_nodes > 0 ? header.max_level : -1;
+    index->rng_state = header.rng_state;
+
+    // allocate exactly, then let inserts grow from there
+    size_t n = header.num_nodes;
+    index->capacity = header.num_nodes > 0 ? header.num_nodes : 0;
+    index->upper_cap = (size_t)header.upper_len;
+    index->levels = (uint8_t*)malloc(n > 0 ? n : 1);
+    index->upper_offsets = (uint32_t*)malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    index->links0 = (uint32_t*)malloc((n > 0 ? n : 1) * (1 + index->m0) * sizeof(uint32_t));
+    index->upper = (uint32_t*)malloc((index->upper_cap > 0 ? index->upper_cap : 1) * sizeof(uint32_t));
+    index->locks = (atomic_uchar*)calloc(n > 0 ? n : 1, sizeof(atomic_uchar)); // all unlocked
+    if (index->levels == NULL || index->upper_offsets == NULL ||
+        index->links0 == NULL || index->upper == NULL || index->locks == NULL) {
+        fclose(fp);
+        hnsw_destroy(&index);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    bool ok = fread(index->levels, 1, n, fp) == n &&
+        fread(index->upper_offsets, sizeof(uint32_t), n, fp) == n &&
+        fread(index->links0, sizeof(uint32_t) * (1 + index->m0), n, fp) == n &&
+        fread(index->upper, sizeof(uint32_t), index->upper_cap, fp) == index->upper_cap;
+    fclose(fp);
+
+    index->num_nodes = header.num_nodes;
+    index->upper_len = index->upper_cap;
+    if (!ok || !links_valid(index)) {
+        hnsw_destroy(&index);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    *out_index = index;
+    return VDB_OK;
+}
@@ -0,0 +1,162 @@
+/**
+ * hnsw.h - Internal HNSW graph (Hierarchical Navigable Small World)
+ *
+ * The graph only knows node numbers; vectors live elsewhere (the mmap'd
+ * embeddings segment) and are reached through a space/query callback,
+ * so the same graph code works over any vector representation.
+ *
+ * Nodes are numbered 0, 1, 2... in insertion order; a graph over a
+ * range of storage rows numbers them from the first row of the range.
+ *
+ * Layout (flat, no per-node allocations):
+ * - levels[n]: top layer of node n
+ * - links0: (1 + m0) uint32 per node for layer 0: [count, ids...]
+ * - upper: layers 1..levels[n] of node n stored back to back at
+ *   upper_offsets[n], (1 + m) uint32 per layer
+ * The same arrays are written verbatim to hnsw.idx.
+ *
+ * The vectors of the top layers can be pinned in memory as well (they
+ * are a small share of the nodes), so the greedy descent from the entry
+ * point never faults a row in.
+*/
+
+#ifndef VDB_HNSW_H
+#define VDB_HNSW_H
+
+#include "vdb/storage.h"
+#include "vdb/distance.h"
+#include "topk.h"
+#include "thread_pool.h"
+#include "roaring.h"
+
+typedef struct hnsw_index hnsw_index_t;
+
+/**
+ * Distance from a fixed query to a node
+ * vector is the float32 query in the graph's space, if there is one
+ * (NULL otherwise): with it, search scores the pinned upper layers
+ * itself instead of calling distance.
+*/
+typedef struct hnsw_query {
+    float (*distance)(const struct hnsw_query *query, uint32_t node);
+    const void *ctx;
+    const float *vector;
+} hnsw_query_t;
+
+/**
+ * Vectors at a fixed stride (what insertion needs)
+*/
+typedef struct {
+    vdb_metric_t metric;
+    uint32_t dim;
+    const uint8_t *base; // node n at base + n * stride
+    size_t stride; // bytes
+    vdb_element_type_t element; // of the stored vectors; queries are float32
+    vdb_dim_kernel_t kernel; // vdb_distance_kernel_for_dim(dim), or generic
+} hnsw_space_t;
+
+/**
+ * Create an empty graph. Params must already be validated.
+*/
+vdb_status_t hnsw_create(const vdb_hnsw_params_t *params, hnsw_index_t **out_index);
+
+/**
+ * Free a graph. Safe with NULL.
+*/
+void hnsw_destroy(hnsw_index_t **index);
+
+/**
+ * Insert node == hnsw_count(index); its vector must be in space
+*/
+vdb_status_t hnsw_insert(hnsw_index_t *index, const hnsw_space_t *space);
+
+/**
+ * Insert nodes [hnsw_count(index), count) from every thread of pool
+ * Nodes get the same levels as count - hnsw_count one-by-one inserts
+ * would; only the link order differs. Neighbour lists are guarded by
+ * per-node spinlocks while the build runs, so no search may run
+ * concurrently (the caller holds the index exclusively).
+*/
+vdb_status_t hnsw_insert_parallel(hnsw_index_t *index, const hnsw_space_t *space,
+                                  uint32_t count, vdb_thread_pool_t *pool);
+
+/**
+ * Work a search did, for the stats
+*/
+typedef struct {
+    uint64_t hops; // nodes whose links were read
+    uint64_t distances; // query->distance calls
+} hnsw_search_counts_t;
+
+/**
+ * Search the graph
+ * out must be initialized with capacity k; receives up to k nodes as
+ * rows row_base + node (unsorted heap order - call topk_sort), pushed
+ * on top of whatever it already holds.
+ * With a row set (allowed rows, dead rows), every node is still walked
+ * through but only admitted ones enter the beam's results, so the beam
+ * widens until it holds ef admitted nodes. NULL admits every node.
+ * counts (nullable) is added to, not overwritten.
+*/
+vdb_status_t hnsw_search(const hnsw_index_t *index, const hnsw_query_t *query, uint32_t ef,
+                         const row_set_t *rows, uint64_t row_base, vdb_topk_t *out,
+                         hnsw_search_counts_t *counts);
+
+/**
+ * Pin the vectors of the top layers: copy them, widened to float32,
+ * out of space into memory, as many layers down from the top as fit in
+ * max_bytes. Searches then descend through those layers without
+ * touching the rows. A graph is pinned once: later calls return at once
+ * until hnsw_unpin, whatever their max_bytes. Safe to call from
+ * concurrent searches (one copy wins); 0 bytes pins nothing.
+*/
+vdb_status_t hnsw_pin_upper(hnsw_index_t *index, const hnsw_space_t *space, size_t max_bytes);
+
+/**
+ * Drop the pinned vectors; no search may run (the caller holds the
+ * index exclusively)
+*/
+void hnsw_unpin(hnsw_index_t *index);
+
+/* Memory the pinned vectors take, 0 if none */
+size_t hnsw_pinned_bytes(const hnsw_index_t *index);
+
+/**
+ * Build a query over float32 vectors in a space
+ * ctx must outlive the query
+*/
+typedef struct {
+    const hnsw_space_t *space;
+    const float *vector;
+} hnsw_float_query_t;
+
+void hnsw_float_query_init(hnsw_query_t *query, hnsw_float_query_t *ctx,
+                           const hnsw_space_t *space, const float *vector);
+
+/* Accessors */
+uint32_t hnsw_count(const hnsw_index_t *index);
+uint64_t hnsw_file_bytes(const hnsw_index_t *index); // what hnsw_save writes
+void hnsw_get_params(const hnsw_index_t *index, vdb_hnsw_params_t *out_params);
+void hnsw_set_ef_search(hnsw_index_t *index, uint32_t ef_search);
+
+/* new_ids entry of a node hnsw_remap drops */
+#define HNSW_REMAP_DROPPED UINT32_MAX
+
+/**
+ * Copy the graph without some of its nodes (compaction)
+ * new_ids[n] is node n's number in the copy, or HNSW_REMAP_DROPPED;
+ * the kept nodes must be numbered 0, 1, 2... in their old order. Links
+ * to a dropped node are replaced by that node's own links where there
+ * is room, and the entry point moves if it was dropped.
+*/
+vdb_status_t hnsw_remap(const hnsw_index_t *index, const uint32_t *new_ids, hnsw_index_t **out_index);
+
+/**
+ * Persist to / load from a file
+ * Save writes path.tmp and renames it over path, so a crash mid-save
+ * leaves the previous index intact.
+*/
+vdb_status_t hnsw_save(const hnsw_index_t *index, const char *path);
+vdb_status_t hnsw_load(const char *path, hnsw_index_t **out_index);
+
+#endif /* VDB_HNSW_H */
@@ -0,0 +1,652 @@
+/**
+ * id_index.c - ID -> row hash index and its ids.idx file
+ *
+ * ids.idx is the slot array as it is in memory behind a small header,
+ * so loading it is one read and no rehashing. Rows past the ones it
+ * covers are indexed from ids.seg on open, as are the deletes still in
+ * the WAL. The dead row bitmap isn't stored: it is every row no live
+ * slot points at.
+ *
+ * index.snap holds the same slot array page-aligned, plus the dead
+ * bitmap, so an index taken from it uses the slots where they are
+ * mapped and skips rebuilding the bitmap.
+*/
+
+#include "id_index.h"
+#include "storage_internal.h"
+#include "crc32c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* On-disk format */
+#define ID_INDEX_MAGIC 0x44494456u /* "VDID" */
+#define ID_INDEX_VERSION 1u
+
+#define ID_INDEX_MIN_CAPACITY 1024
+
+typedef struct {
+    uint64_t hash;
+    uint64_t row; // ID_INDEX_NONE = empty slot
+    uint64_t meta_offset;
+} id_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rows;
+    uint64_t meta_end;
+    uint64_t deletes;
+    uint64_t capacity;
+    uint64_t used;
+    uint32_t crc; // CRC32C of the slot array
+    uint32_t reserved;
+} __attribute__((packed)) id_file_header_t;
+
+/* Header of the index.snap section; the slots and then the dead bitmap
+ * image follow, each from an INDEX_SNAP_ALIGN boundary */
+typedef struct {
+    uint64_t rows;
+    uint64_t meta_end;
+    uint64_t deletes;
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t dead_bytes;
+} id_snap_header_t;
+
+struct id_index {
+    id_slot_t *slots;
+    bool slots_mapped; // slots are taken from an index.snap mapping, not malloc'd
+    size_t capacity; // power of two
+    size_t used;
+    uint64_t rows;
+    uint64_t meta_end;
+    uint64_t deletes;
+    roaring_t dead; // superseded + deleted rows
+};
+
+static uint64_t hash_id(const char *id) {
+    uint64_t h = 1469598103934665603ull; // FNV-1a
+    for (size_t i = 0; i < VDB_ID_MAX_LEN && id[i] != '\0'; i++) {
+        h ^= (uint8_t)id[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static const char *row_id(const uint8_t *keys, uint64_t row) {
+    return (const char*)(keys + (row & ~ID_INDEX_DELETED) * VDB_ID_MAX_LEN);
+}
+
+/* Slot holding id, or the empty slot where it would go */
+static id_slot_t *probe(const id_index_t *index, const uint8_t *keys, const char *id, uint64_t hash) {
+    size_t mask = index->capacity - 1;
+    for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        id_slot_t *slot = &index->slots[i];
+        if (slot->row == ID_INDEX_NONE ||
+            (slot->hash == hash && strncmp(row_id(keys, slot->row), id, VDB_ID_MAX_LEN) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static id_slot_t *alloc_slots(size_t capacity) {
+    id_slot_t *slots = (id_slot_t*)malloc(capacity * sizeof(id_slot_t));
+    if (slots != NULL) {
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].hash = 0;
+            slots[i].row = ID_INDEX_NONE;
+            slots[i].meta_offset = 0;
+        }
+    }
+    return slots;
+}
+
+vdb_status_t id_index_create(id_index_t **out_index) {
+    if (out_index == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    id_index_t *index = (id_index_t*)calloc(1, sizeof(id_index_t));
+    if (index == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    roaring_init(&index->dead);
+    index->capacity = ID_INDEX_MIN_CAPACITY;
+    index->slots = alloc_slots(index->capacity);
+    if (index->slots == NULL) {
+        free(index);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    *out_index = index;
+    return VDB_OK;
+}
+
+static void free_slots(id_index_t *index) {
+    if (index->slots_mapped) {
+        index_snap_untake(index->slots, index->capacity * sizeof(id_slot_t));
+    } else {
+        free(index->slots);
+    }
+    index->slots = NULL;
+    index->slots_mapped = false;
+}
+
+void id_index_free(id_index_t **index) {
+    if (index == NULL || *index == NULL) {
+        return;
+    }
+    free_slots(*index);
+    roaring_free(&(*index)->dead);
+    free(*index);
+    *index = NULL;
+}
+
+uint64_t id_index_rows(const id_index_t *index) {
+    return index->rows;
+}
+
+uint64_t id_index_meta_end(const id_index_t *index) {
+    return index->meta_end;
+}
+
+uint64_t id_index_deletes(const id_index_t *index) {
+    return index->deletes;
+}
+
+const roaring_t *id_index_dead(const id_index_t *index) {
+    return &index->dead;
+}
+
+size_t id_index_memory_bytes(const id_index_t *index) {
+    return sizeof(*index) + index->capacity * sizeof(id_slot_t) + roaring_memory_bytes(&index->dead);
+}
+
+vdb_status_t id_index_reserve(id_index_t *index, uint64_t n) {
+    // keep the load under 3/4
+    uint64_t needed = (uint64_t)index->used + n;
+    if (needed * 4 <= (uint64_t)index->capacity * 3) {
+        return VDB_OK;
+    }
+    size_t capacity = index->capacity;
+    while ((uint64_t)capacity * 3 < needed * 4) {
+        capacity *= 2;
+    }
+
+    id_slot_t *slots = alloc_slots(capacity);
+    if (slots == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    // IDs are unique already, so rehashing needs no key compares
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < index->capacity; i++) {
+        const id_slot_t *slot = &index->slots[i];
+        if (slot->row != ID_INDEX_NONE) {
+            size_t j = (size_t)slot->hash & mask;
+            while (slots[j].row != ID_INDEX_NONE) {
+                j = (j + 1) & mask;
+            }
+            slots[j] = *slot;
+        }
+    }
+    free_slots(index);
+    index->slots = slots;
+    index->capacity = capacity;
+    return VDB_OK;
+}
+
+id_index_entry_t id_index_find(const id_index_t *index, const uint8_t *keys, const char *id) {
+    const id_slot_t *slot = probe(index, keys, id, hash_id(id));
+    id_index_entry_t entry = { slot->row, slot->meta_offset };
+    return entry;
+}
+
+vdb_status_t id_index_add(id_index_t *index, const uint8_t *keys, uint64_t meta_len) {
+    uint64_t row = index->rows;
+    const char *id = row_id(keys, row);
+    uint64_t hash = hash_id(id);
+    id_slot_t *slot = probe(index, keys, id, hash);
+    if (slot->row == ID_INDEX_NONE) {
+        slot->hash = hash;
+        index->used++;
+    } else if ((slot->row & ID_INDEX_DELETED) == 0) {
+        // superseded (a deleted row is dead already)
+        vdb_status_t status = roaring_add(&index->dead, slot->row);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    slot->row = row;
+    slot->meta_offset = index->meta_end;
+    index->rows++;
+    index->meta_end += meta_len;
+    return VDB_OK;
+}
+
+vdb_status_t id_index_delete(id_index_t *index, const uint8_t *keys, uint64_t row) {
+    const char *id = row_id(keys, row);
+    id_slot_t *slot = probe(index, keys, id, hash_id(id));
+    if (slot->row != row) {
+        return VDB_ERROR_NOT_FOUND; // superseded, or deleted already
+    }
+    vdb_status_t status = roaring_add(&index->dead, row);
+    if (status == VDB_OK) {
+        slot->row |= ID_INDEX_DELETED;
+        index->deletes++;
+    }
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Persistence                                                         */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t id_index_save(const id_index_t *index, const char *path) {
+    char tmp_path[MAX_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return VDB_ERROR_IO;
+    }
+
+    id_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ID_INDEX_MAGIC;
+    header.version = ID_INDEX_VERSION;
+    header.rows = index->rows;
+    header.meta_end = index->meta_end;
+    header.deletes = index->deletes;
+    header.capacity = index->capacity;
+    header.used = index->used;
+    header.crc = crc32c(0, index->slots, index->capacity * sizeof(id_slot_t));
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(index->slots, sizeof(id_slot_t), index->capacity, fp) == index->capacity;
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Check the used count and that every slot points at an indexed row
+*/
+static bool slots_valid(const id_index_t *index) {
+    size_t used = 0;
+    for (size_t i = 0; i < index->capacity; i++) {
+        const id_slot_t *slot = &index->slots[i];
+        if (slot->row == ID_INDEX_NONE) {
+            continue;
+        }
+        if ((slot->row & ~ID_INDEX_DELETED) >= index->rows || slot->meta_offset >= index->meta_end) {
+            return false;
+        }
+        used++;
+    }
+    return used == index->used;
+}
+
+static int compare_rows(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Rebuild the dead bitmap: the gaps between the rows live slots point at
+*/
+static vdb_status_t find_dead(id_index_t *index) {
+    uint64_t *live = (uint64_t*)malloc((index->used > 0 ? index->used : 1) * sizeof(uint64_t));
+    if (live == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < index->capacity; i++) {
+        uint64_t row = index->slots[i].row;
+        if (row != ID_INDEX_NONE && (row & ID_INDEX_DELETED) == 0) {
+            live[n++] = row;
+        }
+    }
+    qsort(live, n, sizeof(uint64_t), compare_rows);
+
+    vdb_status_t status = VDB_OK;
+    uint64_t next = 0;
+    for (size_t i = 0; i < n && status == VDB_OK; i++) {
+        if (live[i] > next) {
+            status = roaring_add_range(&index->dead, next, live[i]);
+        }
+        next = live[i] + 1;
+    }
+    if (status == VDB_OK && next < index->rows) {
+        status = roaring_add_range(&index->dead, next, index->rows);
+    }
+    free(live);
+    return status;
+}
+
+vdb_status_t id_index_load(const char *path, id_index_t **out_index) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    id_file_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != ID_INDEX_MAGIC || header.version != ID_INDEX_VERSION ||
+        header.capacity < ID_INDEX_MIN_CAPACITY || (header.capacity & (header.capacity - 1)) != 0 ||
+        header.capacity > SIZE_MAX / sizeof(id_slot_t) || header.used * 4 > header.capacity * 3) {
+        fclose(fp);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    id_index_t *index = (id_index_t*)calloc(1, sizeof(id_index_t));
+    id_slot_t *slots = (id_slot_t*)malloc((size_t)header.capacity * sizeof(id_slot_t));
+    if (index == NULL || slots == NULL) {
+        fclose(fp);
+        free(index);
+        free(slots);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    roaring_init(&index->dead);
+    index->slots = slots;
+    index->capacity = (size_t)header.capacity;
+    index->used = (size_t)header.used;
+    index->rows = header.rows;
+    index->meta_end = header.meta_end;
+    index->deletes = header.deletes;
+
+    bool ok = fread(slots, sizeof(id_slot_t), index->capacity, fp) == index->capacity;
+    fclose(fp);
+    if (!ok || crc32c(0, slots, index->capacity * sizeof(id_slot_t)) != header.crc ||
+        !slots_valid(index)) {
+        id_index_free(&index);
+        return VDB_ERROR_CORRUPTED;
+    }
+    vdb_status_t status = find_dead(index);
+    if (status != VDB_OK) {
+        id_index_free(&index);
+        return status;
+    }
+
+    *out_index = index;
+    return VDB_OK;
+}
+
+vdb_status_t id_index_write_snap(const id_index_t *index, index_snap_writer_t *w) {
+    size_t dead_bytes = roaring_image_bytes(&index->dead);
+    uint8_t *dead = (uint8_t*)malloc(dead_bytes);
+    if (dead == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    roaring_write_image(&index->dead, dead);
+
+    id_snap_header_t header = {
+        index->rows, index->meta_end, index->deletes, index->capacity, index->used, dead_bytes,
+    };
+    index_snap_begin(w, INDEX_SNAP_IDS);
+    index_snap_write(w, &header, sizeof(header));
+    index_snap_pad(w);
+    index_snap_write(w, index->slots, index->capacity * sizeof(id_slot_t));
+    index_snap_pad(w);
+    index_snap_write(w, dead, dead_bytes);
+    index_snap_end(w);
+    free(dead);
+    return VDB_OK;
+}
+
+vdb_status_t id_index_read_snap(index_snap_t *snap, id_index_t **out_index) {
+    index_snap_reader_t r;
+    if (!index_snap_section(snap, INDEX_SNAP_IDS, &r)) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+    id_snap_header_t header;
+    const void *data = index_snap_read(&r, sizeof(header));
+    if (data == NULL) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.capacity < ID_INDEX_MIN_CAPACITY || (header.capacity & (header.capacity - 1)) != 0 ||
+        header.capacity > SIZE_MAX / sizeof(id_slot_t) || header.used * 4 > header.capacity * 3) {
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    id_index_t *index = (id_index_t*)calloc(1, sizeof(id_index_t));
+    if (index == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    roaring_init(&index->dead);
+    index->capacity = (size_t)header.capacity;
+    index->used = (size_t)header.used;
+    index->rows = header.rows;
+    index->meta_end = header.meta_end;
+    index->deletes = header.deletes;
+
+    index_snap_skip_pad(&r);
+    size_t slot_bytes = index->capacity * sizeof(id_slot_t);
+    index->slots = (id_slot_t*)index_snap_take(&r, slot_bytes);
+    index->slots_mapped = index->slots != NULL;
+    if (index->slots == NULL) {
+        data = index_snap_read(&r, slot_bytes);
+        index->slots = data != NULL ? (id_slot_t*)malloc(slot_bytes) : NULL;
+        if (index->slots == NULL) {
+            id_index_free(&index);
+            return data != NULL ? VDB_ERROR_OUT_OF_MEMORY : VDB_ERROR_CORRUPTED;
+        }
+        memcpy(index->slots, data, slot_bytes);
+    }
+    if (!slots_valid(index)) {
+        id_index_free(&index);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    index_snap_skip_pad(&r);
+    size_t used = 0;
+    data = index_snap_read(&r, (size_t)header.dead_bytes);
+    vdb_status_t status = data != NULL
+        ? roaring_read_image((const uint8_t*)data, (size_t)header.dead_bytes, &index->dead, &used)
+        : VDB_ERROR_CORRUPTED;
+    if (status == VDB_OK && used != header.dead_bytes) {
+        status = VDB_ERROR_CORRUPTED;
+    }
+    if (status != VDB_OK) {
+        id_index_free(&index);
+        return status;
+    }
+
+    *out_index = index;
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Storage hooks                                                       */
+/* ------------------------------------------------------------------ */
+
+/* VDB_ERROR_INVALID_ARGUMENT if the path doesn't fit in MAX_PATH */
+static vdb_status_t ids_path(const char *base_dir, const char *name, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/ids.idx", base_dir, name);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+/**
+ * Index rows [id_index_rows, count) - caller holds write_lock
+*/
+vdb_status_t storage_ids_catch_up(vdb_storage_t *storage) {
+    id_index_t *ids = storage->ids;
+    storage_view_t view;
+    vdb_status_t status = storage_view_locked(storage, &view);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    pthread_rwlock_wrlock(&storage->id_lock);
+    status = id_index_reserve(ids, view.count - id_index_rows(ids));
+    if (status == VDB_OK) {
+        storage->id_keys = view.ids;
+    }
+    while (status == VDB_OK && id_index_rows(ids) < view.count) {
+        uint64_t offset = id_index_meta_end(ids);
+        uint32_t len;
+        if (offset + sizeof(len) > view.metadata_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        memcpy(&len, view.metadata + offset, sizeof(len));
+        if (offset + sizeof(len) + len > view.metadata_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        status = id_index_add(ids, view.ids, sizeof(len) + len);
+    }
+    pthread_rwlock_unlock(&storage->id_lock);
+    return status;
+}
+
+/**
+ * Take the index from index.snap if it holds every delete ids.idx does
+*/
+static id_index_t *ids_from_snap(vdb_storage_t *storage) {
+    id_index_t *ids = NULL;
+    if (storage->index_snap == NULL || id_index_read_snap(storage->index_snap, &ids) != VDB_OK) {
+        return NULL;
+    }
+    if (id_index_rows(ids) > storage->count || id_index_meta_end(ids) > storage->metadata_bytes ||
+        id_index_deletes(ids) < storage->ids_saved_deletes) {
+        id_index_free(&ids);
+        return NULL;
+    }
+    // ids.idx may hold fewer rows, but it has the deletes, and the rows
+    // it lacks only cost a catch-up should the snapshot go
+    storage->ids_saved_rows = id_index_rows(ids);
+    storage->snap_ids_used = true;
+    storage->snap_deletes = id_index_deletes(ids);
+    return ids;
+}
+
+/**
+ * Read ids.idx, or start empty when it is missing, damaged or covers
+ * rows that were since cut off - unless the superblock says it held
+ * deletes, which exist nowhere else
+*/
+static vdb_status_t ids_from_file(vdb_storage_t *storage, id_index_t **out_ids) {
+    char path[MAX_PATH];
+    vdb_status_t status = ids_path(storage->base_dir, storage->name, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    id_index_t *ids = NULL;
+    status = id_index_load(path, &ids);
+    if (status == VDB_OK && (id_index_rows(ids) > storage->count ||
+                             id_index_meta_end(ids) > storage->metadata_bytes ||
+                             id_index_deletes(ids) < storage->ids_saved_deletes)) {
+        id_index_free(&ids);
+        status = VDB_ERROR_CORRUPTED;
+    }
+    if (status == VDB_OK) {
+        storage->ids_saved_rows = id_index_rows(ids);
+        storage->ids_saved_deletes = id_index_deletes(ids);
+    } else if (status == VDB_ERROR_NOT_FOUND || status == VDB_ERROR_CORRUPTED) {
+        if (storage->ids_saved_deletes > 0) {
+            return VDB_ERROR_CORRUPTED;
+        }
+        storage->ids_saved_rows = 0;
+        status = id_index_create(&ids);
+    }
+    if (status == VDB_OK) {
+        *out_ids = ids;
+    }
+    return status;
+}
+
+/**
+ * Attach the ID index and bring it up to date (create / open path,
+ * after WAL replay): from index.snap if it has every saved delete,
+ * else from ids.idx, then the rows and deletes past them
+*/
+vdb_status_t storage_ids_load(vdb_storage_t *storage) {
+    id_index_t *ids = ids_from_snap(storage);
+    vdb_status_t status = ids != NULL ? VDB_OK : ids_from_file(storage, &ids);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    storage->ids = ids; // not shared yet, no readers to exclude
+    status = storage_ids_catch_up(storage);
+    if (status == VDB_OK) {
+        // deletes since the last checkpoint; repeats are no-ops
+        for (size_t i = 0; i < storage->num_replayed_deletes && status == VDB_OK; i++) {
+            status = id_index_delete(ids, storage->id_keys, storage->replayed_deletes[i]);
+            if (status == VDB_ERROR_NOT_FOUND) {
+                status = VDB_OK;
+            }
+        }
+    }
+    free(storage->replayed_deletes);
+    storage->replayed_deletes = NULL;
+    storage->num_replayed_deletes = 0;
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Write ids.idx if it lacks deletes (always needed before the WAL that
+ * holds them is emptied) or, when closing, any rows
+ * Caller holds write_lock.
+*/
+vdb_status_t storage_ids_save(vdb_storage_t *storage, bool closing) {
+    id_index_t *ids = storage->ids;
+    if (ids == NULL || (id_index_deletes(ids) == storage->ids_saved_deletes &&
+                        (!closing || id_index_rows(ids) == storage->ids_saved_rows))) {
+        return VDB_OK;
+    }
+
+    char path[MAX_PATH];
+    vdb_status_t status = ids_path(storage->base_dir, storage->name, path);
+    if (status == VDB_OK) {
+        status = id_index_save(ids, path);
+    }
+    if (status == VDB_OK) {
+        storage->ids_saved_rows = id_index_rows(ids);
+        storage->ids_saved_deletes = id_index_deletes(ids);
+    }
+    return status;
+}
+
+/**
+ * Look an ID up for a reader
+*/
+id_index_entry_t storage_ids_find(vdb_storage_t *storage, const char *id) {
+    pthread_rwlock_rdlock(&storage->id_lock);
+    id_index_entry_t entry = id_index_find(storage->ids, storage->id_keys, id);
+    pthread_rwlock_unlock(&storage->id_lock);
+    return entry;
+}
+
+/**
+ * Copy the dead rows out for a reader
+*/
+vdb_status_t storage_ids_dead(vdb_storage_t *storage, roaring_t *out) {
+    roaring_t none;
+    roaring_init(&none);
+    pthread_rwlock_rdlock(&storage->id_lock);
+    vdb_status_t status = roaring_or(id_index_dead(storage->ids), &none, out);
+    pthread_rwlock_unlock(&storage->id_lock);
+    return status;
+}
+
+/**
+ * Number of dead rows
+*/
+uint64_t storage_ids_dead_count(vdb_storage_t *storage) {
+    pthread_rwlock_rdlock(&storage->id_lock);
+    uint64_t n = roaring_cardinality(id_index_dead(storage->ids));
+    pthread_rwlock_unlock(&storage->id_lock);
+    return n;
+}
@@ -0,0 +1,115 @@
+/**
+ * id_index.h - Internal ID -> row hash index (ids.idx)
+ *
+ * Open addressing with linear probing over (hash, row, metadata offset)
+ * slots. IDs aren't copied into the table: a hash match is confirmed
+ * against the ID stored in ids.seg (keys + row * VDB_ID_MAX_LEN).
+ *
+ * Every ID has one slot, pointing at its newest row, so an upsert just
+ * moves the slot and the older row is superseded. A delete flags the
+ * slot with ID_INDEX_DELETED. Slots are never removed, which keeps
+ * probing trivial. Superseded and deleted rows are also kept in a dead
+ * row bitmap, which searches subtract and compaction drops.
+ *
+ * Unlike the other indexes this one is not pure derived data: rows and
+ * upserts can be replayed from ids.seg, deletes can't, so ids.idx is
+ * written at checkpoints once there are deletes it doesn't hold yet.
+*/
+
+#ifndef VDB_ID_INDEX_H
+#define VDB_ID_INDEX_H
+
+#include "vdb/types.h"
+#include "roaring.h"
+#include "index_snap.h"
+
+typedef struct id_index id_index_t;
+
+/* find() result for an ID that was never stored */
+#define ID_INDEX_NONE UINT64_MAX
+
+/* Set on the row of a deleted ID */
+#define ID_INDEX_DELETED (1ull << 63)
+
+typedef struct {
+    uint64_t row; // newest row of the ID, | ID_INDEX_DELETED; ID_INDEX_NONE if absent
+    uint64_t meta_offset; // metadata.seg offset of that row's record
+} id_index_entry_t;
+
+vdb_status_t id_index_create(id_index_t **out_index);
+
+/**
+ * Free an index. Safe with NULL.
+*/
+void id_index_free(id_index_t **index);
+
+/* Rows indexed so far; the next add is this row */
+uint64_t id_index_rows(const id_index_t *index);
+
+/* metadata.seg offset just past the last indexed row */
+uint64_t id_index_meta_end(const id_index_t *index);
+
+/* Rows deleted so far (a counter, never goes down) */
+uint64_t id_index_deletes(const id_index_t *index);
+
+/* Indexed rows that are superseded or deleted */
+const roaring_t *id_index_dead(const id_index_t *index);
+
+/* Bytes the slots (malloc'd or taken from index.snap) and the dead bitmap hold */
+size_t id_index_memory_bytes(const id_index_t *index);
+
+/**
+ * Make room for n more IDs, so the next n adds can't fail
+*/
+vdb_status_t id_index_reserve(id_index_t *index, uint64_t n);
+
+/**
+ * Look an ID up; keys must cover every indexed row
+*/
+id_index_entry_t id_index_find(const id_index_t *index, const uint8_t *keys, const char *id);
+
+/**
+ * Index the next row: its ID now points at it (over any older row)
+ * meta_len is the length of its metadata record, prefix included.
+ * Needs room from id_index_reserve; can still run out of memory
+ * marking the older row dead, and then changes nothing.
+*/
+vdb_status_t id_index_add(id_index_t *index, const uint8_t *keys, uint64_t meta_len);
+
+/**
+ * Mark row deleted, if it still is the newest row of its ID
+ * Returns VDB_ERROR_NOT_FOUND if it wasn't live, so replaying a delete
+ * is a no-op.
+*/
+vdb_status_t id_index_delete(id_index_t *index, const uint8_t *keys, uint64_t row);
+
+/**
+ * Write the index to path.tmp, fsync it and rename it over path
+*/
+vdb_status_t id_index_save(const id_index_t *index, const char *path);
+
+/**
+ * Read ids.idx
+ *
+ * Returns:
+ * - VDB_ERROR_NOT_FOUND: No file
+ * - VDB_ERROR_CORRUPTED: Bad header, checksum or slot
+*/
+vdb_status_t id_index_load(const char *path, id_index_t **out_index);
+
+/**
+ * Write the index as an INDEX_SNAP_IDS section
+*/
+vdb_status_t id_index_write_snap(const id_index_t *index, index_snap_writer_t *w);
+
+/**
+ * Take the index from the INDEX_SNAP_IDS section of a snapshot; the
+ * slot array stays in the mapping (copied if it can't)
+ *
+ * Returns:
+ * - VDB_ERROR_NOT_FOUND: No such section
+ * - VDB_ERROR_CORRUPTED: Bad section header or slot
+*/
+vdb_status_t id_index_read_snap(index_snap_t *snap, id_index_t **out_index);
+
+#endif /* VDB_ID_INDEX_H */
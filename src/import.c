@@ -0,0 +1,1071 @@
+/**
+ * import.c - Bulk import pipeline
+ *
+ * Chunks move around a fixed ring: FREE -> READ (reader thread) ->
+ * PARSED (any parse thread) -> FREE again once the calling thread has
+ * appended them. Chunk n lives in slot n % ring_size, and the writer
+ * frees slots strictly in order, so the reader can never run more than
+ * a ring ahead and batches reach the storage in file order however the
+ * parsers finish.
+ *
+ * fvecs / npy chunks hold whole rows and are parsed in place: items
+ * point straight into the read buffer. JSONL chunks end at a newline;
+ * the partial line after it is carried over to the next chunk by the
+ * reader, and a line longer than a chunk grows it.
+*/
+
+#include "vdb/import.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* Chunks in flight per parse thread, plus the one being read and the
+ * one being appended */
+#define IMPORT_RING_EXTRA 3
+
+/* Longest npy header accepted */
+#define NPY_MAX_HEADER (64u * 1024)
+
+/* Deepest nesting skipped in a JSONL value */
+#define IMPORT_MAX_DEPTH 64
+
+typedef enum {
+    CHUNK_FREE,
+    CHUNK_READ,
+    CHUNK_PARSING,
+    CHUNK_PARSED
+} chunk_state_t;
+
+typedef struct {
+    chunk_state_t state;
+    char *data; // len bytes + a NUL
+    size_t len;
+    size_t cap;
+    uint64_t first_row; // fvecs / npy: rows in the chunks before
+    vdb_status_t status; // read or parse failure
+
+    vdb_item_t *items;
+    size_t num_items;
+    size_t cap_items;
+    float *vectors; // converted vectors (JSONL, f8), dim per item
+    size_t cap_vectors;
+    size_t records; // vectors / lines in the chunk
+    size_t failed; // 1-based record in the chunk that didn't parse
+} import_chunk_t;
+
+typedef struct {
+    vdb_storage_t *storage;
+    vdb_import_format_t format;
+    uint32_t dim;
+    uint64_t first_id;
+    int fd;
+
+    // fvecs / npy
+    size_t row_bytes;
+    size_t elem_size; // 4 or 8
+    uint64_t rows_left; // npy: rows the header promises, UINT64_MAX for fvecs
+    size_t chunk_bytes;
+
+    // JSONL tail carried to the next chunk (reader only)
+    char *carry;
+    size_t carry_len;
+    size_t carry_cap;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // any chunk changed state
+    import_chunk_t *ring;
+    size_t ring_size;
+    uint64_t read_seq; // next chunk the reader fills
+    uint64_t parse_seq; // next chunk a parser takes
+    uint64_t write_seq; // next chunk to append
+    uint64_t end_seq; // chunks in the file, UINT64_MAX until the reader knows
+    bool stop;
+    uint64_t bytes;
+} import_t;
+
+vdb_import_params_t vdb_import_params_default(void) {
+    vdb_import_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.format = VDB_IMPORT_AUTO;
+    return params;
+}
+
+static bool has_suffix(const char *s, const char *suffix) {
+    size_t len = strlen(s);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+vdb_import_format_t vdb_import_format_from_path(const char *path) {
+    if (path == NULL) {
+        return VDB_IMPORT_AUTO;
+    }
+    if (has_suffix(path, ".fvecs")) {
+        return VDB_IMPORT_FVECS;
+    }
+    if (has_suffix(path, ".npy")) {
+        return VDB_IMPORT_NPY;
+    }
+    if (has_suffix(path, ".jsonl") || has_suffix(path, ".ndjson")) {
+        return VDB_IMPORT_JSONL;
+    }
+    return VDB_IMPORT_AUTO;
+}
+
+/**
+ * Read up to len bytes, short only at EOF
+*/
+static vdb_status_t read_full(int fd, char *buf, size_t len, size_t *out_read) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return VDB_ERROR_IO;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    *out_read = done;
+    return VDB_OK;
+}
+
+static bool reserve_bytes(char **data, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap > 0 ? *cap : 4096;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    char *grown = (char*)realloc(*data, new_cap + 1);
+    if (grown == NULL) {
+        return false;
+    }
+    *data = grown;
+    *cap = new_cap;
+    return true;
+}
+
+/* ------------------------------------------------------------------ */
+/* npy header                                                          */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Find the value of 'key' in a header dict: the first non-space char
+ * after its colon, NULL if missing
+*/
+static const char *npy_field(const char *header, const char *key) {
+    const char *p = strstr(header, key);
+    if (p == NULL) {
+        return NULL;
+    }
+    p += strlen(key);
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p++ != ':') {
+        return NULL;
+    }
+    while (*p == ' ') {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Read the npy header, leaving fd at the first row
+ * Only 2-D little-endian float32 / float64 arrays in C order are taken.
+*/
+static vdb_status_t npy_read_header(import_t *imp) {
+    char prefix[12];
+    size_t got = 0;
+    vdb_status_t status = read_full(imp->fd, prefix, 10, &got);
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (got < 10 || memcmp(prefix, "\x93NUMPY", 6) != 0) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    uint8_t major = (uint8_t)prefix[6];
+    size_t header_len = 0;
+    if (major == 1) {
+        header_len = (size_t)(uint8_t)prefix[8] | (size_t)(uint8_t)prefix[9] << 8;
+    } else if (major == 2 || major == 3) {
+        status = read_full(imp->fd, prefix + 10, 2, &got);
+        if (status != VDB_OK) {
+            return status;
+        }
+        if (got < 2) {
+            return VDB_ERROR_CORRUPTED;
+        }
+        uint32_t len32 = (uint32_t)(uint8_t)prefix[8] | (uint32_t)(uint8_t)prefix[9] << 8 |
+                         (uint32_t)(uint8_t)prefix[10] << 16 | (uint32_t)(uint8_t)prefix[11] << 24;
+        header_len = len32;
+    } else {
+        return VDB_ERROR_CORRUPTED;
+    }
+    if (header_len == 0 || header_len > NPY_MAX_HEADER) {
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    char *header = (char*)malloc(header_len + 1);
+    if (header == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    status = read_full(imp->fd, header, header_len, &got);
+    if (status == VDB_OK && got < header_len) {
+        status = VDB_ERROR_CORRUPTED;
+    }
+    header[status == VDB_OK ? header_len : 0] = '\0';
+
+    const char *descr = npy_field(header, "'descr'");
+    const char *order = npy_field(header, "'fortran_order'");
+    const char *shape = npy_field(header, "'shape'");
+    if (status != VDB_OK) {
+        // nothing to parse
+    } else if (descr == NULL || order == NULL || shape == NULL || *shape != '(') {
+        status = VDB_ERROR_CORRUPTED;
+    } else if (strncmp(order, "False", 5) != 0) {
+        status = VDB_ERROR_INVALID_ARGUMENT;
+    } else if (strncmp(descr, "'<f4'", 5) == 0) {
+        imp->elem_size = 4;
+    } else if (strncmp(descr, "'<f8'", 5) == 0) {
+        imp->elem_size = 8;
+    } else {
+        status = VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (status == VDB_OK) {
+        char *end = NULL;
+        unsigned long long rows = strtoull(shape + 1, &end, 10);
+        const char *p = end;
+        while (*p == ' ') {
+            p++;
+        }
+        unsigned long long cols = 0;
+        if (end == shape + 1 || *p++ != ',') {
+            status = VDB_ERROR_CORRUPTED;
+        } else {
+            cols = strtoull(p, &end, 10);
+            if (end == p) {
+                status = VDB_ERROR_INVALID_ARGUMENT; // 1-D
+            } else {
+                p = end;
+                while (*p == ' ') {
+                    p++;
+                }
+                if (*p == ',') {
+                    p++;
+                }
+                while (*p == ' ') {
+                    p++;
+                }
+                if (*p != ')') {
+                    status = VDB_ERROR_INVALID_ARGUMENT; // more than 2-D
+                }
+            }
+        }
+        if (status == VDB_OK && cols != imp->dim) {
+            status = VDB_ERROR_DIMENSION_MISMATCH;
+        }
+        imp->rows_left = rows;
+    }
+    free(header);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    // the data must all be there
+    struct stat st;
+    off_t data_start = lseek(imp->fd, 0, SEEK_CUR);
+    if (data_start < 0 || fstat(imp->fd, &st) != 0) {
+        return VDB_ERROR_IO;
+    }
+    uint64_t have = (uint64_t)(st.st_size - data_start) / (imp->dim * imp->elem_size);
+    return have >= imp->rows_left ? VDB_OK : VDB_ERROR_CORRUPTED;
+}
+
+/* ------------------------------------------------------------------ */
+/* Reader                                                              */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Fill a chunk with whole rows
+ * Returns: true at the end of the input
+*/
+static bool read_rows(import_t *imp, import_chunk_t *chunk) {
+    size_t want = imp->chunk_bytes;
+    if (imp->rows_left < want / imp->row_bytes) {
+        want = (size_t)imp->rows_left * imp->row_bytes;
+    }
+    size_t got = 0;
+    chunk->status = read_full(imp->fd, chunk->data, want, &got);
+    chunk->len = got;
+    if (chunk->status != VDB_OK) {
+        return true;
+    }
+    if (got % imp->row_bytes != 0) {
+        chunk->status = VDB_ERROR_CORRUPTED; // truncated last row
+        return true;
+    }
+    if (imp->rows_left != UINT64_MAX) {
+        imp->rows_left -= got / imp->row_bytes;
+    }
+    return got < imp->chunk_bytes;
+}
+
+/**
+ * Fill a chunk with whole lines, carrying the partial last one over
+ * Returns: true at the end of the input
+*/
+static bool read_lines(import_t *imp, import_chunk_t *chunk) {
+    if (!reserve_bytes(&chunk->data, &chunk->cap, imp->carry_len)) {
+        chunk->status = VDB_ERROR_OUT_OF_MEMORY;
+        return true;
+    }
+    if (imp->carry_len > 0) {
+        memcpy(chunk->data, imp->carry, imp->carry_len);
+    }
+    chunk->len = imp->carry_len;
+    imp->carry_len = 0;
+
+    for (;;) {
+        if (chunk->len == chunk->cap && !reserve_bytes(&chunk->data, &chunk->cap, chunk->cap * 2)) {
+            chunk->status = VDB_ERROR_OUT_OF_MEMORY;
+            return true;
+        }
+        size_t before = chunk->len;
+        size_t got = 0;
+        chunk->status = read_full(imp->fd, chunk->data + chunk->len, chunk->cap - chunk->len, &got);
+        chunk->len += got;
+        if (chunk->status != VDB_OK || chunk->len < chunk->cap) {
+            return true; // error or EOF: the rest is the last line
+        }
+
+        // full: cut after the last newline, or grow if the line is longer
+        // than the chunk (nothing before `before` has one)
+        char *last = NULL;
+        for (size_t i = chunk->len; i > before; i--) {
+            if (chunk->data[i - 1] == '\n') {
+                last = chunk->data + i;
+                break;
+            }
+        }
+        if (last != NULL) {
+            size_t tail = (size_t)(chunk->data + chunk->len - last);
+            if (!reserve_bytes(&imp->carry, &imp->carry_cap, tail)) {
+                chunk->status = VDB_ERROR_OUT_OF_MEMORY;
+                return true;
+            }
+            memcpy(imp->carry, last, tail);
+            imp->carry_len = tail;
+            chunk->len -= tail;
+            return false;
+        }
+    }
+}
+
+static void *reader_main(void *arg) {
+    import_t *imp = (import_t*)arg;
+    uint64_t rows = 0;
+    for (;;) {
+        pthread_mutex_lock(&imp->lock);
+        import_chunk_t *chunk = &imp->ring[imp->read_seq % imp->ring_size];
+        while (!imp->stop && chunk->state != CHUNK_FREE) {
+            pthread_cond_wait(&imp->cond, &imp->lock);
+        }
+        if (imp->stop) {
+            pthread_mutex_unlock(&imp->lock);
+            break;
+        }
+        pthread_mutex_unlock(&imp->lock);
+
+        chunk->first_row = rows;
+        chunk->status = VDB_OK;
+        bool last = imp->format == VDB_IMPORT_JSONL ? read_lines(imp, chunk) : read_rows(imp, chunk);
+        chunk->data[chunk->len] = '\0';
+        if (imp->format != VDB_IMPORT_JSONL) {
+            rows += chunk->len / imp->row_bytes;
+        }
+
+        pthread_mutex_lock(&imp->lock);
+        chunk->state = CHUNK_READ;
+        imp->bytes += chunk->len;
+        imp->read_seq++;
+        if (last) {
+            imp->end_seq = imp->read_seq;
+        }
+        pthread_cond_broadcast(&imp->cond);
+        pthread_mutex_unlock(&imp->lock);
+        if (last) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Parsers                                                             */
+/* ------------------------------------------------------------------ */
+
+static vdb_status_t reserve_items(import_t *imp, import_chunk_t *chunk, size_t n, bool vectors) {
+    if (n > chunk->cap_items) {
+        vdb_item_t *grown = (vdb_item_t*)realloc(chunk->items, n * sizeof(vdb_item_t));
+        if (grown == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        chunk->items = grown;
+        chunk->cap_items = n;
+    }
+    if (vectors && n * imp->dim > chunk->cap_vectors) {
+        float *grown = (float*)realloc(chunk->vectors, n * imp->dim * sizeof(float));
+        if (grown == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        chunk->vectors = grown;
+        chunk->cap_vectors = n * imp->dim;
+    }
+    return VDB_OK;
+}
+
+static void parse_rows(import_t *imp, import_chunk_t *chunk) {
+    size_t n = chunk->len / imp->row_bytes;
+    chunk->records = n;
+    chunk->status = reserve_items(imp, chunk, n, imp->elem_size != sizeof(float));
+    if (chunk->status != VDB_OK) {
+        return;
+    }
+
+    size_t prefix = imp->format == VDB_IMPORT_FVECS ? sizeof(int32_t) : 0;
+    for (size_t i = 0; i < n; i++) {
+        const char *row = chunk->data + i * imp->row_bytes;
+        if (prefix > 0) {
+            int32_t dim;
+            memcpy(&dim, row, sizeof(dim));
+            if (dim != (int32_t)imp->dim) {
+                chunk->status = VDB_ERROR_DIMENSION_MISMATCH;
+                chunk->failed = i + 1;
+                return;
+            }
+        }
+
+        vdb_item_t *item = &chunk->items[i];
+        snprintf(item->id, VDB_ID_MAX_LEN, "%" PRIu64, imp->first_id + chunk->first_row + i);
+        item->vector.dim = imp->dim;
+        item->metadata = NULL;
+        if (imp->elem_size == sizeof(float)) {
+            item->vector.data = (float*)(void*)(row + prefix);
+        } else {
+            float *out = chunk->vectors + i * imp->dim;
+            for (uint32_t d = 0; d < imp->dim; d++) {
+                double v;
+                memcpy(&v, row + prefix + d * sizeof(double), sizeof(v));
+                out[d] = (float)v;
+            }
+            item->vector.data = out;
+        }
+    }
+    chunk->num_items = n;
+}
+
+typedef struct {
+    char *p;
+    char *end;
+} line_reader_t;
+
+static void skip_ws(line_reader_t *r) {
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\r')) {
+        r->p++;
+    }
+}
+
+static bool consume(line_reader_t *r, char c) {
+    skip_ws(r);
+    if (r->p < r->end && *r->p == c) {
+        r->p++;
+        return true;
+    }
+    return false;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool read_hex4(line_reader_t *r, uint32_t *out) {
+    if (r->end - r->p < 4) {
+        return false;
+    }
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = hex_digit(r->p[i]);
+        if (d < 0) {
+            return false;
+        }
+        v = (v << 4) | (uint32_t)d;
+    }
+    r->p += 4;
+    *out = v;
+    return true;
+}
+
+static void put_byte(char *out, size_t cap, size_t *len, char c) {
+    if (*len + 1 < cap) {
+        out[*len] = c;
+    }
+    (*len)++;
+}
+
+/**
+ * Read a string (opening quote next), decoding it into out[cap]
+ * *out_len gets the full decoded length, which may not have fit; out
+ * is NUL-terminated when it did.
+*/
+static bool read_string(line_reader_t *r, char *out, size_t cap, size_t *out_len) {
+    size_t len = 0;
+    if (!consume(r, '"')) {
+        return false;
+    }
+    while (r->p < r->end) {
+        char c = *r->p++;
+        if ((uint8_t)c < 0x20) {
+            return false;
+        }
+        if (c == '"') {
+            if (len < cap) {
+                out[len] = '\0';
+            }
+            *out_len = len;
+            return true;
+        }
+        if (c != '\\') {
+            put_byte(out, cap, &len, c);
+            continue;
+        }
+        if (r->p == r->end) {
+            return false;
+        }
+        c = *r->p++;
+        uint32_t cp;
+        switch (c) {
+            case '"': case '\\': case '/': cp = (uint32_t)c; break;
+            case 'b': cp = '\b'; break;
+            case 'f': cp = '\f'; break;
+            case 'n': cp = '\n'; break;
+            case 'r': cp = '\r'; break;
+            case 't': cp = '\t'; break;
+            case 'u':
+                if (!read_hex4(r, &cp) || cp == 0) {
+                    return false;
+                }
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    uint32_t low;
+                    if (r->end - r->p < 2 || r->p[0] != '\\' || r->p[1] != 'u') {
+                        return false;
+                    }
+                    r->p += 2;
+                    if (!read_hex4(r, &low) || low < 0xdc00 || low >= 0xe000) {
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                } else if (cp >= 0xdc00 && cp < 0xe000) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        if (cp < 0x80) {
+            put_byte(out, cap, &len, (char)cp);
+        } else if (cp < 0x800) {
+            put_byte(out, cap, &len, (char)(0xc0 | (cp >> 6)));
+            put_byte(out, cap, &len, (char)(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            put_byte(out, cap, &len, (char)(0xe0 | (cp >> 12)));
+            put_byte(out, cap, &len, (char)(0x80 | ((cp >> 6) & 0x3f)));
+            put_byte(out, cap, &len, (char)(0x80 | (cp & 0x3f)));
+        } else {
+            put_byte(out, cap, &len, (char)(0xf0 | (cp >> 18)));
+            put_byte(out, cap, &len, (char)(0x80 | ((cp >> 12) & 0x3f)));
+            put_byte(out, cap, &len, (char)(0x80 | ((cp >> 6) & 0x3f)));
+            put_byte(out, cap, &len, (char)(0x80 | (cp & 0x3f)));
+        }
+    }
+    return false;
+}
+
+/**
+ * Skip a number (loosely checked: strtof has the last word)
+*/
+static bool skip_number(line_reader_t *r) {
+    skip_ws(r);
+    char *p = r->p;
+    if (p < r->end && *p == '-') {
+        p++;
+    }
+    if (p == r->end || *p < '0' || *p > '9') {
+        return false;
+    }
+    while (p < r->end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' ||
+                          *p == '+' || *p == '-')) {
+        p++;
+    }
+    r->p = p;
+    return true;
+}
+
+static bool skip_value(line_reader_t *r, int depth) {
+    if (depth > IMPORT_MAX_DEPTH) {
+        return false;
+    }
+    skip_ws(r);
+    if (r->p == r->end) {
+        return false;
+    }
+    size_t len;
+    char c = *r->p;
+    if (c == '"') {
+        return read_string(r, NULL, 0, &len);
+    }
+    if (c == '{' || c == '[') {
+        char close = c == '{' ? '}' : ']';
+        r->p++;
+        if (consume(r, close)) {
+            return true;
+        }
+        do {
+            if (close == '}' && (!read_string(r, NULL, 0, &len) || !consume(r, ':'))) {
+                return false;
+            }
+            if (!skip_value(r, depth + 1)) {
+                return false;
+            }
+        } while (consume(r, ','));
+        return consume(r, close);
+    }
+    const char *literals[] = { "true", "false", "null" };
+    for (size_t i = 0; i < 3; i++) {
+        size_t n = strlen(literals[i]);
+        if ((size_t)(r->end - r->p) >= n && memcmp(r->p, literals[i], n) == 0) {
+            r->p += n;
+            return true;
+        }
+    }
+    return skip_number(r);
+}
+
+/**
+ * Read "vector": [...] into out[dim]
+*/
+static vdb_status_t read_vector(line_reader_t *r, float *out, uint32_t dim) {
+    if (!consume(r, '[')) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    uint32_t n = 0;
+    if (!consume(r, ']')) {
+        do {
+            skip_ws(r);
+            char *start = r->p;
+            if (!skip_number(r)) {
+                return VDB_ERROR_INVALID_ARGUMENT;
+            }
+            if (n < dim) {
+                // the line always ends in a NUL or a newline, so strtof stops there
+                out[n] = strtof(start, NULL);
+            }
+            n++;
+        } while (consume(r, ','));
+        if (!consume(r, ']')) {
+            return VDB_ERROR_INVALID_ARGUMENT;
+        }
+    }
+    return n == dim ? VDB_OK : VDB_ERROR_DIMENSION_MISMATCH;
+}
+
+/**
+ * Parse one line into item; blank lines set *out_blank
+*/
+static vdb_status_t parse_line(import_t *imp, line_reader_t *r, vdb_item_t *item, float *vector,
+                               bool *out_blank) {
+    skip_ws(r);
+    *out_blank = r->p == r->end;
+    if (*out_blank) {
+        return VDB_OK;
+    }
+    if (!consume(r, '{')) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    bool have_id = false;
+    bool have_vector = false;
+    char *metadata = NULL;
+    char *metadata_end = NULL;
+    if (!consume(r, '}')) {
+        do {
+            char key[16];
+            size_t key_len = 0;
+            if (!read_string(r, key, sizeof(key), &key_len) || !consume(r, ':')) {
+                return VDB_ERROR_INVALID_ARGUMENT;
+            }
+            skip_ws(r);
+            if (key_len >= sizeof(key)) {
+                key[0] = '\0'; // not one of ours
+            }
+
+            if (strcmp(key, "id") == 0) {
+                size_t len = 0;
+                if (r->p < r->end && *r->p == '"') {
+                    if (!read_string(r, item->id, VDB_ID_MAX_LEN, &len) || len >= VDB_ID_MAX_LEN) {
+                        return VDB_ERROR_INVALID_ARGUMENT;
+                    }
+                } else {
+                    char *start = r->p;
+                    if (!skip_number(r)) {
+                        return VDB_ERROR_INVALID_ARGUMENT;
+                    }
+                    len = (size_t)(r->p - start);
+                    if (len >= VDB_ID_MAX_LEN) {
+                        return VDB_ERROR_INVALID_ARGUMENT;
+                    }
+                    memcpy(item->id, start, len);
+                    item->id[len] = '\0';
+                }
+                have_id = true;
+            } else if (strcmp(key, "vector") == 0) {
+                vdb_status_t status = read_vector(r, vector, imp->dim);
+                if (status != VDB_OK) {
+                    return status;
+                }
+                have_vector = true;
+            } else if (strcmp(key, "metadata") == 0) {
+                char *start = r->p;
+                if (r->end - r->p >= 4 && memcmp(r->p, "null", 4) == 0) {
+                    r->p += 4;
+                    metadata = NULL;
+                } else if (r->p < r->end && *r->p == '{' && skip_value(r, 0)) {
+                    metadata = start;
+                    metadata_end = r->p;
+                } else {
+                    return VDB_ERROR_INVALID_ARGUMENT;
+                }
+            } else if (!skip_value(r, 0)) {
+                return VDB_ERROR_INVALID_ARGUMENT;
+            }
+        } while (consume(r, ','));
+        if (!consume(r, '}')) {
+            return VDB_ERROR_INVALID_ARGUMENT;
+        }
+    }
+    skip_ws(r);
+    if (r->p != r->end || !have_id || !have_vector || !vdb_id_is_valid(item->id)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    // the line is good: end the metadata in place (the byte after it is
+    // a separator already parsed)
+    if (metadata != NULL) {
+        *metadata_end = '\0';
+    }
+    item->metadata = metadata;
+    item->vector.dim = imp->dim;
+    item->vector.data = vector;
+    return VDB_OK;
+}
+
+static void parse_lines(import_t *imp, import_chunk_t *chunk) {
+    size_t lines = 0;
+    for (const char *p = chunk->data; (p = memchr(p, '\n', (size_t)(chunk->data + chunk->len - p))) != NULL; p++) {
+        lines++;
+    }
+    if (chunk->len > 0 && chunk->data[chunk->len - 1] != '\n') {
+        lines++; // last line of the file, no newline
+    }
+    chunk->records = lines;
+    chunk->status = reserve_items(imp, chunk, lines, true);
+    if (chunk->status != VDB_OK) {
+        return;
+    }
+
+    char *p = chunk->data;
+    char *end = chunk->data + chunk->len;
+    size_t n = 0;
+    for (size_t line = 0; line < lines; line++) {
+        char *eol = memchr(p, '\n', (size_t)(end - p));
+        line_reader_t r = { p, eol != NULL ? eol : end };
+        bool blank = false;
+        vdb_status_t status = parse_line(imp, &r, &chunk->items[n], chunk->vectors + n * imp->dim, &blank);
+        if (status != VDB_OK) {
+            chunk->status = status;
+            chunk->failed = line + 1;
+            return;
+        }
+        if (!blank) {
+            n++;
+        }
+        p = eol != NULL ? eol + 1 : end;
+    }
+    chunk->num_items = n;
+}
+
+static void *parser_main(void *arg) {
+    import_t *imp = (import_t*)arg;
+    pthread_mutex_lock(&imp->lock);
+    for (;;) {
+        while (!imp->stop && imp->parse_seq == imp->read_seq && imp->parse_seq < imp->end_seq) {
+            pthread_cond_wait(&imp->cond, &imp->lock);
+        }
+        if (imp->stop || imp->parse_seq >= imp->end_seq) {
+            break;
+        }
+        import_chunk_t *chunk = &imp->ring[imp->parse_seq % imp->ring_size];
+        imp->parse_seq++;
+        chunk->state = CHUNK_PARSING;
+        pthread_mutex_unlock(&imp->lock);
+
+        chunk->num_items = 0;
+        chunk->records = 0;
+        chunk->failed = 0;
+        if (chunk->status == VDB_OK) {
+            if (imp->format == VDB_IMPORT_JSONL) {
+                parse_lines(imp, chunk);
+            } else {
+                parse_rows(imp, chunk);
+            }
+        }
+
+        pthread_mutex_lock(&imp->lock);
+        chunk->state = CHUNK_PARSED;
+        pthread_cond_broadcast(&imp->cond);
+    }
+    pthread_mutex_unlock(&imp->lock);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Pipeline                                                            */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Append parsed chunks in order until the end or the first failure
+ * The batches go in async; *ticket is the last one's.
+*/
+static vdb_status_t append_chunks(import_t *imp, uint32_t batch_rows, vdb_import_stats_t *stats,
+                                  vdb_commit_ticket_t *ticket) {
+    uint64_t records = 0;
+    for (;;) {
+        pthread_mutex_lock(&imp->lock);
+        import_chunk_t *chunk = &imp->ring[imp->write_seq % imp->ring_size];
+        while (imp->write_seq < imp->end_seq && chunk->state != CHUNK_PARSED) {
+            pthread_cond_wait(&imp->cond, &imp->lock);
+        }
+        bool done = imp->write_seq >= imp->end_seq;
+        stats->bytes = imp->bytes;
+        pthread_mutex_unlock(&imp->lock);
+        if (done) {
+            return VDB_OK;
+        }
+
+        if (chunk->status != VDB_OK) {
+            stats->failed_record = chunk->failed > 0 ? records + chunk->failed : 0;
+            return chunk->status;
+        }
+        for (size_t i = 0; i < chunk->num_items; i += batch_rows) {
+            size_t n = chunk->num_items - i < batch_rows ? chunk->num_items - i : batch_rows;
+            vdb_status_t status = vdb_storage_append_batch_async(imp->storage, chunk->items + i, n, ticket);
+            if (status != VDB_OK) {
+                return status;
+            }
+            stats->rows += n;
+        }
+        records += chunk->records;
+
+        pthread_mutex_lock(&imp->lock);
+        chunk->state = CHUNK_FREE;
+        imp->write_seq++;
+        pthread_cond_broadcast(&imp->cond);
+        pthread_mutex_unlock(&imp->lock);
+    }
+}
+
+/**
+ * Append every parsed chunk, then make them durable with one WAL sync
+ * Rows appended before a failure are synced as well.
+*/
+static vdb_status_t write_chunks(import_t *imp, uint32_t batch_rows, vdb_import_stats_t *stats) {
+    vdb_commit_ticket_t ticket = 0;
+    vdb_status_t status = append_chunks(imp, batch_rows, stats, &ticket);
+    vdb_status_t synced = vdb_storage_wait_durable(imp->storage, ticket);
+    return status != VDB_OK ? status : synced;
+}
+
+static void free_ring(import_t *imp) {
+    for (size_t i = 0; i < imp->ring_size; i++) {
+        free(imp->ring[i].data);
+        free(imp->ring[i].items);
+        free(imp->ring[i].vectors);
+    }
+    free(imp->ring);
+}
+
+static vdb_status_t run_pipeline(import_t *imp, uint32_t parse_threads, uint32_t batch_rows,
+                                 vdb_import_stats_t *stats) {
+    imp->ring_size = parse_threads + IMPORT_RING_EXTRA;
+    imp->ring = (import_chunk_t*)calloc(imp->ring_size, sizeof(import_chunk_t));
+    pthread_t *parsers = (pthread_t*)calloc(parse_threads, sizeof(pthread_t));
+    if (imp->ring == NULL || parsers == NULL) {
+        free(imp->ring);
+        free(parsers);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < imp->ring_size; i++) {
+        imp->ring[i].cap = imp->chunk_bytes;
+        imp->ring[i].data = (char*)malloc(imp->chunk_bytes + 1);
+        if (imp->ring[i].data == NULL) {
+            free_ring(imp);
+            free(parsers);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    pthread_mutex_init(&imp->lock, NULL);
+    pthread_cond_init(&imp->cond, NULL);
+    imp->end_seq = UINT64_MAX;
+
+    vdb_status_t status = VDB_OK;
+    pthread_t reader;
+    bool reader_started = pthread_create(&reader, NULL, reader_main, imp) == 0;
+    uint32_t started = 0;
+    while (reader_started && started < parse_threads &&
+           pthread_create(&parsers[started], NULL, parser_main, imp) == 0) {
+        started++;
+    }
+    if (!reader_started || started == 0) {
+        status = VDB_ERROR_OUT_OF_MEMORY;
+    } else {
+        status = write_chunks(imp, batch_rows, stats);
+    }
+
+    pthread_mutex_lock(&imp->lock);
+    imp->stop = true;
+    pthread_cond_broadcast(&imp->cond);
+    pthread_mutex_unlock(&imp->lock);
+    if (reader_started) {
+        pthread_join(reader, NULL);
+    }
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(parsers[i], NULL);
+    }
+
+    pthread_cond_destroy(&imp->cond);
+    pthread_mutex_destroy(&imp->lock);
+    free_ring(imp);
+    free(parsers);
+    return status;
+}
+
+vdb_status_t vdb_storage_import(
+    vdb_storage_t *storage,
+    const char *path,
+    const vdb_import_params_t *params,
+    vdb_import_stats_t *out_stats
+) {
+    vdb_import_stats_t stats = { 0, 0, 0 };
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+    if (storage == NULL || path == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_import_params_t defaults = vdb_import_params_default();
+    if (params == NULL) {
+        params = &defaults;
+    }
+
+    vdb_collection_info_t info;
+    vdb_status_t status = vdb_storage_get_info(storage, &info);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    import_t imp;
+    memset(&imp, 0, sizeof(imp));
+    imp.storage = storage;
+    imp.dim = info.dim;
+    imp.first_id = params->first_id;
+    imp.format = params->format != VDB_IMPORT_AUTO ? params->format : vdb_import_format_from_path(path);
+    if (imp.format < VDB_IMPORT_FVECS || imp.format > VDB_IMPORT_JSONL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    imp.fd = open(path, O_RDONLY);
+    if (imp.fd < 0) {
+        return errno == ENOENT ? VDB_ERROR_NOT_FOUND : VDB_ERROR_IO;
+    }
+    posix_fadvise(imp.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    imp.rows_left = UINT64_MAX;
+    imp.elem_size = sizeof(float);
+    if (imp.format == VDB_IMPORT_NPY) {
+        status = npy_read_header(&imp);
+    } else if (imp.format == VDB_IMPORT_FVECS) {
+        // rows of another dimension wouldn't even frame right
+        int32_t first_dim = 0;
+        ssize_t n = pread(imp.fd, &first_dim, sizeof(first_dim), 0);
+        if (n < 0) {
+            status = VDB_ERROR_IO;
+        } else if (n == (ssize_t)sizeof(first_dim) && first_dim != (int32_t)imp.dim) {
+            stats.failed_record = 1;
+            status = VDB_ERROR_DIMENSION_MISMATCH;
+        }
+    }
+    imp.row_bytes = imp.dim * imp.elem_size + (imp.format == VDB_IMPORT_FVECS ? sizeof(int32_t) : 0);
+
+    // fixed rows go in whole-row chunks
+    imp.chunk_bytes = params->chunk_bytes > 0 ? params->chunk_bytes : VDB_IMPORT_DEFAULT_CHUNK_BYTES;
+    if (imp.format != VDB_IMPORT_JSONL) {
+        size_t rows = imp.chunk_bytes / imp.row_bytes;
+        imp.chunk_bytes = (rows > 0 ? rows : 1) * imp.row_bytes;
+    }
+
+    uint32_t parse_threads = params->parse_threads;
+    if (parse_threads == 0) {
+        size_t workers = vdb_thread_pool_default_workers();
+        parse_threads = workers > 0 ? (uint32_t)workers : 1;
+    }
+    uint32_t batch_rows = params->batch_rows > 0 ? params->batch_rows : VDB_IMPORT_DEFAULT_BATCH_ROWS;
+
+    if (status == VDB_OK) {
+        status = run_pipeline(&imp, parse_threads, batch_rows, &stats);
+    }
+    close(imp.fd);
+    free(imp.carry);
+
+    if (status == VDB_OK && params->build_hnsw) {
+        status = vdb_storage_has_hnsw(storage) ? vdb_storage_seal(storage)
+                                               : vdb_storage_enable_hnsw(storage, NULL);
+    }
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+    return status;
+}
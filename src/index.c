@@ -0,0 +1,842 @@
+/**
+ * index.c - Attaching the HNSW index to a storage
+ *
+ * The index is laid out like an LSM tree. Rows past the sealed segments
+ * are the memtable, which searches scan exactly, so an append never
+ * waits on graph inserts. Once segment_rows of them pile up, the sealer
+ * thread builds a graph over that range and seals it: the graph is
+ * saved once to its own hnsw-<n>.idx and never changes again, and
+ * hnsw.idx - a small manifest of the params and the sealed segments -
+ * is rewritten to list it. Searches walk every segment's graph, scan
+ * the memtable and merge the top-k.
+ *
+ * Graphs are derived data: rows are the source of truth. A segment
+ * missing from disk (crash before it was listed, unreadable file) goes
+ * back to the memtable and is sealed again.
+*/
+
+#include "vdb/storage.h"
+#include "storage_internal.h"
+#include "hnsw.h"
+#include "crc32c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <unistd.h>
+
+/* Seals at least this big (bulk build, vdb_storage_seal) use every
+ * search thread; below it the hand-off costs more than it saves */
+#define INDEX_PARALLEL_MIN_ROWS 1024
+
+/* The sealer checks for close every this many inserts */
+#define INDEX_STOP_CHECK_ROWS 256
+
+/* hnsw.idx format */
+#define MANIFEST_MAGIC 0x47455348u /* "HSEG" */
+#define MANIFEST_VERSION 1u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t m;
+    uint32_t ef_construction;
+    uint32_t ef_search;
+    uint32_t num_segments;
+    uint64_t next_file;
+    uint32_t crc; // CRC32C of the segment entries
+    uint32_t reserved;
+} __attribute__((packed)) manifest_header_t;
+
+typedef struct {
+    uint64_t first;
+    uint64_t rows;
+    uint64_t file;
+} __attribute__((packed)) manifest_entry_t;
+
+/**
+ * Path to hnsw.idx of a collection
+ * VDB_ERROR_INVALID_ARGUMENT if it doesn't fit in MAX_PATH (as below)
+*/
+static vdb_status_t index_path(const char *base_dir, const char *name, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/hnsw.idx", base_dir, name);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+/**
+ * Path to the graph file of a segment
+*/
+static vdb_status_t segment_path(const char *base_dir, const char *name, uint64_t file, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/hnsw-%" PRIu64 ".idx", base_dir, name, file);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+static vdb_status_t collection_dir(const char *base_dir, const char *name, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s", base_dir, name);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+vdb_hnsw_params_t vdb_hnsw_params_default(void) {
+    vdb_hnsw_params_t params = { 16, 200, 64 };
+    return params;
+}
+
+static bool params_valid(const vdb_hnsw_params_t *params) {
+    return params->m >= VDB_HNSW_MIN_M && params->m <= VDB_HNSW_MAX_M &&
+        params->ef_construction > 0 && params->ef_search > 0;
+}
+
+void storage_index_segments_free(index_segment_t *segments, size_t num) {
+    for (size_t i = 0; i < num; i++) {
+        hnsw_destroy(&segments[i].graph);
+    }
+    free(segments);
+}
+
+/* ------------------------------------------------------------------ */
+/* Manifest                                                            */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Write a manifest listing segments to path.tmp, fsync it and rename
+ * it over path
+*/
+static vdb_status_t write_manifest(const vdb_storage_t *storage, const char *path,
+                                   const index_segment_t *segments, size_t num) {
+    manifest_entry_t *entries = (manifest_entry_t*)calloc(num > 0 ? num : 1, sizeof(manifest_entry_t));
+    if (entries == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < num; i++) {
+        entries[i].first = segments[i].first;
+        entries[i].rows = hnsw_count(segments[i].graph);
+        entries[i].file = segments[i].file;
+    }
+
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MANIFEST_MAGIC;
+    header.version = MANIFEST_VERSION;
+    header.m = storage->hnsw_params.m;
+    header.ef_construction = storage->hnsw_params.ef_construction;
+    header.ef_search = storage->hnsw_params.ef_search;
+    header.num_segments = (uint32_t)num;
+    header.next_file = storage->next_segment_file;
+    header.crc = crc32c(0, entries, num * sizeof(manifest_entry_t));
+
+    char tmp_path[MAX_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        free(entries);
+        return VDB_ERROR_IO;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(entries, sizeof(manifest_entry_t), num, fp) == num;
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+    free(entries);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Read hnsw.idx
+ *
+ * Returns:
+ * - VDB_ERROR_NOT_FOUND: No file
+ * - VDB_ERROR_CORRUPTED: Not a manifest (or a damaged one)
+*/
+static vdb_status_t read_manifest(const char *path, manifest_header_t *out_header,
+                                  manifest_entry_t **out_entries) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    manifest_header_t header;
+    vdb_hnsw_params_t params;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != MANIFEST_MAGIC || header.version != MANIFEST_VERSION) {
+        fclose(fp);
+        return VDB_ERROR_CORRUPTED;
+    }
+    params.m = header.m;
+    params.ef_construction = header.ef_construction;
+    params.ef_search = header.ef_search;
+
+    size_t num = header.num_segments;
+    manifest_entry_t *entries = (manifest_entry_t*)malloc((num > 0 ? num : 1) * sizeof(manifest_entry_t));
+    if (entries == NULL) {
+        fclose(fp);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    bool ok = fread(entries, sizeof(manifest_entry_t), num, fp) == num;
+    fclose(fp);
+    if (!ok || !params_valid(&params) || crc32c(0, entries, num * sizeof(manifest_entry_t)) != header.crc) {
+        free(entries);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    *out_header = header;
+    *out_entries = entries;
+    return VDB_OK;
+}
+
+/**
+ * Delete hnsw-<n>.idx files no segment points at (left by a crash, a
+ * segment that failed to load, or a compaction)
+*/
+static void remove_orphans(vdb_storage_t *storage) {
+    char dir_path[MAX_PATH];
+    if (collection_dir(storage->base_dir, storage->name, dir_path) != VDB_OK) {
+        return;
+    }
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t file;
+        int end = 0;
+        if (sscanf(entry->d_name, "hnsw-%" SCNu64 ".idx%n", &file, &end) != 1 ||
+            end == 0 || entry->d_name[end] != '\0') {
+            continue;
+        }
+        bool used = false;
+        pthread_rwlock_rdlock(&storage->index_lock);
+        for (size_t i = 0; i < storage->num_segments && !used; i++) {
+            used = storage->segments[i].file == file;
+        }
+        pthread_rwlock_unlock(&storage->index_lock);
+        if (!used) {
+            char path[MAX_PATH];
+            if (segment_path(storage->base_dir, storage->name, file, path) == VDB_OK) {
+                unlink(path);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+/* ------------------------------------------------------------------ */
+/* Sealing                                                             */
+/* ------------------------------------------------------------------ */
+
+static bool seal_stopping(vdb_storage_t *storage) {
+    pthread_mutex_lock(&storage->seal_wait_lock);
+    bool stop = storage->seal_stop;
+    pthread_mutex_unlock(&storage->seal_wait_lock);
+    return stop;
+}
+
+/**
+ * Build a graph over rows [first, first + rows) of view
+ * With a pool big ranges are built in parallel; without one (the
+ * sealer) nodes go in one by one, giving up if the storage closes.
+*/
+static vdb_status_t build_segment(vdb_storage_t *storage, const storage_view_t *view, uint64_t first,
+                                  uint32_t rows, vdb_thread_pool_t *pool, hnsw_index_t **out_graph) {
+    hnsw_space_t space = { storage_scan_metric(storage), storage->scan_dim,
+                           view->embeddings + first * storage->row_bytes, storage->row_bytes,
+                           storage->element, storage->dim_kernel };
+    pthread_rwlock_rdlock(&storage->index_lock);
+    vdb_hnsw_params_t params = storage->hnsw_params;
+    pthread_rwlock_unlock(&storage->index_lock);
+
+    hnsw_index_t *graph = NULL;
+    vdb_status_t status = hnsw_create(&params, &graph);
+    if (status == VDB_OK && pool != NULL && rows >= INDEX_PARALLEL_MIN_ROWS) {
+        status = hnsw_insert_parallel(graph, &space, rows, pool);
+    }
+    while (status == VDB_OK && hnsw_count(graph) < rows) {
+        if (pool == NULL && hnsw_count(graph) % INDEX_STOP_CHECK_ROWS == 0 && seal_stopping(storage)) {
+            status = VDB_ERROR_UNKNOWN; // closing; the rows stay in the memtable
+            break;
+        }
+        status = hnsw_insert(graph, &space);
+    }
+
+    if (status != VDB_OK) {
+        hnsw_destroy(&graph);
+        return status;
+    }
+    *out_graph = graph;
+    return VDB_OK;
+}
+
+/**
+ * Add a freshly built segment after the last one
+*/
+static vdb_status_t install_segment(vdb_storage_t *storage, hnsw_index_t *graph, uint64_t first) {
+    pthread_rwlock_wrlock(&storage->index_lock);
+    index_segment_t *grown = (index_segment_t*)realloc(storage->segments,
+                                                       (storage->num_segments + 1) * sizeof(index_segment_t));
+    if (grown == NULL) {
+        pthread_rwlock_unlock(&storage->index_lock);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    grown[storage->num_segments].first = first;
+    grown[storage->num_segments].graph = graph;
+    grown[storage->num_segments].file = 0;
+    storage->segments = grown;
+    storage->num_segments++;
+    storage->sealed_rows = first + hnsw_count(graph);
+    pthread_rwlock_unlock(&storage->index_lock);
+    query_cache_invalidate(storage->query_cache);
+    return VDB_OK;
+}
+
+/**
+ * Seal the memtable into segments and save them - caller holds compact_lock
+ * Only full segments, unless all is set: then the rest becomes one too.
+ * parallel builds on the search pool, else one node at a time.
+*/
+static vdb_status_t seal_locked(vdb_storage_t *storage, bool all, bool parallel) {
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    vdb_thread_pool_t *pool = parallel ? storage_get_pool(storage) : NULL; // under the view's guard
+    bool sealed = false;
+    while (status == VDB_OK) {
+        pthread_rwlock_rdlock(&storage->index_lock);
+        uint64_t first = storage->sealed_rows;
+        uint64_t size = storage->segment_rows;
+        pthread_rwlock_unlock(&storage->index_lock);
+
+        uint64_t left = view.count > first ? view.count - first : 0;
+        if (left == 0 || (!all && left < size)) {
+            break;
+        }
+        uint32_t rows = (uint32_t)(left < size ? left : size);
+
+        hnsw_index_t *graph = NULL;
+        status = build_segment(storage, &view, first, rows, pool, &graph);
+        if (status == VDB_OK) {
+            status = install_segment(storage, graph, first);
+            if (status != VDB_OK) {
+                hnsw_destroy(&graph);
+            }
+        }
+        sealed = sealed || status == VDB_OK;
+    }
+    storage_release_view(storage, &view);
+
+    if (sealed) {
+        vdb_status_t saved = storage_index_save(storage);
+        status = status == VDB_OK ? saved : status;
+    }
+    return status;
+}
+
+/**
+ * Seal full segments whenever appends signal there are some
+*/
+static void *seal_main(void *arg) {
+    vdb_storage_t *storage = (vdb_storage_t*)arg;
+
+    pthread_mutex_lock(&storage->seal_wait_lock);
+    while (!storage->seal_stop) {
+        if (!storage->seal_pending) {
+            pthread_cond_wait(&storage->seal_cond, &storage->seal_wait_lock);
+            continue;
+        }
+        storage->seal_pending = false;
+        pthread_mutex_unlock(&storage->seal_wait_lock);
+
+        // a failed seal is simply tried again after the next append
+        pthread_mutex_lock(&storage->compact_lock);
+        seal_locked(storage, false, false);
+        pthread_mutex_unlock(&storage->compact_lock);
+
+        pthread_mutex_lock(&storage->seal_wait_lock);
+    }
+    pthread_mutex_unlock(&storage->seal_wait_lock);
+    return NULL;
+}
+
+/**
+ * Wake the sealer (starting it if need be) once the memtable holds a
+ * full segment - caller holds write_lock
+*/
+vdb_status_t storage_index_catch_up(vdb_storage_t *storage) {
+    if (!storage->hnsw_enabled) {
+        return VDB_OK;
+    }
+    pthread_rwlock_rdlock(&storage->index_lock);
+    bool due = storage->count >= storage->sealed_rows + storage->segment_rows;
+    pthread_rwlock_unlock(&storage->index_lock);
+    if (!due) {
+        return VDB_OK;
+    }
+
+    vdb_status_t status = VDB_OK;
+    pthread_mutex_lock(&storage->seal_wait_lock);
+    if (!storage->seal_thread_running && !storage->seal_stop) {
+        if (pthread_create(&storage->seal_thread, NULL, seal_main, storage) != 0) {
+            status = VDB_ERROR_UNKNOWN;
+        } else {
+            storage->seal_thread_running = true;
+        }
+    }
+    storage->seal_pending = true;
+    pthread_cond_signal(&storage->seal_cond);
+    pthread_mutex_unlock(&storage->seal_wait_lock);
+    return status;
+}
+
+void storage_index_stop(vdb_storage_t *storage) {
+    pthread_mutex_lock(&storage->seal_wait_lock);
+    if (!storage->seal_thread_running) {
+        pthread_mutex_unlock(&storage->seal_wait_lock);
+        return;
+    }
+    storage->seal_stop = true;
+    pthread_cond_signal(&storage->seal_cond);
+    pthread_mutex_unlock(&storage->seal_wait_lock);
+
+    pthread_join(storage->seal_thread, NULL);
+
+    pthread_mutex_lock(&storage->seal_wait_lock);
+    storage->seal_thread_running = false;
+    pthread_mutex_unlock(&storage->seal_wait_lock);
+}
+
+/* ------------------------------------------------------------------ */
+/* Load / save                                                         */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Attach the segments a manifest lists, up to the first one that is
+ * missing, damaged or past the stored rows
+*/
+static vdb_status_t load_segments(vdb_storage_t *storage, const manifest_entry_t *entries, size_t num) {
+    index_segment_t *segments = (index_segment_t*)calloc(num > 0 ? num : 1, sizeof(index_segment_t));
+    if (segments == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    size_t loaded = 0;
+    uint64_t end = 0;
+    vdb_status_t status = VDB_OK;
+    for (size_t i = 0; i < num && status == VDB_OK; i++) {
+        if (entries[i].first != end || entries[i].rows == 0 || entries[i].file == 0 ||
+            entries[i].rows > storage->count - end) {
+            break;
+        }
+        char path[MAX_PATH];
+        hnsw_index_t *graph = NULL;
+        status = segment_path(storage->base_dir, storage->name, entries[i].file, path);
+        if (status == VDB_OK) {
+            status = hnsw_load(path, &graph);
+        }
+        if (status == VDB_OK && hnsw_count(graph) != entries[i].rows) {
+            hnsw_destroy(&graph);
+            status = VDB_ERROR_CORRUPTED;
+        }
+        if (status != VDB_OK) {
+            // the rest of the rows are sealed again from the memtable
+            status = status == VDB_ERROR_OUT_OF_MEMORY ? status : VDB_OK;
+            break;
+        }
+        hnsw_set_ef_search(graph, storage->hnsw_params.ef_search);
+        segments[loaded].first = end;
+        segments[loaded].graph = graph;
+        segments[loaded].file = entries[i].file;
+        loaded++;
+        end += entries[i].rows;
+    }
+
+    if (status != VDB_OK) {
+        storage_index_segments_free(segments, loaded);
+        return status;
+    }
+    storage->segments = segments;
+    storage->num_segments = loaded;
+    storage->sealed_rows = end;
+    return VDB_OK;
+}
+
+/**
+ * Attach an hnsw.idx from before segments: one graph over every row,
+ * which becomes the first segment
+*/
+static vdb_status_t load_legacy(vdb_storage_t *storage, const char *path) {
+    hnsw_index_t *graph = NULL;
+    vdb_status_t status = hnsw_load(path, &graph);
+    if (status == VDB_ERROR_CORRUPTED) {
+        // unreadable file: the graphs can always be rebuilt from the rows
+        storage->hnsw_params = vdb_hnsw_params_default();
+        return VDB_OK;
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    hnsw_get_params(graph, &storage->hnsw_params);
+    if (hnsw_count(graph) == 0 || hnsw_count(graph) > storage->count) {
+        // empty, or saw rows that never became durable
+        hnsw_destroy(&graph);
+        return VDB_OK;
+    }
+    storage->segments = (index_segment_t*)calloc(1, sizeof(index_segment_t));
+    if (storage->segments == NULL) {
+        hnsw_destroy(&graph);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    storage->segments[0].graph = graph; // saved as a segment on the next save
+    storage->num_segments = 1;
+    storage->sealed_rows = hnsw_count(graph);
+    return VDB_OK;
+}
+
+/**
+ * Load hnsw.idx and its segments on open
+*/
+vdb_status_t storage_index_load(vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    vdb_status_t status = index_path(storage->base_dir, storage->name, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    manifest_header_t header;
+    manifest_entry_t *entries = NULL;
+    status = read_manifest(path, &header, &entries);
+    if (status == VDB_ERROR_NOT_FOUND) {
+        return VDB_OK; // no index enabled
+    }
+
+    if (status == VDB_OK) {
+        storage->hnsw_params.m = header.m;
+        storage->hnsw_params.ef_construction = header.ef_construction;
+        storage->hnsw_params.ef_search = header.ef_search;
+        storage->next_segment_file = header.next_file;
+        status = load_segments(storage, entries, header.num_segments);
+        free(entries);
+    } else if (status == VDB_ERROR_CORRUPTED) {
+        status = load_legacy(storage, path);
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (storage->next_segment_file == 0) {
+        storage->next_segment_file = 1;
+    }
+
+    storage->hnsw_enabled = true; // not shared yet, no readers to exclude
+    remove_orphans(storage);
+    pthread_mutex_lock(&storage->write_lock);
+    storage->hnsw_space.metric = storage_scan_metric(storage);
+    storage->hnsw_space.dim = storage->scan_dim;
+    storage->hnsw_space.element = storage->element;
+    storage->hnsw_space.stride = storage->row_bytes;
+    storage->hnsw_space.kernel = storage->dim_kernel;
+    status = storage_index_catch_up(storage);
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Write the segments not saved yet, then hnsw.idx listing them all
+*/
+vdb_status_t storage_index_save(vdb_storage_t *storage) {
+    if (!storage->hnsw_enabled) {
+        return VDB_OK;
+    }
+
+    /* sealed graphs never change, so they are written under the read lock */
+    vdb_status_t status = VDB_OK;
+    pthread_rwlock_rdlock(&storage->index_lock);
+    size_t num = storage->num_segments;
+    uint64_t *files = (uint64_t*)calloc(num > 0 ? num : 1, sizeof(uint64_t));
+    if (files == NULL) {
+        status = VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < num && status == VDB_OK; i++) {
+        if (storage->segments[i].file != 0) {
+            continue;
+        }
+        char path[MAX_PATH];
+        files[i] = storage->next_segment_file++;
+        status = segment_path(storage->base_dir, storage->name, files[i], path);
+        if (status == VDB_OK) {
+            status = hnsw_save(storage->segments[i].graph, path);
+        }
+        if (status == VDB_OK) {
+            stats_add(storage->stats, STATS_BYTES_INDEX, hnsw_file_bytes(storage->segments[i].graph));
+        }
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+
+    if (files != NULL) {
+        pthread_rwlock_wrlock(&storage->index_lock);
+        for (size_t i = 0; i < num; i++) {
+            if (files[i] != 0 && status == VDB_OK) {
+                storage->segments[i].file = files[i];
+            }
+        }
+        pthread_rwlock_unlock(&storage->index_lock);
+        free(files);
+    }
+
+    char path[MAX_PATH];
+    if (status == VDB_OK) {
+        status = index_path(storage->base_dir, storage->name, path);
+    }
+    if (status == VDB_OK) {
+        pthread_rwlock_rdlock(&storage->index_lock);
+        status = write_manifest(storage, path, storage->segments, storage->num_segments);
+        pthread_rwlock_unlock(&storage->index_lock);
+    }
+    if (status == VDB_OK) {
+        remove_orphans(storage);
+    }
+    return status;
+}
+
+vdb_status_t storage_index_stand_in(const vdb_storage_t *storage, const char *path) {
+    return write_manifest(storage, path, NULL, 0);
+}
+
+/* ------------------------------------------------------------------ */
+/* Compaction                                                          */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Remap every segment onto the rows compaction keeps
+ * Segments stay back to back: each starts where the kept rows of the
+ * ones before it end. Segments left with no rows are dropped.
+*/
+vdb_status_t storage_index_remap(vdb_storage_t *storage, const uint64_t *new_rows,
+                                 index_segment_t **out_segments, size_t *out_num) {
+    pthread_rwlock_rdlock(&storage->index_lock);
+    size_t num = storage->num_segments;
+    index_segment_t *out = (index_segment_t*)calloc(num > 0 ? num : 1, sizeof(index_segment_t));
+    vdb_status_t status = out != NULL ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+
+    size_t kept = 0;
+    uint64_t end = 0;
+    for (size_t i = 0; i < num && status == VDB_OK; i++) {
+        const index_segment_t *seg = &storage->segments[i];
+        uint32_t nodes = hnsw_count(seg->graph);
+        uint32_t *new_ids = (uint32_t*)malloc((nodes > 0 ? nodes : 1) * sizeof(uint32_t));
+        if (new_ids == NULL) {
+            status = VDB_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        uint32_t live = 0;
+        for (uint32_t node = 0; node < nodes; node++) {
+            uint64_t row = new_rows[seg->first + node];
+            new_ids[node] = row == UINT64_MAX ? HNSW_REMAP_DROPPED : (uint32_t)(row - end);
+            live += row == UINT64_MAX ? 0 : 1;
+        }
+        if (live > 0) {
+            status = hnsw_remap(seg->graph, new_ids, &out[kept].graph);
+            if (status == VDB_OK) {
+                out[kept].first = end;
+                kept++;
+                end += live;
+            }
+        }
+        free(new_ids);
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+
+    if (status != VDB_OK) {
+        storage_index_segments_free(out, kept);
+        return status;
+    }
+    *out_segments = out;
+    *out_num = kept;
+    return VDB_OK;
+}
+
+void storage_index_adopt(vdb_storage_t *storage, index_segment_t *segments, size_t num) {
+    pthread_rwlock_wrlock(&storage->index_lock);
+    storage_index_segments_free(storage->segments, storage->num_segments);
+    storage->segments = segments;
+    storage->num_segments = num;
+    storage->sealed_rows = num > 0 ? segments[num - 1].first + hnsw_count(segments[num - 1].graph) : 0;
+    pthread_rwlock_unlock(&storage->index_lock);
+    query_cache_invalidate(storage->query_cache);
+}
+
+/* ------------------------------------------------------------------ */
+/* Public API                                                          */
+/* ------------------------------------------------------------------ */
+
+/**
+ * Turn the index on and seal every existing row
+*/
+vdb_status_t vdb_storage_enable_hnsw(vdb_storage_t *storage, const vdb_hnsw_params_t *params) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    vdb_hnsw_params_t p = params != NULL ? *params : vdb_hnsw_params_default();
+    if (!params_valid(&p)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->compact_lock);
+    pthread_mutex_lock(&storage->write_lock);
+    if (storage->hnsw_enabled) {
+        pthread_mutex_unlock(&storage->write_lock);
+        pthread_mutex_unlock(&storage->compact_lock);
+        return VDB_ERROR_ALREADY_EXISTS;
+    }
+    pthread_rwlock_wrlock(&storage->index_lock);
+    storage->hnsw_params = p;
+    storage->hnsw_space.metric = storage_scan_metric(storage);
+    storage->hnsw_space.dim = storage->scan_dim;
+    storage->hnsw_space.element = storage->element;
+    storage->hnsw_space.stride = storage->row_bytes;
+    storage->hnsw_space.kernel = storage->dim_kernel;
+    storage->next_segment_file = 1;
+    storage->hnsw_enabled = true;
+    pthread_rwlock_unlock(&storage->index_lock);
+    pthread_mutex_unlock(&storage->write_lock);
+
+    // appends go on meanwhile, into the memtable
+    vdb_status_t status = seal_locked(storage, true, true);
+    if (status == VDB_OK) {
+        status = storage_index_save(storage); // hnsw.idx even with no rows yet
+    }
+    if (status != VDB_OK) {
+        pthread_mutex_lock(&storage->write_lock);
+        pthread_rwlock_wrlock(&storage->index_lock);
+        storage_index_segments_free(storage->segments, storage->num_segments);
+        storage->segments = NULL;
+        storage->num_segments = 0;
+        storage->sealed_rows = 0;
+        storage->hnsw_enabled = false;
+        pthread_rwlock_unlock(&storage->index_lock);
+        pthread_mutex_unlock(&storage->write_lock);
+    }
+    pthread_mutex_unlock(&storage->compact_lock);
+    return status;
+}
+
+bool vdb_storage_has_hnsw(const vdb_storage_t *storage) {
+    return storage != NULL && storage->hnsw_enabled;
+}
+
+/**
+ * Seal the whole memtable now
+*/
+vdb_status_t vdb_storage_seal(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (!storage->hnsw_enabled) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&storage->compact_lock);
+    vdb_status_t status = seal_locked(storage, true, true);
+    pthread_mutex_unlock(&storage->compact_lock);
+    return status;
+}
+
+/**
+ * Change how many memtable rows make a segment
+*/
+vdb_status_t vdb_storage_set_segment_rows(vdb_storage_t *storage, uint32_t rows) {
+    if (storage == NULL || rows == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    pthread_rwlock_wrlock(&storage->index_lock);
+    storage->segment_rows = rows;
+    pthread_rwlock_unlock(&storage->index_lock);
+    vdb_status_t status = storage_index_catch_up(storage);
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Change the default efSearch
+*/
+vdb_status_t vdb_storage_set_ef_search(vdb_storage_t *storage, uint32_t ef_search) {
+    if (storage == NULL || ef_search == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (!storage->hnsw_enabled) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    pthread_rwlock_wrlock(&storage->index_lock);
+    storage->hnsw_params.ef_search = ef_search;
+    for (size_t i = 0; i < storage->num_segments; i++) {
+        hnsw_set_ef_search(storage->segments[i].graph, ef_search);
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+    query_cache_invalidate(storage->query_cache);
+    return VDB_OK;
+}
+
+/**
+ * Change how much of each graph's top layers is pinned
+*/
+vdb_status_t vdb_storage_set_hnsw_pinned_bytes(vdb_storage_t *storage, size_t bytes) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    // searches pin the graphs again, to the new size, as they walk them
+    pthread_rwlock_wrlock(&storage->index_lock);
+    storage->hnsw_pinned_bytes = bytes;
+    for (size_t i = 0; i < storage->num_segments; i++) {
+        hnsw_unpin(storage->segments[i].graph);
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+    query_cache_invalidate(storage->query_cache); // quantized walks descend differently
+    return VDB_OK;
+}
+
+/**
+ * Memory the pinned top layers take now
+*/
+size_t vdb_storage_hnsw_pinned_memory(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return 0;
+    }
+    size_t bytes = 0;
+    pthread_rwlock_rdlock(&storage->index_lock);
+    for (size_t i = 0; i < storage->num_segments; i++) {
+        bytes += hnsw_pinned_bytes(storage->segments[i].graph);
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+    return bytes;
+}
+
+size_t vdb_storage_memory_usage(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return 0;
+    }
+    // a graph's file is its arrays as they are in memory
+    size_t bytes = 0;
+    pthread_rwlock_rdlock(&storage->index_lock);
+    for (size_t i = 0; i < storage->num_segments; i++) {
+        bytes += (size_t)hnsw_file_bytes(storage->segments[i].graph) +
+            hnsw_pinned_bytes(storage->segments[i].graph);
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+
+    pthread_rwlock_rdlock(&storage->id_lock);
+    bytes += id_index_memory_bytes(storage->ids);
+    pthread_rwlock_unlock(&storage->id_lock);
+    pthread_rwlock_rdlock(&storage->filter_lock);
+    bytes += filter_index_memory_bytes(storage->filters);
+    pthread_rwlock_unlock(&storage->filter_lock);
+    return bytes + storage_quant_memory(storage) + query_cache_bytes(storage->query_cache);
+}
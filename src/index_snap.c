@@ -0,0 +1,420 @@
+/**
+ * index_snap.c - index.snap: container format and the storage hooks
+ *
+ * A snapshot is only ever taken right after a checkpoint recorded the
+ * same count in collection.meta, so it never covers rows a crash could
+ * take back. Open trusts it when it fits the collection - no more rows,
+ * metadata or WAL position than the checkpoint there - and deletes it
+ * otherwise. Compaction renumbers the rows and deletes it before its
+ * swap commits.
+*/
+
+#include "index_snap.h"
+#include "storage_internal.h"
+#include "superblock.h"
+#include "crc32c.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_SNAP_MAGIC 0x50414E53u /* "SNAP" */
+#define INDEX_SNAP_VERSION 1u
+
+/* Ranges a snapshot can hand over (one per section is plenty) */
+#define INDEX_SNAP_MAX_TAKEN INDEX_SNAP_MAX_SECTIONS
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t lsn;
+    uint64_t count;
+    uint64_t metadata_bytes;
+    uint64_t file_bytes;
+    uint32_t num_sections;
+    uint32_t crc; // CRC32C of the header up to here and the section table
+} __attribute__((packed)) index_snap_header_t;
+
+_Static_assert(sizeof(index_snap_header_t) + INDEX_SNAP_MAX_SECTIONS * sizeof(index_snap_section_t)
+               <= INDEX_SNAP_ALIGN, "header block overflows");
+
+struct index_snap {
+    uint8_t *addr;
+    size_t len;
+    index_snap_info_t info;
+    uint32_t num_sections;
+    index_snap_section_t sections[INDEX_SNAP_MAX_SECTIONS];
+    size_t taken_offset[INDEX_SNAP_MAX_TAKEN];
+    size_t taken_len[INDEX_SNAP_MAX_TAKEN];
+    size_t num_taken;
+};
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + INDEX_SNAP_ALIGN - 1) / INDEX_SNAP_ALIGN * INDEX_SNAP_ALIGN;
+}
+
+static uint32_t header_crc(const index_snap_header_t *header, const index_snap_section_t *sections) {
+    uint32_t crc = crc32c(0, header, offsetof(index_snap_header_t, crc));
+    return crc32c(crc, sections, header->num_sections * sizeof(index_snap_section_t));
+}
+
+/* ------------------------------------------------------------------ */
+/* Writing                                                             */
+/* ------------------------------------------------------------------ */
+
+static void write_zeros(index_snap_writer_t *w, uint64_t n, bool in_section) {
+    static const uint8_t zeros[4096];
+    while (n > 0 && w->ok) {
+        size_t chunk = n < sizeof(zeros) ? (size_t)n : sizeof(zeros);
+        w->ok = fwrite(zeros, 1, chunk, w->fp) == chunk;
+        if (in_section) {
+            w->crc = crc32c(w->crc, zeros, chunk);
+        }
+        w->offset += chunk;
+        n -= chunk;
+    }
+}
+
+vdb_status_t index_snap_create(index_snap_writer_t *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+    snprintf(w->tmp_path, sizeof(w->tmp_path), "%s.tmp", path);
+    w->fp = fopen(w->tmp_path, "wb");
+    if (w->fp == NULL) {
+        return VDB_ERROR_IO;
+    }
+    w->ok = true;
+    write_zeros(w, INDEX_SNAP_ALIGN, false); // the header block, filled in on commit
+    return VDB_OK;
+}
+
+void index_snap_begin(index_snap_writer_t *w, uint32_t kind) {
+    if (w->num_sections == INDEX_SNAP_MAX_SECTIONS) {
+        w->ok = false;
+        return;
+    }
+    write_zeros(w, align_up(w->offset) - w->offset, false);
+    index_snap_section_t *section = &w->sections[w->num_sections];
+    section->kind = kind;
+    section->offset = w->offset;
+    w->crc = 0;
+}
+
+void index_snap_write(index_snap_writer_t *w, const void *data, size_t len) {
+    if (!w->ok || len == 0) {
+        return;
+    }
+    w->ok = fwrite(data, 1, len, w->fp) == len;
+    w->crc = crc32c(w->crc, data, len);
+    w->offset += len;
+}
+
+void index_snap_pad(index_snap_writer_t *w) {
+    write_zeros(w, align_up(w->offset) - w->offset, true);
+}
+
+void index_snap_end(index_snap_writer_t *w) {
+    if (w->num_sections == INDEX_SNAP_MAX_SECTIONS) {
+        return;
+    }
+    index_snap_section_t *section = &w->sections[w->num_sections++];
+    section->length = w->offset - section->offset;
+    section->crc = w->crc;
+}
+
+vdb_status_t index_snap_commit(index_snap_writer_t *w, const char *path, const index_snap_info_t *info,
+                               uint64_t *out_bytes) {
+    write_zeros(w, align_up(w->offset) - w->offset, false); // whole pages, so the tail can be unmapped
+
+    index_snap_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_SNAP_MAGIC;
+    header.version = INDEX_SNAP_VERSION;
+    header.lsn = info->lsn;
+    header.count = info->count;
+    header.metadata_bytes = info->metadata_bytes;
+    header.file_bytes = w->offset;
+    header.num_sections = w->num_sections;
+    header.crc = header_crc(&header, w->sections);
+
+    bool ok = w->ok && fseek(w->fp, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, w->fp) == 1 &&
+        fwrite(w->sections, sizeof(index_snap_section_t), w->num_sections, w->fp) == w->num_sections;
+    ok = fflush(w->fp) == 0 && ok;
+    ok = fsync(fileno(w->fp)) == 0 && ok;
+    ok = fclose(w->fp) == 0 && ok;
+    w->fp = NULL;
+
+    if (!ok || rename(w->tmp_path, path) != 0) {
+        unlink(w->tmp_path);
+        return VDB_ERROR_IO;
+    }
+    if (out_bytes != NULL) {
+        *out_bytes = w->offset;
+    }
+    return VDB_OK;
+}
+
+void index_snap_abort(index_snap_writer_t *w) {
+    if (w->fp != NULL) {
+        fclose(w->fp);
+        w->fp = NULL;
+    }
+    unlink(w->tmp_path);
+}
+
+/* ------------------------------------------------------------------ */
+/* Reading                                                             */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t index_snap_open(const char *path, index_snap_t **out_snap) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < INDEX_SNAP_ALIGN || (size_t)st.st_size % INDEX_SNAP_ALIGN != 0) {
+        close(fd);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    // private and writable: indexes update the arrays in place, on copies of the pages
+    size_t len = (size_t)st.st_size;
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return VDB_ERROR_IO;
+    }
+
+    index_snap_t *snap = (index_snap_t*)calloc(1, sizeof(index_snap_t));
+    if (snap == NULL) {
+        munmap(addr, len);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    snap->addr = (uint8_t*)addr;
+    snap->len = len;
+
+    index_snap_header_t header;
+    memcpy(&header, addr, sizeof(header));
+    bool ok = header.magic == INDEX_SNAP_MAGIC && header.version == INDEX_SNAP_VERSION &&
+        header.file_bytes == len && header.num_sections <= INDEX_SNAP_MAX_SECTIONS;
+    if (ok) {
+        memcpy(snap->sections, snap->addr + sizeof(header), header.num_sections * sizeof(index_snap_section_t));
+        ok = header_crc(&header, snap->sections) == header.crc;
+    }
+    for (uint32_t i = 0; ok && i < header.num_sections; i++) {
+        const index_snap_section_t *section = &snap->sections[i];
+        ok = section->offset >= INDEX_SNAP_ALIGN && section->offset % INDEX_SNAP_ALIGN == 0 &&
+            section->offset <= len && section->length <= len - section->offset &&
+            crc32c(0, snap->addr + section->offset, (size_t)section->length) == section->crc;
+    }
+    if (!ok) {
+        index_snap_close(&snap);
+        return VDB_ERROR_CORRUPTED;
+    }
+    snap->num_sections = header.num_sections;
+    snap->info.lsn = header.lsn;
+    snap->info.count = header.count;
+    snap->info.metadata_bytes = header.metadata_bytes;
+
+    *out_snap = snap;
+    return VDB_OK;
+}
+
+void index_snap_close(index_snap_t **snap) {
+    if (snap == NULL || *snap == NULL) {
+        return;
+    }
+    index_snap_t *s = *snap;
+    // unmap the gaps between the taken ranges (taken in file order)
+    size_t from = 0;
+    for (size_t i = 0; i <= s->num_taken; i++) {
+        size_t to = i < s->num_taken ? s->taken_offset[i] : s->len;
+        if (to > from) {
+            munmap(s->addr + from, to - from);
+        }
+        if (i < s->num_taken) {
+            from = s->taken_offset[i] + s->taken_len[i];
+        }
+    }
+    free(s);
+    *snap = NULL;
+}
+
+const index_snap_info_t *index_snap_info(const index_snap_t *snap) {
+    return &snap->info;
+}
+
+bool index_snap_section(index_snap_t *snap, uint32_t kind, index_snap_reader_t *out) {
+    for (uint32_t i = 0; i < snap->num_sections; i++) {
+        if (snap->sections[i].kind == kind) {
+            out->snap = snap;
+            out->pos = (size_t)snap->sections[i].offset;
+            out->end = out->pos + (size_t)snap->sections[i].length;
+            return true;
+        }
+    }
+    return false;
+}
+
+const void *index_snap_read(index_snap_reader_t *r, size_t len) {
+    if (len > r->end - r->pos) {
+        return NULL;
+    }
+    const void *data = r->snap->addr + r->pos;
+    r->pos += len;
+    return data;
+}
+
+void index_snap_skip_pad(index_snap_reader_t *r) {
+    size_t next = (size_t)align_up(r->pos);
+    r->pos = next < r->end ? next : r->end;
+}
+
+void *index_snap_take(index_snap_reader_t *r, size_t len) {
+    index_snap_t *s = r->snap;
+    size_t mapped = (size_t)align_up(len);
+    long page = sysconf(_SC_PAGESIZE);
+    if (len == 0 || r->pos % INDEX_SNAP_ALIGN != 0 || mapped > r->end - r->pos ||
+        page <= 0 || INDEX_SNAP_ALIGN % page != 0 || s->num_taken == INDEX_SNAP_MAX_TAKEN ||
+        (s->num_taken > 0 && r->pos < s->taken_offset[s->num_taken - 1] + s->taken_len[s->num_taken - 1])) {
+        return NULL;
+    }
+    s->taken_offset[s->num_taken] = r->pos;
+    s->taken_len[s->num_taken] = mapped;
+    s->num_taken++;
+    void *addr = s->addr + r->pos;
+    r->pos += mapped;
+    return addr;
+}
+
+void index_snap_untake(void *addr, size_t len) {
+    munmap(addr, (size_t)align_up(len));
+}
+
+/* ------------------------------------------------------------------ */
+/* Storage hooks                                                       */
+/* ------------------------------------------------------------------ */
+
+/* VDB_ERROR_INVALID_ARGUMENT if the path doesn't fit in MAX_PATH */
+static vdb_status_t snap_path(const char *base_dir, const char *name, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/index.snap", base_dir, name);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+/**
+ * Map index.snap for the loads that follow (open path, after WAL replay)
+ * A snapshot that doesn't fit the collection is deleted; with none,
+ * the indexes are built as before.
+*/
+vdb_status_t storage_index_snap_open(vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    storage->snap_count = UINT64_MAX; // none yet: the next checkpoint writes one
+    vdb_status_t status = snap_path(storage->base_dir, storage->name, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    index_snap_t *snap = NULL;
+    status = index_snap_open(path, &snap);
+    if (status == VDB_ERROR_NOT_FOUND) {
+        return VDB_OK;
+    }
+    if (status == VDB_OK) {
+        const index_snap_info_t *info = index_snap_info(snap);
+        bool at_checkpoint = info->count == storage->checkpoint_count &&
+                             storage->checkpoint_metadata_bytes != SUPERBLOCK_METADATA_UNKNOWN;
+        if (info->count > storage->checkpoint_count || info->lsn > storage->checkpoint_lsn ||
+            info->metadata_bytes > storage->metadata_bytes ||
+            (at_checkpoint && info->metadata_bytes != storage->checkpoint_metadata_bytes)) {
+            index_snap_close(&snap);
+            status = VDB_ERROR_CORRUPTED;
+        }
+    }
+    if (status == VDB_ERROR_CORRUPTED) {
+        unlink(path);
+        return VDB_OK;
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+    storage->index_snap = snap;
+    return VDB_OK;
+}
+
+/**
+ * Unmap index.snap once the indexes are loaded, remembering what it
+ * holds so an unchanged collection isn't snapshotted again
+*/
+void storage_index_snap_release(vdb_storage_t *storage) {
+    if (storage->index_snap == NULL) {
+        return;
+    }
+    if (storage->snap_ids_used && storage->snap_filters_used) {
+        storage->snap_count = index_snap_info(storage->index_snap)->count;
+    }
+    index_snap_close(&storage->index_snap);
+}
+
+/**
+ * Write index.snap if the indexes changed since the last one
+ * Only right after a checkpoint (count == checkpoint_count), and only
+ * once both indexes are loaded. Caller holds write_lock. A failure
+ * leaves the previous snapshot, which only means a longer catch-up.
+*/
+vdb_status_t storage_index_snap_save(vdb_storage_t *storage) {
+    if (storage->ids == NULL || storage->filters == NULL || storage->count != storage->checkpoint_count) {
+        return VDB_OK;
+    }
+    uint64_t deletes = id_index_deletes(storage->ids);
+    if (storage->snap_count == storage->count && storage->snap_deletes == deletes) {
+        return VDB_OK;
+    }
+
+    char path[MAX_PATH];
+    index_snap_writer_t w;
+    vdb_status_t status = snap_path(storage->base_dir, storage->name, path);
+    if (status == VDB_OK) {
+        status = index_snap_create(&w, path);
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+    status = id_index_write_snap(storage->ids, &w);
+    if (status == VDB_OK) {
+        status = filter_index_write_snap(storage->filters, storage->filter_meta_offset, &w);
+    }
+    if (status != VDB_OK) {
+        index_snap_abort(&w);
+        return status;
+    }
+
+    index_snap_info_t info = { storage->checkpoint_lsn, storage->count, storage->metadata_bytes };
+    uint64_t bytes = 0;
+    status = index_snap_commit(&w, path, &info, &bytes);
+    if (status == VDB_OK) {
+        storage->snap_count = storage->count;
+        storage->snap_deletes = deletes;
+        stats_add(storage->stats, STATS_BYTES_INDEX, bytes);
+    }
+    return status;
+}
+
+/**
+ * Delete index.snap: the rows it numbers have been renumbered (compaction)
+*/
+vdb_status_t storage_index_snap_drop(vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    storage->snap_count = UINT64_MAX;
+    vdb_status_t status = snap_path(storage->base_dir, storage->name, path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (unlink(path) != 0 && errno != ENOENT) {
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
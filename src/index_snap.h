@@ -0,0 +1,131 @@
+/**
+ * index_snap.h - Internal snapshot of the in-memory indexes (index.snap)
+ *
+ * The ID index and the metadata filter index are otherwise rebuilt on
+ * open from ids.seg / metadata.seg (or, for IDs, read from ids.idx and
+ * resorted), which takes time in proportion to the whole collection. A
+ * checkpoint writes both to index.snap, tagged with the count and WAL
+ * position it recorded; open maps the file, takes the indexes from it
+ * and only indexes the rows past its count - at most what the WAL
+ * replay brought back, plus anything a failed snapshot left behind.
+ *
+ * Layout: a header block, then one section per index. Sections start
+ * at INDEX_SNAP_ALIGN and carry a CRC32C. Nothing in them is a pointer,
+ * so arrays can be used where they lie in the mapping: it is private
+ * and writable, and writes to it copy the page instead of reaching the
+ * file. HNSW segments are already saved once as immutable files when
+ * sealed, so they are not repeated here.
+*/
+
+#ifndef VDB_INDEX_SNAP_H
+#define VDB_INDEX_SNAP_H
+
+#include "vdb/types.h"
+#include <stdio.h>
+
+/* Section alignment; a multiple of the page size of common targets */
+#define INDEX_SNAP_ALIGN 65536
+
+#define INDEX_SNAP_MAX_SECTIONS 8
+
+/* Section kinds */
+#define INDEX_SNAP_IDS 1u
+#define INDEX_SNAP_FILTERS 2u
+
+/**
+ * Where in the collection a snapshot was taken
+*/
+typedef struct {
+    uint64_t lsn; // next_lsn at the checkpoint
+    uint64_t count; // rows
+    uint64_t metadata_bytes; // length of metadata.seg
+} index_snap_info_t;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t crc;
+    uint64_t offset;
+    uint64_t length;
+} index_snap_section_t;
+
+/**
+ * Writer: sections are streamed to path.tmp, the header goes in last
+ * and the file is renamed over path by index_snap_commit. Write errors
+ * are sticky and reported there.
+*/
+typedef struct {
+    FILE *fp;
+    char tmp_path[1100];
+    uint64_t offset;
+    uint32_t crc; // of the open section
+    uint32_t num_sections;
+    index_snap_section_t sections[INDEX_SNAP_MAX_SECTIONS];
+    bool ok;
+} index_snap_writer_t;
+
+vdb_status_t index_snap_create(index_snap_writer_t *w, const char *path);
+void index_snap_begin(index_snap_writer_t *w, uint32_t kind);
+void index_snap_write(index_snap_writer_t *w, const void *data, size_t len);
+
+/* Pad the open section with zeros to the next INDEX_SNAP_ALIGN */
+void index_snap_pad(index_snap_writer_t *w);
+void index_snap_end(index_snap_writer_t *w);
+
+/**
+ * Write the header, fsync and rename over path; the writer is closed
+ * whatever the outcome. *out_bytes (if not NULL) receives the file length.
+*/
+vdb_status_t index_snap_commit(index_snap_writer_t *w, const char *path, const index_snap_info_t *info,
+                               uint64_t *out_bytes);
+
+/* Close and delete an uncommitted snapshot */
+void index_snap_abort(index_snap_writer_t *w);
+
+typedef struct index_snap index_snap_t;
+
+/**
+ * Cursor over one section of a mapped snapshot
+*/
+typedef struct {
+    index_snap_t *snap;
+    size_t pos; // offset in the file
+    size_t end;
+} index_snap_reader_t;
+
+/**
+ * Map path and check its header and every section's checksum
+ *
+ * Returns:
+ * - VDB_ERROR_NOT_FOUND: No file
+ * - VDB_ERROR_CORRUPTED: Bad header, section table or checksum
+*/
+vdb_status_t index_snap_open(const char *path, index_snap_t **out_snap);
+
+/**
+ * Unmap the snapshot, except the ranges handed out by index_snap_take.
+ * Safe with NULL.
+*/
+void index_snap_close(index_snap_t **snap);
+
+const index_snap_info_t *index_snap_info(const index_snap_t *snap);
+
+/* Start reading a section; false if the snapshot has none of that kind */
+bool index_snap_section(index_snap_t *snap, uint32_t kind, index_snap_reader_t *out);
+
+/* The next len bytes of the section, NULL past its end */
+const void *index_snap_read(index_snap_reader_t *r, size_t len);
+
+/* Skip the zeros index_snap_pad wrote */
+void index_snap_skip_pad(index_snap_reader_t *r);
+
+/**
+ * Hand the next len bytes (at an INDEX_SNAP_ALIGN boundary, padded after)
+ * over to the caller, who unmaps them with index_snap_untake
+ * Returns NULL when they can't be handed over - past the section end,
+ * or pages bigger than INDEX_SNAP_ALIGN - so the caller copies them
+ * with index_snap_read instead.
+*/
+void *index_snap_take(index_snap_reader_t *r, size_t len);
+void index_snap_untake(void *addr, size_t len);
+
+#endif /* VDB_INDEX_SNAP_H */
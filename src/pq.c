@@ -0,0 +1,571 @@
+/**
+ * pq.c - Product quantization codec and 4-bit fast-scan kernels
+ *
+ * Like sq8.c, the block scan kernel follows the ISA chosen by
+ * distance.c (vdb_distance_get_isa) when the query is prepared.
+*/
+
+#include "pq.h"
+#include "vdb/distance.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VDB_PQ_X86 1
+#include <immintrin.h>
+#endif
+
+/* On-disk params format */
+#define PQ_MAGIC 0x42435150u /* "PQCB" */
+#define PQ_VERSION 1u
+
+/* Rows looked at when learning the codebooks */
+#define PQ_TRAIN_MAX_ROWS 16384
+
+/* k-means iterations per subspace (stops early once assignments settle) */
+#define PQ_TRAIN_ITERS 25
+
+/* Bytes of norms in front of a block's codes */
+#define PQ_NORM_BYTES (PQ_BLOCK_ROWS * sizeof(float))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t m;
+} pq_file_header_t;
+
+uint32_t pq_padded_subspaces(uint32_t m) {
+    return (m + 3) & ~3u;
+}
+
+size_t pq_block_bytes(uint32_t m) {
+    return PQ_NORM_BYTES + (size_t)pq_padded_subspaces(m) * 16;
+}
+
+size_t pq_codes_bytes(uint32_t m, uint64_t rows) {
+    return (size_t)((rows + PQ_BLOCK_ROWS - 1) / PQ_BLOCK_ROWS) * pq_block_bytes(m);
+}
+
+static inline float l2sq(const float *a, const float *b, uint32_t n) {
+    float s = 0.0f;
+    for (uint32_t i = 0; i < n; i++) {
+        float d = a[i] - b[i];
+        s += d * d;
+    }
+    return s;
+}
+
+static inline float dot(const float *a, const float *b, uint32_t n) {
+    float s = 0.0f;
+    for (uint32_t i = 0; i < n; i++) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
+/* ------------------------------------------------------------------ */
+/* Block scan kernels: out[r] = sum over j of lut[j][code(r, j)]       */
+/* ------------------------------------------------------------------ */
+
+typedef void (*pq_scan_fn)(const uint8_t *codes, const uint8_t *lut, uint32_t m_pad, uint16_t *out);
+
+static void scan_scalar(const uint8_t *codes, const uint8_t *lut, uint32_t m_pad, uint16_t *out) {
+    for (uint32_t r = 0; r < 16; r++) {
+        uint32_t lo = 0, hi = 0;
+        for (uint32_t j = 0; j < m_pad; j++) {
+            uint8_t b = codes[j * 16 + r];
+            lo += lut[j * 16 + (b & 15)];
+            hi += lut[j * 16 + (b >> 4)];
+        }
+        out[r] = (uint16_t)lo;
+        out[r + 16] = (uint16_t)hi;
+    }
+}
+
+#ifdef VDB_PQ_X86
+
+/*
+ * The u8 table values are widened to u16 before adding; m_pad <= 256
+ * keeps every sum below 65536.
+*/
+
+__attribute__((target("ssse3")))
+static void scan_ssse3(const uint8_t *codes, const uint8_t *lut, uint32_t m_pad, uint16_t *out) {
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+    for (uint32_t j = 0; j < m_pad; j++) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(codes + j * 16));
+        __m128i t = _mm_loadu_si128((const __m128i*)(lut + j * 16));
+        __m128i lo = _mm_shuffle_epi8(t, _mm_and_si128(c, mask));
+        __m128i hi = _mm_shuffle_epi8(t, _mm_and_si128(_mm_srli_epi16(c, 4), mask));
+        acc0 = _mm_add_epi16(acc0, _mm_unpacklo_epi8(lo, zero));
+        acc1 = _mm_add_epi16(acc1, _mm_unpackhi_epi8(lo, zero));
+        acc2 = _mm_add_epi16(acc2, _mm_unpacklo_epi8(hi, zero));
+        acc3 = _mm_add_epi16(acc3, _mm_unpackhi_epi8(hi, zero));
+    }
+    _mm_storeu_si128((__m128i*)(out + 0), acc0);
+    _mm_storeu_si128((__m128i*)(out + 8), acc1);
+    _mm_storeu_si128((__m128i*)(out + 16), acc2);
+    _mm_storeu_si128((__m128i*)(out + 24), acc3);
+}
+
+/* 2 subspaces per step, one per 128-bit lane; lanes are added at the end */
+__attribute__((target("avx2")))
+static void scan_avx2(const uint8_t *codes, const uint8_t *lut, uint32_t m_pad, uint16_t *out) {
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+    for (uint32_t j = 0; j < m_pad; j += 2) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(codes + j * 16));
+        __m256i t = _mm256_loadu_si256((const __m256i*)(lut + j * 16));
+        __m256i lo = _mm256_shuffle_epi8(t, _mm256_and_si256(c, mask));
+        __m256i hi = _mm256_shuffle_epi8(t, _mm256_and_si256(_mm256_srli_epi16(c, 4), mask));
+        acc0 = _mm256_add_epi16(acc0, _mm256_unpacklo_epi8(lo, zero));
+        acc1 = _mm256_add_epi16(acc1, _mm256_unpackhi_epi8(lo, zero));
+        acc2 = _mm256_add_epi16(acc2, _mm256_unpacklo_epi8(hi, zero));
+        acc3 = _mm256_add_epi16(acc3, _mm256_unpackhi_epi8(hi, zero));
+    }
+    __m256i accs[4] = { acc0, acc1, acc2, acc3 };
+    for (int i = 0; i < 4; i++) {
+        __m128i sum = _mm_add_epi16(_mm256_castsi256_si128(accs[i]), _mm256_extracti128_si256(accs[i], 1));
+        _mm_storeu_si128((__m128i*)(out + i * 8), sum);
+    }
+}
+
+/* 4 subspaces per step */
+__attribute__((target("avx512bw")))
+static void scan_avx512(const uint8_t *codes, const uint8_t *lut, uint32_t m_pad, uint16_t *out) {
+    const __m512i mask = _mm512_set1_epi8(0x0f);
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+    for (uint32_t j = 0; j < m_pad; j += 4) {
+        __m512i c = _mm512_loadu_si512((const void*)(codes + j * 16));
+        __m512i t = _mm512_loadu_si512((const void*)(lut + j * 16));
+        __m512i lo = _mm512_shuffle_epi8(t, _mm512_and_si512(c, mask));
+        __m512i hi = _mm512_shuffle_epi8(t, _mm512_and_si512(_mm512_srli_epi16(c, 4), mask));
+        acc0 = _mm512_add_epi16(acc0, _mm512_unpacklo_epi8(lo, zero));
+        acc1 = _mm512_add_epi16(acc1, _mm512_unpackhi_epi8(lo, zero));
+        acc2 = _mm512_add_epi16(acc2, _mm512_unpacklo_epi8(hi, zero));
+        acc3 = _mm512_add_epi16(acc3, _mm512_unpackhi_epi8(hi, zero));
+    }
+    __m512i accs[4] = { acc0, acc1, acc2, acc3 };
+    for (int i = 0; i < 4; i++) {
+        __m256i half = _mm256_add_epi16(_mm512_castsi512_si256(accs[i]),
+                                        _mm512_extracti64x4_epi64(accs[i], 1));
+        __m128i sum = _mm_add_epi16(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+        _mm_storeu_si128((__m128i*)(out + i * 8), sum);
+    }
+}
+
+#endif /* VDB_PQ_X86 */
+
+/**
+ * Kernel for the ISA distance.c currently uses
+ * Byte shuffles need SSSE3, which the SSE2 baseline doesn't promise.
+*/
+static pq_scan_fn pick_scan(void) {
+#ifdef VDB_PQ_X86
+    switch (vdb_distance_get_isa()) {
+        case VDB_ISA_AVX512:
+            if (__builtin_cpu_supports("avx512bw")) {
+                return scan_avx512;
+            }
+            return scan_avx2;
+        case VDB_ISA_AVX2:
+            return scan_avx2;
+        case VDB_ISA_SSE2:
+            return __builtin_cpu_supports("ssse3") ? scan_ssse3 : scan_scalar;
+        default:
+            return scan_scalar;
+    }
+#else
+    return scan_scalar;
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* Codec                                                               */
+/* ------------------------------------------------------------------ */
+
+static pq_codec_t *codec_alloc(uint32_t dim, uint32_t m) {
+    pq_codec_t *codec = (pq_codec_t*)calloc(1, sizeof(pq_codec_t));
+    if (codec == NULL) {
+        return NULL;
+    }
+    codec->dim = dim;
+    codec->m = m;
+    codec->starts = (uint32_t*)malloc((m + 1) * sizeof(uint32_t));
+    codec->centroids = (float*)calloc((size_t)PQ_CENTROIDS * dim, sizeof(float));
+    if (codec->starts == NULL || codec->centroids == NULL) {
+        pq_free(&codec);
+        return NULL;
+    }
+    // widths differ by at most one when m doesn't divide dim
+    for (uint32_t j = 0; j <= m; j++) {
+        codec->starts[j] = (uint32_t)((uint64_t)j * dim / m);
+    }
+    return codec;
+}
+
+void pq_free(pq_codec_t **codec) {
+    if (codec == NULL || *codec == NULL) {
+        return;
+    }
+    free((*codec)->starts);
+    free((*codec)->centroids);
+    free(*codec);
+    *codec = NULL;
+}
+
+/* Index of the centroid nearest to x in subspace j */
+static uint32_t nearest(const pq_codec_t *codec, uint32_t j, const float *x) {
+    uint32_t width = codec->starts[j + 1] - codec->starts[j];
+    const float *cent = codec->centroids + (size_t)PQ_CENTROIDS * codec->starts[j];
+    uint32_t best = 0;
+    float best_d = INFINITY;
+    for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+        float d = l2sq(x, cent + c * width, width);
+        if (d < best_d) {
+            best_d = d;
+            best = c;
+        }
+    }
+    return best;
+}
+
+typedef struct {
+    pq_codec_t *codec;
+    const uint8_t *rows;
+    size_t stride;
+    uint64_t n;
+    uint64_t samples;
+    vdb_status_t *status; // per subspace
+} pq_train_ctx_t;
+
+/**
+ * k-means with 16 centroids over one subspace of the sample
+*/
+static void train_subspace(void *ctx, size_t j) {
+    pq_train_ctx_t *t = (pq_train_ctx_t*)ctx;
+    pq_codec_t *codec = t->codec;
+    uint32_t start = codec->starts[j];
+    uint32_t width = codec->starts[j + 1] - start;
+    float *cent = codec->centroids + (size_t)PQ_CENTROIDS * start;
+    uint64_t samples = t->samples;
+
+    float *data = (float*)malloc((size_t)samples * width * sizeof(float));
+    float *sums = (float*)malloc((size_t)PQ_CENTROIDS * width * sizeof(float));
+    uint8_t *assign = (uint8_t*)malloc((size_t)samples);
+    if (data == NULL || sums == NULL || assign == NULL) {
+        free(data);
+        free(sums);
+        free(assign);
+        t->status[j] = VDB_ERROR_OUT_OF_MEMORY;
+        return;
+    }
+
+    for (uint64_t s = 0; s < samples; s++) {
+        const float *x = (const float*)(t->rows + (size_t)(s * t->n / samples) * t->stride);
+        memcpy(data + s * width, x + start, width * sizeof(float));
+    }
+    // seeds spread over the (already evenly spaced) sample
+    for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+        memcpy(cent + c * width, data + (size_t)(c * samples / PQ_CENTROIDS) * width, width * sizeof(float));
+    }
+    memset(assign, 0xff, (size_t)samples);
+
+    for (int iter = 0; iter < PQ_TRAIN_ITERS; iter++) {
+        uint64_t changed = 0;
+        uint64_t counts[PQ_CENTROIDS] = {0};
+        memset(sums, 0, (size_t)PQ_CENTROIDS * width * sizeof(float));
+        for (uint64_t s = 0; s < samples; s++) {
+            const float *x = data + s * width;
+            uint32_t best = 0;
+            float best_d = INFINITY;
+            for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+                float d = l2sq(x, cent + c * width, width);
+                if (d < best_d) {
+                    best_d = d;
+                    best = c;
+                }
+            }
+            changed += assign[s] != best;
+            assign[s] = (uint8_t)best;
+            counts[best]++;
+            for (uint32_t i = 0; i < width; i++) {
+                sums[best * width + i] += x[i];
+            }
+        }
+        if (changed == 0) {
+            break;
+        }
+
+        for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+            if (counts[c] > 0) {
+                for (uint32_t i = 0; i < width; i++) {
+                    cent[c * width + i] = sums[c * width + i] / (float)counts[c];
+                }
+            }
+        }
+        /* an empty cluster takes half of the biggest one: split its
+         * centroid into two slightly perturbed copies */
+        for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+            if (counts[c] > 0) {
+                continue;
+            }
+            uint32_t big = 0;
+            for (uint32_t b = 1; b < PQ_CENTROIDS; b++) {
+                if (counts[b] > counts[big]) {
+                    big = b;
+                }
+            }
+            if (counts[big] < 2) {
+                break; // fewer distinct samples than centroids
+            }
+            for (uint32_t i = 0; i < width; i++) {
+                float v = cent[big * width + i];
+                float eps = (i & 1 ? 1.0f : -1.0f) * (fabsf(v) * (1.0f / 1024.0f) + 1e-6f);
+                cent[c * width + i] = v + eps;
+                cent[big * width + i] = v - eps;
+            }
+            counts[c] = counts[big] / 2;
+            counts[big] -= counts[c];
+        }
+    }
+
+    free(data);
+    free(sums);
+    free(assign);
+    t->status[j] = VDB_OK;
+}
+
+vdb_status_t pq_train(uint32_t dim, uint32_t m, const uint8_t *rows, size_t stride, uint64_t n,
+                      vdb_thread_pool_t *pool, pq_codec_t **out_codec) {
+    if (n == 0 || m == 0 || m > dim || pq_padded_subspaces(m) > VDB_PQ_MAX_SUBSPACES) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pq_codec_t *codec = codec_alloc(dim, m);
+    vdb_status_t *status = (vdb_status_t*)malloc(m * sizeof(vdb_status_t));
+    if (codec == NULL || status == NULL) {
+        pq_free(&codec);
+        free(status);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    pq_train_ctx_t ctx = { codec, rows, stride, n, n < PQ_TRAIN_MAX_ROWS ? n : PQ_TRAIN_MAX_ROWS, status };
+    vdb_thread_pool_run(pool, m, train_subspace, &ctx);
+
+    vdb_status_t result = VDB_OK;
+    for (uint32_t j = 0; j < m && result == VDB_OK; j++) {
+        result = status[j];
+    }
+    free(status);
+    if (result != VDB_OK) {
+        pq_free(&codec);
+        return result;
+    }
+
+    *out_codec = codec;
+    return VDB_OK;
+}
+
+void pq_encode(const pq_codec_t *codec, const float *vector, uint8_t *block, uint32_t slot) {
+    float norm = sqrtf(dot(vector, vector, codec->dim));
+    memcpy(block + slot * sizeof(float), &norm, sizeof(float));
+
+    uint8_t *codes = block + PQ_NORM_BYTES + (slot & 15);
+    int shift = slot < 16 ? 0 : 4;
+    for (uint32_t j = 0; j < codec->m; j++) {
+        uint32_t c = nearest(codec, j, vector + codec->starts[j]);
+        codes[j * 16] |= (uint8_t)(c << shift);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Query                                                               */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t pq_query_init(const pq_codec_t *codec, vdb_metric_t metric,
+                           const float *query, pq_query_t *out_query) {
+    uint32_t m_pad = pq_padded_subspaces(codec->m);
+    float *lut = (float*)malloc((size_t)codec->m * PQ_CENTROIDS * sizeof(float));
+    uint8_t *lut8 = (uint8_t*)calloc((size_t)m_pad * PQ_CENTROIDS, 1);
+    if (lut == NULL || lut8 == NULL) {
+        free(lut);
+        free(lut8);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* float tables, and each subspace's range for the u8 ones */
+    float bias = 0.0f;
+    float max_range = 0.0f;
+    for (uint32_t j = 0; j < codec->m; j++) {
+        uint32_t width = codec->starts[j + 1] - codec->starts[j];
+        const float *q = query + codec->starts[j];
+        const float *cent = codec->centroids + (size_t)PQ_CENTROIDS * codec->starts[j];
+        float *t = lut + j * PQ_CENTROIDS;
+        float lo = INFINITY, hi = -INFINITY;
+        for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+            t[c] = metric == VDB_METRIC_EUCLIDEAN ? l2sq(q, cent + c * width, width)
+                                                  : dot(q, cent + c * width, width);
+            lo = t[c] < lo ? t[c] : lo;
+            hi = t[c] > hi ? t[c] : hi;
+        }
+        bias += lo;
+        max_range = hi - lo > max_range ? hi - lo : max_range;
+    }
+
+    float scale = max_range > 0.0f ? max_range / 255.0f : 1.0f;
+    for (uint32_t j = 0; j < codec->m; j++) {
+        const float *t = lut + j * PQ_CENTROIDS;
+        float lo = t[0];
+        for (uint32_t c = 1; c < PQ_CENTROIDS; c++) {
+            lo = t[c] < lo ? t[c] : lo;
+        }
+        for (uint32_t c = 0; c < PQ_CENTROIDS; c++) {
+            long v = lrintf((t[c] - lo) / scale);
+            lut8[j * PQ_CENTROIDS + c] = (uint8_t)(v > 255 ? 255 : v);
+        }
+    }
+
+    out_query->metric = metric;
+    out_query->m = codec->m;
+    out_query->m_pad = m_pad;
+    out_query->scan = pick_scan();
+    out_query->lut = lut;
+    out_query->lut8 = lut8;
+    out_query->lut_bias = bias;
+    out_query->lut_scale = scale;
+    out_query->norm = sqrtf(dot(query, query, codec->dim));
+    return VDB_OK;
+}
+
+void pq_query_free(pq_query_t *query) {
+    if (query != NULL) {
+        free(query->lut);
+        free(query->lut8);
+        query->lut = NULL;
+        query->lut8 = NULL;
+    }
+}
+
+/**
+ * Turn a table sum (squared L2, or dot) into the metric's distance
+*/
+static inline float finish_distance(const pq_query_t *query, float sum, float norm) {
+    if (query->metric == VDB_METRIC_COSINE) {
+        float denom = query->norm * norm;
+        return denom > 0.0f ? 1.0f - sum / denom : 1.0f;
+    }
+    if (query->metric == VDB_METRIC_INNER_PRODUCT) {
+        return 1.0f - sum;
+    }
+    return sum > 0.0f ? sqrtf(sum) : 0.0f;
+}
+
+float pq_distance(const pq_query_t *query, const uint8_t *codes, uint64_t row) {
+    const uint8_t *block = codes + (size_t)(row / PQ_BLOCK_ROWS) * pq_block_bytes(query->m);
+    uint32_t slot = (uint32_t)(row % PQ_BLOCK_ROWS);
+    float norm;
+    memcpy(&norm, block + slot * sizeof(float), sizeof(float));
+
+    const uint8_t *c = block + PQ_NORM_BYTES + (slot & 15);
+    int shift = slot < 16 ? 0 : 4;
+    float sum = 0.0f;
+    for (uint32_t j = 0; j < query->m; j++) {
+        sum += query->lut[j * PQ_CENTROIDS + ((c[j * 16] >> shift) & 15)];
+    }
+    return finish_distance(query, sum, norm);
+}
+
+void pq_distance_batch(const pq_query_t *query, const uint8_t *codes, uint64_t first,
+                       size_t n, float *out) {
+    size_t block_bytes = pq_block_bytes(query->m);
+    uint16_t sums[PQ_BLOCK_ROWS];
+    float norms[PQ_BLOCK_ROWS];
+    while (n > 0) {
+        const uint8_t *block = codes + (size_t)(first / PQ_BLOCK_ROWS) * block_bytes;
+        uint32_t slot = (uint32_t)(first % PQ_BLOCK_ROWS);
+        size_t take = PQ_BLOCK_ROWS - slot < n ? PQ_BLOCK_ROWS - slot : n;
+
+        query->scan(block + PQ_NORM_BYTES, query->lut8, query->m_pad, sums);
+        memcpy(norms, block, PQ_NORM_BYTES);
+        for (size_t i = 0; i < take; i++) {
+            float sum = query->lut_bias + query->lut_scale * (float)sums[slot + i];
+            out[i] = finish_distance(query, sum, norms[slot + i]);
+        }
+
+        first += take;
+        out += take;
+        n -= take;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Persistence                                                         */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t pq_save(const pq_codec_t *codec, const char *path) {
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return VDB_ERROR_IO;
+    }
+
+    size_t floats = (size_t)PQ_CENTROIDS * codec->dim;
+    pq_file_header_t header = { PQ_MAGIC, PQ_VERSION, codec->dim, codec->m };
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(codec->centroids, sizeof(float), floats, fp) == floats;
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+vdb_status_t pq_load(const char *path, uint32_t dim, pq_codec_t **out_codec) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    pq_file_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != PQ_MAGIC ||
+        header.version != PQ_VERSION || header.dim != dim || header.m == 0 ||
+        header.m > dim || pq_padded_subspaces(header.m) > VDB_PQ_MAX_SUBSPACES) {
+        fclose(fp);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    pq_codec_t *codec = codec_alloc(dim, header.m);
+    if (codec == NULL) {
+        fclose(fp);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    size_t floats = (size_t)PQ_CENTROIDS * dim;
+    bool ok = fread(codec->centroids, sizeof(float), floats, fp) == floats;
+    fclose(fp);
+
+    for (size_t i = 0; ok && i < floats; i++) {
+        ok = isfinite(codec->centroids[i]);
+    }
+    if (!ok) {
+        pq_free(&codec);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    *out_codec = codec;
+    return VDB_OK;
+}
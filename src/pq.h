@@ -0,0 +1,109 @@
+/**
+ * pq.h - Internal product quantization of embeddings (4-bit fast-scan)
+ *
+ * The dimensions are split into m contiguous subspaces; each subspace
+ * has 16 centroids learned with k-means, so a row is m 4-bit codes.
+ *
+ * Codes are stored in blocks of PQ_BLOCK_ROWS rows, transposed so one
+ * SIMD byte shuffle looks up a subspace for 32 rows at once:
+ *   float norms[32] - float32 norm of each row (cosine)
+ *   uint8 codes[m_pad][16] - byte i of subspace j holds row i in the
+ *                            low nibble and row i + 16 in the high one
+ * m_pad is m rounded up to 4; padding subspaces are all zero.
+ *
+ * Scoring is asymmetric (ADC): the query builds a 16-entry table of
+ * partial distances per subspace. The tables are also quantized to u8
+ * with one shared scale, so a block is summed in uint16 lanes and
+ * converted to float once.
+*/
+
+#ifndef VDB_PQ_H
+#define VDB_PQ_H
+
+#include "vdb/storage.h"
+#include "thread_pool.h"
+
+/* Rows per code block */
+#define PQ_BLOCK_ROWS 32
+
+/* Centroids per subspace (4-bit codes) */
+#define PQ_CENTROIDS 16
+
+typedef struct {
+    uint32_t dim;
+    uint32_t m; // subspaces
+    uint32_t *starts; // m + 1 entries: subspace j is dims [starts[j], starts[j + 1])
+    float *centroids; // subspace j: PQ_CENTROIDS rows of its width at centroids + PQ_CENTROIDS * starts[j]
+} pq_codec_t;
+
+/**
+ * Prepared query
+*/
+typedef struct {
+    vdb_metric_t metric;
+    uint32_t m;
+    uint32_t m_pad;
+    void (*scan)(const uint8_t *codes, const uint8_t *lut, uint32_t m_pad, uint16_t *out); // picked at init
+    float *lut; // m * PQ_CENTROIDS partial distances (squared L2, or dot for cosine / inner product)
+    uint8_t *lut8; // m_pad * PQ_CENTROIDS, round((lut - min_j) / lut_scale)
+    float lut_bias; // sum of the per-subspace minimums
+    float lut_scale;
+    float norm; // |query|
+} pq_query_t;
+
+/* m rounded up for the block layout */
+uint32_t pq_padded_subspaces(uint32_t m);
+
+/* Bytes per block of PQ_BLOCK_ROWS rows */
+size_t pq_block_bytes(uint32_t m);
+
+/* Bytes of codes covering the first `rows` rows (whole blocks) */
+size_t pq_codes_bytes(uint32_t m, uint64_t rows);
+
+/**
+ * Learn the codebooks from n float rows (row i at rows + i * stride bytes)
+ * Uses at most a fixed-size even sample of the rows; subspaces are
+ * trained as pool tasks (pool may be NULL).
+*/
+vdb_status_t pq_train(uint32_t dim, uint32_t m, const uint8_t *rows, size_t stride, uint64_t n,
+                      vdb_thread_pool_t *pool, pq_codec_t **out_codec);
+
+/**
+ * Free a codec. Safe with NULL.
+*/
+void pq_free(pq_codec_t **codec);
+
+/**
+ * Encode one float vector into slot (0..PQ_BLOCK_ROWS-1) of a block
+ * The slot's nibbles must still be zero (fresh, zeroed block).
+*/
+void pq_encode(const pq_codec_t *codec, const float *vector, uint8_t *block, uint32_t slot);
+
+/**
+ * Prepare a query for scoring; release with pq_query_free
+*/
+vdb_status_t pq_query_init(const pq_codec_t *codec, vdb_metric_t metric,
+                           const float *query, pq_query_t *out_query);
+void pq_query_free(pq_query_t *query);
+
+/**
+ * Approximate distance to one row (float tables, for graph walks)
+ * Same convention as vdb_distance (lower = more similar).
+*/
+float pq_distance(const pq_query_t *query, const uint8_t *codes, uint64_t row);
+
+/**
+ * Approximate distances to rows [first, first + n) through the u8 tables
+ * codes is the start of the code segment.
+*/
+void pq_distance_batch(const pq_query_t *query, const uint8_t *codes, uint64_t first,
+                       size_t n, float *out);
+
+/**
+ * Persist / load the codebooks (pq.params)
+ * Save writes path.tmp and renames it over path.
+*/
+vdb_status_t pq_save(const pq_codec_t *codec, const char *path);
+vdb_status_t pq_load(const char *path, uint32_t dim, pq_codec_t **out_codec);
+
+#endif /* VDB_PQ_H */
@@ -0,0 +1,453 @@
+/**
+ * quantize.c - Keeping a quantized copy of the embeddings
+ *
+ * embeddings.sq8 (one code row per row) or embeddings.pq (blocks of
+ * PQ_BLOCK_ROWS rows) mirrors embeddings.seg. It is derived data and is
+ * not fsync'd with every append: on open it is cut back to whole rows
+ * (and to count), and anything missing is re-encoded from the float32
+ * rows. Search only uses the codes to choose candidates and re-ranks
+ * them against the float32 rows, so a stale code can cost recall but
+ * never a wrong distance.
+ *
+ * A PQ block fills up over several appends, so its last block is
+ * rewritten in place (pwrite) until it is full.
+*/
+
+#include "vdb/storage.h"
+#include "storage_internal.h"
+#include "sq8.h"
+#include "pq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Rows encoded per write (a multiple of PQ_BLOCK_ROWS) */
+#define QUANT_ENCODE_BATCH 1024
+
+/* VDB_ERROR_INVALID_ARGUMENT if the path doesn't fit in MAX_PATH */
+static vdb_status_t quant_path(const char *base_dir, const char *name, const char *file, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s/%s", base_dir, name, file);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
+}
+
+static const char *params_file(vdb_quantization_t mode) {
+    return mode == VDB_QUANTIZATION_PQ ? "pq.params" : "sq8.params";
+}
+
+const char *storage_codes_file(const vdb_storage_t *storage) {
+    return storage->quantization == VDB_QUANTIZATION_PQ ? "embeddings.pq" : "embeddings.sq8";
+}
+
+size_t storage_codes_bytes(const vdb_storage_t *storage, uint64_t rows) {
+    if (storage->quantization == VDB_QUANTIZATION_PQ) {
+        return storage->pq != NULL ? pq_codes_bytes(storage->pq->m, rows) : 0;
+    }
+    return (size_t)rows * sq8_row_bytes(storage->dim);
+}
+
+size_t storage_quant_memory(vdb_storage_t *storage) {
+    storage_view_t view;
+    if (storage_acquire_view(storage, &view) != VDB_OK) {
+        return 0;
+    }
+    size_t bytes = 0;
+    if (view.sq8_codec != NULL) {
+        bytes = sizeof(sq8_codec_t) + 2 * (size_t)view.sq8_codec->dim * sizeof(float) +
+                (size_t)view.code_count * sq8_row_bytes(view.sq8_codec->dim);
+    } else if (view.pq_codec != NULL) {
+        const pq_codec_t *pq = view.pq_codec;
+        bytes = sizeof(pq_codec_t) + (pq->m + 1) * sizeof(uint32_t) +
+                PQ_CENTROIDS * (size_t)pq->dim * sizeof(float) + pq_codes_bytes(pq->m, view.code_count);
+    }
+    storage_release_view(storage, &view);
+    return bytes;
+}
+
+/* m used when (re)training PQ */
+static uint32_t pq_subspaces(const vdb_storage_t *storage) {
+    if (storage->pq_subspaces != 0) {
+        return storage->pq_subspaces;
+    }
+    uint32_t m = (storage->dim + VDB_PQ_DEFAULT_SUBSPACE_DIM - 1) / VDB_PQ_DEFAULT_SUBSPACE_DIM;
+    return m < VDB_PQ_MAX_SUBSPACES ? m : VDB_PQ_MAX_SUBSPACES;
+}
+
+static bool has_codec(const vdb_storage_t *storage) {
+    return storage->quantization == VDB_QUANTIZATION_PQ ? storage->pq != NULL : storage->sq8 != NULL;
+}
+
+/* epoch_free_fn for retired codecs */
+static void retired_sq8(void *ptr, size_t len) {
+    (void)len;
+    sq8_codec_t *codec = (sq8_codec_t*)ptr;
+    sq8_free(&codec);
+}
+
+static void retired_pq(void *ptr, size_t len) {
+    (void)len;
+    pq_codec_t *codec = (pq_codec_t*)ptr;
+    pq_free(&codec);
+}
+
+/**
+ * Drop the codecs. Searches may still be scoring with them through a
+ * view, so they are retired rather than freed (or leaked, if even that
+ * fails)
+*/
+static void retire_pq(vdb_storage_t *storage) {
+    if (storage->pq != NULL) {
+        epoch_retire(storage->epoch, retired_pq, storage->pq, 0);
+        storage->pq = NULL;
+    }
+}
+
+static void free_codecs(vdb_storage_t *storage) {
+    if (storage->sq8 != NULL) {
+        epoch_retire(storage->epoch, retired_sq8, storage->sq8, 0);
+        storage->sq8 = NULL;
+    }
+    retire_pq(storage);
+}
+
+/**
+ * Open the mode's codes file (positioned writes, so no O_APPEND)
+*/
+static vdb_status_t open_codes(vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    vdb_status_t status = quant_path(storage->base_dir, storage->name, storage_codes_file(storage), path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    storage->codes_fd = open(path, O_RDWR | O_CREAT, 0644);
+    return storage->codes_fd < 0 ? VDB_ERROR_IO : VDB_OK;
+}
+
+static void close_codes(vdb_storage_t *storage) {
+    if (storage->codes_fd >= 0) {
+        close(storage->codes_fd);
+        storage->codes_fd = -1;
+    }
+}
+
+/**
+ * Drop every code (new params, or quantization turned off)
+*/
+static vdb_status_t reset_codes(vdb_storage_t *storage) {
+    storage->code_count = 0;
+    vdb_status_t status = storage_retire_map(storage, &storage->codes_map);
+    if (status == VDB_OK && storage->codes_fd >= 0 && ftruncate(storage->codes_fd, 0) != 0) {
+        status = VDB_ERROR_IO;
+    }
+    return status;
+}
+
+/* Remove the codes and params files of a mode */
+static void unlink_files(vdb_storage_t *storage, vdb_quantization_t mode) {
+    char path[MAX_PATH];
+    if (quant_path(storage->base_dir, storage->name,
+                   mode == VDB_QUANTIZATION_PQ ? "embeddings.pq" : "embeddings.sq8", path) == VDB_OK) {
+        unlink(path);
+    }
+    if (quant_path(storage->base_dir, storage->name, params_file(mode), path) == VDB_OK) {
+        unlink(path);
+    }
+}
+
+static vdb_status_t pwrite_all(int fd, const uint8_t *data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            return VDB_ERROR_IO;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Learn the codec from the rows in view and save its params
+*/
+static vdb_status_t train_codec(vdb_storage_t *storage, const storage_view_t *view) {
+    vdb_status_t status;
+    if (storage->quantization == VDB_QUANTIZATION_PQ) {
+        status = pq_train(storage->dim, pq_subspaces(storage), view->embeddings, storage->row_bytes,
+                          view->count, storage_pool_locked(storage), &storage->pq);
+    } else {
+        status = sq8_train(storage->dim, view->embeddings, storage->row_bytes, view->count,
+                           &storage->sq8);
+    }
+
+    char path[MAX_PATH];
+    if (status == VDB_OK) {
+        status = quant_path(storage->base_dir, storage->name, params_file(storage->quantization), path);
+    }
+    if (status == VDB_OK) {
+        status = storage->quantization == VDB_QUANTIZATION_PQ ? pq_save(storage->pq, path)
+                                                              : sq8_save(storage->sq8, path);
+    }
+    if (status == VDB_OK) {
+        status = reset_codes(storage);
+    }
+    if (status != VDB_OK) {
+        free_codecs(storage);
+    }
+    return status;
+}
+
+/**
+ * Encode rows [first, first + n) into buf, laid out as in the codes file
+ * For PQ, first is block aligned.
+*/
+static void encode_rows(const vdb_storage_t *storage, const storage_view_t *view,
+                        uint64_t first, uint64_t n, uint8_t *buf) {
+    if (storage->quantization == VDB_QUANTIZATION_PQ) {
+        memset(buf, 0, pq_codes_bytes(storage->pq->m, n));
+        size_t block_bytes = pq_block_bytes(storage->pq->m);
+        for (uint64_t i = 0; i < n; i++) {
+            pq_encode(storage->pq, (const float*)storage_view_row(storage, view, first + i),
+                      buf + (size_t)(i / PQ_BLOCK_ROWS) * block_bytes, (uint32_t)(i % PQ_BLOCK_ROWS));
+        }
+        return;
+    }
+
+    size_t code_bytes = sq8_row_bytes(storage->dim);
+    for (uint64_t i = 0; i < n; i++) {
+        sq8_encode(storage->sq8, (const float*)storage_view_row(storage, view, first + i),
+                   buf + i * code_bytes);
+    }
+}
+
+/**
+ * Encode rows [code_count, count) - caller holds write_lock
+*/
+vdb_status_t storage_quant_catch_up(vdb_storage_t *storage) {
+    if (storage->code_count >= storage->count) {
+        return VDB_OK;
+    }
+
+    storage_view_t view;
+    vdb_status_t status = storage_view_locked(storage, &view);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    /* first rows ever: learn the codec from them */
+    if (!has_codec(storage)) {
+        status = train_codec(storage, &view);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+
+    uint8_t *buf = (uint8_t*)malloc(storage_codes_bytes(storage, QUANT_ENCODE_BATCH));
+    if (buf == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    while (status == VDB_OK && storage->code_count < view.count) {
+        // PQ restarts at its (partial) last block
+        uint64_t first = storage->code_count;
+        if (storage->quantization == VDB_QUANTIZATION_PQ) {
+            first -= first % PQ_BLOCK_ROWS;
+        }
+        uint64_t n = view.count - first < QUANT_ENCODE_BATCH ? view.count - first : QUANT_ENCODE_BATCH;
+        size_t offset = storage_codes_bytes(storage, first);
+        encode_rows(storage, &view, first, n, buf);
+        status = pwrite_all(storage->codes_fd, buf, storage_codes_bytes(storage, first + n) - offset,
+                            (off_t)offset);
+        if (status == VDB_OK) {
+            stats_add(storage->stats, STATS_BYTES_CODES, storage_codes_bytes(storage, first + n) - offset);
+            storage->code_count = first + n;
+        }
+    }
+    free(buf);
+
+    if (status != VDB_OK) {
+        // a partial write leaves a torn row; drop back to the last whole one
+        if (ftruncate(storage->codes_fd, (off_t)storage_codes_bytes(storage, storage->code_count)) != 0) {
+            reset_codes(storage);
+        }
+    }
+    return status;
+}
+
+/**
+ * Drop the codes (compaction renumbered the rows); the codec is kept and
+ * the next catch-up encodes every row again. Caller holds write_lock
+*/
+vdb_status_t storage_quant_reset(vdb_storage_t *storage) {
+    return reset_codes(storage);
+}
+
+/**
+ * Reattach the codes on open
+*/
+vdb_status_t storage_quant_load(vdb_storage_t *storage) {
+    if (storage->quantization == VDB_QUANTIZATION_NONE) {
+        return VDB_OK;
+    }
+
+    vdb_status_t status = open_codes(storage);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    char path[MAX_PATH];
+    status = quant_path(storage->base_dir, storage->name, params_file(storage->quantization), path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    status = storage->quantization == VDB_QUANTIZATION_PQ ? pq_load(path, storage->dim, &storage->pq)
+                                                          : sq8_load(path, storage->dim, &storage->sq8);
+    if (status == VDB_ERROR_NOT_FOUND || status == VDB_ERROR_CORRUPTED) {
+        status = VDB_OK; // retrained (and every code rewritten) on catch-up
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (storage->pq != NULL) {
+        storage->pq_subspaces = storage->pq->m;
+    }
+
+    /* keep whole rows up to count; without params the codes are useless */
+    struct stat st;
+    if (fstat(storage->codes_fd, &st) != 0) {
+        return VDB_ERROR_IO;
+    }
+    uint64_t rows = 0;
+    if (storage->quantization == VDB_QUANTIZATION_PQ && storage->pq != NULL) {
+        // how full the last block was isn't recorded; encode it again
+        uint64_t blocks = (uint64_t)st.st_size / pq_block_bytes(storage->pq->m);
+        rows = blocks > 0 ? (blocks - 1) * PQ_BLOCK_ROWS : 0;
+    } else if (storage->sq8 != NULL) {
+        rows = (uint64_t)st.st_size / sq8_row_bytes(storage->dim);
+    }
+    if (rows > storage->count) {
+        rows = storage->count;
+    }
+    size_t keep = storage_codes_bytes(storage, rows);
+    if ((uint64_t)st.st_size != keep && ftruncate(storage->codes_fd, (off_t)keep) != 0) {
+        return VDB_ERROR_IO;
+    }
+    storage->code_count = rows;
+
+    pthread_mutex_lock(&storage->write_lock);
+    status = storage_quant_catch_up(storage);
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Drop the current mode's codes, codec and files (write_lock held)
+*/
+static vdb_status_t quant_disable(vdb_storage_t *storage) {
+    vdb_status_t status = reset_codes(storage);
+    free_codecs(storage);
+    close_codes(storage);
+    if (storage->quantization != VDB_QUANTIZATION_NONE) {
+        unlink_files(storage, storage->quantization);
+    }
+    storage->quantization = VDB_QUANTIZATION_NONE;
+    return status;
+}
+
+/**
+ * Turn a mode on from scratch (write_lock held, currently NONE)
+*/
+static vdb_status_t quant_enable(vdb_storage_t *storage, vdb_quantization_t mode) {
+    storage->quantization = mode;
+    vdb_status_t status = open_codes(storage);
+    if (status == VDB_OK) {
+        status = reset_codes(storage); // stale codes from an earlier run
+    }
+    if (status == VDB_OK) {
+        status = storage_quant_catch_up(storage);
+    }
+    return status;
+}
+
+/**
+ * Switch quantization on or off
+*/
+vdb_status_t vdb_storage_set_quantization(vdb_storage_t *storage, vdb_quantization_t mode) {
+    if (storage == NULL ||
+        (mode != VDB_QUANTIZATION_NONE && mode != VDB_QUANTIZATION_SQ8 && mode != VDB_QUANTIZATION_PQ)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    if (mode == storage->quantization) {
+        pthread_mutex_unlock(&storage->write_lock);
+        return VDB_OK;
+    }
+    if (storage->element != VDB_ELEMENT_F32) {
+        // training and encoding read the rows as float32
+        pthread_mutex_unlock(&storage->write_lock);
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    // switching straight between modes goes through NONE
+    vdb_status_t status = quant_disable(storage);
+    if (status == VDB_OK && mode != VDB_QUANTIZATION_NONE) {
+        status = quant_enable(storage, mode);
+    }
+
+    if (status == VDB_OK) {
+        status = storage_write_meta(storage);
+    }
+    storage_publish_locked(storage); // whatever is left of the codes
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+vdb_quantization_t vdb_storage_get_quantization(const vdb_storage_t *storage) {
+    return storage != NULL ? storage->quantization : VDB_QUANTIZATION_NONE;
+}
+
+/**
+ * Set re-rank depth
+*/
+vdb_status_t vdb_storage_set_rerank_factor(vdb_storage_t *storage, uint32_t factor) {
+    if (storage == NULL || factor == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    storage->rerank_factor = factor;
+    pthread_mutex_unlock(&storage->write_lock);
+    query_cache_invalidate(storage->query_cache);
+    return VDB_OK;
+}
+
+/**
+ * Set PQ subspace count, retraining if PQ is on
+*/
+vdb_status_t vdb_storage_set_pq_subspaces(vdb_storage_t *storage, uint32_t m) {
+    if (storage == NULL || m > storage->dim || m > VDB_PQ_MAX_SUBSPACES) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    storage->pq_subspaces = m;
+    vdb_status_t status = VDB_OK;
+    if (storage->quantization == VDB_QUANTIZATION_PQ &&
+        (storage->pq == NULL || storage->pq->m != pq_subspaces(storage))) {
+        status = storage_retire_map(storage, &storage->codes_map);
+        retire_pq(storage);
+        storage->code_count = 0;
+        if (status == VDB_OK) {
+            status = storage_quant_catch_up(storage);
+        }
+        storage_publish_locked(storage);
+    }
+    if (status == VDB_OK) {
+        status = storage_write_meta(storage);
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
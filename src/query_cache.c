@@ -0,0 +1,364 @@
+/**
+ * query_cache.c - Sharded CLOCK cache of search results
+ *
+ * An entry is one allocation: the hits, then the key bytes. Entries
+ * sit in a growable array per shard; the hash chains and the free list
+ * link them by index + 1 (0 ends a list), so growing the array moves
+ * nothing that needs fixing up.
+ *
+ * Lookups set the entry's reference bit. To make room the hand sweeps
+ * the array: a referenced, current entry loses its bit and is passed
+ * over once, anything else is evicted.
+*/
+
+#include "query_cache.h"
+#include "filter_index.h"
+#include "storage_internal.h"
+#include "crc32c.h"
+#include "vdb/distance.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Initial hash buckets per shard; doubled when entries outnumber them */
+#define QUERY_CACHE_MIN_BUCKETS 64
+
+/* Fixed part of a key: kind, k, dim, filter length */
+#define QUERY_CACHE_KEY_HEADER (4 * sizeof(uint32_t))
+
+typedef struct {
+    uint8_t *data; // hits, then the key; NULL = free slot
+    size_t key_len;
+    size_t count; // hits
+    uint64_t generation;
+    uint32_t hash;
+    uint32_t next; // hash chain or free list, index + 1
+    bool referenced;
+} cache_entry_t;
+
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    cache_entry_t *entries;
+    size_t num_entries; // slots in use or free
+    size_t cap_entries;
+    uint32_t *buckets; // chain heads, index + 1
+    size_t num_buckets; // power of two
+    uint32_t free_head;
+    size_t used; // entries holding hits
+    size_t hand;
+    size_t bytes;
+} cache_shard_t;
+
+struct query_cache {
+    cache_shard_t shards[QUERY_CACHE_SHARDS];
+    atomic_size_t capacity;
+    atomic_uint_fast64_t generation;
+};
+
+/* Memory an entry is charged for */
+static size_t entry_bytes(size_t key_len, size_t count) {
+    return sizeof(cache_entry_t) + sizeof(uint32_t) + key_len + count * sizeof(vdb_search_hit_t);
+}
+
+static const uint8_t *entry_key(const cache_entry_t *e) {
+    return e->data + e->count * sizeof(vdb_search_hit_t);
+}
+
+static cache_shard_t *key_shard(query_cache_t *cache, uint32_t hash) {
+    return &cache->shards[hash % QUERY_CACHE_SHARDS];
+}
+
+static size_t bucket_of(const cache_shard_t *shard, uint32_t hash) {
+    return (hash / QUERY_CACHE_SHARDS) & (shard->num_buckets - 1);
+}
+
+vdb_status_t query_cache_create(query_cache_t **out_cache) {
+    if (out_cache == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    query_cache_t *cache = (query_cache_t*)aligned_alloc(_Alignof(cache_shard_t), sizeof(query_cache_t));
+    if (cache == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    memset(cache, 0, sizeof(query_cache_t));
+    for (size_t i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+    }
+    atomic_init(&cache->capacity, 0);
+    atomic_init(&cache->generation, 1);
+    *out_cache = cache;
+    return VDB_OK;
+}
+
+/**
+ * Unlink an entry from its chain and free it (shard locked)
+*/
+static void evict(cache_shard_t *shard, uint32_t index) {
+    cache_entry_t *e = &shard->entries[index];
+    uint32_t *link = &shard->buckets[bucket_of(shard, e->hash)];
+    while (*link != index + 1) {
+        link = &shard->entries[*link - 1].next;
+    }
+    *link = e->next;
+
+    shard->bytes -= entry_bytes(e->key_len, e->count);
+    shard->used--;
+    free(e->data);
+    e->data = NULL;
+    e->next = shard->free_head;
+    shard->free_head = index + 1;
+}
+
+/**
+ * Evict until the shard holds at most budget bytes (shard locked)
+ * Two sweeps clear every reference bit, so this always ends.
+*/
+static void make_room(cache_shard_t *shard, size_t budget, uint64_t generation) {
+    while (shard->bytes > budget && shard->used > 0) {
+        if (shard->hand >= shard->num_entries) {
+            shard->hand = 0;
+        }
+        uint32_t index = (uint32_t)shard->hand++;
+        cache_entry_t *e = &shard->entries[index];
+        if (e->data == NULL) {
+            continue;
+        }
+        if (e->referenced && e->generation == generation) {
+            e->referenced = false;
+            continue;
+        }
+        evict(shard, index);
+    }
+}
+
+void query_cache_free(query_cache_t **cache) {
+    if (cache == NULL || *cache == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &(*cache)->shards[i];
+        for (size_t j = 0; j < shard->num_entries; j++) {
+            free(shard->entries[j].data);
+        }
+        free(shard->entries);
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(*cache);
+    *cache = NULL;
+}
+
+void query_cache_set_capacity(query_cache_t *cache, size_t bytes) {
+    atomic_store(&cache->capacity, bytes);
+    uint64_t generation = atomic_load(&cache->generation);
+    for (size_t i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        make_room(shard, bytes / QUERY_CACHE_SHARDS, generation);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+size_t query_cache_bytes(query_cache_t *cache) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        bytes += shard->bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return bytes;
+}
+
+void query_cache_invalidate(query_cache_t *cache) {
+    atomic_fetch_add(&cache->generation, 1);
+}
+
+bool query_cache_key(query_cache_t *cache, query_cache_kind_t kind, const vdb_vector_t *query,
+                     uint32_t k, const vdb_filter_t *filter, vdb_arena_t *arena,
+                     query_cache_key_t *out_key) {
+    if (atomic_load_explicit(&cache->capacity, memory_order_relaxed) == 0) {
+        return false;
+    }
+    // read before the search takes its view, so a write that lands
+    // meanwhile makes the stored hits stale rather than current
+    out_key->generation = atomic_load(&cache->generation);
+
+    size_t filter_len = filter != NULL ? filter_key(filter, NULL, 0) : 0;
+    size_t len = QUERY_CACHE_KEY_HEADER + filter_len + (size_t)query->dim * sizeof(uint16_t);
+    uint8_t *bytes = (uint8_t*)vdb_arena_alloc(arena, len);
+    if (bytes == NULL || filter_len > UINT32_MAX) {
+        return false;
+    }
+    uint32_t header[4] = { (uint32_t)kind, k, query->dim, (uint32_t)filter_len };
+    memcpy(bytes, header, sizeof(header));
+    if (filter != NULL) {
+        filter_key(filter, bytes + QUERY_CACHE_KEY_HEADER, filter_len);
+    }
+    vdb_convert_from_f32(VDB_ELEMENT_BF16, query->data, bytes + QUERY_CACHE_KEY_HEADER + filter_len,
+                         query->dim);
+
+    out_key->bytes = bytes;
+    out_key->len = len;
+    out_key->hash = crc32c(0, bytes, len);
+    return true;
+}
+
+/* Index + 1 of the entry under key, 0 if none (shard locked) */
+static uint32_t find(const cache_shard_t *shard, const query_cache_key_t *key) {
+    if (shard->num_buckets == 0) {
+        return 0;
+    }
+    uint32_t i = shard->buckets[bucket_of(shard, key->hash)];
+    while (i != 0) {
+        const cache_entry_t *e = &shard->entries[i - 1];
+        if (e->hash == key->hash && e->key_len == key->len && memcmp(entry_key(e), key->bytes, key->len) == 0) {
+            return i;
+        }
+        i = e->next;
+    }
+    return 0;
+}
+
+bool query_cache_get(query_cache_t *cache, const query_cache_key_t *key,
+                     vdb_search_results_t *out_results) {
+    cache_shard_t *shard = key_shard(cache, key->hash);
+    uint64_t generation = atomic_load(&cache->generation);
+    bool hit = false;
+
+    pthread_mutex_lock(&shard->lock);
+    uint32_t i = find(shard, key);
+    if (i != 0 && shard->entries[i - 1].generation != generation) {
+        evict(shard, i - 1);
+    } else if (i != 0) {
+        cache_entry_t *e = &shard->entries[i - 1];
+        vdb_search_hit_t *hits = NULL;
+        if (e->count > 0) {
+            hits = (vdb_search_hit_t*)malloc(e->count * sizeof(vdb_search_hit_t));
+        }
+        if (e->count == 0 || hits != NULL) {
+            if (hits != NULL) {
+                memcpy(hits, e->data, e->count * sizeof(vdb_search_hit_t));
+            }
+            out_results->hits = hits;
+            out_results->count = e->count;
+            e->referenced = true;
+            hit = true;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return hit;
+}
+
+/**
+ * Double the buckets once entries outnumber them (shard locked)
+ * Returns: false if they can't be allocated
+*/
+static bool grow_buckets(cache_shard_t *shard) {
+    if (shard->num_buckets > shard->used) {
+        return true;
+    }
+    size_t n = shard->num_buckets > 0 ? shard->num_buckets * 2 : QUERY_CACHE_MIN_BUCKETS;
+    uint32_t *buckets = (uint32_t*)calloc(n, sizeof(uint32_t));
+    if (buckets == NULL) {
+        return shard->num_buckets > 0; // longer chains, still correct
+    }
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->num_buckets = n;
+    for (size_t i = 0; i < shard->num_entries; i++) {
+        cache_entry_t *e = &shard->entries[i];
+        if (e->data != NULL) {
+            uint32_t *head = &buckets[bucket_of(shard, e->hash)];
+            e->next = *head;
+            *head = (uint32_t)i + 1;
+        }
+    }
+    return true;
+}
+
+/* A free slot, or UINT32_MAX if the array can't grow (shard locked) */
+static uint32_t take_slot(cache_shard_t *shard) {
+    if (shard->free_head != 0) {
+        uint32_t index = shard->free_head - 1;
+        shard->free_head = shard->entries[index].next;
+        return index;
+    }
+    if (shard->num_entries == shard->cap_entries) {
+        size_t cap = shard->cap_entries > 0 ? shard->cap_entries * 2 : QUERY_CACHE_MIN_BUCKETS;
+        if (cap >= UINT32_MAX) {
+            return UINT32_MAX;
+        }
+        cache_entry_t *grown = (cache_entry_t*)realloc(shard->entries, cap * sizeof(cache_entry_t));
+        if (grown == NULL) {
+            return UINT32_MAX;
+        }
+        shard->entries = grown;
+        shard->cap_entries = cap;
+    }
+    memset(&shard->entries[shard->num_entries], 0, sizeof(cache_entry_t));
+    return (uint32_t)shard->num_entries++;
+}
+
+void query_cache_put(query_cache_t *cache, const query_cache_key_t *key,
+                     const vdb_search_results_t *results) {
+    size_t budget = atomic_load(&cache->capacity) / QUERY_CACHE_SHARDS;
+    size_t bytes = entry_bytes(key->len, results->count);
+    if (bytes > budget || atomic_load(&cache->generation) != key->generation) {
+        return;
+    }
+
+    size_t hits_len = results->count * sizeof(vdb_search_hit_t);
+    uint8_t *data = (uint8_t*)malloc(hits_len + key->len);
+    if (data == NULL) {
+        return;
+    }
+    if (hits_len > 0) {
+        memcpy(data, results->hits, hits_len);
+    }
+    memcpy(data + hits_len, key->bytes, key->len);
+
+    cache_shard_t *shard = key_shard(cache, key->hash);
+    pthread_mutex_lock(&shard->lock);
+    uint32_t existing = find(shard, key);
+    if (existing != 0) {
+        evict(shard, existing - 1); // a concurrent miss on the same query stored it first
+    }
+    make_room(shard, budget - bytes, key->generation);
+    uint32_t index = grow_buckets(shard) ? take_slot(shard) : UINT32_MAX;
+    if (index == UINT32_MAX) {
+        pthread_mutex_unlock(&shard->lock);
+        free(data);
+        return;
+    }
+
+    cache_entry_t *e = &shard->entries[index];
+    e->data = data;
+    e->key_len = key->len;
+    e->count = results->count;
+    e->generation = key->generation;
+    e->hash = key->hash;
+    e->referenced = false;
+    uint32_t *head = &shard->buckets[bucket_of(shard, key->hash)];
+    e->next = *head;
+    *head = index + 1;
+    shard->used++;
+    shard->bytes += bytes;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Size the query cache
+*/
+vdb_status_t vdb_storage_set_query_cache(vdb_storage_t *storage, size_t max_bytes) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    query_cache_set_capacity(storage->query_cache, max_bytes);
+    return VDB_OK;
+}
+
+size_t vdb_storage_query_cache_bytes(vdb_storage_t *storage) {
+    return storage != NULL ? query_cache_bytes(storage->query_cache) : 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * query_cache.h - Internal cache of search results
+ *
+ * Maps a search - its kind, k, filter and query - to the hits it
+ * returned. The query is rounded to bf16 before it is keyed, so
+ * retried and near-identical queries share an entry.
+ *
+ * Entries are tagged with the cache's generation when their search
+ * started. Writes and setting changes bump it (query_cache_invalidate),
+ * which makes every older entry a miss at once; stale entries are the
+ * first ones evicted.
+ *
+ * The cache is split into QUERY_CACHE_SHARDS shards by key hash, each
+ * with its own lock, a chained hash table and a CLOCK (second chance)
+ * eviction hand. A shard holds at most capacity / QUERY_CACHE_SHARDS
+ * bytes of keys, hits and bookkeeping.
+*/
+
+#ifndef VDB_QUERY_CACHE_H
+#define VDB_QUERY_CACHE_H
+
+#include "vdb/storage.h"
+#include "vdb/arena.h"
+
+/* Shards per cache */
+#define QUERY_CACHE_SHARDS 16
+
+typedef struct query_cache query_cache_t;
+
+/* The search an entry came from; part of the key */
+typedef enum {
+    QUERY_CACHE_EXACT,
+    QUERY_CACHE_HNSW,
+    QUERY_CACHE_DISKANN,
+} query_cache_kind_t;
+
+/**
+ * Key of one search, made before it runs and used for the lookup and
+ * the store after it
+*/
+typedef struct {
+    const uint8_t *bytes; // kind, k, dim, filter and bf16 query
+    size_t len;
+    uint32_t hash;
+    uint64_t generation; // when the key was made
+} query_cache_key_t;
+
+/**
+ * Create an empty cache with capacity 0 (off)
+*/
+vdb_status_t query_cache_create(query_cache_t **out_cache);
+
+/**
+ * Free a cache and its entries. Safe with NULL.
+*/
+void query_cache_free(query_cache_t **cache);
+
+/**
+ * Resize; entries past the new size are evicted, 0 drops them all
+*/
+void query_cache_set_capacity(query_cache_t *cache, size_t bytes);
+
+/* Bytes the entries take now */
+size_t query_cache_bytes(query_cache_t *cache);
+
+/**
+ * Make every entry stale; call after anything that can change a
+ * search's hits is visible to searches
+*/
+void query_cache_invalidate(query_cache_t *cache);
+
+/**
+ * Build the key of a search in arena
+ * Returns: false if the cache is off (or the key can't be allocated) -
+ * then there is nothing to look up or store
+*/
+bool query_cache_key(query_cache_t *cache, query_cache_kind_t kind, const vdb_vector_t *query,
+                     uint32_t k, const vdb_filter_t *filter, vdb_arena_t *arena,
+                     query_cache_key_t *out_key);
+
+/**
+ * Copy the hits cached under key into out_results (malloc'd like a
+ * search's)
+ * Returns: true on a hit; false on a miss, a stale entry, or when the
+ * copy can't be allocated
+*/
+bool query_cache_get(query_cache_t *cache, const query_cache_key_t *key,
+                     vdb_search_results_t *out_results);
+
+/**
+ * Store the hits of a search under its key, unless the generation has
+ * moved on since the key was made or they don't fit
+*/
+void query_cache_put(query_cache_t *cache, const query_cache_key_t *key,
+                     const vdb_search_results_t *results);
+
+#endif /* VDB_QUERY_CACHE_H */
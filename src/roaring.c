@@ -0,0 +1,725 @@
+/**
+ * roaring.c - Roaring bitmap containers and set operations
+ *
+ * Results of set operations are normalized: empty containers are
+ * dropped and a container is an array exactly when it holds at most
+ * ROARING_ARRAY_MAX rows.
+*/
+
+#include "roaring.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROARING_CHUNK_BITS 16
+#define ROARING_CHUNK_ROWS (1u << ROARING_CHUNK_BITS)
+
+static uint32_t popcount64(uint64_t x) {
+    return (uint32_t)__builtin_popcountll(x);
+}
+
+static void container_free(roaring_container_t *c) {
+    free(c->array);
+    free(c->bits);
+    c->array = NULL;
+    c->bits = NULL;
+    c->cardinality = 0;
+    c->capacity = 0;
+}
+
+void roaring_init(roaring_t *r) {
+    r->containers = NULL;
+    r->size = 0;
+    r->capacity = 0;
+}
+
+void roaring_free(roaring_t *r) {
+    for (size_t i = 0; i < r->size; i++) {
+        container_free(&r->containers[i]);
+    }
+    free(r->containers);
+    roaring_init(r);
+}
+
+/* ------------------------------------------------------------------ */
+/* Containers                                                          */
+/* ------------------------------------------------------------------ */
+
+/* First array slot >= value */
+static uint32_t array_lower_bound(const uint16_t *array, uint32_t n, uint16_t value) {
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (array[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool container_contains(const roaring_container_t *c, uint16_t low) {
+    if (c->bits != NULL) {
+        return (c->bits[low >> 6] >> (low & 63)) & 1;
+    }
+    uint32_t i = array_lower_bound(c->array, c->cardinality, low);
+    return i < c->cardinality && c->array[i] == low;
+}
+
+/* Array container -> bitmap container */
+static vdb_status_t container_to_bits(roaring_container_t *c) {
+    uint64_t *bits = (uint64_t*)calloc(ROARING_WORDS, sizeof(uint64_t));
+    if (bits == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (uint32_t i = 0; i < c->cardinality; i++) {
+        bits[c->array[i] >> 6] |= 1ull << (c->array[i] & 63);
+    }
+    free(c->array);
+    c->array = NULL;
+    c->capacity = 0;
+    c->bits = bits;
+    return VDB_OK;
+}
+
+/**
+ * Take ownership of bits and store them normalized in out
+ * Leaves out empty (cardinality 0) when no bit is set.
+*/
+static vdb_status_t container_from_bits(uint64_t key, uint64_t *bits, roaring_container_t *out) {
+    uint32_t cardinality = 0;
+    for (size_t w = 0; w < ROARING_WORDS; w++) {
+        cardinality += popcount64(bits[w]);
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->key = key;
+    out->cardinality = cardinality;
+    if (cardinality > ROARING_ARRAY_MAX) {
+        out->bits = bits;
+        return VDB_OK;
+    }
+    if (cardinality > 0) {
+        out->array = (uint16_t*)malloc(cardinality * sizeof(uint16_t));
+        if (out->array == NULL) {
+            free(bits);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        uint32_t n = 0;
+        for (size_t w = 0; w < ROARING_WORDS; w++) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                out->array[n++] = (uint16_t)(w * 64 + (size_t)__builtin_ctzll(word));
+            }
+        }
+        out->capacity = cardinality;
+    }
+    free(bits);
+    return VDB_OK;
+}
+
+/* Bits of any container (a fresh copy) */
+static uint64_t *container_copy_bits(const roaring_container_t *c) {
+    uint64_t *bits = (uint64_t*)calloc(ROARING_WORDS, sizeof(uint64_t));
+    if (bits == NULL) {
+        return NULL;
+    }
+    if (c->bits != NULL) {
+        memcpy(bits, c->bits, ROARING_WORDS * sizeof(uint64_t));
+    } else {
+        for (uint32_t i = 0; i < c->cardinality; i++) {
+            bits[c->array[i] >> 6] |= 1ull << (c->array[i] & 63);
+        }
+    }
+    return bits;
+}
+
+static vdb_status_t container_copy(const roaring_container_t *c, roaring_container_t *out) {
+    *out = *c;
+    out->array = NULL;
+    out->bits = NULL;
+    if (c->bits != NULL) {
+        out->bits = (uint64_t*)malloc(ROARING_WORDS * sizeof(uint64_t));
+        if (out->bits == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        memcpy(out->bits, c->bits, ROARING_WORDS * sizeof(uint64_t));
+    } else if (c->cardinality > 0) {
+        out->array = (uint16_t*)malloc(c->cardinality * sizeof(uint16_t));
+        if (out->array == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        memcpy(out->array, c->array, c->cardinality * sizeof(uint16_t));
+        out->capacity = c->cardinality;
+    }
+    return VDB_OK;
+}
+
+static vdb_status_t container_add(roaring_container_t *c, uint16_t low) {
+    if (c->bits != NULL) {
+        uint64_t mask = 1ull << (low & 63);
+        if (!(c->bits[low >> 6] & mask)) {
+            c->bits[low >> 6] |= mask;
+            c->cardinality++;
+        }
+        return VDB_OK;
+    }
+
+    // ascending adds land at the end
+    uint32_t pos = c->cardinality;
+    if (pos > 0 && c->array[pos - 1] >= low) {
+        pos = array_lower_bound(c->array, c->cardinality, low);
+        if (c->array[pos] == low) {
+            return VDB_OK;
+        }
+    }
+    if (c->cardinality == ROARING_ARRAY_MAX) {
+        vdb_status_t status = container_to_bits(c);
+        if (status != VDB_OK) {
+            return status;
+        }
+        return container_add(c, low);
+    }
+    if (c->cardinality == c->capacity) {
+        uint32_t capacity = c->capacity < 8 ? 8 : c->capacity * 2;
+        if (capacity > ROARING_ARRAY_MAX) {
+            capacity = ROARING_ARRAY_MAX;
+        }
+        uint16_t *array = (uint16_t*)realloc(c->array, capacity * sizeof(uint16_t));
+        if (array == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        c->array = array;
+        c->capacity = capacity;
+    }
+    memmove(c->array + pos + 1, c->array + pos, (c->cardinality - pos) * sizeof(uint16_t));
+    c->array[pos] = low;
+    c->cardinality++;
+    return VDB_OK;
+}
+
+/* Set low bits [lo, hi) of c, which must be a bitmap container */
+static void bits_set_range(roaring_container_t *c, uint32_t lo, uint32_t hi) {
+    for (uint32_t v = lo; v < hi; ) {
+        uint32_t w = v >> 6;
+        uint32_t bit = v & 63;
+        uint32_t span = 64 - bit < hi - v ? 64 - bit : hi - v;
+        uint64_t mask = (span == 64 ? ~0ull : ((1ull << span) - 1)) << bit;
+        c->cardinality += popcount64(mask & ~c->bits[w]);
+        c->bits[w] |= mask;
+        v += span;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Container set operations                                            */
+/* ------------------------------------------------------------------ */
+
+static vdb_status_t container_and(const roaring_container_t *a, const roaring_container_t *b,
+                                  roaring_container_t *out) {
+    if (a->bits != NULL && b->bits != NULL) {
+        uint64_t *bits = (uint64_t*)malloc(ROARING_WORDS * sizeof(uint64_t));
+        if (bits == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        for (size_t w = 0; w < ROARING_WORDS; w++) {
+            bits[w] = a->bits[w] & b->bits[w];
+        }
+        return container_from_bits(a->key, bits, out);
+    }
+
+    // at least one array: the result fits in the smaller one
+    if (a->bits != NULL || (b->bits == NULL && b->cardinality < a->cardinality)) {
+        const roaring_container_t *t = a;
+        a = b;
+        b = t;
+    }
+    memset(out, 0, sizeof(*out));
+    out->key = a->key;
+    if (a->cardinality == 0) {
+        return VDB_OK;
+    }
+    out->array = (uint16_t*)malloc(a->cardinality * sizeof(uint16_t));
+    if (out->array == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    out->capacity = a->cardinality;
+    uint32_t n = 0;
+    if (b->bits != NULL) {
+        for (uint32_t i = 0; i < a->cardinality; i++) {
+            if (container_contains(b, a->array[i])) {
+                out->array[n++] = a->array[i];
+            }
+        }
+    } else {
+        uint32_t i = 0;
+        uint32_t j = 0;
+        while (i < a->cardinality && j < b->cardinality) {
+            if (a->array[i] < b->array[j]) {
+                i++;
+            } else if (a->array[i] > b->array[j]) {
+                j++;
+            } else {
+                out->array[n++] = a->array[i];
+                i++;
+                j++;
+            }
+        }
+    }
+    out->cardinality = n;
+    return VDB_OK;
+}
+
+static vdb_status_t container_or(const roaring_container_t *a, const roaring_container_t *b,
+                                 roaring_container_t *out) {
+    if (a->bits == NULL && b->bits == NULL &&
+        a->cardinality + b->cardinality <= ROARING_ARRAY_MAX) {
+        memset(out, 0, sizeof(*out));
+        out->key = a->key;
+        out->array = (uint16_t*)malloc((a->cardinality + b->cardinality) * sizeof(uint16_t));
+        if (out->array == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        out->capacity = a->cardinality + b->cardinality;
+        uint32_t i = 0;
+        uint32_t j = 0;
+        uint32_t n = 0;
+        while (i < a->cardinality || j < b->cardinality) {
+            if (j == b->cardinality || (i < a->cardinality && a->array[i] < b->array[j])) {
+                out->array[n++] = a->array[i++];
+            } else if (i == a->cardinality || b->array[j] < a->array[i]) {
+                out->array[n++] = b->array[j++];
+            } else {
+                out->array[n++] = a->array[i++];
+                j++;
+            }
+        }
+        out->cardinality = n;
+        return VDB_OK;
+    }
+
+    uint64_t *bits = container_copy_bits(a);
+    if (bits == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    if (b->bits != NULL) {
+        for (size_t w = 0; w < ROARING_WORDS; w++) {
+            bits[w] |= b->bits[w];
+        }
+    } else {
+        for (uint32_t i = 0; i < b->cardinality; i++) {
+            bits[b->array[i] >> 6] |= 1ull << (b->array[i] & 63);
+        }
+    }
+    return container_from_bits(a->key, bits, out);
+}
+
+static vdb_status_t container_andnot(const roaring_container_t *a, const roaring_container_t *b,
+                                     roaring_container_t *out) {
+    if (a->bits == NULL) {
+        memset(out, 0, sizeof(*out));
+        out->key = a->key;
+        if (a->cardinality == 0) {
+            return VDB_OK;
+        }
+        out->array = (uint16_t*)malloc(a->cardinality * sizeof(uint16_t));
+        if (out->array == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        out->capacity = a->cardinality;
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < a->cardinality; i++) {
+            if (!container_contains(b, a->array[i])) {
+                out->array[n++] = a->array[i];
+            }
+        }
+        out->cardinality = n;
+        return VDB_OK;
+    }
+
+    uint64_t *bits = container_copy_bits(a);
+    if (bits == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    if (b->bits != NULL) {
+        for (size_t w = 0; w < ROARING_WORDS; w++) {
+            bits[w] &= ~b->bits[w];
+        }
+    } else {
+        for (uint32_t i = 0; i < b->cardinality; i++) {
+            bits[b->array[i] >> 6] &= ~(1ull << (b->array[i] & 63));
+        }
+    }
+    return container_from_bits(a->key, bits, out);
+}
+
+/* ------------------------------------------------------------------ */
+/* Bitmaps                                                             */
+/* ------------------------------------------------------------------ */
+
+/* Index of the container with key, or where it would go */
+static size_t find_container(const roaring_t *r, uint64_t key) {
+    size_t lo = 0;
+    size_t hi = r->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (r->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static vdb_status_t reserve_containers(roaring_t *r, size_t n) {
+    if (n <= r->capacity) {
+        return VDB_OK;
+    }
+    size_t capacity = r->capacity < 4 ? 4 : r->capacity * 2;
+    if (capacity < n) {
+        capacity = n;
+    }
+    roaring_container_t *containers = (roaring_container_t*)realloc(
+        r->containers, capacity * sizeof(roaring_container_t));
+    if (containers == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    r->containers = containers;
+    r->capacity = capacity;
+    return VDB_OK;
+}
+
+/* Container for key, inserted empty if missing */
+static roaring_container_t *get_container(roaring_t *r, uint64_t key) {
+    if (r->size > 0 && r->containers[r->size - 1].key == key) {
+        return &r->containers[r->size - 1];
+    }
+    size_t pos = find_container(r, key);
+    if (pos < r->size && r->containers[pos].key == key) {
+        return &r->containers[pos];
+    }
+    if (reserve_containers(r, r->size + 1) != VDB_OK) {
+        return NULL;
+    }
+    memmove(r->containers + pos + 1, r->containers + pos,
+            (r->size - pos) * sizeof(roaring_container_t));
+    memset(&r->containers[pos], 0, sizeof(roaring_container_t));
+    r->containers[pos].key = key;
+    r->size++;
+    return &r->containers[pos];
+}
+
+/* Append a finished container (keys ascending), dropping empty ones */
+static vdb_status_t push_container(roaring_t *r, roaring_container_t *c) {
+    if (c->cardinality == 0) {
+        container_free(c);
+        return VDB_OK;
+    }
+    vdb_status_t status = reserve_containers(r, r->size + 1);
+    if (status != VDB_OK) {
+        container_free(c);
+        return status;
+    }
+    r->containers[r->size++] = *c;
+    return VDB_OK;
+}
+
+vdb_status_t roaring_add(roaring_t *r, uint64_t row) {
+    roaring_container_t *c = get_container(r, row >> ROARING_CHUNK_BITS);
+    if (c == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    return container_add(c, (uint16_t)(row & (ROARING_CHUNK_ROWS - 1)));
+}
+
+vdb_status_t roaring_add_range(roaring_t *r, uint64_t first, uint64_t end) {
+    while (first < end) {
+        uint64_t key = first >> ROARING_CHUNK_BITS;
+        uint32_t lo = (uint32_t)(first & (ROARING_CHUNK_ROWS - 1));
+        uint64_t chunk_end = (key + 1) << ROARING_CHUNK_BITS;
+        uint32_t hi = end < chunk_end ? (uint32_t)(end & (ROARING_CHUNK_ROWS - 1)) : ROARING_CHUNK_ROWS;
+
+        roaring_container_t *c = get_container(r, key);
+        if (c == NULL) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        if (c->bits == NULL && c->cardinality + (hi - lo) > ROARING_ARRAY_MAX) {
+            vdb_status_t status = container_to_bits(c);
+            if (status != VDB_OK) {
+                return status;
+            }
+        }
+        if (c->bits != NULL) {
+            bits_set_range(c, lo, hi);
+        } else {
+            for (uint32_t v = lo; v < hi; v++) {
+                vdb_status_t status = container_add(c, (uint16_t)v);
+                if (status != VDB_OK) {
+                    return status;
+                }
+            }
+        }
+        first = chunk_end;
+    }
+    return VDB_OK;
+}
+
+bool roaring_contains(const roaring_t *r, uint64_t row) {
+    uint64_t key = row >> ROARING_CHUNK_BITS;
+    size_t pos = find_container(r, key);
+    return pos < r->size && r->containers[pos].key == key &&
+           container_contains(&r->containers[pos], (uint16_t)(row & (ROARING_CHUNK_ROWS - 1)));
+}
+
+uint64_t roaring_cardinality(const roaring_t *r) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < r->size; i++) {
+        n += r->containers[i].cardinality;
+    }
+    return n;
+}
+
+size_t roaring_memory_bytes(const roaring_t *r) {
+    size_t bytes = r->capacity * sizeof(roaring_container_t);
+    for (size_t i = 0; i < r->size; i++) {
+        const roaring_container_t *c = &r->containers[i];
+        bytes += c->bits != NULL ? ROARING_WORDS * sizeof(uint64_t) : c->capacity * sizeof(uint16_t);
+    }
+    return bytes;
+}
+
+typedef enum { OP_AND, OP_OR, OP_ANDNOT } roaring_op_t;
+
+/**
+ * Walk both key lists in step and combine matching containers
+ * Containers only on one side are copied (OR; ANDNOT from a) or skipped.
+*/
+static vdb_status_t roaring_combine(const roaring_t *a, const roaring_t *b, roaring_op_t op,
+                                    roaring_t *out) {
+    roaring_free(out);
+    size_t i = 0;
+    size_t j = 0;
+    vdb_status_t status = VDB_OK;
+    while (status == VDB_OK && (i < a->size || j < b->size)) {
+        const roaring_container_t *ca = i < a->size ? &a->containers[i] : NULL;
+        const roaring_container_t *cb = j < b->size ? &b->containers[j] : NULL;
+        roaring_container_t c;
+        memset(&c, 0, sizeof(c));
+
+        if (ca != NULL && cb != NULL && ca->key == cb->key) {
+            status = op == OP_AND ? container_and(ca, cb, &c)
+                   : op == OP_OR ? container_or(ca, cb, &c)
+                   : container_andnot(ca, cb, &c);
+            i++;
+            j++;
+        } else if (ca != NULL && (cb == NULL || ca->key < cb->key)) {
+            if (op != OP_AND) {
+                status = container_copy(ca, &c);
+            }
+            i++;
+        } else {
+            if (op == OP_OR) {
+                status = container_copy(cb, &c);
+            } else if (op == OP_AND && ca == NULL) {
+                break; // nothing left in a to match
+            }
+            j++;
+        }
+
+        if (status == VDB_OK) {
+            status = push_container(out, &c);
+        } else {
+            container_free(&c);
+        }
+    }
+    if (status != VDB_OK) {
+        roaring_free(out);
+    }
+    return status;
+}
+
+vdb_status_t roaring_and(const roaring_t *a, const roaring_t *b, roaring_t *out) {
+    return roaring_combine(a, b, OP_AND, out);
+}
+
+vdb_status_t roaring_or(const roaring_t *a, const roaring_t *b, roaring_t *out) {
+    return roaring_combine(a, b, OP_OR, out);
+}
+
+vdb_status_t roaring_andnot(const roaring_t *a, const roaring_t *b, roaring_t *out) {
+    return roaring_combine(a, b, OP_ANDNOT, out);
+}
+
+size_t roaring_next_rows(const roaring_t *r, uint64_t from, uint64_t end,
+                         uint64_t *out, size_t max) {
+    size_t n = 0;
+    for (size_t i = find_container(r, from >> ROARING_CHUNK_BITS); i < r->size && n < max; i++) {
+        const roaring_container_t *c = &r->containers[i];
+        uint64_t base = c->key << ROARING_CHUNK_BITS;
+        if (base >= end) {
+            break;
+        }
+        uint32_t lo = from > base ? (uint32_t)(from - base) : 0;
+
+        if (c->bits != NULL) {
+            for (uint32_t w = lo >> 6; w < ROARING_WORDS && n < max; w++) {
+                uint64_t word = c->bits[w];
+                if (w == lo >> 6) {
+                    word &= ~0ull << (lo & 63);
+                }
+                for (; word != 0 && n < max; word &= word - 1) {
+                    uint64_t row = base + w * 64 + (uint64_t)__builtin_ctzll(word);
+                    if (row >= end) {
+                        return n;
+                    }
+                    out[n++] = row;
+                }
+            }
+        } else {
+            for (uint32_t k = array_lower_bound(c->array, c->cardinality, (uint16_t)lo);
+                 k < c->cardinality && n < max; k++) {
+                uint64_t row = base + c->array[k];
+                if (row >= end) {
+                    return n;
+                }
+                out[n++] = row;
+            }
+        }
+    }
+    return n;
+}
+
+/* ------------------------------------------------------------------ */
+/* Images                                                              */
+/* ------------------------------------------------------------------ */
+
+/* Container record of an image; its array (padded to 8 bytes) or bits follow */
+typedef struct {
+    uint64_t key;
+    uint32_t cardinality;
+    uint32_t is_bits;
+} roaring_image_container_t;
+
+static size_t image_data_bytes(const roaring_container_t *c) {
+    if (c->bits != NULL) {
+        return ROARING_WORDS * sizeof(uint64_t);
+    }
+    return ((size_t)c->cardinality * sizeof(uint16_t) + 7) & ~(size_t)7;
+}
+
+size_t roaring_image_bytes(const roaring_t *r) {
+    size_t bytes = sizeof(uint64_t);
+    for (size_t i = 0; i < r->size; i++) {
+        bytes += sizeof(roaring_image_container_t) + image_data_bytes(&r->containers[i]);
+    }
+    return bytes;
+}
+
+void roaring_write_image(const roaring_t *r, uint8_t *out) {
+    uint64_t size = r->size;
+    memcpy(out, &size, sizeof(size));
+    out += sizeof(size);
+    for (size_t i = 0; i < r->size; i++) {
+        const roaring_container_t *c = &r->containers[i];
+        roaring_image_container_t record = { c->key, c->cardinality, c->bits != NULL };
+        memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+
+        size_t bytes = image_data_bytes(c);
+        memset(out, 0, bytes);
+        if (c->bits != NULL) {
+            memcpy(out, c->bits, bytes);
+        } else if (c->cardinality > 0) {
+            memcpy(out, c->array, c->cardinality * sizeof(uint16_t));
+        }
+        out += bytes;
+    }
+}
+
+/* Check a container read back holds what its record says */
+static bool image_container_valid(const roaring_container_t *c) {
+    if (c->bits != NULL) {
+        uint32_t n = 0;
+        for (uint32_t w = 0; w < ROARING_WORDS; w++) {
+            n += popcount64(c->bits[w]);
+        }
+        return n == c->cardinality;
+    }
+    if (c->cardinality > ROARING_ARRAY_MAX) {
+        return false;
+    }
+    for (uint32_t i = 1; i < c->cardinality; i++) {
+        if (c->array[i] <= c->array[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vdb_status_t roaring_read_image(const uint8_t *data, size_t len, roaring_t *out, size_t *out_used) {
+    roaring_init(out);
+    uint64_t size;
+    if (len < sizeof(size)) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    memcpy(&size, data, sizeof(size));
+    size_t pos = sizeof(size);
+    if (size > (len - pos) / sizeof(roaring_image_container_t)) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    vdb_status_t status = reserve_containers(out, (size_t)size);
+
+    for (uint64_t i = 0; i < size && status == VDB_OK; i++) {
+        roaring_image_container_t record;
+        if (len - pos < sizeof(record)) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(record);
+
+        roaring_container_t c;
+        memset(&c, 0, sizeof(c));
+        c.key = record.key;
+        c.cardinality = record.cardinality;
+        if (!record.is_bits && record.cardinality > ROARING_ARRAY_MAX) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        if (record.is_bits) {
+            c.bits = (uint64_t*)malloc(ROARING_WORDS * sizeof(uint64_t));
+        } else if (record.cardinality > 0) {
+            c.array = (uint16_t*)malloc(record.cardinality * sizeof(uint16_t));
+            c.capacity = record.cardinality;
+        }
+        size_t bytes = record.is_bits ? ROARING_WORDS * sizeof(uint64_t)
+                                      : ((size_t)record.cardinality * sizeof(uint16_t) + 7) & ~(size_t)7;
+        if (c.bits == NULL && c.array == NULL && (record.is_bits || record.cardinality > 0)) {
+            status = VDB_ERROR_OUT_OF_MEMORY;
+        } else if (len - pos < bytes || (i > 0 && record.key <= out->containers[i - 1].key)) {
+            status = VDB_ERROR_CORRUPTED;
+        } else {
+            if (c.bits != NULL) {
+                memcpy(c.bits, data + pos, bytes);
+            } else if (c.array != NULL) {
+                memcpy(c.array, data + pos, c.cardinality * sizeof(uint16_t));
+            }
+            pos += bytes;
+            if (!image_container_valid(&c)) {
+                status = VDB_ERROR_CORRUPTED;
+            }
+        }
+        if (status != VDB_OK) {
+            container_free(&c);
+            break;
+        }
+        out->containers[out->size++] = c;
+    }
+    if (status != VDB_OK) {
+        roaring_free(out);
+        return status;
+    }
+    *out_used = pos;
+    return VDB_OK;
+}
@@ -0,0 +1,107 @@
+/**
+ * roaring.h - Internal compressed row bitmaps (roaring layout)
+ *
+ * Rows are split by their high bits into chunks of 65536. Each chunk
+ * with any row set is a container holding the low 16 bits, either as a
+ * sorted uint16 array (up to ROARING_ARRAY_MAX rows) or as a plain
+ * 65536-bit bitmap. Containers are kept sorted by key, so set
+ * operations walk both sides in step.
+ *
+ * Adding rows in ascending order (how appends arrive) only ever
+ * touches the last container.
+*/
+
+#ifndef VDB_ROARING_H
+#define VDB_ROARING_H
+
+#include "vdb/types.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Array containers switch to a bitmap past this many rows */
+#define ROARING_ARRAY_MAX 4096
+
+/* uint64 words in a bitmap container */
+#define ROARING_WORDS 1024
+
+typedef struct {
+    uint64_t key; // row >> 16
+    uint32_t cardinality;
+    uint32_t capacity; // array slots allocated
+    uint16_t *array; // sorted low bits, NULL for a bitmap container
+    uint64_t *bits; // ROARING_WORDS words, NULL for an array container
+} roaring_container_t;
+
+typedef struct {
+    roaring_container_t *containers;
+    size_t size;
+    size_t capacity;
+} roaring_t;
+
+void roaring_init(roaring_t *r);
+
+/* Free every container; r is empty (and reusable) afterwards */
+void roaring_free(roaring_t *r);
+
+/**
+ * Add one row / the rows [first, end)
+ * On VDB_ERROR_OUT_OF_MEMORY the rows added so far stay set.
+*/
+vdb_status_t roaring_add(roaring_t *r, uint64_t row);
+vdb_status_t roaring_add_range(roaring_t *r, uint64_t first, uint64_t end);
+
+bool roaring_contains(const roaring_t *r, uint64_t row);
+uint64_t roaring_cardinality(const roaring_t *r);
+
+/**
+ * Rows a search may return: those allow holds (NULL = every row) that
+ * deny (NULL = none) doesn't. A NULL set admits every row.
+*/
+typedef struct {
+    const roaring_t *allow;
+    const roaring_t *deny;
+} row_set_t;
+
+static inline bool row_set_admits(const row_set_t *set, uint64_t row) {
+    return set == NULL || ((set->allow == NULL || roaring_contains(set->allow, row)) &&
+                           (set->deny == NULL || !roaring_contains(set->deny, row)));
+}
+
+/* Heap bytes held: the container array and each container's array or bits */
+size_t roaring_memory_bytes(const roaring_t *r);
+
+/**
+ * Set operations into out, which must be initialized and is replaced
+ * out must not be one of the inputs.
+*/
+vdb_status_t roaring_and(const roaring_t *a, const roaring_t *b, roaring_t *out);
+vdb_status_t roaring_or(const roaring_t *a, const roaring_t *b, roaring_t *out);
+vdb_status_t roaring_andnot(const roaring_t *a, const roaring_t *b, roaring_t *out);
+
+/**
+ * Write up to max set rows in [from, end) to out, ascending
+ * Returns how many; continue from out[n - 1] + 1 for the rest.
+*/
+size_t roaring_next_rows(const roaring_t *r, uint64_t from, uint64_t end,
+                         uint64_t *out, size_t max);
+
+/**
+ * Pointer-free image of a bitmap, for snapshots: the container count,
+ * then each container's key, cardinality and kind followed by its array
+ * (padded to 8 bytes) or bits. write_image fills roaring_image_bytes.
+*/
+size_t roaring_image_bytes(const roaring_t *r);
+void roaring_write_image(const roaring_t *r, uint8_t *out);
+
+/**
+ * Read an image back into out (initialized here); *out_used is the
+ * length it took
+ *
+ * Returns:
+ * - VDB_ERROR_CORRUPTED: Truncated, keys out of order, or a container
+ *   that doesn't match its record
+*/
+vdb_status_t roaring_read_image(const uint8_t *data, size_t len, roaring_t *out, size_t *out_used);
+
+#endif /* VDB_ROARING_H */
@@ -0,0 +1,24 @@
+/**
+ * scratch.h - Internal per-thread scratch arena
+ *
+ * Short-lived buffers of one call (search heaps, WAL frames) come from
+ * the calling thread's arena instead of malloc, so concurrent searches
+ * and appends don't meet in the allocator. Callers take a mark, allocate
+ * and rewind before returning; nested calls stack up naturally.
+ *
+ * Memory from here may be written by pool workers while the owning call
+ * waits, but must not outlive the call.
+*/
+
+#ifndef VDB_SCRATCH_H
+#define VDB_SCRATCH_H
+
+#include "vdb/arena.h"
+
+/**
+ * This thread's scratch arena, created on first use
+ * Returns NULL if it can't be allocated.
+*/
+vdb_arena_t *scratch_arena(void);
+
+#endif /* VDB_SCRATCH_H */
@@ -0,0 +1,1184 @@
+/**
+ * search.c - Exact (brute-force), HNSW and DiskANN top-k search
+ *
+ * The fixed-stride embeddings segment is split into contiguous chunks.
+ * Each chunk is one pool task: it scores rows in small blocks with the
+ * batch distance kernel (so the distances stay in L1) and keeps its own
+ * bounded heap. Heaps are merged once every task is done, so threads
+ * never share mutable state during the scan.
+ *
+ * With quantization on, the scan reads the SQ8 or PQ codes instead,
+ * keeps k * rerank_factor candidates, and re-scores just those against
+ * the float32 rows.
+ *
+ * Batch search runs the same chunked scan for many queries at once:
+ * each block of rows is scored against every query (the tile kernel
+ * shares each row load between four of them) while it is still in
+ * cache, so the rows are streamed once per batch instead of once per
+ * query. Every task keeps one heap per query.
+ *
+ * Heaps and other per-query buffers come from the calling thread's
+ * scratch arena, rewound before returning; only the results are malloc'd.
+ *
+ * HNSW search walks the graph of every sealed segment into one heap and
+ * scans the memtable (the rows no segment covers yet) exactly, then
+ * merges the two.
+ *
+ * DiskANN search walks the on-disk Vamana graph by the codes, reading
+ * the full rows of the nodes it expands from diskann.idx, and scans the
+ * rows appended since the graph was built exactly.
+ *
+ * With the query cache on, each search first looks its key (kind, k,
+ * filter, bf16-rounded query) up and returns a copy of the cached hits
+ * on a hit; a miss stores its hits under the key, unless a write
+ * invalidated the cache while it ran.
+ *
+ * Filters are evaluated to a row bitmap first. The exact scan then
+ * scores only the set rows (runs of adjacent rows still go through the
+ * batch kernels); HNSW walks the graph with the bitmap as allow-list,
+ * unless so few rows match that scanning them is cheaper. Superseded
+ * and deleted rows are subtracted from a filter's matches; without a
+ * filter they are only skipped (a deny-list), so an unfiltered search
+ * never builds a bitmap of every row.
+*/
+
+#include "vdb/storage.h"
+#include "vdb/distance.h"
+#include "storage_internal.h"
+#include "topk.h"
+#include "hnsw.h"
+#include "vamana.h"
+#include "sq8.h"
+#include "pq.h"
+#include "scratch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Rows scored per distance kernel call */
+#define SEARCH_BLOCK_ROWS 256
+
+/* Don't split below this - the scan is cheaper than the hand-off */
+#define SEARCH_MIN_ROWS_PER_TASK 16384
+
+/* Tasks per thread; >1 evens out chunks that hit cold pages */
+#define SEARCH_TASKS_PER_THREAD 4
+
+/* Rows per batch block are capped so the block stays in L2 while every
+ * query of the batch scores it */
+#define SEARCH_BATCH_BLOCK_BYTES (128 * 1024)
+
+/* Queries scored per tile call (their distances for a block stay in L1) */
+#define SEARCH_BATCH_TILE_QUERIES 16
+
+/* Queries per pass over the rows; bounds the per-task heaps */
+#define SEARCH_BATCH_MAX_QUERIES 256
+
+/* Filtered HNSW scans the matching rows instead when fewer than this
+ * many match, or under 1 / SEARCH_FILTER_GRAPH_FRACTION of the rows:
+ * the walk would have to visit most of the graph to find ef of them */
+#define SEARCH_FILTER_EXACT_ROWS 2048
+#define SEARCH_FILTER_GRAPH_FRACTION 32
+
+/**
+ * Query prepared for whichever codes the view has
+*/
+typedef struct {
+    const storage_view_t *view;
+    sq8_query_t sq8;
+    pq_query_t pq;
+    size_t sq8_bytes; // sq8 row stride
+} quant_query_t;
+
+static bool view_quantized(const storage_view_t *view) {
+    return view->sq8_codec != NULL || view->pq_codec != NULL;
+}
+
+static vdb_status_t quant_query_init(const vdb_storage_t *storage, const storage_view_t *view,
+                                     const float *query, quant_query_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->view = view;
+    if (view->pq_codec != NULL) {
+        return pq_query_init(view->pq_codec, storage_scan_metric(storage), query, &out->pq);
+    }
+    if (view->sq8_codec != NULL) {
+        out->sq8_bytes = sq8_row_bytes(storage->dim);
+        return sq8_query_init(view->sq8_codec, storage_scan_metric(storage), query, &out->sq8);
+    }
+    return VDB_OK;
+}
+
+static void quant_query_free(quant_query_t *q) {
+    sq8_query_free(&q->sq8);
+    pq_query_free(&q->pq);
+}
+
+/* Approximate distances to n coded rows starting at first */
+static void quant_distance_batch(const quant_query_t *q, uint64_t first, size_t n, float *out) {
+    if (q->view->pq_codec != NULL) {
+        pq_distance_batch(&q->pq, q->view->codes, first, n, out);
+    } else {
+        sq8_distance_batch(&q->sq8, q->view->codes + first * q->sq8_bytes, n, q->sq8_bytes, out);
+    }
+}
+
+static float quant_distance(const quant_query_t *q, uint64_t row) {
+    if (q->view->pq_codec != NULL) {
+        return pq_distance(&q->pq, q->view->codes, row);
+    }
+    return sq8_distance(&q->sq8, q->view->codes + row * q->sq8_bytes);
+}
+
+typedef struct {
+    const vdb_storage_t *storage;
+    const storage_view_t *view;
+    const float *query;
+    const quant_query_t *quant; // NULL = float32 scan
+    const row_set_t *rows;
+    size_t k;
+    uint64_t rows_per_task;
+    vdb_topk_entry_t *entries; // k entries per task
+    size_t *sizes; // heap size per task
+} exact_scan_t;
+
+/**
+ * Score up to n rows from row into heap, returns how many were scored
+ * Stops early at the end of the coded rows or after one block.
+*/
+static size_t scan_run(const exact_scan_t *scan, vdb_topk_t *heap, uint64_t row, size_t n) {
+    const vdb_storage_t *storage = scan->storage;
+    uint64_t coded = scan->quant != NULL ? scan->view->code_count : 0;
+    float distances[SEARCH_BLOCK_ROWS];
+
+    if (n > SEARCH_BLOCK_ROWS) {
+        n = SEARCH_BLOCK_ROWS;
+    }
+    if (row < coded) {
+        // rows not encoded yet (a failed catch-up) fall through to float32
+        n = (size_t)(coded - row < n ? coded - row : n);
+        quant_distance_batch(scan->quant, row, n, distances);
+    } else {
+        vdb_distance_batch_kernel(storage->dim_kernel, storage_scan_metric(storage), storage->element,
+                                  scan->query, storage_view_row(storage, scan->view, row), n,
+                                  storage->scan_dim, storage->scan_dim, distances);
+    }
+
+    float threshold = topk_threshold(heap);
+    for (size_t i = 0; i < n; i++) {
+        if (distances[i] <= threshold) {
+            topk_push(heap, distances[i], row + i);
+            threshold = topk_threshold(heap);
+        }
+    }
+    return n;
+}
+
+/* Scores up to n rows from row, returns how many it scored */
+typedef size_t (*scan_run_fn)(const void *scan, vdb_topk_t *heaps, uint64_t row, size_t n);
+
+static void scan_every(scan_run_fn run_fn, const void *scan, vdb_topk_t *heaps, uint64_t start, uint64_t end) {
+    for (uint64_t row = start; row < end; ) {
+        row += run_fn(scan, heaps, row, (size_t)(end - row));
+    }
+}
+
+/**
+ * Feed the rows of [start, end) that rows admits to run as runs of
+ * adjacent rows
+*/
+static void scan_range(const row_set_t *rows, uint64_t start, uint64_t end,
+                       scan_run_fn run_fn, const void *scan, vdb_topk_t *heaps) {
+    uint64_t block[SEARCH_BLOCK_ROWS];
+    size_t got;
+    if (rows->allow == NULL) {
+        // the gaps between denied rows, a block of those at a time
+        do {
+            got = rows->deny != NULL ? roaring_next_rows(rows->deny, start, end, block, SEARCH_BLOCK_ROWS) : 0;
+            for (size_t i = 0; i < got; i++) {
+                scan_every(run_fn, scan, heaps, start, block[i]);
+                start = block[i] + 1;
+            }
+        } while (got == SEARCH_BLOCK_ROWS);
+        scan_every(run_fn, scan, heaps, start, end);
+        return;
+    }
+
+    // only the allowed rows, a block of them at a time
+    while ((got = roaring_next_rows(rows->allow, start, end, block, SEARCH_BLOCK_ROWS)) > 0) {
+        start = block[got - 1] + 1;
+        if (rows->deny != NULL) {
+            size_t kept = 0;
+            for (size_t i = 0; i < got; i++) {
+                if (!roaring_contains(rows->deny, block[i])) {
+                    block[kept++] = block[i];
+                }
+            }
+            got = kept;
+        }
+        for (size_t i = 0; i < got; ) {
+            size_t run = 1;
+            while (i + run < got && block[i + run] == block[i] + run) {
+                run++;
+            }
+            for (size_t done = 0; done < run; ) {
+                done += run_fn(scan, heaps, block[i] + done, run - done);
+            }
+            i += run;
+        }
+    }
+}
+
+static size_t exact_run(const void *scan, vdb_topk_t *heaps, uint64_t row, size_t n) {
+    return scan_run((const exact_scan_t*)scan, heaps, row, n);
+}
+
+/**
+ * Scan one chunk of rows into the task's private heap
+*/
+static void exact_scan_task(void *ctx, size_t task) {
+    exact_scan_t *scan = (exact_scan_t*)ctx;
+
+    uint64_t start = (uint64_t)task * scan->rows_per_task;
+    uint64_t end = start + scan->rows_per_task;
+    if (end > scan->view->count) {
+        end = scan->view->count;
+    }
+
+    vdb_topk_t heap;
+    topk_init(&heap, scan->entries + task * scan->k, scan->k);
+    scan_range(scan->rows, start, end, exact_run, scan, &heap);
+    scan->sizes[task] = heap.size;
+}
+
+/**
+ * Copy a best-first sorted heap into caller-owned results
+*/
+static vdb_status_t fill_results(const storage_view_t *view, const vdb_topk_t *heap,
+                                 vdb_search_results_t *out_results) {
+    out_results->hits = NULL;
+    out_results->count = 0;
+    if (heap->size == 0) {
+        return VDB_OK;
+    }
+
+    vdb_search_hit_t *hits = (vdb_search_hit_t*)calloc(heap->size, sizeof(vdb_search_hit_t));
+    if (hits == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < heap->size; i++) {
+        const vdb_topk_entry_t *e = &heap->entries[i];
+        memcpy(hits[i].id, storage_view_id(view, e->row), VDB_ID_MAX_LEN);
+        hits[i].id[VDB_ID_MAX_LEN - 1] = '\0';
+        hits[i].row = e->row;
+        hits[i].distance = e->distance;
+    }
+
+    out_results->hits = hits;
+    out_results->count = heap->size;
+    return VDB_OK;
+}
+
+/**
+ * Re-score candidates against the stored rows (row i at base + i * stride)
+ * and keep the best k of them, sorted, in out (capacity k)
+*/
+static void rerank(const vdb_storage_t *storage, const float *query, const uint8_t *base,
+                   size_t stride, const vdb_topk_t *cands, vdb_topk_t *out) {
+    for (size_t i = 0; i < cands->size; i++) {
+        uint64_t row = cands->entries[i].row;
+        float d = vdb_distance_kernel(storage->dim_kernel, storage_scan_metric(storage), storage->element,
+                                      query, base + row * stride, storage->dim);
+        topk_push(out, d, row);
+    }
+    topk_sort(out);
+}
+
+/* Candidates to collect for k hits: k, or k * rerank_factor when quantized */
+static size_t candidate_count(const vdb_storage_t *storage, const storage_view_t *view, uint32_t k) {
+    if (!view_quantized(view)) {
+        return k;
+    }
+    uint64_t n = (uint64_t)k * storage->rerank_factor;
+    return n < SIZE_MAX / sizeof(vdb_topk_entry_t) ? (size_t)n : k;
+}
+
+/**
+ * Size the scan chunks: enough tasks to balance, none too small
+ * Returns rows per task; *out_pool is NULL when one thread will do.
+*/
+static uint64_t split_rows(vdb_storage_t *storage, const storage_view_t *view, uint64_t matches,
+                           vdb_thread_pool_t **out_pool) {
+    vdb_thread_pool_t *pool = matches > SEARCH_MIN_ROWS_PER_TASK ? storage_get_pool(storage) : NULL;
+    uint64_t max_tasks = (uint64_t)vdb_thread_pool_concurrency(pool) * SEARCH_TASKS_PER_THREAD;
+    uint64_t rows_per_task = (view->count + max_tasks - 1) / max_tasks;
+    if (rows_per_task < SEARCH_MIN_ROWS_PER_TASK) {
+        rows_per_task = SEARCH_MIN_ROWS_PER_TASK;
+    }
+    *out_pool = pool;
+    return rows_per_task;
+}
+
+/* Rows a scan over matches of view's rows scores */
+static uint64_t scanned_rows(const storage_view_t *view, uint64_t matches) {
+    return matches < view->count ? matches : view->count;
+}
+
+/**
+ * Exact top-k over the rows of view that rows admits
+ * matches is how many rows can be hits, at most: view->count, or the
+ * size of rows' allow-list. query has scan_dim floats (see scan_query).
+*/
+static vdb_status_t exact_search(vdb_storage_t *storage, const storage_view_t *view,
+                                 const float *query, uint32_t k, const row_set_t *rows,
+                                 uint64_t matches, vdb_search_results_t *out_results) {
+    if (view->count == 0 || matches == 0) {
+        return VDB_OK;
+    }
+
+    vdb_thread_pool_t *pool = NULL;
+    uint64_t rows_per_task = split_rows(storage, view, matches, &pool);
+    size_t num_tasks = (size_t)((view->count + rows_per_task - 1) / rows_per_task);
+
+    quant_query_t quant;
+    vdb_status_t status = quant_query_init(storage, view, query, &quant);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    size_t cands = candidate_count(storage, view, k);
+    size_t heap_k = cands < matches ? cands : (size_t)matches;
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    exact_scan_t scan = {
+        storage, view, query, view_quantized(view) ? &quant : NULL, rows, heap_k, rows_per_task,
+        (vdb_topk_entry_t*)vdb_arena_alloc(arena, num_tasks * heap_k * sizeof(vdb_topk_entry_t)),
+        (size_t*)vdb_arena_calloc(arena, num_tasks, sizeof(size_t))
+    };
+    if (scan.entries == NULL || scan.sizes == NULL) {
+        vdb_arena_rewind(arena, mark);
+        quant_query_free(&quant);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    vdb_thread_pool_run(pool, num_tasks, exact_scan_task, &scan);
+
+    /* merge the per-task heaps; task 0's heap is reused as the output */
+    vdb_topk_t merged;
+    topk_init(&merged, scan.entries, heap_k);
+    merged.size = scan.sizes[0];
+    for (size_t t = 1; t < num_tasks; t++) {
+        const vdb_topk_entry_t *e = scan.entries + t * heap_k;
+        for (size_t i = 0; i < scan.sizes[t]; i++) {
+            topk_push(&merged, e[i].distance, e[i].row);
+        }
+    }
+    if (scan.quant != NULL) {
+        /* re-score the candidates in float32, keep the best k */
+        size_t out_k = k < merged.size ? k : merged.size;
+        vdb_topk_entry_t *best = (vdb_topk_entry_t*)vdb_arena_alloc(arena, out_k * sizeof(vdb_topk_entry_t));
+        if (best == NULL) {
+            status = VDB_ERROR_OUT_OF_MEMORY;
+        } else {
+            vdb_topk_t reranked;
+            topk_init(&reranked, best, out_k);
+            rerank(storage, query, view->embeddings, storage->row_bytes, &merged, &reranked);
+            status = fill_results(view, &reranked, out_results);
+        }
+    } else {
+        topk_sort(&merged);
+        status = fill_results(view, &merged, out_results);
+    }
+    stats_add(storage->stats, STATS_DISTANCES,
+              scanned_rows(view, matches) + (scan.quant != NULL ? merged.size : 0));
+
+    quant_query_free(&quant);
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+static bool query_valid(const vdb_vector_t *query, uint32_t k, const vdb_search_results_t *out_results) {
+    return query != NULL && query->data != NULL && out_results != NULL && k > 0;
+}
+
+/**
+ * Answer a search from the query cache if it can
+ * On a miss *key is what cache_store needs (key->bytes NULL when the
+ * cache is off); it lives in arena.
+*/
+static bool cache_lookup(vdb_storage_t *storage, query_cache_kind_t kind, const vdb_vector_t *query,
+                         uint32_t k, const vdb_filter_t *filter, vdb_arena_t *arena,
+                         query_cache_key_t *key, vdb_search_results_t *out_results) {
+    key->bytes = NULL;
+    if (!query_cache_key(storage->query_cache, kind, query, k, filter, arena, key)) {
+        key->bytes = NULL;
+        return false;
+    }
+    bool hit = query_cache_get(storage->query_cache, key, out_results);
+    stats_add(storage->stats, hit ? STATS_QUERY_CACHE_HITS : STATS_QUERY_CACHE_MISSES, 1);
+    return hit;
+}
+
+static void cache_store(vdb_storage_t *storage, const query_cache_key_t *key,
+                        const vdb_search_results_t *results) {
+    if (key->bytes != NULL) {
+        query_cache_put(storage->query_cache, key, results);
+    }
+}
+
+/**
+ * Copy a query into dst the way the scan kernels take it: zero padded
+ * to scan_dim, and unit length if the rows are
+*/
+static void prepare_query(const vdb_storage_t *storage, const float *query, float *dst) {
+    memcpy(dst, query, storage->dim * sizeof(float));
+    memset(dst + storage->dim, 0, (storage->scan_dim - storage->dim) * sizeof(float));
+    if (storage->normalize != VDB_NORMALIZE_NONE) {
+        vdb_normalize(dst, storage->dim);
+    }
+}
+
+/**
+ * The query as the scan kernels take it: as is, or for padded or
+ * normalized rows a prepared aligned copy (from arena; NULL if out of memory)
+*/
+static const float *scan_query(const vdb_storage_t *storage, const float *query, vdb_arena_t *arena) {
+    if (storage->scan_dim == storage->dim && storage->normalize == VDB_NORMALIZE_NONE) {
+        return query;
+    }
+    float *copy = (float*)vdb_arena_alloc_aligned(arena, storage->scan_dim * sizeof(float), VDB_ROW_ALIGN);
+    if (copy != NULL) {
+        prepare_query(storage, query, copy);
+    }
+    return copy;
+}
+
+/**
+ * Rows a search may return: the filter's live matches, or without a
+ * filter every row of view except the dead ones
+ * With a filter, rows->allow is set to allow, filled with the matches
+ * minus the dead rows. Without one, dead gets the dead rows and is
+ * rows->deny (unless empty), so the live rows are never materialized.
+ * *matches is how many rows can be hits: the allow-list's size, or
+ * the live rows of view as far as the dead count tells (a guess for
+ * choosing a plan, not a bound: dead rows may lie past the view).
+*/
+static vdb_status_t search_rows(vdb_storage_t *storage, const storage_view_t *view,
+                                const vdb_filter_t *filter, roaring_t *allow, roaring_t *dead,
+                                row_set_t *rows, uint64_t *matches) {
+    rows->allow = NULL;
+    rows->deny = NULL;
+    vdb_status_t status = storage_ids_dead(storage, dead);
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (filter == NULL) {
+        uint64_t dead_rows = roaring_cardinality(dead);
+        rows->deny = dead_rows > 0 ? dead : NULL;
+        *matches = view->count - (dead_rows < view->count ? dead_rows : view->count);
+        return VDB_OK;
+    }
+
+    roaring_t matched;
+    roaring_init(&matched);
+    status = storage_filter_eval(storage, filter, &matched);
+    if (status == VDB_OK) {
+        status = roaring_andnot(&matched, dead, allow);
+    }
+    roaring_free(&matched);
+    rows->allow = allow;
+    *matches = roaring_cardinality(allow);
+    return status;
+}
+
+/* Most hits a search over rows can have (matches may undercount without an allow-list) */
+static uint64_t hit_bound(const storage_view_t *view, const row_set_t *rows, uint64_t matches) {
+    return rows->allow != NULL ? matches : view->count;
+}
+
+/**
+ * Exact top-k search
+*/
+vdb_status_t vdb_storage_search_exact(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    vdb_search_results_t *out_results
+) {
+    return vdb_storage_search_exact_filtered(storage, query, k, NULL, out_results);
+}
+
+/**
+ * Exact top-k search over the rows matching a filter
+*/
+vdb_status_t vdb_storage_search_exact_filtered(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    const vdb_filter_t *filter,
+    vdb_search_results_t *out_results
+) {
+    if (storage == NULL || !query_valid(query, k, out_results)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    out_results->hits = NULL;
+    out_results->count = 0;
+
+    if (query->dim != storage->dim) {
+        return VDB_ERROR_DIMENSION_MISMATCH;
+    }
+
+    uint64_t start = stats_now_ns();
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    query_cache_key_t key;
+    if (cache_lookup(storage, QUERY_CACHE_EXACT, query, k, filter, arena, &key, out_results)) {
+        vdb_arena_rewind(arena, mark);
+        stats_add(storage->stats, STATS_EXACT_SEARCHES, 1);
+        stats_record_since(storage->stats, STATS_EXACT_SEARCH_LATENCY, start);
+        return VDB_OK;
+    }
+    const float *data = scan_query(storage, query->data, arena);
+    if (data == NULL) {
+        vdb_arena_rewind(arena, mark);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* rows the filter matches past the view were committed since; the
+     * scan stops at the view's count */
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    roaring_t allow, dead;
+    roaring_init(&allow);
+    roaring_init(&dead);
+    row_set_t rows;
+    uint64_t matches = 0;
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    if (status == VDB_OK) {
+        status = search_rows(storage, &view, filter, &allow, &dead, &rows, &matches);
+        if (status == VDB_OK) {
+            status = exact_search(storage, &view, data, k, &rows, hit_bound(&view, &rows, matches),
+                                  out_results);
+        }
+        storage_release_view(storage, &view);
+    }
+    roaring_free(&allow);
+    roaring_free(&dead);
+    pthread_rwlock_unlock(&storage->layout_lock);
+    if (status == VDB_OK) {
+        cache_store(storage, &key, out_results);
+    }
+    vdb_arena_rewind(arena, mark);
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_EXACT_SEARCHES, 1);
+        stats_record_since(storage->stats, STATS_EXACT_SEARCH_LATENCY, start);
+    }
+    return status;
+}
+
+typedef struct {
+    const vdb_storage_t *storage;
+    const storage_view_t *view;
+    const float *queries; // nq packed queries, scan_dim floats apart
+    const quant_query_t *quant; // one per query; NULL = float32 scan
+    const row_set_t *rows;
+    size_t nq;
+    size_t k;
+    size_t block_rows;
+    uint64_t rows_per_task;
+    vdb_topk_t *heaps; // nq per task
+    vdb_topk_entry_t *entries; // k entries per heap
+} batch_scan_t;
+
+/**
+ * Score up to one block of rows from row against every query
+*/
+static size_t batch_run(const void *ctx, vdb_topk_t *heaps, uint64_t row, size_t n) {
+    const batch_scan_t *scan = (const batch_scan_t*)ctx;
+    const vdb_storage_t *storage = scan->storage;
+    uint64_t coded = scan->quant != NULL ? scan->view->code_count : 0;
+    float distances[SEARCH_BATCH_TILE_QUERIES * SEARCH_BLOCK_ROWS];
+
+    if (n > scan->block_rows) {
+        n = scan->block_rows;
+    }
+    if (row < coded) {
+        n = (size_t)(coded - row < n ? coded - row : n);
+    }
+
+    /* half precision rows are widened once per block for all the
+     * queries; without the memory each query converts as it goes */
+    const void *block = storage_view_row(storage, scan->view, row);
+    const float *rows = storage->element == VDB_ELEMENT_F32 ? (const float*)block : NULL;
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    if (row >= coded && rows == NULL) {
+        float *widened = (float*)vdb_arena_alloc_aligned(arena, n * storage->scan_dim * sizeof(float), 64);
+        if (widened != NULL) {
+            vdb_convert_to_f32(storage->element, block, widened, n * storage->scan_dim);
+            rows = widened;
+        }
+    }
+
+    for (size_t q0 = 0; q0 < scan->nq; q0 += SEARCH_BATCH_TILE_QUERIES) {
+        size_t group = scan->nq - q0 < SEARCH_BATCH_TILE_QUERIES ? scan->nq - q0 : SEARCH_BATCH_TILE_QUERIES;
+        if (row < coded) {
+            for (size_t j = 0; j < group; j++) {
+                quant_distance_batch(&scan->quant[q0 + j], row, n, distances + j * n);
+            }
+        } else if (rows != NULL) {
+            vdb_distance_tile(storage_scan_metric(storage), scan->queries + q0 * storage->scan_dim, group,
+                              storage->scan_dim, rows, n, storage->scan_dim, storage->scan_dim, distances);
+        } else {
+            for (size_t j = 0; j < group; j++) {
+                vdb_distance_batch_kernel(storage->dim_kernel, storage_scan_metric(storage),
+                                          storage->element, scan->queries + (q0 + j) * storage->scan_dim,
+                                          block, n, storage->scan_dim, storage->scan_dim, distances + j * n);
+            }
+        }
+
+        for (size_t j = 0; j < group; j++) {
+            vdb_topk_t *heap = &heaps[q0 + j];
+            const float *d = distances + j * n;
+            float threshold = topk_threshold(heap);
+            for (size_t i = 0; i < n; i++) {
+                if (d[i] <= threshold) {
+                    topk_push(heap, d[i], row + i);
+                    threshold = topk_threshold(heap);
+                }
+            }
+        }
+    }
+    vdb_arena_rewind(arena, mark);
+    return n;
+}
+
+/**
+ * Scan one chunk of rows into the task's heaps, one per query
+*/
+static void batch_scan_task(void *ctx, size_t task) {
+    batch_scan_t *scan = (batch_scan_t*)ctx;
+
+    uint64_t start = (uint64_t)task * scan->rows_per_task;
+    uint64_t end = start + scan->rows_per_task;
+    if (end > scan->view->count) {
+        end = scan->view->count;
+    }
+
+    vdb_topk_t *heaps = scan->heaps + task * scan->nq;
+    for (size_t q = 0; q < scan->nq; q++) {
+        topk_init(&heaps[q], scan->entries + (task * scan->nq + q) * scan->k, scan->k);
+    }
+    scan_range(scan->rows, start, end, batch_run, scan, heaps);
+}
+
+/**
+ * Exact top-k for up to SEARCH_BATCH_MAX_QUERIES queries in one pass
+ * over the rows of view that rows admits (matches as for exact_search)
+*/
+static vdb_status_t batch_search(vdb_storage_t *storage, const storage_view_t *view,
+                                 const vdb_vector_t *queries, size_t nq, uint32_t k,
+                                 const row_set_t *rows, uint64_t matches,
+                                 vdb_search_results_t *out_results) {
+    vdb_thread_pool_t *pool = NULL;
+    uint64_t rows_per_task = split_rows(storage, view, matches, &pool);
+    size_t num_tasks = (size_t)((view->count + rows_per_task - 1) / rows_per_task);
+
+    size_t block_rows = SEARCH_BATCH_BLOCK_BYTES / storage->row_bytes;
+    block_rows = block_rows < 4 ? 4 : block_rows > SEARCH_BLOCK_ROWS ? SEARCH_BLOCK_ROWS : block_rows;
+
+    size_t cands = candidate_count(storage, view, k);
+    size_t heap_k = cands < matches ? cands : (size_t)matches;
+    bool quantized = view_quantized(view);
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    float *packed = (float*)vdb_arena_alloc_aligned(arena, nq * storage->scan_dim * sizeof(float), 64);
+    quant_query_t *quant = quantized ? (quant_query_t*)vdb_arena_calloc(arena, nq, sizeof(quant_query_t)) : NULL;
+    batch_scan_t scan = {
+        storage, view, packed, quant, rows, nq, heap_k, block_rows, rows_per_task,
+        (vdb_topk_t*)vdb_arena_alloc(arena, num_tasks * nq * sizeof(vdb_topk_t)),
+        (vdb_topk_entry_t*)vdb_arena_alloc(arena, num_tasks * nq * heap_k * sizeof(vdb_topk_entry_t))
+    };
+    vdb_topk_entry_t *best = (vdb_topk_entry_t*)vdb_arena_alloc(arena, (k < heap_k ? k : heap_k) * sizeof(vdb_topk_entry_t));
+    vdb_status_t status = VDB_OK;
+    if (packed == NULL || (quantized && quant == NULL) || scan.heaps == NULL ||
+        scan.entries == NULL || best == NULL) {
+        status = VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* the tile kernel wants the queries packed, padded like the rows */
+    size_t prepared = 0;
+    for (; status == VDB_OK && prepared < nq; prepared++) {
+        float *query = packed + prepared * storage->scan_dim;
+        prepare_query(storage, queries[prepared].data, query);
+        if (quantized) {
+            status = quant_query_init(storage, view, query, &quant[prepared]);
+        }
+    }
+
+    if (status == VDB_OK) {
+        vdb_thread_pool_run(pool, num_tasks, batch_scan_task, &scan);
+    }
+
+    /* merge each query's heaps into task 0's */
+    for (size_t q = 0; q < nq && status == VDB_OK; q++) {
+        vdb_topk_t *merged = &scan.heaps[q];
+        for (size_t t = 1; t < num_tasks; t++) {
+            const vdb_topk_t *heap = &scan.heaps[t * nq + q];
+            for (size_t i = 0; i < heap->size; i++) {
+                topk_push(merged, heap->entries[i].distance, heap->entries[i].row);
+            }
+        }
+        if (quantized) {
+            vdb_topk_t reranked;
+            topk_init(&reranked, best, k < merged->size ? k : merged->size);
+            rerank(storage, packed + q * storage->scan_dim, view->embeddings, storage->row_bytes,
+                   merged, &reranked);
+            status = fill_results(view, &reranked, &out_results[q]);
+        } else {
+            topk_sort(merged);
+            status = fill_results(view, merged, &out_results[q]);
+        }
+    }
+    stats_add(storage->stats, STATS_DISTANCES, nq * scanned_rows(view, matches) +
+              (quantized ? nq * (k < heap_k ? k : heap_k) : 0));
+
+    for (size_t q = 0; quant != NULL && q < prepared; q++) {
+        quant_query_free(&quant[q]);
+    }
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+/**
+ * Exact top-k search for many queries at once
+*/
+vdb_status_t vdb_storage_search_batch(
+    vdb_storage_t *storage,
+    const vdb_vector_t *queries,
+    size_t nq,
+    uint32_t k,
+    vdb_search_results_t *out_results
+) {
+    if (storage == NULL || (nq > 0 && (queries == NULL || out_results == NULL)) || k == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    for (size_t q = 0; q < nq; q++) {
+        out_results[q].hits = NULL;
+        out_results[q].count = 0;
+    }
+    for (size_t q = 0; q < nq; q++) {
+        if (queries[q].data == NULL) {
+            return VDB_ERROR_INVALID_ARGUMENT;
+        }
+        if (queries[q].dim != storage->dim) {
+            return VDB_ERROR_DIMENSION_MISMATCH;
+        }
+    }
+
+    uint64_t start = stats_now_ns();
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    roaring_t allow, dead;
+    roaring_init(&allow);
+    roaring_init(&dead);
+    row_set_t rows;
+    uint64_t matches = 0;
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    if (status == VDB_OK) {
+        status = search_rows(storage, &view, NULL, &allow, &dead, &rows, &matches);
+        uint64_t bound = hit_bound(&view, &rows, matches);
+        if (status == VDB_OK && bound > 0) {
+            for (size_t q = 0; q < nq && status == VDB_OK; q += SEARCH_BATCH_MAX_QUERIES) {
+                size_t n = nq - q < SEARCH_BATCH_MAX_QUERIES ? nq - q : SEARCH_BATCH_MAX_QUERIES;
+                status = batch_search(storage, &view, queries + q, n, k, &rows, bound, out_results + q);
+            }
+        }
+        storage_release_view(storage, &view);
+    }
+    roaring_free(&allow);
+    roaring_free(&dead);
+    pthread_rwlock_unlock(&storage->layout_lock);
+
+    if (status != VDB_OK) {
+        for (size_t q = 0; q < nq; q++) {
+            vdb_search_results_free(&out_results[q]);
+        }
+    } else {
+        stats_add(storage->stats, STATS_BATCH_SEARCHES, 1);
+        stats_add(storage->stats, STATS_BATCH_QUERIES, nq);
+        stats_record_since(storage->stats, STATS_BATCH_SEARCH_LATENCY, start);
+    }
+    return status;
+}
+
+/**
+ * HNSW query over the codes, float32 for nodes not encoded yet
+ * Node n of the segment being walked is row first + n.
+*/
+typedef struct {
+    quant_query_t quant;
+    uint64_t first;
+    hnsw_query_t fallback;
+    hnsw_float_query_t fallback_ctx;
+} quant_hnsw_query_t;
+
+static float quant_node_distance(const hnsw_query_t *query, uint32_t node) {
+    const quant_hnsw_query_t *q = (const quant_hnsw_query_t*)query->ctx;
+    if (q->first + node < q->quant.view->code_count) {
+        return quant_distance(&q->quant, q->first + node);
+    }
+    return q->fallback.distance(&q->fallback, node);
+}
+
+/**
+ * Approximate top-k search through the HNSW graph
+*/
+vdb_status_t vdb_storage_search_hnsw(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    vdb_search_results_t *out_results
+) {
+    return vdb_storage_search_hnsw_filtered(storage, query, k, NULL, out_results);
+}
+
+/**
+ * Exact top-k over the memtable rows [sealed, view->count) that rows
+ * admits; only the memtable's own range is materialized
+*/
+static vdb_status_t memtable_search(vdb_storage_t *storage, const storage_view_t *view,
+                                    const float *query, uint32_t k, const row_set_t *rows,
+                                    uint64_t sealed, vdb_search_results_t *out_results) {
+    if (sealed >= view->count) {
+        return VDB_OK;
+    }
+
+    roaring_t range, allowed;
+    roaring_init(&range);
+    roaring_init(&allowed);
+    vdb_status_t status = roaring_add_range(&range, sealed, view->count);
+    if (status == VDB_OK && rows->allow != NULL) {
+        status = roaring_and(&range, rows->allow, &allowed);
+    }
+    if (status == VDB_OK) {
+        row_set_t memtable = { rows->allow != NULL ? &allowed : &range, rows->deny };
+        status = exact_search(storage, view, query, k, &memtable, roaring_cardinality(memtable.allow),
+                              out_results);
+    }
+    roaring_free(&range);
+    roaring_free(&allowed);
+    return status;
+}
+
+/**
+ * Walk every sealed segment and scan the memtable, only collecting rows
+ * rows admits. query has scan_dim floats.
+*/
+static vdb_status_t hnsw_search_view(vdb_storage_t *storage, const float *query, uint32_t k,
+                                     const row_set_t *rows, vdb_search_results_t *out_results) {
+    /* codes as of now; nodes added since are scored in float32 */
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    quant_hnsw_query_t qctx;
+    status = quant_query_init(storage, &view, query, &qctx.quant);
+    if (status != VDB_OK) {
+        storage_release_view(storage, &view);
+        return status;
+    }
+    bool quantized = view_quantized(&view);
+
+    size_t cands = candidate_count(storage, &view, k);
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    vdb_topk_entry_t *entries = (vdb_topk_entry_t*)vdb_arena_alloc(arena, (cands + 2 * (size_t)k) *
+                                                                   sizeof(vdb_topk_entry_t));
+    if (entries == NULL) {
+        quant_query_free(&qctx.quant);
+        storage_release_view(storage, &view);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    vdb_topk_t heap, best, merged;
+    topk_init(&heap, entries, cands);
+    topk_init(&best, entries + cands, k);
+    topk_init(&merged, entries + cands + k, k);
+
+    /* walk each graph, all pushing into one heap. A seal may have
+     * published rows past the first view, so the graphs read a view
+     * taken once the segment list is fixed; it covers every sealed row */
+    pthread_rwlock_rdlock(&storage->index_lock);
+    storage_view_t sealed_view;
+    status = storage_acquire_view(storage, &sealed_view);
+    uint64_t sealed = storage->sealed_rows;
+    uint32_t ef = storage->hnsw_params.ef_search;
+    size_t pinned_bytes = storage->hnsw_pinned_bytes;
+    hnsw_search_counts_t counts = { 0, 0 };
+    for (size_t i = 0; i < storage->num_segments && status == VDB_OK; i++) {
+        const index_segment_t *seg = &storage->segments[i];
+        hnsw_space_t space = storage->hnsw_space;
+        space.base = sealed_view.embeddings + seg->first * space.stride;
+
+        hnsw_float_query_init(&qctx.fallback, &qctx.fallback_ctx, &space, query);
+        qctx.first = seg->first;
+        hnsw_query_t q = qctx.fallback;
+        if (quantized) {
+            q.distance = quant_node_distance;
+            q.ctx = &qctx;
+        }
+        // without the memory the descent just reads the rows
+        hnsw_pin_upper(seg->graph, &space, pinned_bytes);
+        status = hnsw_search(seg->graph, &q, ef, rows, seg->first, &heap, &counts);
+    }
+    if (status == VDB_OK && quantized) {
+        rerank(storage, query, sealed_view.embeddings, storage->hnsw_space.stride, &heap, &best);
+        counts.distances += heap.size;
+    }
+    pthread_rwlock_unlock(&storage->index_lock);
+    stats_add(storage->stats, STATS_HNSW_HOPS, counts.hops);
+    stats_add(storage->stats, STATS_DISTANCES, counts.distances);
+
+    vdb_search_results_t fresh = { NULL, 0 };
+    if (status == VDB_OK) {
+        status = memtable_search(storage, &view, query, k, rows, sealed, &fresh);
+    }
+
+    /* the hits' IDs come from the later view, which has every row */
+    if (status == VDB_OK) {
+        const vdb_topk_t *found = quantized ? &best : &heap;
+        for (size_t i = 0; i < found->size; i++) {
+            topk_push(&merged, found->entries[i].distance, found->entries[i].row);
+        }
+        for (size_t i = 0; i < fresh.count; i++) {
+            topk_push(&merged, fresh.hits[i].distance, fresh.hits[i].row);
+        }
+        topk_sort(&merged);
+        status = fill_results(&sealed_view, &merged, out_results);
+    }
+
+    storage_release_view(storage, &sealed_view);
+    storage_release_view(storage, &view);
+    vdb_search_results_free(&fresh);
+    quant_query_free(&qctx.quant);
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+/**
+ * Approximate top-k search over the rows matching a filter
+*/
+vdb_status_t vdb_storage_search_hnsw_filtered(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    const vdb_filter_t *filter,
+    vdb_search_results_t *out_results
+) {
+    if (storage == NULL || !query_valid(query, k, out_results)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    out_results->hits = NULL;
+    out_results->count = 0;
+
+    if (query->dim != storage->dim) {
+        return VDB_ERROR_DIMENSION_MISMATCH;
+    }
+    if (!storage->hnsw_enabled) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    uint64_t start = stats_now_ns();
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    query_cache_key_t key;
+    if (cache_lookup(storage, QUERY_CACHE_HNSW, query, k, filter, arena, &key, out_results)) {
+        vdb_arena_rewind(arena, mark);
+        stats_add(storage->stats, STATS_HNSW_SEARCHES, 1);
+        stats_record_since(storage->stats, STATS_HNSW_SEARCH_LATENCY, start);
+        return VDB_OK;
+    }
+    const float *data = scan_query(storage, query->data, arena);
+    if (data == NULL) {
+        vdb_arena_rewind(arena, mark);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    roaring_t allow, dead;
+    roaring_init(&allow);
+    roaring_init(&dead);
+    row_set_t rows;
+    uint64_t matches = 0;
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    if (status == VDB_OK) {
+        status = search_rows(storage, &view, filter, &allow, &dead, &rows, &matches);
+        bool restricted = rows.allow != NULL || rows.deny != NULL;
+        if (status == VDB_OK && restricted &&
+            (matches < SEARCH_FILTER_EXACT_ROWS || matches < view.count / SEARCH_FILTER_GRAPH_FRACTION)) {
+            // selective: scanning the matches beats walking the graph
+            status = exact_search(storage, &view, data, k, &rows, hit_bound(&view, &rows, matches),
+                                  out_results);
+        } else if (status == VDB_OK) {
+            status = hnsw_search_view(storage, data, k, &rows, out_results);
+        }
+        storage_release_view(storage, &view);
+    }
+    roaring_free(&allow);
+    roaring_free(&dead);
+    pthread_rwlock_unlock(&storage->layout_lock);
+    if (status == VDB_OK) {
+        cache_store(storage, &key, out_results);
+    }
+    vdb_arena_rewind(arena, mark);
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_HNSW_SEARCHES, 1);
+        stats_record_since(storage->stats, STATS_HNSW_SEARCH_LATENCY, start);
+    }
+    return status;
+}
+
+/**
+ * Walk the DiskANN graph and scan the rows past it, only collecting
+ * rows rows admits. query has scan_dim floats.
+*/
+static vdb_status_t diskann_search_view(vdb_storage_t *storage, const storage_view_t *view,
+                                        const float *query, uint32_t k, const row_set_t *rows,
+                                        vdb_search_results_t *out_results) {
+    vamana_index_t *index = storage->diskann;
+    quant_hnsw_query_t qctx;
+    vdb_status_t status = quant_query_init(storage, view, query, &qctx.quant);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    // nodes are rows; the walk reads codes, or the rows if there are none
+    hnsw_space_t space = { storage_scan_metric(storage), storage->scan_dim, view->embeddings,
+                           storage->row_bytes, storage->element, storage->dim_kernel };
+    hnsw_float_query_init(&qctx.fallback, &qctx.fallback_ctx, &space, query);
+    qctx.first = 0;
+    hnsw_query_t q = qctx.fallback;
+    if (view_quantized(view)) {
+        q.distance = quant_node_distance;
+        q.ctx = &qctx;
+    }
+
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    vdb_topk_entry_t *entries = (vdb_topk_entry_t*)vdb_arena_alloc(arena, 2 * (size_t)k * sizeof(vdb_topk_entry_t));
+    if (entries == NULL) {
+        quant_query_free(&qctx.quant);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    vdb_topk_t best, merged;
+    topk_init(&best, entries, k);
+    topk_init(&merged, entries + k, k);
+
+    vdb_diskann_params_t params;
+    vamana_get_params(index, &params);
+    vamana_search_counts_t counts = { 0, 0 };
+    status = vamana_search(index, &q, query, params.search_list, params.beam_width, rows, &best, &counts);
+    stats_add(storage->stats, STATS_DISKANN_READS, counts.reads);
+    stats_add(storage->stats, STATS_DISTANCES, counts.distances);
+
+    vdb_search_results_t fresh = { NULL, 0 };
+    if (status == VDB_OK) {
+        status = memtable_search(storage, view, query, k, rows, vamana_count(index), &fresh);
+    }
+    if (status == VDB_OK) {
+        for (size_t i = 0; i < best.size; i++) {
+            topk_push(&merged, best.entries[i].distance, best.entries[i].row);
+        }
+        for (size_t i = 0; i < fresh.count; i++) {
+            topk_push(&merged, fresh.hits[i].distance, fresh.hits[i].row);
+        }
+        topk_sort(&merged);
+        status = fill_results(view, &merged, out_results);
+    }
+
+    vdb_search_results_free(&fresh);
+    quant_query_free(&qctx.quant);
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+/**
+ * Approximate top-k search through the DiskANN index
+*/
+vdb_status_t vdb_storage_search_diskann(
+    vdb_storage_t *storage,
+    const vdb_vector_t *query,
+    uint32_t k,
+    vdb_search_results_t *out_results
+) {
+    if (storage == NULL || !query_valid(query, k, out_results)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    out_results->hits = NULL;
+    out_results->count = 0;
+
+    if (query->dim != storage->dim) {
+        return VDB_ERROR_DIMENSION_MISMATCH;
+    }
+
+    uint64_t start = stats_now_ns();
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    query_cache_key_t key;
+    if (cache_lookup(storage, QUERY_CACHE_DISKANN, query, k, NULL, arena, &key, out_results)) {
+        vdb_arena_rewind(arena, mark);
+        stats_add(storage->stats, STATS_DISKANN_SEARCHES, 1);
+        stats_record_since(storage->stats, STATS_DISKANN_SEARCH_LATENCY, start);
+        return VDB_OK;
+    }
+    const float *data = scan_query(storage, query->data, arena);
+    if (data == NULL) {
+        vdb_arena_rewind(arena, mark);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    roaring_t allow, dead;
+    roaring_init(&allow);
+    roaring_init(&dead);
+    row_set_t rows;
+    uint64_t matches = 0;
+    storage_view_t view;
+    vdb_status_t status = storage->diskann != NULL ? storage_acquire_view(storage, &view) : VDB_ERROR_NOT_FOUND;
+    if (status == VDB_OK) {
+        status = search_rows(storage, &view, NULL, &allow, &dead, &rows, &matches);
+        if (status == VDB_OK) {
+            status = diskann_search_view(storage, &view, data, k, &rows, out_results);
+        }
+        storage_release_view(storage, &view);
+    }
+    roaring_free(&allow);
+    roaring_free(&dead);
+    pthread_rwlock_unlock(&storage->layout_lock);
+    if (status == VDB_OK) {
+        cache_store(storage, &key, out_results);
+    }
+    vdb_arena_rewind(arena, mark);
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_DISKANN_SEARCHES, 1);
+        stats_record_since(storage->stats, STATS_DISKANN_SEARCH_LATENCY, start);
+    }
+    return status;
+}
+
+/**
+ * Free search results
+*/
+void vdb_search_results_free(vdb_search_results_t *results) {
+    if (results == NULL) {
+        return;
+    }
+    free(results->hits);
+    results->hits = NULL;
+    results->count = 0;
+}
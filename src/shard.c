@@ -0,0 +1,1138 @@
+/**
+ * shard.c - Sharded collections
+ *
+ * shards.meta, written once at create (temp file + rename), holds in
+ * host byte order:
+ *   uint32 magic "VDSH", version, mode, num_shards, dim, metric
+ *   per shard: uint32 length + the shard's base directory ("" = base_dir)
+ *   IVF: num_shards x dim float centroids
+ *   uint32 CRC32C of everything before it
+ *
+ * Under IVF an ID may be in any shard, so every write of an ID holds
+ * one of SHARD_STRIPES mutexes (by ID hash) while it checks the other
+ * shards and writes; writes of different IDs still mostly run in
+ * parallel. A batch can't hold its stripes through its appends and
+ * fsyncs without stalling every other writer, so it claims its IDs
+ * instead: stripe by stripe it checks them and records them as pending
+ * under that stripe, appends holding no stripe, then drops them. Other
+ * writes of a pending ID wait for that. Hash partitioning needs no
+ * locks of its own: an ID only ever lives in one shard, which
+ * serializes its writes.
+*/
+
+#include "vdb/shard.h"
+#include "vdb/distance.h"
+#include "storage_internal.h"
+#include "crc32c.h"
+#include "topk.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SHARD_META_MAGIC 0x48534456u /* "VDSH" */
+#define SHARD_META_VERSION 1
+#define SHARD_META_FILE "shards.meta"
+
+/* Largest shards.meta read back */
+#define SHARD_META_MAX_BYTES (64u << 20)
+
+/* Write locks of IVF IDs (a power of two, at most 64: stripes of a batch fit a uint64_t mask) */
+#define SHARD_STRIPES 64
+
+/* Training vectors k-means looks at, evenly spaced over the sample */
+#define SHARD_TRAIN_MAX_SAMPLES 65536
+
+/* k-means iterations (stops early once assignments settle) */
+#define SHARD_TRAIN_ITERS 25
+
+/* An ID a batch is appending */
+typedef struct {
+    const void *batch; // the batch that claimed it
+    uint32_t hash;
+    const char *id; // the batch's item, valid until it drops the claim
+} pending_id_t;
+
+/* Write lock of the IVF IDs hashing to it, and the ones claimed by batches */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t released; // a batch dropped its claims
+    pending_id_t *pending;
+    size_t num_pending;
+    size_t pending_cap;
+} shard_stripe_t;
+
+struct vdb_sharded {
+    vdb_shard_mode_t mode;
+    uint32_t num_shards;
+    uint32_t dim;
+    vdb_metric_t metric;
+    float *centroids; // IVF: num_shards x dim
+    vdb_storage_t **shards;
+    vdb_thread_pool_t *pool; // shared by the shards and the scatter
+    shard_stripe_t stripes[SHARD_STRIPES];
+};
+
+vdb_shard_params_t vdb_shard_params_default(void) {
+    vdb_shard_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.mode = VDB_SHARD_HASH;
+    params.num_shards = 4;
+    return params;
+}
+
+/* ------------------------------------------------------------------ */
+/* Routing                                                             */
+/* ------------------------------------------------------------------ */
+
+static uint32_t id_hash(const char *id) {
+    return crc32c(0, id, strnlen(id, VDB_ID_MAX_LEN));
+}
+
+static shard_stripe_t *stripe_of(vdb_sharded_t *s, const char *id) {
+    return &s->stripes[id_hash(id) & (SHARD_STRIPES - 1)];
+}
+
+/* Whether a batch has claimed id; caller holds its stripe */
+static bool is_pending(const shard_stripe_t *stripe, uint32_t hash, const char *id) {
+    for (size_t i = 0; i < stripe->num_pending; i++) {
+        const pending_id_t *p = &stripe->pending[i];
+        if (p->hash == hash && strncmp(p->id, id, VDB_ID_MAX_LEN) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Lock id's stripe once no batch is appending id */
+static shard_stripe_t *lock_id(vdb_sharded_t *s, const char *id) {
+    uint32_t hash = id_hash(id);
+    shard_stripe_t *stripe = &s->stripes[hash & (SHARD_STRIPES - 1)];
+    pthread_mutex_lock(&stripe->lock);
+    while (is_pending(stripe, hash, id)) {
+        pthread_cond_wait(&stripe->released, &stripe->lock);
+    }
+    return stripe;
+}
+
+/**
+ * Squared L2 distance from x to every centroid; with cosine, from x
+ * scaled to unit length (|c|^2 - 2 c.x / |x|, up to a constant)
+*/
+static void centroid_distances(const vdb_sharded_t *s, vdb_metric_t metric, const float *x, float *out) {
+    float inv = 1.0f;
+    if (metric == VDB_METRIC_COSINE) {
+        float norm = sqrtf(vdb_dot(x, x, s->dim));
+        inv = norm > 0.0f ? 1.0f / norm : 0.0f;
+    }
+    for (uint32_t c = 0; c < s->num_shards; c++) {
+        const float *cent = s->centroids + (size_t)c * s->dim;
+        out[c] = metric == VDB_METRIC_COSINE
+            ? vdb_dot(cent, cent, s->dim) - 2.0f * inv * vdb_dot(cent, x, s->dim)
+            : vdb_l2_squared(cent, x, s->dim);
+    }
+}
+
+static uint32_t nearest_centroid(const vdb_sharded_t *s, vdb_metric_t metric, const float *x) {
+    float dist[VDB_SHARD_MAX];
+    centroid_distances(s, metric, x, dist);
+    uint32_t best = 0;
+    for (uint32_t c = 1; c < s->num_shards; c++) {
+        if (dist[c] < dist[best]) {
+            best = c;
+        }
+    }
+    return best;
+}
+
+/**
+ * Shard that owns a (validated) item
+*/
+static uint32_t shard_of(const vdb_sharded_t *s, const vdb_item_t *item) {
+    if (s->mode == VDB_SHARD_IVF) {
+        return nearest_centroid(s, s->metric, item->vector.data);
+    }
+    return id_hash(item->id) % s->num_shards;
+}
+
+/* Checked up front: routing reads the ID and the vector */
+static vdb_status_t check_item(const vdb_sharded_t *s, const vdb_item_t *item) {
+    if (item->vector.dim != s->dim) {
+        return VDB_ERROR_DIMENSION_MISMATCH;
+    }
+    if (item->vector.data == NULL || !vdb_id_is_valid(item->id)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    return VDB_OK;
+}
+
+/* Whether shard i holds id (live) */
+static bool shard_has(vdb_sharded_t *s, uint32_t i, const char *id) {
+    id_index_entry_t entry = storage_ids_find(s->shards[i], id);
+    return entry.row != ID_INDEX_NONE && (entry.row & ID_INDEX_DELETED) == 0;
+}
+
+/* Whether a shard other than skip holds id; caller holds its stripe */
+static bool other_has(vdb_sharded_t *s, uint32_t skip, const char *id) {
+    for (uint32_t i = 0; i < s->num_shards; i++) {
+        if (i != skip && shard_has(s, i, id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ------------------------------------------------------------------ */
+/* IVF training                                                        */
+/* ------------------------------------------------------------------ */
+
+/**
+ * k-means over (a sample of) the training vectors, one centroid per
+ * shard; with cosine the vectors are clustered at unit length
+*/
+static vdb_status_t train_centroids(vdb_sharded_t *s, const float *train, size_t num_train) {
+    uint32_t dim = s->dim;
+    uint32_t k = s->num_shards;
+    size_t samples = num_train < SHARD_TRAIN_MAX_SAMPLES ? num_train : SHARD_TRAIN_MAX_SAMPLES;
+
+    float *data = (float*)malloc(samples * dim * sizeof(float));
+    double *sums = (double*)malloc((size_t)k * dim * sizeof(double));
+    uint64_t *counts = (uint64_t*)malloc(k * sizeof(uint64_t));
+    uint32_t *assign = (uint32_t*)malloc(samples * sizeof(uint32_t));
+    s->centroids = (float*)malloc((size_t)k * dim * sizeof(float));
+    if (data == NULL || sums == NULL || counts == NULL || assign == NULL || s->centroids == NULL) {
+        free(data);
+        free(sums);
+        free(counts);
+        free(assign);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        float *x = data + i * dim;
+        memcpy(x, train + (i * num_train / samples) * dim, dim * sizeof(float));
+        if (s->metric == VDB_METRIC_COSINE) {
+            vdb_normalize(x, dim);
+        }
+    }
+    // seeds spread over the (evenly spaced) sample
+    for (uint32_t c = 0; c < k; c++) {
+        memcpy(s->centroids + (size_t)c * dim, data + (c * samples / k) * dim, dim * sizeof(float));
+    }
+    memset(assign, 0xff, samples * sizeof(uint32_t));
+
+    // plain L2 k-means on the (unit) vectors
+    for (int iter = 0; iter < SHARD_TRAIN_ITERS; iter++) {
+        uint64_t changed = 0;
+        memset(sums, 0, (size_t)k * dim * sizeof(double));
+        memset(counts, 0, k * sizeof(uint64_t));
+        for (size_t i = 0; i < samples; i++) {
+            const float *x = data + i * dim;
+            uint32_t best = nearest_centroid(s, VDB_METRIC_EUCLIDEAN, x);
+            changed += assign[i] != best;
+            assign[i] = best;
+            counts[best]++;
+            for (uint32_t d = 0; d < dim; d++) {
+                sums[(size_t)best * dim + d] += x[d];
+            }
+        }
+        if (changed == 0) {
+            break;
+        }
+
+        for (uint32_t c = 0; c < k; c++) {
+            float *cent = s->centroids + (size_t)c * dim;
+            if (counts[c] > 0) {
+                for (uint32_t d = 0; d < dim; d++) {
+                    cent[d] = (float)(sums[(size_t)c * dim + d] / (double)counts[c]);
+                }
+                continue;
+            }
+            // an empty partition restarts at the sample farthest from its centroid
+            size_t far = 0;
+            float far_d = -1.0f;
+            for (size_t i = 0; i < samples; i++) {
+                float d = vdb_l2_squared(data + i * dim, s->centroids + (size_t)assign[i] * dim, dim);
+                if (d > far_d) {
+                    far_d = d;
+                    far = i;
+                }
+            }
+            memcpy(cent, data + far * dim, dim * sizeof(float));
+            assign[far] = c;
+        }
+    }
+
+    free(data);
+    free(sums);
+    free(counts);
+    free(assign);
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* shards.meta                                                         */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    bool ok;
+} meta_buf_t;
+
+static void meta_put(meta_buf_t *b, const void *src, size_t len) {
+    if (!b->ok) {
+        return;
+    }
+    uint8_t *data = (uint8_t*)realloc(b->data, b->len + len);
+    if (data == NULL) {
+        b->ok = false;
+        return;
+    }
+    memcpy(data + b->len, src, len);
+    b->data = data;
+    b->len += len;
+}
+
+static void meta_put_u32(meta_buf_t *b, uint32_t v) {
+    meta_put(b, &v, sizeof(v));
+}
+
+static vdb_status_t sync_dir(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return VDB_ERROR_IO;
+    }
+    vdb_status_t status = fsync(fd) == 0 ? VDB_OK : VDB_ERROR_IO;
+    close(fd);
+    return status;
+}
+
+static vdb_status_t write_meta(const vdb_sharded_t *s, const char *coll_dir, const char *const *dirs) {
+    meta_buf_t b = { NULL, 0, true };
+    meta_put_u32(&b, SHARD_META_MAGIC);
+    meta_put_u32(&b, SHARD_META_VERSION);
+    meta_put_u32(&b, (uint32_t)s->mode);
+    meta_put_u32(&b, s->num_shards);
+    meta_put_u32(&b, s->dim);
+    meta_put_u32(&b, (uint32_t)s->metric);
+    for (uint32_t i = 0; i < s->num_shards; i++) {
+        const char *dir = dirs != NULL ? dirs[i] : "";
+        meta_put_u32(&b, (uint32_t)strlen(dir));
+        meta_put(&b, dir, strlen(dir));
+    }
+    if (s->mode == VDB_SHARD_IVF) {
+        meta_put(&b, s->centroids, (size_t)s->num_shards * s->dim * sizeof(float));
+    }
+    if (b.ok) {
+        meta_put_u32(&b, crc32c(0, b.data, b.len));
+    }
+    if (!b.ok) {
+        free(b.data);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    char path[MAX_PATH + 16], tmp_path[MAX_PATH + 32];
+    snprintf(path, sizeof(path), "%s/" SHARD_META_FILE, coll_dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    bool ok = fp != NULL;
+    if (fp != NULL) {
+        ok = fwrite(b.data, 1, b.len, fp) == b.len;
+        ok = fflush(fp) == 0 && ok;
+        ok = fsync(fileno(fp)) == 0 && ok;
+        ok = fclose(fp) == 0 && ok;
+    }
+    free(b.data);
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+    return sync_dir(coll_dir);
+}
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+} meta_reader_t;
+
+static bool meta_get(meta_reader_t *r, void *dst, size_t len) {
+    if ((size_t)(r->end - r->pos) < len) {
+        return false;
+    }
+    memcpy(dst, r->pos, len);
+    r->pos += len;
+    return true;
+}
+
+/**
+ * Read shards.meta into s (mode, shape, centroids) and the shard
+ * directories into dirs (num_shards x MAX_PATH, "" = base_dir)
+*/
+static vdb_status_t read_meta(vdb_sharded_t *s, const char *coll_dir, char (**out_dirs)[MAX_PATH]) {
+    char path[MAX_PATH + 16];
+    snprintf(path, sizeof(path), "%s/" SHARD_META_FILE, coll_dir);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return errno == ENOENT ? VDB_ERROR_NOT_FOUND : VDB_ERROR_IO;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size < 28 || st.st_size > SHARD_META_MAX_BYTES) {
+        fclose(fp);
+        return VDB_ERROR_CORRUPTED;
+    }
+    size_t len = (size_t)st.st_size;
+    uint8_t *data = (uint8_t*)malloc(len);
+    if (data == NULL) {
+        fclose(fp);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    bool read_ok = fread(data, 1, len, fp) == len;
+    fclose(fp);
+    uint32_t crc;
+    memcpy(&crc, data + len - sizeof(crc), sizeof(crc));
+    if (!read_ok || crc != crc32c(0, data, len - sizeof(crc))) {
+        free(data);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    meta_reader_t r = { data, data + len - sizeof(crc) };
+    uint32_t head[6];
+    bool ok = meta_get(&r, head, sizeof(head)) && head[0] == SHARD_META_MAGIC &&
+              head[1] == SHARD_META_VERSION && head[2] <= VDB_SHARD_IVF &&
+              head[3] >= 1 && head[3] <= VDB_SHARD_MAX &&
+              head[4] >= 1 && head[4] <= VDB_COLLECTION_MAX_DIM && vdb_metric_is_valid((vdb_metric_t)head[5]);
+    char (*dirs)[MAX_PATH] = NULL;
+    if (ok) {
+        s->mode = (vdb_shard_mode_t)head[2];
+        s->num_shards = head[3];
+        s->dim = head[4];
+        s->metric = (vdb_metric_t)head[5];
+        dirs = (char (*)[MAX_PATH])calloc(s->num_shards, MAX_PATH);
+        if (dirs == NULL) {
+            free(data);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    for (uint32_t i = 0; ok && i < s->num_shards; i++) {
+        uint32_t dir_len = 0;
+        ok = meta_get(&r, &dir_len, sizeof(dir_len)) && dir_len < MAX_PATH &&
+             meta_get(&r, dirs[i], dir_len);
+    }
+    if (ok && s->mode == VDB_SHARD_IVF) {
+        size_t bytes = (size_t)s->num_shards * s->dim * sizeof(float);
+        s->centroids = (float*)malloc(bytes);
+        if (s->centroids == NULL) {
+            free(data);
+            free(dirs);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+        ok = meta_get(&r, s->centroids, bytes);
+    }
+    ok = ok && r.pos == r.end;
+    free(data);
+    if (!ok) {
+        free(dirs);
+        return VDB_ERROR_CORRUPTED;
+    }
+    *out_dirs = dirs;
+    return VDB_OK;
+}
+
+/* ------------------------------------------------------------------ */
+/* Create / open                                                       */
+/* ------------------------------------------------------------------ */
+
+/* mkdir that accepts an existing directory */
+static vdb_status_t make_dir(const char *path) {
+    struct stat st;
+    if (mkdir(path, 0755) != 0 && (errno != EEXIST || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+/* Base directory of shard i: <dir or base_dir>/<name> */
+static void shard_base(const char *base_dir, const char *name, const char *dir, char *out) {
+    snprintf(out, MAX_PATH, "%s/%s", dir[0] != '\0' ? dir : base_dir, name);
+}
+
+static void shard_name(uint32_t i, char *out) {
+    snprintf(out, VDB_COLLECTION_NAME_MAX_LEN, "shard-%u", i);
+}
+
+static void free_sharded(vdb_sharded_t *s) {
+    if (s->shards != NULL) {
+        for (uint32_t i = 0; i < s->num_shards; i++) {
+            vdb_storage_close(&s->shards[i]);
+        }
+    }
+    // after the shards: they run on it
+    vdb_thread_pool_destroy(&s->pool);
+    for (int i = 0; i < SHARD_STRIPES; i++) {
+        pthread_mutex_destroy(&s->stripes[i].lock);
+        pthread_cond_destroy(&s->stripes[i].released);
+        free(s->stripes[i].pending);
+    }
+    free(s->shards);
+    free(s->centroids);
+    free(s);
+}
+
+static vdb_sharded_t *alloc_sharded(void) {
+    vdb_sharded_t *s = (vdb_sharded_t*)calloc(1, sizeof(vdb_sharded_t));
+    if (s == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < SHARD_STRIPES; i++) {
+        pthread_mutex_init(&s->stripes[i].lock, NULL);
+        pthread_cond_init(&s->stripes[i].released, NULL);
+    }
+    return s;
+}
+
+/**
+ * Allocate the shard array and the pool they all run on
+*/
+static vdb_status_t prepare_shards(vdb_sharded_t *s, uint32_t threads) {
+    s->shards = (vdb_storage_t**)calloc(s->num_shards, sizeof(vdb_storage_t*));
+    size_t workers = threads > 0 ? threads - 1 : vdb_thread_pool_default_workers();
+    if (s->shards == NULL || vdb_thread_pool_create(workers, &s->pool) != VDB_OK) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    return VDB_OK;
+}
+
+static bool params_valid(const vdb_shard_params_t *p, uint32_t dim) {
+    if (p->num_shards < 1 || p->num_shards > VDB_SHARD_MAX || p->mode > VDB_SHARD_IVF) {
+        return false;
+    }
+    if (p->mode == VDB_SHARD_IVF && (p->train == NULL || p->num_train < p->num_shards || dim == 0)) {
+        return false;
+    }
+    for (uint32_t i = 0; p->shard_dirs != NULL && i < p->num_shards; i++) {
+        // room for /<name>/shard-<i>/<file>
+        if (p->shard_dirs[i] == NULL || p->shard_dirs[i][0] == '\0' ||
+            strlen(p->shard_dirs[i]) >= MAX_PATH - 2 * VDB_COLLECTION_NAME_MAX_LEN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vdb_status_t vdb_sharded_create(const char *base_dir, const char *name, uint32_t dim, vdb_metric_t metric,
+                                const vdb_shard_params_t *params, vdb_sharded_t **out_sharded) {
+    if (base_dir == NULL || name == NULL || params == NULL || out_sharded == NULL ||
+        strlen(base_dir) >= MAX_PATH - 2 * VDB_COLLECTION_NAME_MAX_LEN || !params_valid(params, dim)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_status_t status = vdb_collection_validate_params(name, dim, metric);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    char coll_dir[MAX_PATH];
+    char meta_path[MAX_PATH + 16];
+    struct stat st;
+    snprintf(coll_dir, sizeof(coll_dir), "%s/%s", base_dir, name);
+    snprintf(meta_path, sizeof(meta_path), "%s/" SHARD_META_FILE, coll_dir);
+    if (make_dir(base_dir) != VDB_OK || make_dir(coll_dir) != VDB_OK) {
+        return VDB_ERROR_IO;
+    }
+    if (stat(meta_path, &st) == 0) {
+        return VDB_ERROR_ALREADY_EXISTS;
+    }
+
+    vdb_sharded_t *s = alloc_sharded();
+    if (s == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    s->mode = params->mode;
+    s->num_shards = params->num_shards;
+    s->dim = dim;
+    s->metric = metric;
+    status = prepare_shards(s, params->threads);
+    if (status == VDB_OK && s->mode == VDB_SHARD_IVF) {
+        status = train_centroids(s, params->train, params->num_train);
+    }
+
+    for (uint32_t i = 0; status == VDB_OK && i < s->num_shards; i++) {
+        char base[MAX_PATH];
+        char shard[VDB_COLLECTION_NAME_MAX_LEN];
+        const char *dir = params->shard_dirs != NULL ? params->shard_dirs[i] : "";
+        shard_base(base_dir, name, dir, base);
+        shard_name(i, shard);
+        status = dir[0] != '\0' ? make_dir(dir) : VDB_OK;
+        if (status == VDB_OK) {
+            status = make_dir(base);
+        }
+        if (status == VDB_OK) {
+            status = vdb_storage_create(base, shard, dim, metric, &s->shards[i]);
+        }
+        if (status == VDB_OK) {
+            status = storage_share_pool(s->shards[i], s->pool);
+        }
+    }
+    // last: until it is there, the collection doesn't exist
+    if (status == VDB_OK) {
+        status = write_meta(s, coll_dir, params->shard_dirs);
+    }
+    if (status != VDB_OK) {
+        free_sharded(s);
+        return status;
+    }
+
+    *out_sharded = s;
+    return VDB_OK;
+}
+
+vdb_status_t vdb_sharded_open(const char *base_dir, const char *name, uint32_t threads,
+                              vdb_sharded_t **out_sharded) {
+    if (base_dir == NULL || name == NULL || out_sharded == NULL ||
+        strlen(base_dir) >= MAX_PATH - 2 * VDB_COLLECTION_NAME_MAX_LEN ||
+        name[0] == '\0' || strlen(name) >= VDB_COLLECTION_NAME_MAX_LEN) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    vdb_sharded_t *s = alloc_sharded();
+    if (s == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    char coll_dir[MAX_PATH];
+    char (*dirs)[MAX_PATH] = NULL;
+    snprintf(coll_dir, sizeof(coll_dir), "%s/%s", base_dir, name);
+    vdb_status_t status = read_meta(s, coll_dir, &dirs);
+    if (status == VDB_OK) {
+        status = prepare_shards(s, threads);
+    }
+
+    for (uint32_t i = 0; status == VDB_OK && i < s->num_shards; i++) {
+        char base[MAX_PATH];
+        char shard[VDB_COLLECTION_NAME_MAX_LEN];
+        shard_base(base_dir, name, dirs[i], base);
+        shard_name(i, shard);
+        status = vdb_storage_open(base, shard, &s->shards[i]);
+        vdb_collection_info_t info;
+        if (status == VDB_OK && (vdb_storage_get_info(s->shards[i], &info) != VDB_OK ||
+                                 info.dim != s->dim || info.metric != s->metric)) {
+            status = VDB_ERROR_CORRUPTED;
+        }
+        if (status == VDB_OK) {
+            status = storage_share_pool(s->shards[i], s->pool);
+        }
+    }
+    free(dirs);
+    if (status != VDB_OK) {
+        free_sharded(s);
+        return status;
+    }
+
+    *out_sharded = s;
+    return VDB_OK;
+}
+
+void vdb_sharded_close(vdb_sharded_t **sharded) {
+    if (sharded == NULL || *sharded == NULL) {
+        return;
+    }
+    free_sharded(*sharded);
+    *sharded = NULL;
+}
+
+uint32_t vdb_sharded_num_shards(const vdb_sharded_t *sharded) {
+    return sharded != NULL ? sharded->num_shards : 0;
+}
+
+vdb_storage_t *vdb_sharded_shard(vdb_sharded_t *sharded, uint32_t i) {
+    return sharded != NULL && i < sharded->num_shards ? sharded->shards[i] : NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Writes                                                              */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t vdb_sharded_append(vdb_sharded_t *sharded, const vdb_item_t *item) {
+    if (sharded == NULL || item == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_status_t status = check_item(sharded, item);
+    if (status != VDB_OK) {
+        return status;
+    }
+    uint32_t target = shard_of(sharded, item);
+    if (sharded->mode != VDB_SHARD_IVF) {
+        return vdb_storage_append(sharded->shards[target], item);
+    }
+
+    shard_stripe_t *stripe = lock_id(sharded, item->id);
+    status = other_has(sharded, target, item->id)
+        ? VDB_ERROR_ALREADY_EXISTS
+        : vdb_storage_append(sharded->shards[target], item);
+    pthread_mutex_unlock(&stripe->lock);
+    return status;
+}
+
+typedef struct {
+    vdb_sharded_t *sharded;
+    vdb_item_t **parts; // items of each shard
+    size_t *counts;
+    vdb_status_t *status; // per shard
+} batch_ctx_t;
+
+static void append_part(void *ctx, size_t i) {
+    batch_ctx_t *b = (batch_ctx_t*)ctx;
+    b->status[i] = vdb_storage_append_batch(b->sharded->shards[i], b->parts[i], b->counts[i]);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return strcmp(*(const char *const*)a, *(const char *const*)b);
+}
+
+/**
+ * IVF: an ID repeated in a batch may route to two shards, where
+ * neither shard's batch would see the repeat
+*/
+static vdb_status_t check_batch_ids(const vdb_item_t *items, size_t n) {
+    const char **ids = (const char**)malloc(n * sizeof(const char*));
+    if (ids == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = items[i].id;
+    }
+    qsort(ids, n, sizeof(const char*), compare_ids);
+    vdb_status_t status = VDB_OK;
+    for (size_t i = 1; i < n && status == VDB_OK; i++) {
+        if (strcmp(ids[i - 1], ids[i]) == 0) {
+            status = VDB_ERROR_ALREADY_EXISTS;
+        }
+    }
+    free(ids);
+    return status;
+}
+
+/* Whether a batch has claimed any of the items order[first, end); caller holds their stripe */
+static bool any_pending(const shard_stripe_t *stripe, const vdb_item_t *items, const size_t *order,
+                        size_t first, size_t end) {
+    for (size_t j = first; j < end; j++) {
+        const char *id = items[order[j]].id;
+        if (is_pending(stripe, id_hash(id), id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * IVF: claim a batch's IDs for it (owner[i] is the shard item i goes to)
+ *
+ * Stripe by stripe, in stripe order, waits until no other batch holds
+ * any of the IDs, checks no other shard has them, and records them as
+ * pending. A batch only waits on a stripe while holding claims under
+ * lower ones, and whoever it waits for has finished that stripe, so
+ * two batches can't wait on each other. The stripes claimed under are
+ * added to *claimed, also on failure; release_ids drops them.
+*/
+static vdb_status_t claim_ids(vdb_sharded_t *s, const void *batch, const vdb_item_t *items,
+                              const uint32_t *owner, size_t n, uint64_t *claimed) {
+    size_t *order = (size_t*)malloc(n * sizeof(size_t));
+    if (order == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    size_t starts[SHARD_STRIPES + 1] = { 0 };
+    for (size_t i = 0; i < n; i++) {
+        starts[(id_hash(items[i].id) & (SHARD_STRIPES - 1)) + 1]++;
+    }
+    for (int k = 0; k < SHARD_STRIPES; k++) {
+        starts[k + 1] += starts[k];
+    }
+    size_t next[SHARD_STRIPES];
+    memcpy(next, starts, sizeof(next));
+    for (size_t i = 0; i < n; i++) {
+        order[next[id_hash(items[i].id) & (SHARD_STRIPES - 1)]++] = i;
+    }
+
+    vdb_status_t status = VDB_OK;
+    for (int k = 0; k < SHARD_STRIPES && status == VDB_OK; k++) {
+        size_t first = starts[k];
+        size_t end = starts[k + 1];
+        if (first == end) {
+            continue;
+        }
+        shard_stripe_t *stripe = &s->stripes[k];
+        pthread_mutex_lock(&stripe->lock);
+        while (any_pending(stripe, items, order, first, end)) {
+            pthread_cond_wait(&stripe->released, &stripe->lock);
+        }
+        for (size_t j = first; j < end && status == VDB_OK; j++) {
+            if (other_has(s, owner[order[j]], items[order[j]].id)) {
+                status = VDB_ERROR_ALREADY_EXISTS;
+            }
+        }
+        size_t need = stripe->num_pending + (end - first);
+        if (status == VDB_OK && need > stripe->pending_cap) {
+            size_t cap = stripe->pending_cap > 0 ? stripe->pending_cap * 2 : 16;
+            cap = cap > need ? cap : need;
+            pending_id_t *grown = (pending_id_t*)realloc(stripe->pending, cap * sizeof(pending_id_t));
+            if (grown == NULL) {
+                status = VDB_ERROR_OUT_OF_MEMORY;
+            } else {
+                stripe->pending = grown;
+                stripe->pending_cap = cap;
+            }
+        }
+        for (size_t j = first; j < end && status == VDB_OK; j++) {
+            const char *id = items[order[j]].id;
+            stripe->pending[stripe->num_pending++] = (pending_id_t){ batch, id_hash(id), id };
+        }
+        if (status == VDB_OK) {
+            *claimed |= 1ull << k;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+    free(order);
+    return status;
+}
+
+/* Drop a batch's claims under the stripes in claimed and wake their waiters */
+static void release_ids(vdb_sharded_t *s, const void *batch, uint64_t claimed) {
+    for (int k = 0; k < SHARD_STRIPES; k++) {
+        if ((claimed & (1ull << k)) == 0) {
+            continue;
+        }
+        shard_stripe_t *stripe = &s->stripes[k];
+        pthread_mutex_lock(&stripe->lock);
+        size_t kept = 0;
+        for (size_t i = 0; i < stripe->num_pending; i++) {
+            if (stripe->pending[i].batch != batch) {
+                stripe->pending[kept++] = stripe->pending[i];
+            }
+        }
+        stripe->num_pending = kept;
+        pthread_cond_broadcast(&stripe->released);
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+vdb_status_t vdb_sharded_append_batch(vdb_sharded_t *sharded, const vdb_item_t *items, size_t n) {
+    if (sharded == NULL || (items == NULL && n > 0)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (n == 0) {
+        return VDB_OK;
+    }
+    for (size_t i = 0; i < n; i++) {
+        vdb_status_t status = check_item(sharded, &items[i]);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    bool ivf = sharded->mode == VDB_SHARD_IVF;
+    if (ivf) {
+        vdb_status_t status = check_batch_ids(items, n);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+
+    uint32_t num = sharded->num_shards;
+    uint32_t *owner = (uint32_t*)malloc(n * sizeof(uint32_t));
+    vdb_item_t *sorted = (vdb_item_t*)malloc(n * sizeof(vdb_item_t));
+    vdb_item_t **parts = (vdb_item_t**)calloc(num, sizeof(vdb_item_t*));
+    size_t *counts = (size_t*)calloc(num, sizeof(size_t));
+    vdb_status_t *status = (vdb_status_t*)calloc(num, sizeof(vdb_status_t));
+    vdb_status_t result = VDB_OK;
+    if (owner == NULL || sorted == NULL || parts == NULL || counts == NULL || status == NULL) {
+        result = VDB_ERROR_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    // items grouped by shard, each group in batch order
+    for (size_t i = 0; i < n; i++) {
+        owner[i] = shard_of(sharded, &items[i]);
+        counts[owner[i]]++;
+    }
+    size_t offset = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        parts[i] = sorted + offset;
+        offset += counts[i];
+        counts[i] = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        parts[owner[i]][counts[owner[i]]++] = items[i];
+    }
+
+    // IVF: claim the IDs, then append holding no stripe
+    batch_ctx_t ctx = { sharded, parts, counts, status };
+    uint64_t claimed = 0;
+    if (ivf) {
+        result = claim_ids(sharded, &ctx, items, owner, n, &claimed);
+    }
+    if (result == VDB_OK) {
+        vdb_thread_pool_run(sharded->pool, num, append_part, &ctx);
+        for (uint32_t i = 0; i < num && result == VDB_OK; i++) {
+            result = status[i];
+        }
+    }
+    release_ids(sharded, &ctx, claimed);
+
+done:
+    free(owner);
+    free(sorted);
+    free(parts);
+    free(counts);
+    free(status);
+    return result;
+}
+
+vdb_status_t vdb_sharded_upsert(vdb_sharded_t *sharded, const vdb_item_t *item) {
+    if (sharded == NULL || item == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_status_t status = check_item(sharded, item);
+    if (status != VDB_OK) {
+        return status;
+    }
+    uint32_t target = shard_of(sharded, item);
+    if (sharded->mode != VDB_SHARD_IVF) {
+        return vdb_storage_upsert(sharded->shards[target], item);
+    }
+
+    // the new row first: a crash in between leaves two copies, not none
+    shard_stripe_t *stripe = lock_id(sharded, item->id);
+    status = vdb_storage_upsert(sharded->shards[target], item);
+    for (uint32_t i = 0; status == VDB_OK && i < sharded->num_shards; i++) {
+        if (i != target && shard_has(sharded, i, item->id)) {
+            status = vdb_storage_delete(sharded->shards[i], item->id);
+        }
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return status;
+}
+
+vdb_status_t vdb_sharded_delete(vdb_sharded_t *sharded, const char *id) {
+    if (sharded == NULL || id == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (!vdb_id_is_valid(id)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (sharded->mode != VDB_SHARD_IVF) {
+        return vdb_storage_delete(sharded->shards[id_hash(id) % sharded->num_shards], id);
+    }
+
+    // every copy: a crashed move can leave two
+    shard_stripe_t *stripe = lock_id(sharded, id);
+    vdb_status_t result = VDB_ERROR_NOT_FOUND;
+    for (uint32_t i = 0; i < sharded->num_shards; i++) {
+        vdb_status_t status = vdb_storage_delete(sharded->shards[i], id);
+        if (status == VDB_OK && result == VDB_ERROR_NOT_FOUND) {
+            result = VDB_OK;
+        } else if (status != VDB_OK && status != VDB_ERROR_NOT_FOUND) {
+            result = status;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return result;
+}
+
+vdb_status_t vdb_sharded_get(vdb_sharded_t *sharded, const char *id, vdb_item_t *out_item) {
+    if (sharded == NULL || id == NULL || out_item == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (!vdb_id_is_valid(id)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (sharded->mode != VDB_SHARD_IVF) {
+        return vdb_storage_get(sharded->shards[id_hash(id) % sharded->num_shards], id, out_item);
+    }
+
+    // held so a row moving between shards is seen in one of them (rows
+    // of a pending batch aren't there yet, so no need to wait for it)
+    shard_stripe_t *stripe = stripe_of(sharded, id);
+    pthread_mutex_lock(&stripe->lock);
+    vdb_status_t status = VDB_ERROR_NOT_FOUND;
+    for (uint32_t i = 0; i < sharded->num_shards && status == VDB_ERROR_NOT_FOUND; i++) {
+        status = vdb_storage_get(sharded->shards[i], id, out_item);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Search                                                              */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    vdb_sharded_t *sharded;
+    const vdb_vector_t *query;
+    uint32_t k;
+    const vdb_shard_query_t *options;
+    const uint32_t *probe; // shards to search
+    vdb_search_results_t *results; // per probed shard
+    vdb_status_t *status;
+} scatter_ctx_t;
+
+static void search_shard(void *ctx, size_t i) {
+    scatter_ctx_t *c = (scatter_ctx_t*)ctx;
+    vdb_storage_t *shard = c->sharded->shards[c->probe[i]];
+    switch (c->options->kind) {
+    case VDB_SHARD_SEARCH_HNSW:
+        c->status[i] = vdb_storage_search_hnsw_filtered(shard, c->query, c->k, c->options->filter,
+                                                        &c->results[i]);
+        break;
+    case VDB_SHARD_SEARCH_DISKANN:
+        c->status[i] = vdb_storage_search_diskann(shard, c->query, c->k, &c->results[i]);
+        break;
+    default:
+        c->status[i] = vdb_storage_search_exact_filtered(shard, c->query, c->k, c->options->filter,
+                                                         &c->results[i]);
+        break;
+    }
+}
+
+/**
+ * Shards to probe, in shard order: all of them, or under IVF with
+ * nprobe those of the nprobe centroids nearest the query
+*/
+static uint32_t pick_probes(const vdb_sharded_t *s, const vdb_vector_t *query, uint32_t nprobe,
+                            uint32_t *probe) {
+    if (s->mode != VDB_SHARD_IVF || nprobe == 0 || nprobe >= s->num_shards) {
+        for (uint32_t i = 0; i < s->num_shards; i++) {
+            probe[i] = i;
+        }
+        return s->num_shards;
+    }
+
+    vdb_topk_entry_t entries[VDB_SHARD_MAX];
+    float dist[VDB_SHARD_MAX];
+    vdb_topk_t heap;
+    topk_init(&heap, entries, nprobe);
+    centroid_distances(s, s->metric, query->data, dist);
+    for (uint32_t c = 0; c < s->num_shards; c++) {
+        topk_push(&heap, dist[c], c);
+    }
+    uint32_t num = 0;
+    for (uint32_t c = 0; c < s->num_shards; c++) {
+        for (size_t i = 0; i < heap.size; i++) {
+            if (entries[i].row == c) {
+                probe[num++] = c;
+            }
+        }
+    }
+    return num;
+}
+
+vdb_status_t vdb_sharded_search(vdb_sharded_t *sharded, const vdb_vector_t *query, uint32_t k,
+                                const vdb_shard_query_t *options, vdb_search_results_t *out_results) {
+    vdb_shard_query_t exact = { VDB_SHARD_SEARCH_EXACT, NULL, 0 };
+    const vdb_shard_query_t *opts = options != NULL ? options : &exact;
+    if (sharded == NULL || query == NULL || query->data == NULL || k == 0 || out_results == NULL ||
+        opts->kind > VDB_SHARD_SEARCH_DISKANN ||
+        (opts->kind == VDB_SHARD_SEARCH_DISKANN && opts->filter != NULL)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (query->dim != sharded->dim) {
+        return VDB_ERROR_DIMENSION_MISMATCH;
+    }
+    out_results->hits = NULL;
+    out_results->count = 0;
+
+    uint32_t probe[VDB_SHARD_MAX];
+    uint32_t num = pick_probes(sharded, query, opts->nprobe, probe);
+    vdb_search_results_t *results = (vdb_search_results_t*)calloc(num, sizeof(vdb_search_results_t));
+    vdb_status_t *status = (vdb_status_t*)calloc(num, sizeof(vdb_status_t));
+    if (results == NULL || status == NULL) {
+        free(results);
+        free(status);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    scatter_ctx_t ctx = { sharded, query, k, opts, probe, results, status };
+    vdb_thread_pool_run(sharded->pool, num, search_shard, &ctx);
+
+    /* Gather: every shard's hits are best first with ties by row, and
+     * the probes are in shard order, so numbering the hits in that
+     * order makes the heap's row tiebreak the lower shard, then the
+     * lower row */
+    vdb_status_t result = VDB_OK;
+    size_t total = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        if (status[i] != VDB_OK && result == VDB_OK) {
+            result = status[i];
+        }
+        total += results[i].count;
+    }
+    vdb_topk_entry_t *entries = NULL;
+    size_t want = total < k ? total : k;
+    if (result == VDB_OK && want > 0) {
+        entries = (vdb_topk_entry_t*)malloc(want * sizeof(vdb_topk_entry_t));
+        out_results->hits = (vdb_search_hit_t*)malloc(want * sizeof(vdb_search_hit_t));
+        if (entries == NULL || out_results->hits == NULL) {
+            free(out_results->hits);
+            out_results->hits = NULL;
+            result = VDB_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    if (result == VDB_OK && want > 0) {
+        vdb_topk_t heap;
+        topk_init(&heap, entries, want);
+        uint64_t rank = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            for (size_t h = 0; h < results[i].count; h++, rank++) {
+                topk_push(&heap, results[i].hits[h].distance, rank);
+            }
+        }
+        topk_sort(&heap);
+
+        for (size_t h = 0; h < heap.size; h++) {
+            uint64_t at = entries[h].row;
+            uint32_t i = 0;
+            while (at >= results[i].count) {
+                at -= results[i].count;
+                i++;
+            }
+            out_results->hits[h] = results[i].hits[at];
+        }
+        out_results->count = heap.size;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        vdb_search_results_free(&results[i]);
+    }
+    free(entries);
+    free(results);
+    free(status);
+    return result;
+}
+
+/* ------------------------------------------------------------------ */
+/* Stats                                                               */
+/* ------------------------------------------------------------------ */
+
+uint64_t vdb_sharded_count(vdb_sharded_t *sharded) {
+    if (sharded == NULL) {
+        return 0;
+    }
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < sharded->num_shards; i++) {
+        count += vdb_storage_count(sharded->shards[i]);
+    }
+    return count;
+}
+
+vdb_status_t vdb_sharded_checkpoint(vdb_sharded_t *sharded) {
+    if (sharded == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    vdb_status_t result = VDB_OK;
+    for (uint32_t i = 0; i < sharded->num_shards; i++) {
+        vdb_status_t status = vdb_storage_checkpoint(sharded->shards[i]);
+        if (result == VDB_OK) {
+            result = status;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,398 @@
+/**
+ * sq8.c - Scalar quantization codec and u8 x i16 scoring kernels
+ *
+ * The integer dot product follows the ISA chosen by distance.c
+ * (vdb_distance_get_isa) when the query is prepared, so forcing an ISA
+ * for testing or benchmarking covers these kernels too.
+*/
+
+#include "sq8.h"
+#include "vdb/distance.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VDB_SQ8_X86 1
+#include <immintrin.h>
+#endif
+
+/* On-disk params format */
+#define SQ8_MAGIC 0x50385153u /* "SQ8P" */
+#define SQ8_VERSION 1u
+
+/* Rows looked at when learning the ranges */
+#define SQ8_TRAIN_MAX_ROWS 65536
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t reserved;
+} sq8_file_header_t;
+
+size_t sq8_row_bytes(uint32_t dim) {
+    return sizeof(float) + (((size_t)dim + 3) & ~(size_t)3);
+}
+
+/* ------------------------------------------------------------------ */
+/* Integer dot kernels: sum codes[i] * weights[i]                      */
+/* ------------------------------------------------------------------ */
+
+typedef int32_t (*sq8_dot_fn)(const uint8_t *codes, const int16_t *weights, uint32_t dim);
+
+static int32_t dot_scalar(const uint8_t *codes, const int16_t *weights, uint32_t dim) {
+    int32_t s0 = 0, s1 = 0;
+    uint32_t i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        s0 += (int32_t)codes[i] * weights[i];
+        s1 += (int32_t)codes[i + 1] * weights[i + 1];
+    }
+    for (; i < dim; i++) {
+        s0 += (int32_t)codes[i] * weights[i];
+    }
+    return s0 + s1;
+}
+
+#ifdef VDB_SQ8_X86
+
+__attribute__((target("sse2")))
+static int32_t hsum_epi32_sse2(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+__attribute__((target("sse2")))
+static int32_t dot_sse2(const uint8_t *codes, const int16_t *weights, uint32_t dim) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(codes + i));
+        __m128i lo = _mm_unpacklo_epi8(c, zero);
+        __m128i hi = _mm_unpackhi_epi8(c, zero);
+        acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(lo, _mm_loadu_si128((const __m128i*)(weights + i))));
+        acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(hi, _mm_loadu_si128((const __m128i*)(weights + i + 8))));
+    }
+    int32_t sum = hsum_epi32_sse2(_mm_add_epi32(acc0, acc1));
+    return sum + dot_scalar(codes + i, weights + i, dim - i);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_avx2(const uint8_t *codes, const int16_t *weights, uint32_t dim) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(codes + i)));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(codes + i + 16)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(lo, _mm256_loadu_si256((const __m256i*)(weights + i))));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(hi, _mm256_loadu_si256((const __m256i*)(weights + i + 16))));
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(codes + i)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(c, _mm256_loadu_si256((const __m256i*)(weights + i))));
+    }
+    __m256i acc = _mm256_add_epi32(acc0, acc1);
+    __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    int32_t sum = hsum_epi32_sse2(sum4);
+    return sum + dot_scalar(codes + i, weights + i, dim - i);
+}
+
+__attribute__((target("avx512bw")))
+static int32_t dot_avx512(const uint8_t *codes, const int16_t *weights, uint32_t dim) {
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    uint32_t i = 0;
+    for (; i + 64 <= dim; i += 64) {
+        __m512i lo = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(codes + i)));
+        __m512i hi = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(codes + i + 32)));
+        acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(lo, _mm512_loadu_si512(weights + i)));
+        acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(hi, _mm512_loadu_si512(weights + i + 32)));
+    }
+    for (; i + 32 <= dim; i += 32) {
+        __m512i c = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(codes + i)));
+        acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(c, _mm512_loadu_si512(weights + i)));
+    }
+    int32_t sum = _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+    return sum + dot_scalar(codes + i, weights + i, dim - i);
+}
+
+/* VNNI fuses the multiply-add-accumulate into one instruction */
+__attribute__((target("avx512bw,avx512vnni")))
+static int32_t dot_avx512_vnni(const uint8_t *codes, const int16_t *weights, uint32_t dim) {
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    uint32_t i = 0;
+    for (; i + 64 <= dim; i += 64) {
+        __m512i lo = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(codes + i)));
+        __m512i hi = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(codes + i + 32)));
+        acc0 = _mm512_dpwssd_epi32(acc0, lo, _mm512_loadu_si512(weights + i));
+        acc1 = _mm512_dpwssd_epi32(acc1, hi, _mm512_loadu_si512(weights + i + 32));
+    }
+    for (; i + 32 <= dim; i += 32) {
+        __m512i c = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(codes + i)));
+        acc0 = _mm512_dpwssd_epi32(acc0, c, _mm512_loadu_si512(weights + i));
+    }
+    int32_t sum = _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+    return sum + dot_scalar(codes + i, weights + i, dim - i);
+}
+
+#endif /* VDB_SQ8_X86 */
+
+/**
+ * Kernel for the ISA distance.c currently uses
+*/
+static sq8_dot_fn pick_dot(void) {
+#ifdef VDB_SQ8_X86
+    switch (vdb_distance_get_isa()) {
+        case VDB_ISA_AVX512:
+            if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) {
+                return dot_avx512_vnni;
+            }
+            if (__builtin_cpu_supports("avx512bw")) {
+                return dot_avx512;
+            }
+            return dot_avx2; // AVX-512F without BW still has AVX2
+        case VDB_ISA_AVX2:
+            return dot_avx2;
+        case VDB_ISA_SSE2:
+            return dot_sse2;
+        default:
+            return dot_scalar;
+    }
+#else
+    return dot_scalar;
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* Codec                                                               */
+/* ------------------------------------------------------------------ */
+
+static sq8_codec_t *codec_alloc(uint32_t dim) {
+    sq8_codec_t *codec = (sq8_codec_t*)calloc(1, sizeof(sq8_codec_t));
+    if (codec == NULL) {
+        return NULL;
+    }
+    codec->dim = dim;
+    codec->offset = (float*)malloc(dim * sizeof(float));
+    codec->scale = (float*)malloc(dim * sizeof(float));
+    if (codec->offset == NULL || codec->scale == NULL) {
+        sq8_free(&codec);
+        return NULL;
+    }
+    return codec;
+}
+
+void sq8_free(sq8_codec_t **codec) {
+    if (codec == NULL || *codec == NULL) {
+        return;
+    }
+    free((*codec)->offset);
+    free((*codec)->scale);
+    free(*codec);
+    *codec = NULL;
+}
+
+vdb_status_t sq8_train(uint32_t dim, const uint8_t *rows, size_t stride, uint64_t n,
+                       sq8_codec_t **out_codec) {
+    if (n == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    sq8_codec_t *codec = codec_alloc(dim);
+    if (codec == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    float *max = codec->scale; // reused as scratch until the end
+    for (uint32_t i = 0; i < dim; i++) {
+        codec->offset[i] = INFINITY;
+        max[i] = -INFINITY;
+    }
+
+    uint64_t samples = n < SQ8_TRAIN_MAX_ROWS ? n : SQ8_TRAIN_MAX_ROWS;
+    for (uint64_t s = 0; s < samples; s++) {
+        const float *x = (const float*)(rows + (size_t)(s * n / samples) * stride);
+        for (uint32_t i = 0; i < dim; i++) {
+            if (x[i] < codec->offset[i]) {
+                codec->offset[i] = x[i];
+            }
+            if (x[i] > max[i]) {
+                max[i] = x[i];
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < dim; i++) {
+        codec->scale[i] = (max[i] - codec->offset[i]) / 255.0f;
+    }
+
+    *out_codec = codec;
+    return VDB_OK;
+}
+
+void sq8_encode(const sq8_codec_t *codec, const float *vector, uint8_t *out_row) {
+    uint8_t *codes = out_row + sizeof(float);
+    float norm_sq = 0.0f;
+    for (uint32_t i = 0; i < codec->dim; i++) {
+        float step = codec->scale[i];
+        // values outside the trained range (later appends) clamp to the ends
+        float q = step > 0.0f ? (vector[i] - codec->offset[i]) / step : 0.0f;
+        long c = lrintf(q);
+        c = c < 0 ? 0 : (c > 255 ? 255 : c);
+        codes[i] = (uint8_t)c;
+
+        float decoded = codec->offset[i] + step * (float)c;
+        norm_sq += decoded * decoded;
+    }
+    size_t padded = sq8_row_bytes(codec->dim) - sizeof(float);
+    memset(codes + codec->dim, 0, padded - codec->dim);
+    memcpy(out_row, &norm_sq, sizeof(float));
+}
+
+vdb_status_t sq8_query_init(const sq8_codec_t *codec, vdb_metric_t metric,
+                            const float *query, sq8_query_t *out_query) {
+    uint32_t dim = codec->dim;
+    int16_t *weights = (int16_t*)malloc(dim * sizeof(int16_t));
+    if (weights == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    float bias = 0.0f, qq = 0.0f, max_abs = 0.0f;
+    for (uint32_t i = 0; i < dim; i++) {
+        bias += query[i] * codec->offset[i];
+        qq += query[i] * query[i];
+        float w = fabsf(query[i] * codec->scale[i]);
+        if (w > max_abs) {
+            max_abs = w;
+        }
+    }
+
+    // largest weight that can't overflow the int32 sum: dim * 255 * limit < 2^31
+    double limit = 2147483647.0 / ((double)dim * 255.0);
+    if (limit > 32767.0) {
+        limit = 32767.0;
+    }
+    float inv = max_abs > 0.0f ? (float)(floor(limit) / max_abs) : 0.0f;
+    for (uint32_t i = 0; i < dim; i++) {
+        weights[i] = (int16_t)lrintf(query[i] * codec->scale[i] * inv);
+    }
+
+    out_query->metric = metric;
+    out_query->dim = dim;
+    out_query->dot = pick_dot();
+    out_query->weights = weights;
+    out_query->weight_scale = inv > 0.0f ? 1.0f / inv : 0.0f;
+    out_query->bias = bias;
+    out_query->qq = qq;
+    return VDB_OK;
+}
+
+void sq8_query_free(sq8_query_t *query) {
+    if (query != NULL) {
+        free(query->weights);
+        query->weights = NULL;
+    }
+}
+
+/**
+ * Turn a query . row dot product into the metric's distance
+*/
+static inline float finish_distance(const sq8_query_t *query, float dot, float xx) {
+    if (query->metric == VDB_METRIC_COSINE) {
+        float denom = query->qq * xx;
+        return denom > 0.0f ? 1.0f - dot / sqrtf(denom) : 1.0f;
+    }
+    if (query->metric == VDB_METRIC_INNER_PRODUCT) {
+        return 1.0f - dot;
+    }
+    float d2 = query->qq - 2.0f * dot + xx;
+    return d2 > 0.0f ? sqrtf(d2) : 0.0f;
+}
+
+float sq8_distance(const sq8_query_t *query, const uint8_t *row) {
+    float xx;
+    memcpy(&xx, row, sizeof(float));
+    int32_t idot = query->dot(row + sizeof(float), query->weights, query->dim);
+    return finish_distance(query, query->bias + query->weight_scale * (float)idot, xx);
+}
+
+void sq8_distance_batch(const sq8_query_t *query, const uint8_t *rows, size_t n,
+                        size_t stride, float *out) {
+    sq8_dot_fn dot = query->dot;
+    for (size_t r = 0; r < n; r++) {
+        const uint8_t *row = rows + r * stride;
+        float xx;
+        memcpy(&xx, row, sizeof(float));
+        int32_t idot = dot(row + sizeof(float), query->weights, query->dim);
+        out[r] = finish_distance(query, query->bias + query->weight_scale * (float)idot, xx);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Persistence                                                         */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t sq8_save(const sq8_codec_t *codec, const char *path) {
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return VDB_ERROR_IO;
+    }
+
+    sq8_file_header_t header = { SQ8_MAGIC, SQ8_VERSION, codec->dim, 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(codec->offset, sizeof(float), codec->dim, fp) == codec->dim &&
+        fwrite(codec->scale, sizeof(float), codec->dim, fp) == codec->dim;
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+    return VDB_OK;
+}
+
+vdb_status_t sq8_load(const char *path, uint32_t dim, sq8_codec_t **out_codec) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    sq8_file_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != SQ8_MAGIC ||
+        header.version != SQ8_VERSION || header.dim != dim) {
+        fclose(fp);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    sq8_codec_t *codec = codec_alloc(dim);
+    if (codec == NULL) {
+        fclose(fp);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    bool ok = fread(codec->offset, sizeof(float), dim, fp) == dim &&
+        fread(codec->scale, sizeof(float), dim, fp) == dim;
+    fclose(fp);
+
+    for (uint32_t i = 0; ok && i < dim; i++) {
+        ok = isfinite(codec->offset[i]) && isfinite(codec->scale[i]) && codec->scale[i] >= 0.0f;
+    }
+    if (!ok) {
+        sq8_free(&codec);
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    *out_codec = codec;
+    return VDB_OK;
+}
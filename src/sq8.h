@@ -0,0 +1,84 @@
+/**
+ * sq8.h - Internal scalar (8-bit) quantization of embeddings
+ *
+ * Each dimension is mapped linearly onto 0..255 using a per-dimension
+ * offset (min) and scale (step) learned from the stored rows:
+ *   x[i] ~= offset[i] + scale[i] * code[i]
+ *
+ * Row layout in embeddings.sq8 (sq8_row_bytes(dim) per row):
+ *   float norm_sq - squared norm of the decoded vector
+ *   uint8 codes[dim], zero-padded to a multiple of 4 bytes
+ *
+ * Distances are asymmetric: the query stays full precision. It is
+ * folded into int16 weights (query * scale) plus a float bias
+ * (query . offset), so scoring a row is one u8 x i16 integer dot
+ * product - 4x less memory traffic than the float32 scan.
+*/
+
+#ifndef VDB_SQ8_H
+#define VDB_SQ8_H
+
+#include "vdb/types.h"
+
+typedef struct {
+    uint32_t dim;
+    float *offset; // per-dimension minimum
+    float *scale; // per-dimension step, (max - min) / 255
+} sq8_codec_t;
+
+/**
+ * Prepared query
+*/
+typedef struct {
+    vdb_metric_t metric;
+    uint32_t dim;
+    int32_t (*dot)(const uint8_t *codes, const int16_t *weights, uint32_t dim); // picked at init
+    int16_t *weights; // round(query[i] * scale[i] / weight_scale)
+    float weight_scale; // integer dot * weight_scale = sum query[i] * scale[i] * code[i]
+    float bias; // query . offset
+    float qq; // query . query
+} sq8_query_t;
+
+/* Bytes per row in embeddings.sq8 */
+size_t sq8_row_bytes(uint32_t dim);
+
+/**
+ * Learn offset/scale from n float rows (row i at rows + i * stride bytes)
+ * Uses at most a fixed-size even sample of the rows.
+*/
+vdb_status_t sq8_train(uint32_t dim, const uint8_t *rows, size_t stride, uint64_t n,
+                       sq8_codec_t **out_codec);
+
+/**
+ * Free a codec. Safe with NULL.
+*/
+void sq8_free(sq8_codec_t **codec);
+
+/**
+ * Encode one float vector into an sq8 row (sq8_row_bytes(dim) bytes)
+*/
+void sq8_encode(const sq8_codec_t *codec, const float *vector, uint8_t *out_row);
+
+/**
+ * Prepare a query for scoring; release with sq8_query_free
+*/
+vdb_status_t sq8_query_init(const sq8_codec_t *codec, vdb_metric_t metric,
+                            const float *query, sq8_query_t *out_query);
+void sq8_query_free(sq8_query_t *query);
+
+/**
+ * Approximate distance to one row / n rows (stride in bytes)
+ * Same convention as vdb_distance (lower = more similar).
+*/
+float sq8_distance(const sq8_query_t *query, const uint8_t *row);
+void sq8_distance_batch(const sq8_query_t *query, const uint8_t *rows, size_t n,
+                        size_t stride, float *out);
+
+/**
+ * Persist / load offset and scale (sq8.params)
+ * Save writes path.tmp and renames it over path.
+*/
+vdb_status_t sq8_save(const sq8_codec_t *codec, const char *path);
+vdb_status_t sq8_load(const char *path, uint32_t dim, sq8_codec_t **out_codec);
+
+#endif /* VDB_SQ8_H */
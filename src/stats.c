@@ -0,0 +1,324 @@
+/**
+ * stats.c - Sharded counters, latency histograms and their export
+*/
+
+#include "stats.h"
+#include "storage_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t buckets[VDB_HISTOGRAM_BUCKETS];
+} shard_histogram_t;
+
+/* One thread's copy; aligned so neighbouring shards don't share a line */
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t counters[STATS_NUM_COUNTERS];
+    shard_histogram_t histograms[STATS_NUM_HISTOGRAMS];
+} stats_shard_t;
+
+struct stats {
+    stats_shard_t shards[STATS_SHARDS];
+};
+
+/* The shard this thread records into, picked round robin on first use */
+static _Thread_local uint32_t shard_index = UINT32_MAX;
+static atomic_uint next_shard;
+
+static stats_shard_t *thread_shard(stats_t *stats) {
+    if (shard_index == UINT32_MAX) {
+        shard_index = atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) % STATS_SHARDS;
+    }
+    return &stats->shards[shard_index];
+}
+
+vdb_status_t stats_create(stats_t **out_stats) {
+    if (out_stats == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    stats_t *stats = (stats_t*)aligned_alloc(_Alignof(stats_shard_t), sizeof(stats_t));
+    if (stats == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    memset(stats, 0, sizeof(stats_t));
+    *out_stats = stats;
+    return VDB_OK;
+}
+
+void stats_free(stats_t **stats) {
+    if (stats == NULL || *stats == NULL) {
+        return;
+    }
+    free(*stats);
+    *stats = NULL;
+}
+
+void stats_add(stats_t *stats, stats_counter_t counter, uint64_t n) {
+    atomic_fetch_add_explicit(&thread_shard(stats)->counters[counter], n, memory_order_relaxed);
+}
+
+uint32_t stats_bucket(uint64_t ns) {
+    const uint32_t sub = 1u << VDB_HISTOGRAM_SUB_BITS;
+    if (ns < sub) {
+        return (uint32_t)ns;
+    }
+    uint32_t e = 63u - (uint32_t)__builtin_clzll(ns);
+    if (e >= VDB_HISTOGRAM_MAX_BITS) {
+        return VDB_HISTOGRAM_BUCKETS - 1;
+    }
+    uint32_t shift = e - VDB_HISTOGRAM_SUB_BITS;
+    return sub + shift * sub + (uint32_t)((ns >> shift) & (sub - 1));
+}
+
+/* Smallest value past bucket b */
+static uint64_t bucket_end(uint32_t b) {
+    const uint32_t sub = 1u << VDB_HISTOGRAM_SUB_BITS;
+    if (b < sub) {
+        return b + 1;
+    }
+    uint32_t shift = (b - sub) / sub;
+    return (uint64_t)(sub + (b - sub) % sub + 1) << shift;
+}
+
+void stats_record(stats_t *stats, stats_histogram_t histogram, uint64_t ns) {
+    shard_histogram_t *h = &thread_shard(stats)->histograms[histogram];
+    atomic_fetch_add_explicit(&h->buckets[stats_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+    uint_fast64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, ns, memory_order_relaxed,
+                                                              memory_order_relaxed)) {
+    }
+}
+
+static void collect_histogram(const stats_t *stats, stats_histogram_t histogram, vdb_histogram_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t s = 0; s < STATS_SHARDS; s++) {
+        const shard_histogram_t *h = &stats->shards[s].histograms[histogram];
+        out->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+        out->sum_ns += atomic_load_explicit(&h->sum, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+        out->max_ns = max > out->max_ns ? max : out->max_ns;
+        for (size_t b = 0; b < VDB_HISTOGRAM_BUCKETS; b++) {
+            out->buckets[b] += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        }
+    }
+}
+
+void stats_collect(const stats_t *stats, vdb_stats_t *out) {
+    uint64_t c[STATS_NUM_COUNTERS] = { 0 };
+    for (size_t s = 0; s < STATS_SHARDS; s++) {
+        for (size_t i = 0; i < STATS_NUM_COUNTERS; i++) {
+            c[i] += atomic_load_explicit(&stats->shards[s].counters[i], memory_order_relaxed);
+        }
+    }
+
+    out->appended_rows = c[STATS_APPENDED_ROWS];
+    out->append_calls = c[STATS_APPEND_CALLS];
+    out->deletes = c[STATS_DELETES];
+    out->wal_fsyncs = c[STATS_WAL_FSYNCS];
+    out->checkpoints = c[STATS_CHECKPOINTS];
+    out->bytes_written.wal = c[STATS_BYTES_WAL];
+    out->bytes_written.embeddings = c[STATS_BYTES_EMBEDDINGS];
+    out->bytes_written.ids = c[STATS_BYTES_IDS];
+    out->bytes_written.metadata = c[STATS_BYTES_METADATA];
+    out->bytes_written.norms = c[STATS_BYTES_NORMS];
+    out->bytes_written.codes = c[STATS_BYTES_CODES];
+    out->bytes_written.index = c[STATS_BYTES_INDEX];
+    out->exact_searches = c[STATS_EXACT_SEARCHES];
+    out->hnsw_searches = c[STATS_HNSW_SEARCHES];
+    out->diskann_searches = c[STATS_DISKANN_SEARCHES];
+    out->batch_searches = c[STATS_BATCH_SEARCHES];
+    out->batch_queries = c[STATS_BATCH_QUERIES];
+    out->distances = c[STATS_DISTANCES];
+    out->hnsw_hops = c[STATS_HNSW_HOPS];
+    out->diskann_reads = c[STATS_DISKANN_READS];
+    out->query_cache_hits = c[STATS_QUERY_CACHE_HITS];
+    out->query_cache_misses = c[STATS_QUERY_CACHE_MISSES];
+
+    collect_histogram(stats, STATS_APPEND_LATENCY, &out->append_latency);
+    collect_histogram(stats, STATS_WAL_FSYNC_LATENCY, &out->wal_fsync_latency);
+    collect_histogram(stats, STATS_EXACT_SEARCH_LATENCY, &out->exact_search_latency);
+    collect_histogram(stats, STATS_HNSW_SEARCH_LATENCY, &out->hnsw_search_latency);
+    collect_histogram(stats, STATS_DISKANN_SEARCH_LATENCY, &out->diskann_search_latency);
+    collect_histogram(stats, STATS_BATCH_SEARCH_LATENCY, &out->batch_search_latency);
+}
+
+void stats_reset(stats_t *stats) {
+    for (size_t s = 0; s < STATS_SHARDS; s++) {
+        stats_shard_t *shard = &stats->shards[s];
+        for (size_t i = 0; i < STATS_NUM_COUNTERS; i++) {
+            atomic_store_explicit(&shard->counters[i], 0, memory_order_relaxed);
+        }
+        for (size_t i = 0; i < STATS_NUM_HISTOGRAMS; i++) {
+            shard_histogram_t *h = &shard->histograms[i];
+            atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+            atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+            atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+            for (size_t b = 0; b < VDB_HISTOGRAM_BUCKETS; b++) {
+                atomic_store_explicit(&h->buckets[b], 0, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Public API                                                          */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t vdb_storage_get_stats(vdb_storage_t *storage, vdb_stats_t *out_stats) {
+    if (storage == NULL || out_stats == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    stats_collect(storage->stats, out_stats);
+    return VDB_OK;
+}
+
+vdb_status_t vdb_storage_reset_stats(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    stats_reset(storage->stats);
+    return VDB_OK;
+}
+
+uint64_t vdb_histogram_quantile(const vdb_histogram_t *histogram, double quantile) {
+    if (histogram == NULL || histogram->count == 0) {
+        return 0;
+    }
+    quantile = quantile < 0.0 ? 0.0 : quantile > 1.0 ? 1.0 : quantile;
+
+    // the rank'th smallest value, 1-based
+    uint64_t rank = (uint64_t)(quantile * (double)histogram->count + 0.5);
+    rank = rank < 1 ? 1 : rank > histogram->count ? histogram->count : rank;
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < VDB_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) {
+            uint64_t end = bucket_end(b) - 1;
+            return end < histogram->max_ns ? end : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+double vdb_histogram_mean(const vdb_histogram_t *histogram) {
+    if (histogram == NULL || histogram->count == 0) {
+        return 0.0;
+    }
+    return (double)histogram->sum_ns / (double)histogram->count;
+}
+
+/* ------------------------------------------------------------------ */
+/* Prometheus text format                                              */
+/* ------------------------------------------------------------------ */
+
+/* {collection="...",key="value",quantile="q"}; key and quantile may be NULL */
+static void write_labels(FILE *out, const char *collection, const char *key, const char *value,
+                         const char *quantile) {
+    fputs("{collection=\"", out);
+    for (const char *p = collection; *p != '\0'; p++) {
+        if (*p == '\\' || *p == '"') {
+            fputc('\\', out);
+            fputc(*p, out);
+        } else if (*p == '\n') {
+            fputs("\\n", out);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+    if (key != NULL) {
+        fprintf(out, ",%s=\"%s\"", key, value);
+    }
+    if (quantile != NULL) {
+        fprintf(out, ",quantile=\"%s\"", quantile);
+    }
+    fputc('}', out);
+}
+
+static void write_family(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_sample(FILE *out, const char *name, const char *collection,
+                         const char *key, const char *value, uint64_t v) {
+    fputs(name, out);
+    write_labels(out, collection, key, value, NULL);
+    fprintf(out, " %llu\n", (unsigned long long)v);
+}
+
+static void write_counter(FILE *out, const char *name, const char *help, const char *collection, uint64_t v) {
+    write_family(out, name, "counter", help);
+    write_sample(out, name, collection, NULL, NULL, v);
+}
+
+/* One histogram as summary samples, labelled key=value (key may be NULL) */
+static void write_summary(FILE *out, const char *name, const char *collection,
+                          const char *key, const char *value, const vdb_histogram_t *h) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *labels[] = { "0.5", "0.9", "0.99", "0.999" };
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fputs(name, out);
+        write_labels(out, collection, key, value, labels[i]);
+        fprintf(out, " %.9g\n", (double)vdb_histogram_quantile(h, quantiles[i]) / 1e9);
+    }
+    fprintf(out, "%s_sum", name);
+    write_labels(out, collection, key, value, NULL);
+    fprintf(out, " %.9g\n", (double)h->sum_ns / 1e9);
+    fprintf(out, "%s_count", name);
+    write_labels(out, collection, key, value, NULL);
+    fprintf(out, " %llu\n", (unsigned long long)h->count);
+}
+
+vdb_status_t vdb_stats_write_prometheus(const vdb_stats_t *stats, const char *collection, FILE *out) {
+    if (stats == NULL || collection == NULL || out == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    write_counter(out, "vdb_appended_rows_total", "Rows appended or upserted.", collection, stats->appended_rows);
+    write_counter(out, "vdb_append_calls_total", "Append and upsert calls.", collection, stats->append_calls);
+    write_counter(out, "vdb_deletes_total", "Rows deleted.", collection, stats->deletes);
+    write_counter(out, "vdb_wal_fsyncs_total", "WAL fsyncs.", collection, stats->wal_fsyncs);
+    write_counter(out, "vdb_checkpoints_total", "Checkpoints.", collection, stats->checkpoints);
+
+    const vdb_bytes_written_t *b = &stats->bytes_written;
+    write_family(out, "vdb_bytes_written_total", "counter", "Bytes written, by file.");
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "wal", b->wal);
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "embeddings", b->embeddings);
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "ids", b->ids);
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "metadata", b->metadata);
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "norms", b->norms);
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "codes", b->codes);
+    write_sample(out, "vdb_bytes_written_total", collection, "file", "index", b->index);
+
+    write_family(out, "vdb_searches_total", "counter", "Searches, by kind (batch counts queries).");
+    write_sample(out, "vdb_searches_total", collection, "kind", "exact", stats->exact_searches);
+    write_sample(out, "vdb_searches_total", collection, "kind", "hnsw", stats->hnsw_searches);
+    write_sample(out, "vdb_searches_total", collection, "kind", "diskann", stats->diskann_searches);
+    write_sample(out, "vdb_searches_total", collection, "kind", "batch", stats->batch_queries);
+    write_counter(out, "vdb_batch_search_calls_total", "Batch search calls.", collection, stats->batch_searches);
+    write_counter(out, "vdb_distances_total", "Vectors or codes scored by searches.", collection, stats->distances);
+    write_counter(out, "vdb_hnsw_hops_total", "HNSW nodes expanded by searches.", collection, stats->hnsw_hops);
+    write_counter(out, "vdb_diskann_reads_total", "DiskANN node records read by searches.", collection,
+                  stats->diskann_reads);
+    write_family(out, "vdb_query_cache_lookups_total", "counter", "Query cache lookups, by result.");
+    write_sample(out, "vdb_query_cache_lookups_total", collection, "result", "hit", stats->query_cache_hits);
+    write_sample(out, "vdb_query_cache_lookups_total", collection, "result", "miss", stats->query_cache_misses);
+
+    write_family(out, "vdb_append_latency_seconds", "summary", "Append call latency, WAL fsync included.");
+    write_summary(out, "vdb_append_latency_seconds", collection, NULL, NULL, &stats->append_latency);
+    write_family(out, "vdb_wal_fsync_seconds", "summary", "WAL fsync latency.");
+    write_summary(out, "vdb_wal_fsync_seconds", collection, NULL, NULL, &stats->wal_fsync_latency);
+    write_family(out, "vdb_search_latency_seconds", "summary", "Search latency, by kind (batch per call).");
+    write_summary(out, "vdb_search_latency_seconds", collection, "kind", "exact", &stats->exact_search_latency);
+    write_summary(out, "vdb_search_latency_seconds", collection, "kind", "hnsw", &stats->hnsw_search_latency);
+    write_summary(out, "vdb_search_latency_seconds", collection, "kind", "diskann", &stats->diskann_search_latency);
+    write_summary(out, "vdb_search_latency_seconds", collection, "kind", "batch", &stats->batch_search_latency);
+
+    return ferror(out) ? VDB_ERROR_IO : VDB_OK;
+}
@@ -0,0 +1,95 @@
+/**
+ * stats.h - Internal counters behind vdb_storage_get_stats
+ *
+ * A stats_t is STATS_SHARDS copies of every counter and histogram. A
+ * thread picks a shard the first time it records anything and sticks
+ * to it, so threads mostly bump cache lines no one else writes; every
+ * update is a relaxed atomic add. Collecting sums the shards.
+*/
+
+#ifndef VDB_STATS_INTERNAL_H
+#define VDB_STATS_INTERNAL_H
+
+#include "vdb/stats.h"
+#include <stdint.h>
+#include <time.h>
+
+/* Shards per storage */
+#define STATS_SHARDS 8
+
+typedef enum {
+    STATS_APPENDED_ROWS,
+    STATS_APPEND_CALLS,
+    STATS_DELETES,
+    STATS_WAL_FSYNCS,
+    STATS_CHECKPOINTS,
+    STATS_BYTES_WAL,
+    STATS_BYTES_EMBEDDINGS,
+    STATS_BYTES_IDS,
+    STATS_BYTES_METADATA,
+    STATS_BYTES_NORMS,
+    STATS_BYTES_CODES,
+    STATS_BYTES_INDEX,
+    STATS_EXACT_SEARCHES,
+    STATS_HNSW_SEARCHES,
+    STATS_DISKANN_SEARCHES,
+    STATS_BATCH_SEARCHES,
+    STATS_BATCH_QUERIES,
+    STATS_DISTANCES,
+    STATS_HNSW_HOPS,
+    STATS_DISKANN_READS,
+    STATS_QUERY_CACHE_HITS,
+    STATS_QUERY_CACHE_MISSES,
+    STATS_NUM_COUNTERS
+} stats_counter_t;
+
+typedef enum {
+    STATS_APPEND_LATENCY,
+    STATS_WAL_FSYNC_LATENCY,
+    STATS_EXACT_SEARCH_LATENCY,
+    STATS_HNSW_SEARCH_LATENCY,
+    STATS_DISKANN_SEARCH_LATENCY,
+    STATS_BATCH_SEARCH_LATENCY,
+    STATS_NUM_HISTOGRAMS
+} stats_histogram_t;
+
+typedef struct stats stats_t;
+
+/**
+ * Create zeroed counters
+*/
+vdb_status_t stats_create(stats_t **out_stats);
+
+/**
+ * Free counters. Safe with NULL.
+*/
+void stats_free(stats_t **stats);
+
+/* Add n to a counter */
+void stats_add(stats_t *stats, stats_counter_t counter, uint64_t n);
+
+/* Record one value (ns) in a histogram */
+void stats_record(stats_t *stats, stats_histogram_t histogram, uint64_t ns);
+
+/* Sum the shards */
+void stats_collect(const stats_t *stats, vdb_stats_t *out);
+
+/* Zero every shard */
+void stats_reset(stats_t *stats);
+
+/* Bucket a value falls in */
+uint32_t stats_bucket(uint64_t ns);
+
+/* Monotonic clock in ns, for timing what the histograms record */
+static inline uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Time since start (from stats_now_ns) into a histogram */
+static inline void stats_record_since(stats_t *stats, stats_histogram_t histogram, uint64_t start) {
+    stats_record(stats, histogram, stats_now_ns() - start);
+}
+
+#endif /* VDB_STATS_INTERNAL_H */
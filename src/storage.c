@@ -3,10 +3,32 @@
  * 
  * This implements append-only storage with WAL for crash recov
  * uses POSIX APIs (open, write, fsync, mmap) for file ops
+ *
+ * Durability: an append is durable once its WAL frame is fsync'd. The
+ * segments are only fsync'd at checkpoints (WAL past checkpoint_bytes,
+ * explicit checkpoint, close), which also record count in the
+ * collection.meta superblock and empty the WAL. On open, frames past
+ * the recorded count are replayed into the segments. A checkpoint also
+ * snapshots the ID and filter indexes to index.snap, so open maps them
+ * and only indexes the rows past the snapshot.
+ *
+ * Concurrency: one writer at a time (write_lock), any number of
+ * readers that never take it. Each write publishes a fresh snapshot of
+ * the rows once they are in the segments; readers copy it inside an
+ * epoch guard, so they don't wait on a WAL fsync or checkpoint. What a
+ * publish replaces (the old snapshot, grown or swapped-out mappings)
+ * is freed only once no reader that could have seen it is left.
 */
 
 #include "vdb/storage.h"
 #include "vdb/collection.h"
+#include "vdb/distance.h"
+#include "storage_internal.h"
+#include "sq8.h"
+#include "pq.h"
+#include "crc32c.h"
+#include "superblock.h"
+#include "scratch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,52 +38,55 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <time.h>
 
-/* Max path len */
-#define MAX_PATH 1024
+/* WAL frame types */
+#define WAL_FRAME_APPEND 1 // append records (appends and upserts alike)
+#define WAL_FRAME_DELETE 2 // uint64 rows deleted
 
-/* WAL record types */
-#define WAL_RECORD_APPEND 1
+/* How long a get waits for a row's publish before making it itself */
+#define PUBLISH_WAIT_MS 10
 
-/* WAL record header */
+/**
+ * WAL frame header, followed by num_records records
+ * One frame per append, batch or delete. crc is CRC32C over the payload and
+ * then the header bytes after crc, so the payload can be summed before
+ * write_lock is taken.
+*/
 typedef struct {
-    uint8_t type;
-    uint32_t id_len; // record type
+    uint32_t crc;
+    uint32_t type; // WAL_FRAME_*
+    uint64_t lsn; // +1 per frame, continues across checkpoints
+    uint64_t first_row; // row of the first record (count, for deletes)
+    uint32_t num_records; // records in this frame
+    uint32_t reserved;
+    uint64_t payload_len; // bytes of records following the header
+} __attribute__((packed)) wal_frame_header_t;
+
+/* WAL append record header, followed by id, vector and metadata */
+typedef struct {
+    uint32_t id_len;
     uint32_t vector_dim; // vector dimension
     uint32_t metadata_len; // len of metadata (0 if none)
 } __attribute__((packed)) wal_record_header_t;
 
-/**
- * Storage structure (opaque to users)
-*/
-struct vdb_storage {
-    char base_dir[MAX_PATH];
-    char name[VDB_COLLECTION_NAME_MAX_LEN];
-    uint32_t dim;
-    vdb_metric_t metric;
-    uint64_t count;
-
-    /* File descriptors */
-    int meta_fd;
-    int embeddings_fd;
-    int ids_fd;
-    int metadata_fd;
-    int wal_fd;
-};
-
 /**
  * Build path to collection directory
+ * VDB_ERROR_INVALID_ARGUMENT if it doesn't fit in MAX_PATH
 */
-static void build_collection_path(const char *base_dir, const char *name, char *out_path) {
-    snprintf(out_path, MAX_PATH, "%s/%s", base_dir, name);
+static vdb_status_t build_collection_path(const char *base_dir, const char *name, char *out_path) {
+    int len = snprintf(out_path, MAX_PATH, "%s/%s", base_dir, name);
+    return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
 }
 
 /** 
  * Build path to a file within collection
+ * VDB_ERROR_INVALID_ARGUMENT if it doesn't fit in MAX_PATH
 */
-static void build_file_path(const char *base_dir, const char *name,
+static vdb_status_t build_file_path(const char *base_dir, const char *name,
     const char *filename, char *out_path) {
-        sprintf(out_path, MAX_PATH, "%s/%s/%s", base_dir, name, filename);
+        int len = snprintf(out_path, MAX_PATH, "%s/%s/%s", base_dir, name, filename);
+        return len >= 0 && len < MAX_PATH ? VDB_OK : VDB_ERROR_INVALID_ARGUMENT;
 }
 
 /** 
@@ -109,56 +134,16 @@ static vdb_status_t create_directory(const char *path) {
 }
 
 /**
- * Write collection metadata file
-*/
-static vdb_status_t write_collection_meta(const char *path, uint32_t dim, 
-                                        vdb_metric_t metric, u_int64_t count) {
-    FILE *fp = fopen(path, "w");
-    if (fp == NULL) {
-        return VDB_ERROR_IO;
-    }
-    fprintf(fp, "dimension=%u\n", dim);
-    fprintf(fp, "metric=%d\n", (int)metric);
-    fprintf(fp, "count=%lu\n", (unsigned long)count);
-
-    if (fclose(fp) != 0) {
-        return VDB_ERROR_IO;
-    }
-
-    return VDB_OK;
-}
-
-/** 
- * Read collection metadata file
+ * Open norms.seg for appending (sets norms_fd)
 */
-static vdb_status_t read_collection_meta(const char *path, uint32_t *dim, 
-                                        vdb_metric_t *metric, uint64_t *count) {
-    FILE *fp = fopen(path, "r");
-    if (fp == NULL) {
-        return VDB_ERROR_NOT_FOUND;
-    }
-
-    int metric_int;
-    unsigned long count_ul;
-
-    int n = fscanf(fp, "dimension=%u\nmetric=%d\ncount=%lu\n",
-                    dim, &metric_int, &count_ul);
-    
-    fclose(fp);
-
-    if (n != 3) {
-        return VDB_ERROR_CORRUPTED;
-    }
-
-    *metric = (vdb_metric_t)metric_int;
-    *count = (uint64_t)count_ul;
-
-    /* Validate */
-    if (*dim == 0 || *dim > VDB_COLLECTION_MAX_DIM || !vdb_metric_is_valid(*metric)) {
-        return VDB_ERROR_CORRUPTED;
+static vdb_status_t open_norms_file(vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    vdb_status_t status = build_file_path(storage->base_dir, storage->name, "norms.seg", path);
+    if (status != VDB_OK) {
+        return status;
     }
-
-    return VDB_OK;
+    storage->norms_fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    return storage->norms_fd >= 0 ? VDB_OK : VDB_ERROR_IO;
 }
 
 /** 
@@ -168,23 +153,26 @@ static vdb_status_t open_segment_files(vdb_storage_t *storage) {
     char path[MAX_PATH];
 
     /* Open embeddings segment */
-    build_file_path(storage->base_dir, storage->name, "embeddings.seg", path);
-    storage->embeddings_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    storage->embeddings_fd = build_file_path(storage->base_dir, storage->name, "embeddings.seg", path) == VDB_OK
+        ? open(path, O_RDWR | O_APPEND | O_CREAT, 0644)
+        : -1;
     if (storage->embeddings_fd < 0) {
         return VDB_ERROR_IO;
     }
 
     /* Open IDs segment */
-    build_file_path(storage->base_dir, storage->name, "ids.seg", path);
-    storage->ids_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    storage->ids_fd = build_file_path(storage->base_dir, storage->name, "ids.seg", path) == VDB_OK
+        ? open(path, O_RDWR | O_APPEND | O_CREAT, 0644)
+        : -1;
     if (storage->ids_fd < 0) {
         close(storage->embeddings_fd);
         return VDB_ERROR_IO;
     }
 
-    /* Open metaddata segment */
-    build_file_path(storage->base_dir, storage->name, "metadata.seg", path);
-    storage->metadata_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    /* Open metadata segment */
+    storage->metadata_fd = build_file_path(storage->base_dir, storage->name, "metadata.seg", path) == VDB_OK
+        ? open(path, O_RDWR | O_APPEND | O_CREAT, 0644)
+        : -1;
     if (storage->metadata_fd < 0) {
         close(storage->embeddings_fd);
         close(storage->ids_fd);
@@ -192,8 +180,9 @@ static vdb_status_t open_segment_files(vdb_storage_t *storage) {
     }
 
     /* Open WAL */
-    build_file_path(storage->base_dir, storage->name, "wal.log", path);
-    storage->wal_fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    storage->wal_fd = build_file_path(storage->base_dir, storage->name, "wal.log", path) == VDB_OK
+        ? open(path, O_RDWR | O_APPEND | O_CREAT, 0644)
+        : -1;
     if (storage->wal_fd < 0) {
         close(storage->embeddings_fd);
         close(storage->ids_fd);
@@ -201,6 +190,15 @@ static vdb_status_t open_segment_files(vdb_storage_t *storage) {
         return VDB_ERROR_IO;
     }
 
+    /* Open norms segment (kept norms only) */
+    if (storage->normalize == VDB_NORMALIZE_KEEP_NORMS && open_norms_file(storage) != VDB_OK) {
+        close(storage->embeddings_fd);
+        close(storage->ids_fd);
+        close(storage->metadata_fd);
+        close(storage->wal_fd);
+        return VDB_ERROR_IO;
+    }
+
     return VDB_OK;
 }
 
@@ -224,35 +222,427 @@ static void close_segment_files(vdb_storage_t *storage) {
         close(storage->wal_fd);
         storage->wal_fd = -1;
     }
+    if (storage->codes_fd >= 0) {
+        close(storage->codes_fd);
+        storage->codes_fd = -1;
+    }
+    if (storage->norms_fd >= 0) {
+        close(storage->norms_fd);
+        storage->norms_fd = -1;
+    }
 }
 
-/** 
- * Recover from WAL (replay uncommitted records)
- * for now, ill implement a simple truncate-on success strat:
- * if WAL is non-empty on open, we assume crash and replay
+/**
+ * Map (or re-map) a segment read-only so at least `needed` bytes are visible
+ *
+ * The mapping reserves headroom past the current end of file; pages are
+ * only touched once appends have extended the file, so growth usually
+ * needs no remap at all.
 */
+vdb_status_t storage_map_segment(vdb_storage_t *storage, const char *filename,
+                                 segment_map_t *map, size_t needed) {
+    if (needed <= map->len) {
+        return VDB_OK;
+    }
 
-static vdb_status_t recover_from_wal(vdb_storage_t *storage) {
-    /* get wal size */
-    off_t wal_size = lseek(storage->wal_fd, 0, SEEK_END);
-    if (wal_size < 0) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = needed + needed / 2;
+    len = (len + page - 1) / page * page;
+
+    char path[MAX_PATH];
+    if (build_file_path(storage->base_dir, storage->name, filename, path) != VDB_OK) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         return VDB_ERROR_IO;
     }
 
-    if (wal_size == 0) {
-        return VDB_OK; // no recov needed
+    void *addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference
+    if (addr == MAP_FAILED) {
+        return VDB_ERROR_IO;
     }
 
-    /** for this simple impl, we'll just truncate the WAL
-     * after investigatin, in a real system we'd replay records
-     * Since we fsync after each append, partial records indicate crash
-     * during write, so we conservatively truncate
-    */
-   if (ftruncate(storage->wal_fd, 0) != 0) {
-    return VDB_ERROR_IO;
-   }
+    // a concurrent reader may still be scanning the old mapping
+    vdb_status_t status = storage_retire_map(storage, map);
+    if (status != VDB_OK) {
+        munmap(addr, len);
+        return status;
+    }
+    map->addr = (const uint8_t*)addr;
+    map->len = len;
+    return VDB_OK;
+}
+
+/**
+ * Park a mapping until the next publish hands it to the epoch domain
+ * (the published snapshot may still point into it)
+*/
+vdb_status_t storage_retire_map(vdb_storage_t *storage, segment_map_t *map) {
+    if (map->addr == NULL) {
+        return VDB_OK;
+    }
+    segment_map_t *retired = (segment_map_t*)realloc(storage->retired_maps,
+        (storage->num_retired_maps + 1) * sizeof(segment_map_t));
+    if (retired == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    storage->retired_maps = retired;
+    storage->retired_maps[storage->num_retired_maps++] = *map;
+    map->addr = NULL;
+    map->len = 0;
+    return VDB_OK;
+}
+
+/**
+ * Make sure every committed row is covered by the mappings
+*/
+static vdb_status_t ensure_mapped(vdb_storage_t *storage) {
+    vdb_status_t status = storage_map_segment(storage, "embeddings.seg", &storage->embeddings_map,
+                                      (size_t)storage->count * storage->row_bytes);
+    if (status == VDB_OK) {
+        status = storage_map_segment(storage, "ids.seg", &storage->ids_map,
+                             (size_t)storage->count * VDB_ID_MAX_LEN);
+    }
+    if (status == VDB_OK) {
+        status = storage_map_segment(storage, "metadata.seg", &storage->metadata_map,
+                             (size_t)storage->metadata_bytes);
+    }
+    if (status == VDB_OK && storage->normalize == VDB_NORMALIZE_KEEP_NORMS) {
+        status = storage_map_segment(storage, "norms.seg", &storage->norms_map,
+                                     (size_t)storage->count * sizeof(float));
+    }
+    if (status == VDB_OK && storage->code_count > 0) {
+        status = storage_map_segment(storage, storage_codes_file(storage), &storage->codes_map,
+                                     storage_codes_bytes(storage, storage->code_count));
+    }
+    return status;
+}
+
+/* epoch_free_fn for retired mappings and snapshots */
+static void retired_unmap(void *ptr, size_t len) {
+    munmap(ptr, len);
+}
+
+static void retired_free(void *ptr, size_t len) {
+    (void)len;
+    free(ptr);
+}
+
+static void retired_pool(void *ptr, size_t len) {
+    (void)len;
+    vdb_thread_pool_t *pool = (vdb_thread_pool_t*)ptr;
+    vdb_thread_pool_destroy(&pool);
+}
+
+static void unmap_segment(segment_map_t *map) {
+    if (map->addr != NULL) {
+        munmap((void*)map->addr, map->len);
+        map->addr = NULL;
+        map->len = 0;
+    }
+}
+
+static void unmap_segments(vdb_storage_t *storage) {
+    unmap_segment(&storage->embeddings_map);
+    unmap_segment(&storage->ids_map);
+    unmap_segment(&storage->metadata_map);
+    unmap_segment(&storage->codes_map);
+    unmap_segment(&storage->norms_map);
+    for (size_t i = 0; i < storage->num_retired_maps; i++) {
+        unmap_segment(&storage->retired_maps[i]);
+    }
+    free(storage->retired_maps);
+    storage->retired_maps = NULL;
+    storage->num_retired_maps = 0;
+}
+
+/**
+ * Apply an access pattern hint to a mapping
+*/
+static void advise_segment(const segment_map_t *map, size_t used, int advice) {
+    if (map->addr != NULL && used > 0) {
+        posix_madvise((void*)map->addr, used, advice);
+    }
+}
+
+/**
+ * Line the segment files up with count
+ *
+ * count is the number of rows as last recorded in collection.meta by a
+ * checkpoint, which synced the segments first, so a segment shorter
+ * than that is corruption. Rows past count are cut off (WAL replay
+ * writes them again); otherwise the next append would land at a
+ * different row in each file. The superblock records where row count
+ * ends in metadata.seg; only records from before it did are walked.
+*/
+static vdb_status_t reconcile_segments(vdb_storage_t *storage) {
+    struct stat emb_st, ids_st, meta_st;
+    if (fstat(storage->embeddings_fd, &emb_st) != 0 ||
+        fstat(storage->ids_fd, &ids_st) != 0 ||
+        fstat(storage->metadata_fd, &meta_st) != 0) {
+        return VDB_ERROR_IO;
+    }
+
+    uint64_t emb_bytes = storage->count * storage->row_bytes;
+    uint64_t ids_bytes = storage->count * VDB_ID_MAX_LEN;
+    if ((uint64_t)emb_st.st_size < emb_bytes || (uint64_t)ids_st.st_size < ids_bytes) {
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    uint64_t offset = storage->checkpoint_metadata_bytes;
+    if (offset == SUPERBLOCK_METADATA_UNKNOWN) {
+        /* older superblocks: walk the length prefixes to find where row `count` ends */
+        offset = 0;
+        for (uint64_t row = 0; row < storage->count; row++) {
+            uint32_t len;
+            if (pread(storage->metadata_fd, &len, sizeof(len), (off_t)offset) != sizeof(len)) {
+                return VDB_ERROR_CORRUPTED;
+            }
+            offset += sizeof(len) + len;
+        }
+    }
+    if ((uint64_t)meta_st.st_size < offset) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    storage->metadata_bytes = offset;
+
+    if (((uint64_t)emb_st.st_size > emb_bytes && ftruncate(storage->embeddings_fd, (off_t)emb_bytes) != 0) ||
+        ((uint64_t)ids_st.st_size > ids_bytes && ftruncate(storage->ids_fd, (off_t)ids_bytes) != 0) ||
+        ((uint64_t)meta_st.st_size > offset && ftruncate(storage->metadata_fd, (off_t)offset) != 0)) {
+        return VDB_ERROR_IO;
+    }
+
+    if (storage->norms_fd >= 0) {
+        struct stat norms_st;
+        uint64_t norms_bytes = storage->count * sizeof(float);
+        if (fstat(storage->norms_fd, &norms_st) != 0) {
+            return VDB_ERROR_IO;
+        }
+        if ((uint64_t)norms_st.st_size < norms_bytes) {
+            return VDB_ERROR_CORRUPTED;
+        }
+        if ((uint64_t)norms_st.st_size > norms_bytes && ftruncate(storage->norms_fd, (off_t)norms_bytes) != 0) {
+            return VDB_ERROR_IO;
+        }
+    }
+    return VDB_OK;
+}
+
+/**
+ * Allocate and initialize a storage struct (no files touched)
+*/
+static vdb_storage_t *alloc_storage(const char *base_dir, const char *name,
+                                    uint32_t dim, vdb_metric_t metric, uint64_t count) {
+    vdb_storage_t *storage = (vdb_storage_t*)calloc(1, sizeof(vdb_storage_t));
+    if (storage == NULL) {
+        return NULL;
+    }
+    if (epoch_domain_create(&storage->epoch) != VDB_OK) {
+        free(storage);
+        return NULL;
+    }
+    if (stats_create(&storage->stats) != VDB_OK) {
+        epoch_domain_free(&storage->epoch);
+        free(storage);
+        return NULL;
+    }
+    if (query_cache_create(&storage->query_cache) != VDB_OK) {
+        stats_free(&storage->stats);
+        epoch_domain_free(&storage->epoch);
+        free(storage);
+        return NULL;
+    }
+    atomic_init(&storage->snapshot, NULL);
+    atomic_init(&storage->published_count, 0);
+    atomic_init(&storage->pool, NULL);
+
+    /* init fields */
+    strncpy(storage->base_dir, base_dir, MAX_PATH - 1);
+    storage->base_dir[MAX_PATH - 1] = '\0';
+    strncpy(storage->name, name, VDB_COLLECTION_NAME_MAX_LEN - 1);
+    storage->name[VDB_COLLECTION_NAME_MAX_LEN - 1] = '\0';
+    storage->dim = dim;
+    storage->metric = metric;
+    storage->count = count;
+    storage->row_bytes = (size_t)dim * sizeof(float);
+    storage->scan_dim = dim;
+    storage->embeddings_fd = -1;
+    storage->ids_fd = -1;
+    storage->metadata_fd = -1;
+    storage->wal_fd = -1;
+    storage->codes_fd = -1;
+    storage->norms_fd = -1;
+    storage->checkpoint_count = count;
+    storage->checkpoint_metadata_bytes = count == 0 ? 0 : SUPERBLOCK_METADATA_UNKNOWN;
+    storage->next_lsn = 1;
+    storage->checkpoint_lsn = 1;
+    storage->unsynced_row = UINT64_MAX;
+    storage->checkpoint_bytes = VDB_DEFAULT_CHECKPOINT_BYTES;
+    storage->rerank_factor = VDB_DEFAULT_RERANK_FACTOR;
+    storage->segment_rows = VDB_DEFAULT_SEGMENT_ROWS;
+    storage->hnsw_pinned_bytes = VDB_DEFAULT_HNSW_PINNED_BYTES;
+    pthread_mutex_init(&storage->publish_lock, NULL);
+    pthread_cond_init(&storage->publish_cond, NULL);
+    pthread_mutex_init(&storage->write_lock, NULL);
+    pthread_cond_init(&storage->pending_cond, NULL);
+    pthread_cond_init(&storage->commit_cond, NULL);
+    pthread_rwlock_init(&storage->index_lock, NULL);
+    pthread_mutex_init(&storage->seal_wait_lock, NULL);
+    pthread_cond_init(&storage->seal_cond, NULL);
+    pthread_rwlock_init(&storage->filter_lock, NULL);
+    pthread_rwlock_init(&storage->id_lock, NULL);
+    pthread_rwlock_init(&storage->layout_lock, NULL);
+    pthread_mutex_init(&storage->compact_lock, NULL);
+    pthread_mutex_init(&storage->compact_wait_lock, NULL);
+    pthread_cond_init(&storage->compact_cond, NULL);
+    return storage;
+}
+
+/**
+ * Size the rows for a layout and element type; padding is whole
+ * elements, so the kernels can run over it
+*/
+static void set_row_format(vdb_storage_t *storage, vdb_row_layout_t layout, vdb_element_type_t element) {
+    size_t bytes = (size_t)storage->dim * vdb_element_size(element);
+    if (layout == VDB_ROW_LAYOUT_PADDED) {
+        bytes = (bytes + VDB_ROW_ALIGN - 1) / VDB_ROW_ALIGN * VDB_ROW_ALIGN;
+    }
+    storage->row_layout = layout;
+    storage->element = element;
+    storage->row_bytes = bytes;
+    storage->scan_dim = (uint32_t)(bytes / vdb_element_size(element));
+    storage->dim_kernel = vdb_distance_kernel_for_dim(storage->scan_dim);
+}
+
+/**
+ * Release synchronization primitives and free the storage struct
+*/
+static void destroy_storage(vdb_storage_t *storage) {
+    vdb_thread_pool_t *pool = atomic_load(&storage->pool);
+    if (!storage->pool_shared) {
+        vdb_thread_pool_destroy(&pool);
+    }
+    storage_index_segments_free(storage->segments, storage->num_segments);
+    sq8_free(&storage->sq8);
+    pq_free(&storage->pq);
+    filter_index_free(&storage->filters);
+    id_index_free(&storage->ids);
+    index_snap_close(&storage->index_snap);
+    free(storage->replayed_deletes);
+    pthread_cond_destroy(&storage->compact_cond);
+    pthread_mutex_destroy(&storage->compact_wait_lock);
+    pthread_mutex_destroy(&storage->compact_lock);
+    pthread_rwlock_destroy(&storage->layout_lock);
+    pthread_rwlock_destroy(&storage->id_lock);
+    pthread_rwlock_destroy(&storage->filter_lock);
+    pthread_cond_destroy(&storage->seal_cond);
+    pthread_mutex_destroy(&storage->seal_wait_lock);
+    pthread_rwlock_destroy(&storage->index_lock);
+    unmap_segments(storage);
+    free(atomic_load(&storage->snapshot));
+    epoch_domain_free(&storage->epoch);
+    stats_free(&storage->stats);
+    query_cache_free(&storage->query_cache);
+    aio_ring_free(&storage->ring);
+    vamana_close(&storage->diskann);
+    pthread_cond_destroy(&storage->commit_cond);
+    pthread_cond_destroy(&storage->pending_cond);
+    pthread_mutex_destroy(&storage->write_lock);
+    pthread_cond_destroy(&storage->publish_cond);
+    pthread_mutex_destroy(&storage->publish_lock);
+    free(storage);
+}
+
+static vdb_status_t recover_from_wal(vdb_storage_t *storage);
+static vdb_status_t checkpoint_locked(vdb_storage_t *storage);
+
+/**
+ * Open files, line the segments up with count and replay the WAL
+ * A checkpoint then makes the result durable and empties the WAL.
+*/
+static vdb_status_t attach_files(vdb_storage_t *storage) {
+    /* open segment files */
+    vdb_status_t status = open_segment_files(storage);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    /* cut back to the last checkpoint, then redo what the WAL has past it */
+    status = reconcile_segments(storage);
+    if (status == VDB_OK) {
+        status = recover_from_wal(storage);
+    }
+    /* the indexes start from the snapshot, if there is one that fits */
+    if (status == VDB_OK) {
+        status = storage_index_snap_open(storage);
+    }
+    /* replayed deletes need the ID index, and must reach ids.idx
+     * before the checkpoint drops them from the WAL */
+    if (status == VDB_OK) {
+        status = storage_ids_load(storage);
+    }
+    if (status == VDB_OK) {
+        status = checkpoint_locked(storage);
+    }
+    if (status != VDB_OK) {
+        close_segment_files(storage);
+    }
+    return status;
+}
+
+static vdb_status_t stop_group_commit(vdb_storage_t *storage);
+
+/**
+ * Reopen the segment files and WAL (compaction renamed new ones over them)
+*/
+vdb_status_t storage_reopen_segments(vdb_storage_t *storage) {
+    int codes_fd = storage->codes_fd;
+    storage->codes_fd = -1; // not replaced
+    close_segment_files(storage);
+    storage->codes_fd = codes_fd;
+    return open_segment_files(storage);
+}
+
+/**
+ * Rewrite the collection.meta superblock from the in-memory state
+ * Records the checkpointed count: rows past it may not be synced yet.
+*/
+vdb_status_t storage_write_meta(const vdb_storage_t *storage) {
+    char meta_path[MAX_PATH];
+    vdb_status_t status = build_file_path(storage->base_dir, storage->name, "collection.meta", meta_path);
+    if (status != VDB_OK) {
+        return status;
+    }
+    return storage_write_superblock(storage, meta_path, storage->checkpoint_count,
+                                    storage->checkpoint_metadata_bytes, storage->checkpoint_lsn,
+                                    storage->ids_saved_deletes);
+}
 
-   return VDB_OK;
+/**
+ * Write a superblock with the collection's settings and the given
+ * checkpoint to path
+*/
+vdb_status_t storage_write_superblock(const vdb_storage_t *storage, const char *path,
+                                      uint64_t count, uint64_t metadata_bytes, uint64_t next_lsn,
+                                      uint64_t deletes) {
+    superblock_t sb;
+    memset(&sb, 0, sizeof(sb));
+    sb.features = superblock_quantization_features(storage->quantization);
+    if (storage->row_layout == VDB_ROW_LAYOUT_PADDED) {
+        sb.features |= SUPERBLOCK_FEATURE_PADDED_ROWS;
+    }
+    sb.features |= superblock_element_features(storage->element);
+    sb.features |= superblock_normalize_features(storage->normalize);
+    sb.dim = storage->dim;
+    sb.metric = storage->metric;
+    sb.pq_subspaces = storage->pq_subspaces;
+    sb.count = count;
+    sb.metadata_bytes = metadata_bytes;
+    sb.next_lsn = next_lsn;
+    sb.deletes = deletes;
+    return superblock_write(path, &sb);
 }
 
 /** 
@@ -265,7 +655,7 @@ vdb_status_t vdb_storage_create(
     vdb_metric_t metric, 
     vdb_storage_t **out_storage
 ) {
-    if (base_dir == NULL | name == NULL || out_storage == NULL) {
+    if (base_dir == NULL || name == NULL || out_storage == NULL) {
         return VDB_ERROR_INVALID_ARGUMENT;
     }
 
@@ -277,7 +667,10 @@ vdb_status_t vdb_storage_create(
 
     /* check if collection already exists */
     char coll_path[MAX_PATH];
-    build_collection_path(base_dir, name, coll_path);
+    status = build_collection_path(base_dir, name, coll_path);
+    if (status != VDB_OK) {
+        return status;
+    }
 
     struct stat st;
     if (stat(coll_path, &st) == 0) {
@@ -296,45 +689,32 @@ vdb_status_t vdb_storage_create(
         return status;
     }
 
-    /* write metadata file */
-    char meta_path[MAX_PATH];
-    build_file_path(base_dir, name, "collection.meta", meta_path);
-    status = write_collection_meta(meta_path, dim, metric, 0);
-    if (status != VDB_OK) {
-        return status;
-    }
-
     /* Allocate storage structure */
-    vdb_storage_t *storage = (vdb_storage_t*)calloc(1, sizeof(vdb_storage_t));
+    vdb_storage_t *storage = alloc_storage(base_dir, name, dim, metric, 0);
     if (storage == NULL) {
         return VDB_ERROR_OUT_OF_MEMORY;
     }
 
-    /* init fields */
-    strncpy(storage->base_dir, base_dir, MAX_PATH - 1);
-    storage->base_dir[MAX_PATH - 1] = '\0';
-    strncpy(storage->name, name, VDB_COLLECTION_NAME_MAX_LEN - 1);
-    storage->name[VDB_COLLECTION_NAME_MAX_LEN - 1] = '\0';
-    storage->dim = dim;
-    storage->metric = metric;
-    storage->count = 0;
-    storage->embeddings_fd = -1;
-    storage->ids_fd = -1;
-    storage->metadata_fd = -1;
-    storage->wal_fd = -1;
-
-    /* open segment files */
-    status = open_segment_files(storage);
+    /* write superblock */
+    status = storage_write_meta(storage);
     if (status != VDB_OK) {
-        free(storage);
+        destroy_storage(storage);
         return status;
     }
 
-    /* recover from WAL if needed */
-    status = recover_from_wal(storage);
+    status = attach_files(storage);
+    if (status == VDB_OK) {
+        status = storage_filter_load(storage);
+        storage_index_snap_release(storage);
+        if (status == VDB_OK) {
+            status = storage_publish_locked(storage);
+        }
+        if (status != VDB_OK) {
+            close_segment_files(storage);
+        }
+    }
     if (status != VDB_OK) {
-        close_segment_files(storage);
-        free(storage);
+        destroy_storage(storage);
         return status;
     }
 
@@ -343,135 +723,1937 @@ vdb_status_t vdb_storage_create(
 }
 
 /** 
- * Close storage
+ * Open an existing collection from disk
 */
-void vdb_storage_close(vdb_storage_t **storage) {
-    if (storage == NULL || *storage == NULL) {
-        return;
+vdb_status_t vdb_storage_open(
+    const char *base_dir,
+    const char *name,
+    vdb_storage_t **out_storage
+) {
+    if (base_dir == NULL || name == NULL || out_storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
     }
 
-    vdb_storage_t *s = *storage;
-
-    /* flush and close files */
-    close_segment_files(s);
-
-    /* update metadata file with final cnt */
-    char meta_path[MAX_PATH];
-    build_file_path(s->base_dir, s->name, "collection.meta", meta_path);
-    write_collection_meta(meta_path, s->dim, s->metric, s->count);
-
-    free(s);
-    *storage = NULL;
-}
-
-/** 
- * Write WAL record
-*/
-static vdb_status_t write_wal_record(vdb_storage_t *storage, const vdb_item_t *item) {
-    /* build WAL record */
-    wal_record_header_t header;
-    header.type = WAL_RECORD_APPEND;
-    header.id_len = (uint32_t)strlen(item->id);
-    header.vector_dim = item->vector.dim;
-    header.metadata_len = item->metadata ? (uint32_t)strlen(item->metadata) : 0;
+    char coll_path[MAX_PATH];
+    if (build_collection_path(base_dir, name, coll_path) != VDB_OK) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
 
-    // write header
-    if (write(storage->wal_fd, &header, sizeof(header)) != sizeof(header)) {
-        return VDB_ERROR_IO;
+    struct stat st;
+    if (stat(coll_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return VDB_ERROR_NOT_FOUND;
     }
 
-    // write ID
-    if (write(storage->wal_fd, item->id, header.id_len) != (ssize_t)header.id_len) {
-        return VDB_ERROR_IO;
+    /* finish a compaction swap a crash interrupted */
+    vdb_status_t status = storage_compact_recover(base_dir, name);
+    if (status != VDB_OK) {
+        return status;
     }
 
-    // write vector
-    size_t vector_bytes = item->vector.dim * sizeof(float);
-    if (write(storage->wal_fd, item->vector.data, vector_bytes) != (ssize_t)vector_bytes) {
-        return VDB_ERROR_IO;
+    /* load metadata */
+    char meta_path[MAX_PATH];
+    status = build_file_path(base_dir, name, "collection.meta", meta_path);
+    if (status != VDB_OK) {
+        return status;
     }
 
-    // write metadata if present
-    if (header.metadata_len > 0) {
-        if (write(storage->wal_fd, item->metadata, header.metadata_len) != (ssize_t)header.metadata_len) {
-            return VDB_ERROR_IO;
-        }
+    superblock_t sb;
+    status = superblock_read(meta_path, &sb);
+    if (status != VDB_OK) {
+        return status;
     }
 
-    // fsync WAL (for durability)
-    if (fsync(storage->wal_fd) != 0) {
-        return VDB_ERROR_IO;
+    vdb_storage_t *storage = alloc_storage(base_dir, name, sb.dim, sb.metric, sb.count);
+    if (storage == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    storage->quantization = superblock_quantization(sb.features);
+    set_row_format(storage, (sb.features & SUPERBLOCK_FEATURE_PADDED_ROWS) ? VDB_ROW_LAYOUT_PADDED
+                                                                           : VDB_ROW_LAYOUT_PACKED,
+                   superblock_element(sb.features));
+    storage->normalize = superblock_normalize(sb.features);
+    storage->pq_subspaces = sb.pq_subspaces;
+    storage->checkpoint_lsn = sb.next_lsn;
+    storage->next_lsn = sb.next_lsn;
+    storage->ids_saved_deletes = sb.deletes;
+    storage->checkpoint_metadata_bytes = sb.metadata_bytes;
+
+    status = attach_files(storage);
+    if (status != VDB_OK) {
+        destroy_storage(storage);
+        return status;
+    }
+
+    /* map what we have now; appends grow the mappings on demand */
+    status = ensure_mapped(storage);
+    if (status == VDB_OK) {
+        status = storage_filter_load(storage);
+    }
+    storage_index_snap_release(storage);
+    if (status == VDB_OK) {
+        status = storage_quant_load(storage);
+    }
+    if (status == VDB_OK) {
+        status = storage_publish_locked(storage); // before the sealer can start
+    }
+    if (status == VDB_OK) {
+        status = storage_index_load(storage);
+    }
+    if (status == VDB_OK) {
+        status = storage_diskann_load(storage);
+    }
+    if (status != VDB_OK) {
+        close_segment_files(storage);
+        destroy_storage(storage);
+        return status;
     }
 
+    *out_storage = storage;
     return VDB_OK;
 }
 
 /** 
- * Append item to storage
+ * Close storage
 */
-vdb_status_t vdb_storage_append(
-    vdb_storage_t *storage,
-    const vdb_item_t *item
-) {
-    if (storage == NULL || item == NULL) {
-        return VDB_ERROR_INVALID_ARGUMENT;
+void vdb_storage_close(vdb_storage_t **storage) {
+    if (storage == NULL || *storage == NULL) {
+        return;
+    }
+
+    vdb_storage_t *s = *storage;
+
+    /* no seal or compaction may swap files under us from here on; the
+     * sealer goes first so the compactor isn't left waiting on it */
+    storage_index_stop(s);
+    storage_compact_stop(s);
+
+    /* flush pending group commits before the fds go away */
+    stop_group_commit(s);
+
+    /* persist the index so the next open doesn't rebuild it */
+    storage_index_save(s);
+
+    /* sync segments, record the final count, empty the WAL; if this
+     * fails the next open replays the WAL instead. The index snapshot
+     * spares the next open rebuilding the ID and filter indexes. After
+     * a failed commit nothing is recorded: the next open's replay
+     * decides which of the unsynced rows survived. */
+    pthread_mutex_lock(&s->write_lock);
+    if (s->commit_error == VDB_OK) {
+        storage_ids_save(s, true);
+        checkpoint_locked(s);
+        storage_index_snap_save(s);
+    }
+    pthread_mutex_unlock(&s->write_lock);
+
+    close_segment_files(s);
+
+    destroy_storage(s);
+    *storage = NULL;
+}
+
+/**
+ * Growable byte buffer used to stage WAL frames and segment writes
+ * so each file gets a single write() per append/batch
+ * With an arena the memory is the caller's to rewind; reserve the full
+ * size up front there, since a grown buffer leaves the old copy behind.
+*/
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    vdb_arena_t *arena; // NULL = malloc'd
+} byte_buffer_t;
+
+static vdb_status_t buffer_reserve(byte_buffer_t *buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) {
+        return VDB_OK;
+    }
+
+    size_t new_cap = buf->cap ? buf->cap : 4096;
+    while (new_cap < buf->len + extra) {
+        new_cap *= 2;
+    }
+
+    uint8_t *data = NULL;
+    if (buf->arena != NULL) {
+        data = (uint8_t*)vdb_arena_alloc(buf->arena, new_cap);
+        if (data != NULL && buf->len > 0) {
+            memcpy(data, buf->data, buf->len);
+        }
+    } else {
+        data = (uint8_t*)realloc(buf->data, new_cap);
+    }
+    if (data == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    buf->data = data;
+    buf->cap = new_cap;
+    return VDB_OK;
+}
+
+static vdb_status_t buffer_append(byte_buffer_t *buf, const void *src, size_t len) {
+    vdb_status_t status = buffer_reserve(buf, len);
+    if (status != VDB_OK) {
+        return status;
+    }
+    if (len > 0) {
+        memcpy(buf->data + buf->len, src, len);
+        buf->len += len;
+    }
+    return VDB_OK;
+}
+
+static void buffer_free(byte_buffer_t *buf) {
+    if (buf->arena == NULL) {
+        free(buf->data);
+    }
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+/**
+ * Write a whole buffer, retrying on short writes and EINTR
+*/
+static vdb_status_t write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return VDB_ERROR_IO;
+        }
+        p += n;
+        len -= (size_t)n;
     }
+    return VDB_OK;
+}
 
+/**
+ * Validate an item against the collection before anything is written
+*/
+static vdb_status_t validate_item(const vdb_storage_t *storage, const vdb_item_t *item) {
     // validate dimension
     if (item->vector.dim != storage->dim) {
         return VDB_ERROR_DIMENSION_MISMATCH;
     }
 
+    if (item->vector.data == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
     // validate ID
     if (!vdb_id_is_valid(item->id)) {
         return VDB_ERROR_INVALID_ARGUMENT;
     }
 
-    // step1: write to WAL and fsync
-    vdb_status_t status = write_wal_record(storage, item);
+    return VDB_OK;
+}
+
+/** 
+ * Encode a WAL append record (header + id + vector + metadata) into buf
+*/
+static vdb_status_t encode_wal_record(byte_buffer_t *buf, const vdb_item_t *item) {
+    wal_record_header_t header;
+    header.id_len = (uint32_t)strlen(item->id);
+    header.vector_dim = item->vector.dim;
+    header.metadata_len = item->metadata ? (uint32_t)strlen(item->metadata) : 0;
+
+    size_t vector_bytes = item->vector.dim * sizeof(float);
+    vdb_status_t status = buffer_reserve(buf, sizeof(header) + header.id_len +
+                                              vector_bytes + header.metadata_len);
     if (status != VDB_OK) {
-        return status;;
+        return status;
     }
 
-    // step2: write to embeddings segment
-    size_t vector_bytes = storage->dim * sizeof(float);
-    if (write(storage->embeddings_fd, item->vector.data, vector_bytes) != (ssize_t)vector_bytes) {
-        return VDB_ERROR_IO;
+    buffer_append(buf, &header, sizeof(header));
+    buffer_append(buf, item->id, header.id_len);
+    buffer_append(buf, item->vector.data, vector_bytes);
+    buffer_append(buf, item->metadata, header.metadata_len);
+    return VDB_OK;
+}
+
+/**
+ * Encode the WAL frame for n items into buf, leaving lsn, first_row and
+ * crc for seal_wal_frame (they are only known under write_lock)
+ * payload_crc gets the CRC32C of the records.
+*/
+static vdb_status_t encode_wal_frame(byte_buffer_t *buf, const vdb_item_t *items, size_t n,
+                                     uint32_t *payload_crc) {
+    size_t size = sizeof(wal_frame_header_t);
+    for (size_t i = 0; i < n; i++) {
+        size += sizeof(wal_record_header_t) + strlen(items[i].id) + items[i].vector.dim * sizeof(float) +
+            (items[i].metadata ? strlen(items[i].metadata) : 0);
+    }
+    wal_frame_header_t header = {0};
+    vdb_status_t status = buffer_reserve(buf, size);
+    if (status == VDB_OK) {
+        status = buffer_append(buf, &header, sizeof(header));
+    }
+    for (size_t i = 0; i < n && status == VDB_OK; i++) {
+        status = encode_wal_record(buf, &items[i]);
+    }
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    header.type = WAL_FRAME_APPEND;
+    header.num_records = (uint32_t)n;
+    header.payload_len = (uint64_t)(buf->len - sizeof(header));
+    memcpy(buf->data, &header, sizeof(header));
+    *payload_crc = crc32c(0, buf->data + sizeof(header), (size_t)header.payload_len);
+    return VDB_OK;
+}
+
+/* CRC of a frame: payload first, then the header after the crc field */
+static uint32_t wal_frame_crc(const wal_frame_header_t *header, uint32_t payload_crc) {
+    return crc32c(payload_crc, (const uint8_t*)header + sizeof(header->crc),
+                  sizeof(*header) - sizeof(header->crc));
+}
+
+static void seal_wal_frame(byte_buffer_t *buf, uint32_t payload_crc, uint64_t lsn, uint64_t first_row) {
+    wal_frame_header_t header;
+    memcpy(&header, buf->data, sizeof(header));
+    header.lsn = lsn;
+    header.first_row = first_row;
+    header.crc = wal_frame_crc(&header, payload_crc);
+    memcpy(buf->data, &header, sizeof(header));
+}
+
+/**
+ * Write n items to the segment files, one write per segment, behind
+ * their WAL frame if there is one (replay has none)
+ * sync also fsyncs the WAL. Without a ring every write runs in turn;
+ * with one the whole lot is a single batch: the WAL write and its fsync
+ * are linked, the segment writes overlap them. That's safe because a
+ * crash before the fsync loses the frame, and reconcile trims segment
+ * rows past the checkpoint that replay doesn't rewrite.
+*/
+static vdb_status_t write_segments(vdb_storage_t *storage, const byte_buffer_t *wal, bool sync,
+                                   const vdb_item_t *items, size_t n) {
+    static const uint8_t zeros[VDB_ROW_ALIGN] = { 0 };
+    size_t vector_bytes = storage->dim * vdb_element_size(storage->element);
+    size_t pad_bytes = storage->row_bytes - vector_bytes;
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    byte_buffer_t embeddings = { NULL, 0, 0, arena };
+    byte_buffer_t ids = { NULL, 0, 0, arena };
+    byte_buffer_t metadata = { NULL, 0, 0, arena };
+    byte_buffer_t norms = { NULL, 0, 0, arena };
+    float *unit = NULL;
+
+    size_t metadata_size = 0;
+    for (size_t i = 0; i < n; i++) {
+        metadata_size += sizeof(uint32_t) + (items[i].metadata ? strlen(items[i].metadata) : 0);
+    }
+    vdb_status_t status = buffer_reserve(&embeddings, n * storage->row_bytes);
+    if (status == VDB_OK) {
+        status = buffer_reserve(&ids, n * VDB_ID_MAX_LEN);
+    }
+    if (status == VDB_OK) {
+        status = buffer_reserve(&metadata, metadata_size);
+    }
+    if (status == VDB_OK && storage->normalize != VDB_NORMALIZE_NONE) {
+        unit = (float*)vdb_arena_alloc_aligned(arena, storage->dim * sizeof(float), VDB_VECTOR_ALIGN);
+        status = unit != NULL ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+    }
+    if (status == VDB_OK && storage->normalize == VDB_NORMALIZE_KEEP_NORMS) {
+        status = buffer_reserve(&norms, n * sizeof(float));
+    }
+
+    for (size_t i = 0; i < n && status == VDB_OK; i++) {
+        const vdb_item_t *item = &items[i];
+        const float *vector = item->vector.data;
+        if (unit != NULL) {
+            memcpy(unit, vector, storage->dim * sizeof(float));
+            float norm = vdb_normalize(unit, storage->dim);
+            if (storage->normalize == VDB_NORMALIZE_KEEP_NORMS) {
+                buffer_append(&norms, &norm, sizeof(norm));
+            }
+            vector = unit;
+        }
+
+        // embeddings segment, narrowed in place (reserved above)
+        vdb_convert_from_f32(storage->element, vector, embeddings.data + embeddings.len, storage->dim);
+        embeddings.len += vector_bytes;
+        buffer_append(&embeddings, zeros, pad_bytes);
+
+        // IDs segment - fixed 64 bytes
+        vdb_id_t padded_id;
+        memset(padded_id, 0, VDB_ID_MAX_LEN);
+        vdb_id_copy(item->id, padded_id);
+        buffer_append(&ids, padded_id, VDB_ID_MAX_LEN);
+
+        // metadata segment (length-prefixed)
+        uint32_t metadata_len = item->metadata ? (uint32_t)strlen(item->metadata) : 0;
+        status = buffer_append(&metadata, &metadata_len, sizeof(metadata_len));
+        if (status == VDB_OK) {
+            status = buffer_append(&metadata, item->metadata, metadata_len);
+        }
+    }
+
+    aio_op_t ops[6];
+    size_t num_ops = 0;
+    if (wal != NULL) {
+        ops[num_ops++] = (aio_op_t){ AIO_WRITE, storage->wal_fd, wal->data, wal->len, sync, NULL, 0 };
+        if (sync) {
+            ops[num_ops++] = (aio_op_t){ AIO_FSYNC, storage->wal_fd, NULL, 0, false, NULL, 0 };
+        }
+    }
+    size_t wal_ops = num_ops;
+    ops[num_ops++] = (aio_op_t){ AIO_WRITE, storage->embeddings_fd, embeddings.data, embeddings.len, false, NULL, 0 };
+    ops[num_ops++] = (aio_op_t){ AIO_WRITE, storage->ids_fd, ids.data, ids.len, false, NULL, 0 };
+    ops[num_ops++] = (aio_op_t){ AIO_WRITE, storage->metadata_fd, metadata.data, metadata.len, false, NULL, 0 };
+    if (storage->norms_fd >= 0) {
+        ops[num_ops++] = (aio_op_t){ AIO_WRITE, storage->norms_fd, norms.data, norms.len, false, NULL, 0 };
+    }
+
+    // blocking, the WAL goes first on its own so the fsync is timed alone
+    uint64_t sync_start = stats_now_ns();
+    size_t first = storage->ring == NULL ? wal_ops : 0;
+    if (status == VDB_OK && first > 0) {
+        status = aio_run(NULL, ops, first);
+    }
+    if (status == VDB_OK && storage->ring == NULL && sync) {
+        stats_add(storage->stats, STATS_WAL_FSYNCS, 1);
+        stats_record_since(storage->stats, STATS_WAL_FSYNC_LATENCY, sync_start);
+    }
+    if (status == VDB_OK) {
+        status = aio_run(storage->ring, ops + first, num_ops - first);
+    }
+    if (status == VDB_OK && storage->ring != NULL && sync) {
+        stats_add(storage->stats, STATS_WAL_FSYNCS, 1);
+        stats_record_since(storage->stats, STATS_WAL_FSYNC_LATENCY, sync_start);
+    }
+    if (status == VDB_OK) {
+        if (wal != NULL) {
+            storage->wal_bytes += wal->len;
+            stats_add(storage->stats, STATS_BYTES_WAL, wal->len);
+        }
+        storage->metadata_bytes += metadata.len;
+        stats_add(storage->stats, STATS_BYTES_EMBEDDINGS, embeddings.len);
+        stats_add(storage->stats, STATS_BYTES_IDS, ids.len);
+        stats_add(storage->stats, STATS_BYTES_METADATA, metadata.len);
+        stats_add(storage->stats, STATS_BYTES_NORMS, norms.len);
     }
 
-    // step 3: write to IDs semgent - fixed 64 bytes
-    vdb_id_t padded_id;
-    memset(padded_id, 0, VDB_ID_MAX_LEN);
-    vdb_id_copy(item->id, padded_id);
-    if (write(storage->ids_fd, padded_id, VDB_ID_MAX_LEN) != VDB_ID_MAX_LEN) {
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+/**
+ * fsync the WAL, timing it for the stats
+*/
+static vdb_status_t sync_wal(vdb_storage_t *storage) {
+    uint64_t start = stats_now_ns();
+    if (fsync(storage->wal_fd) != 0) {
         return VDB_ERROR_IO;
     }
+    stats_add(storage->stats, STATS_WAL_FSYNCS, 1);
+    stats_record_since(storage->stats, STATS_WAL_FSYNC_LATENCY, start);
+    return VDB_OK;
+}
 
-    // step4 : write to metadata segment (length-prefixed)
-    uint32_t metadata_len = item->metadata ? (uint32_t)strlen(item->metadata) : 0;
-    if (write(storage->metadata_fd, &metadata_len, sizeof(metadata_len)) != sizeof(metadata_len)) {
+/**
+ * fsync all segment files (all at once with a ring)
+*/
+static vdb_status_t sync_segments(vdb_storage_t *storage) {
+    aio_op_t ops[4] = {
+        { AIO_FSYNC, storage->embeddings_fd, NULL, 0, false, NULL, 0 },
+        { AIO_FSYNC, storage->ids_fd, NULL, 0, false, NULL, 0 },
+        { AIO_FSYNC, storage->metadata_fd, NULL, 0, false, NULL, 0 },
+        { AIO_FSYNC, storage->norms_fd, NULL, 0, false, NULL, 0 }
+    };
+    return aio_run(storage->ring, ops, storage->norms_fd >= 0 ? 4 : 3);
+}
+
+/**
+ * fsync the collection directory, so renames and new files stick
+*/
+static vdb_status_t sync_collection_dir(const vdb_storage_t *storage) {
+    char path[MAX_PATH];
+    if (build_collection_path(storage->base_dir, storage->name, path) != VDB_OK) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         return VDB_ERROR_IO;
     }
+    vdb_status_t status = fsync(fd) == 0 ? VDB_OK : VDB_ERROR_IO;
+    close(fd);
+    return status;
+}
 
-    if (metadata_len > 0) {
-        if (write(storage->metadata_fd, item->metadata, metadata_len) != (ssize_t)metadata_len) {
-            return VDB_ERROR_IO;
+/**
+ * Checkpoint: sync the segments, record count, empty the WAL
+ * Every row written so far is durable afterwards, whether or not its
+ * WAL frame was. Refused after a failed group commit, which left rows
+ * nobody knows the fate of. Caller must hold write_lock
+*/
+static vdb_status_t checkpoint_locked(vdb_storage_t *storage) {
+    if (storage->commit_error != VDB_OK) {
+        return storage->commit_error;
+    }
+    if (storage->checkpoint_count == storage->count && storage->wal_bytes == 0) {
+        return VDB_OK;
+    }
+
+    vdb_status_t status = sync_segments(storage);
+    if (status == VDB_OK) {
+        // the WAL is the only other copy of recent deletes
+        status = storage_ids_save(storage, false);
+    }
+    if (status == VDB_OK) {
+        uint64_t previous = storage->checkpoint_count;
+        uint64_t previous_metadata = storage->checkpoint_metadata_bytes;
+        uint64_t previous_lsn = storage->checkpoint_lsn;
+        storage->checkpoint_count = storage->count;
+        storage->checkpoint_metadata_bytes = storage->metadata_bytes;
+        storage->checkpoint_lsn = storage->next_lsn;
+        status = storage_write_meta(storage);
+        if (status == VDB_OK) {
+            status = sync_collection_dir(storage);
         }
+        if (status != VDB_OK) {
+            storage->checkpoint_count = previous;
+            storage->checkpoint_metadata_bytes = previous_metadata;
+            storage->checkpoint_lsn = previous_lsn;
+        }
+    }
+    // only once the count it records is durable; a failure leaves the
+    // previous snapshot, which costs a longer catch-up on open
+    if (status == VDB_OK) {
+        storage_index_snap_save(storage);
     }
 
-    // step5 - fsync all segments
-    if (fsync(storage->embeddings_fd) != 0 ||
-        fsync(storage->ids_fd) != 0 ||
-        fsync(storage->metadata_fd) != 0) {
-        return VDB_ERROR_IO;
+    // frames the checkpoint covers are skipped on replay, so a failed
+    // truncate only costs a longer WAL
+    if (status == VDB_OK && ftruncate(storage->wal_fd, 0) == 0) {
+        storage->wal_bytes = 0;
+    }
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_CHECKPOINTS, 1);
+    }
+    return status;
+}
+
+/**
+ * Make the WAL durable, checkpointing once it has grown large enough
+ * sync is false when the WAL was already fsync'd by the appender
+ * Caller must hold write_lock
+*/
+static vdb_status_t commit_locked(vdb_storage_t *storage, bool sync) {
+    if (sync) {
+        vdb_status_t status = sync_wal(storage);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+
+    // the rows are durable through the WAL already; a failed checkpoint
+    // is retried on the next commit
+    if (storage->wal_bytes >= storage->checkpoint_bytes) {
+        checkpoint_locked(storage);
+    }
+    return VDB_OK;
+}
+
+/**
+ * Undo a partly written append: cut every file back to where it started
+*/
+static void rollback_append(vdb_storage_t *storage, uint64_t wal_start, uint64_t metadata_start) {
+    if (ftruncate(storage->embeddings_fd, (off_t)(storage->count * storage->row_bytes)) != 0 ||
+        ftruncate(storage->ids_fd, (off_t)(storage->count * VDB_ID_MAX_LEN)) != 0 ||
+        ftruncate(storage->metadata_fd, (off_t)metadata_start) != 0 ||
+        ftruncate(storage->wal_fd, (off_t)wal_start) != 0 ||
+        (storage->norms_fd >= 0 && ftruncate(storage->norms_fd, (off_t)(storage->count * sizeof(float))) != 0)) {
+        // leftovers are trimmed by reconcile / rejected by replay on open
+    }
+    storage->metadata_bytes = metadata_start;
+    storage->wal_bytes = wal_start;
+}
+
+/**
+ * pread a whole range, false on EOF or error
+*/
+static bool read_exact(int fd, void *data, size_t len, uint64_t offset) {
+    uint8_t *p = (uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+/**
+ * Re-apply one checksummed frame's records past count
+ * Returns VDB_ERROR_CORRUPTED if the records don't parse, which the
+ * caller treats like a torn frame.
+*/
+static vdb_status_t replay_frame(vdb_storage_t *storage, const wal_frame_header_t *header,
+                                 const uint8_t *payload) {
+    uint64_t skip = storage->count - header->first_row; // already in the segments
+    if (skip >= header->num_records) {
+        return VDB_OK;
+    }
+
+    size_t n = header->num_records;
+    size_t vector_bytes = storage->dim * sizeof(float);
+    vdb_item_t *items = (vdb_item_t*)calloc(n, sizeof(vdb_item_t));
+    float *vectors = (float*)malloc(n * vector_bytes);
+    char *metadata = (char*)malloc((size_t)header->payload_len + n); // one terminator each
+    if (items == NULL || vectors == NULL || metadata == NULL) {
+        free(items);
+        free(vectors);
+        free(metadata);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    vdb_status_t status = VDB_OK;
+    uint64_t pos = 0;
+    char *meta_out = metadata;
+    for (size_t i = 0; i < n && status == VDB_OK; i++) {
+        wal_record_header_t rec;
+        if (header->payload_len - pos < sizeof(rec)) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        memcpy(&rec, payload + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (rec.id_len == 0 || rec.id_len >= VDB_ID_MAX_LEN || rec.vector_dim != storage->dim ||
+            header->payload_len - pos < (uint64_t)rec.id_len + vector_bytes + rec.metadata_len) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+
+        vdb_item_t *item = &items[i];
+        memcpy(item->id, payload + pos, rec.id_len);
+        item->id[rec.id_len] = '\0';
+        pos += rec.id_len;
+        item->vector.dim = rec.vector_dim;
+        item->vector.data = vectors + i * storage->dim;
+        memcpy(item->vector.data, payload + pos, vector_bytes);
+        pos += vector_bytes;
+        if (rec.metadata_len > 0) {
+            memcpy(meta_out, payload + pos, rec.metadata_len);
+            meta_out[rec.metadata_len] = '\0';
+            item->metadata = meta_out;
+            meta_out += rec.metadata_len + 1;
+            pos += rec.metadata_len;
+        }
+    }
+    if (status == VDB_OK && pos != header->payload_len) {
+        status = VDB_ERROR_CORRUPTED;
     }
 
-    // step6: increement count
-    storage->count++;
+    if (status == VDB_OK) {
+        status = write_segments(storage, NULL, false, items + skip, n - (size_t)skip);
+    }
+    if (status == VDB_OK) {
+        storage->count += n - skip;
+    }
+
+    free(items);
+    free(vectors);
+    free(metadata);
+    return status;
+}
 
-    // step7 - truncate WAL (record is committed now)
-    if (ftruncate(storage->wal_fd, 0) != 0) {
-        // non fatal, we can recover on next open
+/**
+ * Collect the rows of a checksummed delete frame
+ * Returns VDB_ERROR_CORRUPTED if the records don't parse.
+*/
+static vdb_status_t replay_deletes(vdb_storage_t *storage, const wal_frame_header_t *header,
+                                   const uint8_t *payload) {
+    size_t n = header->num_records;
+    if (header->payload_len != (uint64_t)n * sizeof(uint64_t)) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    if (n == 0) {
+        return VDB_OK;
+    }
+    uint64_t *rows = (uint64_t*)realloc(storage->replayed_deletes,
+        (storage->num_replayed_deletes + n) * sizeof(uint64_t));
+    if (rows == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    storage->replayed_deletes = rows;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t row;
+        memcpy(&row, payload + i * sizeof(row), sizeof(row));
+        if (row >= header->first_row) {
+            return VDB_ERROR_CORRUPTED; // deletes only name rows before them
+        }
+        rows[storage->num_replayed_deletes + i] = row;
     }
+    storage->num_replayed_deletes += n;
     return VDB_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * Replay the WAL over the segments (open path)
+ *
+ * count is the last checkpoint and the segments were already cut back
+ * to it. Each frame records the row it starts at: frames the checkpoint
+ * covers are skipped, the rest re-applied in order. Replay stops at the
+ * first frame that is torn, fails its CRC or doesn't continue the LSN
+ * and row sequence - nothing after it was acknowledged. Deleted rows
+ * are collected for storage_ids_load; applying a delete twice is
+ * harmless, so they aren't skipped by row like appends.
+*/
+static vdb_status_t recover_from_wal(vdb_storage_t *storage) {
+    off_t wal_size = lseek(storage->wal_fd, 0, SEEK_END);
+    if (wal_size < 0) {
+        return VDB_ERROR_IO;
+    }
+    storage->wal_bytes = (uint64_t)wal_size;
+    if (wal_size == 0) {
+        return VDB_OK; // no recov needed
+    }
+
+    byte_buffer_t payload = {0};
+    vdb_status_t status = VDB_OK;
+    uint64_t offset = 0;
+    uint64_t frames = 0;
+    uint64_t next_lsn = 0;
+    uint64_t next_row = 0;
+
+    while (status == VDB_OK) {
+        wal_frame_header_t header;
+        if ((uint64_t)wal_size - offset < sizeof(header) ||
+            !read_exact(storage->wal_fd, &header, sizeof(header), offset)) {
+            break;
+        }
+        offset += sizeof(header);
+
+        if ((header.type != WAL_FRAME_APPEND && header.type != WAL_FRAME_DELETE) ||
+            header.payload_len > (uint64_t)wal_size - offset) {
+            break;
+        }
+        payload.len = 0;
+        status = buffer_reserve(&payload, (size_t)header.payload_len);
+        if (status != VDB_OK) {
+            break;
+        }
+        if (!read_exact(storage->wal_fd, payload.data, (size_t)header.payload_len, offset) ||
+            wal_frame_crc(&header, crc32c(0, payload.data, (size_t)header.payload_len)) != header.crc) {
+            break;
+        }
+        offset += header.payload_len;
+
+        if (frames > 0 && (header.lsn != next_lsn || header.first_row != next_row)) {
+            break; // not a continuation of the frames before it
+        }
+        if (header.first_row > storage->count) {
+            status = VDB_ERROR_CORRUPTED; // rows between the checkpoint and this frame are gone
+            break;
+        }
+
+        status = header.type == WAL_FRAME_DELETE
+            ? replay_deletes(storage, &header, payload.data)
+            : replay_frame(storage, &header, payload.data);
+        if (status == VDB_ERROR_CORRUPTED) {
+            status = VDB_OK;
+            break;
+        }
+        frames++;
+        next_lsn = header.lsn + 1;
+        next_row = header.first_row + (header.type == WAL_FRAME_APPEND ? header.num_records : 0);
+    }
+    buffer_free(&payload);
+
+    if (status == VDB_OK && frames > 0 && next_lsn > storage->next_lsn) {
+        storage->next_lsn = next_lsn;
+    }
+    return status;
+}
+
+/**
+ * Background committer for group commit mode
+ * Sleeps until an append is pending, waits out the commit window so
+ * concurrent appends can pile up, then syncs them all at once
+*/
+static void *group_commit_main(void *arg) {
+    vdb_storage_t *storage = (vdb_storage_t*)arg;
+
+    pthread_mutex_lock(&storage->write_lock);
+    for (;;) {
+        while (!storage->commit_stop && storage->written_seq == storage->durable_seq) {
+            pthread_cond_wait(&storage->pending_cond, &storage->write_lock);
+        }
+        if (storage->written_seq == storage->durable_seq) {
+            break; // stopping, nothing left to flush
+        }
+
+        // let more appends join this group
+        if (!storage->commit_stop && storage->group_commit_window_us > 0) {
+            pthread_mutex_unlock(&storage->write_lock);
+            struct timespec ts;
+            ts.tv_sec = storage->group_commit_window_us / 1000000;
+            ts.tv_nsec = (long)(storage->group_commit_window_us % 1000000) * 1000;
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&storage->write_lock);
+        }
+
+        // fsync without write_lock, so neither readers that take it nor
+        // the writers of the next group wait the sync out; layout_lock
+        // keeps a compaction from swapping the WAL and renumbering the
+        // rows meanwhile. Once a sync failed, later ones prove nothing:
+        // the kernel may have dropped the pages that failed.
+        pthread_mutex_unlock(&storage->write_lock);
+        pthread_rwlock_rdlock(&storage->layout_lock);
+        pthread_mutex_lock(&storage->write_lock);
+        uint64_t target = storage->written_seq;
+        uint64_t target_count = storage->count;
+        vdb_status_t status = storage->commit_error;
+        if (status == VDB_OK) {
+            pthread_mutex_unlock(&storage->write_lock);
+            status = sync_wal(storage);
+            pthread_mutex_lock(&storage->write_lock);
+        }
+        if (status == VDB_OK) {
+            status = commit_locked(storage, false); // checkpoint if due
+        }
+        if (status != VDB_OK) {
+            pthread_mutex_lock(&storage->publish_lock);
+            storage->commit_error = status;
+            pthread_cond_broadcast(&storage->publish_cond);
+            pthread_mutex_unlock(&storage->publish_lock);
+        } else if (storage->unsynced_row < target_count) {
+            // rows past target_count came after the sync; they wait for the next one
+            storage->unsynced_row = storage->count > target_count ? target_count : UINT64_MAX;
+            storage_publish_locked(storage);
+        }
+        storage->durable_seq = target;
+        pthread_cond_broadcast(&storage->commit_cond);
+        pthread_rwlock_unlock(&storage->layout_lock);
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return NULL;
+}
+
+/** 
+ * Stop the group committer (flushing anything pending)
+ * Caller must NOT hold write_lock
+*/
+static vdb_status_t stop_group_commit(vdb_storage_t *storage) {
+    pthread_mutex_lock(&storage->write_lock);
+    if (!storage->commit_thread_running) {
+        pthread_mutex_unlock(&storage->write_lock);
+        return VDB_OK;
+    }
+    storage->commit_stop = true;
+    pthread_cond_signal(&storage->pending_cond);
+    pthread_mutex_unlock(&storage->write_lock);
+
+    pthread_join(storage->commit_thread, NULL);
+
+    pthread_mutex_lock(&storage->write_lock);
+    storage->commit_thread_running = false;
+    storage->commit_stop = false;
+    storage->group_commit_window_us = 0;
+    vdb_status_t status = storage->commit_error;
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/** 
+ * Configure group commit
+*/
+vdb_status_t vdb_storage_set_group_commit(vdb_storage_t *storage, uint32_t window_us) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (window_us == 0) {
+        return stop_group_commit(storage);
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    storage->group_commit_window_us = window_us;
+    if (!storage->commit_thread_running) {
+        if (pthread_create(&storage->commit_thread, NULL, group_commit_main, storage) != 0) {
+            storage->group_commit_window_us = 0;
+            pthread_mutex_unlock(&storage->write_lock);
+            return VDB_ERROR_UNKNOWN;
+        }
+        storage->commit_thread_running = true;
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return VDB_OK;
+}
+
+/**
+ * Switch the write path between blocking I/O and io_uring
+*/
+vdb_status_t vdb_storage_set_io_backend(vdb_storage_t *storage, vdb_io_backend_t backend) {
+    if (storage == NULL || (backend != VDB_IO_BLOCKING && backend != VDB_IO_URING)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = VDB_OK;
+    if (backend == VDB_IO_BLOCKING) {
+        aio_ring_free(&storage->ring);
+    } else if (storage->ring == NULL) {
+        status = aio_ring_create(&storage->ring);
+    }
+    if (storage->diskann != NULL) {
+        vamana_set_uring(storage->diskann, storage->ring != NULL);
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+vdb_io_backend_t vdb_storage_get_io_backend(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return VDB_IO_BLOCKING;
+    }
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_io_backend_t backend = storage->ring != NULL ? VDB_IO_URING : VDB_IO_BLOCKING;
+    pthread_mutex_unlock(&storage->write_lock);
+    return backend;
+}
+
+/**
+ * Checkpoint on demand
+*/
+vdb_status_t vdb_storage_checkpoint(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = checkpoint_locked(storage);
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Set the WAL size that triggers a checkpoint
+*/
+vdb_status_t vdb_storage_set_checkpoint_bytes(vdb_storage_t *storage, uint64_t bytes) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    storage->checkpoint_bytes = bytes;
+    pthread_mutex_unlock(&storage->write_lock);
+    return VDB_OK;
+}
+
+/**
+ * Set the row layout; only while nothing depends on the old row size
+*/
+vdb_status_t vdb_storage_set_row_layout(vdb_storage_t *storage, vdb_row_layout_t layout) {
+    if (storage == NULL || (layout != VDB_ROW_LAYOUT_PACKED && layout != VDB_ROW_LAYOUT_PADDED)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = VDB_OK;
+    if (layout != storage->row_layout) {
+        if (storage->count > 0 || storage->hnsw_enabled) {
+            status = VDB_ERROR_INVALID_ARGUMENT;
+        } else {
+            vdb_row_layout_t old = storage->row_layout;
+            set_row_format(storage, layout, storage->element);
+            status = storage_write_meta(storage);
+            if (status != VDB_OK) {
+                set_row_format(storage, old, storage->element);
+            }
+        }
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+vdb_row_layout_t vdb_storage_get_row_layout(const vdb_storage_t *storage) {
+    return storage != NULL ? storage->row_layout : VDB_ROW_LAYOUT_PACKED;
+}
+
+/**
+ * Set the element type; same conditions as the row layout, and no
+ * quantization (the codecs train on float32 rows)
+*/
+vdb_status_t vdb_storage_set_element_type(vdb_storage_t *storage, vdb_element_type_t type) {
+    if (storage == NULL || vdb_element_size(type) == 0) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = VDB_OK;
+    if (type != storage->element) {
+        if (storage->count > 0 || storage->hnsw_enabled ||
+            (type != VDB_ELEMENT_F32 && storage->quantization != VDB_QUANTIZATION_NONE)) {
+            status = VDB_ERROR_INVALID_ARGUMENT;
+        } else {
+            vdb_element_type_t old = storage->element;
+            set_row_format(storage, storage->row_layout, type);
+            status = storage_write_meta(storage);
+            if (status != VDB_OK) {
+                set_row_format(storage, storage->row_layout, old);
+            }
+        }
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+vdb_element_type_t vdb_storage_get_element_type(const vdb_storage_t *storage) {
+    return storage != NULL ? storage->element : VDB_ELEMENT_F32;
+}
+
+/**
+ * Set the normalization; same conditions as the row layout, cosine only.
+ * norms.seg exists exactly while norms are kept.
+*/
+vdb_status_t vdb_storage_set_normalize(vdb_storage_t *storage, vdb_normalize_t mode) {
+    if (storage == NULL || (mode != VDB_NORMALIZE_NONE && mode != VDB_NORMALIZE_UNIT &&
+                            mode != VDB_NORMALIZE_KEEP_NORMS)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    if (mode != VDB_NORMALIZE_NONE && storage->metric != VDB_METRIC_COSINE) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = VDB_OK;
+    if (mode != storage->normalize) {
+        if (storage->count > 0 || storage->hnsw_enabled) {
+            status = VDB_ERROR_INVALID_ARGUMENT;
+        } else {
+            vdb_normalize_t old = storage->normalize;
+            if (mode == VDB_NORMALIZE_KEEP_NORMS) {
+                status = open_norms_file(storage);
+            }
+            if (status == VDB_OK) {
+                storage->normalize = mode;
+                status = storage_write_meta(storage);
+            }
+            bool drop = status == VDB_OK ? old == VDB_NORMALIZE_KEEP_NORMS
+                                         : mode == VDB_NORMALIZE_KEEP_NORMS;
+            if (status != VDB_OK) {
+                storage->normalize = old;
+            }
+            if (drop && storage->norms_fd >= 0) {
+                char path[MAX_PATH];
+                close(storage->norms_fd);
+                storage->norms_fd = -1;
+                if (build_file_path(storage->base_dir, storage->name, "norms.seg", path) == VDB_OK) {
+                    unlink(path);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+vdb_normalize_t vdb_storage_get_normalize(const vdb_storage_t *storage) {
+    return storage != NULL ? storage->normalize : VDB_NORMALIZE_NONE;
+}
+
+/**
+ * Wait until what this writer put in the WAL is durable
+ * With group commit the committer syncs it; otherwise the writer did
+ * already, and this only checkpoints if the WAL is big enough.
+ * Caller must hold write_lock
+*/
+static vdb_status_t await_commit_locked(vdb_storage_t *storage) {
+    if (!storage->commit_thread_running) {
+        // the writer's fsync covered async appends before it too
+        storage->durable_seq = storage->written_seq;
+        return commit_locked(storage, false);
+    }
+    uint64_t seq = ++storage->written_seq;
+    pthread_cond_signal(&storage->pending_cond);
+    while (storage->durable_seq < seq) {
+        pthread_cond_wait(&storage->commit_cond, &storage->write_lock);
+    }
+    return storage->commit_error;
+}
+
+/**
+ * Hand out a ticket for an append written without a sync
+ * The committer (if running) syncs it on its own; otherwise the next
+ * sync does: a wait, a plain append, or the commit that checkpoints
+ * once the WAL has grown large enough.
+ * Caller must hold write_lock
+*/
+static vdb_status_t note_written_locked(vdb_storage_t *storage, vdb_commit_ticket_t *ticket) {
+    *ticket = ++storage->written_seq;
+    if (storage->commit_thread_running) {
+        pthread_cond_signal(&storage->pending_cond);
+        return VDB_OK;
+    }
+    if (storage->wal_bytes < storage->checkpoint_bytes) {
+        return VDB_OK;
+    }
+    vdb_status_t status = commit_locked(storage, true);
+    if (status == VDB_OK) {
+        storage->durable_seq = storage->written_seq;
+    }
+    return status;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    return strcmp(*(const char *const*)a, *(const char *const*)b);
+}
+
+/**
+ * VDB_ERROR_ALREADY_EXISTS if two items share an ID
+*/
+static vdb_status_t check_unique_ids(const vdb_item_t *items, size_t n) {
+    if (n < 2) {
+        return VDB_OK;
+    }
+    const char **ids = (const char**)malloc(n * sizeof(const char*));
+    if (ids == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < n; i++) {
+        ids[i] = items[i].id;
+    }
+    qsort(ids, n, sizeof(const char*), compare_ids);
+    vdb_status_t status = VDB_OK;
+    for (size_t i = 1; i < n && status == VDB_OK; i++) {
+        if (strcmp(ids[i - 1], ids[i]) == 0) {
+            status = VDB_ERROR_ALREADY_EXISTS;
+        }
+    }
+    free(ids);
+    return status;
+}
+
+static bool entry_live(id_index_entry_t entry) {
+    return entry.row != ID_INDEX_NONE && (entry.row & ID_INDEX_DELETED) == 0;
+}
+
+/**
+ * Common append path for single items and batches
+ * Plain appends refuse IDs that are stored already; upserts write the
+ * same frames, and the ID index moves the ID to its new row.
+*/
+static vdb_status_t append_items(vdb_storage_t *storage, const vdb_item_t *items, size_t n,
+                                 bool upsert, vdb_commit_ticket_t *ticket) {
+    uint64_t start = stats_now_ns();
+    for (size_t i = 0; i < n; i++) {
+        vdb_status_t status = validate_item(storage, &items[i]);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    if (!upsert) {
+        vdb_status_t status = check_unique_ids(items, n);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+
+    // encode (and checksum) the WAL frame before taking the lock
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    byte_buffer_t wal = { NULL, 0, 0, arena };
+    uint32_t payload_crc = 0;
+    vdb_status_t status = encode_wal_frame(&wal, items, n, &payload_crc);
+    if (status != VDB_OK) {
+        vdb_arena_rewind(arena, mark);
+        return status;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    if (storage->commit_error != VDB_OK) {
+        status = storage->commit_error;
+        pthread_mutex_unlock(&storage->write_lock);
+        vdb_arena_rewind(arena, mark);
+        return status;
+    }
+
+    // step0: refuse IDs already stored (the index must be current for that)
+    if (!upsert) {
+        status = storage_ids_catch_up(storage);
+        for (size_t i = 0; i < n && status == VDB_OK; i++) {
+            if (entry_live(id_index_find(storage->ids, storage->id_keys, items[i].id))) {
+                status = VDB_ERROR_ALREADY_EXISTS;
+            }
+        }
+        if (status != VDB_OK) {
+            pthread_mutex_unlock(&storage->write_lock);
+            vdb_arena_rewind(arena, mark);
+            return status;
+        }
+    }
+
+    // step1+2: write the WAL frame (fsync'd, unless the committer or a
+    // later wait does it), then the segments, one write per file; those
+    // are synced at the next checkpoint
+    uint64_t wal_start = storage->wal_bytes;
+    uint64_t metadata_start = storage->metadata_bytes;
+    seal_wal_frame(&wal, payload_crc, storage->next_lsn, storage->count);
+    bool sync = ticket == NULL && !storage->commit_thread_running;
+    status = write_segments(storage, &wal, sync, items, n);
+
+    if (status != VDB_OK) {
+        rollback_append(storage, wal_start, metadata_start);
+    } else {
+        // rows left to the committer are published once it synced them
+        if (ticket == NULL && !sync && storage->unsynced_row == UINT64_MAX) {
+            storage->unsynced_row = storage->count;
+        }
+        storage->next_lsn++;
+        storage->count += n;
+
+        // step3: durable now (or once the committer synced us), or just
+        // handed a ticket; checkpoint if due. If the committer's sync
+        // failed the rows are never published and the handle takes no
+        // more writes: only the next open knows whether they survived.
+        status = ticket != NULL ? note_written_locked(storage, ticket)
+                                : await_commit_locked(storage);
+    }
+
+    // step4: quantize the new rows, wake the sealer if they fill a
+    // segment, index their metadata and, last, their IDs: a get that
+    // finds a row the published view doesn't have yet waits for the
+    // publish below. They are durable by now, so a failure here is not
+    // an append failure - the next write (or reopen) picks the missing
+    // rows up again.
+    if (status == VDB_OK && storage->quantization != VDB_QUANTIZATION_NONE) {
+        storage_quant_catch_up(storage);
+    }
+    if (status == VDB_OK && storage->hnsw_enabled) {
+        storage_index_catch_up(storage);
+    }
+    if (status == VDB_OK) {
+        storage_filter_catch_up(storage);
+    }
+    if (status == VDB_OK) {
+        storage_ids_catch_up(storage);
+    }
+
+    // step5: let readers see the rows (up to any the committer has yet
+    // to sync); until then they keep the snapshot from before, which is
+    // still consistent
+    storage_publish_locked(storage);
+
+    pthread_mutex_unlock(&storage->write_lock);
+    vdb_arena_rewind(arena, mark);
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_APPENDED_ROWS, n);
+        stats_add(storage->stats, STATS_APPEND_CALLS, 1);
+        stats_record_since(storage->stats, STATS_APPEND_LATENCY, start);
+    }
+    return status;
+}
+
+/** 
+ * Append item to storage
+*/
+vdb_status_t vdb_storage_append(
+    vdb_storage_t *storage,
+    const vdb_item_t *item
+) {
+    if (storage == NULL || item == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    return append_items(storage, item, 1, false, NULL);
+}
+
+/** 
+ * Append a batch of items to storage
+*/
+vdb_status_t vdb_storage_append_batch(
+    vdb_storage_t *storage,
+    const vdb_item_t *items,
+    size_t n
+) {
+    if (storage == NULL || (items == NULL && n > 0)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (n == 0) {
+        return VDB_OK;
+    }
+
+    return append_items(storage, items, n, false, NULL);
+}
+
+/**
+ * Insert or replace an item
+*/
+vdb_status_t vdb_storage_upsert(vdb_storage_t *storage, const vdb_item_t *item) {
+    if (storage == NULL || item == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    return append_items(storage, item, 1, true, NULL);
+}
+
+/**
+ * Insert or replace a batch of items
+*/
+vdb_status_t vdb_storage_upsert_batch(vdb_storage_t *storage, const vdb_item_t *items, size_t n) {
+    if (storage == NULL || (items == NULL && n > 0)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (n == 0) {
+        return VDB_OK;
+    }
+
+    return append_items(storage, items, n, true, NULL);
+}
+
+/**
+ * Append a batch without waiting for its fsync
+*/
+vdb_status_t vdb_storage_append_batch_async(vdb_storage_t *storage, const vdb_item_t *items, size_t n,
+                                            vdb_commit_ticket_t *out_ticket) {
+    if (storage == NULL || (items == NULL && n > 0) || out_ticket == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    *out_ticket = 0;
+
+    if (n == 0) {
+        return VDB_OK;
+    }
+
+    return append_items(storage, items, n, false, out_ticket);
+}
+
+/**
+ * Block until the append behind a ticket is durable
+*/
+vdb_status_t vdb_storage_wait_durable(vdb_storage_t *storage, vdb_commit_ticket_t ticket) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = VDB_OK;
+    if (ticket > storage->written_seq) {
+        status = VDB_ERROR_INVALID_ARGUMENT;
+    } else if (storage->commit_thread_running) {
+        pthread_cond_signal(&storage->pending_cond);
+        while (storage->durable_seq < ticket) {
+            pthread_cond_wait(&storage->commit_cond, &storage->write_lock);
+        }
+        status = storage->commit_error;
+    } else if (storage->durable_seq < ticket) {
+        uint64_t target = storage->written_seq;
+        status = commit_locked(storage, true);
+        if (status == VDB_OK) {
+            storage->durable_seq = target;
+        }
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Encode the WAL frame deleting one row into buf (sealed by the caller)
+*/
+static vdb_status_t encode_delete_frame(byte_buffer_t *buf, uint64_t row, uint32_t *payload_crc) {
+    wal_frame_header_t header = {0};
+    header.type = WAL_FRAME_DELETE;
+    header.num_records = 1;
+    header.payload_len = sizeof(row);
+    vdb_status_t status = buffer_append(buf, &header, sizeof(header));
+    if (status == VDB_OK) {
+        status = buffer_append(buf, &row, sizeof(row));
+    }
+    *payload_crc = crc32c(0, &row, sizeof(row));
+    return status;
+}
+
+/**
+ * Delete an item by ID
+*/
+vdb_status_t vdb_storage_delete(vdb_storage_t *storage, const char *id) {
+    if (storage == NULL || !vdb_id_is_valid(id)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+
+    // a failed commit leaves the handle read-only
+    id_index_entry_t entry = { ID_INDEX_NONE, 0 };
+    vdb_status_t status = storage->commit_error;
+    if (status == VDB_OK) {
+        status = storage_ids_catch_up(storage);
+    }
+    if (status == VDB_OK) {
+        entry = id_index_find(storage->ids, storage->id_keys, id);
+        if (!entry_live(entry)) {
+            status = VDB_ERROR_NOT_FOUND;
+        }
+    }
+
+    // log the row (not the ID): replaying it can't hit a later row of the same ID
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    byte_buffer_t wal = { NULL, 0, 0, arena };
+    uint32_t payload_crc = 0;
+    if (status == VDB_OK) {
+        status = encode_delete_frame(&wal, entry.row, &payload_crc);
+    }
+    if (status == VDB_OK) {
+        uint64_t wal_start = storage->wal_bytes;
+        seal_wal_frame(&wal, payload_crc, storage->next_lsn, storage->count);
+        status = write_all(storage->wal_fd, wal.data, wal.len);
+        if (status == VDB_OK) {
+            storage->wal_bytes += wal.len;
+            stats_add(storage->stats, STATS_BYTES_WAL, wal.len);
+            if (!storage->commit_thread_running) {
+                status = sync_wal(storage);
+            }
+        }
+        if (status != VDB_OK) {
+            if (ftruncate(storage->wal_fd, (off_t)wal_start) != 0) {
+                // a leftover frame is rejected by replay on open
+            }
+            storage->wal_bytes = wal_start;
+        }
+    }
+
+    if (status == VDB_OK) {
+        storage->next_lsn++;
+        pthread_rwlock_wrlock(&storage->id_lock);
+        vdb_status_t applied = id_index_delete(storage->ids, storage->id_keys, entry.row);
+        pthread_rwlock_unlock(&storage->id_lock);
+        query_cache_invalidate(storage->query_cache);
+        status = await_commit_locked(storage);
+        if (status == VDB_OK) {
+            status = applied; // logged but not applied: reopen replays it
+        }
+    }
+    if (status == VDB_OK) {
+        stats_add(storage->stats, STATS_DELETES, 1);
+    }
+
+    pthread_mutex_unlock(&storage->write_lock);
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
+
+/**
+ * Copy a row out as float32 values, at its original length if norms are kept
+*/
+static void read_row(const vdb_storage_t *storage, const storage_view_t *view, uint64_t row, float *out) {
+    vdb_convert_to_f32(storage->element, storage_view_row(storage, view, row), out, storage->dim);
+    if (view->norms != NULL) {
+        float norm = view->norms[row];
+        for (uint32_t i = 0; i < storage->dim; i++) {
+            out[i] *= norm;
+        }
+    }
+}
+
+/**
+ * Copy an item out of view - caller holds layout_lock, so the row the
+ * ID index gives is a row of the view
+*/
+static vdb_status_t copy_item(const vdb_storage_t *storage, const storage_view_t *view,
+                              id_index_entry_t entry, vdb_item_t *out_item) {
+    uint32_t len;
+    if (entry.meta_offset + sizeof(len) > view->metadata_bytes) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    memcpy(&len, view->metadata + entry.meta_offset, sizeof(len));
+    if (entry.meta_offset + sizeof(len) + len > view->metadata_bytes) {
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    float *data = (float*)malloc(storage->dim * sizeof(float));
+    char *metadata = len > 0 ? (char*)malloc((size_t)len + 1) : NULL;
+    if (data == NULL || (len > 0 && metadata == NULL)) {
+        free(data);
+        free(metadata);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    read_row(storage, view, entry.row, data);
+    if (metadata != NULL) {
+        memcpy(metadata, view->metadata + entry.meta_offset + sizeof(len), len);
+        metadata[len] = '\0';
+    }
+
+    memcpy(out_item->id, storage_view_id(view, entry.row), VDB_ID_MAX_LEN);
+    out_item->id[VDB_ID_MAX_LEN - 1] = '\0';
+    out_item->vector.dim = storage->dim;
+    out_item->vector.data = data;
+    out_item->metadata = metadata;
+    return VDB_OK;
+}
+
+/**
+ * Wait until row is published, or a failed commit means it never will be
+ * Its writer (or the committer) publishes it without readers touching
+ * write_lock. Only if no publish comes within PUBLISH_WAIT_MS - that
+ * one failed - is it made here, under write_lock.
+*/
+static vdb_status_t await_publish(vdb_storage_t *storage, uint64_t row) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PUBLISH_WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    vdb_status_t status = VDB_OK;
+    bool timed_out = false;
+    pthread_mutex_lock(&storage->publish_lock);
+    while (atomic_load_explicit(&storage->published_count, memory_order_acquire) <= row && !timed_out) {
+        status = storage->commit_error;
+        if (status != VDB_OK) {
+            break;
+        }
+        timed_out = pthread_cond_timedwait(&storage->publish_cond, &storage->publish_lock, &deadline) == ETIMEDOUT;
+    }
+    pthread_mutex_unlock(&storage->publish_lock);
+
+    if (timed_out) {
+        pthread_mutex_lock(&storage->write_lock);
+        status = storage->commit_error;
+        if (status == VDB_OK && atomic_load_explicit(&storage->published_count, memory_order_acquire) <= row) {
+            status = storage_publish_locked(storage);
+        }
+        pthread_mutex_unlock(&storage->write_lock);
+    }
+    return status;
+}
+
+static vdb_status_t get_locked(vdb_storage_t *storage, const char *id, vdb_item_t *out_item) {
+    storage_view_t view;
+    id_index_entry_t entry;
+    for (;;) {
+        vdb_status_t status = storage_acquire_view(storage, &view);
+        if (status != VDB_OK) {
+            return status;
+        }
+        entry = storage_ids_find(storage, id);
+        if (!entry_live(entry)) {
+            storage_release_view(storage, &view);
+            return VDB_ERROR_NOT_FOUND;
+        }
+        if (entry.row < view.count) {
+            break;
+        }
+        // indexed since the view was taken; wait for the publish
+        storage_release_view(storage, &view);
+        status = await_publish(storage, entry.row);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+
+    vdb_status_t status = copy_item(storage, &view, entry, out_item);
+    storage_release_view(storage, &view);
+    return status;
+}
+
+/**
+ * Look up an item by ID, copying it out
+*/
+vdb_status_t vdb_storage_get(vdb_storage_t *storage, const char *id, vdb_item_t *out_item) {
+    if (storage == NULL || out_item == NULL || !vdb_id_is_valid(id)) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+    memset(out_item, 0, sizeof(*out_item));
+
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    vdb_status_t status = get_locked(storage, id, out_item);
+    pthread_rwlock_unlock(&storage->layout_lock);
+    return status;
+}
+
+
+/**
+ * Free an item returned by vdb_storage_get
+*/
+void vdb_storage_item_free(vdb_item_t *item) {
+    if (item == NULL) {
+        return;
+    }
+    free(item->vector.data);
+    free((char*)item->metadata);
+    memset(item, 0, sizeof(*item));
+}
+
+/** 
+ * Get collection info from storage
+*/
+vdb_status_t vdb_storage_get_info(
+    const vdb_storage_t *storage,
+    vdb_collection_info_t *out_info
+) {
+    if (storage == NULL || out_info == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    strncpy(out_info->name, storage->name, VDB_COLLECTION_NAME_MAX_LEN);
+    out_info->name[VDB_COLLECTION_NAME_MAX_LEN - 1] = '\0';
+    out_info->dim = storage->dim;
+    out_info->metric = storage->metric;
+    out_info->num_vectors = atomic_load_explicit(&storage->published_count, memory_order_acquire);
+
+    return VDB_OK;
+}
+
+/** 
+ * Get num of items in storage
+*/
+uint64_t vdb_storage_count(const vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return 0;
+    }
+    return atomic_load_explicit(&storage->published_count, memory_order_acquire);
+}
+
+/**
+ * Get num of rows not superseded or deleted
+*/
+uint64_t vdb_storage_live_count(vdb_storage_t *storage) {
+    if (storage == NULL) {
+        return 0;
+    }
+
+    // the published count, so a writer mid-append (or the committer's
+    // fsync) never holds this up
+    uint64_t count = atomic_load_explicit(&storage->published_count, memory_order_acquire);
+    uint64_t dead = storage_ids_dead_count(storage);
+    return dead < count ? count - dead : 0;
+}
+
+/**
+ * Map an access hint to posix_madvise advice
+*/
+static int advice_for_hint(vdb_access_hint_t hint) {
+    switch (hint) {
+        case VDB_ACCESS_SEQUENTIAL:
+            return POSIX_MADV_SEQUENTIAL;
+        case VDB_ACCESS_RANDOM:
+            return POSIX_MADV_RANDOM;
+        case VDB_ACCESS_WILLNEED:
+            return POSIX_MADV_WILLNEED;
+        case VDB_ACCESS_NORMAL:
+        default:
+            return POSIX_MADV_NORMAL;
+    }
+}
+
+/** 
+ * Advise the kernel how the segments are about to be read
+*/
+vdb_status_t vdb_storage_advise(vdb_storage_t *storage, vdb_access_hint_t hint) {
+    if (storage == NULL || hint < VDB_ACCESS_NORMAL || hint > VDB_ACCESS_WILLNEED) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_status_t status = ensure_mapped(storage);
+    if (status == VDB_OK) {
+        int advice = advice_for_hint(hint);
+        advise_segment(&storage->embeddings_map, storage->count * storage->row_bytes, advice);
+        advise_segment(&storage->ids_map, storage->count * VDB_ID_MAX_LEN, advice);
+        advise_segment(&storage->metadata_map, storage->metadata_bytes, advice);
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/**
+ * Walk the live rows of a view - caller holds layout_lock
+*/
+static vdb_status_t iterate_view(vdb_storage_t *storage, const storage_view_t *view,
+                                 vdb_storage_iter_fn callback, void *user_data) {
+    roaring_t dead;
+    roaring_init(&dead);
+    vdb_status_t status = storage_ids_dead(storage, &dead);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    segment_map_t rows = { view->embeddings, (size_t)(view->count * storage->row_bytes) };
+    segment_map_t metadata = { view->metadata, (size_t)view->metadata_bytes };
+    advise_segment(&rows, rows.len, POSIX_MADV_SEQUENTIAL);
+    advise_segment(&metadata, metadata.len, POSIX_MADV_SEQUENTIAL);
+
+    /* metadata is stored without a terminator, so it is the one copy,
+     * and half precision rows (or unit rows with kept norms) are
+     * widened into a buffer of their own */
+    char *scratch = NULL;
+    size_t scratch_cap = 0;
+    uint64_t meta_offset = 0;
+    float *widened = NULL;
+    if (storage->element != VDB_ELEMENT_F32 || view->norms != NULL) {
+        widened = (float*)malloc(storage->dim * sizeof(float));
+        if (widened == NULL) {
+            roaring_free(&dead);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    for (uint64_t row = 0; row < view->count; row++) {
+        vdb_item_t item;
+        memcpy(item.id, storage_view_id(view, row), VDB_ID_MAX_LEN);
+        item.id[VDB_ID_MAX_LEN - 1] = '\0';
+        item.vector.dim = storage->dim;
+        item.vector.data = (float*)storage_view_row(storage, view, row);
+        item.metadata = NULL;
+
+        uint32_t len;
+        if (meta_offset + sizeof(len) > view->metadata_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        memcpy(&len, view->metadata + meta_offset, sizeof(len));
+        meta_offset += sizeof(len);
+        if (meta_offset + len > view->metadata_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+            break;
+        }
+        if (roaring_contains(&dead, row)) {
+            meta_offset += len;
+            continue;
+        }
+        if (widened != NULL) {
+            read_row(storage, view, row, widened);
+            item.vector.data = widened;
+        }
+
+        if (len > 0) {
+            if (len + 1 > scratch_cap) {
+                char *grown = (char*)realloc(scratch, len + 1);
+                if (grown == NULL) {
+                    status = VDB_ERROR_OUT_OF_MEMORY;
+                    break;
+                }
+                scratch = grown;
+                scratch_cap = len + 1;
+            }
+            memcpy(scratch, view->metadata + meta_offset, len);
+            scratch[len] = '\0';
+            item.metadata = scratch;
+            meta_offset += len;
+        }
+
+        if (callback(&item, user_data) != 0) {
+            break;
+        }
+    }
+
+    free(widened);
+    free(scratch);
+    roaring_free(&dead);
+    return status;
+}
+
+/** 
+ * Iterate over all stored items
+ * Vectors are views into the embeddings mapping, not copies (except
+ * for half precision rows and kept norms)
+*/
+vdb_status_t vdb_storage_iterate(
+    vdb_storage_t *storage,
+    vdb_storage_iter_fn callback,
+    void *user_data
+) {
+    if (storage == NULL || callback == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    pthread_rwlock_rdlock(&storage->layout_lock);
+    storage_view_t view;
+    vdb_status_t status = storage_acquire_view(storage, &view);
+    if (status == VDB_OK) {
+        status = iterate_view(storage, &view, callback, user_data);
+        storage_release_view(storage, &view);
+    }
+    pthread_rwlock_unlock(&storage->layout_lock);
+    return status;
+}
+
+
+/** 
+ * Snapshot the committed rows for a reader, lock-free
+ * The guard keeps everything the snapshot points at mapped until the
+ * view is released, whatever the writer publishes meanwhile.
+*/
+vdb_status_t storage_acquire_view(vdb_storage_t *storage, storage_view_t *out_view) {
+    uint32_t guard = epoch_enter(storage->epoch);
+    const storage_view_t *snapshot = atomic_load_explicit(&storage->snapshot, memory_order_acquire);
+    *out_view = *snapshot;
+    out_view->guard = guard;
+    return VDB_OK;
+}
+
+void storage_release_view(vdb_storage_t *storage, storage_view_t *view) {
+    epoch_exit(storage->epoch, view->guard);
+    view->guard = EPOCH_NONE;
+}
+
+/**
+ * Publish the current rows, short of any still waiting on the group
+ * committer (write_lock held, or opening)
+ * The old snapshot and the mappings retired since the last publish go
+ * to the epoch domain only once the new snapshot is out, so a reader
+ * that can still load them is always one the domain waits for.
+*/
+vdb_status_t storage_publish_locked(vdb_storage_t *storage) {
+    storage_view_t *snapshot = (storage_view_t*)malloc(sizeof(storage_view_t));
+    if (snapshot == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    vdb_status_t status = storage_view_locked(storage, snapshot);
+    if (status != VDB_OK) {
+        free(snapshot);
+        return status;
+    }
+    snapshot->guard = EPOCH_NONE;
+    if (snapshot->count > storage->unsynced_row) {
+        snapshot->count = storage->unsynced_row;
+    }
+
+    // ID lookups read ids.seg through id_keys; move it off a retired mapping
+    if (storage->ids != NULL && storage->id_keys != storage->ids_map.addr) {
+        pthread_rwlock_wrlock(&storage->id_lock);
+        storage->id_keys = storage->ids_map.addr;
+        pthread_rwlock_unlock(&storage->id_lock);
+    }
+
+    storage_view_t *old = atomic_exchange_explicit(&storage->snapshot, snapshot, memory_order_acq_rel);
+    atomic_store_explicit(&storage->published_count, snapshot->count, memory_order_release);
+    pthread_mutex_lock(&storage->publish_lock);
+    pthread_cond_broadcast(&storage->publish_cond);
+    pthread_mutex_unlock(&storage->publish_lock);
+
+    // if the domain can't take them they simply wait for the next publish
+    // (or close); the snapshot leaks rather than being freed under a reader
+    if (old != NULL) {
+        epoch_retire(storage->epoch, retired_free, old, sizeof(storage_view_t));
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < storage->num_retired_maps; i++) {
+        segment_map_t *map = &storage->retired_maps[i];
+        if (epoch_retire(storage->epoch, retired_unmap, (void*)map->addr, map->len) != VDB_OK) {
+            storage->retired_maps[kept++] = *map;
+        }
+    }
+    storage->num_retired_maps = kept;
+    epoch_reclaim(storage->epoch);
+    query_cache_invalidate(storage->query_cache);
+    return VDB_OK;
+}
+
+/** 
+ * Snapshot the committed rows (write_lock held)
+*/
+vdb_status_t storage_view_locked(vdb_storage_t *storage, storage_view_t *out_view) {
+    vdb_status_t status = ensure_mapped(storage);
+    if (status == VDB_OK) {
+        out_view->count = storage->count;
+        out_view->embeddings = storage->embeddings_map.addr;
+        out_view->ids = storage->ids_map.addr;
+        out_view->metadata = storage->metadata_map.addr;
+        out_view->metadata_bytes = storage->metadata_bytes;
+        out_view->norms = storage->normalize == VDB_NORMALIZE_KEEP_NORMS
+            ? (const float*)storage->norms_map.addr : NULL;
+        out_view->sq8_codec = storage->sq8;
+        out_view->pq_codec = storage->pq;
+        out_view->codes = storage->codes_map.addr;
+        out_view->code_count = storage->code_count;
+    }
+    return status;
+}
+
+/** 
+ * Get (lazily creating) the search pool
+*/
+vdb_thread_pool_t *storage_get_pool(vdb_storage_t *storage) {
+    vdb_thread_pool_t *pool = atomic_load_explicit(&storage->pool, memory_order_acquire);
+    if (pool != NULL) {
+        return pool;
+    }
+    pthread_mutex_lock(&storage->write_lock);
+    pool = storage_pool_locked(storage);
+    pthread_mutex_unlock(&storage->write_lock);
+    return pool;
+}
+
+/** 
+ * Get (lazily creating) the search pool (write_lock held)
+*/
+vdb_thread_pool_t *storage_pool_locked(vdb_storage_t *storage) {
+    vdb_thread_pool_t *pool = atomic_load_explicit(&storage->pool, memory_order_relaxed);
+    if (pool == NULL) {
+        size_t workers = storage->search_threads > 0
+            ? storage->search_threads - 1
+            : vdb_thread_pool_default_workers();
+        if (vdb_thread_pool_create(workers, &pool) != VDB_OK) {
+            pool = NULL;
+        }
+        atomic_store_explicit(&storage->pool, pool, memory_order_release);
+    }
+    return pool;
+}
+
+vdb_status_t storage_share_pool(vdb_storage_t *storage, vdb_thread_pool_t *pool) {
+    pthread_mutex_lock(&storage->write_lock);
+    vdb_thread_pool_t *old = atomic_exchange_explicit(&storage->pool, pool, memory_order_acq_rel);
+    vdb_status_t status = VDB_OK;
+    if (old != NULL && !storage->pool_shared) {
+        status = epoch_retire(storage->epoch, retired_pool, old, 0);
+        if (status != VDB_OK) {
+            atomic_store_explicit(&storage->pool, old, memory_order_release);
+        } else {
+            epoch_reclaim(storage->epoch);
+        }
+    }
+    if (status == VDB_OK) {
+        storage->pool_shared = true;
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
+
+/** 
+ * Set the number of threads used by a single search
+*/
+vdb_status_t vdb_storage_set_search_threads(vdb_storage_t *storage, uint32_t num_threads) {
+    if (storage == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    // recreated with the new size; searches still running on the old
+    // pool hold a view, so it goes once they are done
+    pthread_mutex_lock(&storage->write_lock);
+    storage->search_threads = num_threads;
+    vdb_thread_pool_t *old = atomic_exchange_explicit(&storage->pool, NULL, memory_order_acq_rel);
+    vdb_status_t status = VDB_OK;
+    if (storage->pool_shared) {
+        storage->pool_shared = false; // its owner frees it
+    } else if (old != NULL) {
+        status = epoch_retire(storage->epoch, retired_pool, old, 0);
+        if (status != VDB_OK) {
+            atomic_store_explicit(&storage->pool, old, memory_order_release); // keep the old size
+        } else {
+            epoch_reclaim(storage->epoch);
+        }
+    }
+    pthread_mutex_unlock(&storage->write_lock);
+    return status;
+}
@@ -0,0 +1,402 @@
+/**
+ * storage_internal.h - Storage internals shared by the library modules
+ *
+ * The storage struct stays opaque to users; search and index modules
+ * include this header to reach the segment mappings directly.
+*/
+
+#ifndef VDB_STORAGE_INTERNAL_H
+#define VDB_STORAGE_INTERNAL_H
+
+#include "vdb/storage.h"
+#include "thread_pool.h"
+#include "hnsw.h"
+#include "vamana.h"
+#include "sq8.h"
+#include "pq.h"
+#include "filter_index.h"
+#include "id_index.h"
+#include "index_snap.h"
+#include "epoch.h"
+#include "stats.h"
+#include "aio.h"
+#include "query_cache.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Max path len */
+#define MAX_PATH 1024
+
+/**
+ * Read-only mapping of one segment file
+ * len is the reserved mapping length, which may run past end of file
+*/
+typedef struct {
+    const uint8_t *addr;
+    size_t len;
+} segment_map_t;
+
+/**
+ * Sealed HNSW segment: a graph over rows [first, first + hnsw_count(graph))
+ * file is its hnsw-<file>.idx, 0 until it has been saved.
+*/
+typedef struct {
+    uint64_t first;
+    hnsw_index_t *graph;
+    uint64_t file;
+} index_segment_t;
+
+/**
+ * Consistent snapshot of the committed rows
+ * Pointers stay valid until the view is released (storage_release_view),
+ * or while write_lock is held for a storage_view_locked one.
+*/
+typedef struct {
+    uint64_t count;
+    const uint8_t *embeddings; // row i at embeddings + i * row_bytes
+    const uint8_t *ids; // row i at ids + i * VDB_ID_MAX_LEN
+    const uint8_t *metadata;
+    uint64_t metadata_bytes;
+    const float *norms; // row i's original norm, NULL unless norms are kept
+    const sq8_codec_t *sq8_codec; // at most one codec is set
+    const pq_codec_t *pq_codec;
+    const uint8_t *codes; // embeddings.sq8 or embeddings.pq, rows < code_count
+    uint64_t code_count;
+    uint32_t guard; // epoch guard of an acquired view, EPOCH_NONE otherwise
+} storage_view_t;
+
+/**
+ * Storage structure (opaque to users)
+*/
+struct vdb_storage {
+    char base_dir[MAX_PATH];
+    char name[VDB_COLLECTION_NAME_MAX_LEN];
+    uint32_t dim;
+    vdb_metric_t metric;
+    uint64_t count;
+    size_t row_bytes; // bytes per row in embeddings.seg
+    vdb_row_layout_t row_layout;
+    vdb_element_type_t element; // type of the stored values
+    uint32_t scan_dim; // elements the kernels run over: dim, or the whole padded row
+    vdb_dim_kernel_t dim_kernel; // distance kernels specialized for scan_dim, if any
+    vdb_normalize_t normalize; // rows are unit vectors unless NONE
+    uint64_t metadata_bytes; // committed length of metadata.seg
+
+    /* File descriptors */
+    int meta_fd;
+    int embeddings_fd;
+    int ids_fd;
+    int metadata_fd;
+    int wal_fd;
+    int norms_fd; // -1 unless norms are kept
+
+    /* Read path: segment mappings, grown on demand */
+    segment_map_t embeddings_map;
+    segment_map_t ids_map;
+    segment_map_t metadata_map;
+    segment_map_t norms_map;
+
+    /* Readers (storage_acquire_view) copy the published snapshot inside
+     * an epoch guard and never take write_lock. Writers rebuild it under
+     * write_lock after every change to the rows (storage_publish_locked);
+     * whenever write_lock is free it matches the committed state.
+     * published_count is its count, for the lock-free counters. */
+    epoch_domain_t *epoch;
+    _Atomic(storage_view_t*) snapshot;
+    atomic_uint_fast64_t published_count;
+    pthread_mutex_t publish_lock; // publish_cond, and commit_error for readers
+    pthread_cond_t publish_cond; // signalled on every publish and a failed commit
+
+    /* Mappings replaced by a bigger or a swapped-in one. The published
+     * snapshot may still point into them, so they are handed to the
+     * epoch domain on the next publish, once it no longer does. */
+    segment_map_t *retired_maps;
+    size_t num_retired_maps;
+
+    /* Search workers, created on first parallel search; a replaced pool
+     * is retired through the epoch domain. A shared pool (a vdb_db_t's)
+     * belongs to its owner and is never freed here. */
+    _Atomic(vdb_thread_pool_t*) pool;
+    size_t search_threads; // 0 = one per CPU
+    bool pool_shared;
+
+    /* Write path serialization + group commit */
+    pthread_mutex_t write_lock;
+    pthread_cond_t pending_cond; // wakes the committer
+    pthread_cond_t commit_cond; // signalled when durable_seq advances
+    pthread_t commit_thread;
+    bool commit_thread_running;
+    bool commit_stop;
+    uint32_t group_commit_window_us;
+    uint64_t written_seq; // appends written but maybe not synced
+    uint64_t durable_seq; // appends known durable
+    uint64_t unsynced_row; // first row an append waits on the committer for, UINT64_MAX if none; never published before it syncs
+    vdb_status_t commit_error; // committer failure: sticky, the handle takes no more writes. Set under publish_lock too
+    aio_ring_t *ring; // io_uring backend; NULL = blocking. Used under write_lock
+
+    /* WAL + checkpoints: rows [checkpoint_count, count) are only durable
+     * through wal.log until the next checkpoint syncs the segments */
+    uint64_t checkpoint_count; // count recorded in collection.meta
+    uint64_t checkpoint_metadata_bytes; // metadata.seg length recorded with it (or SUPERBLOCK_METADATA_UNKNOWN)
+    uint64_t checkpoint_lsn; // next_lsn recorded with it
+    uint64_t next_lsn; // sequence number of the next WAL frame
+    uint64_t wal_bytes; // length of wal.log
+    uint64_t checkpoint_bytes; // checkpoint once the WAL reaches this
+
+    /* HNSW index (index.c), off until enabled: sealed segments cover
+     * rows [0, sealed_rows), the rows past them are the memtable.
+     * Segments are swapped in under index_lock held for writing;
+     * searches take it for reading and never hold write_lock at the
+     * same time. Seals and index saves run under compact_lock. */
+    bool hnsw_enabled;
+    vdb_hnsw_params_t hnsw_params;
+    index_segment_t *segments;
+    size_t num_segments;
+    uint64_t sealed_rows;
+    uint64_t segment_rows; // memtable rows that make a segment
+    uint64_t next_segment_file; // file number of the next segment saved
+    pthread_rwlock_t index_lock;
+    hnsw_space_t hnsw_space; // the graphs' row format; searches fill base in from their view
+    size_t hnsw_pinned_bytes; // top-layer vectors each graph may pin, under index_lock
+
+    /* DiskANN index (diskann.c), NULL unless built: a Vamana graph over
+     * rows [0, vamana_count) in diskann.idx. Attached and dropped under
+     * layout_lock held for writing and write_lock; searches use it under
+     * layout_lock for reading. Builds run under compact_lock. */
+    vamana_index_t *diskann;
+
+    /* Sealer thread: sleeps on seal_cond under seal_wait_lock until
+     * appends fill a segment */
+    pthread_mutex_t seal_wait_lock;
+    pthread_cond_t seal_cond;
+    pthread_t seal_thread;
+    bool seal_thread_running;
+    bool seal_pending;
+    bool seal_stop;
+
+    /* Quantized copy of the embeddings (quantize.c). Derived data like
+     * the index: rows [code_count, count) are encoded on the next append
+     * or open. The mode's codec is NULL until there were rows to train on. */
+    vdb_quantization_t quantization;
+    sq8_codec_t *sq8;
+    pq_codec_t *pq;
+    uint32_t pq_subspaces; // m for the next PQ training, 0 = default
+    int codes_fd;
+    segment_map_t codes_map;
+    uint64_t code_count; // rows in embeddings.sq8 / embeddings.pq
+    uint32_t rerank_factor; // quantized candidates kept per requested hit
+
+    /* Metadata filter index (filter_index.c), derived from metadata.seg
+     * and rebuilt on open: rows [0, filter_index_count) are indexed.
+     * Catch-up takes filter_lock for writing under write_lock; searches
+     * evaluate filters under it for reading. */
+    filter_index_t *filters;
+    pthread_rwlock_t filter_lock;
+    uint64_t filter_meta_offset; // metadata.seg offset of the next row to index
+
+    /* ID -> row index (id_index.c). Rows are indexed before any write
+     * that checks IDs; entries are set under write_lock with id_lock
+     * held for writing, lookups take id_lock for reading. Deletes live
+     * only here and in the WAL, so ids.idx is saved at checkpoints. */
+    id_index_t *ids;
+    pthread_rwlock_t id_lock;
+    const uint8_t *id_keys; // ids.seg mapping as of the last update, under id_lock
+    uint64_t ids_saved_rows; // rows / deletes in ids.idx
+    uint64_t ids_saved_deletes;
+    uint64_t *replayed_deletes; // deleted rows found by WAL replay, applied by storage_ids_load
+    size_t num_replayed_deletes;
+
+    /* Snapshot of the ID and filter indexes (index_snap.c), written
+     * under write_lock right after a checkpoint. index_snap is the
+     * mapped file while open loads from it; snap_count / snap_deletes
+     * are what the file on disk holds (UINT64_MAX = nothing usable). */
+    index_snap_t *index_snap;
+    uint64_t snap_count;
+    uint64_t snap_deletes;
+    bool snap_ids_used; // the loads took their index from index_snap
+    bool snap_filters_used;
+
+    /* Row numbering: compaction renumbers the rows under layout_lock
+     * held for writing (taken before write_lock). Readers that map rows
+     * back to IDs (searches, get, iterate) hold it for reading, so a
+     * view and the indexes they consult always agree. */
+    pthread_rwlock_t layout_lock;
+
+    /* Compaction (compact.c): compact_lock runs one at a time; the
+     * background thread sleeps on compact_cond under compact_wait_lock */
+    pthread_mutex_t compact_lock;
+    pthread_mutex_t compact_wait_lock;
+    pthread_cond_t compact_cond;
+    pthread_t compact_thread;
+    bool compact_thread_running;
+    bool compact_stop;
+    vdb_compaction_params_t compact_params;
+
+    /* Counters and latency histograms (stats.c), bumped lock-free from
+     * any thread */
+    stats_t *stats;
+
+    /* Search results by query (query_cache.c), off until sized. Every
+     * change searches could see - rows published, a delete, an index or
+     * a search setting swapped - calls query_cache_invalidate once it is
+     * visible. */
+    query_cache_t *query_cache;
+};
+
+/**
+ * Take the published snapshot without locking; release it with
+ * storage_release_view when done with its pointers
+*/
+vdb_status_t storage_acquire_view(vdb_storage_t *storage, storage_view_t *out_view);
+void storage_release_view(vdb_storage_t *storage, storage_view_t *view);
+
+/* The current rows for callers holding write_lock, mapping new data as
+ * needed; only valid until write_lock is released */
+vdb_status_t storage_view_locked(vdb_storage_t *storage, storage_view_t *out_view);
+
+/* Publish the current rows to readers and reclaim what they can no
+ * longer see; caller holds write_lock */
+vdb_status_t storage_publish_locked(vdb_storage_t *storage);
+
+/**
+ * Get the search pool (created on first use), NULL if it can't be made
+*/
+vdb_thread_pool_t *storage_get_pool(vdb_storage_t *storage);
+
+/* Same, for callers already holding write_lock */
+vdb_thread_pool_t *storage_pool_locked(vdb_storage_t *storage);
+
+/**
+ * Run parallel work on pool, owned by the caller, instead of a pool of
+ * the storage's own; the caller keeps pool alive until the storage is
+ * closed or vdb_storage_set_search_threads detaches it
+*/
+vdb_status_t storage_share_pool(vdb_storage_t *storage, vdb_thread_pool_t *pool);
+
+/* Segment helpers shared with the derived-data modules */
+vdb_status_t storage_map_segment(vdb_storage_t *storage, const char *filename,
+                                 segment_map_t *map, size_t needed);
+vdb_status_t storage_retire_map(vdb_storage_t *storage, segment_map_t *map);
+vdb_status_t storage_write_meta(const vdb_storage_t *storage);
+vdb_status_t storage_write_superblock(const vdb_storage_t *storage, const char *path,
+                                      uint64_t count, uint64_t metadata_bytes, uint64_t next_lsn,
+                                      uint64_t deletes);
+
+/* Reopen the segment files and WAL after their paths were replaced,
+ * caller holds write_lock */
+vdb_status_t storage_reopen_segments(vdb_storage_t *storage);
+
+/**
+ * Quantization hooks (quantize.c)
+ * catch_up: encode rows [code_count, count); caller holds write_lock
+ * reset: drop every code, keeping the codec
+ * load: reopen the codes and params files (open path)
+ * codes_file / codes_bytes: the mode's code segment and its length for rows
+ * memory: bytes of the published codec and codes (searches keep them hot)
+*/
+vdb_status_t storage_quant_catch_up(vdb_storage_t *storage);
+vdb_status_t storage_quant_reset(vdb_storage_t *storage);
+vdb_status_t storage_quant_load(vdb_storage_t *storage);
+const char *storage_codes_file(const vdb_storage_t *storage);
+size_t storage_codes_bytes(const vdb_storage_t *storage, uint64_t rows);
+size_t storage_quant_memory(vdb_storage_t *storage);
+
+/**
+ * Index hooks (index.c)
+ * catch_up: wake the sealer if the memtable fills a segment; caller holds write_lock
+ * load: attach hnsw.idx and its segments if present (open path)
+ * save: write unsaved segments and hnsw.idx; caller holds compact_lock,
+ *   or is closing with the sealer stopped
+ * stop: stop the sealer (close path)
+ * remap: the segments over the rows compaction keeps, new_rows[row] is
+ *   a row's new number or UINT64_MAX; caller holds write_lock
+ * adopt: replace the segments with remapped ones (takes ownership)
+ * stand_in: write an hnsw.idx with the params and no segments to path
+*/
+vdb_status_t storage_index_catch_up(vdb_storage_t *storage);
+vdb_status_t storage_index_load(vdb_storage_t *storage);
+vdb_status_t storage_index_save(vdb_storage_t *storage);
+void storage_index_stop(vdb_storage_t *storage);
+vdb_status_t storage_index_remap(vdb_storage_t *storage, const uint64_t *new_rows,
+                                 index_segment_t **out_segments, size_t *out_num);
+void storage_index_adopt(vdb_storage_t *storage, index_segment_t *segments, size_t num);
+void storage_index_segments_free(index_segment_t *segments, size_t num);
+vdb_status_t storage_index_stand_in(const vdb_storage_t *storage, const char *path);
+
+/**
+ * DiskANN hooks (diskann.c)
+ * load: attach diskann.idx if it still fits the rows (open path)
+ * drop: close the index and delete diskann.idx; caller holds layout_lock
+ *   for writing and write_lock
+*/
+vdb_status_t storage_diskann_load(vdb_storage_t *storage);
+vdb_status_t storage_diskann_drop(vdb_storage_t *storage);
+
+/**
+ * Filter hooks (filter_index.c)
+ * catch_up: index the metadata of rows not indexed yet; caller holds write_lock
+ * load: build the index from metadata.seg (create / open path)
+ * eval: rows matching filter, NULL filter = every indexed row
+*/
+vdb_status_t storage_filter_catch_up(vdb_storage_t *storage);
+vdb_status_t storage_filter_load(vdb_storage_t *storage);
+vdb_status_t storage_filter_eval(vdb_storage_t *storage, const vdb_filter_t *filter, roaring_t *out);
+
+/**
+ * ID index hooks (id_index.c)
+ * catch_up: index rows not indexed yet; caller holds write_lock
+ * load: attach ids.idx, index the rest and apply replayed deletes (create / open path)
+ * save: write ids.idx if it lacks deletes, or any change when closing; caller holds write_lock
+ * find: look an ID up without write_lock
+ * dead / dead_count: the superseded and deleted rows, without write_lock
+*/
+vdb_status_t storage_ids_catch_up(vdb_storage_t *storage);
+vdb_status_t storage_ids_load(vdb_storage_t *storage);
+vdb_status_t storage_ids_save(vdb_storage_t *storage, bool closing);
+id_index_entry_t storage_ids_find(vdb_storage_t *storage, const char *id);
+vdb_status_t storage_ids_dead(vdb_storage_t *storage, roaring_t *out);
+uint64_t storage_ids_dead_count(vdb_storage_t *storage);
+
+/**
+ * Index snapshot hooks (index_snap.c)
+ * open: map index.snap if it fits the collection (open path, after WAL replay)
+ * release: unmap it once the ID and filter indexes are loaded
+ * save: write index.snap if the indexes changed; caller holds write_lock
+ *   right after a checkpoint
+ * drop: delete index.snap before the rows are renumbered
+*/
+vdb_status_t storage_index_snap_open(vdb_storage_t *storage);
+void storage_index_snap_release(vdb_storage_t *storage);
+vdb_status_t storage_index_snap_save(vdb_storage_t *storage);
+vdb_status_t storage_index_snap_drop(vdb_storage_t *storage);
+
+/**
+ * Compaction hooks (compact.c)
+ * recover: finish or discard an interrupted swap (open path, before
+ *   collection.meta is read)
+ * stop: stop the background compactor (close path)
+ * if_due: one check-and-compact round of the background compactor, for
+ *   callers running it on their own thread (vdb_db_t)
+*/
+vdb_status_t storage_compact_recover(const char *base_dir, const char *name);
+void storage_compact_stop(vdb_storage_t *storage);
+bool storage_compaction_params_valid(const vdb_compaction_params_t *params);
+vdb_status_t storage_compact_if_due(vdb_storage_t *storage, const vdb_compaction_params_t *params);
+
+/* Metric the kernels run: cosine over unit rows (and unit queries) is
+ * a plain dot product */
+static inline vdb_metric_t storage_scan_metric(const vdb_storage_t *storage) {
+    return storage->normalize != VDB_NORMALIZE_NONE ? VDB_METRIC_INNER_PRODUCT : storage->metric;
+}
+
+/* Row accessors on a view; rows hold storage->element values */
+static inline const void *storage_view_row(const vdb_storage_t *storage,
+                                           const storage_view_t *view, uint64_t row) {
+    return view->embeddings + row * storage->row_bytes;
+}
+
+static inline const char *storage_view_id(const storage_view_t *view, uint64_t row) {
+    return (const char*)(view->ids + row * VDB_ID_MAX_LEN);
+}
+
+#endif /* VDB_STORAGE_INTERNAL_H */
@@ -0,0 +1,211 @@
+/**
+ * superblock.c - Binary collection header encoding
+ *
+ * Fields are packed byte by byte so the file is little-endian whatever
+ * the host is.
+*/
+
+#include "superblock.h"
+#include "storage_internal.h"
+#include "crc32c.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUPERBLOCK_CRC_OFFSET (SUPERBLOCK_SIZE - 4)
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+uint32_t superblock_quantization_features(vdb_quantization_t mode) {
+    switch (mode) {
+        case VDB_QUANTIZATION_SQ8: return SUPERBLOCK_FEATURE_SQ8;
+        case VDB_QUANTIZATION_PQ: return SUPERBLOCK_FEATURE_PQ;
+        default: return 0;
+    }
+}
+
+vdb_quantization_t superblock_quantization(uint32_t features) {
+    if (features & SUPERBLOCK_FEATURE_PQ) {
+        return VDB_QUANTIZATION_PQ;
+    }
+    return (features & SUPERBLOCK_FEATURE_SQ8) ? VDB_QUANTIZATION_SQ8 : VDB_QUANTIZATION_NONE;
+}
+
+uint32_t superblock_element_features(vdb_element_type_t type) {
+    switch (type) {
+        case VDB_ELEMENT_F16: return SUPERBLOCK_FEATURE_F16;
+        case VDB_ELEMENT_BF16: return SUPERBLOCK_FEATURE_BF16;
+        default: return 0;
+    }
+}
+
+vdb_element_type_t superblock_element(uint32_t features) {
+    if (features & SUPERBLOCK_FEATURE_BF16) {
+        return VDB_ELEMENT_BF16;
+    }
+    return (features & SUPERBLOCK_FEATURE_F16) ? VDB_ELEMENT_F16 : VDB_ELEMENT_F32;
+}
+
+uint32_t superblock_normalize_features(vdb_normalize_t mode) {
+    switch (mode) {
+        case VDB_NORMALIZE_UNIT: return SUPERBLOCK_FEATURE_NORMALIZED;
+        case VDB_NORMALIZE_KEEP_NORMS: return SUPERBLOCK_FEATURE_NORMALIZED | SUPERBLOCK_FEATURE_NORMS;
+        default: return 0;
+    }
+}
+
+vdb_normalize_t superblock_normalize(uint32_t features) {
+    if (features & SUPERBLOCK_FEATURE_NORMS) {
+        return VDB_NORMALIZE_KEEP_NORMS;
+    }
+    return (features & SUPERBLOCK_FEATURE_NORMALIZED) ? VDB_NORMALIZE_UNIT : VDB_NORMALIZE_NONE;
+}
+
+static bool superblock_valid(const superblock_t *sb) {
+    return sb->dim > 0 && sb->dim <= VDB_COLLECTION_MAX_DIM && vdb_metric_is_valid(sb->metric) &&
+           (sb->features & ~SUPERBLOCK_FEATURES_KNOWN) == 0 &&
+           (sb->features & (SUPERBLOCK_FEATURE_SQ8 | SUPERBLOCK_FEATURE_PQ)) !=
+               (SUPERBLOCK_FEATURE_SQ8 | SUPERBLOCK_FEATURE_PQ) && // one quantization mode
+           (sb->features & (SUPERBLOCK_FEATURE_F16 | SUPERBLOCK_FEATURE_BF16)) !=
+               (SUPERBLOCK_FEATURE_F16 | SUPERBLOCK_FEATURE_BF16) && // one element type
+           ((sb->features & SUPERBLOCK_FEATURE_NORMS) == 0 ||
+            (sb->features & SUPERBLOCK_FEATURE_NORMALIZED) != 0) &&
+           ((sb->features & SUPERBLOCK_FEATURE_NORMALIZED) == 0 || sb->metric == VDB_METRIC_COSINE) &&
+           sb->pq_subspaces <= VDB_PQ_MAX_SUBSPACES && sb->next_lsn > 0;
+}
+
+vdb_status_t superblock_write(const char *path, const superblock_t *sb) {
+    uint8_t buf[SUPERBLOCK_SIZE];
+    memset(buf, 0, sizeof(buf));
+    put_u32(buf + 0, SUPERBLOCK_MAGIC);
+    put_u32(buf + 4, SUPERBLOCK_VERSION);
+    put_u32(buf + 8, SUPERBLOCK_SIZE);
+    put_u32(buf + 12, sb->features);
+    put_u32(buf + 16, sb->dim);
+    put_u32(buf + 20, (uint32_t)sb->metric);
+    put_u32(buf + 24, sb->pq_subspaces);
+    put_u64(buf + 32, sb->count);
+    put_u64(buf + 40, sb->next_lsn);
+    put_u64(buf + 48, sb->deletes);
+    put_u64(buf + 56, sb->metadata_bytes);
+    put_u32(buf + SUPERBLOCK_CRC_OFFSET, crc32c(0, buf, SUPERBLOCK_CRC_OFFSET));
+
+    // written aside and renamed over, so a crash leaves the old or the new one
+    char tmp_path[MAX_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        return VDB_ERROR_IO;
+    }
+    bool ok = fwrite(buf, 1, sizeof(buf), fp) == sizeof(buf);
+    ok = fflush(fp) == 0 && ok;
+    ok = fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return VDB_ERROR_IO;
+    }
+
+    return VDB_OK;
+}
+
+/**
+ * Parse the text collection.meta written before the superblock
+*/
+static vdb_status_t read_legacy_meta(FILE *fp, superblock_t *sb) {
+    int metric_int;
+    unsigned long count_ul;
+    int quant_int = VDB_QUANTIZATION_NONE;
+
+    int n = fscanf(fp, "dimension=%u\nmetric=%d\ncount=%lu\n", &sb->dim, &metric_int, &count_ul);
+    if (n != 3) {
+        return VDB_ERROR_CORRUPTED;
+    }
+    if (fscanf(fp, "quantization=%d\n", &quant_int) != 1) {
+        quant_int = VDB_QUANTIZATION_NONE; // written before quantization existed
+    }
+    if (quant_int < VDB_QUANTIZATION_NONE || quant_int > VDB_QUANTIZATION_PQ) {
+        return VDB_ERROR_CORRUPTED;
+    }
+
+    sb->metric = (vdb_metric_t)metric_int;
+    sb->count = (uint64_t)count_ul;
+    sb->features = superblock_quantization_features((vdb_quantization_t)quant_int);
+    sb->pq_subspaces = 0;
+    sb->next_lsn = 1;
+    sb->deletes = 0;
+    sb->metadata_bytes = SUPERBLOCK_METADATA_UNKNOWN;
+    return VDB_OK;
+}
+
+vdb_status_t superblock_read(const char *path, superblock_t *out_sb) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return VDB_ERROR_NOT_FOUND;
+    }
+
+    uint8_t buf[SUPERBLOCK_SIZE];
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    if (ferror(fp)) {
+        fclose(fp);
+        return VDB_ERROR_IO;
+    }
+
+    superblock_t sb;
+    memset(&sb, 0, sizeof(sb));
+    vdb_status_t status = VDB_OK;
+    if (n >= 10 && memcmp(buf, "dimension=", 10) == 0) {
+        rewind(fp);
+        status = read_legacy_meta(fp, &sb);
+    } else if (n != SUPERBLOCK_SIZE || get_u32(buf + 0) != SUPERBLOCK_MAGIC ||
+               (get_u32(buf + 4) != SUPERBLOCK_VERSION && get_u32(buf + 4) != 1) ||
+               get_u32(buf + 8) != SUPERBLOCK_SIZE ||
+               get_u32(buf + SUPERBLOCK_CRC_OFFSET) != crc32c(0, buf, SUPERBLOCK_CRC_OFFSET)) {
+        status = VDB_ERROR_CORRUPTED;
+    } else {
+        sb.features = get_u32(buf + 12);
+        sb.dim = get_u32(buf + 16);
+        sb.metric = (vdb_metric_t)get_u32(buf + 20);
+        sb.pq_subspaces = get_u32(buf + 24);
+        sb.count = get_u64(buf + 32);
+        sb.next_lsn = get_u64(buf + 40);
+        sb.deletes = get_u64(buf + 48);
+        sb.metadata_bytes = get_u32(buf + 4) >= 2 ? get_u64(buf + 56) : SUPERBLOCK_METADATA_UNKNOWN;
+    }
+    fclose(fp);
+
+    if (status == VDB_OK && !superblock_valid(&sb)) {
+        status = VDB_ERROR_CORRUPTED;
+    }
+    if (status == VDB_OK) {
+        *out_sb = sb;
+    }
+    return status;
+}
@@ -0,0 +1,93 @@
+/**
+ * superblock.h - Internal binary collection header (collection.meta)
+ *
+ * A fixed SUPERBLOCK_SIZE-byte record, all fields little-endian:
+ *   0   uint32 magic "VDSB"
+ *   4   uint32 format version
+ *   8   uint32 size of the record (SUPERBLOCK_SIZE)
+ *   12  uint32 feature flags (SUPERBLOCK_FEATURE_*)
+ *   16  uint32 dimension
+ *   20  uint32 metric
+ *   24  uint32 PQ subspaces to train with (0 = default)
+ *   28  uint32 reserved
+ *   32  uint64 checkpointed row count
+ *   40  uint64 LSN of the first WAL frame after the checkpoint
+ *   48  uint64 deletes recorded in ids.idx (0 = ids.idx can be rebuilt)
+ *   56  uint64 length of metadata.seg at the checkpointed count (version 2)
+ *   64  ...    reserved, zero
+ *   252 uint32 CRC32C of bytes [0, 252)
+ *
+ * Readers refuse feature bits they don't know, so a flag can change
+ * how the other files must be read. Rewritten whole at checkpoints
+ * (temp file + rename), so it is the old record or the new one.
+*/
+
+#ifndef VDB_SUPERBLOCK_H
+#define VDB_SUPERBLOCK_H
+
+#include "vdb/storage.h"
+
+#define SUPERBLOCK_MAGIC 0x42534456u /* "VDSB" */
+#define SUPERBLOCK_VERSION 2
+#define SUPERBLOCK_SIZE 256
+
+/* metadata_bytes of records that don't have it (version 1, text meta):
+ * found by walking the length prefixes of the checkpointed rows */
+#define SUPERBLOCK_METADATA_UNKNOWN UINT64_MAX
+
+/* Feature flags */
+#define SUPERBLOCK_FEATURE_SQ8 (1u << 0) // embeddings.sq8 + sq8.params
+#define SUPERBLOCK_FEATURE_PQ (1u << 1) // embeddings.pq + pq.params
+#define SUPERBLOCK_FEATURE_PADDED_ROWS (1u << 2) // embeddings.seg rows padded to VDB_ROW_ALIGN
+#define SUPERBLOCK_FEATURE_F16 (1u << 3) // embeddings.seg holds IEEE halves
+#define SUPERBLOCK_FEATURE_BF16 (1u << 4) // embeddings.seg holds bfloat16
+#define SUPERBLOCK_FEATURE_NORMALIZED (1u << 5) // embeddings.seg holds unit vectors
+#define SUPERBLOCK_FEATURE_NORMS (1u << 6) // norms.seg holds their original norms
+#define SUPERBLOCK_FEATURES_KNOWN (SUPERBLOCK_FEATURE_SQ8 | SUPERBLOCK_FEATURE_PQ | \
+                                   SUPERBLOCK_FEATURE_PADDED_ROWS | SUPERBLOCK_FEATURE_F16 | \
+                                   SUPERBLOCK_FEATURE_BF16 | SUPERBLOCK_FEATURE_NORMALIZED | \
+                                   SUPERBLOCK_FEATURE_NORMS)
+
+typedef struct {
+    uint32_t features;
+    uint32_t dim;
+    vdb_metric_t metric;
+    uint32_t pq_subspaces;
+    uint64_t count;
+    uint64_t next_lsn;
+    uint64_t deletes;
+    uint64_t metadata_bytes; // or SUPERBLOCK_METADATA_UNKNOWN
+} superblock_t;
+
+/* Quantization mode <-> feature flags */
+uint32_t superblock_quantization_features(vdb_quantization_t mode);
+vdb_quantization_t superblock_quantization(uint32_t features);
+
+/* Element type <-> feature flags */
+uint32_t superblock_element_features(vdb_element_type_t type);
+vdb_element_type_t superblock_element(uint32_t features);
+
+/* Normalization <-> feature flags */
+uint32_t superblock_normalize_features(vdb_normalize_t mode);
+vdb_normalize_t superblock_normalize(uint32_t features);
+
+/**
+ * Write the superblock to path.tmp, fsync it and rename it over path
+ * The caller syncs the directory if the rename itself must be durable.
+*/
+vdb_status_t superblock_write(const char *path, const superblock_t *sb);
+
+/**
+ * Read and validate the superblock
+ * Also accepts version 1 records and the old text collection.meta
+ * (dimension=/metric=/count=), which are replaced by the current record
+ * at the next checkpoint.
+ *
+ * Returns:
+ * - VDB_ERROR_NOT_FOUND: No file
+ * - VDB_ERROR_CORRUPTED: Bad magic, size, checksum or field
+ * - VDB_ERROR_IO: Read failed
+*/
+vdb_status_t superblock_read(const char *path, superblock_t *out_sb);
+
+#endif /* VDB_SUPERBLOCK_H */
@@ -0,0 +1,202 @@
+/**
+ * thread_pool.c - Internal fixed-size worker pool
+ *
+ * Tasks are coarse (thousands of rows each), so claiming them under a
+ * single mutex costs nothing measurable and keeps the code simple.
+*/
+
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* One queued job */
+typedef struct pool_job {
+    vdb_task_fn fn;
+    void *ctx;
+    size_t num_tasks;
+    size_t next_task; // next index to hand out
+    size_t done_tasks; // finished tasks
+    struct pool_job *next;
+} pool_job_t;
+
+struct vdb_thread_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond; // jobs queued or stopping
+    pthread_cond_t done_cond; // a job finished
+    pool_job_t *head; // jobs with unclaimed tasks
+    pool_job_t *tail;
+    bool stop;
+    size_t num_workers;
+    pthread_t *workers;
+};
+
+/**
+ * Claim one task from the head job; caller holds lock
+ * Returns false if no job has tasks left
+*/
+static bool claim_task(vdb_thread_pool_t *pool, pool_job_t **out_job, size_t *out_index) {
+    pool_job_t *job = pool->head;
+    if (job == NULL) {
+        return false;
+    }
+
+    *out_job = job;
+    *out_index = job->next_task++;
+    if (job->next_task == job->num_tasks) {
+        // fully handed out - unlink so others move on to the next job
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+    }
+    return true;
+}
+
+/**
+ * Run one claimed task and account for it; caller holds lock
+*/
+static void run_task(vdb_thread_pool_t *pool, pool_job_t *job, size_t index) {
+    pthread_mutex_unlock(&pool->lock);
+    job->fn(job->ctx, index);
+    pthread_mutex_lock(&pool->lock);
+
+    job->done_tasks++;
+    if (job->done_tasks == job->num_tasks) {
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+}
+
+static void *worker_main(void *arg) {
+    vdb_thread_pool_t *pool = (vdb_thread_pool_t*)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        pool_job_t *job;
+        size_t index;
+        if (claim_task(pool, &job, &index)) {
+            run_task(pool, job, index);
+            continue;
+        }
+        if (pool->stop) {
+            break;
+        }
+        pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+size_t vdb_thread_pool_default_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 1 ? (size_t)(cpus - 1) : 0;
+}
+
+vdb_status_t vdb_thread_pool_create(size_t num_workers, vdb_thread_pool_t **out_pool) {
+    if (out_pool == NULL) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    vdb_thread_pool_t *pool = (vdb_thread_pool_t*)calloc(1, sizeof(vdb_thread_pool_t));
+    if (pool == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    if (num_workers > 0) {
+        pool->workers = (pthread_t*)calloc(num_workers, sizeof(pthread_t));
+        if (pool->workers == NULL) {
+            free(pool);
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (size_t i = 0; i < num_workers; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+            // keep the threads we got
+            break;
+        }
+        pool->num_workers++;
+    }
+
+    *out_pool = pool;
+    return VDB_OK;
+}
+
+void vdb_thread_pool_destroy(vdb_thread_pool_t **pool) {
+    if (pool == NULL || *pool == NULL) {
+        return;
+    }
+
+    vdb_thread_pool_t *p = *pool;
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->work_cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (size_t i = 0; i < p->num_workers; i++) {
+        pthread_join(p->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&p->done_cond);
+    pthread_cond_destroy(&p->work_cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p->workers);
+    free(p);
+    *pool = NULL;
+}
+
+void vdb_thread_pool_run(vdb_thread_pool_t *pool, size_t num_tasks, vdb_task_fn fn, void *ctx) {
+    if (num_tasks == 0) {
+        return;
+    }
+
+    // nothing to share - skip the queue entirely
+    if (pool == NULL || pool->num_workers == 0 || num_tasks == 1) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+
+    pool_job_t job = { fn, ctx, num_tasks, 0, 0, NULL };
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) {
+        pool->tail->next = &job;
+    } else {
+        pool->head = &job;
+    }
+    pool->tail = &job;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    // help with our own job until it is fully handed out
+    while (job.next_task < job.num_tasks) {
+        size_t index = job.next_task++;
+        if (job.next_task == job.num_tasks) {
+            // unlink; it may not be at the head if others queued first
+            pool_job_t **link = &pool->head;
+            pool_job_t *prev = NULL;
+            while (*link != &job) {
+                prev = *link;
+                link = &(*link)->next;
+            }
+            *link = job.next;
+            if (pool->tail == &job) {
+                pool->tail = prev;
+            }
+        }
+        run_task(pool, &job, index);
+    }
+
+    while (job.done_tasks < job.num_tasks) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t vdb_thread_pool_concurrency(const vdb_thread_pool_t *pool) {
+    return pool != NULL ? pool->num_workers + 1 : 1;
+}
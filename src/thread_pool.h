@@ -0,0 +1,47 @@
+/**
+ * thread_pool.h - Internal fixed-size worker pool
+ *
+ * A job is a function run over task indices [0, num_tasks). Jobs are
+ * queued FIFO, so concurrent callers (e.g. two searches) share the
+ * workers instead of serializing on the pool. The calling thread also
+ * works on its own job while it waits, so a pool with 0 workers simply
+ * runs everything inline.
+*/
+
+#ifndef VDB_THREAD_POOL_H
+#define VDB_THREAD_POOL_H
+
+#include "vdb/types.h"
+
+typedef struct vdb_thread_pool vdb_thread_pool_t;
+
+/* Task callback: called once per task index */
+typedef void (*vdb_task_fn)(void *ctx, size_t task_index);
+
+/**
+ * Create a pool with num_workers background threads (0 is valid)
+*/
+vdb_status_t vdb_thread_pool_create(size_t num_workers, vdb_thread_pool_t **out_pool);
+
+/**
+ * Stop the workers and free the pool. Safe with NULL.
+ * No job may be running.
+*/
+void vdb_thread_pool_destroy(vdb_thread_pool_t **pool);
+
+/**
+ * Run fn over num_tasks tasks and wait for all of them to finish
+*/
+void vdb_thread_pool_run(vdb_thread_pool_t *pool, size_t num_tasks, vdb_task_fn fn, void *ctx);
+
+/**
+ * Threads that can work on a job: workers + the calling thread
+*/
+size_t vdb_thread_pool_concurrency(const vdb_thread_pool_t *pool);
+
+/**
+ * Default worker count: online CPUs minus the calling thread
+*/
+size_t vdb_thread_pool_default_workers(void);
+
+#endif /* VDB_THREAD_POOL_H */
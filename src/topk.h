@@ -0,0 +1,103 @@
+/**
+ * topk.h - Internal bounded top-k selection
+ *
+ * A max-heap of at most k (distance, row) pairs: the root is the worst
+ * candidate kept so far, so rejecting a row costs one compare. Ties on
+ * distance are broken by row so results are deterministic no matter
+ * how the scan was split across threads.
+*/
+
+#ifndef VDB_TOPK_H
+#define VDB_TOPK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+typedef struct {
+    float distance;
+    uint64_t row;
+} vdb_topk_entry_t;
+
+typedef struct {
+    vdb_topk_entry_t *entries; // caller-provided, capacity k
+    size_t size;
+    size_t k;
+} vdb_topk_t;
+
+/* a ranks worse than b (farther, or same distance and later row) */
+static inline int topk_worse(const vdb_topk_entry_t *a, const vdb_topk_entry_t *b) {
+    return a->distance > b->distance || (a->distance == b->distance && a->row > b->row);
+}
+
+static inline void topk_init(vdb_topk_t *heap, vdb_topk_entry_t *entries, size_t k) {
+    heap->entries = entries;
+    heap->size = 0;
+    heap->k = k;
+}
+
+/* Distance a candidate must beat to get in (+inf until the heap is full) */
+static inline float topk_threshold(const vdb_topk_t *heap) {
+    return heap->size < heap->k ? INFINITY : heap->entries[0].distance;
+}
+
+static inline void topk_sift_down(vdb_topk_entry_t *e, size_t size, size_t i) {
+    for (;;) {
+        size_t left = 2 * i + 1;
+        size_t worst = i;
+        if (left < size && topk_worse(&e[left], &e[worst])) {
+            worst = left;
+        }
+        if (left + 1 < size && topk_worse(&e[left + 1], &e[worst])) {
+            worst = left + 1;
+        }
+        if (worst == i) {
+            return;
+        }
+        vdb_topk_entry_t tmp = e[i];
+        e[i] = e[worst];
+        e[worst] = tmp;
+        i = worst;
+    }
+}
+
+/* Offer a candidate; keeps it only if it ranks among the best k */
+static inline void topk_push(vdb_topk_t *heap, float distance, uint64_t row) {
+    vdb_topk_entry_t cand = { distance, row };
+    vdb_topk_entry_t *e = heap->entries;
+
+    if (heap->size < heap->k) {
+        size_t i = heap->size++;
+        e[i] = cand;
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!topk_worse(&e[i], &e[parent])) {
+                break;
+            }
+            vdb_topk_entry_t tmp = e[i];
+            e[i] = e[parent];
+            e[parent] = tmp;
+            i = parent;
+        }
+        return;
+    }
+
+    if (heap->k == 0 || !topk_worse(&e[0], &cand)) {
+        return;
+    }
+    e[0] = cand;
+    topk_sift_down(e, heap->size, 0);
+}
+
+/* Sort entries best-first in place (the heap is unusable afterwards) */
+static inline void topk_sort(vdb_topk_t *heap) {
+    vdb_topk_entry_t *e = heap->entries;
+    for (size_t n = heap->size; n > 1; n--) {
+        vdb_topk_entry_t tmp = e[0];
+        e[0] = e[n - 1];
+        e[n - 1] = tmp;
+        topk_sift_down(e, n - 1, 0);
+    }
+}
+
+#endif /* VDB_TOPK_H */
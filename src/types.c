@@ -17,6 +17,8 @@ const char* vdb_metric_to_string(vdb_metric_t metric) {
             return "cosine";
         case VDB_METRIC_EUCLIDEAN:
             return "euclidean";
+        case VDB_METRIC_INNER_PRODUCT:
+            return "dot";
         default:
             return "unknown";
     }
@@ -51,7 +53,33 @@ const char* vdb_status_to_string(vdb_status_t status) {
 
 // validate metric type
 bool vdb_metric_is_valid(vdb_metric_t metric) {
-    return (metric == VDB_METRIC_COSINE || metric == VDB_METRIC_EUCLIDEAN);
+    return (metric == VDB_METRIC_COSINE || metric == VDB_METRIC_EUCLIDEAN ||
+            metric == VDB_METRIC_INNER_PRODUCT);
+}
+
+size_t vdb_element_size(vdb_element_type_t type) {
+    switch (type) {
+        case VDB_ELEMENT_F32:
+            return sizeof(float);
+        case VDB_ELEMENT_F16:
+        case VDB_ELEMENT_BF16:
+            return sizeof(uint16_t);
+        default:
+            return 0;
+    }
+}
+
+const char* vdb_element_type_to_string(vdb_element_type_t type) {
+    switch (type) {
+        case VDB_ELEMENT_F32:
+            return "f32";
+        case VDB_ELEMENT_F16:
+            return "f16";
+        case VDB_ELEMENT_BF16:
+            return "bf16";
+        default:
+            return "unknown";
+    }
 }
 
 // create a vector
@@ -66,8 +94,12 @@ vdb_status_t vdb_vector_create(uint32_t dim, vdb_vector_t *out_vector) {
         return VDB_ERROR_INVALID_ARGUMENT;
     }
 
-    // allocate and zero-initialize
-    float *data = (float*)calloc(dim, sizeof(float));
+    // aligned_alloc wants a multiple of the alignment; the tail is zeroed too
+    size_t bytes = ((size_t)dim * sizeof(float) + VDB_VECTOR_ALIGN - 1) / VDB_VECTOR_ALIGN * VDB_VECTOR_ALIGN;
+    float *data = (float*)aligned_alloc(VDB_VECTOR_ALIGN, bytes);
+    if (data != NULL) {
+        memset(data, 0, bytes);
+    }
     if (data == NULL) {
         out_vector->dim = 0;
         out_vector->data = NULL;
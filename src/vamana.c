@@ -0,0 +1,957 @@
+/**
+ * vamana.c - Vamana graph construction, sector file and beam search
+ *
+ * Follows Subramanya et al. (DiskANN): the graph is built by inserting
+ * every node in random order - a greedy search from the medoid, then
+ * RobustPrune over the nodes it expanded - in two passes, the first
+ * with alpha = 1 and the second with the configured alpha, which keeps
+ * some longer links so searches need fewer hops (fewer reads).
+ *
+ * The search is the beam search of the paper: the candidate list is
+ * ordered by the caller's approximate distance, and each round reads
+ * the records of the best few unexpanded candidates together (one aio
+ * batch, so io_uring has them in flight at once). The full-precision
+ * rows in those records give the exact distances the results carry.
+*/
+
+#define _GNU_SOURCE // O_DIRECT
+
+#include "vamana.h"
+#include "vdb/distance.h"
+#include "aio.h"
+#include "crc32c.h"
+#include "scratch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* On-disk format */
+#define VAMANA_MAGIC 0x4E4E4144u /* "DANN" */
+#define VAMANA_VERSION 1u
+
+/* Sectors per write() while saving */
+#define VAMANA_WRITE_SECTORS 64
+
+/* Idle io_uring rings kept for later searches */
+#define VAMANA_MAX_RINGS 64
+
+/* Slots of a search's visited set to start with */
+#define VAMANA_VISITED_SLOTS 1024
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t metric;
+    uint32_t element;
+    uint32_t dim;
+    uint32_t num_nodes;
+    uint32_t entry_point;
+    uint32_t max_degree;
+    uint32_t build_list;
+    float alpha;
+    uint32_t search_list;
+    uint32_t beam_width;
+    uint64_t row_bytes; // stride of the rows the records copy
+    uint32_t record_bytes;
+    uint32_t crc; // CRC32C of everything before it
+} __attribute__((packed)) vamana_header_t;
+
+struct vamana_index {
+    int fd;
+    vdb_metric_t metric;
+    vdb_element_type_t element;
+    uint32_t dim;
+    size_t row_bytes;
+    uint32_t num_nodes;
+    uint32_t entry_point;
+    vdb_diskann_params_t params; // search_list / beam_width are the search defaults
+
+    /* Record layout */
+    uint32_t record_bytes;
+    uint32_t links_offset; // [count, ids...] after the row, 4-aligned
+    uint32_t per_sector; // records per sector, 0 = each takes record_sectors
+    uint32_t record_sectors;
+    uint64_t file_bytes;
+
+    /* Idle rings; searches take one each */
+    atomic_bool uring;
+    pthread_mutex_t ring_lock;
+    aio_ring_t *rings[VAMANA_MAX_RINGS];
+    size_t num_rings;
+};
+
+static uint32_t links_offset(size_t row_bytes) {
+    return (uint32_t)((row_bytes + 3) & ~(size_t)3);
+}
+
+/* Fill in the record layout from row_bytes and max_degree */
+static void set_layout(vamana_index_t *index) {
+    index->links_offset = links_offset(index->row_bytes);
+    index->record_bytes = index->links_offset + (1 + index->params.max_degree) * (uint32_t)sizeof(uint32_t);
+    uint64_t sectors;
+    if (index->record_bytes <= VAMANA_SECTOR_BYTES) {
+        index->per_sector = VAMANA_SECTOR_BYTES / index->record_bytes;
+        index->record_sectors = 1;
+        sectors = ((uint64_t)index->num_nodes + index->per_sector - 1) / index->per_sector;
+    } else {
+        index->per_sector = 0;
+        index->record_sectors = (index->record_bytes + VAMANA_SECTOR_BYTES - 1) / VAMANA_SECTOR_BYTES;
+        sectors = (uint64_t)index->num_nodes * index->record_sectors;
+    }
+    index->file_bytes = (1 + sectors) * VAMANA_SECTOR_BYTES;
+}
+
+/* File offset of the sector(s) holding a node's record */
+static uint64_t record_sector(const vamana_index_t *index, uint32_t node) {
+    uint64_t sector = index->per_sector > 0 ? node / index->per_sector
+                                            : (uint64_t)node * index->record_sectors;
+    return (1 + sector) * VAMANA_SECTOR_BYTES;
+}
+
+/* Where in its sector(s) a node's record starts */
+static size_t record_offset(const vamana_index_t *index, uint32_t node) {
+    return index->per_sector > 0 ? (size_t)(node % index->per_sector) * index->record_bytes : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Candidate list: the best nodes so far, sorted closest first         */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    float distance;
+    uint32_t node;
+    bool expanded;
+} candidate_t;
+
+typedef struct {
+    candidate_t *c;
+    uint32_t size;
+    uint32_t cap;
+} cand_list_t;
+
+/**
+ * Insert unless the list is full of closer nodes; the worst falls off
+ * Returns the position it went in at, cap if it didn't.
+*/
+static uint32_t list_insert(cand_list_t *list, float distance, uint32_t node) {
+    if (list->size == list->cap && distance >= list->c[list->size - 1].distance) {
+        return list->cap;
+    }
+    uint32_t lo = 0;
+    uint32_t hi = list->size;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (list->c[mid].distance <= distance) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    uint32_t moved = (list->size < list->cap ? list->size : list->cap - 1) - lo;
+    memmove(&list->c[lo + 1], &list->c[lo], moved * sizeof(candidate_t));
+    list->c[lo].distance = distance;
+    list->c[lo].node = node;
+    list->c[lo].expanded = false;
+    if (list->size < list->cap) {
+        list->size++;
+    }
+    return lo;
+}
+
+/* ------------------------------------------------------------------ */
+/* Build                                                               */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    uint32_t *tags; // visited set over every node, generation-tagged
+    uint32_t generation;
+    candidate_t *list; // build_list
+    vdb_topk_entry_t *pool; // expanded nodes, then the prune candidates
+    size_t pool_size;
+    size_t pool_cap;
+    uint32_t *links; // 1 + max_degree, copy of a neighbour list
+    uint32_t *selected; // max_degree
+} build_scratch_t;
+
+typedef struct {
+    const hnsw_space_t *space;
+    uint32_t num_nodes;
+    uint32_t max_degree;
+    uint32_t build_list;
+    float alpha; // of the current pass
+    uint32_t entry_point;
+    uint32_t *links; // (1 + max_degree) per node: [count, ids...]
+    atomic_uchar *locks;
+    const uint32_t *order; // insertion order
+    atomic_uint next;
+    build_scratch_t *scratch; // one per task
+    atomic_int status;
+} vamana_build_t;
+
+static inline uint32_t *node_links(const vamana_build_t *build, uint32_t node) {
+    return build->links + (size_t)node * (1 + build->max_degree);
+}
+
+/* Per-node spinlock, as in hnsw.c */
+static inline void node_lock(const vamana_build_t *build, uint32_t node) {
+    unsigned spins = 0;
+    while (atomic_exchange_explicit(&build->locks[node], 1, memory_order_acquire)) {
+        if (++spins % 64 == 0) {
+            sched_yield();
+        }
+    }
+}
+
+static inline void node_unlock(const vamana_build_t *build, uint32_t node) {
+    atomic_store_explicit(&build->locks[node], 0, memory_order_release);
+}
+
+static float space_distance(const hnsw_space_t *space, uint32_t a, uint32_t b) {
+    return vdb_distance_rows(space->metric, space->element,
+                             space->base + (size_t)a * space->stride,
+                             space->base + (size_t)b * space->stride,
+                             space->dim);
+}
+
+static bool pool_push(build_scratch_t *scratch, float distance, uint32_t node) {
+    if (scratch->pool_size == scratch->pool_cap) {
+        size_t cap = scratch->pool_cap * 2;
+        vdb_topk_entry_t *grown = (vdb_topk_entry_t*)realloc(scratch->pool, cap * sizeof(vdb_topk_entry_t));
+        if (grown == NULL) {
+            return false;
+        }
+        scratch->pool = grown;
+        scratch->pool_cap = cap;
+    }
+    scratch->pool[scratch->pool_size].distance = distance;
+    scratch->pool[scratch->pool_size].row = node;
+    scratch->pool_size++;
+    return true;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const vdb_topk_entry_t *x = (const vdb_topk_entry_t*)a;
+    const vdb_topk_entry_t *y = (const vdb_topk_entry_t*)b;
+    if (x->distance != y->distance) {
+        return x->distance < y->distance ? -1 : 1;
+    }
+    return x->row < y->row ? -1 : x->row > y->row;
+}
+
+/**
+ * RobustPrune: cands sorted closest-first by distance to node (duplicates
+ * adjacent); keeps a candidate unless a kept neighbour o is so close to
+ * it that alpha * d(o, c) <= d(node, c). Writes up to max_degree ids to
+ * out, returns how many.
+*/
+static uint32_t robust_prune(const vamana_build_t *build, uint32_t node, const vdb_topk_entry_t *cands,
+                             size_t num_cands, float alpha, uint32_t *out) {
+    uint32_t selected = 0;
+    for (size_t i = 0; i < num_cands && selected < build->max_degree; i++) {
+        uint32_t c = (uint32_t)cands[i].row;
+        if (c == node || (i > 0 && cands[i - 1].row == c)) {
+            continue;
+        }
+        bool keep = true;
+        for (uint32_t j = 0; j < selected; j++) {
+            if (alpha * space_distance(build->space, out[j], c) <= cands[i].distance) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            out[selected++] = c;
+        }
+    }
+    return selected;
+}
+
+/* Copy of a node's links taken under its lock */
+static const uint32_t *read_links(const vamana_build_t *build, uint32_t node, uint32_t *buf) {
+    node_lock(build, node);
+    const uint32_t *links = node_links(build, node);
+    memcpy(buf, links, (1 + (size_t)links[0]) * sizeof(uint32_t));
+    node_unlock(build, node);
+    return buf;
+}
+
+/**
+ * Greedy search for node's own vector from the entry point
+ * Leaves every node it expanded in scratch->pool.
+*/
+static vdb_status_t greedy_search(const vamana_build_t *build, uint32_t node, build_scratch_t *scratch) {
+    if (++scratch->generation == 0) {
+        memset(scratch->tags, 0, build->num_nodes * sizeof(uint32_t));
+        scratch->generation = 1;
+    }
+    cand_list_t list = { scratch->list, 0, build->build_list };
+    scratch->pool_size = 0;
+
+    scratch->tags[node] = scratch->generation;
+    uint32_t entry = build->entry_point;
+    if (entry != node) {
+        scratch->tags[entry] = scratch->generation;
+        list_insert(&list, space_distance(build->space, node, entry), entry);
+    }
+
+    uint32_t next = 0; // no unexpanded candidate before this
+    while (next < list.size) {
+        if (list.c[next].expanded) {
+            next++;
+            continue;
+        }
+        candidate_t *current = &list.c[next];
+        current->expanded = true;
+        uint32_t expand = current->node;
+        if (!pool_push(scratch, current->distance, expand)) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+
+        const uint32_t *links = read_links(build, expand, scratch->links);
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            uint32_t neighbour = links[i];
+            if (scratch->tags[neighbour] == scratch->generation) {
+                continue;
+            }
+            scratch->tags[neighbour] = scratch->generation;
+            uint32_t at = list_insert(&list, space_distance(build->space, node, neighbour), neighbour);
+            if (at < next) {
+                next = at; // went in before the cursor
+            }
+        }
+    }
+    return VDB_OK;
+}
+
+/**
+ * Add a back-link from neighbour to node, re-pruning a full list
+*/
+static vdb_status_t add_back_link(const vamana_build_t *build, uint32_t neighbour, uint32_t node,
+                                  build_scratch_t *scratch) {
+    node_lock(build, neighbour);
+    uint32_t *links = node_links(build, neighbour);
+    for (uint32_t i = 1; i <= links[0]; i++) {
+        if (links[i] == node) {
+            node_unlock(build, neighbour);
+            return VDB_OK;
+        }
+    }
+    if (links[0] < build->max_degree) {
+        links[++links[0]] = node;
+        node_unlock(build, neighbour);
+        return VDB_OK;
+    }
+
+    scratch->pool_size = 0;
+    for (uint32_t i = 1; i <= links[0]; i++) {
+        pool_push(scratch, space_distance(build->space, neighbour, links[i]), links[i]); // room for max_degree + 1
+    }
+    pool_push(scratch, space_distance(build->space, neighbour, node), node);
+    qsort(scratch->pool, scratch->pool_size, sizeof(vdb_topk_entry_t), compare_entries);
+    links[0] = robust_prune(build, neighbour, scratch->pool, scratch->pool_size, build->alpha, links + 1);
+    node_unlock(build, neighbour);
+    return VDB_OK;
+}
+
+/**
+ * Re-link one node: search, prune what it expanded plus its current
+ * links, then link back from each chosen neighbour
+*/
+static vdb_status_t link_node(const vamana_build_t *build, uint32_t node, build_scratch_t *scratch) {
+    vdb_status_t status = greedy_search(build, node, scratch);
+    if (status != VDB_OK) {
+        return status;
+    }
+
+    const uint32_t *current = read_links(build, node, scratch->links);
+    for (uint32_t i = 1; i <= current[0]; i++) {
+        if (!pool_push(scratch, space_distance(build->space, node, current[i]), current[i])) {
+            return VDB_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    qsort(scratch->pool, scratch->pool_size, sizeof(vdb_topk_entry_t), compare_entries);
+    uint32_t count = robust_prune(build, node, scratch->pool, scratch->pool_size, build->alpha,
+                                  scratch->selected);
+
+    node_lock(build, node);
+    uint32_t *links = node_links(build, node);
+    memcpy(links + 1, scratch->selected, count * sizeof(uint32_t));
+    links[0] = count;
+    node_unlock(build, node);
+
+    for (uint32_t i = 0; i < count && status == VDB_OK; i++) {
+        status = add_back_link(build, scratch->selected[i], node, scratch);
+    }
+    return status;
+}
+
+/**
+ * Build task: keep claiming the next node of the order until none are left
+*/
+static void build_task(void *ctx, size_t task) {
+    vamana_build_t *build = (vamana_build_t*)ctx;
+    for (;;) {
+        uint32_t i = atomic_fetch_add_explicit(&build->next, 1, memory_order_relaxed);
+        if (i >= build->num_nodes || atomic_load(&build->status) != VDB_OK) {
+            return;
+        }
+        vdb_status_t status = link_node(build, build->order[i], &build->scratch[task]);
+        if (status != VDB_OK) {
+            atomic_store(&build->status, (int)status);
+            return;
+        }
+    }
+}
+
+static void scratch_free(build_scratch_t *scratch) {
+    free(scratch->tags);
+    free(scratch->list);
+    free(scratch->pool);
+    free(scratch->links);
+    free(scratch->selected);
+}
+
+static vdb_status_t scratch_init(const vamana_build_t *build, build_scratch_t *scratch) {
+    scratch->tags = (uint32_t*)calloc(build->num_nodes, sizeof(uint32_t));
+    scratch->list = (candidate_t*)malloc(build->build_list * sizeof(candidate_t));
+    scratch->pool_cap = (size_t)build->build_list * 2 + build->max_degree + 1;
+    scratch->pool = (vdb_topk_entry_t*)malloc(scratch->pool_cap * sizeof(vdb_topk_entry_t));
+    scratch->links = (uint32_t*)malloc((1 + build->max_degree) * sizeof(uint32_t));
+    scratch->selected = (uint32_t*)malloc(build->max_degree * sizeof(uint32_t));
+    if (scratch->tags == NULL || scratch->list == NULL || scratch->pool == NULL ||
+        scratch->links == NULL || scratch->selected == NULL) {
+        scratch_free(scratch);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    return VDB_OK;
+}
+
+/**
+ * The node closest to the mean of all of them
+*/
+static vdb_status_t find_medoid(const hnsw_space_t *space, uint32_t count, uint32_t *out_node) {
+    float *mean = (float*)calloc(space->dim, sizeof(float));
+    float *row = (float*)malloc(space->dim * sizeof(float));
+    if (mean == NULL || row == NULL) {
+        free(mean);
+        free(row);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        vdb_convert_to_f32(space->element, space->base + (size_t)n * space->stride, row, space->dim);
+        for (uint32_t d = 0; d < space->dim; d++) {
+            mean[d] += row[d];
+        }
+    }
+    for (uint32_t d = 0; d < space->dim; d++) {
+        mean[d] /= (float)count;
+    }
+
+    uint32_t best = 0;
+    float best_distance = INFINITY;
+    for (uint32_t n = 0; n < count; n++) {
+        float d = vdb_distance_typed(VDB_METRIC_EUCLIDEAN, space->element, mean,
+                                     space->base + (size_t)n * space->stride, space->dim);
+        if (d < best_distance) {
+            best_distance = d;
+            best = n;
+        }
+    }
+    free(mean);
+    free(row);
+    *out_node = best;
+    return VDB_OK;
+}
+
+/* Random insertion order (Fisher-Yates over xorshift64*, fixed seed) */
+static void shuffle(uint32_t *order, uint32_t count) {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    for (uint32_t i = count; i > 1; i--) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        uint32_t j = (uint32_t)((x * 0x2545F4914F6CDD1DULL >> 32) % i);
+        uint32_t tmp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = tmp;
+    }
+}
+
+static vdb_status_t write_fully(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return VDB_ERROR_IO;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return VDB_OK;
+}
+
+/**
+ * Write the header sector and every record, sector by sector
+*/
+static vdb_status_t write_records(int fd, const vamana_index_t *layout, const hnsw_space_t *space,
+                                  const uint32_t *links) {
+    size_t buf_sectors = layout->record_sectors > VAMANA_WRITE_SECTORS ? layout->record_sectors
+                                                                       : VAMANA_WRITE_SECTORS;
+    size_t buf_bytes = buf_sectors * VAMANA_SECTOR_BYTES;
+    uint8_t *buf = (uint8_t*)calloc(buf_sectors, VAMANA_SECTOR_BYTES);
+    if (buf == NULL) {
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    vamana_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = VAMANA_MAGIC;
+    header.version = VAMANA_VERSION;
+    header.metric = (uint32_t)layout->metric;
+    header.element = (uint32_t)layout->element;
+    header.dim = layout->dim;
+    header.num_nodes = layout->num_nodes;
+    header.entry_point = layout->entry_point;
+    header.max_degree = layout->params.max_degree;
+    header.build_list = layout->params.build_list;
+    header.alpha = layout->params.alpha;
+    header.search_list = layout->params.search_list;
+    header.beam_width = layout->params.beam_width;
+    header.row_bytes = layout->row_bytes;
+    header.record_bytes = layout->record_bytes;
+    header.crc = crc32c(0, &header, offsetof(vamana_header_t, crc));
+    memcpy(buf, &header, sizeof(header));
+    vdb_status_t status = write_fully(fd, buf, VAMANA_SECTOR_BYTES);
+
+    size_t links_len = (1 + (size_t)layout->params.max_degree) * sizeof(uint32_t);
+    size_t sector_bytes = (size_t)layout->record_sectors * VAMANA_SECTOR_BYTES;
+    size_t used = 0; // bytes of buf filled
+    uint32_t node = 0;
+    while (status == VDB_OK && node < layout->num_nodes) {
+        if (used == 0) {
+            memset(buf, 0, buf_bytes);
+        }
+        // one sector (or one record's sectors) at a time
+        uint8_t *sector = buf + used;
+        uint32_t n = layout->per_sector > 0 ? layout->per_sector : 1;
+        for (uint32_t i = 0; i < n && node < layout->num_nodes; i++, node++) {
+            uint8_t *record = sector + (size_t)i * layout->record_bytes;
+            memcpy(record, space->base + (size_t)node * space->stride, layout->row_bytes);
+            memcpy(record + layout->links_offset, links + (size_t)node * (1 + layout->params.max_degree),
+                   links_len);
+        }
+        used += sector_bytes;
+        if (used + sector_bytes > buf_bytes ||
+            node == layout->num_nodes) {
+            status = write_fully(fd, buf, used);
+            used = 0;
+        }
+    }
+    free(buf);
+    return status;
+}
+
+vdb_status_t vamana_build(const vdb_diskann_params_t *params, const hnsw_space_t *space,
+                          uint32_t count, vdb_thread_pool_t *pool, const char *path) {
+    if (count == 0 || count == UINT32_MAX) {
+        return VDB_ERROR_INVALID_ARGUMENT;
+    }
+
+    vamana_build_t build;
+    memset(&build, 0, sizeof(build));
+    build.space = space;
+    build.num_nodes = count;
+    build.max_degree = params->max_degree;
+    build.build_list = params->build_list;
+    atomic_init(&build.status, VDB_OK);
+
+    size_t num_tasks = vdb_thread_pool_concurrency(pool);
+    if (num_tasks > count) {
+        num_tasks = count;
+    }
+    build.links = (uint32_t*)calloc((size_t)count * (1 + params->max_degree), sizeof(uint32_t));
+    build.locks = (atomic_uchar*)calloc(count, sizeof(atomic_uchar)); // all unlocked
+    uint32_t *order = (uint32_t*)malloc(count * sizeof(uint32_t));
+    build.scratch = (build_scratch_t*)calloc(num_tasks, sizeof(build_scratch_t));
+    vdb_status_t status = build.links != NULL && build.locks != NULL && order != NULL && build.scratch != NULL
+        ? find_medoid(space, count, &build.entry_point)
+        : VDB_ERROR_OUT_OF_MEMORY;
+    size_t ready = 0;
+    while (status == VDB_OK && ready < num_tasks) {
+        status = scratch_init(&build, &build.scratch[ready]);
+        ready += status == VDB_OK;
+    }
+
+    if (status == VDB_OK) {
+        shuffle(order, count);
+        build.order = order;
+    }
+    // pass 1 links the graph up, pass 2 re-prunes with the real alpha
+    float alphas[2] = { 1.0f, params->alpha };
+    for (int pass = 0; pass < 2 && status == VDB_OK; pass++) {
+        build.alpha = alphas[pass];
+        atomic_store(&build.next, 0);
+        vdb_thread_pool_run(pool, num_tasks, build_task, &build);
+        status = (vdb_status_t)atomic_load(&build.status);
+    }
+
+    for (size_t t = 0; t < ready; t++) {
+        scratch_free(&build.scratch[t]);
+    }
+    free(build.scratch);
+    free(order);
+    free(build.locks);
+
+    vamana_index_t layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.metric = space->metric;
+    layout.element = space->element;
+    layout.dim = space->dim;
+    layout.row_bytes = space->stride;
+    layout.num_nodes = count;
+    layout.entry_point = build.entry_point;
+    layout.params = *params;
+    set_layout(&layout);
+
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = -1;
+    if (status == VDB_OK) {
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        status = fd >= 0 ? write_records(fd, &layout, space, build.links) : VDB_ERROR_IO;
+    }
+    free(build.links);
+    if (fd >= 0) {
+        if (status == VDB_OK && fsync(fd) != 0) {
+            status = VDB_ERROR_IO;
+        }
+        if (close(fd) != 0 && status == VDB_OK) {
+            status = VDB_ERROR_IO;
+        }
+        if (status == VDB_OK && rename(tmp_path, path) != 0) {
+            status = VDB_ERROR_IO;
+        }
+        if (status != VDB_OK) {
+            unlink(tmp_path);
+        }
+    }
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Open / close                                                        */
+/* ------------------------------------------------------------------ */
+
+vdb_status_t vamana_open(const char *path, vamana_index_t **out_index) {
+    // records are read whole sectors at sector offsets, so the page
+    // cache can be bypassed where the filesystem allows it
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0) {
+        return errno == ENOENT ? VDB_ERROR_NOT_FOUND : VDB_ERROR_IO;
+    }
+
+    vamana_header_t header;
+    void *sector = aligned_alloc(VAMANA_SECTOR_BYTES, VAMANA_SECTOR_BYTES);
+    aio_op_t op = { AIO_READ, fd, NULL, VAMANA_SECTOR_BYTES, false, sector, 0 };
+    vdb_status_t status = sector != NULL ? aio_run(NULL, &op, 1) : VDB_ERROR_OUT_OF_MEMORY;
+    if (status == VDB_OK) {
+        memcpy(&header, sector, sizeof(header));
+    } else if (status == VDB_ERROR_IO) {
+        status = VDB_ERROR_CORRUPTED; // shorter than a sector
+    }
+    free(sector);
+
+    struct stat st;
+    if (status == VDB_OK && (header.magic != VAMANA_MAGIC || header.version != VAMANA_VERSION ||
+                             header.crc != crc32c(0, &header, offsetof(vamana_header_t, crc)) ||
+                             header.max_degree < VDB_DISKANN_MIN_DEGREE ||
+                             header.max_degree > VDB_DISKANN_MAX_DEGREE ||
+                             header.num_nodes == 0 || header.entry_point >= header.num_nodes ||
+                             header.dim == 0 || header.row_bytes == 0 || header.row_bytes > UINT32_MAX / 2 ||
+                             fstat(fd, &st) != 0)) {
+        status = VDB_ERROR_CORRUPTED;
+    }
+    vamana_index_t *index = NULL;
+    if (status == VDB_OK) {
+        index = (vamana_index_t*)calloc(1, sizeof(vamana_index_t));
+        status = index != NULL ? VDB_OK : VDB_ERROR_OUT_OF_MEMORY;
+    }
+    if (status == VDB_OK) {
+        index->fd = fd;
+        index->metric = (vdb_metric_t)header.metric;
+        index->element = (vdb_element_type_t)header.element;
+        index->dim = header.dim;
+        index->row_bytes = (size_t)header.row_bytes;
+        index->num_nodes = header.num_nodes;
+        index->entry_point = header.entry_point;
+        index->params.max_degree = header.max_degree;
+        index->params.build_list = header.build_list;
+        index->params.alpha = header.alpha;
+        index->params.search_list = header.search_list;
+        index->params.beam_width = header.beam_width;
+        set_layout(index);
+        if (index->record_bytes != header.record_bytes || (uint64_t)st.st_size < index->file_bytes) {
+            status = VDB_ERROR_CORRUPTED;
+        }
+    }
+    if (status != VDB_OK) {
+        free(index);
+        close(fd);
+        return status;
+    }
+
+    atomic_init(&index->uring, false);
+    pthread_mutex_init(&index->ring_lock, NULL);
+    *out_index = index;
+    return VDB_OK;
+}
+
+void vamana_close(vamana_index_t **index) {
+    if (index == NULL || *index == NULL) {
+        return;
+    }
+    vamana_index_t *idx = *index;
+    for (size_t i = 0; i < idx->num_rings; i++) {
+        aio_ring_free(&idx->rings[i]);
+    }
+    pthread_mutex_destroy(&idx->ring_lock);
+    close(idx->fd);
+    free(idx);
+    *index = NULL;
+}
+
+bool vamana_matches(const vamana_index_t *index, const hnsw_space_t *space) {
+    return index->metric == space->metric && index->element == space->element &&
+        index->dim == space->dim && index->row_bytes == space->stride;
+}
+
+uint32_t vamana_count(const vamana_index_t *index) {
+    return index->num_nodes;
+}
+
+uint64_t vamana_file_bytes(const vamana_index_t *index) {
+    return index->file_bytes;
+}
+
+void vamana_get_params(const vamana_index_t *index, vdb_diskann_params_t *out_params) {
+    *out_params = index->params;
+}
+
+void vamana_set_search(vamana_index_t *index, uint32_t list, uint32_t beam) {
+    index->params.search_list = list;
+    index->params.beam_width = beam;
+}
+
+void vamana_set_uring(vamana_index_t *index, bool uring) {
+    atomic_store(&index->uring, uring);
+    if (!uring) {
+        pthread_mutex_lock(&index->ring_lock);
+        for (size_t i = 0; i < index->num_rings; i++) {
+            aio_ring_free(&index->rings[i]);
+        }
+        index->num_rings = 0;
+        pthread_mutex_unlock(&index->ring_lock);
+    }
+}
+
+/* An idle ring, a new one, or NULL to read blocking */
+static aio_ring_t *ring_acquire(vamana_index_t *index) {
+    if (!atomic_load(&index->uring)) {
+        return NULL;
+    }
+    aio_ring_t *ring = NULL;
+    pthread_mutex_lock(&index->ring_lock);
+    if (index->num_rings > 0) {
+        ring = index->rings[--index->num_rings];
+    }
+    pthread_mutex_unlock(&index->ring_lock);
+    if (ring == NULL && aio_ring_create(&ring) != VDB_OK) {
+        ring = NULL;
+    }
+    return ring;
+}
+
+static void ring_release(vamana_index_t *index, aio_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&index->ring_lock);
+    if (atomic_load(&index->uring) && index->num_rings < VAMANA_MAX_RINGS) {
+        index->rings[index->num_rings++] = ring;
+        ring = NULL;
+    }
+    pthread_mutex_unlock(&index->ring_lock);
+    aio_ring_free(&ring);
+}
+
+/* ------------------------------------------------------------------ */
+/* Search                                                              */
+/* ------------------------------------------------------------------ */
+
+/* Open-addressing set of node ids, for graphs too big to tag per node */
+typedef struct {
+    uint32_t *slots; // UINT32_MAX = empty
+    size_t mask;
+    size_t size;
+} node_set_t;
+
+static bool set_init(node_set_t *set, size_t slots) {
+    set->slots = (uint32_t*)malloc(slots * sizeof(uint32_t));
+    set->mask = slots - 1;
+    set->size = 0;
+    if (set->slots != NULL) {
+        memset(set->slots, 0xFF, slots * sizeof(uint32_t));
+    }
+    return set->slots != NULL;
+}
+
+static bool set_add_slot(uint32_t *slots, size_t mask, uint32_t node) {
+    size_t i = (node * 2654435761u) & mask;
+    while (slots[i] != UINT32_MAX) {
+        if (slots[i] == node) {
+            return false;
+        }
+        i = (i + 1) & mask;
+    }
+    slots[i] = node;
+    return true;
+}
+
+/**
+ * Add a node; returns 1 if it is new, 0 if it was there, -1 if out of memory
+*/
+static int set_add(node_set_t *set, uint32_t node) {
+    if (2 * (set->size + 1) > set->mask + 1) {
+        node_set_t grown;
+        if (!set_init(&grown, 2 * (set->mask + 1))) {
+            return -1;
+        }
+        for (size_t i = 0; i <= set->mask; i++) {
+            if (set->slots[i] != UINT32_MAX) {
+                set_add_slot(grown.slots, grown.mask, set->slots[i]);
+            }
+        }
+        grown.size = set->size;
+        free(set->slots);
+        *set = grown;
+    }
+    if (!set_add_slot(set->slots, set->mask, node)) {
+        return 0;
+    }
+    set->size++;
+    return 1;
+}
+
+vdb_status_t vamana_search(vamana_index_t *index, const hnsw_query_t *approx, const float *query,
+                           uint32_t list, uint32_t beam, const row_set_t *rows, vdb_topk_t *out,
+                           vamana_search_counts_t *counts) {
+    if (out->k == 0) {
+        return VDB_OK;
+    }
+    if (list < out->k) {
+        list = (uint32_t)out->k;
+    }
+    if (beam == 0) {
+        beam = 1;
+    } else if (beam > VDB_DISKANN_MAX_BEAM) {
+        beam = VDB_DISKANN_MAX_BEAM;
+    }
+
+    size_t read_bytes = (size_t)index->record_sectors * VAMANA_SECTOR_BYTES;
+    vdb_arena_t *arena = scratch_arena();
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    candidate_t *entries = (candidate_t*)vdb_arena_alloc(arena, list * sizeof(candidate_t));
+    uint8_t *bufs = (uint8_t*)vdb_arena_alloc_aligned(arena, beam * read_bytes, VAMANA_SECTOR_BYTES);
+    node_set_t visited = { NULL, 0, 0 };
+    if (entries == NULL || bufs == NULL || !set_init(&visited, VAMANA_VISITED_SLOTS)) {
+        vdb_arena_rewind(arena, mark);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    vamana_search_counts_t local = { 0, 1 };
+    cand_list_t cands = { entries, 0, list };
+    set_add(&visited, index->entry_point);
+    list_insert(&cands, approx->distance(approx, index->entry_point), index->entry_point);
+
+    aio_ring_t *ring = ring_acquire(index);
+    vdb_status_t status = VDB_OK;
+    uint32_t picked[VDB_DISKANN_MAX_BEAM];
+    aio_op_t ops[VDB_DISKANN_MAX_BEAM];
+    while (status == VDB_OK) {
+        /* the beam: best unexpanded candidates, read in one batch */
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < cands.size && n < beam; i++) {
+            if (!cands.c[i].expanded) {
+                cands.c[i].expanded = true;
+                picked[n] = cands.c[i].node;
+                ops[n] = (aio_op_t){ AIO_READ, index->fd, NULL, read_bytes, false,
+                                     bufs + n * read_bytes, record_sector(index, picked[n]) };
+                n++;
+            }
+        }
+        if (n == 0) {
+            break;
+        }
+        status = aio_run(ring, ops, n);
+        local.reads += n;
+
+        for (uint32_t j = 0; j < n && status == VDB_OK; j++) {
+            const uint8_t *record = bufs + j * read_bytes + record_offset(index, picked[j]);
+            local.distances++;
+            float d = vdb_distance_typed(index->metric, index->element, query, record, index->dim);
+            if (row_set_admits(rows, picked[j])) {
+                topk_push(out, d, picked[j]);
+            }
+
+            uint32_t degree;
+            memcpy(&degree, record + index->links_offset, sizeof(degree));
+            if (degree > index->params.max_degree) {
+                status = VDB_ERROR_CORRUPTED;
+                break;
+            }
+            for (uint32_t i = 0; i < degree; i++) {
+                uint32_t neighbour;
+                memcpy(&neighbour, record + index->links_offset + (1 + i) * sizeof(uint32_t), sizeof(neighbour));
+                if (neighbour >= index->num_nodes) {
+                    status = VDB_ERROR_CORRUPTED;
+                    break;
+                }
+                int added = set_add(&visited, neighbour);
+                if (added < 0) {
+                    status = VDB_ERROR_OUT_OF_MEMORY;
+                    break;
+                }
+                if (added > 0) {
+                    local.distances++;
+                    list_insert(&cands, approx->distance(approx, neighbour), neighbour);
+                }
+            }
+        }
+    }
+    ring_release(index, ring);
+
+    if (counts != NULL) {
+        counts->reads += local.reads;
+        counts->distances += local.distances;
+    }
+    free(visited.slots);
+    vdb_arena_rewind(arena, mark);
+    return status;
+}
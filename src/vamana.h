@@ -0,0 +1,91 @@
+/**
+ * vamana.h - Internal Vamana graph stored in 4 KB sectors (DiskANN)
+ *
+ * Built in memory over vectors at a fixed stride (an hnsw_space_t) and
+ * written out as one record per node: the node's row as stored, then
+ * its neighbour list [count, ids...]. Records are packed into 4 KB
+ * sectors so reading a node is one aligned read; a record that doesn't
+ * fit a sector gets whole sectors of its own. Sector 0 is the header.
+ *
+ * Once written only the header stays in memory. A search steers by a
+ * distance the caller supplies (PQ codes in RAM, typically), and each
+ * round reads the records of the beam's best unexpanded nodes in one
+ * batch, scoring those nodes exactly from the rows in their records.
+ *
+ * Nodes are numbered 0, 1, 2..., node n being row n of the space.
+*/
+
+#ifndef VDB_VAMANA_H
+#define VDB_VAMANA_H
+
+#include "vdb/storage.h"
+#include "hnsw.h"
+#include "topk.h"
+#include "thread_pool.h"
+#include "roaring.h"
+
+/* Sector size; records never straddle one */
+#define VAMANA_SECTOR_BYTES 4096
+
+typedef struct vamana_index vamana_index_t;
+
+/**
+ * Build a graph over nodes [0, count) of space and write it to path
+ * Params must already be validated. Nodes are linked from every thread
+ * of pool (NULL = the caller's); the graph is held in memory while it
+ * is built, (1 + max_degree) uint32 per node. Writes path.tmp and
+ * renames it over path, so a crash mid-build leaves the previous file.
+*/
+vdb_status_t vamana_build(const vdb_diskann_params_t *params, const hnsw_space_t *space,
+                          uint32_t count, vdb_thread_pool_t *pool, const char *path);
+
+/**
+ * Open a written graph
+ * Returns VDB_ERROR_NOT_FOUND if there is no file, VDB_ERROR_CORRUPTED
+ * if its header is bad.
+*/
+vdb_status_t vamana_open(const char *path, vamana_index_t **out_index);
+
+/**
+ * Close a graph. Safe with NULL. No search may be running.
+*/
+void vamana_close(vamana_index_t **index);
+
+/**
+ * Whether the records hold rows of this format (metric, dim, stride, element)
+*/
+bool vamana_matches(const vamana_index_t *index, const hnsw_space_t *space);
+
+/**
+ * Work a search did, for the stats
+*/
+typedef struct {
+    uint64_t reads; // node records read
+    uint64_t distances; // approximate and exact
+} vamana_search_counts_t;
+
+/**
+ * Search the graph
+ * approx scores nodes for the walk; query (the space's dim floats) is
+ * scored exactly against the rows read. out must be initialized; every
+ * node read that rows admits (NULL = all) is pushed to it with
+ * its exact distance. list is the candidate list length (raised to
+ * out->k if lower), beam how many records each round reads.
+ * counts (nullable) is added to, not overwritten.
+*/
+vdb_status_t vamana_search(vamana_index_t *index, const hnsw_query_t *approx, const float *query,
+                           uint32_t list, uint32_t beam, const row_set_t *rows, vdb_topk_t *out,
+                           vamana_search_counts_t *counts);
+
+/* Accessors */
+uint32_t vamana_count(const vamana_index_t *index);
+uint64_t vamana_file_bytes(const vamana_index_t *index);
+void vamana_get_params(const vamana_index_t *index, vdb_diskann_params_t *out_params);
+void vamana_set_search(vamana_index_t *index, uint32_t list, uint32_t beam);
+
+/**
+ * Read through io_uring (from then on, as rings can be set up) or blocking
+*/
+void vamana_set_uring(vamana_index_t *index, bool uring);
+
+#endif /* VDB_VAMANA_H */
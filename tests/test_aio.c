@@ -0,0 +1,247 @@
+/**
+ * test_aio.c - Tests for the io_uring backend and async appends
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/stats.h"
+
+#define AIO_DIM 16
+
+/**
+ * Append rows [first, first + n) ("row-<i>", metadata on even rows) in
+ * one batch; async when ticket isn't NULL
+ */
+static vdb_status_t append_rows(vdb_storage_t *storage, int first, int n, vdb_commit_ticket_t *ticket) {
+    float *data = (float*)malloc((size_t)n * AIO_DIM * sizeof(float));
+    vdb_item_t *items = (vdb_item_t*)calloc((size_t)n, sizeof(vdb_item_t));
+    char (*metadata)[32] = (char (*)[32])calloc((size_t)n, 32);
+    if (data == NULL || items == NULL || metadata == NULL) {
+        free(data);
+        free(items);
+        free(metadata);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < n; i++) {
+        snprintf(items[i].id, VDB_ID_MAX_LEN, "row-%d", first + i);
+        test_fill_vector(data + (size_t)i * AIO_DIM, AIO_DIM, (uint32_t)(first + i));
+        items[i].vector.dim = AIO_DIM;
+        items[i].vector.data = data + (size_t)i * AIO_DIM;
+        if ((first + i) % 2 == 0) {
+            snprintf(metadata[i], 32, "{\"row\":%d}", first + i);
+            items[i].metadata = metadata[i];
+        }
+    }
+    vdb_status_t status = ticket != NULL
+        ? vdb_storage_append_batch_async(storage, items, (size_t)n, ticket)
+        : vdb_storage_append_batch(storage, items, (size_t)n);
+    free(data);
+    free(items);
+    free(metadata);
+    return status;
+}
+
+/**
+ * Count rows [0, n) that read back as written
+ */
+static int count_matching(vdb_storage_t *storage, int n) {
+    int matching = 0;
+    for (int i = 0; i < n; i++) {
+        char id[VDB_ID_MAX_LEN];
+        char metadata[32];
+        snprintf(id, sizeof(id), "row-%d", i);
+        snprintf(metadata, sizeof(metadata), "{\"row\":%d}", i);
+        float expected[AIO_DIM];
+        test_fill_vector(expected, AIO_DIM, (uint32_t)i);
+
+        vdb_item_t item;
+        if (vdb_storage_get(storage, id, &item) != VDB_OK) {
+            continue;
+        }
+        bool ok = memcmp(item.vector.data, expected, sizeof(expected)) == 0 &&
+                  (i % 2 != 0 ? item.metadata == NULL
+                              : item.metadata != NULL && strcmp(item.metadata, metadata) == 0);
+        matching += ok ? 1 : 0;
+        vdb_storage_item_free(&item);
+    }
+    return matching;
+}
+
+/**
+ * Test switching backends, and that io_uring is either there or says so
+ */
+TEST(aio_backend_switch) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", AIO_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_IO_BLOCKING, vdb_storage_get_io_backend(storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_io_backend(NULL, VDB_IO_URING));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_io_backend(storage, (vdb_io_backend_t)7));
+
+    vdb_status_t status = vdb_storage_set_io_backend(storage, VDB_IO_URING);
+    ASSERT_TRUE(status == VDB_OK || status == VDB_ERROR_NOT_FOUND);
+    ASSERT_EQ(status == VDB_OK ? VDB_IO_URING : VDB_IO_BLOCKING, vdb_storage_get_io_backend(storage));
+    ASSERT_EQ(status, vdb_storage_set_io_backend(storage, VDB_IO_URING)); // again is a no-op
+    ASSERT_EQ(VDB_OK, append_rows(storage, 0, 10, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_io_backend(storage, VDB_IO_BLOCKING));
+    ASSERT_EQ(VDB_IO_BLOCKING, vdb_storage_get_io_backend(storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 10, 10, NULL));
+    ASSERT_EQ(20, count_matching(storage, 20));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test appends, deletes and checkpoints through io_uring write the same
+ * files blocking I/O does, and survive reopen and a crash
+ */
+TEST(aio_uring_writes) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", AIO_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    if (vdb_storage_set_io_backend(storage, VDB_IO_URING) != VDB_OK) {
+        printf("(no io_uring, skipped) ");
+        vdb_storage_close(&storage);
+        test_remove_dir(dir);
+        return;
+    }
+    for (int i = 0; i < 20; i++) {
+        ASSERT_EQ(VDB_OK, append_rows(storage, i, 1, NULL));
+    }
+    ASSERT_EQ(VDB_OK, append_rows(storage, 20, 300, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 320, 80, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "row-5"));
+    ASSERT_EQ(399, count_matching(storage, 400));
+    ASSERT_EQ(400 * VDB_ID_MAX_LEN, test_file_size(dir, "coll", "ids.seg"));
+    ASSERT_EQ(400 * AIO_DIM * (long long)sizeof(float), test_file_size(dir, "coll", "embeddings.seg"));
+
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(23, stats.wal_fsyncs); // 22 appends + the delete
+
+    // segments past the checkpoint lost, the WAL kept
+    char src[TEST_PATH_MAX + 64];
+    char dst[TEST_PATH_MAX + 64];
+    snprintf(src, sizeof(src), "%s/coll", dir);
+    snprintf(dst, sizeof(dst), "%s/crashed", dir);
+    ASSERT_EQ(0, test_copy_dir(src, dst));
+    vdb_storage_close(&storage);
+    snprintf(dst, sizeof(dst), "%s/crashed/embeddings.seg", dir);
+    ASSERT_EQ(0, truncate(dst, 320 * AIO_DIM * (off_t)sizeof(float)));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(400, vdb_storage_count(storage));
+    ASSERT_EQ(399, count_matching(storage, 400));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(399, count_matching(storage, 400));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test async appends skip the fsync until a wait, which covers every
+ * ticket before it
+ */
+TEST(aio_async_append) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", AIO_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_storage_set_io_backend(storage, VDB_IO_URING); // either backend will do
+
+    vdb_commit_ticket_t ticket = 42;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_append_batch_async(storage, NULL, 1, &ticket));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, append_rows(NULL, 0, 1, &ticket));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch_async(storage, NULL, 0, &ticket));
+    ASSERT_EQ(0, ticket);
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, 0));
+
+    vdb_commit_ticket_t tickets[5];
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(VDB_OK, append_rows(storage, i * 20, 20, &tickets[i]));
+        ASSERT_TRUE(i == 0 || tickets[i] > tickets[i - 1]);
+    }
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, append_rows(storage, 0, 1, &ticket));
+    ASSERT_EQ(100, vdb_storage_count(storage)); // searchable before it's durable
+    ASSERT_EQ(100, count_matching(storage, 100));
+
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(0, stats.wal_fsyncs);
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_wait_durable(storage, tickets[4] + 1));
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, tickets[4]));
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, tickets[1])); // durable already
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(1, stats.wal_fsyncs);
+
+    // a plain append's fsync covers the async ones before it
+    ASSERT_EQ(VDB_OK, append_rows(storage, 100, 10, &ticket));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 110, 10, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, ticket));
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(2, stats.wal_fsyncs);
+
+    // a WAL past the checkpoint size is synced by the append itself
+    ASSERT_EQ(VDB_OK, vdb_storage_set_checkpoint_bytes(storage, 0));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 120, 10, &ticket));
+    ASSERT_EQ(0, test_file_size(dir, "coll", "wal.log"));
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(3, stats.wal_fsyncs);
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, ticket));
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(3, stats.wal_fsyncs);
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(130, count_matching(storage, 130));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test waiting on tickets while the group committer syncs
+ */
+TEST(aio_async_group_commit) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", AIO_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_storage_set_io_backend(storage, VDB_IO_URING);
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 200));
+
+    vdb_commit_ticket_t ticket = 0;
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(VDB_OK, append_rows(storage, i * 10, 10, &ticket));
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, ticket));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 100, 10, NULL));
+
+    // left pending when the committer stops: it flushes them
+    ASSERT_EQ(VDB_OK, append_rows(storage, 110, 10, &ticket));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 0));
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, ticket));
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    uint64_t fsyncs = stats.wal_fsyncs;
+    ASSERT_EQ(VDB_OK, vdb_storage_wait_durable(storage, ticket));
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(fsyncs, stats.wal_fsyncs);
+    ASSERT_EQ(120, count_matching(storage, 120));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
@@ -0,0 +1,168 @@
+/**
+ * test_arena.c - Tests for the arena and slab allocators
+ */
+
+#include "test_framework.h"
+#include "vdb/arena.h"
+#include "vdb/collection.h"
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * Test bump allocation, alignment, and blocks of their own for big sizes
+ */
+TEST(arena_alloc) {
+    vdb_arena_t *arena = NULL;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_arena_create(0, NULL));
+    ASSERT_EQ(VDB_OK, vdb_arena_create(1024, &arena));
+    ASSERT_EQ(0, vdb_arena_used(arena));
+
+    uint8_t *a = (uint8_t*)vdb_arena_alloc(arena, 3);
+    uint8_t *b = (uint8_t*)vdb_arena_alloc(arena, 5);
+    ASSERT_NOT_NULL(a);
+    ASSERT_NOT_NULL(b);
+    ASSERT_EQ(0, (uintptr_t)a % VDB_ARENA_ALIGN);
+    ASSERT_EQ(0, (uintptr_t)b % VDB_ARENA_ALIGN);
+    ASSERT_TRUE(b >= a + 3);
+    memset(a, 0xAA, 3);
+    memset(b, 0xBB, 5);
+    ASSERT_EQ(0xAA, a[2]);
+
+    void *c = vdb_arena_alloc_aligned(arena, 10, 256);
+    ASSERT_NOT_NULL(c);
+    ASSERT_EQ(0, (uintptr_t)c % 256);
+    ASSERT_NULL(vdb_arena_alloc_aligned(arena, 10, 24));
+    ASSERT_NULL(vdb_arena_alloc_aligned(arena, 10, 8192));
+
+    // bigger than a block, and past the first block
+    uint8_t *big = (uint8_t*)vdb_arena_alloc(arena, 100000);
+    ASSERT_NOT_NULL(big);
+    memset(big, 1, 100000);
+    for (int i = 0; i < 100; i++) {
+        ASSERT_NOT_NULL(vdb_arena_alloc(arena, 100));
+    }
+    ASSERT_TRUE(vdb_arena_used(arena) >= 100000 + 100 * 100);
+    ASSERT_EQ(0xBB, b[4]); // older allocations untouched
+
+    int *zeros = (int*)vdb_arena_calloc(arena, 50, sizeof(int));
+    ASSERT_NOT_NULL(zeros);
+    for (int i = 0; i < 50; i++) {
+        ASSERT_EQ(0, zeros[i]);
+    }
+    ASSERT_NULL(vdb_arena_calloc(arena, SIZE_MAX / 2, 4));
+    ASSERT_NULL(vdb_arena_alloc(arena, SIZE_MAX - 8));
+
+    vdb_arena_reset(arena);
+    ASSERT_EQ(0, vdb_arena_used(arena));
+    ASSERT_NOT_NULL(vdb_arena_alloc(arena, 16));
+
+    vdb_arena_free(&arena);
+    ASSERT_NULL(arena);
+    vdb_arena_free(&arena);
+    vdb_arena_free(NULL);
+    ASSERT_NULL(vdb_arena_alloc(NULL, 16));
+}
+
+/**
+ * Test nested marks rewind like a stack, across blocks
+ */
+TEST(arena_mark_rewind) {
+    vdb_arena_t *arena = NULL;
+    ASSERT_EQ(VDB_OK, vdb_arena_create(256, &arena));
+
+    vdb_arena_mark_t empty = vdb_arena_mark(arena);
+    char *outer = (char*)vdb_arena_alloc(arena, 32);
+    strcpy(outer, "outer");
+    size_t outer_used = vdb_arena_used(arena);
+
+    vdb_arena_mark_t mark = vdb_arena_mark(arena);
+    for (int i = 0; i < 20; i++) {
+        ASSERT_NOT_NULL(vdb_arena_alloc(arena, 100)); // several blocks
+    }
+    vdb_arena_mark_t inner = vdb_arena_mark(arena);
+    ASSERT_NOT_NULL(vdb_arena_alloc(arena, 5000));
+    vdb_arena_rewind(arena, inner);
+    vdb_arena_rewind(arena, mark);
+    ASSERT_EQ(outer_used, vdb_arena_used(arena));
+    ASSERT_STR_EQ("outer", outer);
+
+    // the space after the mark is handed out again
+    char *again = (char*)vdb_arena_alloc(arena, 32);
+    ASSERT_TRUE(again > outer && again < outer + 256);
+    ASSERT_STR_EQ("outer", outer);
+
+    vdb_arena_rewind(arena, empty);
+    ASSERT_EQ(0, vdb_arena_used(arena));
+    vdb_arena_rewind(NULL, empty);
+    vdb_arena_free(&arena);
+}
+
+/**
+ * Test vectors created and copied into an arena
+ */
+TEST(arena_vectors) {
+    vdb_arena_t *arena = NULL;
+    ASSERT_EQ(VDB_OK, vdb_arena_create(0, &arena));
+
+    vdb_vector_t v;
+    ASSERT_EQ(VDB_OK, vdb_vector_create_in(arena, 37, &v));
+    ASSERT_EQ(37, v.dim);
+    ASSERT_EQ(0, (uintptr_t)v.data % 64);
+    for (uint32_t i = 0; i < v.dim; i++) {
+        ASSERT_FLOAT_EQ(0.0f, v.data[i], 0.0);
+        v.data[i] = (float)i;
+    }
+
+    vdb_vector_t copy;
+    ASSERT_EQ(VDB_OK, vdb_vector_copy_in(arena, &v, &copy));
+    ASSERT_TRUE(copy.data != v.data);
+    ASSERT_FLOAT_EQ(36.0f, copy.data[36], 0.0);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_vector_create_in(arena, 0, &v));
+    ASSERT_NULL(v.data);
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_vector_create_in(arena, VDB_COLLECTION_MAX_DIM + 1, &v));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_vector_create_in(NULL, 4, &v));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_vector_copy_in(arena, NULL, &v));
+
+    vdb_arena_free(&arena);
+}
+
+/**
+ * Test slab objects are reused, distinct and span several chunks
+ */
+TEST(slab_alloc_release) {
+    vdb_slab_t *slab = NULL;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_slab_create(0, 0, &slab));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_slab_create(24, 0, NULL));
+    ASSERT_EQ(VDB_OK, vdb_slab_create(24, 8, &slab));
+
+    enum { N = 100 };
+    uint64_t *objects[N];
+    for (int i = 0; i < N; i++) {
+        objects[i] = (uint64_t*)vdb_slab_alloc(slab);
+        ASSERT_NOT_NULL(objects[i]);
+        ASSERT_EQ(0, (uintptr_t)objects[i] % VDB_ARENA_ALIGN);
+        objects[i][0] = (uint64_t)i;
+        objects[i][2] = (uint64_t)i * 3u;
+    }
+    ASSERT_EQ(N, vdb_slab_live(slab));
+    for (int i = 0; i < N; i++) {
+        ASSERT_EQ((uint64_t)i, objects[i][0]);
+        ASSERT_EQ((uint64_t)i * 3u, objects[i][2]);
+    }
+
+    // last released, first handed out again
+    vdb_slab_release(slab, objects[10]);
+    vdb_slab_release(slab, objects[20]);
+    ASSERT_EQ(N - 2, vdb_slab_live(slab));
+    ASSERT_TRUE(vdb_slab_alloc(slab) == objects[20]);
+    ASSERT_TRUE(vdb_slab_alloc(slab) == objects[10]);
+    vdb_slab_release(slab, NULL);
+    ASSERT_EQ(N, vdb_slab_live(slab));
+
+    vdb_slab_free(&slab);
+    ASSERT_NULL(slab);
+    vdb_slab_free(&slab);
+    ASSERT_NULL(vdb_slab_alloc(NULL));
+    ASSERT_EQ(0, vdb_slab_live(NULL));
+}
@@ -0,0 +1,251 @@
+/**
+ * test_cache.c - Tests for the query result cache and pinned HNSW layers
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/filter.h"
+#include "vdb/stats.h"
+
+#define CACHE_DIM 16
+#define CACHE_ROWS 2000
+
+/**
+ * Append rows [first, first + n) ("row-<i>", {"even": <i is even>}) in
+ * one batch
+ */
+static vdb_status_t append_rows(vdb_storage_t *storage, int first, int n) {
+    float *data = (float*)malloc((size_t)n * CACHE_DIM * sizeof(float));
+    vdb_item_t *items = (vdb_item_t*)calloc((size_t)n, sizeof(vdb_item_t));
+    if (data == NULL || items == NULL) {
+        free(data);
+        free(items);
+        return VDB_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; i < n; i++) {
+        snprintf(items[i].id, VDB_ID_MAX_LEN, "row-%d", first + i);
+        test_random_vector(data + (size_t)i * CACHE_DIM, CACHE_DIM, (uint32_t)(first + i));
+        items[i].vector.dim = CACHE_DIM;
+        items[i].vector.data = data + (size_t)i * CACHE_DIM;
+        items[i].metadata = (first + i) % 2 == 0 ? "{\"even\": true}" : "{\"even\": false}";
+    }
+    vdb_status_t status = vdb_storage_append_batch(storage, items, (size_t)n);
+    free(data);
+    free(items);
+    return status;
+}
+
+static bool same_results(const vdb_search_results_t *a, const vdb_search_results_t *b) {
+    if (a->count != b->count) {
+        return false;
+    }
+    for (size_t i = 0; i < a->count; i++) {
+        if (a->hits[i].row != b->hits[i].row || strcmp(a->hits[i].id, b->hits[i].id) != 0 ||
+            a->hits[i].distance != b->hits[i].distance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Test repeated searches hit, differing k and filters miss, and writes
+ * invalidate
+ */
+TEST(cache_hits_and_invalidation) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", CACHE_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 0, 500));
+
+    float qdata[CACHE_DIM];
+    test_random_vector(qdata, CACHE_DIM, 777);
+    vdb_vector_t query = { CACHE_DIM, qdata };
+    vdb_search_results_t first, again;
+
+    // off by default: nothing counted
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 10, &first));
+    vdb_search_results_free(&first);
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(0, stats.query_cache_hits + stats.query_cache_misses);
+    ASSERT_EQ(0, vdb_storage_query_cache_bytes(storage));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_query_cache(storage, 1 << 20));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 10, &first));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 10, &again));
+    ASSERT_TRUE(same_results(&first, &again));
+    ASSERT_TRUE(first.hits != again.hits); // each caller owns its copy
+    vdb_search_results_free(&again);
+    ASSERT_TRUE(vdb_storage_query_cache_bytes(storage) > 0);
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(1, stats.query_cache_hits);
+    ASSERT_EQ(1, stats.query_cache_misses);
+    ASSERT_EQ(3, stats.exact_searches); // hits are still searches
+
+    // k and the filter are part of the key
+    vdb_filter_t *even = NULL;
+    ASSERT_EQ(VDB_OK, vdb_filter_parse("even = true", &even));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 5, &again));
+    ASSERT_EQ(5, again.count);
+    vdb_search_results_free(&again);
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(storage, &query, 10, even, &again));
+    for (size_t i = 0; i < again.count; i++) {
+        ASSERT_EQ(0, again.hits[i].row % 2);
+    }
+    vdb_search_results_free(&again);
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(storage, &query, 10, even, &again));
+    vdb_search_results_free(&again);
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(2, stats.query_cache_hits);
+    ASSERT_EQ(3, stats.query_cache_misses);
+
+    // an exact copy of the nearest row, appended: the cached hits are stale
+    vdb_item_t item;
+    memset(&item, 0, sizeof(item));
+    snprintf(item.id, VDB_ID_MAX_LEN, "twin");
+    item.vector = query;
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, &item, 1));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 10, &again));
+    ASSERT_STR_EQ("twin", again.hits[0].id);
+    vdb_search_results_free(&again);
+
+    // and deleted again
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "twin"));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 10, &again));
+    ASSERT_TRUE(same_results(&first, &again));
+    vdb_search_results_free(&again);
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(2, stats.query_cache_hits);
+    ASSERT_EQ(5, stats.query_cache_misses);
+
+    // 0 turns it off and frees the entries
+    ASSERT_EQ(VDB_OK, vdb_storage_set_query_cache(storage, 0));
+    ASSERT_EQ(0, vdb_storage_query_cache_bytes(storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_query_cache(NULL, 1024));
+    ASSERT_EQ(0, vdb_storage_query_cache_bytes(NULL));
+
+    vdb_search_results_free(&first);
+    vdb_filter_free(&even);
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the cache stays within its size as queries churn through it
+ */
+TEST(cache_bounded) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", CACHE_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 0, 200));
+    const size_t cap = 64 * 1024;
+    ASSERT_EQ(VDB_OK, vdb_storage_set_query_cache(storage, cap));
+
+    float qdata[CACHE_DIM];
+    vdb_vector_t query = { CACHE_DIM, qdata };
+    for (int q = 0; q < 2000; q++) {
+        test_random_vector(qdata, CACHE_DIM, 5000u + (uint32_t)q);
+        vdb_search_results_t results;
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 20, &results));
+        vdb_search_results_free(&results);
+        ASSERT_TRUE(vdb_storage_query_cache_bytes(storage) <= cap);
+    }
+    ASSERT_TRUE(vdb_storage_query_cache_bytes(storage) > cap / 2);
+
+    // the most recent query is still there
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_reset_stats(storage));
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 20, &results));
+    vdb_search_results_free(&results);
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(1, stats.query_cache_hits);
+
+    // shrinking evicts down to the new size
+    ASSERT_EQ(VDB_OK, vdb_storage_set_query_cache(storage, cap / 4));
+    ASSERT_TRUE(vdb_storage_query_cache_bytes(storage) <= cap / 4);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test HNSW searches are cached, a seal invalidates, and pinned upper
+ * layers give the same results as unpinned ones
+ */
+TEST(cache_hnsw_pinned) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", CACHE_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 0, CACHE_ROWS));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+
+    enum { QUERIES = 20 };
+    float qdata[QUERIES][CACHE_DIM];
+    vdb_vector_t queries[QUERIES];
+    vdb_search_results_t pinned[QUERIES];
+    for (int q = 0; q < QUERIES; q++) {
+        test_random_vector(qdata[q], CACHE_DIM, 42000u + (uint32_t)q);
+        queries[q].dim = CACHE_DIM;
+        queries[q].data = qdata[q];
+    }
+
+    // pinned by default, on the first search
+    ASSERT_EQ(0, vdb_storage_hnsw_pinned_memory(storage));
+    for (int q = 0; q < QUERIES; q++) {
+        ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &queries[q], 10, &pinned[q]));
+    }
+    size_t pinned_bytes = vdb_storage_hnsw_pinned_memory(storage);
+    ASSERT_TRUE(pinned_bytes > 0);
+    ASSERT_TRUE(pinned_bytes <= VDB_DEFAULT_HNSW_PINNED_BYTES);
+
+    // a budget too small for any layer pins nothing; results match
+    ASSERT_EQ(VDB_OK, vdb_storage_set_hnsw_pinned_bytes(storage, 0));
+    ASSERT_EQ(0, vdb_storage_hnsw_pinned_memory(storage));
+    for (int q = 0; q < QUERIES; q++) {
+        vdb_search_results_t plain;
+        ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &queries[q], 10, &plain));
+        ASSERT_TRUE(same_results(&pinned[q], &plain));
+        vdb_search_results_free(&plain);
+    }
+    ASSERT_EQ(0, vdb_storage_hnsw_pinned_memory(storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_hnsw_pinned_bytes(NULL, 0));
+
+    // cached, then invalidated by a seal of new rows
+    ASSERT_EQ(VDB_OK, vdb_storage_set_query_cache(storage, 1 << 20));
+    ASSERT_EQ(VDB_OK, vdb_storage_reset_stats(storage));
+    vdb_search_results_t results;
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &queries[0], 10, &results));
+        ASSERT_TRUE(same_results(&pinned[0], &results));
+        vdb_search_results_free(&results);
+    }
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(2, stats.query_cache_hits);
+    ASSERT_EQ(1, stats.query_cache_misses);
+    ASSERT_EQ(3, stats.hnsw_searches);
+
+    ASSERT_EQ(VDB_OK, append_rows(storage, CACHE_ROWS, 100));
+    ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &queries[0], 10, &results));
+    vdb_search_results_free(&results);
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(2, stats.query_cache_misses);
+
+    for (int q = 0; q < QUERIES; q++) {
+        vdb_search_results_free(&pinned[q]);
+    }
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
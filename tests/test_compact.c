@@ -0,0 +1,372 @@
+/**
+ * test_compact.c - Tests for dead rows, compaction and its crash recovery
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/filter.h"
+
+#include <time.h>
+
+#define COMPACT_DIM 16
+
+/**
+ * Rows "r-<i>" with vector test_random_vector(i); metadata on even rows
+ */
+static vdb_status_t append_range(vdb_storage_t *storage, int first, int n) {
+    enum { BATCH = 500 };
+    static float data[BATCH][COMPACT_DIM];
+    static vdb_item_t items[BATCH];
+
+    for (int done = 0; done < n; done += BATCH) {
+        int count = n - done < BATCH ? n - done : BATCH;
+        for (int i = 0; i < count; i++) {
+            int row = first + done + i;
+            memset(&items[i], 0, sizeof(items[i]));
+            snprintf(items[i].id, VDB_ID_MAX_LEN, "r-%d", row);
+            test_random_vector(data[i], COMPACT_DIM, (uint32_t)row);
+            items[i].vector.dim = COMPACT_DIM;
+            items[i].vector.data = data[i];
+            items[i].metadata = row % 2 == 0 ? "{\"even\":true}" : NULL;
+        }
+        vdb_status_t status = vdb_storage_append_batch(storage, items, (size_t)count);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    return VDB_OK;
+}
+
+/* Every third row from first on is deleted, rows 1 mod 3 below 300 are upserted */
+static vdb_status_t kill_rows(vdb_storage_t *storage, int first, int rows) {
+    vdb_status_t status = VDB_OK;
+    for (int i = first; i < rows && status == VDB_OK; i += 3) {
+        char id[VDB_ID_MAX_LEN];
+        snprintf(id, sizeof(id), "r-%d", i);
+        status = vdb_storage_delete(storage, id);
+    }
+    for (int i = 1; i < 300 && status == VDB_OK; i += 3) {
+        float data[COMPACT_DIM];
+        vdb_item_t item;
+        memset(&item, 0, sizeof(item));
+        snprintf(item.id, VDB_ID_MAX_LEN, "r-%d", i);
+        test_random_vector(data, COMPACT_DIM, (uint32_t)(100000 + i));
+        item.vector.dim = COMPACT_DIM;
+        item.vector.data = data;
+        item.metadata = "{\"upserted\":true}";
+        status = vdb_storage_upsert(storage, &item);
+    }
+    return status;
+}
+
+static uint64_t live_rows(int rows) {
+    return (uint64_t)(rows - (rows + 2) / 3);
+}
+
+typedef struct {
+    size_t seen;
+    size_t dead;
+} live_check_t;
+
+static int live_check(const vdb_item_t *item, void *user_data) {
+    live_check_t *check = (live_check_t*)user_data;
+    int i = atoi(item->id + 2);
+    bool upserted = item->metadata != NULL && strcmp(item->metadata, "{\"upserted\":true}") == 0;
+    check->dead += (i % 3 == 0 || (i % 3 == 1 && i < 300 && !upserted)) ? 1 : 0;
+    check->seen++;
+    return 0;
+}
+
+/**
+ * Check get/iterate/search only ever see the live rows
+ */
+static bool check_live(vdb_storage_t *storage, int rows) {
+    live_check_t check = {0, 0};
+    if (vdb_storage_iterate(storage, live_check, &check) != VDB_OK ||
+        check.seen != live_rows(rows) || check.dead != 0 ||
+        vdb_storage_live_count(storage) != live_rows(rows)) {
+        return false;
+    }
+
+    vdb_item_t item;
+    if (vdb_storage_get(storage, "r-3", &item) != VDB_ERROR_NOT_FOUND ||
+        vdb_storage_get(storage, "r-4", &item) != VDB_OK) {
+        return false;
+    }
+    bool ok = item.metadata != NULL && strcmp(item.metadata, "{\"upserted\":true}") == 0;
+    vdb_storage_item_free(&item);
+
+    // the query is a deleted row's vector: its exact match must not come back
+    float qdata[COMPACT_DIM];
+    test_random_vector(qdata, COMPACT_DIM, 6);
+    vdb_vector_t query = { COMPACT_DIM, qdata };
+    vdb_search_results_t results;
+    ok = ok && vdb_storage_search_exact(storage, &query, (uint32_t)rows, &results) == VDB_OK;
+    if (!ok) {
+        return false;
+    }
+    ok = results.count == live_rows(rows);
+    for (size_t i = 0; ok && i < results.count; i++) {
+        ok = strcmp(results.hits[i].id, "r-6") != 0;
+    }
+    vdb_search_results_free(&results);
+
+    vdb_filter_t *filter = NULL;
+    ok = ok && vdb_filter_parse("even = true", &filter) == VDB_OK &&
+         vdb_storage_search_exact_filtered(storage, &query, (uint32_t)rows, filter, &results) == VDB_OK;
+    vdb_filter_free(&filter);
+    if (!ok) {
+        return false;
+    }
+    // even rows that are neither deleted nor upserted (upserts drop the flag)
+    size_t expected = 0;
+    for (int i = 0; i < rows; i++) {
+        expected += (i % 2 == 0 && i % 3 != 0 && !(i % 3 == 1 && i < 300)) ? 1 : 0;
+    }
+    ok = results.count == expected;
+    vdb_search_results_free(&results);
+    return ok;
+}
+
+/**
+ * Test dead rows are hidden, then dropped by compaction, across reopen
+ */
+TEST(compact_drops_dead_rows) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    const int rows = 3000;
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", COMPACT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_range(storage, 0, rows));
+
+    // nothing dead yet, nothing to do
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ((uint64_t)rows, vdb_storage_count(storage));
+
+    ASSERT_EQ(VDB_OK, kill_rows(storage, 0, rows));
+    ASSERT_EQ((uint64_t)rows + 100, vdb_storage_count(storage));
+    ASSERT_TRUE(check_live(storage, rows));
+
+    long long before = test_file_size(dir, "coll", "embeddings.seg");
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ(live_rows(rows), vdb_storage_count(storage));
+    ASSERT_TRUE(test_file_size(dir, "coll", "embeddings.seg") < before);
+    ASSERT_EQ(-1, test_file_size(dir, "coll", ".compact"));
+    ASSERT_TRUE(check_live(storage, rows));
+
+    // writes carry on over the compacted files
+    ASSERT_EQ(VDB_OK, append_range(storage, rows, 10));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "r-3005"));
+    ASSERT_EQ(live_rows(rows) + 9, vdb_storage_live_count(storage));
+
+    vdb_storage_close(&storage);
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(live_rows(rows) + 10, vdb_storage_count(storage));
+    vdb_item_t item;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "r-3005", &item));
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "r-3009", &item));
+    vdb_storage_item_free(&item);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ(live_rows(rows) + 9, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "r-3005", &item));
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "r-3009", &item));
+    vdb_storage_item_free(&item);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_compact(NULL, 0));
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Recall of HNSW against exact search over the live rows
+ */
+static double hnsw_recall(vdb_storage_t *storage) {
+    size_t found = 0;
+    size_t wanted = 0;
+    for (uint32_t q = 0; q < 30; q++) {
+        float qdata[COMPACT_DIM];
+        test_random_vector(qdata, COMPACT_DIM, 500000 + q);
+        vdb_vector_t query = { COMPACT_DIM, qdata };
+        vdb_search_results_t truth, results;
+        if (vdb_storage_search_exact(storage, &query, 10, &truth) != VDB_OK) {
+            return 0;
+        }
+        if (vdb_storage_search_hnsw(storage, &query, 10, &results) != VDB_OK) {
+            vdb_search_results_free(&truth);
+            return 0;
+        }
+        for (size_t i = 0; i < results.count; i++) {
+            for (size_t j = 0; j < truth.count; j++) {
+                found += results.hits[i].row == truth.hits[j].row ? 1 : 0;
+            }
+        }
+        wanted += truth.count;
+        vdb_search_results_free(&truth);
+        vdb_search_results_free(&results);
+    }
+    return (double)found / (double)wanted;
+}
+
+/**
+ * Test the graph and quantized codes follow the rows through compaction
+ */
+TEST(compact_hnsw_remap) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    const int rows = 4000;
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", COMPACT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_range(storage, 0, rows));
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.ef_construction = 100;
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_ef_search(storage, 100));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+
+    ASSERT_EQ(VDB_OK, kill_rows(storage, 0, rows));
+    ASSERT_TRUE(hnsw_recall(storage) >= 0.9);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ(live_rows(rows), vdb_storage_count(storage));
+    ASSERT_TRUE(hnsw_recall(storage) >= 0.9);
+    ASSERT_TRUE(check_live(storage, rows));
+
+    // the remapped graph is what gets saved
+    vdb_storage_close(&storage);
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_QUANTIZATION_SQ8, vdb_storage_get_quantization(storage));
+    ASSERT_TRUE(hnsw_recall(storage) >= 0.9);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test open finishes a committed swap and discards an uncommitted one
+ */
+TEST(compact_recovery) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    const int rows = 1500;
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", COMPACT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_range(storage, 0, rows));
+    ASSERT_EQ(VDB_OK, kill_rows(storage, 0, rows));
+    vdb_storage_close(&storage);
+
+    char src[TEST_PATH_MAX + 64];
+    char dst[TEST_PATH_MAX + 64];
+    snprintf(src, sizeof(src), "%s/coll", dir);
+    snprintf(dst, sizeof(dst), "%s/committed", dir);
+    ASSERT_EQ(0, test_copy_dir(src, dst));
+    snprintf(dst, sizeof(dst), "%s/uncommitted", dir);
+    ASSERT_EQ(0, test_copy_dir(src, dst));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    vdb_storage_close(&storage);
+
+    // crashed halfway through the renames: two files already moved
+    snprintf(dst, sizeof(dst), "%s/committed/.compact", dir);
+    ASSERT_EQ(0, test_copy_dir(src, dst));
+    const char *moved[] = { "embeddings.seg", "ids.seg" };
+    for (int i = 0; i < 2; i++) {
+        char from[TEST_PATH_MAX + 128];
+        char to[TEST_PATH_MAX + 128];
+        snprintf(from, sizeof(from), "%s/committed/.compact/%s", dir, moved[i]);
+        snprintf(to, sizeof(to), "%s/committed/%s", dir, moved[i]);
+        ASSERT_EQ(0, rename(from, to));
+    }
+    // files derived from the old rows must not survive the swap
+    const char *stale[] = { "diskann.idx", "index.snap", "embeddings.sq8" };
+    for (int i = 0; i < 3; i++) {
+        snprintf(dst, sizeof(dst), "%s/committed/%s", dir, stale[i]);
+        FILE *f = fopen(dst, "wb");
+        ASSERT_TRUE(f != NULL);
+        fputs("old rows", f);
+        fclose(f);
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "committed", &storage));
+    ASSERT_EQ(-1, test_file_size(dir, "committed", ".compact"));
+    ASSERT_EQ(-1, test_file_size(dir, "committed", "diskann.idx"));
+    ASSERT_EQ(-1, test_file_size(dir, "committed", "index.snap"));
+    ASSERT_EQ(0, test_file_size(dir, "committed", "embeddings.sq8"));
+    ASSERT_FALSE(vdb_storage_has_diskann(storage));
+    ASSERT_EQ(live_rows(rows), vdb_storage_count(storage));
+    ASSERT_TRUE(check_live(storage, rows));
+    vdb_storage_close(&storage);
+
+    // crashed before the superblock: the old files stay
+    snprintf(dst, sizeof(dst), "%s/uncommitted/.compact", dir);
+    ASSERT_EQ(0, test_copy_dir(src, dst));
+    snprintf(dst, sizeof(dst), "%s/uncommitted/.compact/collection.meta", dir);
+    ASSERT_EQ(0, unlink(dst));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "uncommitted", &storage));
+    ASSERT_EQ(-1, test_file_size(dir, "uncommitted", ".compact"));
+    ASSERT_EQ((uint64_t)rows + 100, vdb_storage_count(storage));
+    ASSERT_TRUE(check_live(storage, rows));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the background compactor kicks in past the dead fraction while
+ * searches keep running
+ */
+TEST(compact_background) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    const int rows = 3000;
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", COMPACT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_range(storage, 0, rows));
+
+    vdb_compaction_params_t params = vdb_compaction_params_default();
+    params.min_dead_fraction = 0;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_compaction(storage, &params));
+    params.min_dead_fraction = 0.25;
+    params.interval_ms = 0;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_compaction(storage, &params));
+    params.interval_ms = 10;
+    params.io_bytes_per_sec = 4 << 20;
+    ASSERT_EQ(VDB_OK, vdb_storage_set_compaction(storage, &params));
+
+    // a few dead rows stay below the threshold
+    for (int i = 0; i < 30; i++) {
+        char id[VDB_ID_MAX_LEN];
+        snprintf(id, sizeof(id), "r-%d", i * 3);
+        ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+    }
+    struct timespec pause = { 0, 50 * 1000000L };
+    nanosleep(&pause, NULL);
+    ASSERT_EQ((uint64_t)rows, vdb_storage_count(storage));
+
+    // the rest are killed with the compactor off, then it's started again
+    ASSERT_EQ(VDB_OK, vdb_storage_set_compaction(storage, NULL));
+    ASSERT_EQ(VDB_OK, kill_rows(storage, 90, rows));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_compaction(storage, &params));
+    float qdata[COMPACT_DIM];
+    test_random_vector(qdata, COMPACT_DIM, 6);
+    vdb_vector_t query = { COMPACT_DIM, qdata };
+    for (int tries = 0; tries < 500 && vdb_storage_count(storage) != live_rows(rows); tries++) {
+        vdb_search_results_t results;
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 5, &results));
+        ASSERT_EQ(5, results.count);
+        ASSERT_TRUE(strcmp(results.hits[0].id, "r-6") != 0);
+        vdb_search_results_free(&results);
+        nanosleep(&pause, NULL);
+    }
+    ASSERT_EQ(live_rows(rows), vdb_storage_count(storage));
+    ASSERT_TRUE(check_live(storage, rows));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_compaction(storage, NULL));
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
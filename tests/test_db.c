@@ -0,0 +1,253 @@
+/**
+ * test_db.c - Tests for the multi-collection handle
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/db.h"
+#include <pthread.h>
+#include <time.h>
+
+#define DB_DIM 16
+
+static int count_names(const char *name, void *user_data) {
+    (void)name;
+    (*(int*)user_data)++;
+    return 0;
+}
+
+/**
+ * Test collections open on demand, idle ones close past max_open, and
+ * held ones never do
+ */
+TEST(db_lazy_open_and_lru) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_db_params_t params = vdb_db_params_default();
+    params.max_open = 2;
+    params.threads = 2;
+    vdb_db_t *db = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_open(dir, &params, &db));
+    ASSERT_EQ(0, vdb_db_open_count(db));
+
+    for (int c = 0; c < 4; c++) {
+        char name[32];
+        snprintf(name, sizeof(name), "coll-%d", c);
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_db_create(db, name, DB_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, DB_DIM, 0, 10 * (c + 1)));
+        vdb_db_release(db, storage);
+        ASSERT_TRUE(vdb_db_open_count(db) <= 2);
+    }
+    int names = 0;
+    ASSERT_EQ(VDB_OK, vdb_db_list(db, count_names, &names));
+    ASSERT_EQ(4, names);
+
+    // coll-0 was closed; it opens again with its rows
+    vdb_storage_t *first = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_acquire(db, "coll-0", &first));
+    ASSERT_EQ(10, vdb_storage_count(first));
+    vdb_storage_t *again = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_acquire(db, "coll-0", &again));
+    ASSERT_TRUE(first == again);
+    vdb_db_release(db, again);
+
+    // three held: over max_open until they are released
+    vdb_storage_t *second = NULL;
+    vdb_storage_t *third = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_acquire(db, "coll-1", &second));
+    ASSERT_EQ(VDB_OK, vdb_db_acquire(db, "coll-2", &third));
+    ASSERT_EQ(3, vdb_db_open_count(db));
+    ASSERT_EQ(20, vdb_storage_count(second));
+    ASSERT_EQ(30, vdb_storage_count(third));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_db_evict(db, "coll-1"));
+    vdb_db_release(db, first); // the least recently used goes
+    ASSERT_EQ(2, vdb_db_open_count(db));
+    vdb_db_release(db, second);
+    vdb_db_release(db, third);
+
+    ASSERT_EQ(VDB_OK, vdb_db_evict(db, "coll-2"));
+    ASSERT_EQ(VDB_OK, vdb_db_evict(db, "coll-2")); // not open
+    ASSERT_EQ(1, vdb_db_open_count(db));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_db_acquire(db, "missing", &storage));
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_db_create(db, "coll-3", DB_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_db_create(db, "coll-1", DB_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_db_acquire(NULL, "coll-1", &storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_db_acquire(db, NULL, &storage));
+
+    vdb_db_close(&db);
+    ASSERT_NULL(db);
+    vdb_db_close(&db);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the memory budget caps each collection's caches and closes idle
+ * collections once their indexes pass it
+ */
+TEST(db_memory_budget) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    // one sealed graph of 1000 rows takes ~100 KB
+    vdb_db_params_t params = vdb_db_params_default();
+    params.max_open = 4;
+    params.memory_budget = 256 * 1024;
+    params.query_cache_bytes = 1 << 20;
+    vdb_db_t *db = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_open(dir, &params, &db));
+
+    float qdata[DB_DIM];
+    test_random_vector(qdata, DB_DIM, 99);
+    vdb_vector_t query = { DB_DIM, qdata };
+    for (int c = 0; c < 4; c++) {
+        char name[32];
+        snprintf(name, sizeof(name), "coll-%d", c);
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_db_create(db, name, DB_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, DB_DIM, 0, 1000));
+        ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+        ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+        for (int q = 0; q < 200; q++) {
+            qdata[0] = (float)q;
+            vdb_search_results_t results;
+            ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 10, &results));
+            vdb_search_results_free(&results);
+        }
+        // 256 KiB / 4 / 2 for each cache
+        ASSERT_TRUE(vdb_storage_query_cache_bytes(storage) <= 32 * 1024);
+        ASSERT_TRUE(vdb_storage_hnsw_pinned_memory(storage) <= 32 * 1024);
+        ASSERT_TRUE(vdb_storage_memory_usage(storage) > 64 * 1024);
+        vdb_db_release(db, storage);
+    }
+
+    // the maintenance thread closes idle ones until the rest fit
+    for (int i = 0; i < 500 && vdb_db_memory_usage(db) > params.memory_budget; i++) {
+        struct timespec ts = { 0, 10 * 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    ASSERT_TRUE(vdb_db_memory_usage(db) <= params.memory_budget);
+    ASSERT_TRUE(vdb_db_open_count(db) < 4);
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_acquire(db, "coll-0", &storage));
+    ASSERT_EQ(1000, vdb_storage_count(storage));
+    ASSERT_TRUE(vdb_storage_has_hnsw(storage));
+    vdb_db_release(db, storage);
+
+    vdb_db_close(&db);
+    test_remove_dir(dir);
+}
+
+typedef struct {
+    vdb_db_t *db;
+    int worker;
+} db_worker_t;
+
+static void *db_worker(void *arg) {
+    db_worker_t *w = (db_worker_t*)arg;
+    float qdata[DB_DIM];
+    vdb_vector_t query = { DB_DIM, qdata };
+    for (int i = 0; i < 200; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "coll-%d", (w->worker + i) % 6);
+        vdb_storage_t *storage = NULL;
+        if (vdb_db_acquire(w->db, name, &storage) != VDB_OK) {
+            return (void*)1;
+        }
+        test_random_vector(qdata, DB_DIM, (uint32_t)i);
+        vdb_search_results_t results;
+        vdb_status_t status = vdb_storage_search_exact(storage, &query, 5, &results);
+        bool ok = status == VDB_OK && results.count == 5;
+        if (status == VDB_OK) {
+            vdb_search_results_free(&results);
+        }
+        vdb_db_release(w->db, storage);
+        if (!ok) {
+            return (void*)1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Test threads sharing collections while they are opened and closed
+ * under them
+ */
+TEST(db_concurrent) {
+    enum { WORKERS = 4 };
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_db_params_t params = vdb_db_params_default();
+    params.max_open = 2;
+    params.threads = 3;
+    vdb_db_t *db = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_open(dir, &params, &db));
+    for (int c = 0; c < 6; c++) {
+        char name[32];
+        snprintf(name, sizeof(name), "coll-%d", c);
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_db_create(db, name, DB_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, DB_DIM, 0, 5000)); // enough to search in parallel
+        vdb_db_release(db, storage);
+    }
+
+    pthread_t threads[WORKERS];
+    db_worker_t workers[WORKERS];
+    for (int t = 0; t < WORKERS; t++) {
+        workers[t].db = db;
+        workers[t].worker = t;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, db_worker, &workers[t]));
+    }
+    for (int t = 0; t < WORKERS; t++) {
+        void *result = NULL;
+        pthread_join(threads[t], &result);
+        ASSERT_NULL(result);
+    }
+    ASSERT_TRUE(vdb_db_open_count(db) <= 2);
+
+    vdb_db_close(&db);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the maintenance thread compacts open collections
+ */
+TEST(db_compaction) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_db_params_t params = vdb_db_params_default();
+    params.compaction = true;
+    params.compaction_params.interval_ms = 10;
+    params.compaction_params.io_bytes_per_sec = 0;
+    vdb_db_t *db = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_open(dir, &params, &db));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_db_create(db, "coll", DB_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DB_DIM, 0, 100));
+    for (int i = 0; i < 50; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "row-%d", i);
+        ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+    }
+    for (int i = 0; i < 500 && vdb_storage_count(storage) != 50; i++) {
+        struct timespec ts = { 0, 10 * 1000000 };
+        nanosleep(&ts, NULL);
+    }
+    ASSERT_EQ(50, vdb_storage_count(storage));
+    ASSERT_EQ(50, vdb_storage_live_count(storage));
+    vdb_db_release(db, storage);
+
+    params.compaction_params.min_dead_fraction = 0.0;
+    vdb_db_t *bad = NULL;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_db_open(dir, &params, &bad));
+
+    vdb_db_close(&db);
+    test_remove_dir(dir);
+}
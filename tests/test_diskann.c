@@ -0,0 +1,322 @@
+/**
+ * test_diskann.c - Tests for the DiskANN (Vamana) index
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/stats.h"
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DISKANN_DIM 24
+
+/* Rows wider than a sector: records take two */
+#define DISKANN_WIDE_DIM 1500
+
+/**
+ * Rows of the exact top k for nq queries, k per query (UINT64_MAX pads).
+ * Taken before quantization is on, as exact search reranks codes then.
+ */
+static uint64_t *exact_rows(vdb_storage_t *storage, uint32_t dim, uint32_t k, int nq) {
+    uint64_t *rows = (uint64_t*)malloc((size_t)k * nq * sizeof(uint64_t));
+    float *qdata = (float*)malloc(dim * sizeof(float));
+    vdb_vector_t query = { dim, qdata };
+
+    for (int q = 0; q < nq && rows != NULL && qdata != NULL; q++) {
+        test_random_vector(qdata, dim, 1000000u + (uint32_t)q);
+        vdb_search_results_t exact = { NULL, 0 };
+        vdb_status_t status = vdb_storage_search_exact(storage, &query, k, &exact);
+        for (uint32_t j = 0; j < k; j++) {
+            rows[(size_t)q * k + j] = status == VDB_OK && j < exact.count ? exact.hits[j].row : UINT64_MAX;
+        }
+        vdb_search_results_free(&exact);
+    }
+    free(qdata);
+    return rows;
+}
+
+/**
+ * Average recall@k of DiskANN over nq queries against truth (from
+ * exact_rows; NULL = exact search now)
+ */
+static double measure_recall(vdb_storage_t *storage, uint32_t dim, uint32_t k, int nq,
+                             const uint64_t *truth) {
+    uint64_t *own = truth == NULL ? exact_rows(storage, dim, k, nq) : NULL;
+    const uint64_t *rows = truth != NULL ? truth : own;
+    size_t found = 0;
+    float *qdata = (float*)malloc(dim * sizeof(float));
+    vdb_vector_t query = { dim, qdata };
+
+    for (int q = 0; q < nq && qdata != NULL && rows != NULL; q++) {
+        test_random_vector(qdata, dim, 1000000u + (uint32_t)q);
+
+        vdb_search_results_t approx;
+        if (vdb_storage_search_diskann(storage, &query, k, &approx) != VDB_OK) {
+            break;
+        }
+        for (size_t i = 0; i < approx.count; i++) {
+            for (uint32_t j = 0; j < k; j++) {
+                if (approx.hits[i].row == rows[(size_t)q * k + j]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+        vdb_search_results_free(&approx);
+    }
+    free(qdata);
+    free(own);
+    return (double)found / ((double)k * nq);
+}
+
+/* Smaller than the defaults, so the tests build fast */
+static vdb_diskann_params_t test_params(void) {
+    vdb_diskann_params_t params = vdb_diskann_params_default();
+    params.max_degree = 32;
+    params.build_list = 64;
+    return params;
+}
+
+/**
+ * Test searching row-<seed> finds it first at distance 0
+ */
+static bool finds_itself(vdb_storage_t *storage, uint32_t dim, int seed) {
+    float *qdata = (float*)malloc(dim * sizeof(float));
+    if (qdata == NULL) {
+        return false;
+    }
+    test_random_vector(qdata, dim, (uint32_t)seed);
+    vdb_vector_t query = { dim, qdata };
+    char id[VDB_ID_MAX_LEN];
+    snprintf(id, sizeof(id), "row-%d", seed);
+
+    vdb_search_results_t results = { NULL, 0 };
+    bool ok = vdb_storage_search_diskann(storage, &query, 5, &results) == VDB_OK &&
+        results.count == 5 && strcmp(results.hits[0].id, id) == 0 && results.hits[0].distance < 1e-5f;
+    for (size_t i = 1; ok && i < results.count; i++) {
+        ok = results.hits[i - 1].distance <= results.hits[i].distance;
+    }
+    vdb_search_results_free(&results);
+    free(qdata);
+    return ok;
+}
+
+/**
+ * Test recall against exact search with PQ steering the walk, and the
+ * argument checks
+ */
+TEST(diskann_recall) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", DISKANN_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_build_diskann(storage, NULL)); // no rows
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DISKANN_DIM, 0, 3000));
+    uint64_t *truth = exact_rows(storage, DISKANN_DIM, 10, 50);
+    ASSERT_TRUE(truth != NULL);
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_PQ));
+
+    float qdata[DISKANN_DIM] = { 0 };
+    vdb_vector_t query = { DISKANN_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_search_diskann(storage, &query, 5, &results));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_set_diskann_search(storage, 64, 4));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_drop_diskann(storage));
+    ASSERT_FALSE(vdb_storage_has_diskann(storage));
+
+    vdb_diskann_params_t bad = test_params();
+    bad.max_degree = 1;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_build_diskann(storage, &bad));
+    bad = test_params();
+    bad.alpha = 0.5f;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_build_diskann(storage, &bad));
+    bad = test_params();
+    bad.beam_width = VDB_DISKANN_MAX_BEAM + 1;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_build_diskann(storage, &bad));
+
+    vdb_diskann_params_t params = test_params();
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+    ASSERT_TRUE(vdb_storage_has_diskann(storage));
+    ASSERT_EQ(0, test_file_size(dir, "coll", "diskann.idx") % 4096);
+
+    // PQ steers coarsely at this dim; a longer list makes up for it
+    ASSERT_EQ(VDB_OK, vdb_storage_set_diskann_search(storage, 256, 4));
+    ASSERT_EQ(VDB_OK, vdb_storage_reset_stats(storage));
+    double recall = measure_recall(storage, DISKANN_DIM, 10, 50, truth);
+    ASSERT_TRUE(recall >= 0.9);
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 1234));
+
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(51, stats.diskann_searches);
+    ASSERT_EQ(51, stats.diskann_search_latency.count);
+    ASSERT_TRUE(stats.diskann_reads >= 51 * 10);
+
+    // a longer list, no worse recall; a narrow beam, same answers
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_diskann_search(storage, 0, 4));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_diskann_search(storage, 64, 0));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_diskann_search(storage, 400, 8));
+    ASSERT_TRUE(measure_recall(storage, DISKANN_DIM, 10, 50, truth) >= recall - 0.02);
+    ASSERT_EQ(VDB_OK, vdb_storage_set_diskann_search(storage, 256, 1));
+    ASSERT_TRUE(measure_recall(storage, DISKANN_DIM, 10, 50, truth) >= 0.85);
+    free(truth);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_drop_diskann(storage));
+    ASSERT_FALSE(vdb_storage_has_diskann(storage));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "diskann.idx"));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test rows appended after the build are found, deleted rows aren't,
+ * and the index comes back on open
+ */
+TEST(diskann_tail_and_reopen) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", DISKANN_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DISKANN_DIM, 0, 1500));
+    vdb_diskann_params_t params = test_params();
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DISKANN_DIM, 1500, 300));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 1700));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 42));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "row-42"));
+    ASSERT_FALSE(finds_itself(storage, DISKANN_DIM, 42));
+    ASSERT_TRUE(measure_recall(storage, DISKANN_DIM, 10, 30, NULL) >= 0.9);
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(vdb_storage_has_diskann(storage));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 1700));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 7));
+    ASSERT_FALSE(finds_itself(storage, DISKANN_DIM, 42));
+    ASSERT_TRUE(measure_recall(storage, DISKANN_DIM, 10, 30, NULL) >= 0.9);
+
+    // building again takes the new rows in
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 1700));
+    vdb_storage_close(&storage);
+
+    // a damaged file is dropped on open, not trusted
+    char path[TEST_PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/coll/diskann.idx", dir);
+    ASSERT_EQ(0, truncate(path, 100));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_FALSE(vdb_storage_has_diskann(storage));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "diskann.idx"));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test records bigger than a sector, walked by the float rows (no codes)
+ */
+TEST(diskann_wide_rows) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", DISKANN_WIDE_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DISKANN_WIDE_DIM, 0, 300));
+    vdb_diskann_params_t params = test_params();
+    params.max_degree = 16;
+    params.build_list = 32;
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+
+    // 1 + 300 two-sector records
+    ASSERT_EQ(4096 * (1 + 300 * 2), test_file_size(dir, "coll", "diskann.idx"));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_WIDE_DIM, 123));
+    ASSERT_TRUE(measure_recall(storage, DISKANN_WIDE_DIM, 10, 10, NULL) >= 0.9);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test io_uring reads return what blocking reads do
+ */
+TEST(diskann_uring) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", DISKANN_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DISKANN_DIM, 0, 1000));
+    vdb_diskann_params_t params = test_params();
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+
+    float qdata[DISKANN_DIM];
+    test_random_vector(qdata, DISKANN_DIM, 777777);
+    vdb_vector_t query = { DISKANN_DIM, qdata };
+    vdb_search_results_t blocking, uring;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_diskann(storage, &query, 10, &blocking));
+
+    vdb_status_t status = vdb_storage_set_io_backend(storage, VDB_IO_URING);
+    if (status == VDB_ERROR_NOT_FOUND) {
+        printf("(no io_uring, skipped) ");
+        vdb_search_results_free(&blocking);
+        vdb_storage_close(&storage);
+        test_remove_dir(dir);
+        return;
+    }
+    ASSERT_EQ(VDB_OK, status);
+    for (int round = 0; round < 3; round++) { // the ring is reused
+        ASSERT_EQ(VDB_OK, vdb_storage_search_diskann(storage, &query, 10, &uring));
+        ASSERT_EQ(blocking.count, uring.count);
+        for (size_t i = 0; i < blocking.count; i++) {
+            ASSERT_EQ(blocking.hits[i].row, uring.hits[i].row);
+            ASSERT_FLOAT_EQ(blocking.hits[i].distance, uring.hits[i].distance, 1e-6);
+        }
+        vdb_search_results_free(&uring);
+    }
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 500));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_io_backend(storage, VDB_IO_BLOCKING));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 500));
+
+    vdb_search_results_free(&blocking);
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test compaction drops the index (its node numbers are gone) and a
+ * rebuild brings it back
+ */
+TEST(diskann_compaction_drops) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", DISKANN_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, DISKANN_DIM, 0, 800));
+    vdb_diskann_params_t params = test_params();
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+    for (int i = 0; i < 800; i += 4) {
+        char id[VDB_ID_MAX_LEN];
+        snprintf(id, sizeof(id), "row-%d", i);
+        ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+    }
+
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_FALSE(vdb_storage_has_diskann(storage));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "diskann.idx"));
+    ASSERT_FALSE(finds_itself(storage, DISKANN_DIM, 1));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_build_diskann(storage, &params));
+    ASSERT_TRUE(finds_itself(storage, DISKANN_DIM, 1));
+    ASSERT_FALSE(finds_itself(storage, DISKANN_DIM, 4));
+    ASSERT_TRUE(measure_recall(storage, DISKANN_DIM, 10, 30, NULL) >= 0.9);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
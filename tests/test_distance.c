@@ -0,0 +1,343 @@
+/**
+ * test_distance.c - Tests for distance kernels
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/distance.h"
+
+/**
+ * Test distances on hand-computed vectors
+ */
+TEST(distance_known_values) {
+    float a[3] = {1.0f, 0.0f, 0.0f};
+    float b[3] = {0.0f, 1.0f, 0.0f};
+    float c[3] = {2.0f, 0.0f, 0.0f};
+    float zero[3] = {0.0f, 0.0f, 0.0f};
+
+    ASSERT_FLOAT_EQ(1.0f, vdb_distance(VDB_METRIC_COSINE, a, b, 3), 1e-6);
+    ASSERT_FLOAT_EQ(0.0f, vdb_distance(VDB_METRIC_COSINE, a, c, 3), 1e-6);
+    ASSERT_FLOAT_EQ(1.0f, vdb_distance(VDB_METRIC_COSINE, a, zero, 3), 1e-6);
+    ASSERT_FLOAT_EQ(sqrtf(2.0f), vdb_distance(VDB_METRIC_EUCLIDEAN, a, b, 3), 1e-6);
+    ASSERT_FLOAT_EQ(1.0f, vdb_distance(VDB_METRIC_EUCLIDEAN, a, c, 3), 1e-6);
+    ASSERT_FLOAT_EQ(2.0f, vdb_dot(a, c, 3), 1e-6);
+    ASSERT_FLOAT_EQ(2.0f, vdb_l2_squared(a, b, 3), 1e-6);
+    ASSERT_FLOAT_EQ(1.0f, vdb_distance(VDB_METRIC_INNER_PRODUCT, a, b, 3), 1e-6);
+    ASSERT_FLOAT_EQ(-1.0f, vdb_distance(VDB_METRIC_INNER_PRODUCT, a, c, 3), 1e-6);
+    ASSERT_TRUE(isnan(vdb_distance((vdb_metric_t)999, a, b, 3)));
+}
+
+/**
+ * Test every supported ISA agrees with scalar, including tail lengths
+ */
+TEST(distance_isa_agreement) {
+    enum { MAX_DIM = 133 };
+    float a[MAX_DIM], b[MAX_DIM];
+    test_fill_vector(a, MAX_DIM, 3);
+    test_fill_vector(b, MAX_DIM, 11);
+
+    vdb_isa_t original = vdb_distance_get_isa();
+    ASSERT_TRUE(vdb_distance_isa_supported(VDB_ISA_SCALAR));
+    ASSERT_TRUE(vdb_distance_isa_supported(original));
+
+    for (int isa = VDB_ISA_SSE2; isa <= VDB_ISA_NEON; isa++) {
+        if (!vdb_distance_isa_supported((vdb_isa_t)isa)) {
+            ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_distance_set_isa((vdb_isa_t)isa));
+            continue;
+        }
+        for (uint32_t dim = 1; dim <= MAX_DIM; dim++) {
+            ASSERT_EQ(VDB_OK, vdb_distance_set_isa(VDB_ISA_SCALAR));
+            float cos_ref = vdb_distance(VDB_METRIC_COSINE, a, b, dim);
+            float l2_ref = vdb_distance(VDB_METRIC_EUCLIDEAN, a, b, dim);
+            float dot_ref = vdb_dot(a, b, dim);
+            float ip_ref = vdb_distance(VDB_METRIC_INNER_PRODUCT, a, b, dim);
+
+            ASSERT_EQ(VDB_OK, vdb_distance_set_isa((vdb_isa_t)isa));
+            ASSERT_EQ((vdb_isa_t)isa, vdb_distance_get_isa());
+            ASSERT_FLOAT_EQ(cos_ref, vdb_distance(VDB_METRIC_COSINE, a, b, dim), 1e-4);
+            ASSERT_FLOAT_EQ(l2_ref, vdb_distance(VDB_METRIC_EUCLIDEAN, a, b, dim), 1e-4);
+            ASSERT_FLOAT_EQ(dot_ref, vdb_dot(a, b, dim), 1e-4);
+            ASSERT_FLOAT_EQ(ip_ref, vdb_distance(VDB_METRIC_INNER_PRODUCT, a, b, dim), 1e-4);
+        }
+    }
+
+    ASSERT_EQ(VDB_OK, vdb_distance_set_isa(original));
+    ASSERT_STR_EQ("scalar", vdb_isa_to_string(VDB_ISA_SCALAR));
+    ASSERT_STR_EQ("unknown", vdb_isa_to_string((vdb_isa_t)999));
+}
+
+/**
+ * Test batch distances match pairwise distances with a padded stride
+ */
+TEST(distance_batch) {
+    enum { DIM = 37, STRIDE = 40, ROWS = 9 };
+    float query[DIM];
+    float rows[ROWS * STRIDE];
+    float out[ROWS];
+    test_fill_vector(query, DIM, 7);
+    for (int i = 0; i < ROWS; i++) {
+        test_fill_vector(rows + i * STRIDE, STRIDE, (uint32_t)(100 + i));
+    }
+
+    for (int m = VDB_METRIC_COSINE; m <= VDB_METRIC_INNER_PRODUCT; m++) {
+        ASSERT_EQ(VDB_OK, vdb_distance_batch((vdb_metric_t)m, query, rows, ROWS, STRIDE, DIM, out));
+        for (int i = 0; i < ROWS; i++) {
+            float expected = vdb_distance((vdb_metric_t)m, query, rows + i * STRIDE, DIM);
+            ASSERT_FLOAT_EQ(expected, out[i], 1e-5);
+        }
+    }
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch(VDB_METRIC_COSINE, query, rows, ROWS, DIM - 1, DIM, out));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch((vdb_metric_t)999, query, rows, ROWS, STRIDE, DIM, out));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch(VDB_METRIC_COSINE, NULL, rows, ROWS, STRIDE, DIM, out));
+}
+
+/**
+ * Test tile distances match pairwise ones on every ISA, including a
+ * short last query group and dims with tails
+ */
+TEST(distance_tile) {
+    enum { MAX_DIM = 37, STRIDE = 40, ROWS = 7, QUERIES = 6 };
+    float queries[QUERIES * STRIDE];
+    float rows[ROWS * STRIDE];
+    float out[QUERIES * ROWS];
+    for (int j = 0; j < QUERIES; j++) {
+        test_fill_vector(queries + j * STRIDE, STRIDE, (uint32_t)(7 + j));
+    }
+    for (int i = 0; i < ROWS; i++) {
+        test_fill_vector(rows + i * STRIDE, STRIDE, (uint32_t)(100 + i));
+    }
+
+    vdb_isa_t original = vdb_distance_get_isa();
+    for (int isa = VDB_ISA_SCALAR; isa <= VDB_ISA_NEON; isa++) {
+        if (vdb_distance_set_isa((vdb_isa_t)isa) != VDB_OK) {
+            continue;
+        }
+        for (uint32_t dim = 1; dim <= MAX_DIM; dim += 4) {
+            for (int m = VDB_METRIC_COSINE; m <= VDB_METRIC_INNER_PRODUCT; m++) {
+                for (size_t nq = 1; nq <= QUERIES; nq += 4) {
+                    ASSERT_EQ(VDB_OK, vdb_distance_tile((vdb_metric_t)m, queries, nq, STRIDE,
+                                                        rows, ROWS, STRIDE, dim, out));
+                    for (size_t j = 0; j < nq; j++) {
+                        for (int i = 0; i < ROWS; i++) {
+                            float expected = vdb_distance((vdb_metric_t)m, queries + j * STRIDE,
+                                                          rows + i * STRIDE, dim);
+                            ASSERT_FLOAT_EQ(expected, out[j * ROWS + i], 1e-4);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    ASSERT_EQ(VDB_OK, vdb_distance_set_isa(original));
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_tile(VDB_METRIC_COSINE, queries, 2, MAX_DIM - 1, rows, ROWS, STRIDE, MAX_DIM, out));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_tile((vdb_metric_t)999, queries, 2, STRIDE, rows, ROWS, STRIDE, MAX_DIM, out));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_tile(VDB_METRIC_EUCLIDEAN, NULL, 2, STRIDE, rows, ROWS, STRIDE, MAX_DIM, out));
+}
+
+/**
+ * Test f16 and bf16 conversions: exact values, rounding to nearest
+ * even, subnormals, overflow, infinities and NaN
+ */
+TEST(distance_half_convert) {
+    const float exact[] = {0.0f, -0.0f, 1.0f, -2.5f, 0.5f, 65504.0f, 6.103515625e-05f, 5.9604645e-08f};
+    const uint16_t f16_bits[] = {0x0000, 0x8000, 0x3C00, 0xC100, 0x3800, 0x7BFF, 0x0400, 0x0001};
+    enum { N = sizeof(exact) / sizeof(exact[0]) };
+    uint16_t half[N];
+    float back[N];
+
+    vdb_convert_from_f32(VDB_ELEMENT_F16, exact, half, N);
+    vdb_convert_to_f32(VDB_ELEMENT_F16, half, back, N);
+    for (int i = 0; i < N; i++) {
+        ASSERT_EQ(f16_bits[i], half[i]);
+        ASSERT_FLOAT_EQ(exact[i], back[i], 0.0);
+    }
+
+    // 1 + 2^-11 is halfway between two f16 values: ties go to even
+    const float ties[] = {1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f, 70000.0f, INFINITY, -INFINITY, NAN};
+    const uint16_t tie_bits[] = {0x3C00, 0x3C02, 0x7C00, 0x7C00, 0xFC00};
+    uint16_t rounded[6];
+    vdb_convert_from_f32(VDB_ELEMENT_F16, ties, rounded, 6);
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(tie_bits[i], rounded[i]);
+    }
+    ASSERT_TRUE((rounded[5] & 0x7C00) == 0x7C00 && (rounded[5] & 0x03FF) != 0);
+
+    // bf16 keeps the float32 exponent, so big values survive
+    const float wide[] = {1.0f, -3.0e38f, 1.0f + 1.0f / 256.0f, 1.0f + 3.0f / 256.0f, NAN};
+    const uint16_t bf16_bits[] = {0x3F80, 0xFF62, 0x3F80, 0x3F82};
+    uint16_t brain[5];
+    float widened[5];
+    vdb_convert_from_f32(VDB_ELEMENT_BF16, wide, brain, 5);
+    vdb_convert_to_f32(VDB_ELEMENT_BF16, brain, widened, 5);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(bf16_bits[i], brain[i]);
+    }
+    ASSERT_FLOAT_EQ(-3.0e38f, widened[1], 1e36);
+    ASSERT_TRUE(isnan(widened[4]));
+
+    // float32 is a plain copy
+    float copy[N];
+    vdb_convert_from_f32(VDB_ELEMENT_F32, exact, copy, N);
+    ASSERT_EQ(0, memcmp(copy, exact, sizeof(copy)));
+
+    ASSERT_EQ(4, vdb_element_size(VDB_ELEMENT_F32));
+    ASSERT_EQ(2, vdb_element_size(VDB_ELEMENT_F16));
+    ASSERT_EQ(2, vdb_element_size(VDB_ELEMENT_BF16));
+    ASSERT_EQ(0, vdb_element_size((vdb_element_type_t)9));
+    ASSERT_STR_EQ("bf16", vdb_element_type_to_string(VDB_ELEMENT_BF16));
+    ASSERT_STR_EQ("unknown", vdb_element_type_to_string((vdb_element_type_t)9));
+}
+
+/**
+ * Test the typed kernels on every ISA match float32 kernels run on the
+ * widened rows, including tail lengths
+ */
+TEST(distance_half_kernels) {
+    enum { MAX_DIM = 45, STRIDE = 48, ROWS = 5 };
+    float query[MAX_DIM];
+    float rows[ROWS * STRIDE];
+    uint16_t half[ROWS * STRIDE];
+    float widened[ROWS * STRIDE];
+    float out[ROWS];
+    test_fill_vector(query, MAX_DIM, 5);
+    for (int i = 0; i < ROWS; i++) {
+        test_fill_vector(rows + i * STRIDE, STRIDE, (uint32_t)(200 + i));
+    }
+
+    vdb_isa_t original = vdb_distance_get_isa();
+    for (int type = VDB_ELEMENT_F16; type <= VDB_ELEMENT_BF16; type++) {
+        vdb_convert_from_f32((vdb_element_type_t)type, rows, half, ROWS * STRIDE);
+        vdb_convert_to_f32((vdb_element_type_t)type, half, widened, ROWS * STRIDE);
+
+        for (int isa = VDB_ISA_SCALAR; isa <= VDB_ISA_NEON; isa++) {
+            if (vdb_distance_set_isa((vdb_isa_t)isa) != VDB_OK) {
+                continue;
+            }
+            for (uint32_t dim = 1; dim <= MAX_DIM; dim += 2) {
+                for (int m = VDB_METRIC_COSINE; m <= VDB_METRIC_INNER_PRODUCT; m++) {
+                    ASSERT_EQ(VDB_OK, vdb_distance_batch_typed((vdb_metric_t)m, (vdb_element_type_t)type,
+                                                               query, half, ROWS, STRIDE, dim, out));
+                    for (int i = 0; i < ROWS; i++) {
+                        float expected = vdb_distance((vdb_metric_t)m, query, widened + i * STRIDE, dim);
+                        ASSERT_FLOAT_EQ(expected, out[i], 1e-4);
+                        ASSERT_FLOAT_EQ(expected, vdb_distance_typed((vdb_metric_t)m, (vdb_element_type_t)type,
+                                                                     query, half + i * STRIDE, dim), 1e-4);
+                    }
+                    float pair = vdb_distance((vdb_metric_t)m, widened, widened + STRIDE, dim);
+                    ASSERT_FLOAT_EQ(pair, vdb_distance_rows((vdb_metric_t)m, (vdb_element_type_t)type,
+                                                            half, half + STRIDE, dim), 1e-4);
+                }
+            }
+        }
+    }
+    ASSERT_EQ(VDB_OK, vdb_distance_set_isa(original));
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch_typed(VDB_METRIC_COSINE, (vdb_element_type_t)9, query, half, ROWS, STRIDE, MAX_DIM, out));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch_typed(VDB_METRIC_COSINE, VDB_ELEMENT_F16, query, half, ROWS, MAX_DIM - 1, MAX_DIM, out));
+    ASSERT_TRUE(isnan(vdb_distance_typed((vdb_metric_t)999, VDB_ELEMENT_F16, query, half, MAX_DIM)));
+}
+
+/**
+ * Test normalizing: unit length after, the old norm returned, zero
+ * vectors untouched, and cosine of the originals equal to the inner
+ * product of the unit vectors
+ */
+TEST(distance_normalize) {
+    enum { DIM = 29 };
+    float a[DIM], b[DIM];
+    test_fill_vector(a, DIM, 4);
+    test_fill_vector(b, DIM, 9);
+    float cosine = vdb_distance(VDB_METRIC_COSINE, a, b, DIM);
+    float norm = sqrtf(vdb_dot(a, a, DIM));
+
+    ASSERT_FLOAT_EQ(norm, vdb_normalize(a, DIM), 1e-5);
+    vdb_normalize(b, DIM);
+    ASSERT_FLOAT_EQ(1.0f, vdb_dot(a, a, DIM), 1e-5);
+    ASSERT_FLOAT_EQ(cosine, vdb_distance(VDB_METRIC_INNER_PRODUCT, a, b, DIM), 1e-5);
+
+    float zero[DIM] = {0};
+    ASSERT_FLOAT_EQ(0.0f, vdb_normalize(zero, DIM), 0.0);
+    ASSERT_FLOAT_EQ(0.0f, zero[0], 0.0);
+    ASSERT_FLOAT_EQ(1.0f, vdb_distance(VDB_METRIC_INNER_PRODUCT, a, zero, DIM), 0.0);
+    ASSERT_STR_EQ("dot", vdb_metric_to_string(VDB_METRIC_INNER_PRODUCT));
+}
+
+/**
+ * Test the kernels specialized for common dimensions agree with the
+ * generic ones on every ISA, and fall back where they don't apply
+ */
+TEST(distance_fixed_dims) {
+    enum { ROWS = 5, MAX_DIM = 1536, STRIDE = MAX_DIM + 3 };
+    static const uint32_t dims[] = { 384, 768, 1024, 1536 };
+    float *query = (float*)malloc(MAX_DIM * sizeof(float));
+    float *rows = (float*)malloc((size_t)ROWS * STRIDE * sizeof(float));
+    uint16_t *half = (uint16_t*)malloc((size_t)ROWS * STRIDE * sizeof(uint16_t));
+    float out[ROWS], expected[ROWS];
+    ASSERT_NOT_NULL(query);
+    ASSERT_NOT_NULL(rows);
+    ASSERT_NOT_NULL(half);
+    test_fill_vector(query, MAX_DIM, 17);
+    test_fill_vector(rows, ROWS * STRIDE, 23);
+    vdb_convert_from_f32(VDB_ELEMENT_F16, rows, half, (size_t)ROWS * STRIDE);
+
+    ASSERT_EQ(VDB_DIM_KERNEL_GENERIC, vdb_distance_kernel_for_dim(0));
+    ASSERT_EQ(VDB_DIM_KERNEL_GENERIC, vdb_distance_kernel_for_dim(383));
+    ASSERT_EQ(VDB_DIM_KERNEL_GENERIC, vdb_distance_kernel_for_dim(4096));
+
+    vdb_isa_t original = vdb_distance_get_isa();
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        uint32_t dim = dims[d];
+        vdb_dim_kernel_t kernel = vdb_distance_kernel_for_dim(dim);
+        ASSERT_TRUE(kernel != VDB_DIM_KERNEL_GENERIC);
+        for (size_t o = 0; o < d; o++) {
+            ASSERT_TRUE(kernel != vdb_distance_kernel_for_dim(dims[o]));
+        }
+
+        for (int isa = VDB_ISA_SCALAR; isa <= VDB_ISA_NEON; isa++) {
+            if (vdb_distance_set_isa((vdb_isa_t)isa) != VDB_OK) {
+                continue;
+            }
+            for (int m = VDB_METRIC_COSINE; m <= VDB_METRIC_INNER_PRODUCT; m++) {
+                ASSERT_EQ(VDB_OK, vdb_distance_batch((vdb_metric_t)m, query, rows, ROWS, STRIDE, dim, expected));
+                ASSERT_EQ(VDB_OK, vdb_distance_batch_kernel(kernel, (vdb_metric_t)m, VDB_ELEMENT_F32,
+                                                            query, rows, ROWS, STRIDE, dim, out));
+                for (int i = 0; i < ROWS; i++) {
+                    // the sums are only reassociated
+                    float tolerance = 1e-4f * (1.0f + fabsf(expected[i]));
+                    ASSERT_FLOAT_EQ(expected[i], out[i], tolerance);
+                    ASSERT_FLOAT_EQ(expected[i], vdb_distance_kernel(kernel, (vdb_metric_t)m, VDB_ELEMENT_F32,
+                                                                     query, rows + i * STRIDE, dim), tolerance);
+                }
+
+                // another dim or element type goes to the generic kernels
+                uint32_t other = dim - 1;
+                ASSERT_FLOAT_EQ(vdb_distance((vdb_metric_t)m, query, rows, other),
+                                vdb_distance_kernel(kernel, (vdb_metric_t)m, VDB_ELEMENT_F32, query, rows, other), 0.0);
+                ASSERT_FLOAT_EQ(vdb_distance_typed((vdb_metric_t)m, VDB_ELEMENT_F16, query, half, dim),
+                                vdb_distance_kernel(kernel, (vdb_metric_t)m, VDB_ELEMENT_F16, query, half, dim), 0.0);
+            }
+        }
+    }
+    ASSERT_EQ(VDB_OK, vdb_distance_set_isa(original));
+
+    vdb_dim_kernel_t kernel = vdb_distance_kernel_for_dim(384);
+    ASSERT_TRUE(isnan(vdb_distance_kernel(kernel, (vdb_metric_t)999, VDB_ELEMENT_F32, query, rows, 384)));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch_kernel(kernel, VDB_METRIC_COSINE, VDB_ELEMENT_F32, query, rows, ROWS, 383, 384, out));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_distance_batch_kernel(kernel, VDB_METRIC_COSINE, VDB_ELEMENT_F32, NULL, rows, ROWS, STRIDE, 384, out));
+
+    free(query);
+    free(rows);
+    free(half);
+}
@@ -0,0 +1,259 @@
+/**
+ * test_filter.c - Tests for metadata filter expressions and filtered search
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/filter.h"
+#include "vdb/distance.h"
+
+#define FILTER_DIM 16
+
+/**
+ * Metadata of row i: cat "c<i%5>", price i%100, flag on even rows,
+ * tags ["t<i%3>", "all"]; every 97th row has broken JSON and every
+ * 89th none at all
+ */
+static const char *row_metadata(int i, char *buf, size_t len) {
+    if (i % 89 == 0) {
+        return NULL;
+    }
+    if (i % 97 == 0) {
+        return "{\"cat\": \"c1\", broken";
+    }
+    snprintf(buf, len, "{\"cat\": \"c%d\", \"price\": %d, \"flag\": %s, \"tags\": [\"t%d\", \"all\"], "
+             "\"nested\": {\"cat\": \"c9\"}}",
+             i % 5, i % 100, i % 2 == 0 ? "true" : "false", i % 3);
+    return buf;
+}
+
+static bool row_indexed(int i) {
+    return i % 89 != 0 && i % 97 != 0;
+}
+
+static vdb_status_t append_rows(vdb_storage_t *storage, int first, int n) {
+    enum { BATCH = 500 };
+    static float data[BATCH][FILTER_DIM];
+    static char meta[BATCH][160];
+    static vdb_item_t items[BATCH];
+
+    for (int done = 0; done < n; done += BATCH) {
+        int count = n - done < BATCH ? n - done : BATCH;
+        for (int i = 0; i < count; i++) {
+            int row = first + done + i;
+            memset(&items[i], 0, sizeof(items[i]));
+            snprintf(items[i].id, VDB_ID_MAX_LEN, "row-%d", row);
+            test_random_vector(data[i], FILTER_DIM, (uint32_t)row);
+            items[i].vector.dim = FILTER_DIM;
+            items[i].vector.data = data[i];
+            items[i].metadata = row_metadata(row, meta[i], sizeof(meta[i]));
+        }
+        vdb_status_t status = vdb_storage_append_batch(storage, items, (size_t)count);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    return VDB_OK;
+}
+
+typedef bool (*row_pred_t)(int i);
+
+static bool pred_c2(int i) { return row_indexed(i) && i % 5 == 2; }
+static bool pred_flag(int i) { return row_indexed(i) && i % 2 == 0; }
+static bool pred_price(int i) { return row_indexed(i) && i % 100 >= 10 && i % 100 < 20; }
+static bool pred_price_eq(int i) { return row_indexed(i) && i % 100 == 42; }
+static bool pred_and_or(int i) { return row_indexed(i) && i % 5 == 3 && (i % 100 < 30 || i % 2 == 1); }
+static bool pred_not(int i) { return !(row_indexed(i) && i % 5 == 0); }
+static bool pred_tag(int i) { return row_indexed(i) && i % 3 == 1; }
+static bool pred_all(int i) { return row_indexed(i); }
+static bool pred_none(int i) { (void)i; return false; }
+
+/**
+ * Check exact filtered search returns exactly the matching rows, best first
+ */
+static bool check_exact(vdb_storage_t *storage, int rows, const char *expr, row_pred_t pred) {
+    vdb_filter_t *filter = NULL;
+    if (vdb_filter_parse(expr, &filter) != VDB_OK) {
+        return false;
+    }
+
+    int expected = 0;
+    for (int i = 0; i < rows; i++) {
+        expected += pred(i) ? 1 : 0;
+    }
+
+    float qdata[FILTER_DIM];
+    test_random_vector(qdata, FILTER_DIM, 777777);
+    vdb_vector_t query = { FILTER_DIM, qdata };
+    vdb_search_results_t results;
+    bool ok = vdb_storage_search_exact_filtered(storage, &query, (uint32_t)rows, filter, &results) == VDB_OK;
+    ok = ok && results.count == (size_t)expected;
+    for (size_t i = 0; ok && i < results.count; i++) {
+        ok = pred((int)results.hits[i].row) &&
+             (i == 0 || results.hits[i - 1].distance <= results.hits[i].distance);
+    }
+    if (ok) {
+        vdb_search_results_free(&results);
+    }
+    vdb_filter_free(&filter);
+    return ok;
+}
+
+/**
+ * Test expressions parse, and bad ones are rejected
+ */
+TEST(filter_parse) {
+    const char *good[] = {
+        "cat = \"shoes\"",
+        "price < 50",
+        "price >= -1.5e3 and price <= 10",
+        "NOT flag = true",
+        "(a = 1 OR b != \"x\") AND NOT (c > 2)",
+        "\"field with space\" = false",
+        "x.y-z == 1",
+    };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        vdb_filter_t *filter = NULL;
+        ASSERT_EQ(VDB_OK, vdb_filter_parse(good[i], &filter));
+        ASSERT_NOT_NULL(filter);
+        vdb_filter_free(&filter);
+        ASSERT_NULL(filter);
+    }
+
+    const char *bad[] = {
+        "", "cat", "cat =", "= 1", "cat = shoes", "price < \"x\"", "flag > true",
+        "(a = 1", "a = 1)", "a = 1 AND", "a = 1 b = 2", "a = \"unterminated", "a === 1",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        vdb_filter_t *filter = NULL;
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_filter_parse(bad[i], &filter));
+        ASSERT_NULL(filter);
+    }
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_filter_parse(NULL, NULL));
+    vdb_filter_free(NULL);
+}
+
+/**
+ * Test exact filtered search over terms, ranges, arrays and boolean
+ * operators, before and after reopen (the index is rebuilt)
+ */
+TEST(filter_exact_search) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    const int rows = 3000;
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", FILTER_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 0, rows));
+
+    struct { const char *expr; row_pred_t pred; } cases[] = {
+        { "cat = \"c2\"", pred_c2 },
+        { "flag = true", pred_flag },
+        { "price >= 10 AND price < 20", pred_price },
+        { "price = 42", pred_price_eq },
+        { "cat = \"c3\" and (price < 30 or flag = false)", pred_and_or },
+        { "cat != \"c0\"", pred_not },
+        { "NOT cat = \"c0\"", pred_not },
+        { "tags = \"t1\"", pred_tag },
+        { "tags = \"all\"", pred_all },
+        { "cat = \"c9\"", pred_none }, // nested fields aren't indexed
+        { "price = \"42\"", pred_none }, // types never cross
+        { "missing > 0", pred_none },
+    };
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            ASSERT_TRUE(check_exact(storage, rows, cases[i].expr, cases[i].pred));
+        }
+        vdb_storage_close(&storage);
+        ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    }
+
+    // appends after reopen are indexed too
+    ASSERT_EQ(VDB_OK, append_rows(storage, rows, 500));
+    ASSERT_TRUE(check_exact(storage, rows + 500, "cat = \"c2\"", pred_c2));
+
+    // a NULL filter is a plain exact search
+    float qdata[FILTER_DIM];
+    test_random_vector(qdata, FILTER_DIM, 5);
+    vdb_vector_t query = { FILTER_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(storage, &query, 3, NULL, &results));
+    ASSERT_EQ(3, results.count);
+    ASSERT_STR_EQ("row-5", results.hits[0].id);
+    vdb_search_results_free(&results);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test filtered HNSW against exact filtered search: recall for a broad
+ * filter, exact answers for a selective one, and quantized codes
+ */
+TEST(filter_hnsw_search) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    const int rows = 6000;
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", FILTER_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_rows(storage, 0, rows));
+
+    vdb_filter_t *broad = NULL;
+    vdb_filter_t *selective = NULL;
+    ASSERT_EQ(VDB_OK, vdb_filter_parse("flag = true", &broad));
+    ASSERT_EQ(VDB_OK, vdb_filter_parse("price = 42 AND cat = \"c2\"", &selective));
+
+    float qdata[FILTER_DIM];
+    vdb_vector_t query = { FILTER_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_search_hnsw_filtered(storage, &query, 10, broad, &results));
+
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.ef_construction = 100;
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_ef_search(storage, 100));
+
+    for (int quant = 0; quant < 2; quant++) {
+        if (quant) {
+            ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+        }
+
+        size_t found = 0;
+        size_t wanted = 0;
+        for (uint32_t q = 0; q < 30; q++) {
+            test_random_vector(qdata, FILTER_DIM, 900000 + q);
+
+            vdb_search_results_t truth;
+            ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(storage, &query, 10, broad, &truth));
+            ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw_filtered(storage, &query, 10, broad, &results));
+            for (size_t i = 0; i < results.count; i++) {
+                ASSERT_TRUE(pred_flag((int)results.hits[i].row));
+                for (size_t j = 0; j < truth.count; j++) {
+                    found += results.hits[i].row == truth.hits[j].row ? 1 : 0;
+                }
+            }
+            wanted += truth.count;
+            vdb_search_results_free(&truth);
+            vdb_search_results_free(&results);
+
+            // few matches: answered by scanning them, so exact
+            ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(storage, &query, 5, selective, &truth));
+            ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw_filtered(storage, &query, 5, selective, &results));
+            ASSERT_EQ(truth.count, results.count);
+            for (size_t i = 0; i < results.count; i++) {
+                ASSERT_EQ(truth.hits[i].row, results.hits[i].row);
+            }
+            vdb_search_results_free(&truth);
+            vdb_search_results_free(&results);
+        }
+        ASSERT_TRUE((double)found / (double)wanted >= 0.9);
+    }
+
+    vdb_filter_free(&broad);
+    vdb_filter_free(&selective);
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
@@ -18,11 +18,12 @@
 #include <string.h>
 #include <math.h>
 
-/* Global test statistics */
-static int _tests_run = 0;
+/* Global test statistics (every test file includes them, only
+   test_main.c reads them all) */
+static int _tests_run __attribute__((unused)) = 0;
 static int _tests_passed = 0;
 static int _tests_failed = 0;
-static const char *_current_test = NULL;
+static const char *_current_test __attribute__((unused)) = NULL;
 
 /**
  * Define a test function
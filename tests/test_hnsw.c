@@ -0,0 +1,336 @@
+/**
+ * test_hnsw.c - Tests for the HNSW index
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include <math.h>
+#include <time.h>
+
+#define HNSW_DIM 24
+
+/**
+ * Average recall@k of HNSW against exact search over nq queries
+ */
+static double measure_recall(vdb_storage_t *storage, uint32_t k, int nq) {
+    size_t found = 0;
+    float qdata[HNSW_DIM];
+    vdb_vector_t query = { HNSW_DIM, qdata };
+
+    for (int q = 0; q < nq; q++) {
+        test_random_vector(qdata, HNSW_DIM, 1000000u + (uint32_t)q);
+
+        vdb_search_results_t exact, approx;
+        if (vdb_storage_search_exact(storage, &query, k, &exact) != VDB_OK) {
+            return 0.0;
+        }
+        if (vdb_storage_search_hnsw(storage, &query, k, &approx) != VDB_OK) {
+            vdb_search_results_free(&exact);
+            return 0.0;
+        }
+        for (size_t i = 0; i < approx.count; i++) {
+            for (size_t j = 0; j < exact.count; j++) {
+                if (approx.hits[i].row == exact.hits[j].row) {
+                    found++;
+                    break;
+                }
+            }
+        }
+        vdb_search_results_free(&exact);
+        vdb_search_results_free(&approx);
+    }
+    return (double)found / ((double)k * nq);
+}
+
+/**
+ * Test recall against exact search, building over existing rows and
+ * then growing through appends
+ */
+TEST(hnsw_recall) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", HNSW_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 0, 2000));
+
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.ef_construction = 100;
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_TRUE(vdb_storage_has_hnsw(storage));
+
+    // appends keep the index in step
+    for (int first = 2000; first < 5000; first += 500) {
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, first, 500));
+    }
+
+    double recall = measure_recall(storage, 10, 50);
+    ASSERT_TRUE(recall >= 0.9);
+
+    // a stored vector finds itself
+    float qdata[HNSW_DIM];
+    test_random_vector(qdata, HNSW_DIM, 4321);
+    vdb_vector_t query = { HNSW_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 5, &results));
+    ASSERT_EQ(5, results.count);
+    ASSERT_STR_EQ("row-4321", results.hits[0].id);
+    ASSERT_FLOAT_EQ(0.0f, results.hits[0].distance, 1e-5);
+    for (size_t i = 1; i < results.count; i++) {
+        ASSERT_TRUE(results.hits[i - 1].distance <= results.hits[i].distance);
+    }
+    vdb_search_results_free(&results);
+
+    // wider beam, no worse recall
+    ASSERT_EQ(VDB_OK, vdb_storage_set_ef_search(storage, 200));
+    ASSERT_TRUE(measure_recall(storage, 10, 50) >= recall - 1e-9);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the graph survives close/open via hnsw.idx, including rows
+ * appended after the last save
+ */
+TEST(hnsw_persistence) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", HNSW_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 0, 1500));
+    vdb_storage_close(&storage);
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw.idx") > 0);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(vdb_storage_has_hnsw(storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 1500, 500));
+
+    float qdata[HNSW_DIM];
+    test_random_vector(qdata, HNSW_DIM, 1777);
+    vdb_vector_t query = { HNSW_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 3, &results));
+    ASSERT_EQ(3, results.count);
+    ASSERT_STR_EQ("row-1777", results.hits[0].id);
+    vdb_search_results_free(&results);
+    ASSERT_TRUE(measure_recall(storage, 10, 30) >= 0.9);
+    vdb_storage_close(&storage);
+
+    // a stale index (rows added by a writer that never saved it) is caught up on open
+    char idx_path[TEST_PATH_MAX + 64];
+    char saved_path[TEST_PATH_MAX + 64];
+    snprintf(idx_path, sizeof(idx_path), "%s/coll/hnsw.idx", dir);
+    snprintf(saved_path, sizeof(saved_path), "%s/coll/hnsw.idx.saved", dir);
+    ASSERT_EQ(0, rename(idx_path, saved_path));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_FALSE(vdb_storage_has_hnsw(storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 2000, 100));
+    vdb_storage_close(&storage);
+    ASSERT_EQ(0, rename(saved_path, idx_path));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(vdb_storage_has_hnsw(storage));
+    test_random_vector(qdata, HNSW_DIM, 2050);
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 1, &results));
+    ASSERT_EQ(1, results.count);
+    ASSERT_STR_EQ("row-2050", results.hits[0].id);
+    vdb_search_results_free(&results);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test a multi-threaded bulk build matches the single-threaded one
+ */
+TEST(hnsw_parallel_build) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    double recall[2];
+    const uint32_t threads[2] = { 1, 4 };
+    const char *names[2] = { "serial", "parallel" };
+    for (int i = 0; i < 2; i++) {
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_storage_create(dir, names[i], HNSW_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+        ASSERT_EQ(VDB_OK, vdb_storage_set_search_threads(storage, threads[i]));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 0, 4000));
+
+        // bulk build over embeddings.seg, then a big batch through append
+        vdb_hnsw_params_t params = vdb_hnsw_params_default();
+        params.ef_construction = 100;
+        ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 4000, 2000));
+
+        recall[i] = measure_recall(storage, 10, 50);
+        ASSERT_TRUE(recall[i] >= 0.9);
+        vdb_storage_close(&storage);
+    }
+    ASSERT_TRUE(fabs(recall[0] - recall[1]) <= 0.03);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test search across several sealed segments plus the memtable, and
+ * that they survive close/open and compaction
+ */
+TEST(hnsw_segments) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", HNSW_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_seal(storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_segment_rows(storage, 0));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_segment_rows(storage, 800));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 0, 2000));
+
+    // 800 + 800 + 400, the last one sealed early
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.ef_construction = 100;
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-1.idx") > 0);
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-3.idx") > 0);
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-4.idx") < 0);
+
+    // fresh rows are only in the memtable, and found by the exact scan
+    ASSERT_EQ(VDB_OK, vdb_storage_set_segment_rows(storage, 100000));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 2000, 600));
+    float qdata[HNSW_DIM];
+    test_random_vector(qdata, HNSW_DIM, 2345);
+    vdb_vector_t query = { HNSW_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 3, &results));
+    ASSERT_EQ(3, results.count);
+    ASSERT_STR_EQ("row-2345", results.hits[0].id);
+    vdb_search_results_free(&results);
+    ASSERT_TRUE(measure_recall(storage, 10, 50) >= 0.9);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-4.idx") > 0);
+    ASSERT_EQ(VDB_OK, vdb_storage_seal(storage)); // nothing left, no-op
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-5.idx") < 0);
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(vdb_storage_has_hnsw(storage));
+    ASSERT_TRUE(measure_recall(storage, 10, 50) >= 0.9);
+
+    // drop most of the first segment, all of the second
+    for (int i = 0; i < 1600; i++) {
+        if (i >= 800 || i % 4 != 0) {
+            char id[VDB_ID_MAX_LEN];
+            snprintf(id, sizeof(id), "row-%d", i);
+            ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+        }
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ(1200u, vdb_storage_count(storage));
+    ASSERT_TRUE(measure_recall(storage, 10, 50) >= 0.9);
+    test_random_vector(qdata, HNSW_DIM, 2500);
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 1, &results));
+    ASSERT_EQ(1, results.count);
+    ASSERT_STR_EQ("row-2500", results.hits[0].id);
+    vdb_search_results_free(&results);
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(measure_recall(storage, 10, 50) >= 0.9);
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the sealer builds full segments in the background while appends
+ * keep going, and that close stops it cleanly
+ */
+TEST(hnsw_background_seal) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", HNSW_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_segment_rows(storage, 500));
+    for (int first = 0; first < 1600; first += 200) {
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, first, 200));
+    }
+
+    // three full segments; the last 100 rows stay in the memtable
+    struct timespec pause = { 0, 20 * 1000000L };
+    for (int tries = 0; tries < 1000 && test_file_size(dir, "coll", "hnsw-3.idx") < 0; tries++) {
+        nanosleep(&pause, NULL);
+    }
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-3.idx") > 0);
+    ASSERT_TRUE(test_file_size(dir, "coll", "hnsw-4.idx") < 0);
+    ASSERT_TRUE(measure_recall(storage, 10, 30) >= 0.9);
+
+    // closed mid-seal: whatever wasn't sealed is caught up after open
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 1600, 900));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(measure_recall(storage, 10, 30) >= 0.9);
+    float qdata[HNSW_DIM];
+    test_random_vector(qdata, HNSW_DIM, 2480);
+    vdb_vector_t query = { HNSW_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 1, &results));
+    ASSERT_EQ(1, results.count);
+    ASSERT_STR_EQ("row-2480", results.hits[0].id);
+    vdb_search_results_free(&results);
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test argument checking and the no-index case
+ */
+TEST(hnsw_invalid) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", HNSW_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+
+    float qdata[HNSW_DIM];
+    test_random_vector(qdata, HNSW_DIM, 1);
+    vdb_vector_t query = { HNSW_DIM, qdata };
+    vdb_search_results_t results;
+
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_search_hnsw(storage, &query, 5, &results));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_set_ef_search(storage, 10));
+
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.m = 1;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_enable_hnsw(storage, &params));
+    params = vdb_hnsw_params_default();
+    params.ef_search = 0;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_FALSE(vdb_storage_has_hnsw(storage));
+
+    // empty index
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 5, &results));
+    ASSERT_EQ(0, results.count);
+
+    // k larger than the collection
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, HNSW_DIM, 0, 3));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 10, &results));
+    ASSERT_EQ(3, results.count);
+    vdb_search_results_free(&results);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_search_hnsw(storage, &query, 0, &results));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_ef_search(storage, 0));
+    query.dim = HNSW_DIM + 1;
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_storage_search_hnsw(storage, &query, 5, &results));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
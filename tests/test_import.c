@@ -0,0 +1,364 @@
+/**
+ * test_import.c - Tests for bulk import from fvecs, npy and JSONL files
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/import.h"
+#include "vdb/filter.h"
+#include <math.h>
+
+#define IMPORT_DIM 24
+#define IMPORT_ROWS 1000
+
+/**
+ * Small chunks and batches, so every test crosses many of both
+ */
+static vdb_import_params_t small_params(void) {
+    vdb_import_params_t params = vdb_import_params_default();
+    params.parse_threads = 3;
+    params.batch_rows = 37;
+    params.chunk_bytes = 1000;
+    return params;
+}
+
+/**
+ * Write rows [0, rows) as fvecs, seeded by row
+ */
+static int write_fvecs(const char *path, uint32_t dim, int rows) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    float data[IMPORT_DIM];
+    int32_t header = (int32_t)dim;
+    for (int i = 0; i < rows; i++) {
+        test_random_vector(data, dim, (uint32_t)i);
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(data, sizeof(float), dim, f);
+    }
+    return fclose(f);
+}
+
+/**
+ * Write rows [0, rows) as a version 1 npy array of float32 or float64
+ */
+static int write_npy(const char *path, int rows, bool f64) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    char header[128];
+    int len = snprintf(header, sizeof(header), "{'descr': '%s', 'fortran_order': False, 'shape': (%d, %d), }",
+                       f64 ? "<f8" : "<f4", rows, IMPORT_DIM);
+    while (len < 117) {
+        header[len++] = ' ';
+    }
+    header[len++] = '\n';
+    uint8_t prefix[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (uint8_t)len, 0 };
+    fwrite(prefix, 1, sizeof(prefix), f);
+    fwrite(header, 1, (size_t)len, f);
+
+    float data[IMPORT_DIM];
+    for (int i = 0; i < rows; i++) {
+        test_random_vector(data, IMPORT_DIM, (uint32_t)i);
+        for (int d = 0; d < IMPORT_DIM; d++) {
+            if (f64) {
+                double v = data[d];
+                fwrite(&v, sizeof(v), 1, f);
+            } else {
+                fwrite(&data[d], sizeof(float), 1, f);
+            }
+        }
+    }
+    return fclose(f);
+}
+
+/**
+ * Check the row stored under the decimal ID `id` holds vector `seed`
+ */
+static bool row_matches(vdb_storage_t *storage, unsigned long id, uint32_t seed, float eps) {
+    char key[VDB_ID_MAX_LEN];
+    snprintf(key, sizeof(key), "%lu", id);
+    vdb_item_t item;
+    if (vdb_storage_get(storage, key, &item) != VDB_OK) {
+        return false;
+    }
+    float expected[IMPORT_DIM];
+    test_random_vector(expected, IMPORT_DIM, seed);
+    bool ok = item.vector.dim == IMPORT_DIM;
+    for (uint32_t d = 0; ok && d < IMPORT_DIM; d++) {
+        ok = fabsf(item.vector.data[d] - expected[d]) <= eps;
+    }
+    vdb_storage_item_free(&item);
+    return ok;
+}
+
+/**
+ * Test fvecs and npy (f4 and f8) imports land every row under its ID
+ */
+TEST(import_fvecs_npy) {
+    char dir[TEST_PATH_MAX];
+    char path[TEST_PATH_MAX + 32];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", IMPORT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_import_params_t params = small_params();
+    vdb_import_stats_t stats;
+
+    snprintf(path, sizeof(path), "%s/rows.fvecs", dir);
+    ASSERT_EQ(0, write_fvecs(path, IMPORT_DIM, IMPORT_ROWS));
+    ASSERT_EQ(VDB_OK, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(IMPORT_ROWS, stats.rows);
+    ASSERT_EQ(IMPORT_ROWS * (4 + IMPORT_DIM * 4), stats.bytes);
+    ASSERT_EQ(0, stats.failed_record);
+
+    snprintf(path, sizeof(path), "%s/rows.npy", dir);
+    ASSERT_EQ(0, write_npy(path, IMPORT_ROWS, false));
+    params.first_id = IMPORT_ROWS;
+    ASSERT_EQ(VDB_OK, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(IMPORT_ROWS, stats.rows);
+
+    snprintf(path, sizeof(path), "%s/rows64.npy", dir);
+    ASSERT_EQ(0, write_npy(path, IMPORT_ROWS, true));
+    params.first_id = 2 * IMPORT_ROWS;
+    params.parse_threads = 1;
+    ASSERT_EQ(VDB_OK, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(IMPORT_ROWS, stats.rows);
+
+    ASSERT_EQ(3 * IMPORT_ROWS, vdb_storage_count(storage));
+    for (int i = 0; i < IMPORT_ROWS; i += 7) {
+        ASSERT_TRUE(row_matches(storage, (unsigned long)i, (uint32_t)i, 0.0f));
+        ASSERT_TRUE(row_matches(storage, (unsigned long)(IMPORT_ROWS + i), (uint32_t)i, 0.0f));
+        ASSERT_TRUE(row_matches(storage, (unsigned long)(2 * IMPORT_ROWS + i), (uint32_t)i, 1e-7f));
+    }
+
+    // the same IDs again
+    params.first_id = 0;
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(0, stats.rows);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test bad fvecs and npy files are refused, keeping the batches before
+ */
+TEST(import_fixed_errors) {
+    char dir[TEST_PATH_MAX];
+    char path[TEST_PATH_MAX + 32];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", IMPORT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_import_params_t params = small_params();
+    vdb_import_stats_t stats;
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_import(NULL, "x.fvecs", &params, &stats));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_import(storage, NULL, &params, &stats));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_import(storage, "rows.csv", &params, &stats));
+    snprintf(path, sizeof(path), "%s/missing.fvecs", dir);
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_import(storage, path, NULL, NULL));
+
+    // wrong dimension
+    snprintf(path, sizeof(path), "%s/narrow.fvecs", dir);
+    ASSERT_EQ(0, write_fvecs(path, IMPORT_DIM - 1, 10));
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(1, stats.failed_record);
+    ASSERT_EQ(0, vdb_storage_count(storage));
+
+    // cut in the middle of the last row: whole chunks before it stay
+    snprintf(path, sizeof(path), "%s/cut.fvecs", dir);
+    ASSERT_EQ(0, write_fvecs(path, IMPORT_DIM, 100));
+    ASSERT_EQ(0, truncate(path, 100 * (4 + IMPORT_DIM * 4) - 10));
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_TRUE(stats.rows > 0 && stats.rows < 100);
+    ASSERT_EQ(stats.rows, vdb_storage_count(storage));
+
+    // npy with fewer rows than its header says, or the wrong shape
+    snprintf(path, sizeof(path), "%s/cut.npy", dir);
+    ASSERT_EQ(0, write_npy(path, 50, false));
+    ASSERT_EQ(0, truncate(path, 128 + 49 * IMPORT_DIM * 4));
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(0, stats.rows);
+
+    vdb_storage_t *other = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "other", IMPORT_DIM + 1, VDB_METRIC_EUCLIDEAN, &other));
+    snprintf(path, sizeof(path), "%s/rows.npy", dir);
+    ASSERT_EQ(0, write_npy(path, 10, false));
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_storage_import(other, path, &params, &stats));
+    ASSERT_EQ(0, vdb_storage_count(other));
+    vdb_storage_close(&other);
+
+    snprintf(path, sizeof(path), "%s/junk.npy", dir);
+    FILE *f = fopen(path, "wb");
+    ASSERT_NOT_NULL(f);
+    fputs("not an npy file at all", f);
+    fclose(f);
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_import(storage, path, &params, &stats));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test JSONL ids, vectors and metadata, with lines longer than a chunk
+ */
+TEST(import_jsonl) {
+    char dir[TEST_PATH_MAX];
+    char path[TEST_PATH_MAX + 32];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+    snprintf(path, sizeof(path), "%s/rows.jsonl", dir);
+
+    FILE *f = fopen(path, "w");
+    ASSERT_NOT_NULL(f);
+    float data[IMPORT_DIM];
+    for (int i = 0; i < IMPORT_ROWS; i++) {
+        test_random_vector(data, IMPORT_DIM, (uint32_t)i);
+        if (i % 2 == 0) {
+            fprintf(f, "{\"id\": \"%d\", \"extra\": [1, {\"a\": \"}\"}], \"vector\": [", i);
+        } else {
+            fprintf(f, "  {\"vector\":[");
+        }
+        for (int d = 0; d < IMPORT_DIM; d++) {
+            fprintf(f, "%s%.9g", d > 0 ? ", " : "", data[d]);
+        }
+        fprintf(f, "]");
+        if (i % 2 == 1) {
+            fprintf(f, ",\"id\":%d,\"metadata\":{\"odd\": true, \"pad\": \"%0*d\"}", i, i % 5 == 0 ? 900 : 1, 0);
+        }
+        fprintf(f, i % 3 == 0 ? "}\r\n" : "}\n");
+        if (i % 100 == 0) {
+            fprintf(f, "\n   \n");
+        }
+    }
+    fprintf(f, "{\"id\": \"a\\/b\\u0041\", \"vector\": [");
+    for (int d = 0; d < IMPORT_DIM; d++) {
+        fprintf(f, "%s%d", d > 0 ? "," : "", d);
+    }
+    fprintf(f, "], \"metadata\": null}"); // no newline at the end
+    fclose(f);
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", IMPORT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_import_params_t params = small_params();
+    vdb_import_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_import(storage, path, &params, &stats));
+    ASSERT_EQ(IMPORT_ROWS + 1, stats.rows);
+    ASSERT_EQ(IMPORT_ROWS + 1, vdb_storage_count(storage));
+
+    for (int i = 0; i < IMPORT_ROWS; i += 3) {
+        ASSERT_TRUE(row_matches(storage, (unsigned long)i, (uint32_t)i, 0.0f));
+    }
+    vdb_item_t item;
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "a/bA", &item));
+    ASSERT_FLOAT_EQ(23.0f, item.vector.data[23], 0.0);
+    ASSERT_NULL(item.metadata);
+    vdb_storage_item_free(&item);
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "5", &item));
+    ASSERT_NOT_NULL(item.metadata);
+    ASSERT_TRUE(strncmp(item.metadata, "{\"odd\": true, \"pad\": \"000", 25) == 0);
+    ASSERT_EQ(strlen(item.metadata), strlen("{\"odd\": true, \"pad\": \"\"}") + 900);
+    vdb_storage_item_free(&item);
+
+    // metadata was indexed like any appended row
+    vdb_filter_t *filter = NULL;
+    ASSERT_EQ(VDB_OK, vdb_filter_parse("odd = true", &filter));
+    vdb_vector_t query = { IMPORT_DIM, data };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(storage, &query, IMPORT_ROWS, filter, &results));
+    ASSERT_EQ(IMPORT_ROWS / 2, results.count);
+    vdb_search_results_free(&results);
+    vdb_filter_free(&filter);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test a bad JSONL line stops the import and is reported by line number
+ */
+TEST(import_jsonl_errors) {
+    char dir[TEST_PATH_MAX];
+    char path[TEST_PATH_MAX + 32];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+    snprintf(path, sizeof(path), "%s/rows.ndjson", dir);
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", 2, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_import_params_t params = small_params();
+    params.batch_rows = 10;
+    vdb_import_stats_t stats;
+
+    struct { const char *line; vdb_status_t status; } cases[] = {
+        { "{\"id\": \"x\", \"vector\": [1, 2, 3]}", VDB_ERROR_DIMENSION_MISMATCH },
+        { "{\"id\": \"x\", \"vector\": [1]}", VDB_ERROR_DIMENSION_MISMATCH },
+        { "{\"id\": \"x\"}", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"vector\": [1, 2]}", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"id\": \"x\", \"vector\": [1, \"2\"]}", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"id\": \"x\", \"vector\": [1, 2], \"metadata\": \"text\"}", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"id\": \"x\", \"vector\": [1, 2]} trailing", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"id\": \"x\", \"vector\": [1, 2]", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"id\": true, \"vector\": [1, 2]}", VDB_ERROR_INVALID_ARGUMENT },
+        { "{\"id\": \"caf\\u00e9\", \"vector\": [1, 2]}", VDB_ERROR_INVALID_ARGUMENT }, // not printable ASCII
+        { "[1, 2]", VDB_ERROR_INVALID_ARGUMENT },
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        // 250 good lines, then the bad one
+        FILE *f = fopen(path, "w");
+        ASSERT_NOT_NULL(f);
+        for (int i = 0; i < 250; i++) {
+            fprintf(f, "{\"id\": \"c%zu-%d\", \"vector\": [%d, 0.5]}\n", c, i, i);
+        }
+        fprintf(f, "%s\n{\"id\": \"after\", \"vector\": [0, 0]}\n", cases[c].line);
+        fclose(f);
+
+        uint64_t before = vdb_storage_count(storage);
+        ASSERT_EQ(cases[c].status, vdb_storage_import(storage, path, &params, &stats));
+        ASSERT_EQ(251, stats.failed_record);
+        ASSERT_TRUE(stats.rows <= 250);
+        ASSERT_EQ(before + stats.rows, vdb_storage_count(storage));
+    }
+
+    vdb_item_t item;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "after", &item));
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test build_hnsw indexes the import, and seals an existing index
+ */
+TEST(import_build_hnsw) {
+    char dir[TEST_PATH_MAX];
+    char path[TEST_PATH_MAX + 32];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+    snprintf(path, sizeof(path), "%s/rows.fvecs", dir);
+    ASSERT_EQ(0, write_fvecs(path, IMPORT_DIM, 300));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", IMPORT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_import_params_t params = vdb_import_params_default();
+    params.build_hnsw = true;
+    ASSERT_EQ(VDB_OK, vdb_storage_import(storage, path, &params, NULL));
+    ASSERT_TRUE(vdb_storage_has_hnsw(storage));
+
+    params.first_id = 300;
+    ASSERT_EQ(VDB_OK, vdb_storage_import(storage, path, &params, NULL));
+    ASSERT_EQ(600, vdb_storage_count(storage));
+
+    float data[IMPORT_DIM];
+    test_random_vector(data, IMPORT_DIM, 123);
+    vdb_vector_t query = { IMPORT_DIM, data };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 2, &results));
+    ASSERT_EQ(2, results.count);
+    ASSERT_FLOAT_EQ(0.0f, results.hits[0].distance, 1e-6);
+    ASSERT_FLOAT_EQ(0.0f, results.hits[1].distance, 1e-6);
+    vdb_search_results_free(&results);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
@@ -18,6 +18,12 @@ extern void test_vector_copy(void);
 extern void test_id_validation(void);
 extern void test_id_copy(void);
 
+/* From test_arena.c */
+extern void test_arena_alloc(void);
+extern void test_arena_mark_rewind(void);
+extern void test_arena_vectors(void);
+extern void test_slab_alloc_release(void);
+
 /* From test_collection.c */
 extern void test_collection_validate_params(void);
 extern void test_collection_create_close(void);
@@ -26,6 +32,115 @@ extern void test_collection_create_invalid(void);
 extern void test_collection_get_info_invalid(void);
 extern void test_collection_long_name(void);
 
+/* From test_distance.c */
+extern void test_distance_known_values(void);
+extern void test_distance_isa_agreement(void);
+extern void test_distance_batch(void);
+extern void test_distance_tile(void);
+extern void test_distance_half_convert(void);
+extern void test_distance_half_kernels(void);
+extern void test_distance_normalize(void);
+extern void test_distance_fixed_dims(void);
+
+/* From test_storage.c */
+extern void test_storage_append(void);
+extern void test_storage_append_batch(void);
+extern void test_storage_group_commit(void);
+extern void test_storage_group_commit_failure(void);
+extern void test_storage_reads_during_commit(void);
+extern void test_storage_open_iterate(void);
+extern void test_storage_open_trims_unrecorded_rows(void);
+extern void test_storage_wal_replay(void);
+extern void test_storage_wal_damaged_tail(void);
+extern void test_storage_checkpoint_threshold(void);
+extern void test_storage_superblock(void);
+extern void test_storage_get_upsert_delete(void);
+extern void test_storage_ids_recovery(void);
+extern void test_storage_index_snapshot(void);
+extern void test_storage_memory_usage(void);
+extern void test_storage_padded_rows(void);
+extern void test_storage_element_types(void);
+extern void test_storage_normalized(void);
+extern void test_storage_concurrent_readers(void);
+
+/* From test_search.c */
+extern void test_search_exact_matches_brute_force(void);
+extern void test_search_exact_edge_cases(void);
+extern void test_search_batch(void);
+extern void test_search_batch_edge_cases(void);
+extern void test_search_dead_rows(void);
+
+/* From test_filter.c */
+extern void test_filter_parse(void);
+extern void test_filter_exact_search(void);
+extern void test_filter_hnsw_search(void);
+
+/* From test_compact.c */
+extern void test_compact_drops_dead_rows(void);
+extern void test_compact_hnsw_remap(void);
+extern void test_compact_recovery(void);
+extern void test_compact_background(void);
+
+/* From test_hnsw.c */
+extern void test_hnsw_recall(void);
+extern void test_hnsw_persistence(void);
+extern void test_hnsw_parallel_build(void);
+extern void test_hnsw_segments(void);
+extern void test_hnsw_background_seal(void);
+extern void test_hnsw_invalid(void);
+
+/* From test_quantize.c */
+extern void test_quantize_sq8_exact_recall(void);
+extern void test_quantize_sq8_isa_agreement(void);
+extern void test_quantize_sq8_persistence(void);
+extern void test_quantize_sq8_hnsw(void);
+extern void test_quantize_pq_exact_recall(void);
+extern void test_quantize_pq_isa_agreement(void);
+extern void test_quantize_pq_persistence(void);
+extern void test_quantize_pq_hnsw(void);
+
+/* From test_import.c */
+extern void test_import_fvecs_npy(void);
+extern void test_import_fixed_errors(void);
+extern void test_import_jsonl(void);
+extern void test_import_jsonl_errors(void);
+extern void test_import_build_hnsw(void);
+
+/* From test_stats.c */
+extern void test_stats_histogram(void);
+extern void test_stats_writes(void);
+extern void test_stats_searches(void);
+extern void test_stats_index_bytes(void);
+extern void test_stats_concurrent(void);
+extern void test_stats_prometheus(void);
+
+/* From test_aio.c */
+extern void test_aio_backend_switch(void);
+extern void test_aio_uring_writes(void);
+extern void test_aio_async_append(void);
+extern void test_aio_async_group_commit(void);
+
+/* From test_diskann.c */
+extern void test_diskann_recall(void);
+extern void test_diskann_tail_and_reopen(void);
+extern void test_diskann_wide_rows(void);
+extern void test_diskann_uring(void);
+extern void test_diskann_compaction_drops(void);
+
+/* From test_cache.c */
+extern void test_cache_hits_and_invalidation(void);
+extern void test_cache_bounded(void);
+extern void test_cache_hnsw_pinned(void);
+
+/* From test_db.c */
+extern void test_db_lazy_open_and_lru(void);
+extern void test_db_memory_budget(void);
+extern void test_db_concurrent(void);
+extern void test_db_compaction(void);
+extern void test_shard_hash_scatter_gather(void);
+extern void test_shard_ivf_probe(void);
+extern void test_shard_ivf_concurrent_batches(void);
+
 /**
  * Sanity test: basic arithmetic
  */
@@ -96,6 +211,13 @@ int main(void) {
     RUN_TEST(id_validation);
     RUN_TEST(id_copy);
     
+    /* Arena tests */
+    printf("\n--- Arena Tests ---\n");
+    RUN_TEST(arena_alloc);
+    RUN_TEST(arena_mark_rewind);
+    RUN_TEST(arena_vectors);
+    RUN_TEST(slab_alloc_release);
+
     /* Collection tests */
     printf("\n--- Collection Tests ---\n");
     RUN_TEST(collection_validate_params);
@@ -104,7 +226,128 @@ int main(void) {
     RUN_TEST(collection_create_invalid);
     RUN_TEST(collection_get_info_invalid);
     RUN_TEST(collection_long_name);
+
+    /* Distance tests */
+    printf("\n--- Distance Tests ---\n");
+    RUN_TEST(distance_known_values);
+    RUN_TEST(distance_isa_agreement);
+    RUN_TEST(distance_batch);
+    RUN_TEST(distance_tile);
+    RUN_TEST(distance_half_convert);
+    RUN_TEST(distance_half_kernels);
+    RUN_TEST(distance_normalize);
+    RUN_TEST(distance_fixed_dims);
+
+    /* Storage tests */
+    printf("\n--- Storage Tests ---\n");
+    RUN_TEST(storage_append);
+    RUN_TEST(storage_append_batch);
+    RUN_TEST(storage_group_commit);
+    RUN_TEST(storage_group_commit_failure);
+    RUN_TEST(storage_reads_during_commit);
+    RUN_TEST(storage_open_iterate);
+    RUN_TEST(storage_open_trims_unrecorded_rows);
+    RUN_TEST(storage_wal_replay);
+    RUN_TEST(storage_wal_damaged_tail);
+    RUN_TEST(storage_checkpoint_threshold);
+    RUN_TEST(storage_superblock);
+    RUN_TEST(storage_get_upsert_delete);
+    RUN_TEST(storage_ids_recovery);
+    RUN_TEST(storage_index_snapshot);
+    RUN_TEST(storage_memory_usage);
+    RUN_TEST(storage_padded_rows);
+    RUN_TEST(storage_element_types);
+    RUN_TEST(storage_normalized);
+    RUN_TEST(storage_concurrent_readers);
     
+    /* Search tests */
+    printf("\n--- Search Tests ---\n");
+    RUN_TEST(search_exact_matches_brute_force);
+    RUN_TEST(search_exact_edge_cases);
+    RUN_TEST(search_batch);
+    RUN_TEST(search_batch_edge_cases);
+    RUN_TEST(search_dead_rows);
+
+    /* Filter tests */
+    printf("\n--- Filter Tests ---\n");
+    RUN_TEST(filter_parse);
+    RUN_TEST(filter_exact_search);
+    RUN_TEST(filter_hnsw_search);
+
+    /* Compaction tests */
+    printf("\n--- Compaction Tests ---\n");
+    RUN_TEST(compact_drops_dead_rows);
+    RUN_TEST(compact_hnsw_remap);
+    RUN_TEST(compact_recovery);
+    RUN_TEST(compact_background);
+
+    /* HNSW tests */
+    printf("\n--- HNSW Tests ---\n");
+    RUN_TEST(hnsw_recall);
+    RUN_TEST(hnsw_persistence);
+    RUN_TEST(hnsw_parallel_build);
+    RUN_TEST(hnsw_segments);
+    RUN_TEST(hnsw_background_seal);
+    RUN_TEST(hnsw_invalid);
+
+    /* Quantization tests */
+    printf("\n--- Quantization Tests ---\n");
+    RUN_TEST(quantize_sq8_exact_recall);
+    RUN_TEST(quantize_sq8_isa_agreement);
+    RUN_TEST(quantize_sq8_persistence);
+    RUN_TEST(quantize_sq8_hnsw);
+    RUN_TEST(quantize_pq_exact_recall);
+    RUN_TEST(quantize_pq_isa_agreement);
+    RUN_TEST(quantize_pq_persistence);
+    RUN_TEST(quantize_pq_hnsw);
+
+    /* Import tests */
+    printf("\n--- Import Tests ---\n");
+    RUN_TEST(import_fvecs_npy);
+    RUN_TEST(import_fixed_errors);
+    RUN_TEST(import_jsonl);
+    RUN_TEST(import_jsonl_errors);
+    RUN_TEST(import_build_hnsw);
+
+    /* Stats tests */
+    printf("\n--- Stats Tests ---\n");
+    RUN_TEST(stats_histogram);
+    RUN_TEST(stats_writes);
+    RUN_TEST(stats_searches);
+    RUN_TEST(stats_index_bytes);
+    RUN_TEST(stats_concurrent);
+    RUN_TEST(stats_prometheus);
+
+    /* I/O backend tests */
+    printf("\n--- I/O Backend Tests ---\n");
+    RUN_TEST(aio_backend_switch);
+    RUN_TEST(aio_uring_writes);
+    RUN_TEST(aio_async_append);
+    RUN_TEST(aio_async_group_commit);
+
+    printf("\n--- DiskANN Tests ---\n");
+    RUN_TEST(diskann_recall);
+    RUN_TEST(diskann_tail_and_reopen);
+    RUN_TEST(diskann_wide_rows);
+    RUN_TEST(diskann_uring);
+    RUN_TEST(diskann_compaction_drops);
+
+    printf("\n--- Query Cache Tests ---\n");
+    RUN_TEST(cache_hits_and_invalidation);
+    RUN_TEST(cache_bounded);
+    RUN_TEST(cache_hnsw_pinned);
+
+    printf("\n--- Database Tests ---\n");
+    RUN_TEST(db_lazy_open_and_lru);
+    RUN_TEST(db_memory_budget);
+    RUN_TEST(db_concurrent);
+    RUN_TEST(db_compaction);
+
+    printf("\n--- Shard Tests ---\n");
+    RUN_TEST(shard_hash_scatter_gather);
+    RUN_TEST(shard_ivf_probe);
+    RUN_TEST(shard_ivf_concurrent_batches);
+
     /* Print summary and exit */
     TEST_SUMMARY();
     
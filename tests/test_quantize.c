@@ -0,0 +1,354 @@
+/**
+ * test_quantize.c - Tests for SQ8 and PQ quantized search
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/distance.h"
+
+/* 64 + 8: covers the wide SIMD loop and the tails */
+#define QUANT_DIM 72
+#define QUANT_ROWS 6000
+#define QUANT_QUERIES 40
+#define QUANT_K 10
+
+/**
+ * Run the query set, writing QUANT_K rows per query into rows
+ */
+static vdb_status_t run_queries(vdb_storage_t *storage, bool hnsw, uint64_t *rows, float *distances) {
+    float qdata[QUANT_DIM];
+    vdb_vector_t query = { QUANT_DIM, qdata };
+    for (int q = 0; q < QUANT_QUERIES; q++) {
+        test_random_vector(qdata, QUANT_DIM, 500000u + (uint32_t)q);
+        vdb_search_results_t results;
+        vdb_status_t status = hnsw
+            ? vdb_storage_search_hnsw(storage, &query, QUANT_K, &results)
+            : vdb_storage_search_exact(storage, &query, QUANT_K, &results);
+        if (status != VDB_OK) {
+            return status;
+        }
+        if (results.count != QUANT_K) {
+            vdb_search_results_free(&results);
+            return VDB_ERROR_UNKNOWN;
+        }
+        for (size_t i = 0; i < results.count; i++) {
+            rows[q * QUANT_K + i] = results.hits[i].row;
+            distances[q * QUANT_K + i] = results.hits[i].distance;
+        }
+        vdb_search_results_free(&results);
+    }
+    return VDB_OK;
+}
+
+/**
+ * Fraction of truth rows found in got, per query
+ */
+static double recall(const uint64_t *truth, const uint64_t *got) {
+    size_t found = 0;
+    for (int q = 0; q < QUANT_QUERIES; q++) {
+        for (int i = 0; i < QUANT_K; i++) {
+            for (int j = 0; j < QUANT_K; j++) {
+                if (got[q * QUANT_K + i] == truth[q * QUANT_K + j]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    return (double)found / (QUANT_QUERIES * QUANT_K);
+}
+
+static uint64_t truth_rows[QUANT_QUERIES * QUANT_K];
+static float truth_dist[QUANT_QUERIES * QUANT_K];
+static uint64_t got_rows[QUANT_QUERIES * QUANT_K];
+static float got_dist[QUANT_QUERIES * QUANT_K];
+
+/**
+ * Test quantized exact search against float32 ground truth, per metric
+ */
+TEST(quantize_sq8_exact_recall) {
+    const vdb_metric_t metrics[2] = { VDB_METRIC_EUCLIDEAN, VDB_METRIC_COSINE };
+    for (int m = 0; m < 2; m++) {
+        char dir[TEST_PATH_MAX];
+        ASSERT_EQ(0, test_make_temp_dir(dir));
+
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, metrics[m], &storage));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, QUANT_ROWS / 2));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, QUANT_ROWS / 2, QUANT_ROWS / 2));
+        ASSERT_EQ(VDB_OK, run_queries(storage, false, truth_rows, truth_dist));
+
+        ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+        ASSERT_EQ(VDB_QUANTIZATION_SQ8, vdb_storage_get_quantization(storage));
+        ASSERT_EQ(VDB_OK, run_queries(storage, false, got_rows, got_dist));
+        ASSERT_TRUE(recall(truth_rows, got_rows) >= 0.95);
+
+        // re-ranked distances are the float32 ones, not approximations
+        for (int q = 0; q < QUANT_QUERIES; q++) {
+            if (got_rows[q * QUANT_K] == truth_rows[q * QUANT_K]) {
+                ASSERT_FLOAT_EQ(truth_dist[q * QUANT_K], got_dist[q * QUANT_K], 1e-6);
+            }
+        }
+
+        vdb_storage_close(&storage);
+        test_remove_dir(dir);
+    }
+}
+
+/**
+ * Every supported ISA must pick the same candidates as the scalar kernels
+ */
+static void check_isa_agreement(vdb_quantization_t mode) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, 2000));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, mode));
+
+    vdb_isa_t original = vdb_distance_get_isa();
+    ASSERT_EQ(VDB_OK, vdb_distance_set_isa(VDB_ISA_SCALAR));
+    ASSERT_EQ(VDB_OK, run_queries(storage, false, truth_rows, truth_dist));
+
+    for (int isa = VDB_ISA_SSE2; isa <= VDB_ISA_NEON; isa++) {
+        if (!vdb_distance_isa_supported((vdb_isa_t)isa)) {
+            continue;
+        }
+        ASSERT_EQ(VDB_OK, vdb_distance_set_isa((vdb_isa_t)isa));
+        ASSERT_EQ(VDB_OK, run_queries(storage, false, got_rows, got_dist));
+        // integer code scores are exact; only the float re-rank may differ in the last bits
+        for (int i = 0; i < QUANT_QUERIES * QUANT_K; i++) {
+            ASSERT_EQ(truth_rows[i], got_rows[i]);
+            ASSERT_FLOAT_EQ(truth_dist[i], got_dist[i], 1e-4);
+        }
+    }
+    ASSERT_EQ(VDB_OK, vdb_distance_set_isa(original));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the SQ8 integer dot kernels agree
+ */
+TEST(quantize_sq8_isa_agreement) {
+    check_isa_agreement(VDB_QUANTIZATION_SQ8);
+}
+
+/**
+ * Test the mode and codes survive reopen, torn codes are repaired, and
+ * turning quantization off removes the files
+ */
+TEST(quantize_sq8_persistence) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    // enabled while empty: trained on the first append
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "sq8.params"));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, 3000));
+    ASSERT_TRUE(test_file_size(dir, "coll", "sq8.params") > 0);
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 3000, 10));
+    vdb_storage_close(&storage);
+
+    long long row_bytes = 4 + QUANT_DIM;
+    ASSERT_EQ(3010 * row_bytes, test_file_size(dir, "coll", "embeddings.sq8"));
+
+    // tear the last rows off, as an unsynced write would after a crash
+    char path[TEST_PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/coll/embeddings.sq8", dir);
+    ASSERT_EQ(0, truncate(path, 2500 * row_bytes + 7));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_QUANTIZATION_SQ8, vdb_storage_get_quantization(storage));
+    ASSERT_EQ(3010 * row_bytes, test_file_size(dir, "coll", "embeddings.sq8"));
+
+    float qdata[QUANT_DIM];
+    test_random_vector(qdata, QUANT_DIM, 2999);
+    vdb_vector_t query = { QUANT_DIM, qdata };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 3, &results));
+    ASSERT_EQ(3, results.count);
+    ASSERT_STR_EQ("row-2999", results.hits[0].id);
+    ASSERT_FLOAT_EQ(0.0f, results.hits[0].distance, 1e-6);
+    vdb_search_results_free(&results);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_rerank_factor(storage, 0));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_rerank_factor(storage, 1));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_quantization(storage, (vdb_quantization_t)7));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_NONE));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "embeddings.sq8"));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "sq8.params"));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_QUANTIZATION_NONE, vdb_storage_get_quantization(storage));
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test HNSW walks the codes and re-ranks
+ */
+TEST(quantize_sq8_hnsw) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, 4000));
+    ASSERT_EQ(VDB_OK, run_queries(storage, false, truth_rows, truth_dist));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.ef_construction = 100;
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_EQ(VDB_OK, run_queries(storage, true, got_rows, got_dist));
+    ASSERT_TRUE(recall(truth_rows, got_rows) >= 0.85);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test PQ fast-scan against float32 ground truth, per metric
+ * Uniform random data is the worst case for PQ, hence the deep re-rank.
+ */
+TEST(quantize_pq_exact_recall) {
+    const vdb_metric_t metrics[2] = { VDB_METRIC_EUCLIDEAN, VDB_METRIC_COSINE };
+    for (int m = 0; m < 2; m++) {
+        char dir[TEST_PATH_MAX];
+        ASSERT_EQ(0, test_make_temp_dir(dir));
+
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, metrics[m], &storage));
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, QUANT_ROWS));
+        ASSERT_EQ(VDB_OK, run_queries(storage, false, truth_rows, truth_dist));
+
+        ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_PQ));
+        ASSERT_EQ(VDB_QUANTIZATION_PQ, vdb_storage_get_quantization(storage));
+        ASSERT_EQ(VDB_OK, vdb_storage_set_rerank_factor(storage, 32));
+        ASSERT_EQ(VDB_OK, run_queries(storage, false, got_rows, got_dist));
+        ASSERT_TRUE(recall(truth_rows, got_rows) >= 0.9);
+
+        // finer subspaces (retrained in place) need less re-ranking
+        ASSERT_EQ(VDB_OK, vdb_storage_set_pq_subspaces(storage, QUANT_DIM / 2));
+        ASSERT_EQ(VDB_OK, vdb_storage_set_rerank_factor(storage, 16));
+        ASSERT_EQ(VDB_OK, run_queries(storage, false, got_rows, got_dist));
+        ASSERT_TRUE(recall(truth_rows, got_rows) >= 0.9);
+
+        for (int q = 0; q < QUANT_QUERIES; q++) {
+            if (got_rows[q * QUANT_K] == truth_rows[q * QUANT_K]) {
+                ASSERT_FLOAT_EQ(truth_dist[q * QUANT_K], got_dist[q * QUANT_K], 1e-6);
+            }
+        }
+
+        vdb_storage_close(&storage);
+        test_remove_dir(dir);
+    }
+}
+
+/**
+ * Test the PQ block scan kernels agree
+ */
+TEST(quantize_pq_isa_agreement) {
+    check_isa_agreement(VDB_QUANTIZATION_PQ);
+}
+
+/**
+ * Test PQ blocks filled across appends, reopen with a torn last block,
+ * and switching to SQ8
+ */
+TEST(quantize_pq_persistence) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_PQ));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_rerank_factor(storage, 16));
+
+    // batches that end mid-block
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, 1000));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 1000, 7));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 1007, 50));
+    ASSERT_TRUE(test_file_size(dir, "coll", "pq.params") > 0);
+
+    // 18 subspaces pad to 20: 32 norms + 20 * 16 code bytes per block
+    long long block_bytes = 32 * 4 + 20 * 16;
+    ASSERT_EQ(((1057 + 31) / 32) * block_bytes, test_file_size(dir, "coll", "embeddings.pq"));
+
+    float qdata[QUANT_DIM];
+    vdb_vector_t query = { QUANT_DIM, qdata };
+    vdb_search_results_t results;
+    const int probes[3] = { 999, 1003, 1056 };
+    for (int i = 0; i < 3; i++) {
+        test_random_vector(qdata, QUANT_DIM, (uint32_t)probes[i]);
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 1, &results));
+        ASSERT_EQ(1, results.count);
+        ASSERT_EQ(probes[i], (int)results.hits[0].row);
+        vdb_search_results_free(&results);
+    }
+    vdb_storage_close(&storage);
+
+    // half a block torn off the end
+    char path[TEST_PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/coll/embeddings.pq", dir);
+    ASSERT_EQ(0, truncate(path, 32 * block_bytes + block_bytes / 2));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_QUANTIZATION_PQ, vdb_storage_get_quantization(storage));
+    ASSERT_EQ(((1057 + 31) / 32) * block_bytes, test_file_size(dir, "coll", "embeddings.pq"));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_rerank_factor(storage, 16));
+    test_random_vector(qdata, QUANT_DIM, 1030);
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 1, &results));
+    ASSERT_EQ(1, results.count);
+    ASSERT_STR_EQ("row-1030", results.hits[0].id);
+    ASSERT_FLOAT_EQ(0.0f, results.hits[0].distance, 1e-6);
+    vdb_search_results_free(&results);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_pq_subspaces(storage, QUANT_DIM + 1));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_pq_subspaces(storage, VDB_PQ_MAX_SUBSPACES + 1));
+
+    // straight to SQ8: the PQ files go, the SQ8 ones appear
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "embeddings.pq"));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "pq.params"));
+    ASSERT_EQ(1057 * (4 + QUANT_DIM), test_file_size(dir, "coll", "embeddings.sq8"));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_QUANTIZATION_SQ8, vdb_storage_get_quantization(storage));
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test HNSW walks the PQ codes and re-ranks
+ */
+TEST(quantize_pq_hnsw) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", QUANT_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, QUANT_DIM, 0, 4000));
+    ASSERT_EQ(VDB_OK, run_queries(storage, false, truth_rows, truth_dist));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_PQ));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_rerank_factor(storage, 16));
+    vdb_hnsw_params_t params = vdb_hnsw_params_default();
+    params.ef_construction = 100;
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, &params));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_ef_search(storage, 160));
+    ASSERT_EQ(VDB_OK, run_queries(storage, true, got_rows, got_dist));
+    ASSERT_TRUE(recall(truth_rows, got_rows) >= 0.8);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
@@ -0,0 +1,358 @@
+/**
+ * test_search.c - Tests for exact top-k search
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/distance.h"
+
+#define SEARCH_DIM 16
+
+/**
+ * Append n deterministic rows ("row-<i>") in batches
+ */
+static vdb_status_t fill_storage(vdb_storage_t *storage, int n) {
+    enum { BATCH = 1000 };
+    static float data[BATCH][SEARCH_DIM];
+    static vdb_item_t items[BATCH];
+
+    for (int first = 0; first < n; first += BATCH) {
+        int count = n - first < BATCH ? n - first : BATCH;
+        for (int i = 0; i < count; i++) {
+            memset(&items[i], 0, sizeof(items[i]));
+            snprintf(items[i].id, VDB_ID_MAX_LEN, "row-%d", first + i);
+            test_fill_vector(data[i], SEARCH_DIM, (uint32_t)(first + i) * 7919u);
+            items[i].vector.dim = SEARCH_DIM;
+            items[i].vector.data = data[i];
+        }
+        vdb_status_t status = vdb_storage_append_batch(storage, items, (size_t)count);
+        if (status != VDB_OK) {
+            return status;
+        }
+    }
+    return VDB_OK;
+}
+
+typedef struct {
+    const float *query;
+    vdb_metric_t metric;
+    float best[3];
+    uint64_t row;
+} brute_force_t;
+
+static int brute_force_min(const vdb_item_t *item, void *user_data) {
+    brute_force_t *bf = (brute_force_t*)user_data;
+    float d = vdb_distance(bf->metric, bf->query, item->vector.data, SEARCH_DIM);
+    // keep the 3 best distances, sorted
+    for (int i = 0; i < 3; i++) {
+        if (d < bf->best[i]) {
+            for (int j = 2; j > i; j--) {
+                bf->best[j] = bf->best[j - 1];
+            }
+            bf->best[i] = d;
+            break;
+        }
+    }
+    bf->row++;
+    return 0;
+}
+
+/**
+ * Test exact search matches a brute-force scan, single and multi-threaded
+ */
+TEST(search_exact_matches_brute_force) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", SEARCH_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, fill_storage(storage, 40000));
+
+    float qdata[SEARCH_DIM];
+    test_fill_vector(qdata, SEARCH_DIM, 12345);
+    vdb_vector_t query = { SEARCH_DIM, qdata };
+
+    brute_force_t bf = { qdata, VDB_METRIC_EUCLIDEAN, {INFINITY, INFINITY, INFINITY}, 0 };
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, brute_force_min, &bf));
+
+    for (uint32_t threads = 1; threads <= 4; threads += 3) {
+        ASSERT_EQ(VDB_OK, vdb_storage_set_search_threads(storage, threads));
+
+        vdb_search_results_t results;
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 10, &results));
+        ASSERT_EQ(10, results.count);
+        for (int i = 0; i < 3; i++) {
+            ASSERT_FLOAT_EQ(bf.best[i], results.hits[i].distance, 1e-5);
+        }
+        for (size_t i = 1; i < results.count; i++) {
+            ASSERT_TRUE(results.hits[i - 1].distance <= results.hits[i].distance);
+        }
+
+        // hit IDs line up with their rows
+        char expected_id[VDB_ID_MAX_LEN];
+        snprintf(expected_id, sizeof(expected_id), "row-%llu",
+                 (unsigned long long)results.hits[0].row);
+        ASSERT_STR_EQ(expected_id, results.hits[0].id);
+
+        vdb_search_results_free(&results);
+        ASSERT_NULL(results.hits);
+    }
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test edge cases: tiny collections, k > count, bad arguments
+ */
+TEST(search_exact_edge_cases) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", SEARCH_DIM, VDB_METRIC_COSINE, &storage));
+
+    float qdata[SEARCH_DIM];
+    test_fill_vector(qdata, SEARCH_DIM, 5 * 7919u);
+    vdb_vector_t query = { SEARCH_DIM, qdata };
+    vdb_search_results_t results;
+
+    // empty collection
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 5, &results));
+    ASSERT_EQ(0, results.count);
+
+    ASSERT_EQ(VDB_OK, fill_storage(storage, 7));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 50, &results));
+    ASSERT_EQ(7, results.count);
+    ASSERT_STR_EQ("row-5", results.hits[0].id); // the query is row 5
+    ASSERT_FLOAT_EQ(0.0f, results.hits[0].distance, 1e-5);
+    vdb_search_results_free(&results);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_search_exact(storage, &query, 0, &results));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_search_exact(storage, NULL, 5, &results));
+    query.dim = SEARCH_DIM - 1;
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_storage_search_exact(storage, &query, 5, &results));
+
+    vdb_search_results_free(NULL);
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Check a batch gives the same hits as searching its queries one by one
+ */
+static bool batch_matches_single(vdb_storage_t *storage, const vdb_vector_t *queries, size_t nq, uint32_t k) {
+    vdb_search_results_t *batch = (vdb_search_results_t*)calloc(nq, sizeof(vdb_search_results_t));
+    if (batch == NULL || vdb_storage_search_batch(storage, queries, nq, k, batch) != VDB_OK) {
+        free(batch);
+        return false;
+    }
+
+    bool same = true;
+    for (size_t q = 0; q < nq && same; q++) {
+        vdb_search_results_t single;
+        if (vdb_storage_search_exact(storage, &queries[q], k, &single) != VDB_OK) {
+            same = false;
+            break;
+        }
+        same = single.count == batch[q].count;
+        for (size_t i = 0; same && i < single.count; i++) {
+            same = fabsf(single.hits[i].distance - batch[q].hits[i].distance) <= 1e-5f;
+        }
+        vdb_search_results_free(&single);
+    }
+    for (size_t q = 0; q < nq; q++) {
+        vdb_search_results_free(&batch[q]);
+    }
+    free(batch);
+    return same;
+}
+
+/**
+ * Test batch search against one-at-a-time search: several passes, a
+ * short last tile, threads, dead rows and quantized codes
+ */
+TEST(search_batch) {
+    enum { NQ = 300 };
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", SEARCH_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, fill_storage(storage, 40000));
+
+    static float qdata[NQ][SEARCH_DIM];
+    vdb_vector_t queries[NQ];
+    for (int q = 0; q < NQ; q++) {
+        test_fill_vector(qdata[q], SEARCH_DIM, 500000u + (uint32_t)q * 13u);
+        queries[q].dim = SEARCH_DIM;
+        queries[q].data = qdata[q];
+    }
+    // a stored row finds itself
+    test_fill_vector(qdata[7], SEARCH_DIM, 321u * 7919u);
+
+    for (uint32_t threads = 1; threads <= 4; threads += 3) {
+        ASSERT_EQ(VDB_OK, vdb_storage_set_search_threads(storage, threads));
+        ASSERT_TRUE(batch_matches_single(storage, queries, NQ, 10));
+        ASSERT_TRUE(batch_matches_single(storage, queries, 5, 1));
+    }
+
+    vdb_search_results_t results[3];
+    ASSERT_EQ(VDB_OK, vdb_storage_search_batch(storage, queries + 6, 3, 4, results));
+    ASSERT_EQ(4, results[1].count);
+    ASSERT_FLOAT_EQ(0.0f, results[1].hits[0].distance, 1e-5);
+    for (int q = 0; q < 3; q++) {
+        vdb_search_results_free(&results[q]);
+    }
+
+    // dead rows are skipped like in a single search
+    for (int i = 0; i < 40000; i += 3) {
+        char id[VDB_ID_MAX_LEN];
+        snprintf(id, sizeof(id), "row-%d", i);
+        ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+    }
+    ASSERT_TRUE(batch_matches_single(storage, queries, 40, 10));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_batch(storage, queries + 6, 3, 4, results));
+    for (int q = 0; q < 3; q++) {
+        for (size_t i = 0; i < results[q].count; i++) {
+            ASSERT_TRUE(results[q].hits[i].row % 3 != 0);
+        }
+    }
+    for (int q = 0; q < 3; q++) {
+        vdb_search_results_free(&results[q]);
+    }
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    ASSERT_TRUE(batch_matches_single(storage, queries, 40, 10));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test batch edge cases: empty batch, empty collection, bad queries
+ */
+TEST(search_batch_edge_cases) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", SEARCH_DIM, VDB_METRIC_COSINE, &storage));
+
+    float qdata[2][SEARCH_DIM];
+    test_fill_vector(qdata[0], SEARCH_DIM, 1);
+    test_fill_vector(qdata[1], SEARCH_DIM, 2);
+    vdb_vector_t queries[2] = { { SEARCH_DIM, qdata[0] }, { SEARCH_DIM, qdata[1] } };
+    vdb_search_results_t results[2];
+
+    ASSERT_EQ(VDB_OK, vdb_storage_search_batch(storage, NULL, 0, 5, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_batch(storage, queries, 2, 5, results));
+    ASSERT_EQ(0, results[0].count);
+    ASSERT_EQ(0, results[1].count);
+
+    ASSERT_EQ(VDB_OK, fill_storage(storage, 3));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_batch(storage, queries, 2, 10, results));
+    ASSERT_EQ(3, results[0].count);
+    ASSERT_EQ(3, results[1].count);
+    vdb_search_results_free(&results[0]);
+    vdb_search_results_free(&results[1]);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_search_batch(storage, queries, 2, 0, results));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_search_batch(NULL, queries, 2, 5, results));
+    queries[1].dim = SEARCH_DIM + 1;
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_storage_search_batch(storage, queries, 2, 5, results));
+    ASSERT_NULL(results[0].hits);
+    queries[1].dim = SEARCH_DIM;
+    queries[1].data = NULL;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_search_batch(storage, queries, 2, 5, results));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/* Rows search_dead_rows deletes: a run longer than a scan block, and every 7th */
+static bool deleted_row(uint64_t row) {
+    return (row >= 1000 && row < 2000) || row % 7 == 0;
+}
+
+/* Whether every hit is live and the closest is row `self` (UINT64_MAX = none at distance 0) */
+static bool live_hits(const vdb_search_results_t *results, uint64_t self) {
+    for (size_t i = 0; i < results->count; i++) {
+        if (deleted_row(results->hits[i].row)) {
+            return false;
+        }
+    }
+    if (self == UINT64_MAX) {
+        return results->count == 0 || results->hits[0].distance > 1e-6f;
+    }
+    return results->count > 0 && results->hits[0].row == self && results->hits[0].distance < 1e-6f;
+}
+
+/**
+ * Test dead rows are skipped without a filter: exact scans over long
+ * dead runs, and HNSW over sealed segments and the memtable
+ */
+TEST(search_dead_rows) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", SEARCH_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_segment_rows(storage, 1500));
+    float data[SEARCH_DIM];
+    for (int i = 0; i < 3400; i++) { // rows 3000.. stay in the memtable
+        if (i == 3000) {
+            ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+        }
+        vdb_item_t item;
+        memset(&item, 0, sizeof(item));
+        snprintf(item.id, VDB_ID_MAX_LEN, "row-%d", i);
+        test_random_vector(data, SEARCH_DIM, (uint32_t)i);
+        item.vector.dim = SEARCH_DIM;
+        item.vector.data = data;
+        ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &item));
+    }
+    for (uint64_t row = 0; row < 3400; row++) {
+        if (deleted_row(row)) {
+            char id[VDB_ID_MAX_LEN];
+            snprintf(id, sizeof(id), "row-%llu", (unsigned long long)row);
+            ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+        }
+    }
+
+    float qdata[SEARCH_DIM];
+    vdb_vector_t query = { SEARCH_DIM, qdata };
+    const uint64_t probes[] = { 0, 1, 999, 1000, 1500, 1999, 2000, 2999, 3003, 3010, 3399 };
+    for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+        uint64_t row = probes[p];
+        uint64_t self = deleted_row(row) ? UINT64_MAX : row;
+        test_random_vector(qdata, SEARCH_DIM, (uint32_t)row);
+
+        vdb_search_results_t results;
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 20, &results));
+        ASSERT_EQ(20, results.count);
+        ASSERT_TRUE(live_hits(&results, self));
+        vdb_search_results_free(&results);
+
+        ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &query, 10, &results));
+        ASSERT_TRUE(live_hits(&results, self));
+        vdb_search_results_free(&results);
+    }
+
+    // the scan still finds the best live rows: brute force over them
+    test_random_vector(qdata, SEARCH_DIM, 12345);
+    brute_force_t bf = { qdata, VDB_METRIC_EUCLIDEAN, {INFINITY, INFINITY, INFINITY}, 0 };
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, brute_force_min, &bf));
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 3, &results));
+    ASSERT_EQ(3, results.count);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_FLOAT_EQ(bf.best[i], results.hits[i].distance, 1e-5);
+    }
+    vdb_search_results_free(&results);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
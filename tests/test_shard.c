@@ -0,0 +1,382 @@
+/**
+ * test_shard.c - Tests for sharded collections
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/shard.h"
+#include <pthread.h>
+
+#define SHARD_DIM 16
+
+/**
+ * Fill items "<prefix>-<i>" for i in [first, first + n); even rows get
+ * {"even":true}. A non-negative cluster moves every vector by +10 in
+ * that coordinate, so clusters are far apart.
+ */
+static void fill_items(vdb_item_t *items, float *data, const char *prefix, int first, int n, int cluster) {
+    for (int i = 0; i < n; i++) {
+        float *v = data + (size_t)i * SHARD_DIM;
+        memset(&items[i], 0, sizeof(vdb_item_t));
+        snprintf(items[i].id, VDB_ID_MAX_LEN, "%s-%d", prefix, first + i);
+        test_random_vector(v, SHARD_DIM, (uint32_t)(first + i + 1000 * (cluster + 1)));
+        if (cluster >= 0) {
+            v[cluster] += 10.0f;
+        }
+        items[i].vector.dim = SHARD_DIM;
+        items[i].vector.data = v;
+        items[i].metadata = (first + i) % 2 == 0 ? "{\"even\":true}" : NULL;
+    }
+}
+
+static bool same_hits(const vdb_search_results_t *a, const vdb_search_results_t *b) {
+    if (a->count != b->count) {
+        return false;
+    }
+    for (size_t i = 0; i < a->count; i++) {
+        if (strcmp(a->hits[i].id, b->hits[i].id) != 0 || fabsf(a->hits[i].distance - b->hits[i].distance) > 1e-5f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Test hash sharding over two directories gives the same results as one
+ * storage, and that writes are routed and survive a reopen
+ */
+TEST(shard_hash_scatter_gather) {
+    enum { ROWS = 2000 };
+    char dir[TEST_PATH_MAX];
+    char disk2[TEST_PATH_MAX + 8];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+    snprintf(disk2, sizeof(disk2), "%s/disk2", dir);
+
+    const char *dirs[4] = { dir, disk2, dir, disk2 };
+    vdb_shard_params_t params = vdb_shard_params_default();
+    params.shard_dirs = dirs;
+    params.threads = 3;
+    vdb_sharded_t *sharded = NULL;
+    vdb_storage_t *ref = NULL;
+    ASSERT_EQ(VDB_OK, vdb_sharded_create(dir, "coll", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &params, &sharded));
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "ref", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &ref));
+    ASSERT_EQ(4, vdb_sharded_num_shards(sharded));
+    ASSERT_NULL(vdb_sharded_shard(sharded, 4));
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS,
+              vdb_sharded_create(dir, "coll", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &params, &sharded));
+
+    vdb_item_t *items = (vdb_item_t*)malloc(ROWS * sizeof(vdb_item_t));
+    float *data = (float*)malloc((size_t)ROWS * SHARD_DIM * sizeof(float));
+    ASSERT_NOT_NULL(items);
+    ASSERT_NOT_NULL(data);
+    fill_items(items, data, "row", 0, ROWS, -1);
+    ASSERT_EQ(VDB_OK, vdb_sharded_append_batch(sharded, items, ROWS));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(ref, items, ROWS));
+    ASSERT_EQ(ROWS, vdb_sharded_count(sharded));
+    for (uint32_t i = 0; i < 4; i++) {
+        ASSERT_TRUE(vdb_storage_count(vdb_sharded_shard(sharded, i)) > ROWS / 8);
+    }
+    ASSERT_TRUE(test_file_size(disk2, "coll/shard-1", "collection.meta") > 0);
+
+    // routed writes
+    vdb_item_t item;
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_sharded_append(sharded, &items[10]));
+    ASSERT_EQ(VDB_OK, vdb_sharded_delete(sharded, "row-5"));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(ref, "row-5"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_get(sharded, "row-5", &item));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_delete(sharded, "row-5"));
+    test_random_vector(data + 10 * SHARD_DIM, SHARD_DIM, 77777);
+    ASSERT_EQ(VDB_OK, vdb_sharded_upsert(sharded, &items[10]));
+    ASSERT_EQ(VDB_OK, vdb_storage_upsert(ref, &items[10]));
+    ASSERT_EQ(VDB_OK, vdb_sharded_get(sharded, "row-10", &item));
+    ASSERT_FLOAT_EQ(data[10 * SHARD_DIM], item.vector.data[0], 0.0f);
+    vdb_storage_item_free(&item);
+
+    // exact results equal one storage's, filtered or not
+    vdb_filter_t *filter = NULL;
+    ASSERT_EQ(VDB_OK, vdb_filter_parse("even = true", &filter));
+    vdb_shard_query_t filtered = { VDB_SHARD_SEARCH_EXACT, filter, 0 };
+    float qdata[SHARD_DIM];
+    vdb_vector_t query = { SHARD_DIM, qdata };
+    for (int q = 0; q < 20; q++) {
+        test_random_vector(qdata, SHARD_DIM, (uint32_t)(90000 + q));
+        vdb_search_results_t got, want;
+        ASSERT_EQ(VDB_OK, vdb_sharded_search(sharded, &query, 10, NULL, &got));
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(ref, &query, 10, &want));
+        ASSERT_TRUE(same_hits(&want, &got));
+        vdb_search_results_free(&got);
+        vdb_search_results_free(&want);
+
+        ASSERT_EQ(VDB_OK, vdb_sharded_search(sharded, &query, 10, &filtered, &got));
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact_filtered(ref, &query, 10, filter, &want));
+        ASSERT_TRUE(same_hits(&want, &got));
+        vdb_search_results_free(&got);
+        vdb_search_results_free(&want);
+    }
+
+    // HNSW on every shard
+    for (uint32_t i = 0; i < 4; i++) {
+        ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(vdb_sharded_shard(sharded, i), NULL));
+    }
+    vdb_shard_query_t hnsw = { VDB_SHARD_SEARCH_HNSW, NULL, 0 };
+    size_t found = 0;
+    for (int q = 0; q < 20; q++) {
+        test_random_vector(qdata, SHARD_DIM, (uint32_t)(90000 + q));
+        vdb_search_results_t got, want;
+        ASSERT_EQ(VDB_OK, vdb_sharded_search(sharded, &query, 10, &hnsw, &got));
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(ref, &query, 10, &want));
+        for (size_t i = 0; i < want.count; i++) {
+            for (size_t j = 0; j < got.count; j++) {
+                found += strcmp(want.hits[i].id, got.hits[j].id) == 0;
+            }
+        }
+        vdb_search_results_free(&got);
+        vdb_search_results_free(&want);
+    }
+    ASSERT_TRUE(found >= 180); // recall@10 >= 0.9
+
+    vdb_shard_query_t diskann = { VDB_SHARD_SEARCH_DISKANN, filter, 0 };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_sharded_search(sharded, &query, 10, &diskann, &results));
+    vdb_vector_t short_query = { SHARD_DIM - 1, qdata };
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_sharded_search(sharded, &short_query, 10, NULL, &results));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_sharded_search(sharded, &query, 0, NULL, &results));
+    vdb_sharded_close(&sharded);
+    ASSERT_NULL(sharded);
+
+    // reopened, the shards come back from both directories
+    ASSERT_EQ(VDB_OK, vdb_sharded_open(dir, "coll", 2, &sharded));
+    ASSERT_EQ(ROWS + 1, vdb_sharded_count(sharded)); // the upsert's old row counts until compaction
+    ASSERT_TRUE(vdb_storage_has_hnsw(vdb_sharded_shard(sharded, 1)));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_get(sharded, "row-5", &item));
+    test_random_vector(qdata, SHARD_DIM, 4242);
+    vdb_search_results_t got, want;
+    ASSERT_EQ(VDB_OK, vdb_sharded_search(sharded, &query, 25, NULL, &got));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(ref, &query, 25, &want));
+    ASSERT_TRUE(same_hits(&want, &got));
+    vdb_search_results_free(&got);
+    vdb_search_results_free(&want);
+    vdb_sharded_close(&sharded);
+
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_open(dir, "missing", 0, &sharded));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_open(dir, "ref", 0, &sharded)); // a plain collection
+    params.num_shards = 0;
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_sharded_create(dir, "other", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &params, &sharded));
+    params = vdb_shard_params_default();
+    params.mode = VDB_SHARD_IVF; // no training vectors
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT,
+              vdb_sharded_create(dir, "other", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &params, &sharded));
+    vdb_sharded_close(&sharded);
+
+    vdb_filter_free(&filter);
+    vdb_storage_close(&ref);
+    free(items);
+    free(data);
+    test_remove_dir(dir);
+}
+
+/* Shard whose partition holds cluster c (the one holding "c<c>-0") */
+static int shard_of_cluster(vdb_sharded_t *sharded, int c) {
+    char id[32];
+    snprintf(id, sizeof(id), "c%d-0", c);
+    for (uint32_t i = 0; i < vdb_sharded_num_shards(sharded); i++) {
+        vdb_item_t item;
+        if (vdb_storage_get(vdb_sharded_shard(sharded, i), id, &item) == VDB_OK) {
+            vdb_storage_item_free(&item);
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Test IVF sharding puts each cluster in its own shard, that probing
+ * the nearest partition finds the same hits as probing all, and that
+ * IDs stay unique across shards
+ */
+TEST(shard_ivf_probe) {
+    enum { CLUSTERS = 4, PER = 250 };
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_item_t *items = (vdb_item_t*)malloc(CLUSTERS * PER * sizeof(vdb_item_t));
+    float *data = (float*)malloc((size_t)CLUSTERS * PER * SHARD_DIM * sizeof(float));
+    ASSERT_NOT_NULL(items);
+    ASSERT_NOT_NULL(data);
+    for (int c = 0; c < CLUSTERS; c++) {
+        char prefix[8];
+        snprintf(prefix, sizeof(prefix), "c%d", c);
+        fill_items(items + c * PER, data + (size_t)c * PER * SHARD_DIM, prefix, 0, PER, c);
+    }
+
+    vdb_shard_params_t params = vdb_shard_params_default();
+    params.mode = VDB_SHARD_IVF;
+    params.num_shards = CLUSTERS;
+    params.train = data;
+    params.num_train = CLUSTERS * PER;
+    vdb_sharded_t *sharded = NULL;
+    ASSERT_EQ(VDB_OK, vdb_sharded_create(dir, "coll", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &params, &sharded));
+    ASSERT_EQ(VDB_OK, vdb_sharded_append_batch(sharded, items, CLUSTERS * PER));
+
+    int owner[CLUSTERS];
+    for (int c = 0; c < CLUSTERS; c++) {
+        owner[c] = shard_of_cluster(sharded, c);
+        ASSERT_TRUE(owner[c] >= 0);
+        ASSERT_EQ(PER, vdb_storage_count(vdb_sharded_shard(sharded, (uint32_t)owner[c])));
+        for (int d = 0; d < c; d++) {
+            ASSERT_NE(owner[d], owner[c]);
+        }
+    }
+
+    // an ID is unique across shards, even when its vector routes elsewhere
+    vdb_item_t moved = items[1]; // c0-1
+    float mdata[SHARD_DIM];
+    memcpy(mdata, data + 3 * PER * SHARD_DIM, sizeof(mdata)); // near cluster 3
+    moved.vector.data = mdata;
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_sharded_append(sharded, &moved));
+    vdb_item_t twice[2] = { items[3 * PER], items[3 * PER] };
+    snprintf(twice[0].id, VDB_ID_MAX_LEN, "new-1");
+    snprintf(twice[1].id, VDB_ID_MAX_LEN, "new-1");
+    twice[1].vector.data = data; // routes to cluster 0
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_sharded_append_batch(sharded, twice, 2));
+
+    // an upsert to another partition moves the row
+    ASSERT_EQ(VDB_OK, vdb_sharded_upsert(sharded, &moved));
+    ASSERT_EQ(PER - 1, vdb_storage_live_count(vdb_sharded_shard(sharded, (uint32_t)owner[0])));
+    ASSERT_EQ(PER + 1, vdb_storage_live_count(vdb_sharded_shard(sharded, (uint32_t)owner[3])));
+    vdb_item_t item;
+    ASSERT_EQ(VDB_OK, vdb_sharded_get(sharded, "c0-1", &item));
+    ASSERT_FLOAT_EQ(mdata[3], item.vector.data[3], 0.0f);
+    vdb_storage_item_free(&item);
+    ASSERT_EQ(VDB_OK, vdb_sharded_delete(sharded, "c0-2"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_get(sharded, "c0-2", &item));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_sharded_delete(sharded, "c0-2"));
+    vdb_sharded_close(&sharded);
+
+    // the centroids persist: one probe finds what probing all does
+    ASSERT_EQ(VDB_OK, vdb_sharded_open(dir, "coll", 0, &sharded));
+    vdb_shard_query_t all = { VDB_SHARD_SEARCH_EXACT, NULL, 0 };
+    vdb_shard_query_t one = { VDB_SHARD_SEARCH_EXACT, NULL, 1 };
+    float qdata[SHARD_DIM];
+    vdb_vector_t query = { SHARD_DIM, qdata };
+    for (int c = 0; c < CLUSTERS; c++) {
+        test_random_vector(qdata, SHARD_DIM, (uint32_t)(5000 + c));
+        qdata[c] += 10.0f;
+        vdb_search_results_t probed, full;
+        ASSERT_EQ(VDB_OK, vdb_sharded_search(sharded, &query, 10, &one, &probed));
+        ASSERT_EQ(VDB_OK, vdb_sharded_search(sharded, &query, 10, &all, &full));
+        ASSERT_TRUE(same_hits(&full, &probed));
+        ASSERT_EQ(10, probed.count);
+        char prefix[8];
+        snprintf(prefix, sizeof(prefix), "c%d-", c);
+        for (size_t i = 0; i < probed.count; i++) {
+            ASSERT_TRUE(strncmp(probed.hits[i].id, prefix, strlen(prefix)) == 0 ||
+                        strcmp(probed.hits[i].id, "c0-1") == 0);
+        }
+        vdb_search_results_free(&probed);
+        vdb_search_results_free(&full);
+    }
+    ASSERT_EQ(VDB_OK, vdb_sharded_checkpoint(sharded));
+    vdb_sharded_close(&sharded);
+
+    free(items);
+    free(data);
+    test_remove_dir(dir);
+}
+
+typedef struct {
+    vdb_sharded_t *sharded;
+    int writer;
+    int won; // contested batches this writer appended
+    bool ok;
+} ivf_writer_t;
+
+enum { IVF_WRITERS = 4, IVF_BATCHES = 20, IVF_BATCH = 40 };
+
+/**
+ * Append IVF_BATCHES batches of IDs every writer also tries ("x-<b>-<i>",
+ * with this writer's vectors, so the copies route to different shards),
+ * each followed by a batch of its own IDs
+ */
+static void *ivf_writer(void *arg) {
+    ivf_writer_t *w = (ivf_writer_t*)arg;
+    vdb_item_t items[IVF_BATCH];
+    float data[IVF_BATCH * SHARD_DIM];
+    w->ok = true;
+    for (int b = 0; b < IVF_BATCHES && w->ok; b++) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "x-%d", b);
+        fill_items(items, data, prefix, 0, IVF_BATCH, w->writer);
+        vdb_status_t status = vdb_sharded_append_batch(w->sharded, items, IVF_BATCH);
+        w->won += status == VDB_OK;
+        w->ok = status == VDB_OK || status == VDB_ERROR_ALREADY_EXISTS;
+
+        snprintf(prefix, sizeof(prefix), "w%d-%d", w->writer, b);
+        fill_items(items, data, prefix, 0, IVF_BATCH, w->writer);
+        w->ok = w->ok && vdb_sharded_append_batch(w->sharded, items, IVF_BATCH) == VDB_OK;
+    }
+    return NULL;
+}
+
+/**
+ * Test concurrent IVF batches: every batch of contested IDs lands once,
+ * in one shard, and the uncontested ones all land
+ */
+TEST(shard_ivf_concurrent_batches) {
+    enum { TRAIN = 400 };
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_item_t *train_items = (vdb_item_t*)malloc(TRAIN * sizeof(vdb_item_t));
+    float *train = (float*)malloc((size_t)TRAIN * SHARD_DIM * sizeof(float));
+    ASSERT_NOT_NULL(train_items);
+    ASSERT_NOT_NULL(train);
+    for (int c = 0; c < IVF_WRITERS; c++) {
+        fill_items(train_items + c * (TRAIN / IVF_WRITERS), train + (size_t)c * (TRAIN / IVF_WRITERS) * SHARD_DIM,
+                   "t", 0, TRAIN / IVF_WRITERS, c);
+    }
+    vdb_shard_params_t params = vdb_shard_params_default();
+    params.mode = VDB_SHARD_IVF;
+    params.num_shards = IVF_WRITERS;
+    params.train = train;
+    params.num_train = TRAIN;
+    params.threads = 3;
+    vdb_sharded_t *sharded = NULL;
+    ASSERT_EQ(VDB_OK, vdb_sharded_create(dir, "coll", SHARD_DIM, VDB_METRIC_EUCLIDEAN, &params, &sharded));
+
+    pthread_t threads[IVF_WRITERS];
+    ivf_writer_t writers[IVF_WRITERS];
+    for (int t = 0; t < IVF_WRITERS; t++) {
+        writers[t] = (ivf_writer_t){ sharded, t, 0, false };
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, ivf_writer, &writers[t]));
+    }
+    int won = 0;
+    for (int t = 0; t < IVF_WRITERS; t++) {
+        pthread_join(threads[t], NULL);
+        ASSERT_TRUE(writers[t].ok);
+        won += writers[t].won;
+    }
+    ASSERT_EQ(IVF_BATCHES, won);
+    ASSERT_EQ((uint64_t)IVF_BATCHES * IVF_BATCH * (IVF_WRITERS + 1), vdb_sharded_count(sharded));
+
+    // each contested ID is in exactly one shard
+    for (int b = 0; b < IVF_BATCHES; b++) {
+        char id[32];
+        snprintf(id, sizeof(id), "x-%d-%d", b, b % IVF_BATCH);
+        int copies = 0;
+        for (uint32_t i = 0; i < IVF_WRITERS; i++) {
+            vdb_item_t item;
+            if (vdb_storage_get(vdb_sharded_shard(sharded, i), id, &item) == VDB_OK) {
+                copies++;
+                vdb_storage_item_free(&item);
+            }
+        }
+        ASSERT_EQ(1, copies);
+    }
+    vdb_sharded_close(&sharded);
+
+    free(train_items);
+    free(train);
+    test_remove_dir(dir);
+}
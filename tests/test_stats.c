@@ -0,0 +1,274 @@
+/**
+ * test_stats.c - Tests for the storage counters and histograms
+ */
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/stats.h"
+#include <pthread.h>
+
+#define STATS_DIM 16
+#define STATS_ROWS 500
+
+/**
+ * Test quantiles land on bucket bounds: one bucket per value below 8,
+ * then 8 buckets per power of two
+ */
+TEST(stats_histogram) {
+    vdb_histogram_t h;
+    memset(&h, 0, sizeof(h));
+    ASSERT_EQ(0, vdb_histogram_quantile(&h, 0.5));
+    ASSERT_FLOAT_EQ(0.0, vdb_histogram_mean(&h), 1e-9);
+
+    h.buckets[3] = 50; // value 3
+    h.buckets[16] = 49; // [16, 18)
+    h.buckets[VDB_HISTOGRAM_BUCKETS - 1] = 1; // the overflow bucket
+    h.count = 100;
+    h.sum_ns = 50 * 3 + 49 * 17 + 100000;
+    h.max_ns = 100000;
+    ASSERT_EQ(3, vdb_histogram_quantile(&h, 0.0));
+    ASSERT_EQ(3, vdb_histogram_quantile(&h, 0.5));
+    ASSERT_EQ(17, vdb_histogram_quantile(&h, 0.9));
+    ASSERT_EQ(17, vdb_histogram_quantile(&h, 0.99));
+    ASSERT_EQ(100000, vdb_histogram_quantile(&h, 1.0)); // capped at max
+    ASSERT_FLOAT_EQ((double)h.sum_ns / 100.0, vdb_histogram_mean(&h), 1e-9);
+}
+
+/**
+ * Test the write path counts rows, calls, fsyncs and bytes per file
+ */
+TEST(stats_writes) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", STATS_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(0, stats.appended_rows);
+    ASSERT_EQ(0, stats.append_latency.count);
+
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(VDB_OK, test_append_rows(storage, STATS_DIM, i, 1));
+    }
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, STATS_DIM, 10, 100));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "row-3"));
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, test_append_rows(storage, STATS_DIM, 0, 1)); // failures aren't counted
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(110, stats.appended_rows);
+    ASSERT_EQ(11, stats.append_calls);
+    ASSERT_EQ(1, stats.deletes);
+    ASSERT_EQ(12, stats.wal_fsyncs);
+    ASSERT_EQ(1, stats.checkpoints);
+    ASSERT_EQ(11, stats.append_latency.count);
+    ASSERT_EQ(12, stats.wal_fsync_latency.count);
+    ASSERT_TRUE(stats.wal_fsync_latency.max_ns > 0);
+    ASSERT_TRUE(stats.append_latency.sum_ns >= stats.append_latency.max_ns);
+    ASSERT_TRUE(vdb_histogram_quantile(&stats.append_latency, 0.5) <=
+                vdb_histogram_quantile(&stats.append_latency, 0.99));
+    ASSERT_EQ(110 * STATS_DIM * sizeof(float), stats.bytes_written.embeddings);
+    ASSERT_EQ(110 * VDB_ID_MAX_LEN, stats.bytes_written.ids);
+    ASSERT_EQ(110 * sizeof(uint32_t), stats.bytes_written.metadata); // no metadata, just lengths
+    ASSERT_EQ(0, stats.bytes_written.norms);
+    ASSERT_TRUE(stats.bytes_written.wal > stats.bytes_written.embeddings);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_reset_stats(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(0, stats.appended_rows);
+    ASSERT_EQ(0, stats.wal_fsyncs);
+    ASSERT_EQ(0, stats.bytes_written.wal);
+    ASSERT_EQ(0, stats.append_latency.count);
+    ASSERT_EQ(0, stats.append_latency.max_ns);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_get_stats(NULL, &stats));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_get_stats(storage, NULL));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_reset_stats(NULL));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test searches count themselves, the rows they score and HNSW hops
+ */
+TEST(stats_searches) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", STATS_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, STATS_DIM, 0, STATS_ROWS));
+    ASSERT_EQ(VDB_OK, vdb_storage_reset_stats(storage));
+
+    float qdata[3][STATS_DIM];
+    vdb_vector_t queries[3];
+    for (int q = 0; q < 3; q++) {
+        test_random_vector(qdata[q], STATS_DIM, 9000u + (uint32_t)q);
+        queries[q].dim = STATS_DIM;
+        queries[q].data = qdata[q];
+    }
+
+    vdb_search_results_t results[3];
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &queries[0], 10, &results[0]));
+        vdb_search_results_free(&results[0]);
+    }
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(5, stats.exact_searches);
+    ASSERT_EQ(5, stats.exact_search_latency.count);
+    ASSERT_EQ(5 * STATS_ROWS, stats.distances);
+    ASSERT_EQ(0, stats.hnsw_hops);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_search_batch(storage, queries, 3, 10, results));
+    for (int q = 0; q < 3; q++) {
+        vdb_search_results_free(&results[q]);
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(1, stats.batch_searches);
+    ASSERT_EQ(3, stats.batch_queries);
+    ASSERT_EQ(1, stats.batch_search_latency.count);
+    ASSERT_EQ(8 * STATS_ROWS, stats.distances);
+
+    // a sealed graph: hops, and far fewer distances than a scan
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_reset_stats(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_hnsw(storage, &queries[0], 10, &results[0]));
+    ASSERT_EQ(10, results[0].count);
+    vdb_search_results_free(&results[0]);
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(1, stats.hnsw_searches);
+    ASSERT_EQ(1, stats.hnsw_search_latency.count);
+    ASSERT_EQ(0, stats.exact_searches);
+    ASSERT_TRUE(stats.hnsw_hops > 0);
+    ASSERT_TRUE(stats.distances > stats.hnsw_hops);
+    ASSERT_TRUE(stats.distances < STATS_ROWS);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the index files a seal writes are counted
+ */
+TEST(stats_index_bytes) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", STATS_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, STATS_DIM, 0, STATS_ROWS));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_seal(storage));
+
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(test_file_size(dir, "coll", "hnsw-1.idx"), (long long)stats.bytes_written.index);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+typedef struct {
+    vdb_storage_t *storage;
+    int first;
+} stats_worker_t;
+
+static void *stats_worker(void *arg) {
+    stats_worker_t *w = (stats_worker_t*)arg;
+    float qdata[STATS_DIM];
+    vdb_vector_t query = { STATS_DIM, qdata };
+    for (int i = 0; i < 50; i++) {
+        if (test_append_rows(w->storage, STATS_DIM, w->first + i * 2, 2) != VDB_OK) {
+            return (void*)1;
+        }
+        test_random_vector(qdata, STATS_DIM, (uint32_t)(w->first + i));
+        vdb_search_results_t results;
+        if (vdb_storage_search_exact(w->storage, &query, 5, &results) != VDB_OK) {
+            return (void*)1;
+        }
+        vdb_search_results_free(&results);
+    }
+    return NULL;
+}
+
+/**
+ * Test nothing is lost when threads share the counters
+ */
+TEST(stats_concurrent) {
+    enum { WORKERS = 4 };
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", STATS_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 100));
+
+    pthread_t threads[WORKERS];
+    stats_worker_t workers[WORKERS];
+    for (int t = 0; t < WORKERS; t++) {
+        workers[t].storage = storage;
+        workers[t].first = t * 1000;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, stats_worker, &workers[t]));
+    }
+    for (int t = 0; t < WORKERS; t++) {
+        void *result = NULL;
+        pthread_join(threads[t], &result);
+        ASSERT_NULL(result);
+    }
+
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+    ASSERT_EQ(WORKERS * 100, stats.appended_rows);
+    ASSERT_EQ(WORKERS * 50, stats.append_calls);
+    ASSERT_EQ(WORKERS * 50, stats.append_latency.count);
+    ASSERT_EQ(WORKERS * 50, stats.exact_searches);
+    ASSERT_EQ(WORKERS * 100 * VDB_ID_MAX_LEN, stats.bytes_written.ids);
+    // group commit: fewer fsyncs than appends
+    ASSERT_TRUE(stats.wal_fsyncs >= 1 && stats.wal_fsyncs <= stats.append_calls);
+    ASSERT_EQ(stats.wal_fsyncs, stats.wal_fsync_latency.count);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the Prometheus text export
+ */
+TEST(stats_prometheus) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", STATS_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, test_append_rows(storage, STATS_DIM, 0, 3));
+    vdb_stats_t stats;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_stats(storage, &stats));
+
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    ASSERT_NOT_NULL(out);
+    ASSERT_EQ(VDB_OK, vdb_stats_write_prometheus(&stats, "co\"ll", out));
+    fclose(out);
+
+    ASSERT_NOT_NULL(strstr(text, "# TYPE vdb_appended_rows_total counter\n"));
+    ASSERT_NOT_NULL(strstr(text, "vdb_appended_rows_total{collection=\"co\\\"ll\"} 3\n"));
+    ASSERT_NOT_NULL(strstr(text, "vdb_wal_fsyncs_total{collection=\"co\\\"ll\"} 1\n"));
+    ASSERT_NOT_NULL(strstr(text, "vdb_bytes_written_total{collection=\"co\\\"ll\",file=\"ids\"} 192\n"));
+    ASSERT_NOT_NULL(strstr(text, "# TYPE vdb_search_latency_seconds summary\n"));
+    ASSERT_NOT_NULL(strstr(text, "vdb_append_latency_seconds{collection=\"co\\\"ll\",quantile=\"0.99\"} "));
+    ASSERT_NOT_NULL(strstr(text, "vdb_append_latency_seconds_count{collection=\"co\\\"ll\"} 1\n"));
+    ASSERT_NOT_NULL(strstr(text,
+        "vdb_search_latency_seconds_count{collection=\"co\\\"ll\",kind=\"hnsw\"} 0\n"));
+    free(text);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_stats_write_prometheus(NULL, "coll", stdout));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_stats_write_prometheus(&stats, NULL, stdout));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
@@ -0,0 +1,1564 @@
+/**
+ * test_storage.c - Tests for persistent storage
+ */
+
+#define _DEFAULT_SOURCE // syscall()
+
+#include "test_framework.h"
+#include "test_util.h"
+#include "vdb/storage.h"
+#include "vdb/distance.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define TEST_DIM 8
+
+/* Set to make every fsync in the process fail, as a dying disk would */
+static atomic_bool fail_fsync;
+/* Set to make every fsync take this long, as a busy disk would */
+static atomic_int fsync_delay_ms;
+static atomic_int fsyncs_running;
+
+/**
+ * fsync stand-in for the whole test binary (it takes the place of the
+ * libc one at link time): the real thing unless fail_fsync or
+ * fsync_delay_ms is set
+ */
+int fsync(int fd) {
+    if (atomic_load(&fail_fsync)) {
+        errno = EIO;
+        return -1;
+    }
+    atomic_fetch_add(&fsyncs_running, 1);
+    int delay_ms = atomic_load(&fsync_delay_ms);
+    if (delay_ms > 0) {
+        struct timespec pause = { delay_ms / 1000, (long)(delay_ms % 1000) * 1000000L };
+        nanosleep(&pause, NULL);
+    }
+    int rc = (int)syscall(SYS_fsync, fd);
+    atomic_fetch_sub(&fsyncs_running, 1);
+    return rc;
+}
+
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1e3 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/**
+ * Test single appends land in every segment
+ */
+TEST(storage_append) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    vdb_status_t status = vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage);
+    ASSERT_EQ(VDB_OK, status);
+    ASSERT_NOT_NULL(storage);
+
+    float data[TEST_DIM];
+    test_fill_vector(data, TEST_DIM, 1);
+    vdb_item_t item = { .id = "a", .vector = { TEST_DIM, data }, .metadata = "{\"k\":1}" };
+    ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &item));
+    ASSERT_EQ(1, vdb_storage_count(storage));
+
+    // dimension mismatch is rejected
+    item.vector.dim = TEST_DIM - 1;
+    ASSERT_EQ(VDB_ERROR_DIMENSION_MISMATCH, vdb_storage_append(storage, &item));
+    ASSERT_EQ(1, vdb_storage_count(storage));
+
+    ASSERT_EQ(TEST_DIM * sizeof(float), test_file_size(dir, "coll", "embeddings.seg"));
+    ASSERT_EQ(VDB_ID_MAX_LEN, test_file_size(dir, "coll", "ids.seg"));
+    ASSERT_EQ(sizeof(uint32_t) + 7, test_file_size(dir, "coll", "metadata.seg"));
+
+    // the record stays in the WAL until a checkpoint
+    ASSERT_TRUE(test_file_size(dir, "coll", "wal.log") > 0);
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(0, test_file_size(dir, "coll", "wal.log"));
+
+    vdb_storage_close(&storage);
+    ASSERT_NULL(storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test batch append writes all items and validates before writing
+ */
+TEST(storage_append_batch) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+
+    enum { N = 10 };
+    float data[N][TEST_DIM];
+    vdb_item_t items[N];
+    memset(items, 0, sizeof(items));
+    for (int i = 0; i < N; i++) {
+        test_fill_vector(data[i], TEST_DIM, (uint32_t)i);
+        snprintf(items[i].id, VDB_ID_MAX_LEN, "id-%d", i);
+        items[i].vector.dim = TEST_DIM;
+        items[i].vector.data = data[i];
+        items[i].metadata = NULL;
+    }
+
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, N));
+    ASSERT_EQ(N, vdb_storage_count(storage));
+    ASSERT_EQ(N * TEST_DIM * sizeof(float), test_file_size(dir, "coll", "embeddings.seg"));
+    ASSERT_EQ(N * VDB_ID_MAX_LEN, test_file_size(dir, "coll", "ids.seg"));
+    ASSERT_EQ(N * sizeof(uint32_t), test_file_size(dir, "coll", "metadata.seg"));
+    ASSERT_TRUE(test_file_size(dir, "coll", "wal.log") > 0);
+
+    // one bad item rejects the whole batch
+    items[N - 1].id[0] = '\0';
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_append_batch(storage, items, N));
+    ASSERT_EQ(N, vdb_storage_count(storage));
+    ASSERT_EQ(N * VDB_ID_MAX_LEN, test_file_size(dir, "coll", "ids.seg"));
+
+    // empty batch is a no-op
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, NULL, 0));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_append_batch(NULL, items, 1));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+typedef struct {
+    vdb_storage_t *storage;
+    int thread_index;
+    int appends;
+    vdb_status_t status;
+} group_commit_worker_t;
+
+static void *group_commit_worker(void *arg) {
+    group_commit_worker_t *w = (group_commit_worker_t*)arg;
+    float data[TEST_DIM];
+    w->status = VDB_OK;
+    for (int i = 0; i < w->appends && w->status == VDB_OK; i++) {
+        vdb_item_t item;
+        memset(&item, 0, sizeof(item));
+        snprintf(item.id, VDB_ID_MAX_LEN, "t%d-%d", w->thread_index, i);
+        test_fill_vector(data, TEST_DIM, (uint32_t)i);
+        item.vector.dim = TEST_DIM;
+        item.vector.data = data;
+        w->status = vdb_storage_append(w->storage, &item);
+    }
+    return NULL;
+}
+
+/**
+ * Test concurrent appends under group commit are all durable
+ */
+TEST(storage_group_commit) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 500));
+
+    enum { THREADS = 4, APPENDS = 25 };
+    pthread_t threads[THREADS];
+    group_commit_worker_t workers[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        workers[t].storage = storage;
+        workers[t].thread_index = t;
+        workers[t].appends = APPENDS;
+        pthread_create(&threads[t], NULL, group_commit_worker, &workers[t]);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        ASSERT_EQ(VDB_OK, workers[t].status);
+    }
+
+    ASSERT_EQ(THREADS * APPENDS, vdb_storage_count(storage));
+    ASSERT_EQ(THREADS * APPENDS * VDB_ID_MAX_LEN, test_file_size(dir, "coll", "ids.seg"));
+
+    // disabling flushes and falls back to synchronous commits
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 0));
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(0, test_file_size(dir, "coll", "wal.log"));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+static vdb_status_t append_one(vdb_storage_t *storage, const char *id, uint32_t seed) {
+    float data[TEST_DIM];
+    vdb_item_t item;
+    memset(&item, 0, sizeof(item));
+    snprintf(item.id, VDB_ID_MAX_LEN, "%s", id);
+    test_random_vector(data, TEST_DIM, seed);
+    item.vector.dim = TEST_DIM;
+    item.vector.data = data;
+    return vdb_storage_append(storage, &item);
+}
+
+/**
+ * Test a failed group commit: the append it covered errors out and is
+ * never published, the handle refuses writes from then on, and reopening
+ * replays whatever reached the WAL
+ */
+TEST(storage_group_commit_failure) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    for (int i = 0; i < 10; i++) {
+        char id[VDB_ID_MAX_LEN];
+        snprintf(id, sizeof(id), "kept-%d", i);
+        ASSERT_EQ(VDB_OK, append_one(storage, id, (uint32_t)i));
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 100));
+
+    atomic_store(&fail_fsync, true);
+    ASSERT_EQ(VDB_ERROR_IO, append_one(storage, "lost", 100));
+    atomic_store(&fail_fsync, false);
+
+    // not visible: neither counted, found by ID nor searched
+    ASSERT_EQ(10, vdb_storage_count(storage));
+    vdb_item_t item;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "lost", &item));
+    float data[TEST_DIM];
+    test_random_vector(data, TEST_DIM, 100);
+    vdb_vector_t query = { TEST_DIM, data };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 11, &results));
+    ASSERT_EQ(10, results.count);
+    vdb_search_results_free(&results);
+
+    // the rows written before stay readable; nothing can be written
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "kept-3", &item));
+    vdb_storage_item_free(&item);
+    ASSERT_EQ(VDB_ERROR_IO, append_one(storage, "after", 101));
+    ASSERT_EQ(VDB_ERROR_IO, vdb_storage_delete(storage, "kept-0"));
+    ASSERT_EQ(VDB_ERROR_IO, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(VDB_ERROR_IO, vdb_storage_set_group_commit(storage, 0));
+    ASSERT_EQ(VDB_ERROR_IO, append_one(storage, "after", 101));
+    vdb_storage_close(&storage);
+
+    // the frame got as far as the page cache, so replay brings the row back
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(11, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "lost", &item));
+    ASSERT_EQ(0, memcmp(data, item.vector.data, sizeof(data)));
+    vdb_storage_item_free(&item);
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "after", &item));
+    ASSERT_EQ(VDB_OK, append_one(storage, "after", 101));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+typedef struct {
+    vdb_storage_t *storage;
+    vdb_status_t status;
+} slow_append_t;
+
+static void *slow_append(void *arg) {
+    slow_append_t *a = (slow_append_t*)arg;
+    a->status = append_one(a->storage, "slow", 200);
+    return NULL;
+}
+
+/**
+ * Test reads don't wait out the group committer's fsync: while it
+ * syncs, counts, gets and searches answer from the published rows
+ */
+TEST(storage_reads_during_commit) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    for (int i = 0; i < 10; i++) {
+        char id[VDB_ID_MAX_LEN];
+        snprintf(id, sizeof(id), "kept-%d", i);
+        ASSERT_EQ(VDB_OK, append_one(storage, id, (uint32_t)i));
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_set_group_commit(storage, 100));
+
+    atomic_store(&fsync_delay_ms, 500);
+    slow_append_t a = { storage, VDB_ERROR_UNKNOWN };
+    pthread_t thread;
+    pthread_create(&thread, NULL, slow_append, &a);
+    while (atomic_load(&fsyncs_running) == 0) {
+        struct timespec pause = { 0, 100 * 1000 };
+        nanosleep(&pause, NULL);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ASSERT_EQ(10, vdb_storage_count(storage));
+    ASSERT_EQ(10, vdb_storage_live_count(storage));
+    vdb_item_t item;
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "kept-3", &item));
+    vdb_storage_item_free(&item);
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "slow", &item));
+    float data[TEST_DIM];
+    test_random_vector(data, TEST_DIM, 3);
+    vdb_vector_t query = { TEST_DIM, data };
+    vdb_search_results_t results;
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 1, &results));
+    ASSERT_STR_EQ("kept-3", results.hits[0].id);
+    vdb_search_results_free(&results);
+    ASSERT_TRUE(elapsed_ms(&start) < 250.0);
+    ASSERT_EQ(1, atomic_load(&fsyncs_running)); // still syncing
+
+    pthread_join(thread, NULL);
+    atomic_store(&fsync_delay_ms, 0);
+    ASSERT_EQ(VDB_OK, a.status);
+    ASSERT_EQ(11, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "slow", &item));
+    vdb_storage_item_free(&item);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+typedef struct {
+    int seen;
+    int stop_after;
+    int mismatches;
+} iterate_check_t;
+
+static int iterate_check(const vdb_item_t *item, void *user_data) {
+    iterate_check_t *check = (iterate_check_t*)user_data;
+    char expected_id[VDB_ID_MAX_LEN];
+    float expected[TEST_DIM];
+    snprintf(expected_id, sizeof(expected_id), "id-%d", check->seen);
+    test_fill_vector(expected, TEST_DIM, (uint32_t)check->seen);
+
+    if (strcmp(expected_id, item->id) != 0 || item->vector.dim != TEST_DIM ||
+        memcmp(expected, item->vector.data, sizeof(expected)) != 0) {
+        check->mismatches++;
+    }
+    // every even row carries metadata
+    if ((check->seen % 2 == 0) != (item->metadata != NULL)) {
+        check->mismatches++;
+    } else if (item->metadata != NULL && strcmp(item->metadata, "{\"even\":true}") != 0) {
+        check->mismatches++;
+    }
+
+    check->seen++;
+    return check->stop_after > 0 && check->seen >= check->stop_after;
+}
+
+static vdb_status_t append_numbered(vdb_storage_t *storage, int first, int n) {
+    vdb_status_t status = VDB_OK;
+    for (int i = first; i < first + n && status == VDB_OK; i++) {
+        float data[TEST_DIM];
+        vdb_item_t item;
+        memset(&item, 0, sizeof(item));
+        snprintf(item.id, VDB_ID_MAX_LEN, "id-%d", i);
+        test_fill_vector(data, TEST_DIM, (uint32_t)i);
+        item.vector.dim = TEST_DIM;
+        item.vector.data = data;
+        item.metadata = (i % 2 == 0) ? "{\"even\":true}" : NULL;
+        status = vdb_storage_append(storage, &item);
+    }
+    return status;
+}
+
+/**
+ * Test reopen + iterate returns everything through the mmap read path
+ */
+TEST(storage_open_iterate) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 20));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(20, vdb_storage_count(storage));
+
+    vdb_collection_info_t info;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_info(storage, &info));
+    ASSERT_STR_EQ("coll", info.name);
+    ASSERT_EQ(TEST_DIM, info.dim);
+    ASSERT_EQ(VDB_METRIC_COSINE, info.metric);
+
+    iterate_check_t check = {0, 0, 0};
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(20, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+
+    // appends after open are visible without reopening (mapping grows)
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 20, 300));
+    ASSERT_EQ(VDB_OK, vdb_storage_advise(storage, VDB_ACCESS_WILLNEED));
+    check.seen = 0;
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(320, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+
+    // callback can stop early
+    check.seen = 0;
+    check.stop_after = 5;
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(5, check.seen);
+
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_iterate(storage, NULL, NULL));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_advise(storage, (vdb_access_hint_t)42));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test rows written past the recorded count are cut off on open
+ */
+TEST(storage_open_trims_unrecorded_rows) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 4));
+    vdb_storage_close(&storage);
+
+    // simulate a crash: segments hold 4 rows but the meta says 2
+    char path[TEST_PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/coll/collection.meta", dir);
+    FILE *fp = fopen(path, "w");
+    ASSERT_NOT_NULL(fp);
+    fprintf(fp, "dimension=%d\nmetric=0\ncount=2\n", TEST_DIM);
+    fclose(fp);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(2, vdb_storage_count(storage));
+    ASSERT_EQ(2 * VDB_ID_MAX_LEN, test_file_size(dir, "coll", "ids.seg"));
+
+    // next append lines up in every segment again
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 2, 1));
+    iterate_check_t check = {0, 0, 0};
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(3, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Overwrite or cut a file inside a collection directory
+ * offset < 0 truncates the file to its size + offset instead.
+ */
+static int damage_file(const char *base_dir, const char *name, const char *filename,
+                       long long offset) {
+    char path[TEST_PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/%s/%s", base_dir, name, filename);
+    if (offset < 0) {
+        return truncate(path, test_file_size(base_dir, name, filename) + offset);
+    }
+    FILE *fp = fopen(path, "r+b");
+    if (fp == NULL) {
+        return -1;
+    }
+    int byte = 0;
+    if (fseek(fp, offset, SEEK_SET) != 0 || (byte = fgetc(fp)) == EOF ||
+        fseek(fp, offset, SEEK_SET) != 0 || fputc(byte ^ 0xff, fp) == EOF) {
+        fclose(fp);
+        return -1;
+    }
+    return fclose(fp);
+}
+
+/**
+ * Snapshot an open collection as "<name>" under dir, as a crash would leave it
+ */
+static int crash_copy(const char *dir, const char *name) {
+    char src[TEST_PATH_MAX + 64];
+    char dst[TEST_PATH_MAX + 64];
+    snprintf(src, sizeof(src), "%s/coll", dir);
+    snprintf(dst, sizeof(dst), "%s/%s", dir, name);
+    return test_copy_dir(src, dst);
+}
+
+/**
+ * Test rows the segments lost are rebuilt from the WAL on open
+ */
+TEST(storage_wal_replay) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 10));
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 10, 15));
+    ASSERT_EQ(0, crash_copy(dir, "crashed"));
+    vdb_storage_close(&storage);
+
+    // segments never made it past the checkpoint, only the WAL did
+    ASSERT_EQ(0, damage_file(dir, "crashed", "ids.seg", -15 * VDB_ID_MAX_LEN));
+    ASSERT_EQ(0, damage_file(dir, "crashed", "embeddings.seg", -7 * TEST_DIM * (long long)sizeof(float)));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(25, vdb_storage_count(storage));
+    ASSERT_EQ(0, test_file_size(dir, "crashed", "wal.log"));
+    iterate_check_t check = {0, 0, 0};
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(25, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+
+    // appends continue on top of the replayed rows
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 25, 5));
+    vdb_storage_close(&storage);
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(30, vdb_storage_count(storage));
+    check.seen = 0;
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(30, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test replay stops at a torn or corrupted frame
+ */
+TEST(storage_wal_damaged_tail) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    long long frame_end[6]; // every append is one frame
+    for (int i = 0; i < 6; i++) {
+        ASSERT_EQ(VDB_OK, append_numbered(storage, i, 1));
+        frame_end[i] = test_file_size(dir, "coll", "wal.log");
+    }
+    ASSERT_EQ(0, crash_copy(dir, "torn"));
+    ASSERT_EQ(0, crash_copy(dir, "flipped"));
+    vdb_storage_close(&storage);
+
+    const char *segments[] = { "ids.seg", "embeddings.seg", "metadata.seg" };
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(0, damage_file(dir, "torn", segments[i], -test_file_size(dir, "torn", segments[i])));
+        ASSERT_EQ(0, damage_file(dir, "flipped", segments[i], -test_file_size(dir, "flipped", segments[i])));
+    }
+
+    // half of the last frame reached the disk
+    ASSERT_EQ(0, damage_file(dir, "torn", "wal.log", -(frame_end[5] - frame_end[4]) / 2));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "torn", &storage));
+    ASSERT_EQ(5, vdb_storage_count(storage));
+    iterate_check_t check = {0, 0, 0};
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(5, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+    vdb_storage_close(&storage);
+
+    // a bad byte inside the fourth frame drops it and everything after
+    ASSERT_EQ(0, damage_file(dir, "flipped", "wal.log", frame_end[3] - 2));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "flipped", &storage));
+    ASSERT_EQ(3, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 3, 1));
+    check.seen = 0;
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(4, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test checkpoints fire once the WAL passes checkpoint_bytes
+ */
+TEST(storage_checkpoint_threshold) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 2));
+    long long wal_size = test_file_size(dir, "coll", "wal.log");
+
+    // the third frame takes the WAL past the threshold
+    ASSERT_EQ(VDB_OK, vdb_storage_set_checkpoint_bytes(storage, (uint64_t)wal_size + 1));
+    ASSERT_EQ(wal_size, test_file_size(dir, "coll", "wal.log"));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 2, 1));
+    ASSERT_EQ(0, test_file_size(dir, "coll", "wal.log"));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 3, 1));
+    long long frame = test_file_size(dir, "coll", "wal.log");
+    ASSERT_TRUE(frame > 0);
+
+    // the checkpoint recorded its rows in the meta; the WAL covers the rest
+    ASSERT_EQ(0, crash_copy(dir, "copy"));
+    vdb_storage_close(&storage);
+    ASSERT_EQ(0, damage_file(dir, "copy", "wal.log", -frame));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "copy", &storage));
+    ASSERT_EQ(3, vdb_storage_count(storage));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test the binary superblock: written at checkpoints, checksummed, holds
+ * the committed metadata.seg length, and the old text collection.meta
+ * still opens
+ */
+TEST(storage_superblock) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(256, test_file_size(dir, "coll", "collection.meta"));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 3));
+    vdb_storage_close(&storage);
+    ASSERT_EQ(256, test_file_size(dir, "coll", "collection.meta"));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "collection.meta.tmp"));
+
+    // the superblock records where the last row ends in metadata.seg,
+    // and open cuts anything past it
+    long long metadata_bytes = test_file_size(dir, "coll", "metadata.seg");
+    uint8_t sb[256];
+    char path[TEST_PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/coll/collection.meta", dir);
+    FILE *fp = fopen(path, "rb");
+    ASSERT_NOT_NULL(fp);
+    ASSERT_EQ(256, fread(sb, 1, sizeof(sb), fp));
+    fclose(fp);
+    uint64_t recorded = 0;
+    for (int i = 7; i >= 0; i--) {
+        recorded = (recorded << 8) | sb[56 + i];
+    }
+    ASSERT_EQ((uint64_t)metadata_bytes, recorded);
+    snprintf(path, sizeof(path), "%s/coll/metadata.seg", dir);
+    fp = fopen(path, "ab");
+    ASSERT_NOT_NULL(fp);
+    fputs("torn tail", fp);
+    fclose(fp);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(3, vdb_storage_count(storage));
+    ASSERT_EQ(metadata_bytes, test_file_size(dir, "coll", "metadata.seg"));
+    vdb_collection_info_t info;
+    ASSERT_EQ(VDB_OK, vdb_storage_get_info(storage, &info));
+    ASSERT_EQ(TEST_DIM, info.dim);
+    ASSERT_EQ(VDB_METRIC_EUCLIDEAN, info.metric);
+    vdb_storage_close(&storage);
+
+    // any damaged byte fails the checksum
+    ASSERT_EQ(0, crash_copy(dir, "flipped"));
+    ASSERT_EQ(0, damage_file(dir, "flipped", "collection.meta", 33));
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_open(dir, "flipped", &storage));
+    ASSERT_EQ(0, crash_copy(dir, "short"));
+    ASSERT_EQ(0, damage_file(dir, "short", "collection.meta", -1));
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_open(dir, "short", &storage));
+
+    // text meta from older versions is upgraded at the next checkpoint
+    snprintf(path, sizeof(path), "%s/coll/collection.meta", dir);
+    fp = fopen(path, "w");
+    ASSERT_NOT_NULL(fp);
+    fprintf(fp, "dimension=%d\nmetric=1\ncount=3\nquantization=0\n", TEST_DIM);
+    fclose(fp);
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(3, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 3, 1));
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(256, test_file_size(dir, "coll", "collection.meta"));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(4, vdb_storage_count(storage));
+    iterate_check_t check = {0, 0, 0};
+    ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, iterate_check, &check));
+    ASSERT_EQ(4, check.seen);
+    ASSERT_EQ(0, check.mismatches);
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Check get(id) returns the vector test_fill_vector(seed) and metadata
+ */
+static bool get_matches(vdb_storage_t *storage, const char *id, uint32_t seed, const char *metadata) {
+    vdb_item_t item;
+    if (vdb_storage_get(storage, id, &item) != VDB_OK) {
+        return false;
+    }
+    float expected[TEST_DIM];
+    test_fill_vector(expected, TEST_DIM, seed);
+    bool ok = strcmp(item.id, id) == 0 && item.vector.dim == TEST_DIM &&
+              memcmp(item.vector.data, expected, sizeof(expected)) == 0 &&
+              (metadata == NULL ? item.metadata == NULL
+                                : item.metadata != NULL && strcmp(item.metadata, metadata) == 0);
+    vdb_storage_item_free(&item);
+    return ok;
+}
+
+/**
+ * Test point get, duplicate IDs, upsert and delete, across reopen
+ */
+TEST(storage_get_upsert_delete) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 3000));
+    ASSERT_TRUE(get_matches(storage, "id-0", 0, "{\"even\":true}"));
+    ASSERT_TRUE(get_matches(storage, "id-2999", 2999, NULL));
+
+    vdb_item_t item;
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "missing", &item));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_get(storage, "", &item));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_get(storage, NULL, &item));
+
+    // IDs are unique: stored ones and repeats in a batch are refused
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, append_numbered(storage, 5, 1));
+    float data[2][TEST_DIM];
+    test_fill_vector(data[0], TEST_DIM, 7000);
+    test_fill_vector(data[1], TEST_DIM, 7001);
+    vdb_item_t batch[2] = {
+        { "dup", { TEST_DIM, data[0] }, NULL },
+        { "dup", { TEST_DIM, data[1] }, "{\"v\":2}" },
+    };
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, vdb_storage_append_batch(storage, batch, 2));
+    ASSERT_EQ(3000, vdb_storage_count(storage));
+
+    // upserts move the ID to the new row; the last one in a batch wins
+    ASSERT_EQ(VDB_OK, vdb_storage_upsert_batch(storage, batch, 2));
+    ASSERT_TRUE(get_matches(storage, "dup", 7001, "{\"v\":2}"));
+    vdb_item_t replaced = { "id-7", { TEST_DIM, data[0] }, "{\"new\":1}" };
+    ASSERT_EQ(VDB_OK, vdb_storage_upsert(storage, &replaced));
+    ASSERT_TRUE(get_matches(storage, "id-7", 7000, "{\"new\":1}"));
+    ASSERT_EQ(3003, vdb_storage_count(storage));
+
+    // deletes hide the ID; it can be stored again afterwards
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "id-10"));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "id-7"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_delete(storage, "id-10"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_delete(storage, "missing"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "id-10", &item));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "id-7", &item));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 10, 1));
+    ASSERT_TRUE(get_matches(storage, "id-10", 10, "{\"even\":true}"));
+
+    // everything survives close/open through ids.idx
+    vdb_storage_close(&storage);
+    ASSERT_TRUE(test_file_size(dir, "coll", "ids.idx") > 0);
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_TRUE(get_matches(storage, "dup", 7001, "{\"v\":2}"));
+    ASSERT_TRUE(get_matches(storage, "id-10", 10, "{\"even\":true}"));
+    ASSERT_TRUE(get_matches(storage, "id-2998", 2998, "{\"even\":true}"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "id-7", &item));
+    ASSERT_EQ(VDB_ERROR_ALREADY_EXISTS, append_numbered(storage, 11, 1));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 3000, 10));
+    ASSERT_TRUE(get_matches(storage, "id-3009", 3009, NULL));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
+
+/**
+ * Test deletes are replayed from the WAL, and that a lost ids.idx is
+ * rebuilt from ids.seg unless it held deletes
+ */
+TEST(storage_ids_recovery) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 20));
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(-1, test_file_size(dir, "coll", "ids.idx")); // no deletes yet
+
+    // a delete then a re-append of the same ID, both only in the WAL
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "id-3"));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "id-4"));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 4, 1));
+    ASSERT_EQ(0, crash_copy(dir, "crashed"));
+    vdb_storage_close(&storage);
+
+    vdb_item_t item;
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(21, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "id-3", &item));
+    ASSERT_TRUE(get_matches(storage, "id-4", 4, "{\"even\":true}"));
+    ASSERT_TRUE(get_matches(storage, "id-19", 19, NULL));
+    // the replay checkpoint moved the deletes into ids.idx
+    ASSERT_EQ(0, test_file_size(dir, "crashed", "wal.log"));
+    ASSERT_TRUE(test_file_size(dir, "crashed", "ids.idx") > 0);
+    vdb_storage_close(&storage);
+
+    // without deletes to lose, a damaged ids.idx is just rebuilt
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "plain", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_numbered(storage, 0, 5));
+    vdb_storage_close(&storage);
+    ASSERT_EQ(0, damage_file(dir, "plain", "ids.idx", 70));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "plain", &storage));
+    ASSERT_TRUE(get_matches(storage, "id-2", 2, "{\"even\":true}"));
+    vdb_storage_close(&storage);
+
+    // with deletes, index.snap still holds them
+    ASSERT_EQ(0, damage_file(dir, "crashed", "ids.idx", 70));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "id-3", &item));
+    vdb_storage_close(&storage);
+
+    // without it (ids.idx is still damaged), the open is refused instead
+    // of silently bringing them back
+    ASSERT_EQ(0, damage_file(dir, "crashed", "index.snap", 70));
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_open(dir, "crashed", &storage));
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Append (or upsert) rows "s-<i>" with metadata {"n": i, "tag": "even" / "odd"}
+ */
+static vdb_status_t append_tagged(vdb_storage_t *storage, int first, int n, bool upsert) {
+    vdb_status_t status = VDB_OK;
+    for (int i = first; i < first + n && status == VDB_OK; i++) {
+        float data[TEST_DIM];
+        char metadata[64];
+        vdb_item_t item;
+        memset(&item, 0, sizeof(item));
+        snprintf(item.id, VDB_ID_MAX_LEN, "s-%d", i);
+        snprintf(metadata, sizeof(metadata), "{\"n\":%d,\"tag\":\"%s\"}", i, i % 2 == 0 ? "even" : "odd");
+        test_fill_vector(data, TEST_DIM, (uint32_t)i);
+        item.vector.dim = TEST_DIM;
+        item.vector.data = data;
+        item.metadata = metadata;
+        status = upsert ? vdb_storage_upsert(storage, &item) : vdb_storage_append(storage, &item);
+    }
+    return status;
+}
+
+/* Live rows matching a filter expression, -1 on error */
+static long long count_matching(vdb_storage_t *storage, const char *expr) {
+    float qdata[TEST_DIM];
+    test_fill_vector(qdata, TEST_DIM, 1);
+    vdb_vector_t query = { TEST_DIM, qdata };
+    vdb_filter_t *filter = NULL;
+    vdb_search_results_t results;
+    uint32_t k = (uint32_t)vdb_storage_count(storage);
+    if (vdb_filter_parse(expr, &filter) != VDB_OK ||
+        vdb_storage_search_exact_filtered(storage, &query, k, filter, &results) != VDB_OK) {
+        vdb_filter_free(&filter);
+        return -1;
+    }
+    vdb_filter_free(&filter);
+    long long n = (long long)results.count;
+    vdb_search_results_free(&results);
+    return n;
+}
+
+/**
+ * Test open takes the ID and filter indexes from index.snap and indexes
+ * only what came after it, and that a snapshot that doesn't fit the
+ * rows (taken later, damaged, or from before a compaction) is dropped
+ */
+TEST(storage_index_snapshot) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    // enough rows for a sorted run and a tail in the range index
+    vdb_storage_t *storage = NULL;
+    vdb_item_t item;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, append_tagged(storage, 0, 3000, false));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "s-7"));
+    ASSERT_EQ(VDB_OK, append_tagged(storage, 8, 1, true)); // moves s-8
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_TRUE(test_file_size(dir, "coll", "index.snap") > 0);
+    ASSERT_EQ(0, crash_copy(dir, "early"));
+
+    // past the snapshot: rows and a delete only in the WAL
+    ASSERT_EQ(VDB_OK, append_tagged(storage, 3000, 500, false));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "s-9"));
+    ASSERT_EQ(0, crash_copy(dir, "crashed"));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(3501, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "s-7", &item));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "s-9", &item));
+    ASSERT_TRUE(get_matches(storage, "s-8", 8, "{\"n\":8,\"tag\":\"even\"}"));
+    ASSERT_TRUE(get_matches(storage, "s-3201", 3201, "{\"n\":3201,\"tag\":\"odd\"}"));
+    ASSERT_EQ(1750, count_matching(storage, "tag = \"even\""));
+    ASSERT_EQ(8, count_matching(storage, "n < 10"));
+    ASSERT_EQ(20, count_matching(storage, "n >= 2990 AND n < 3010"));
+    vdb_storage_close(&storage);
+
+    // a snapshot of more rows than the checkpoint recorded is dropped
+    char from[TEST_PATH_MAX + 64], to[TEST_PATH_MAX + 64];
+    snprintf(from, sizeof(from), "%s/coll/index.snap", dir);
+    snprintf(to, sizeof(to), "%s/early/index.snap", dir);
+    ASSERT_EQ(0, rename(from, to));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "early", &storage));
+    ASSERT_EQ(-1, test_file_size(dir, "early", "index.snap"));
+    ASSERT_EQ(3001, vdb_storage_count(storage));
+    ASSERT_EQ(1500, count_matching(storage, "tag = \"even\""));
+    ASSERT_EQ(0, count_matching(storage, "n >= 3001"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "s-3001", &item));
+    vdb_storage_close(&storage);
+    ASSERT_TRUE(test_file_size(dir, "early", "index.snap") > 0);
+
+    // so is a damaged one
+    ASSERT_EQ(0, damage_file(dir, "early", "index.snap", 65536 + 40));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "early", &storage));
+    ASSERT_EQ(1500, count_matching(storage, "tag = \"even\""));
+    ASSERT_EQ(9, count_matching(storage, "n < 10"));
+    vdb_storage_close(&storage);
+
+    // compaction renumbers the rows, so it goes until the next checkpoint
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ(-1, test_file_size(dir, "crashed", "index.snap"));
+    ASSERT_EQ(3498, vdb_storage_count(storage));
+    ASSERT_EQ(VDB_OK, append_tagged(storage, 3500, 2, false));
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_TRUE(test_file_size(dir, "crashed", "index.snap") > 0);
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(3500, vdb_storage_count(storage));
+    ASSERT_EQ(1751, count_matching(storage, "tag = \"even\""));
+    ASSERT_EQ(8, count_matching(storage, "n < 10"));
+    ASSERT_TRUE(get_matches(storage, "s-3000", 3000, "{\"n\":3000,\"tag\":\"even\"}"));
+    ASSERT_EQ(VDB_ERROR_NOT_FOUND, vdb_storage_get(storage, "s-7", &item));
+    vdb_storage_close(&storage);
+
+    // open doesn't read committed rows: with their length prefix
+    // garbled it still opens, and only a get of that row notices
+    ASSERT_EQ(0, damage_file(dir, "crashed", "metadata.seg", 3));
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(3500, vdb_storage_count(storage));
+    ASSERT_EQ(1751, count_matching(storage, "tag = \"even\""));
+    ASSERT_TRUE(get_matches(storage, "s-1", 1, "{\"n\":1,\"tag\":\"odd\"}"));
+    ASSERT_EQ(VDB_ERROR_CORRUPTED, vdb_storage_get(storage, "s-0", &item));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+/**
+ * Test memory usage counts the ID index, the filter postings and the
+ * quantized codes, not only graphs and caches
+ */
+TEST(storage_memory_usage) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", TEST_DIM, VDB_METRIC_COSINE, &storage));
+    size_t empty = vdb_storage_memory_usage(storage);
+
+    // 24-byte ID slots, 16-byte entries for n and a posting for tag
+    ASSERT_EQ(VDB_OK, append_tagged(storage, 0, 2000, false));
+    size_t indexed = vdb_storage_memory_usage(storage);
+    ASSERT_TRUE(indexed >= empty + 2000 * (24 + 16));
+
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    ASSERT_TRUE(vdb_storage_memory_usage(storage) >= indexed + 2000 * TEST_DIM);
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_NONE));
+    ASSERT_EQ(indexed, vdb_storage_memory_usage(storage));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+#define PADDED_DIM 20 // 80 bytes, padded to 128
+#define PADDED_ROW_BYTES 128
+
+/**
+ * Check the top exact and HNSW hit for seed's vector is its own row
+ */
+static bool padded_finds(vdb_storage_t *storage, uint32_t seed) {
+    float data[PADDED_DIM];
+    test_random_vector(data, PADDED_DIM, seed);
+    vdb_vector_t query = { PADDED_DIM, data };
+    char id[32];
+    snprintf(id, sizeof(id), "p-%u", seed);
+
+    vdb_search_results_t results;
+    if (vdb_storage_search_exact(storage, &query, 3, &results) != VDB_OK) {
+        return false;
+    }
+    bool ok = results.count == 3 && strcmp(results.hits[0].id, id) == 0 &&
+              results.hits[0].distance < 1e-4f;
+    vdb_search_results_free(&results);
+
+    if (ok && vdb_storage_has_hnsw(storage)) {
+        ok = vdb_storage_search_hnsw(storage, &query, 3, &results) == VDB_OK &&
+             results.count == 3 && strcmp(results.hits[0].id, id) == 0;
+        vdb_search_results_free(&results);
+    }
+    if (ok) {
+        ok = vdb_storage_search_batch(storage, &query, 1, 3, &results) == VDB_OK &&
+             results.count == 3 && strcmp(results.hits[0].id, id) == 0;
+        vdb_search_results_free(&results);
+    }
+
+    vdb_item_t item;
+    if (ok && vdb_storage_get(storage, id, &item) == VDB_OK) {
+        ok = item.vector.dim == PADDED_DIM && memcmp(item.vector.data, data, sizeof(data)) == 0;
+        vdb_storage_item_free(&item);
+    }
+    return ok;
+}
+
+/**
+ * Test padded rows: the layout is recorded, every row takes a whole
+ * number of cache lines, and append, replay, search and compaction
+ * all see the same vectors
+ */
+TEST(storage_padded_rows) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", PADDED_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_ROW_LAYOUT_PACKED, vdb_storage_get_row_layout(storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_row_layout(NULL, VDB_ROW_LAYOUT_PADDED));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_row_layout(storage, (vdb_row_layout_t)7));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_row_layout(storage, VDB_ROW_LAYOUT_PADDED));
+    ASSERT_EQ(VDB_ROW_LAYOUT_PADDED, vdb_storage_get_row_layout(storage));
+
+    float data[60][PADDED_DIM];
+    char ids[60][32];
+    vdb_item_t items[60];
+    for (int i = 0; i < 60; i++) {
+        test_random_vector(data[i], PADDED_DIM, (uint32_t)i);
+        snprintf(ids[i], sizeof(ids[i]), "p-%d", i);
+        items[i].vector.dim = PADDED_DIM;
+        items[i].vector.data = data[i];
+        items[i].metadata = NULL;
+        vdb_id_copy(ids[i], items[i].id);
+    }
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 40));
+    for (int i = 40; i < 50; i++) {
+        ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &items[i]));
+    }
+    ASSERT_EQ(50 * PADDED_ROW_BYTES, test_file_size(dir, "coll", "embeddings.seg"));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_row_layout(storage, VDB_ROW_LAYOUT_PACKED));
+    ASSERT_TRUE(padded_finds(storage, 0));
+    ASSERT_TRUE(padded_finds(storage, 47));
+
+    // replayed rows are padded the same way
+    ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items + 50, 10));
+    ASSERT_EQ(0, crash_copy(dir, "crashed"));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+    ASSERT_EQ(VDB_ROW_LAYOUT_PADDED, vdb_storage_get_row_layout(storage));
+    ASSERT_EQ(60, vdb_storage_count(storage));
+    ASSERT_EQ(60 * PADDED_ROW_BYTES, test_file_size(dir, "crashed", "embeddings.seg"));
+    ASSERT_TRUE(padded_finds(storage, 55));
+    vdb_storage_close(&storage);
+
+    // graphs and compaction keep to the padded stride
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_TRUE(padded_finds(storage, 12));
+    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "p-3"));
+    ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+    ASSERT_EQ(59 * PADDED_ROW_BYTES, test_file_size(dir, "coll", "embeddings.seg"));
+    ASSERT_TRUE(padded_finds(storage, 12));
+    ASSERT_TRUE(padded_finds(storage, 59));
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+    ASSERT_EQ(VDB_ROW_LAYOUT_PADDED, vdb_storage_get_row_layout(storage));
+    ASSERT_TRUE(padded_finds(storage, 30));
+    vdb_storage_close(&storage);
+
+    // rows already packed are refused
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "packed", PADDED_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &items[0]));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_row_layout(storage, VDB_ROW_LAYOUT_PADDED));
+    ASSERT_EQ(PADDED_DIM * 4, test_file_size(dir, "packed", "embeddings.seg"));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+#define HALF_DIM 24
+
+/**
+ * Check seed's vector comes back as its own top hit from every search,
+ * and get returns it rounded the way the element type rounds
+ */
+static bool half_finds(vdb_storage_t *storage, uint32_t seed) {
+    float data[HALF_DIM];
+    float rounded[HALF_DIM];
+    uint16_t half[HALF_DIM];
+    test_random_vector(data, HALF_DIM, seed);
+    vdb_element_type_t type = vdb_storage_get_element_type(storage);
+    vdb_convert_from_f32(type, data, half, HALF_DIM);
+    vdb_convert_to_f32(type, half, rounded, HALF_DIM);
+    vdb_vector_t query = { HALF_DIM, data };
+    char id[32];
+    snprintf(id, sizeof(id), "h-%u", seed);
+
+    vdb_search_results_t results;
+    if (vdb_storage_search_exact(storage, &query, 3, &results) != VDB_OK) {
+        return false;
+    }
+    bool ok = results.count == 3 && strcmp(results.hits[0].id, id) == 0 &&
+              results.hits[0].distance < 1e-2f;
+    vdb_search_results_free(&results);
+
+    if (ok && vdb_storage_has_hnsw(storage)) {
+        ok = vdb_storage_search_hnsw(storage, &query, 3, &results) == VDB_OK &&
+             results.count == 3 && strcmp(results.hits[0].id, id) == 0;
+        vdb_search_results_free(&results);
+    }
+    if (ok) {
+        ok = vdb_storage_search_batch(storage, &query, 1, 3, &results) == VDB_OK &&
+             results.count == 3 && strcmp(results.hits[0].id, id) == 0;
+        vdb_search_results_free(&results);
+    }
+
+    vdb_item_t item;
+    if (ok && vdb_storage_get(storage, id, &item) == VDB_OK) {
+        ok = item.vector.dim == HALF_DIM && memcmp(item.vector.data, rounded, sizeof(rounded)) == 0;
+        vdb_storage_item_free(&item);
+    }
+    return ok;
+}
+
+static int half_count_rows(const vdb_item_t *item, void *user_data) {
+    int *count = (int*)user_data;
+    if (item->vector.dim == HALF_DIM && isfinite(item->vector.data[0])) {
+        (*count)++;
+    }
+    return 0;
+}
+
+/**
+ * Test f16 and bf16 collections: rows take 2 bytes per dimension, the
+ * type survives replay, reopen and compaction, and it can't be mixed
+ * with quantization or set on a collection with rows
+ */
+TEST(storage_element_types) {
+    float data[60][HALF_DIM];
+    char ids[60][32];
+    vdb_item_t items[60];
+    for (int i = 0; i < 60; i++) {
+        test_random_vector(data[i], HALF_DIM, (uint32_t)i);
+        snprintf(ids[i], sizeof(ids[i]), "h-%d", i);
+        items[i].vector.dim = HALF_DIM;
+        items[i].vector.data = data[i];
+        items[i].metadata = NULL;
+        vdb_id_copy(ids[i], items[i].id);
+    }
+
+    const vdb_element_type_t types[] = {VDB_ELEMENT_F16, VDB_ELEMENT_BF16};
+    for (int t = 0; t < 2; t++) {
+        char dir[TEST_PATH_MAX];
+        ASSERT_EQ(0, test_make_temp_dir(dir));
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", HALF_DIM, VDB_METRIC_COSINE, &storage));
+        ASSERT_EQ(VDB_ELEMENT_F32, vdb_storage_get_element_type(storage));
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_element_type(NULL, types[t]));
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_element_type(storage, (vdb_element_type_t)9));
+        ASSERT_EQ(VDB_OK, vdb_storage_set_element_type(storage, types[t]));
+        ASSERT_EQ(types[t], vdb_storage_get_element_type(storage));
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+
+        ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 40));
+        for (int i = 40; i < 50; i++) {
+            ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &items[i]));
+        }
+        ASSERT_EQ(50 * HALF_DIM * 2, test_file_size(dir, "coll", "embeddings.seg"));
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_element_type(storage, VDB_ELEMENT_F32));
+        ASSERT_TRUE(half_finds(storage, 0));
+        ASSERT_TRUE(half_finds(storage, 49));
+
+        int count = 0;
+        ASSERT_EQ(VDB_OK, vdb_storage_iterate(storage, half_count_rows, &count));
+        ASSERT_EQ(50, count);
+
+        // replayed rows are narrowed the same way
+        ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+        ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items + 50, 10));
+        ASSERT_EQ(0, crash_copy(dir, "crashed"));
+        vdb_storage_close(&storage);
+
+        ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "crashed", &storage));
+        ASSERT_EQ(types[t], vdb_storage_get_element_type(storage));
+        ASSERT_EQ(60, vdb_storage_count(storage));
+        ASSERT_EQ(60 * HALF_DIM * 2, test_file_size(dir, "crashed", "embeddings.seg"));
+        ASSERT_TRUE(half_finds(storage, 57));
+        vdb_storage_close(&storage);
+
+        // graphs and compaction work on the half rows
+        ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+        ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+        ASSERT_TRUE(half_finds(storage, 12));
+        ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "h-3"));
+        ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+        ASSERT_EQ(59 * HALF_DIM * 2, test_file_size(dir, "coll", "embeddings.seg"));
+        ASSERT_TRUE(half_finds(storage, 12));
+        ASSERT_TRUE(half_finds(storage, 59));
+        vdb_storage_close(&storage);
+
+        ASSERT_EQ(VDB_OK, vdb_storage_open(dir, "coll", &storage));
+        ASSERT_EQ(types[t], vdb_storage_get_element_type(storage));
+        ASSERT_TRUE(half_finds(storage, 30));
+        vdb_storage_close(&storage);
+        test_remove_dir(dir);
+    }
+
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+
+    // padded half rows: 24 * 2 = 48 bytes, one cache line
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "padded", HALF_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_element_type(storage, VDB_ELEMENT_F16));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_row_layout(storage, VDB_ROW_LAYOUT_PADDED));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 20));
+    ASSERT_EQ(20 * VDB_ROW_ALIGN, test_file_size(dir, "padded", "embeddings.seg"));
+    ASSERT_TRUE(half_finds(storage, 7));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_TRUE(half_finds(storage, 19));
+    vdb_storage_close(&storage);
+
+    // quantized or non-empty collections keep float32
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "quant", HALF_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_element_type(storage, VDB_ELEMENT_BF16));
+    ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &items[0]));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_element_type(storage, VDB_ELEMENT_F16));
+    ASSERT_EQ(VDB_ELEMENT_F32, vdb_storage_get_element_type(storage));
+    ASSERT_EQ(HALF_DIM * 4, test_file_size(dir, "quant", "embeddings.seg"));
+    vdb_storage_close(&storage);
+
+    test_remove_dir(dir);
+}
+
+#define NORM_DIM 20
+
+/**
+ * Plain and normalized collections return the same hits, distances
+ * included, from every search path
+ */
+static bool norm_matches(vdb_storage_t *plain, vdb_storage_t *normalized, uint32_t seed) {
+    float data[NORM_DIM];
+    test_random_vector(data, NORM_DIM, seed);
+    vdb_vector_t query = { NORM_DIM, data };
+
+    vdb_search_results_t a, b;
+    bool ok = true;
+    for (int path = 0; path < 3 && ok; path++) {
+        vdb_status_t sa, sb;
+        if (path == 0) {
+            sa = vdb_storage_search_exact(plain, &query, 5, &a);
+            sb = vdb_storage_search_exact(normalized, &query, 5, &b);
+        } else if (path == 1) {
+            sa = vdb_storage_search_batch(plain, &query, 1, 5, &a);
+            sb = vdb_storage_search_batch(normalized, &query, 1, 5, &b);
+        } else {
+            if (!vdb_storage_has_hnsw(normalized)) {
+                break;
+            }
+            sa = vdb_storage_search_exact(plain, &query, 5, &a);
+            sb = vdb_storage_search_hnsw(normalized, &query, 5, &b);
+        }
+        if (sa != VDB_OK || sb != VDB_OK) {
+            return false;
+        }
+        ok = a.count == 5 && b.count == 5 && strcmp(a.hits[0].id, b.hits[0].id) == 0;
+        for (size_t i = 0; ok && i < a.count; i++) {
+            ok = fabsf(a.hits[i].distance - b.hits[i].distance) < 1e-4f;
+        }
+        vdb_search_results_free(&a);
+        vdb_search_results_free(&b);
+    }
+    return ok;
+}
+
+/**
+ * Test normalized cosine collections: searches match a plain cosine
+ * collection, get returns unit vectors (or the originals with norms
+ * kept), and the mode survives replay, compaction and reopen
+ */
+TEST(storage_normalized) {
+    float data[40][NORM_DIM];
+    char ids[40][32];
+    vdb_item_t items[40];
+    for (int i = 0; i < 40; i++) {
+        test_random_vector(data[i], NORM_DIM, (uint32_t)i);
+        for (int d = 0; d < NORM_DIM; d++) {
+            data[i][d] *= (float)(i % 7 + 1); // norms all over the place
+        }
+        snprintf(ids[i], sizeof(ids[i]), "n-%d", i);
+        items[i].vector.dim = NORM_DIM;
+        items[i].vector.data = data[i];
+        items[i].metadata = NULL;
+        vdb_id_copy(ids[i], items[i].id);
+    }
+
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+    vdb_storage_t *plain = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "plain", NORM_DIM, VDB_METRIC_COSINE, &plain));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(plain, items, 40));
+
+    const vdb_normalize_t modes[] = {VDB_NORMALIZE_UNIT, VDB_NORMALIZE_KEEP_NORMS};
+    for (int m = 0; m < 2; m++) {
+        char cdir[TEST_PATH_MAX];
+        ASSERT_EQ(0, test_make_temp_dir(cdir));
+        vdb_storage_t *storage = NULL;
+        ASSERT_EQ(VDB_OK, vdb_storage_create(cdir, "coll", NORM_DIM, VDB_METRIC_COSINE, &storage));
+        ASSERT_EQ(VDB_NORMALIZE_NONE, vdb_storage_get_normalize(storage));
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_normalize(NULL, modes[m]));
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_normalize(storage, (vdb_normalize_t)7));
+        ASSERT_EQ(VDB_OK, vdb_storage_set_normalize(storage, modes[m]));
+        ASSERT_EQ(modes[m], vdb_storage_get_normalize(storage));
+
+        ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 30));
+        ASSERT_EQ(VDB_OK, vdb_storage_checkpoint(storage));
+        for (int i = 30; i < 40; i++) {
+            ASSERT_EQ(VDB_OK, vdb_storage_append(storage, &items[i]));
+        }
+        ASSERT_TRUE(norm_matches(plain, storage, 3));
+        ASSERT_TRUE(norm_matches(plain, storage, 100));
+        long long norms = modes[m] == VDB_NORMALIZE_KEEP_NORMS ? 40 * 4 : -1;
+        ASSERT_EQ(norms, test_file_size(cdir, "coll", "norms.seg"));
+
+        vdb_item_t item;
+        ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "n-5", &item));
+        if (modes[m] == VDB_NORMALIZE_UNIT) {
+            ASSERT_FLOAT_EQ(1.0f, vdb_dot(item.vector.data, item.vector.data, NORM_DIM), 1e-5);
+        } else {
+            for (int d = 0; d < NORM_DIM; d++) {
+                ASSERT_FLOAT_EQ(data[5][d], item.vector.data[d], 1e-5);
+            }
+        }
+        vdb_storage_item_free(&item);
+        ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_normalize(storage, VDB_NORMALIZE_NONE));
+
+        // replayed rows are normalized on the way in too
+        ASSERT_EQ(0, crash_copy(cdir, "crashed"));
+        vdb_storage_close(&storage);
+
+        ASSERT_EQ(VDB_OK, vdb_storage_open(cdir, "crashed", &storage));
+        ASSERT_EQ(modes[m], vdb_storage_get_normalize(storage));
+        ASSERT_EQ(40, vdb_storage_count(storage));
+        ASSERT_TRUE(norm_matches(plain, storage, 35));
+        vdb_storage_close(&storage);
+
+        // graphs and compaction; norms.seg shrinks with the rows
+        ASSERT_EQ(VDB_OK, vdb_storage_open(cdir, "coll", &storage));
+        ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+        ASSERT_TRUE(norm_matches(plain, storage, 12));
+        ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, "n-3"));
+        ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+        norms = modes[m] == VDB_NORMALIZE_KEEP_NORMS ? 39 * 4 : -1;
+        ASSERT_EQ(norms, test_file_size(cdir, "coll", "norms.seg"));
+        ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "n-39", &item));
+        if (modes[m] == VDB_NORMALIZE_KEEP_NORMS) {
+            ASSERT_FLOAT_EQ(data[39][0], item.vector.data[0], 1e-5);
+        }
+        vdb_storage_item_free(&item);
+        vdb_storage_close(&storage);
+
+        ASSERT_EQ(VDB_OK, vdb_storage_open(cdir, "coll", &storage));
+        ASSERT_EQ(modes[m], vdb_storage_get_normalize(storage));
+        ASSERT_EQ(VDB_OK, vdb_storage_get(storage, "n-20", &item));
+        if (modes[m] == VDB_NORMALIZE_KEEP_NORMS) {
+            ASSERT_FLOAT_EQ(data[20][1], item.vector.data[1], 1e-5);
+        }
+        vdb_storage_item_free(&item);
+        vdb_storage_close(&storage);
+        test_remove_dir(cdir);
+    }
+
+    // half rows and SQ8 codes are built from the unit vectors
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "half", NORM_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_element_type(storage, VDB_ELEMENT_F16));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_normalize(storage, VDB_NORMALIZE_UNIT));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 40));
+    vdb_search_results_t results;
+    vdb_vector_t query = { NORM_DIM, data[17] };
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 3, &results));
+    ASSERT_STR_EQ("n-17", results.hits[0].id);
+    ASSERT_TRUE(results.hits[0].distance < 1e-2f);
+    vdb_search_results_free(&results);
+    vdb_storage_close(&storage);
+
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "sq8", NORM_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_normalize(storage, VDB_NORMALIZE_KEEP_NORMS));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_quantization(storage, VDB_QUANTIZATION_SQ8));
+    ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 40));
+    ASSERT_EQ(VDB_OK, vdb_storage_search_exact(storage, &query, 3, &results));
+    ASSERT_STR_EQ("n-17", results.hits[0].id);
+    vdb_search_results_free(&results);
+    vdb_storage_close(&storage);
+
+    // only empty cosine collections without a graph
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "l2", NORM_DIM, VDB_METRIC_EUCLIDEAN, &storage));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_normalize(storage, VDB_NORMALIZE_UNIT));
+    vdb_storage_close(&storage);
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_normalize(plain, VDB_NORMALIZE_UNIT));
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "graph", NORM_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_ERROR_INVALID_ARGUMENT, vdb_storage_set_normalize(storage, VDB_NORMALIZE_UNIT));
+    ASSERT_EQ(VDB_NORMALIZE_NONE, vdb_storage_get_normalize(storage));
+    vdb_storage_close(&storage);
+
+    vdb_storage_close(&plain);
+    test_remove_dir(dir);
+}
+
+#define CONC_DIM 16
+#define CONC_ROWS 600
+
+typedef struct {
+    vdb_storage_t *storage;
+    atomic_int appended; // rows whose append returned
+    atomic_bool done;
+    int failures;
+    int queries;
+} concurrent_t;
+
+/* Rows deleted (and compacted away) midway */
+static bool conc_deleted(int row) {
+    return row < 100 && row % 2 == 0;
+}
+
+static void *concurrent_reader(void *arg) {
+    concurrent_t *c = (concurrent_t*)arg;
+    uint32_t next = 1;
+    while (!atomic_load(&c->done)) {
+        // gaps between reads, or the compaction swap waits for long
+        struct timespec pause = { 0, 200 * 1000 };
+        nanosleep(&pause, NULL);
+        int appended = atomic_load(&c->appended);
+        if (appended == 0) {
+            continue;
+        }
+        next = next * 1103515245u + 12345u;
+        int row = (int)((next >> 8) % (uint32_t)appended);
+        if (conc_deleted(row)) {
+            row++;
+        }
+
+        float data[CONC_DIM];
+        test_random_vector(data, CONC_DIM, (uint32_t)row);
+        vdb_vector_t query = { CONC_DIM, data };
+        char id[32];
+        snprintf(id, sizeof(id), "c-%d", row);
+
+        vdb_search_results_t results;
+        if (vdb_storage_search_exact(c->storage, &query, 1, &results) != VDB_OK ||
+            results.count != 1 || strcmp(results.hits[0].id, id) != 0) {
+            c->failures++;
+        }
+        vdb_search_results_free(&results);
+        if (vdb_storage_search_hnsw(c->storage, &query, 3, &results) != VDB_OK || results.count == 0) {
+            c->failures++;
+        }
+        vdb_search_results_free(&results);
+
+        vdb_item_t item;
+        if (vdb_storage_get(c->storage, id, &item) != VDB_OK ||
+            memcmp(item.vector.data, data, sizeof(data)) != 0) {
+            c->failures++;
+        }
+        vdb_storage_item_free(&item);
+        c->queries++;
+    }
+    return NULL;
+}
+
+/**
+ * Test readers searching and getting rows while one writer appends,
+ * deletes, compacts and swaps the search pool: every committed row is
+ * found, whatever the writer is in the middle of
+ */
+TEST(storage_concurrent_readers) {
+    char dir[TEST_PATH_MAX];
+    ASSERT_EQ(0, test_make_temp_dir(dir));
+    vdb_storage_t *storage = NULL;
+    ASSERT_EQ(VDB_OK, vdb_storage_create(dir, "coll", CONC_DIM, VDB_METRIC_COSINE, &storage));
+    ASSERT_EQ(VDB_OK, vdb_storage_enable_hnsw(storage, NULL));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_segment_rows(storage, 64));
+    ASSERT_EQ(VDB_OK, vdb_storage_set_checkpoint_bytes(storage, 16 * 1024)); // checkpoints on the way
+
+    enum { READERS = 2 };
+    pthread_t readers[READERS];
+    concurrent_t *states[READERS];
+    for (int t = 0; t < READERS; t++) {
+        states[t] = (concurrent_t*)malloc(sizeof(concurrent_t));
+        ASSERT_NOT_NULL(states[t]);
+        states[t]->storage = storage;
+        atomic_init(&states[t]->appended, 0);
+        atomic_init(&states[t]->done, false);
+        states[t]->failures = 0;
+        states[t]->queries = 0;
+        pthread_create(&readers[t], NULL, concurrent_reader, states[t]);
+    }
+
+    float data[20][CONC_DIM];
+    char ids[20][32];
+    vdb_item_t items[20];
+    for (int first = 0; first < CONC_ROWS; first += 20) {
+        for (int i = 0; i < 20; i++) {
+            test_random_vector(data[i], CONC_DIM, (uint32_t)(first + i));
+            snprintf(ids[i], sizeof(ids[i]), "c-%d", first + i);
+            items[i].vector.dim = CONC_DIM;
+            items[i].vector.data = data[i];
+            items[i].metadata = NULL;
+            vdb_id_copy(ids[i], items[i].id);
+        }
+        ASSERT_EQ(VDB_OK, vdb_storage_append_batch(storage, items, 20));
+        for (int t = 0; t < READERS; t++) {
+            atomic_store(&states[t]->appended, first + 20);
+        }
+
+        if (first == 300) {
+            for (int row = 0; row < 100; row++) {
+                if (conc_deleted(row)) {
+                    char id[32];
+                    snprintf(id, sizeof(id), "c-%d", row);
+                    ASSERT_EQ(VDB_OK, vdb_storage_delete(storage, id));
+                }
+            }
+            ASSERT_EQ(VDB_OK, vdb_storage_compact(storage, 0));
+        }
+        if (first % 200 == 0) {
+            ASSERT_EQ(VDB_OK, vdb_storage_set_search_threads(storage, (uint32_t)(first / 200 % 2 + 1)));
+        }
+    }
+
+    int queries = 0;
+    for (int t = 0; t < READERS; t++) {
+        atomic_store(&states[t]->done, true);
+        pthread_join(readers[t], NULL);
+        ASSERT_EQ(0, states[t]->failures);
+        queries += states[t]->queries;
+        free(states[t]);
+    }
+    ASSERT_TRUE(queries > 0);
+    ASSERT_EQ(CONC_ROWS - 50, vdb_storage_count(storage));
+    ASSERT_EQ(CONC_ROWS - 50, vdb_storage_live_count(storage));
+
+    vdb_storage_close(&storage);
+    test_remove_dir(dir);
+}
@@ -6,6 +6,7 @@
 #include "vdb/types.h"
 #include "vdb/collection.h"
 #include <string.h>
+#include <stdint.h>
 
 /**
  * Test metric to string conversion
@@ -46,6 +47,7 @@ TEST(vector_create_free) {
     ASSERT_EQ(VDB_OK, status);
     ASSERT_EQ(128, vec.dim);
     ASSERT_NOT_NULL(vec.data);
+    ASSERT_EQ(0, (uintptr_t)vec.data % VDB_VECTOR_ALIGN);
 
     // data should be zero-initialized
     for (uint32_t i = 0; i < vec.dim; i++) {